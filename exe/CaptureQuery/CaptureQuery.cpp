@@ -0,0 +1,1429 @@
+/*++
+
+Module Name:
+
+    CaptureQuery.cpp
+
+Abstract:
+
+    Answers questions about capture files written by SendIoctlToFilter -w,
+    like the inter-arrival times of trackpad notifications or how many
+    writes went to an attribute, per connection.
+
+    The capture is memory mapped. The first run writes a sidecar index,
+    <capture>.idx, with the offset and time span of every capture window
+    and, per connection, ATT opcode and attribute handle, the windows
+    holding such packets. Queries then only decode the windows that can
+    match. The index is rebuilt when the capture grows.
+
+    -check writes a capture of generated windows instead, and compares the
+    index and a few hundred queries, answered with the index and again by
+    decoding every window, with the packets it wrote. It prints how long
+    indexing and querying took and exits with 2 on a wrong answer.
+
+Environment:
+
+    usermode console application
+
+--*/
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "capstream.h"
+#include "hci.h"
+
+#if !defined(_WIN32)
+typedef int BOOL;
+#define fopen_s(File, Path, Mode)   ((*(File) = fopen((Path), (Mode))) == NULL)
+#endif
+
+#define CAPINDEX_MAGIC      0x49435253  // 'SRCI'
+#define CAPINDEX_VERSION    1
+
+#define CAPINDEX_NO_HANDLE  0xFFFF
+#define CAPINDEX_NO_OPCODE  0xFFFF
+
+typedef struct _CAPINDEX_HEADER {
+
+	ULONG		Magic;
+	ULONG		Version;
+	ULONGLONG	CaptureSize;	// index is stale once the capture differs
+	ULONG		WindowCount;
+	ULONG		KeyCount;
+	ULONG		PostingCount;
+	ULONG		Reserved;
+
+} CAPINDEX_HEADER, *PCAPINDEX_HEADER;
+
+typedef struct _CAPINDEX_WINDOW {
+
+	ULONGLONG	Offset;			// of its window item in the capture
+	LONGLONG	FirstTime;
+	LONGLONG	LastTime;
+	ULONG		RecordCount;
+	ULONG		Reserved;
+
+} CAPINDEX_WINDOW, *PCAPINDEX_WINDOW;
+
+//
+// Packets with the same kind, direction, connection, ATT opcode and
+// attribute handle. Non ATT packets have CAPINDEX_NO_OPCODE, packets
+// without an attribute handle CAPINDEX_NO_HANDLE.
+//
+typedef struct _CAPINDEX_KEY {
+
+	UCHAR		KindDirection;	// kind | direction << 1
+	UCHAR		Reserved;
+	USHORT		Connection;
+	USHORT		Opcode;
+	USHORT		AttHandle;
+	ULONGLONG	Packets;
+	ULONG		FirstPosting;
+	ULONG		PostingCount;
+
+} CAPINDEX_KEY, *PCAPINDEX_KEY;
+
+typedef struct _CAPINDEX_POSTING {
+
+	ULONG		Window;
+	ULONG		Packets;
+
+} CAPINDEX_POSTING, *PCAPINDEX_POSTING;
+
+typedef struct _MAPPED_FILE {
+
+	const UCHAR *	Data;
+	ULONGLONG		Size;
+#if defined(_WIN32)
+	HANDLE			File;
+	HANDLE			Mapping;
+#else
+	int				File;
+#endif
+
+} MAPPED_FILE, *PMAPPED_FILE;
+
+typedef struct _QUERY {
+
+	LONGLONG	From;			// relative to the first packet, 100ns units
+	LONGLONG	To;
+	int			Direction;		// -1 for any
+	int			Connection;
+	int			Opcode;
+	int			AttHandle;
+	ULONG		MinLength;
+	ULONG		MaxLength;
+	LONGLONG	Gap;
+
+} QUERY, *PQUERY;
+
+//
+// Inter-arrival histogram buckets, powers of two microseconds.
+//
+#define HISTOGRAM_BUCKETS	24
+
+BOOL
+MapFile(
+	const char *	Path,
+	PMAPPED_FILE	Map
+)
+{
+	memset(Map, 0, sizeof(MAPPED_FILE));
+
+#if defined(_WIN32)
+	LARGE_INTEGER size;
+
+	Map->File = CreateFileA(Path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+	if (Map->File == INVALID_HANDLE_VALUE)
+		return FALSE;
+
+	if (!GetFileSizeEx(Map->File, &size) || size.QuadPart == 0) {
+		CloseHandle(Map->File);
+		return FALSE;
+	}
+	Map->Size = size.QuadPart;
+
+	Map->Mapping = CreateFileMapping(Map->File, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (Map->Mapping == NULL) {
+		CloseHandle(Map->File);
+		return FALSE;
+	}
+
+	Map->Data = (const UCHAR *)MapViewOfFile(Map->Mapping, FILE_MAP_READ, 0, 0, 0);
+	if (Map->Data == NULL) {
+		CloseHandle(Map->Mapping);
+		CloseHandle(Map->File);
+		return FALSE;
+	}
+#else
+	struct stat st;
+	void *data;
+
+	Map->File = open(Path, O_RDONLY);
+	if (Map->File < 0)
+		return FALSE;
+
+	if (fstat(Map->File, &st) != 0 || st.st_size == 0) {
+		close(Map->File);
+		return FALSE;
+	}
+	Map->Size = st.st_size;
+
+	data = mmap(NULL, (size_t)Map->Size, PROT_READ, MAP_SHARED, Map->File, 0);
+	if (data == MAP_FAILED) {
+		close(Map->File);
+		return FALSE;
+	}
+	Map->Data = (const UCHAR *)data;
+
+	madvise(data, (size_t)Map->Size, MADV_SEQUENTIAL);
+#endif
+
+	return TRUE;
+}
+
+VOID
+UnmapFile(
+	PMAPPED_FILE Map
+)
+{
+	if (Map->Data == NULL)
+		return;
+
+#if defined(_WIN32)
+	UnmapViewOfFile(Map->Data);
+	CloseHandle(Map->Mapping);
+	CloseHandle(Map->File);
+#else
+	munmap((void *)Map->Data, (size_t)Map->Size);
+	close(Map->File);
+#endif
+
+	Map->Data = NULL;
+}
+
+BOOL
+AttHasHandle(
+	UCHAR Opcode
+)
+{
+	switch (Opcode) {
+	case ATT_OP_READ_REQ:
+	case ATT_OP_READ_BLOB_REQ:
+	case ATT_OP_WRITE_REQ:
+	case ATT_OP_PREPARE_WRITE_REQ:
+	case ATT_OP_HANDLE_VALUE_NTF:
+	case ATT_OP_HANDLE_VALUE_IND:
+	case ATT_OP_WRITE_CMD:
+	case ATT_OP_SIGNED_WRITE_CMD:
+		return TRUE;
+	default:
+		return FALSE;
+	}
+}
+
+VOID
+GetKey(
+	const FILTER_CAPTURE_RECORD *	Record,
+	PCAPINDEX_KEY					Key
+)
+{
+	memset(Key, 0, sizeof(CAPINDEX_KEY));
+	Key->KindDirection = (UCHAR)((Record->Kind & 1) | ((Record->Direction & 1) << 1));
+	Key->Connection = CAPINDEX_NO_HANDLE;
+	Key->Opcode = CAPINDEX_NO_OPCODE;
+	Key->AttHandle = CAPINDEX_NO_HANDLE;
+
+	if (Record->Kind != TRACE_KIND_ACL || Record->CapturedLength < HCI_ACL_HEADER_LENGTH)
+		return;
+
+	Key->Connection = HCI_ACL_HANDLE(Record->Data);
+
+	if (!HCI_IS_ATT_PDU(Record->Data, Record->CapturedLength))
+		return;
+
+	Key->Opcode = Record->Data[ATT_PDU_OFFSET];
+
+	if (Record->CapturedLength >= ATT_PDU_OFFSET + 3 && AttHasHandle((UCHAR)Key->Opcode))
+		Key->AttHandle = (USHORT)(Record->Data[ATT_PDU_OFFSET + 1] | (Record->Data[ATT_PDU_OFFSET + 2] << 8));
+}
+
+ULONGLONG
+KeyId(
+	const CAPINDEX_KEY * Key
+)
+{
+	return ((ULONGLONG)Key->KindDirection << 48) | ((ULONGLONG)Key->Connection << 32) |
+		((ULONGLONG)Key->Opcode << 16) | Key->AttHandle;
+}
+
+//
+// Calls Callback for every record of the window at Offset.
+//
+template <typename CALLBACK_TYPE>
+BOOL
+DecodeWindow(
+	const MAPPED_FILE *	Capture,
+	ULONGLONG			Offset,
+	CALLBACK_TYPE		Callback
+)
+{
+	CAPSTREAM_STATE			state;
+	FILTER_CAPTURE_HEADER	window;
+	FILTER_CAPTURE_RECORD	record;
+	UCHAR					type;
+	BOOL					first = TRUE;
+
+	CapStreamInit(&state);
+
+	while (Offset < Capture->Size) {
+		ULONGLONG available = Capture->Size - Offset;
+		LONG n = CapStreamDecode(&state, Capture->Data + Offset,
+			(ULONG)min(available, (ULONGLONG)0x10000), &type, &window, &record);
+
+		if (n <= 0)
+			return n == CAPSTREAM_NEED_MORE;	// a capture being appended to ends short
+
+		if (type == CAPSTREAM_ITEM_WINDOW) {
+			if (!first)
+				return TRUE;
+			first = FALSE;
+		} else {
+			Callback(record);
+		}
+
+		Offset += n;
+	}
+
+	return TRUE;
+}
+
+BOOL
+BuildIndex(
+	const MAPPED_FILE *	Capture,
+	const char *		IndexPath
+)
+{
+	std::vector<CAPINDEX_WINDOW>	windows;
+	std::vector<CAPINDEX_KEY>		keys;
+	std::map<ULONGLONG, ULONG>		keyIds;
+	std::vector<std::vector<CAPINDEX_POSTING> > postings;
+	CAPINDEX_HEADER	header;
+	ULONGLONG		offset = sizeof(CAPSTREAM_FILE_HEADER);
+	ULONG			postingCount = 0;
+	FILE *			file;
+
+	//
+	// Walk the windows, decoding each to count its packets per key.
+	//
+	while (offset < Capture->Size) {
+		CAPSTREAM_STATE			state;
+		FILTER_CAPTURE_HEADER	window;
+		FILTER_CAPTURE_RECORD	record;
+		UCHAR					type;
+		CAPINDEX_WINDOW			entry;
+		ULONG					windowIndex = (ULONG)windows.size();
+		LONG					n;
+
+		CapStreamInit(&state);
+
+		n = CapStreamDecode(&state, Capture->Data + offset,
+			(ULONG)min(Capture->Size - offset, (ULONGLONG)0x10000), &type, &window, &record);
+		if (n <= 0 || type != CAPSTREAM_ITEM_WINDOW) {
+			if (n == CAPSTREAM_CORRUPT || (n > 0 && type != CAPSTREAM_ITEM_WINDOW))
+				printf("Capture corrupt at offset %llu, indexed up to there\n", (unsigned long long)offset);
+			break;
+		}
+
+		memset(&entry, 0, sizeof(entry));
+		entry.Offset = offset;
+		entry.FirstTime = window.TriggerTime;
+		entry.LastTime = window.TriggerTime;
+
+		offset += n;
+
+		while (offset < Capture->Size) {
+			n = CapStreamDecode(&state, Capture->Data + offset,
+				(ULONG)min(Capture->Size - offset, (ULONGLONG)0x10000), &type, &window, &record);
+			if (n <= 0 || type == CAPSTREAM_ITEM_WINDOW)
+				break;
+
+			CAPINDEX_KEY key;
+			GetKey(&record, &key);
+
+			std::map<ULONGLONG, ULONG>::iterator it = keyIds.find(KeyId(&key));
+			ULONG keyIndex;
+
+			if (it == keyIds.end()) {
+				keyIndex = (ULONG)keys.size();
+				keyIds[KeyId(&key)] = keyIndex;
+				keys.push_back(key);
+				postings.push_back(std::vector<CAPINDEX_POSTING>());
+			} else {
+				keyIndex = it->second;
+			}
+
+			keys[keyIndex].Packets++;
+
+			std::vector<CAPINDEX_POSTING> & list = postings[keyIndex];
+			if (list.empty() || list.back().Window != windowIndex) {
+				CAPINDEX_POSTING posting = { windowIndex, 0 };
+				list.push_back(posting);
+				postingCount++;
+			}
+			list.back().Packets++;
+
+			if (entry.RecordCount == 0 || record.Time < entry.FirstTime)
+				entry.FirstTime = record.Time;
+			if (entry.RecordCount == 0 || record.Time > entry.LastTime)
+				entry.LastTime = record.Time;
+			entry.RecordCount++;
+
+			offset += n;
+		}
+
+		windows.push_back(entry);
+
+		if (n < 0) {
+			printf("Capture corrupt at offset %llu, indexed up to there\n", (unsigned long long)offset);
+			break;
+		}
+		if (n == CAPSTREAM_NEED_MORE)
+			break;
+	}
+
+	if (fopen_s(&file, IndexPath, "wb") != 0) {
+		printf("Failed to create %s\n", IndexPath);
+		return FALSE;
+	}
+
+	memset(&header, 0, sizeof(header));
+	header.Magic = CAPINDEX_MAGIC;
+	header.Version = CAPINDEX_VERSION;
+	header.CaptureSize = Capture->Size;
+	header.WindowCount = (ULONG)windows.size();
+	header.KeyCount = (ULONG)keys.size();
+	header.PostingCount = postingCount;
+
+	postingCount = 0;
+	for (size_t i = 0; i < keys.size(); i++) {
+		keys[i].FirstPosting = postingCount;
+		keys[i].PostingCount = (ULONG)postings[i].size();
+		postingCount += keys[i].PostingCount;
+	}
+
+	fwrite(&header, sizeof(header), 1, file);
+	if (!windows.empty())
+		fwrite(&windows[0], sizeof(CAPINDEX_WINDOW), windows.size(), file);
+	if (!keys.empty())
+		fwrite(&keys[0], sizeof(CAPINDEX_KEY), keys.size(), file);
+	for (size_t i = 0; i < postings.size(); i++)
+		fwrite(&postings[i][0], sizeof(CAPINDEX_POSTING), postings[i].size(), file);
+
+	fclose(file);
+
+	printf("Indexed %lu windows, %lu keys\n", (unsigned long)header.WindowCount, (unsigned long)header.KeyCount);
+
+	return TRUE;
+}
+
+BOOL
+OpenIndex(
+	const MAPPED_FILE *	Capture,
+	const char *		IndexPath,
+	PMAPPED_FILE		Index
+)
+{
+	for (int attempt = 0; attempt < 2; attempt++) {
+		if (MapFile(IndexPath, Index)) {
+			PCAPINDEX_HEADER header = (PCAPINDEX_HEADER)Index->Data;
+
+			if (Index->Size >= sizeof(CAPINDEX_HEADER) &&
+				header->Magic == CAPINDEX_MAGIC &&
+				header->Version == CAPINDEX_VERSION &&
+				header->CaptureSize == Capture->Size &&
+				Index->Size == sizeof(CAPINDEX_HEADER) +
+					(ULONGLONG)header->WindowCount * sizeof(CAPINDEX_WINDOW) +
+					(ULONGLONG)header->KeyCount * sizeof(CAPINDEX_KEY) +
+					(ULONGLONG)header->PostingCount * sizeof(CAPINDEX_POSTING))
+				return TRUE;
+
+			UnmapFile(Index);
+		}
+
+		if (attempt == 0 && !BuildIndex(Capture, IndexPath))
+			return FALSE;
+	}
+
+	return FALSE;
+}
+
+BOOL
+KeyMatches(
+	const CAPINDEX_KEY *	Key,
+	const QUERY *			Query
+)
+{
+	if (Key->KindDirection & 1)		// HCI events carry no connection data we query
+		return Query->Connection < 0 && Query->Opcode < 0 && Query->AttHandle < 0 &&
+			(Query->Direction < 0 || Query->Direction == (Key->KindDirection >> 1));
+
+	return (Query->Direction < 0 || Query->Direction == (Key->KindDirection >> 1)) &&
+		(Query->Connection < 0 || Query->Connection == Key->Connection) &&
+		(Query->Opcode < 0 || Query->Opcode == Key->Opcode) &&
+		(Query->AttHandle < 0 || Query->AttHandle == Key->AttHandle);
+}
+
+VOID
+PrintSummary(
+	const MAPPED_FILE * Index
+)
+{
+	PCAPINDEX_HEADER	header = (PCAPINDEX_HEADER)Index->Data;
+	PCAPINDEX_WINDOW	windows = (PCAPINDEX_WINDOW)(header + 1);
+	PCAPINDEX_KEY		keys = (PCAPINDEX_KEY)(windows + header->WindowCount);
+	std::vector<CAPINDEX_KEY> sorted(keys, keys + header->KeyCount);
+
+	std::sort(sorted.begin(), sorted.end(), [](const CAPINDEX_KEY & a, const CAPINDEX_KEY & b) {
+		return a.Connection != b.Connection ? a.Connection < b.Connection : KeyId(&a) < KeyId(&b);
+	});
+
+	printf("\n%lu windows\n\n", (unsigned long)header->WindowCount);
+	printf("  conn  dir kind  op    att     packets windows\n");
+
+	for (size_t i = 0; i < sorted.size(); i++) {
+		const CAPINDEX_KEY & key = sorted[i];
+
+		if (key.Connection == CAPINDEX_NO_HANDLE)
+			printf("     -");
+		else
+			printf("  %03x ", key.Connection);
+
+		printf(" %s %s", key.KindDirection & 2 ? "in " : "out", key.KindDirection & 1 ? "evt " : "acl ");
+
+		if (key.Opcode == CAPINDEX_NO_OPCODE)
+			printf("    -");
+		else
+			printf(" 0x%02x", key.Opcode);
+
+		if (key.AttHandle == CAPINDEX_NO_HANDLE)
+			printf("      -");
+		else
+			printf(" 0x%04x", key.AttHandle);
+
+		printf(" %11llu %7lu\n", (unsigned long long)key.Packets, (unsigned long)key.PostingCount);
+	}
+}
+
+typedef struct _QUERY_RESULT {
+
+	ULONGLONG			Packets;
+	ULONG				Windows;		// decoded
+	ULONG				Gaps;
+	LONGLONG			Span;			// from the first to the last packet of each window, summed
+	ULONGLONG			Histogram[HISTOGRAM_BUCKETS];
+	std::vector<ULONG>	Intervals;		// microseconds, sorted
+
+} QUERY_RESULT, *PQUERY_RESULT;
+
+//
+// Decodes the windows that can hold packets of Query, or with Scan every
+// window, and counts the packets that match. Gaps are listed with
+// PrintGaps.
+//
+VOID
+QueryCapture(
+	const MAPPED_FILE *	Capture,
+	const MAPPED_FILE *	Index,
+	const QUERY *		Query,
+	BOOL				Scan,
+	BOOL				PrintGaps,
+	PQUERY_RESULT		Result
+)
+{
+	PCAPINDEX_HEADER	header = (PCAPINDEX_HEADER)Index->Data;
+	PCAPINDEX_WINDOW	windows = (PCAPINDEX_WINDOW)(header + 1);
+	PCAPINDEX_KEY		keys = (PCAPINDEX_KEY)(windows + header->WindowCount);
+	PCAPINDEX_POSTING	postings = (PCAPINDEX_POSTING)(keys + header->KeyCount);
+	std::vector<ULONG>	selected;
+	LONGLONG			base = 0;
+
+	Result->Packets = 0;
+	Result->Windows = 0;
+	Result->Gaps = 0;
+	Result->Span = 0;
+	memset(Result->Histogram, 0, sizeof(Result->Histogram));
+	Result->Intervals.clear();
+
+	if (header->WindowCount == 0)
+		return;
+
+	//
+	// Times are relative to the start of the first window.
+	//
+	base = windows[0].FirstTime;
+	for (ULONG i = 1; i < header->WindowCount; i++)
+		base = min(base, windows[i].FirstTime);
+
+	//
+	// Windows holding a matching key and overlapping the time range, the
+	// only ones decoded.
+	//
+	for (ULONG k = 0; k < header->KeyCount && !Scan; k++) {
+		if (!KeyMatches(&keys[k], Query))
+			continue;
+
+		for (ULONG p = 0; p < keys[k].PostingCount; p++) {
+			ULONG w = postings[keys[k].FirstPosting + p].Window;
+
+			if (w < header->WindowCount &&
+				windows[w].LastTime - base >= Query->From &&
+				windows[w].FirstTime - base <= Query->To)
+				selected.push_back(w);
+		}
+	}
+
+	for (ULONG w = 0; w < header->WindowCount && Scan; w++)
+		selected.push_back(w);
+
+	std::sort(selected.begin(), selected.end());
+	selected.erase(std::unique(selected.begin(), selected.end()), selected.end());
+
+	for (size_t i = 0; i < selected.size(); i++) {
+		LONGLONG last = 0;
+		LONGLONG first = 0;
+
+		DecodeWindow(Capture, windows[selected[i]].Offset, [&](const FILTER_CAPTURE_RECORD & record) {
+			CAPINDEX_KEY key;
+			LONGLONG time = record.Time - base;
+
+			if (time < Query->From || time > Query->To ||
+				record.Length < Query->MinLength || record.Length > Query->MaxLength)
+				return;
+
+			GetKey(&record, &key);
+			if (!KeyMatches(&key, Query))
+				return;
+
+			Result->Packets++;
+
+			if (last != 0) {
+				LONGLONG interval = record.Time - last;
+				ULONG us = (ULONG)min(interval / 10, (LONGLONG)0xFFFFFFFF);
+				ULONG bucket = 0;
+
+				while (bucket + 1 < HISTOGRAM_BUCKETS && (1UL << (bucket + 1)) <= us)
+					bucket++;
+
+				Result->Histogram[bucket]++;
+				Result->Intervals.push_back(us);
+
+				if (Query->Gap != 0 && interval > Query->Gap) {
+					Result->Gaps++;
+					if (PrintGaps)
+						printf("  gap of %.3f ms at %.3f ms on connection 0x%03x\n",
+							interval / 10000.0, (last - base) / 10000.0, key.Connection);
+				}
+			} else {
+				first = record.Time;
+			}
+
+			last = record.Time;
+		});
+
+		//
+		// Windows are discontiguous, so rates only count the time inside them.
+		//
+		Result->Span += last - first;
+	}
+
+	Result->Windows = (ULONG)selected.size();
+
+	std::sort(Result->Intervals.begin(), Result->Intervals.end());
+}
+
+int
+RunQuery(
+	const MAPPED_FILE *	Capture,
+	const MAPPED_FILE *	Index,
+	const QUERY *		Query
+)
+{
+	PCAPINDEX_HEADER	header = (PCAPINDEX_HEADER)Index->Data;
+	QUERY_RESULT		result;
+
+	if (header->WindowCount == 0) {
+		printf("Capture holds no windows\n");
+		return 0;
+	}
+
+	QueryCapture(Capture, Index, Query, FALSE, TRUE, &result);
+
+	printf("\n%llu packets in %lu of %lu windows", (unsigned long long)result.Packets,
+		(unsigned long)result.Windows, (unsigned long)header->WindowCount);
+	if (result.Span > 0)
+		printf(", %.1f packets/s while capturing", result.Intervals.size() * 10000000.0 / result.Span);
+	printf("\n");
+
+	if (Query->Gap != 0)
+		printf("%lu gaps over %.3f ms\n", (unsigned long)result.Gaps, Query->Gap / 10000.0);
+
+	if (result.Intervals.empty())
+		return 0;
+
+	std::vector<ULONG> & intervals = result.Intervals;
+
+	printf("Inter-arrival p50 %lu us, p90 %lu us, p99 %lu us, max %lu us\n",
+		(unsigned long)intervals[intervals.size() / 2],
+		(unsigned long)intervals[intervals.size() * 90 / 100],
+		(unsigned long)intervals[intervals.size() * 99 / 100],
+		(unsigned long)intervals.back());
+
+	for (ULONG b = 0; b < HISTOGRAM_BUCKETS; b++) {
+		if (result.Histogram[b] == 0)
+			continue;
+
+		printf("  %8lu us %10llu ", b == 0 ? 0UL : 1UL << b, (unsigned long long)result.Histogram[b]);
+		for (ULONGLONG j = 0; j < result.Histogram[b] * 50 / intervals.size(); j++)
+			printf("#");
+		printf("\n");
+	}
+
+	return 0;
+}
+
+//
+// With -check, a capture of known packets is written and every query is
+// compared with what the generator put in.
+//
+typedef struct _CHECK_PACKET {
+
+	LONGLONG	Time;
+	ULONG		Window;
+	USHORT		Length;
+	UCHAR		KindDirection;
+	UCHAR		Reserved;
+	USHORT		Connection;
+	USHORT		Opcode;
+	USHORT		AttHandle;
+
+} CHECK_PACKET, *PCHECK_PACKET;
+
+typedef struct _CHECK_CAPTURE {
+
+	ULONGLONG					Random;
+	LONGLONG					Time;
+	ULONG						Windows;
+	std::vector<CHECK_PACKET>	Packets;
+
+} CHECK_CAPTURE, *PCHECK_CAPTURE;
+
+ULONG
+CheckRandom(
+	PCHECK_CAPTURE Check
+)
+{
+	Check->Random ^= Check->Random << 13;
+	Check->Random ^= Check->Random >> 7;
+	Check->Random ^= Check->Random << 17;
+
+	return (ULONG)(Check->Random >> 32);
+}
+
+//
+// Fills Record with a packet like the remote and the stack exchange:
+// trackpad and voice notifications, writes, their responses, HCI events,
+// another channel and continuation fragments, and notes what it is.
+//
+VOID
+CheckPacket(
+	PCHECK_CAPTURE			Check,
+	USHORT					Connection,
+	PFILTER_CAPTURE_RECORD	Record,
+	PCHECK_PACKET			Packet
+)
+{
+	ULONG	type = CheckRandom(Check) % 16;
+	ULONG	length;
+	UCHAR	data[128];
+
+	memset(data, 0, sizeof(data));
+
+	Packet->Connection = Connection;
+	Packet->Opcode = CAPINDEX_NO_OPCODE;
+	Packet->AttHandle = CAPINDEX_NO_HANDLE;
+
+	Record->Kind = TRACE_KIND_ACL;
+	Record->Direction = HCI_DIRECTION_IN;
+
+	if (type == 0) {
+		//
+		// Number of completed packets
+		//
+		data[0] = 0x13;
+		data[1] = 5;
+		data[2] = 1;
+		data[3] = (UCHAR)Connection;
+		data[4] = (UCHAR)(Connection >> 8);
+		data[5] = 1;
+		length = 7;
+		Record->Kind = TRACE_KIND_HCI_EVENT;
+		Packet->Connection = CAPINDEX_NO_HANDLE;
+	} else {
+		USHORT	cid = L2CAP_CID_ATT;
+		UCHAR	pb = HCI_ACL_PB_FIRST_FLUSHABLE;
+		UCHAR	opcode = 0;
+		USHORT	handle = CAPINDEX_NO_HANDLE;
+
+		if (type <= 8) {
+			opcode = ATT_OP_HANDLE_VALUE_NTF;
+			handle = 0x2b;
+			length = ATT_PDU_OFFSET + 3 + 2 + CheckRandom(Check) % 8;
+		} else if (type <= 10) {
+			opcode = ATT_OP_HANDLE_VALUE_NTF;
+			handle = 0x23;
+			length = ATT_PDU_OFFSET + 3 + 97;
+		} else if (type == 11) {
+			opcode = ATT_OP_WRITE_CMD;
+			handle = 0x2b;
+			length = ATT_PDU_OFFSET + 3 + 2;
+			Record->Direction = HCI_DIRECTION_OUT;
+		} else if (type == 12) {
+			opcode = ATT_OP_WRITE_REQ;
+			handle = 0x24;
+			length = ATT_PDU_OFFSET + 3 + 2;
+			Record->Direction = HCI_DIRECTION_OUT;
+		} else if (type == 13) {
+			opcode = ATT_OP_WRITE_RSP;
+			length = ATT_PDU_OFFSET + 1;
+		} else if (type == 14) {
+			cid = 0x0005;
+			length = ATT_PDU_OFFSET + 6;
+		} else {
+			pb = HCI_ACL_PB_CONTINUING;		// looks like ATT, isn't
+			opcode = ATT_OP_HANDLE_VALUE_NTF;
+			handle = 0x2b;
+			length = ATT_PDU_OFFSET + 3 + 10;
+		}
+
+		data[0] = (UCHAR)Connection;
+		data[1] = (UCHAR)((Connection >> 8) | (pb << 4));
+		data[2] = (UCHAR)(length - HCI_ACL_HEADER_LENGTH);
+		data[3] = (UCHAR)((length - HCI_ACL_HEADER_LENGTH) >> 8);
+		data[4] = (UCHAR)(length - ATT_PDU_OFFSET);
+		data[5] = (UCHAR)((length - ATT_PDU_OFFSET) >> 8);
+		data[6] = (UCHAR)cid;
+		data[7] = (UCHAR)(cid >> 8);
+		data[ATT_PDU_OFFSET] = opcode;
+		if (handle != CAPINDEX_NO_HANDLE) {
+			data[ATT_PDU_OFFSET + 1] = (UCHAR)handle;
+			data[ATT_PDU_OFFSET + 2] = (UCHAR)(handle >> 8);
+		}
+
+		//
+		// A few payload bytes change, like trackpad coordinates.
+		//
+		for (ULONG i = ATT_PDU_OFFSET + 3; i < length && i < ATT_PDU_OFFSET + 7; i++)
+			data[i] = (UCHAR)CheckRandom(Check);
+
+		if (cid == L2CAP_CID_ATT && pb != HCI_ACL_PB_CONTINUING) {
+			Packet->Opcode = opcode;
+			Packet->AttHandle = handle;
+		}
+	}
+
+	Record->Length = (USHORT)length;
+	Record->CapturedLength = (USHORT)min(length, (ULONG)FILTER_CAPTURE_SNAPLEN);
+	Record->Reserved = 0;
+	memcpy(Record->Data, data, Record->CapturedLength);
+
+	Packet->Length = Record->Length;
+	Packet->KindDirection = (UCHAR)(Record->Kind | (Record->Direction << 1));
+}
+
+//
+// Appends Windows capture windows to Path, the way SendIoctlToFilter -w
+// does, of 1 to 128 packets 1 to 20 ms apart with now and then a stall, on
+// one to three connections.
+//
+BOOL
+CheckWriteCapture(
+	const char *	Path,
+	ULONG			Windows,
+	PCHECK_CAPTURE	Check
+)
+{
+	std::vector<FILTER_CAPTURE_RECORD>	records;
+	CAPSTREAM_FILE_HEADER	fileHeader;
+	UCHAR	item[CAPSTREAM_MAX_ITEM_SIZE];
+	FILE *	file;
+
+	if (fopen_s(&file, Path, "ab") != 0) {
+		printf("Failed to open %s\n", Path);
+		return FALSE;
+	}
+
+	fseek(file, 0, SEEK_END);
+	if (ftell(file) == 0) {
+		fileHeader.Magic = CAPSTREAM_FILE_MAGIC;
+		fileHeader.Version = CAPSTREAM_FILE_VERSION;
+		fwrite(&fileHeader, sizeof(fileHeader), 1, file);
+	}
+
+	for (ULONG w = 0; w < Windows; w++) {
+		CAPSTREAM_STATE			state;
+		FILTER_CAPTURE_HEADER	header;
+		ULONG	count = 1 + CheckRandom(Check) % 128;
+		ULONG	connections = 1 + CheckRandom(Check) % 3;
+		USHORT	first = (USHORT)(0x40 + CheckRandom(Check) % 8);
+
+		records.resize(count);
+
+		Check->Time += 5000000 + CheckRandom(Check) % 45000000;
+
+		for (ULONG i = 0; i < count; i++) {
+			CHECK_PACKET packet;
+
+			if (i != 0)
+				Check->Time += CheckRandom(Check) % 32 == 0 ? 1500000 : 10000 + CheckRandom(Check) % 190000;
+
+			memset(&packet, 0, sizeof(packet));
+			CheckPacket(Check, (USHORT)(0x40 + (first - 0x40 + CheckRandom(Check) % connections) % 8),
+				&records[i], &packet);
+
+			records[i].Time = Check->Time;
+			packet.Time = Check->Time;
+			packet.Window = Check->Windows;
+			Check->Packets.push_back(packet);
+		}
+
+		memset(&header, 0, sizeof(header));
+		header.State = FILTER_CAPTURE_FROZEN;
+		header.Trigger = FILTER_CAPTURE_TRIGGER_NOTIFICATION_GAP;
+		header.TriggerHandle = first;
+		header.RecordCount = count;
+		header.TriggerRecord = count / 2;
+		header.TriggerTime = records[count / 2].Time;
+
+		CapStreamInit(&state);
+
+		fwrite(item, 1, CapStreamEncodeWindow(&state, &header, item, sizeof(item)), file);
+		for (ULONG i = 0; i < count; i++)
+			fwrite(item, 1, CapStreamEncode(&state, &records[i], item, sizeof(item)), file);
+
+		Check->Windows++;
+	}
+
+	fclose(file);
+
+	return TRUE;
+}
+
+//
+// Whether the generator's Packet is one Query asks for, worked out from
+// what was generated rather than from the index keys.
+//
+BOOL
+CheckMatches(
+	const CHECK_PACKET *	Packet,
+	const QUERY *			Query
+)
+{
+	if (Query->Direction >= 0 && Query->Direction != (Packet->KindDirection >> 1))
+		return FALSE;
+
+	if ((Packet->KindDirection & 1) == TRACE_KIND_HCI_EVENT)
+		return Query->Connection < 0 && Query->Opcode < 0 && Query->AttHandle < 0;
+
+	return (Query->Connection < 0 || Query->Connection == Packet->Connection) &&
+		(Query->Opcode < 0 || Query->Opcode == Packet->Opcode) &&
+		(Query->AttHandle < 0 || Query->AttHandle == Packet->AttHandle);
+}
+
+//
+// What QueryCapture should find: the windows with a packet of the query
+// that overlap its time range, and in them the packets also within the
+// range and lengths.
+//
+VOID
+CheckExpected(
+	const CHECK_CAPTURE *	Check,
+	const QUERY *			Query,
+	PQUERY_RESULT			Result
+)
+{
+	const std::vector<CHECK_PACKET> & packets = Check->Packets;
+	LONGLONG	base = packets[0].Time;
+	size_t		i = 0;
+
+	Result->Packets = 0;
+	Result->Windows = 0;
+	Result->Gaps = 0;
+	Result->Span = 0;
+	memset(Result->Histogram, 0, sizeof(Result->Histogram));
+	Result->Intervals.clear();
+
+	while (i < packets.size()) {
+		size_t		end = i;
+		BOOL		holds = FALSE;
+		LONGLONG	first = 0;
+		LONGLONG	last = 0;
+
+		while (end < packets.size() && packets[end].Window == packets[i].Window)
+			holds |= CheckMatches(&packets[end++], Query);
+
+		if (!holds || packets[end - 1].Time - base < Query->From || packets[i].Time - base > Query->To) {
+			i = end;
+			continue;
+		}
+
+		Result->Windows++;
+
+		for (; i < end; i++) {
+			const CHECK_PACKET & packet = packets[i];
+
+			if (packet.Time - base < Query->From || packet.Time - base > Query->To ||
+				packet.Length < Query->MinLength || packet.Length > Query->MaxLength ||
+				!CheckMatches(&packet, Query))
+				continue;
+
+			Result->Packets++;
+
+			if (first == 0) {
+				first = last = packet.Time;
+				continue;
+			}
+
+			ULONG us = (ULONG)((packet.Time - last) / 10);
+			ULONG bucket = 0;
+
+			for (ULONG v = us; v > 1 && bucket + 1 < HISTOGRAM_BUCKETS; v >>= 1)
+				bucket++;
+
+			Result->Histogram[bucket]++;
+			Result->Intervals.push_back(us);
+
+			if (Query->Gap != 0 && packet.Time - last > Query->Gap)
+				Result->Gaps++;
+
+			last = packet.Time;
+		}
+
+		Result->Span += last - first;
+	}
+
+	std::sort(Result->Intervals.begin(), Result->Intervals.end());
+}
+
+//
+// Compares the index with the generated packets: every window's span and
+// record count, and per key the packets and the windows holding them.
+//
+ULONG
+CheckIndex(
+	const CHECK_CAPTURE *	Check,
+	const MAPPED_FILE *		Index
+)
+{
+	PCAPINDEX_HEADER	header = (PCAPINDEX_HEADER)Index->Data;
+	PCAPINDEX_WINDOW	windows = (PCAPINDEX_WINDOW)(header + 1);
+	PCAPINDEX_KEY		keys = (PCAPINDEX_KEY)(windows + header->WindowCount);
+	PCAPINDEX_POSTING	postings = (PCAPINDEX_POSTING)(keys + header->KeyCount);
+	std::map<ULONGLONG, std::map<ULONG, ULONG> > expected;
+	std::vector<CAPINDEX_WINDOW>	spans(Check->Windows);
+	ULONG	wrong = 0;
+
+	for (size_t i = 0; i < Check->Packets.size(); i++) {
+		const CHECK_PACKET & packet = Check->Packets[i];
+		CAPINDEX_WINDOW & span = spans[packet.Window];
+		CAPINDEX_KEY key;
+
+		memset(&key, 0, sizeof(key));
+		key.KindDirection = packet.KindDirection;
+		key.Connection = packet.Connection;
+		key.Opcode = packet.Opcode;
+		key.AttHandle = packet.AttHandle;
+		expected[KeyId(&key)][packet.Window]++;
+
+		if (span.RecordCount++ == 0)
+			span.FirstTime = packet.Time;
+		span.LastTime = packet.Time;
+	}
+
+	if (header->WindowCount != Check->Windows || header->KeyCount != expected.size()) {
+		printf("Index holds %lu windows and %lu keys, expected %lu and %lu\n",
+			(unsigned long)header->WindowCount, (unsigned long)header->KeyCount,
+			(unsigned long)Check->Windows, (unsigned long)expected.size());
+		return 1;
+	}
+
+	for (ULONG w = 0; w < header->WindowCount; w++) {
+		if (windows[w].FirstTime != spans[w].FirstTime || windows[w].LastTime != spans[w].LastTime ||
+			windows[w].RecordCount != spans[w].RecordCount) {
+			if (wrong++ < 8)
+				printf("  window %lu indexed with %lu records, expected %lu\n", (unsigned long)w,
+					(unsigned long)windows[w].RecordCount, (unsigned long)spans[w].RecordCount);
+		}
+	}
+
+	for (ULONG k = 0; k < header->KeyCount; k++) {
+		std::map<ULONGLONG, std::map<ULONG, ULONG> >::const_iterator it = expected.find(KeyId(&keys[k]));
+		ULONGLONG packets = 0;
+		BOOL right = it != expected.end() && keys[k].PostingCount == it->second.size();
+
+		if (right) {
+			std::map<ULONG, ULONG>::const_iterator window = it->second.begin();
+
+			for (ULONG p = 0; p < keys[k].PostingCount; p++, window++) {
+				const CAPINDEX_POSTING & posting = postings[keys[k].FirstPosting + p];
+
+				right &= posting.Window == window->first && posting.Packets == window->second;
+				packets += window->second;
+			}
+
+			right &= keys[k].Packets == packets;
+		}
+
+		if (!right && wrong++ < 8)
+			printf("  key conn 0x%03x op 0x%02x att 0x%04x indexed with %llu packets in %lu windows, expected %llu\n",
+				keys[k].Connection, keys[k].Opcode, keys[k].AttHandle, (unsigned long long)keys[k].Packets,
+				(unsigned long)keys[k].PostingCount, (unsigned long long)packets);
+	}
+
+	return wrong;
+}
+
+BOOL
+CheckSameResult(
+	const QUERY_RESULT *	Result,
+	const QUERY_RESULT *	Expected,
+	BOOL					Windows
+)
+{
+	return Result->Packets == Expected->Packets &&
+		(!Windows || Result->Windows == Expected->Windows) &&
+		Result->Gaps == Expected->Gaps &&
+		Result->Span == Expected->Span &&
+		Result->Intervals == Expected->Intervals &&
+		!memcmp(Result->Histogram, Expected->Histogram, sizeof(Result->Histogram));
+}
+
+double
+CheckMilliseconds(
+	std::chrono::steady_clock::time_point Since
+)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Since).count();
+}
+
+//
+// Runs the usage example, a few fixed queries and Queries random ones
+// against the index, and again decoding every window, and compares both
+// with the generator. Returns the number of wrong results.
+//
+ULONG
+CheckQueries(
+	PCHECK_CAPTURE			Check,
+	const MAPPED_FILE *		Capture,
+	const MAPPED_FILE *		Index,
+	ULONG					Queries,
+	double *				IndexedMs,
+	double *				ScanMs
+)
+{
+	LONGLONG	length = Check->Packets.back().Time - Check->Packets[0].Time;
+	ULONG		wrong = 0;
+
+	for (ULONG q = 0; q < Queries + 6; q++) {
+		QUERY			query;
+		QUERY_RESULT	expected;
+		QUERY_RESULT	indexed;
+		QUERY_RESULT	scanned;
+
+		memset(&query, 0, sizeof(query));
+		query.To = 0x7FFFFFFFFFFFFFFFLL;
+		query.Direction = query.Connection = query.Opcode = query.AttHandle = -1;
+		query.MaxLength = 0xFFFF;
+
+		switch (q) {
+		case 0:		// everything
+			break;
+		case 1:		// trackpad and button notifications
+			query.Direction = HCI_DIRECTION_IN;
+			query.Opcode = ATT_OP_HANDLE_VALUE_NTF;
+			query.AttHandle = 0x2b;
+			query.MaxLength = 30;
+			query.Gap = 500000;
+			break;
+		case 2:
+			query.Direction = HCI_DIRECTION_OUT;
+			query.Connection = 0x41;
+			break;
+		case 3:
+			query.Opcode = ATT_OP_WRITE_RSP;
+			break;
+		case 4:		// no such packets
+			query.AttHandle = 0x99;
+			break;
+		case 5:		// from the end of the first window to the start of the last
+			for (size_t i = 0; i < Check->Packets.size(); i++) {
+				if (Check->Packets[i].Window == 0)
+					query.From = Check->Packets[i].Time - Check->Packets[0].Time;
+				if (Check->Packets[i].Window == Check->Windows - 1 && query.To > length)
+					query.To = Check->Packets[i].Time - Check->Packets[0].Time;
+			}
+			break;
+		default:
+			if (CheckRandom(Check) % 2)
+				query.Direction = CheckRandom(Check) % 2;
+			if (CheckRandom(Check) % 2)
+				query.Connection = 0x40 + CheckRandom(Check) % 9;
+			if (CheckRandom(Check) % 2) {
+				const int opcodes[] = { ATT_OP_HANDLE_VALUE_NTF, ATT_OP_WRITE_CMD, ATT_OP_WRITE_REQ, ATT_OP_WRITE_RSP };
+				query.Opcode = opcodes[CheckRandom(Check) % 4];
+			}
+			if (CheckRandom(Check) % 2) {
+				const int handles[] = { 0x23, 0x24, 0x2b };
+				query.AttHandle = handles[CheckRandom(Check) % 3];
+			}
+			if (CheckRandom(Check) % 2) {
+				query.MinLength = CheckRandom(Check) % 32;
+				query.MaxLength = query.MinLength + CheckRandom(Check) % 100;
+			}
+			if (CheckRandom(Check) % 2) {
+				query.From = (LONGLONG)(CheckRandom(Check) % 1000) * length / 1000;
+				query.To = query.From + (LONGLONG)(CheckRandom(Check) % 1000) * length / 4000;
+			}
+			if (CheckRandom(Check) % 2)
+				query.Gap = 10000 + CheckRandom(Check) % 2000000;
+			break;
+		}
+
+		CheckExpected(Check, &query, &expected);
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		QueryCapture(Capture, Index, &query, FALSE, FALSE, &indexed);
+		*IndexedMs += CheckMilliseconds(start);
+
+		start = std::chrono::steady_clock::now();
+		QueryCapture(Capture, Index, &query, TRUE, FALSE, &scanned);
+		*ScanMs += CheckMilliseconds(start);
+
+		if (CheckSameResult(&indexed, &expected, TRUE) && CheckSameResult(&scanned, &expected, FALSE))
+			continue;
+
+		if (wrong++ < 8)
+			printf("  query %lu: %llu packets in %lu windows, %lu gaps with the index, %llu packets, %lu gaps decoding every window, expected %llu packets in %lu windows, %lu gaps\n",
+				(unsigned long)q, (unsigned long long)indexed.Packets, (unsigned long)indexed.Windows,
+				(unsigned long)indexed.Gaps, (unsigned long long)scanned.Packets, (unsigned long)scanned.Gaps,
+				(unsigned long long)expected.Packets, (unsigned long)expected.Windows, (unsigned long)expected.Gaps);
+	}
+
+	return wrong;
+}
+
+//
+// Writes Windows generated windows to Path, indexes them and checks the
+// index and the queries against what was written, then appends a window
+// and checks the index is rebuilt. Prints how long indexing and querying
+// took. Returns 2 when anything is wrong.
+//
+int
+RunCheck(
+	const char *	Path,
+	ULONG			Windows,
+	ULONGLONG		Seed
+)
+{
+	CHECK_CAPTURE	check;
+	MAPPED_FILE		capture;
+	MAPPED_FILE		index;
+	std::string		indexPath = std::string(Path) + ".idx";
+	double			indexedMs = 0;
+	double			scanMs = 0;
+	ULONG			wrong = 0;
+	ULONG			queries = 200;
+
+	check.Random = Seed != 0 ? Seed : 1;
+	check.Time = 0;
+	check.Windows = 0;
+
+	remove(Path);
+	remove(indexPath.c_str());
+
+	if (Windows == 0 || !CheckWriteCapture(Path, Windows, &check))
+		return 1;
+
+	for (int pass = 0; pass < 2; pass++) {
+		std::chrono::steady_clock::time_point start;
+
+		if (!MapFile(Path, &capture)) {
+			printf("Failed to map %s\n", Path);
+			return 1;
+		}
+
+		start = std::chrono::steady_clock::now();
+		if (!OpenIndex(&capture, indexPath.c_str(), &index)) {
+			UnmapFile(&capture);
+			return 1;
+		}
+
+		printf("%s %llu bytes, %lu windows, %llu packets indexed in %.1f ms\n",
+			pass == 0 ? "Wrote" : "Appended a window,", (unsigned long long)capture.Size,
+			(unsigned long)check.Windows, (unsigned long long)check.Packets.size(), CheckMilliseconds(start));
+
+		wrong += CheckIndex(&check, &index);
+		wrong += CheckQueries(&check, &capture, &index, pass == 0 ? queries : 0, &indexedMs, &scanMs);
+
+		UnmapFile(&index);
+		UnmapFile(&capture);
+
+		if (pass == 0 && !CheckWriteCapture(Path, 1, &check))
+			return 1;
+	}
+
+	printf("%lu queries took %.1f ms with the index, %.1f ms decoding every window\n",
+		(unsigned long)(queries + 12), indexedMs, scanMs);
+	printf("Index and queries checked against the packets written, %lu wrong\n", (unsigned long)wrong);
+
+	return wrong == 0 ? 0 : 2;
+}
+
+VOID
+Usage()
+{
+	printf("Usage: CaptureQuery <capture> [options]\n");
+	printf("-s to list packet counts per connection, direction, ATT opcode and handle\n");
+	printf("-from <ms> -to <ms> to only look at that time range, from the first packet\n");
+	printf("-in or -out, -conn <n>, -op <n>, -att <n> to only look at those packets\n");
+	printf("-len <n>[-<n>] to only look at packets of that length on the pipe\n");
+	printf("-gap <ms> to list inter-arrival gaps longer than that\n");
+	printf("e.g. CaptureQuery remote.cap -in -op 0x1b -att 0x2b -len 0-30 -gap 50\n");
+	printf("     for trackpad and button notifications\n");
+	printf("-check <windows> [-seed <n>] to write a capture of that many generated windows,\n");
+	printf("     replacing <capture>, and check the index and queries against it\n");
+}
+
+int
+main(
+	int		argc,
+	char *	argv[]
+)
+{
+	MAPPED_FILE	capture;
+	MAPPED_FILE	index;
+	QUERY		query;
+	BOOL		summary = FALSE;
+	ULONG		checkWindows = 0;
+	ULONGLONG	seed = 1;
+	std::string	indexPath;
+	int			retValue;
+
+	if (argc < 2) {
+		Usage();
+		return 1;
+	}
+
+	memset(&query, 0, sizeof(query));
+	query.To = 0x7FFFFFFFFFFFFFFFLL;
+	query.Direction = query.Connection = query.Opcode = query.AttHandle = -1;
+	query.MaxLength = 0xFFFF;
+
+	for (int i = 2; i < argc; i++) {
+		const char * arg = argv[i];
+		const char * value = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (!strcmp(arg, "-s")) {
+			summary = TRUE;
+		} else if (!strcmp(arg, "-in")) {
+			query.Direction = HCI_DIRECTION_IN;
+		} else if (!strcmp(arg, "-out")) {
+			query.Direction = HCI_DIRECTION_OUT;
+		} else if (value == NULL) {
+			Usage();
+			return 1;
+		} else if (!strcmp(arg, "-from")) {
+			query.From = (LONGLONG)(atof(value) * 10000);
+			i++;
+		} else if (!strcmp(arg, "-to")) {
+			query.To = (LONGLONG)(atof(value) * 10000);
+			i++;
+		} else if (!strcmp(arg, "-conn")) {
+			query.Connection = (int)strtoul(value, NULL, 0);
+			i++;
+		} else if (!strcmp(arg, "-op")) {
+			query.Opcode = (int)strtoul(value, NULL, 0);
+			i++;
+		} else if (!strcmp(arg, "-att")) {
+			query.AttHandle = (int)strtoul(value, NULL, 0);
+			i++;
+		} else if (!strcmp(arg, "-len")) {
+			char * end;
+			query.MinLength = query.MaxLength = strtoul(value, &end, 0);
+			if (*end == '-')
+				query.MaxLength = strtoul(end + 1, NULL, 0);
+			i++;
+		} else if (!strcmp(arg, "-gap")) {
+			query.Gap = (LONGLONG)(atof(value) * 10000);
+			i++;
+		} else if (!strcmp(arg, "-check")) {
+			checkWindows = strtoul(value, NULL, 0);
+			i++;
+		} else if (!strcmp(arg, "-seed")) {
+			seed = strtoull(value, NULL, 0);
+			i++;
+		} else {
+			Usage();
+			return 1;
+		}
+	}
+
+	if (checkWindows != 0)
+		return RunCheck(argv[1], checkWindows, seed);
+
+	if (!MapFile(argv[1], &capture) ||
+		capture.Size < sizeof(CAPSTREAM_FILE_HEADER) ||
+		((PCAPSTREAM_FILE_HEADER)capture.Data)->Magic != CAPSTREAM_FILE_MAGIC ||
+		((PCAPSTREAM_FILE_HEADER)capture.Data)->Version != CAPSTREAM_FILE_VERSION) {
+		printf("%s is not a capture file\n", argv[1]);
+		UnmapFile(&capture);
+		return 1;
+	}
+
+	indexPath = std::string(argv[1]) + ".idx";
+
+	if (!OpenIndex(&capture, indexPath.c_str(), &index)) {
+		UnmapFile(&capture);
+		return 1;
+	}
+
+	if (summary) {
+		PrintSummary(&index);
+		retValue = 0;
+	} else {
+		retValue = RunQuery(&capture, &index, &query);
+	}
+
+	UnmapFile(&index);
+	UnmapFile(&capture);
+
+	return retValue;
+}
@@ -0,0 +1,262 @@
+/*
+ * The GATT operations that activate a remote, behind IGattTransport so they
+ * run against the WinRT stack (WinRtGattTransport.cs) or a simulated one
+ * (exe/NotificationBench/MockGattTransport.cs).
+ *
+ * Discovering the battery service over the air takes a round trip for the
+ * service, the characteristics and the descriptors of each, several with
+ * the ATT paging. The handles found are kept per remote in a GattHandleMap
+ * file. The next run takes the handles from the system's cache, and only
+ * goes over the air to read the battery level once, which checks that the
+ * handles still answer. A map that changed or doesn't answer is discovered
+ * again.
+ *
+ * ATT allows one request in flight per connection, but the stack queues
+ * the ones issued together and sends them back to back. So activation
+ * issues the descriptor writes at once and waits for all of them instead
+ * of waiting for each before issuing the next. The magic packet is written
+ * after them, without response, like before.
+ */
+using System;
+using System.Collections.Generic;
+using System.Globalization;
+using System.IO;
+using System.Linq;
+using System.Threading.Tasks;
+
+namespace ConsoleApp
+{
+    /// <summary>
+    ///     Attribute handles of the battery service that activation writes to.
+    /// </summary>
+    sealed class GattHandleMap : IEquatable<GattHandleMap>
+    {
+        const string Header = "# SiriRemote GATT handles";
+
+        public ushort BatteryLevel;
+        public ushort[] BatteryLevelDescriptors = new ushort[0];
+        public ushort BatteryPowerState;
+
+        public bool Equals(GattHandleMap other)
+        {
+            return other != null &&
+                BatteryLevel == other.BatteryLevel &&
+                BatteryPowerState == other.BatteryPowerState &&
+                BatteryLevelDescriptors.SequenceEqual(other.BatteryLevelDescriptors);
+        }
+
+        public override bool Equals(object obj)
+        {
+            return Equals(obj as GattHandleMap);
+        }
+
+        public override int GetHashCode()
+        {
+            return BatteryLevel | (BatteryPowerState << 16);
+        }
+
+        /// <summary>
+        ///     Where the map of the remote with that address is kept.
+        /// </summary>
+        public static string PathFor(string deviceAddress)
+        {
+            return Path.Combine(Environment.GetFolderPath(Environment.SpecialFolder.LocalApplicationData),
+                "SiriRemoteDriver", deviceAddress + ".gatt");
+        }
+
+        /// <summary>
+        ///     The map kept at path, null when there is none or it doesn't parse.
+        /// </summary>
+        public static GattHandleMap Load(string path)
+        {
+            if (path == null || !File.Exists(path))
+                return null;
+
+            var map = new GattHandleMap();
+
+            try
+            {
+                foreach (var line in File.ReadAllLines(path))
+                {
+                    var separator = line.IndexOf('=');
+
+                    if (line.StartsWith("#") || separator < 0)
+                        continue;
+
+                    var key = line.Substring(0, separator).Trim();
+                    var handles = line.Substring(separator + 1)
+                        .Split(new[] { ',' }, StringSplitOptions.RemoveEmptyEntries)
+                        .Select(ParseHandle)
+                        .ToArray();
+
+                    if (key == "batterylevel" && handles.Length == 1)
+                        map.BatteryLevel = handles[0];
+                    else if (key == "descriptors")
+                        map.BatteryLevelDescriptors = handles;
+                    else if (key == "powerstate" && handles.Length == 1)
+                        map.BatteryPowerState = handles[0];
+                }
+            }
+            catch (Exception ex) when (ex is IOException || ex is FormatException || ex is OverflowException)
+            {
+                return null;
+            }
+
+            return map.BatteryLevel != 0 ? map : null;
+        }
+
+        static ushort ParseHandle(string s)
+        {
+            s = s.Trim();
+
+            if (s.StartsWith("0x", StringComparison.OrdinalIgnoreCase))
+                s = s.Substring(2);
+
+            return ushort.Parse(s, NumberStyles.HexNumber, CultureInfo.InvariantCulture);
+        }
+
+        public void Save(string path)
+        {
+            if (path == null)
+                return;
+
+            try
+            {
+                Directory.CreateDirectory(Path.GetDirectoryName(path));
+                File.WriteAllLines(path, new[]
+                {
+                    Header,
+                    $"batterylevel=0x{BatteryLevel:x4}",
+                    "descriptors=" + string.Join(",", BatteryLevelDescriptors.Select(h => $"0x{h:x4}")),
+                    $"powerstate=0x{BatteryPowerState:x4}",
+                });
+            }
+            catch (Exception ex) when (ex is IOException || ex is UnauthorizedAccessException)
+            {
+                // Only costs the next run a discovery
+            }
+        }
+    }
+
+    interface IGattTransport : IDisposable
+    {
+        /// <summary>
+        ///     Finds the battery service's handles. Cached takes them from the system's
+        ///     cache of the remote's attributes when it has one, without going over the
+        ///     air. Null when the service or the battery level isn't there.
+        /// </summary>
+        Task<GattHandleMap> DiscoverAsync(bool cached);
+
+        /// <summary>
+        ///     Reads a characteristic value over the air, null when it failed.
+        /// </summary>
+        Task<byte[]> ReadAsync(ushort handle);
+
+        Task<bool> WriteAsync(ushort handle, byte[] value, bool withResponse);
+
+        Task<bool> WriteDescriptorAsync(ushort handle, byte[] value);
+
+        /// <summary>
+        ///     Enables notifications of a characteristic and publishes their values to
+        ///     channel.
+        /// </summary>
+        Task<bool> SubscribeAsync(ushort handle, NotificationChannel channel);
+    }
+
+    static class RemoteActivation
+    {
+        static readonly byte[] EnableNotifications = { 0x01, 0x00 };
+        static readonly byte[] MagicPacket = { 0xAF };
+
+        /// <summary>
+        ///     The handles from the map kept at cachePath when the system's cache still
+        ///     has them and they answer, else from discovering them over the air, which
+        ///     are then kept. A null cachePath always discovers.
+        /// </summary>
+        public static async Task<GattHandleMap> GetHandleMapAsync(IGattTransport transport, string cachePath, Action<string> log)
+        {
+            var kept = GattHandleMap.Load(cachePath);
+
+            if (kept != null)
+            {
+                var cached = await transport.DiscoverAsync(true);
+
+                if (kept.Equals(cached) && await transport.ReadAsync(cached.BatteryLevel) != null)
+                    return cached;
+
+                log("Kept GATT handles changed or don't answer, discovering them again.");
+            }
+
+            var map = await transport.DiscoverAsync(false);
+
+            if (map != null)
+                map.Save(cachePath);
+
+            return map;
+        }
+
+        static async Task<bool> Run(Func<Task<bool>> operation, string name, Action<string> log)
+        {
+            try
+            {
+                if (await operation())
+                {
+                    log(name);
+                    return true;
+                }
+
+                log($"{name} failed");
+            }
+            catch (Exception ex)
+            {
+                log($"{name} Exception: {ex.Message}");
+            }
+
+            return false;
+        }
+
+        /// <summary>
+        ///     Subscribes to the notifications the filter redirects HID reports to and
+        ///     sends the magic packet. Pipelined issues the writes that get a response
+        ///     together, else one after the other like before.
+        /// </summary>
+        public static async Task<bool> ActivateAsync(IGattTransport transport, GattHandleMap map,
+            NotificationChannel channel, bool pipelined, Action<string> log)
+        {
+            var writes = new List<Func<Task<bool>>>();
+            bool[] results;
+
+            if (map.BatteryPowerState != 0)
+            {
+                log($"attr handle: {map.BatteryPowerState:X}, Name: BatteryPowerState");
+                log("Registering for BatteryPowerState notifications where HID notifications will be redirected to by SiriRemoteFilterDriver.");
+
+                writes.Add(() => Run(() => transport.SubscribeAsync(map.BatteryPowerState, channel),
+                    "Registering for notifications", log));
+            }
+
+            log($"attr handle: {map.BatteryLevel:X}, Name: BatteryLevel");
+            log("Sending SiriRemote magic packets via BatteryLevel so SiriRemoteFilterDriver can trigger and intercept HID notifications.");
+
+            foreach (var descriptor in map.BatteryLevelDescriptors)
+                writes.Add(() => Run(() => transport.WriteDescriptorAsync(descriptor, EnableNotifications),
+                    $"Writing 0x01, 0x00 to {descriptor:X}", log));
+
+            if (pipelined)
+            {
+                results = await Task.WhenAll(writes.Select(write => write()));
+            }
+            else
+            {
+                results = new bool[writes.Count];
+
+                for (int i = 0; i < writes.Count; i++)
+                    results[i] = await writes[i]();
+            }
+
+            var sent = await Run(() => transport.WriteAsync(map.BatteryLevel, MagicPacket, false), "Writing 0xAF", log);
+
+            return sent && results.All(result => result);
+        }
+    }
+}
@@ -0,0 +1,329 @@
+/*
+ * Notification pipeline of the console app.
+ *
+ * The GATT ValueChanged callback runs on a WinRT thread for every
+ * notification, up to a few hundred a second with voice. It only copies
+ * the value into a buffer rented from a fixed pool and publishes it to a
+ * bounded queue. A consumer thread takes whatever queued up in one go,
+ * formats the batch into one reused character buffer and writes it out
+ * with one call. Once started nothing here allocates per notification.
+ *
+ * Nothing here depends on Windows, so the benchmark in
+ * exe/NotificationBench runs it on any platform.
+ */
+using System;
+using System.IO;
+using System.Threading;
+
+namespace ConsoleApp
+{
+    /// <summary>
+    ///     A notification value in a pooled buffer, the first Length bytes of Buffer.
+    /// </summary>
+    struct Notification
+    {
+        public byte[] Buffer;
+        public int Length;
+        public int OriginalLength;
+        public long Timestamp;
+    }
+
+    /// <summary>
+    ///     Pool of notification buffers and the bounded queue of the published ones.
+    ///     There are as many buffers as the queue has room for, so a producer that
+    ///     got a buffer can always publish it. When every buffer is queued or being
+    ///     processed the notification is dropped and counted instead of blocking the
+    ///     callback. Any number of producers, one consumer.
+    /// </summary>
+    sealed class NotificationChannel
+    {
+        readonly object sync = new object();
+        readonly byte[][] free;
+        readonly Notification[] queue;
+        int freeCount;
+        int head;
+        int count;
+        bool completed;
+        long dropped;
+
+        public NotificationChannel(int capacity, int bufferSize)
+        {
+            free = new byte[capacity][];
+            queue = new Notification[capacity];
+
+            for (int i = 0; i < capacity; i++)
+                free[i] = new byte[bufferSize];
+
+            freeCount = capacity;
+            BufferSize = bufferSize;
+        }
+
+        public int BufferSize { get; }
+
+        public long Dropped
+        {
+            get { return Interlocked.Read(ref dropped); }
+        }
+
+        /// <summary>
+        ///     A buffer to copy a notification into, or null when all are in use.
+        /// </summary>
+        public byte[] TryRent()
+        {
+            lock (sync)
+            {
+                if (freeCount > 0 && !completed)
+                    return free[--freeCount];
+            }
+
+            Interlocked.Increment(ref dropped);
+            return null;
+        }
+
+        /// <summary>
+        ///     Queues a rented buffer holding length bytes of a notification that was
+        ///     originalLength long, more when it didn't fit the buffer.
+        /// </summary>
+        public void Publish(byte[] buffer, int length, int originalLength, long timestamp)
+        {
+            lock (sync)
+            {
+                var tail = (head + count) % queue.Length;
+
+                queue[tail].Buffer = buffer;
+                queue[tail].Length = length;
+                queue[tail].OriginalLength = originalLength;
+                queue[tail].Timestamp = timestamp;
+
+                if (count++ == 0)
+                    Monitor.Pulse(sync);
+            }
+        }
+
+        /// <summary>
+        ///     Copies a notification into a pooled buffer and queues it, false if it was dropped.
+        /// </summary>
+        public bool TryPublish(byte[] value, int length, long timestamp)
+        {
+            var buffer = TryRent();
+
+            if (buffer == null)
+                return false;
+
+            var copied = Math.Min(length, buffer.Length);
+
+            Buffer.BlockCopy(value, 0, buffer, 0, copied);
+            Publish(buffer, copied, length, timestamp);
+            return true;
+        }
+
+        /// <summary>
+        ///     Moves up to batch.Length queued notifications into batch. Waits for one
+        ///     when wait is set and the queue is empty. Returns 0 once the channel is
+        ///     completed and drained, or when not waiting and there is nothing queued.
+        /// </summary>
+        public int ReadBatch(Notification[] batch, bool wait)
+        {
+            lock (sync)
+            {
+                while (count == 0)
+                {
+                    if (!wait || completed)
+                        return 0;
+
+                    Monitor.Wait(sync);
+                }
+
+                var taken = Math.Min(count, batch.Length);
+
+                for (int i = 0; i < taken; i++)
+                {
+                    batch[i] = queue[head];
+                    queue[head].Buffer = null;
+                    head = (head + 1) % queue.Length;
+                }
+
+                count -= taken;
+                return taken;
+            }
+        }
+
+        /// <summary>
+        ///     Gives the buffers of a processed batch back to the pool.
+        /// </summary>
+        public void Return(Notification[] batch, int taken)
+        {
+            lock (sync)
+            {
+                for (int i = 0; i < taken; i++)
+                {
+                    free[freeCount++] = batch[i].Buffer;
+                    batch[i].Buffer = null;
+                }
+            }
+        }
+
+        /// <summary>
+        ///     No more notifications, the consumer returns once it has taken the queued ones.
+        /// </summary>
+        public void Complete()
+        {
+            lock (sync)
+            {
+                completed = true;
+                Monitor.PulseAll(sync);
+            }
+        }
+    }
+
+    /// <summary>
+    ///     Formats notifications as hex lines into a reused character buffer and
+    ///     writes each batch out with one call.
+    /// </summary>
+    sealed class NotificationWriter
+    {
+        const string Prefix = "Notification :";
+        const string Truncated = "...<- Voice data most likely truncated.";
+        const string Hex = "0123456789abcdef";
+
+        readonly TextWriter output;
+        char[] text;
+        int used;
+
+        public NotificationWriter(TextWriter output, int bufferSize)
+        {
+            this.output = output;
+            text = new char[LineLength(bufferSize) * 16];
+        }
+
+        static int LineLength(int length)
+        {
+            return Prefix.Length + length * 3 + Truncated.Length + Environment.NewLine.Length;
+        }
+
+        void Append(string s)
+        {
+            s.CopyTo(0, text, used, s.Length);
+            used += s.Length;
+        }
+
+        /// <summary>
+        ///     Appends the line of one notification. Voice frames are around 102 bytes,
+        ///     shorter ones above 13 bytes most likely lost their end to the header fix.
+        /// </summary>
+        public void Format(ref Notification notification)
+        {
+            var length = notification.Length;
+
+            if (text.Length - used < LineLength(length))
+                Array.Resize(ref text, Math.Max(text.Length * 2, used + LineLength(length)));
+
+            Append(Prefix);
+
+            for (int i = 0; i < length; i++)
+            {
+                var b = notification.Buffer[i];
+
+                text[used++] = ' ';
+                text[used++] = Hex[b >> 4];
+                text[used++] = Hex[b & 0xF];
+            }
+
+            if (notification.OriginalLength > 13 && notification.OriginalLength < 100)
+                Append(Truncated);
+
+            Append(Environment.NewLine);
+        }
+
+        public void WriteBatch(Notification[] batch, int taken)
+        {
+            used = 0;
+
+            for (int i = 0; i < taken; i++)
+                Format(ref batch[i]);
+
+            output.Write(text, 0, used);
+            output.Flush();
+        }
+    }
+
+    /// <summary>
+    ///     The channel and the consumer thread writing its batches out.
+    /// </summary>
+    sealed class NotificationPipeline : IDisposable
+    {
+        public const int DefaultCapacity = 256;
+        public const int DefaultBufferSize = 128;
+        public const int DefaultBatchSize = 32;
+
+        readonly NotificationWriter writer;
+        readonly TextWriter output;
+        readonly Notification[] batch;
+        readonly Thread consumer;
+        long reportedDrops;
+
+        public NotificationPipeline(TextWriter output)
+            : this(output, DefaultCapacity, DefaultBufferSize, DefaultBatchSize)
+        {
+        }
+
+        public NotificationPipeline(TextWriter output, int capacity, int bufferSize, int batchSize)
+        {
+            this.output = output;
+            Channel = new NotificationChannel(capacity, bufferSize);
+            writer = new NotificationWriter(output, bufferSize);
+            batch = new Notification[batchSize];
+            consumer = new Thread(Consume) { IsBackground = true, Name = "Notifications" };
+        }
+
+        public NotificationChannel Channel { get; }
+
+        public void Start()
+        {
+            consumer.Start();
+        }
+
+        /// <summary>
+        ///     Processes one batch on the calling thread, the consumer thread's loop
+        ///     without waiting. Returns how many notifications it took.
+        /// </summary>
+        public int ProcessBatch(bool wait)
+        {
+            var taken = Channel.ReadBatch(batch, wait);
+
+            if (taken == 0)
+                return 0;
+
+            writer.WriteBatch(batch, taken);
+            Channel.Return(batch, taken);
+
+            var dropped = Channel.Dropped;
+
+            if (dropped != reportedDrops)
+            {
+                output.WriteLine($"Dropped {dropped - reportedDrops} notifications, the console didn't keep up");
+                reportedDrops = dropped;
+            }
+
+            return taken;
+        }
+
+        void Consume()
+        {
+            while (ProcessBatch(true) != 0)
+            {
+            }
+        }
+
+        /// <summary>
+        ///     Writes out what is queued and stops the consumer.
+        /// </summary>
+        public void Dispose()
+        {
+            Channel.Complete();
+
+            if (consumer.IsAlive)
+                consumer.Join();
+        }
+    }
+}
@@ -5,12 +5,9 @@
  * https://github.com/CarterAppleton/Win10Win32Bluetooth
  */
 using System;
-using System.Text;
 using System.Threading.Tasks;
 
-using Windows.Devices.Bluetooth;
 using Windows.Devices.Bluetooth.GenericAttributeProfile;
-using Windows.Storage.Streams;
 
 namespace ConsoleApp
 {
@@ -22,11 +19,17 @@ namespace ConsoleApp
         static string deviceAddress;
         static ulong deviceAddressNumber;
 
+        static bool discoverHandles;
+        static WinRtGattTransport transport;
+
+        static readonly NotificationPipeline notifications = new NotificationPipeline(Console.Out);
+
         static void Usage()
         {
             log("Usage:");
-            log("ConsoleApp <DEVICENAME> <DEVICEMAC>");
+            log("ConsoleApp <DEVICENAME> <DEVICEMAC> [-d]");
             log("E.g. ConsoleApp DJ7XXXXXXXXM FF:FF:FF:FF:FF:FF");
+            log("-d to discover the GATT handles over the air instead of using the ones kept from the last run");
         }
 
         static void Main(string[] args)
@@ -39,10 +42,13 @@ namespace ConsoleApp
 
             deviceName = args[0].Replace("\"", "");
             deviceMAC = args[1].Replace("\"", "");
+            discoverHandles = args.Length > 2 && args[2] == "-d";
 
             deviceAddress = deviceMAC.Replace(":", "").ToUpper();
             deviceAddressNumber = ulong.Parse(deviceMAC.Replace(":", "").ToUpper(), System.Globalization.NumberStyles.HexNumber);
 
+            notifications.Start();
+
             //https://stackoverflow.com/questions/9208921/cant-specify-the-async-modifier-on-the-main-method-of-a-console-app
             Task.Run(async () =>
             {
@@ -54,6 +60,9 @@ namespace ConsoleApp
 
             // Keep console application open to receive notifications
             Console.ReadLine();
+
+            notifications.Dispose();
+            transport?.Dispose();
         }
 
         enum AttributeType
@@ -171,144 +180,26 @@ namespace ConsoleApp
         /// </summary>
         static async Task SendMagicPacket()
         {
-            //This works only if your device is already paired!
-
-            //we get the bluetooth address number by debug the connect function
-            BluetoothLEDevice bleDevice = await BluetoothLEDevice.FromBluetoothAddressAsync(deviceAddressNumber);
-
-            if (bleDevice != null && (bleDevice.Name.Equals(deviceName) || bleDevice.Name.Contains(deviceMAC)))
-            {
-                //Battery Service
-                GattDeviceServicesResult servicesResult = await bleDevice.GetGattServicesForUuidAsync(new Guid("0000180F-0000-1000-8000-00805f9b34fb"), BluetoothCacheMode.Uncached);
-                GattDeviceService batteryservice = servicesResult.Services[0];
-
-                GattCharacteristicsResult characteristicsResult = await batteryservice.GetCharacteristicsAsync(BluetoothCacheMode.Uncached);
-
-                foreach (GattCharacteristic characteristic in characteristicsResult.Characteristics)
-                {
-                    //UUID: 00002a1a-0000-1000-8000-00805f9b34fb, Name: BatteryPowerState
-                    if (characteristic.Uuid == new Guid("00002a1a-0000-1000-8000-00805f9b34fb"))
-                    {
-                        log($"attr handle: {characteristic.AttributeHandle.ToString("X")}, Characteristic UUID: {characteristic.Uuid.ToString()}, Name: {GetName(AttributeType.Characteristic, characteristic)}");
-                        log("Registering for BatteryPowerState notifications where HID notifications will be redirected to by SiriRemoteFilterDriver.");
-
-                        if (characteristic.CharacteristicProperties.HasFlag(GattCharacteristicProperties.Notify))
-                        {
-                            try
-                            {
-                                // Write the ClientCharacteristicConfigurationDescriptor in order for server to send notifications.               
-                                var result = await characteristic.WriteClientCharacteristicConfigurationDescriptorAsync(
-                                                                          GattClientCharacteristicConfigurationDescriptorValue.Notify);
-                                if (result == GattCommunicationStatus.Success)
-                                {
-                                    log("Successfully registered for notifications");
-                                    characteristic.ValueChanged += SelectedCharacteristic_ValueChanged;
-                                }
-                                else
-                                {
-                                    log($"Error registering for notifications: {result}");
-                                }
-                            }
-                            catch (Exception ex)
-                            {
-                                log($"Notify Exception: {ex.Message}");
-                            }
-                        }
-                    }
-                }
-
-                log("");
-
-                foreach (GattCharacteristic characteristic in characteristicsResult.Characteristics)
-                {
-                    //UUID: 00002a19-0000-1000-8000-00805f9b34fb, Name: BatteryLevel
-                    if (characteristic.Uuid == new Guid("00002a19-0000-1000-8000-00805f9b34fb"))
-                    {
-                        log($"attr handle: {characteristic.AttributeHandle.ToString("X")}, Characteristic UUID: {characteristic.Uuid.ToString()}, Name: {GetName(AttributeType.Characteristic, characteristic)}");
-                        log("Sending SiriRemote magic packets via BatteryLevel so SiriRemoteFilterDriver can trigger and intercept HID notifications.");
-
-                        byte[] bytesToSend;
-                        DataWriter writer;
-                        IBuffer dataToSend;
-
-                        GattDescriptorsResult descriptorsResult = await characteristic.GetDescriptorsAsync(BluetoothCacheMode.Uncached);
-
-                        foreach (GattDescriptor batdesc in descriptorsResult.Descriptors)
-                        {
-                            bytesToSend = new byte[] { 0x01, 0x00 };
-
-                            writer = new DataWriter();
-
-                            writer.WriteBytes(bytesToSend);
-
-                            dataToSend = writer.DetachBuffer();
-
-                            Task.Run(async () =>
-                            {
-                                // Do any async anything you need here without worry
-                                await batdesc.WriteValueAsync(dataToSend);
-
-                            }).GetAwaiter().GetResult();
-
-                            log("Writing 0x01, 0x00");
-                        }
-
-                        bytesToSend = new byte[] { 0xAF };
-
-                        writer = new DataWriter();
-
-                        writer.WriteBytes(bytesToSend);
-
-                        dataToSend = writer.DetachBuffer();
-
-                        Task.Run(async () =>
-                        {
-                            // Do any async anything you need here without worry
-                            await characteristic.WriteValueAsync(dataToSend, GattWriteOption.WriteWithoutResponse);
-
-                        }).GetAwaiter().GetResult();
-
-                        log("Writing 0xAF");
-                    }
-                }
-
-                log("");
-
-                //for (int i = 0; i < 3; i++)
-                //    await Task.Delay(1000);
-            }
-        }
-
-        static void SelectedCharacteristic_ValueChanged(GattCharacteristic sender, GattValueChangedEventArgs args)
-        {
-            var RawBufLen = (int)args.CharacteristicValue.Length;
-            byte[] data;
-            string strData = null;
-
+            transport = await WinRtGattTransport.OpenAsync(deviceAddressNumber, deviceName, deviceMAC);
 
-            Windows.Security.Cryptography.CryptographicBuffer.CopyToByteArray(args.CharacteristicValue, out data);
-            //byte[] bytes = WindowsRuntimeBufferExtensions.ToArray(result.Value, 0, (int)result.Value.Length);
+            if (transport == null)
+                return;
 
-            StringBuilder hex = new StringBuilder(data.Length * 2);
+            GattHandleMap map = await RemoteActivation.GetHandleMapAsync(transport,
+                discoverHandles ? null : GattHandleMap.PathFor(deviceAddress), log);
 
-            for (int j = 0; j < data.Length; j++)
+            if (map == null)
             {
-                char ch = Convert.ToChar(data[j]);
-                hex.AppendFormat(" {0:x2}", data[j]);
-
-                if (ch != '\0')
-                {
-                    strData = strData + ch;
-                }
+                log("Battery service not found");
+                return;
             }
 
-            //log($"Value Changed : {strData} ({hex})");
+            if (discoverHandles)
+                map.Save(GattHandleMap.PathFor(deviceAddress));
 
-            //voice data should be around 102 bytes
-            if (data.Length > 13 && data.Length < 100)
-                hex.AppendFormat("...<- Voice data most likely truncated.");
+            await RemoteActivation.ActivateAsync(transport, map, notifications.Channel, true, log);
 
-            log($"Notification :{hex}");
+            log("");
         }
 
         /// <summary>
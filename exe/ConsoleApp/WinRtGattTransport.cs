@@ -0,0 +1,189 @@
+/*
+ * IGattTransport on the WinRT Bluetooth LE APIs.
+ */
+using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Runtime.InteropServices.WindowsRuntime;
+using System.Threading.Tasks;
+
+using Windows.Devices.Bluetooth;
+using Windows.Devices.Bluetooth.GenericAttributeProfile;
+using Windows.Storage.Streams;
+
+namespace ConsoleApp
+{
+    sealed class WinRtGattTransport : IGattTransport
+    {
+        static readonly Guid BatteryServiceUuid = new Guid("0000180F-0000-1000-8000-00805f9b34fb");
+        static readonly Guid BatteryLevelUuid = new Guid("00002a19-0000-1000-8000-00805f9b34fb");
+        static readonly Guid BatteryPowerStateUuid = new Guid("00002a1a-0000-1000-8000-00805f9b34fb");
+
+        readonly BluetoothLEDevice device;
+        readonly Dictionary<ushort, GattCharacteristic> characteristics = new Dictionary<ushort, GattCharacteristic>();
+        readonly Dictionary<ushort, GattDescriptor> descriptors = new Dictionary<ushort, GattDescriptor>();
+        NotificationChannel notifications;
+
+        WinRtGattTransport(BluetoothLEDevice device)
+        {
+            this.device = device;
+        }
+
+        /// <summary>
+        ///     The transport of the paired remote at that address, null when there is
+        ///     none or it isn't the one named.
+        /// </summary>
+        public static async Task<WinRtGattTransport> OpenAsync(ulong address, string name, string mac)
+        {
+            //This works only if your device is already paired!
+            BluetoothLEDevice bleDevice = await BluetoothLEDevice.FromBluetoothAddressAsync(address);
+
+            if (bleDevice == null)
+                return null;
+
+            if (!bleDevice.Name.Equals(name) && !bleDevice.Name.Contains(mac))
+            {
+                bleDevice.Dispose();
+                return null;
+            }
+
+            return new WinRtGattTransport(bleDevice);
+        }
+
+        public async Task<GattHandleMap> DiscoverAsync(bool cached)
+        {
+            var mode = cached ? BluetoothCacheMode.Cached : BluetoothCacheMode.Uncached;
+            var map = new GattHandleMap();
+
+            GattDeviceServicesResult servicesResult = await device.GetGattServicesForUuidAsync(BatteryServiceUuid, mode);
+
+            if (servicesResult.Status != GattCommunicationStatus.Success || servicesResult.Services.Count == 0)
+                return null;
+
+            GattCharacteristicsResult characteristicsResult = await servicesResult.Services[0].GetCharacteristicsAsync(mode);
+
+            if (characteristicsResult.Status != GattCommunicationStatus.Success)
+                return null;
+
+            characteristics.Clear();
+            descriptors.Clear();
+
+            foreach (GattCharacteristic characteristic in characteristicsResult.Characteristics)
+            {
+                if (characteristic.Uuid == BatteryPowerStateUuid &&
+                    characteristic.CharacteristicProperties.HasFlag(GattCharacteristicProperties.Notify))
+                {
+                    map.BatteryPowerState = characteristic.AttributeHandle;
+                    characteristics[characteristic.AttributeHandle] = characteristic;
+                }
+                else if (characteristic.Uuid == BatteryLevelUuid)
+                {
+                    map.BatteryLevel = characteristic.AttributeHandle;
+                    characteristics[characteristic.AttributeHandle] = characteristic;
+
+                    GattDescriptorsResult descriptorsResult = await characteristic.GetDescriptorsAsync(mode);
+
+                    if (descriptorsResult.Status != GattCommunicationStatus.Success)
+                        return null;
+
+                    var handles = new List<ushort>();
+
+                    foreach (GattDescriptor descriptor in descriptorsResult.Descriptors)
+                    {
+                        handles.Add(descriptor.AttributeHandle);
+                        descriptors[descriptor.AttributeHandle] = descriptor;
+                    }
+
+                    map.BatteryLevelDescriptors = handles.ToArray();
+                }
+            }
+
+            return map.BatteryLevel != 0 ? map : null;
+        }
+
+        public async Task<byte[]> ReadAsync(ushort handle)
+        {
+            GattCharacteristic characteristic;
+
+            if (!characteristics.TryGetValue(handle, out characteristic))
+                return null;
+
+            GattReadResult result = await characteristic.ReadValueAsync(BluetoothCacheMode.Uncached);
+
+            if (result.Status != GattCommunicationStatus.Success)
+                return null;
+
+            return result.Value.ToArray();
+        }
+
+        public async Task<bool> WriteAsync(ushort handle, byte[] value, bool withResponse)
+        {
+            GattCharacteristic characteristic;
+
+            if (!characteristics.TryGetValue(handle, out characteristic))
+                return false;
+
+            var status = await characteristic.WriteValueAsync(value.AsBuffer(),
+                withResponse ? GattWriteOption.WriteWithResponse : GattWriteOption.WriteWithoutResponse);
+
+            return status == GattCommunicationStatus.Success;
+        }
+
+        public async Task<bool> WriteDescriptorAsync(ushort handle, byte[] value)
+        {
+            GattDescriptor descriptor;
+
+            if (!descriptors.TryGetValue(handle, out descriptor))
+                return false;
+
+            return await descriptor.WriteValueAsync(value.AsBuffer()) == GattCommunicationStatus.Success;
+        }
+
+        public async Task<bool> SubscribeAsync(ushort handle, NotificationChannel channel)
+        {
+            GattCharacteristic characteristic;
+
+            if (!characteristics.TryGetValue(handle, out characteristic))
+                return false;
+
+            // Write the ClientCharacteristicConfigurationDescriptor in order for server to send notifications.
+            var result = await characteristic.WriteClientCharacteristicConfigurationDescriptorAsync(
+                GattClientCharacteristicConfigurationDescriptorValue.Notify);
+
+            if (result != GattCommunicationStatus.Success)
+                return false;
+
+            notifications = channel;
+            characteristic.ValueChanged += Characteristic_ValueChanged;
+            return true;
+        }
+
+        /// <summary>
+        /// Runs on a WinRT thread for every notification, so it only copies the
+        /// value into a pooled buffer and queues it. The pipeline's thread formats
+        /// and prints what queued up in batches, see NotificationPipeline.cs.
+        /// </summary>
+        void Characteristic_ValueChanged(GattCharacteristic sender, GattValueChangedEventArgs args)
+        {
+            IBuffer value = args.CharacteristicValue;
+            var length = (int)value.Length;
+            var buffer = notifications.TryRent();
+
+            if (buffer == null)
+                return;
+
+            var copied = Math.Min(length, buffer.Length);
+
+            value.CopyTo(0, buffer, 0, copied);
+            notifications.Publish(buffer, copied, length, Stopwatch.GetTimestamp());
+        }
+
+        public void Dispose()
+        {
+            foreach (var characteristic in characteristics.Values)
+                characteristic.ValueChanged -= Characteristic_ValueChanged;
+
+            device.Dispose();
+        }
+    }
+}
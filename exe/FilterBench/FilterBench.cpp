@@ -0,0 +1,9884 @@
+/*++
+
+Module Name:
+
+    FilterBench.cpp
+
+Abstract:
+
+    Replays a capture file written by SendIoctlToFilter -w through the
+    filter's own dispatch and completion routines, running on the usermode
+    shim (kmdf/filter/usermode/shim.h), and reports what each path costs
+    per packet. Instead of a capture, it can generate the traffic of
+    several remotes (kmdf/filter/generic/synth.h) for a number of seconds,
+    as fast as it goes or paced at a multiple of the real rate, to see
+    where classification, rewriting, tracing and event queuing stop
+    keeping up. It then also reports the cost per kind of report.
+
+    The bench plays the bluetooth stack above the filter and the adapter
+    below it. Captured IN packets are returned on a read the bench keeps
+    pending on their pipe, OUT packets are written. Captures only keep
+    FILTER_CAPTURE_SNAPLEN bytes of a packet, the rest is zero padded to
+    the length on the pipe. The interrupt time follows the capture, so
+    timers like the watchdog's run when they would have.
+
+    The default queue of the filter is parallel, so on Windows reads
+    complete and URBs are dispatched on several CPUs at once. With -j the
+    generated traffic is passed through the filter from 1, 2, 4 and up to
+    that many threads, each pinned to its own CPU and keeping its own reads
+    pending, while the main thread runs the timers. For each count the
+    bench reports the throughput, how it scales, the latency percentiles
+    of a packet and, where perf counters can be opened, cycles,
+    instructions and cache misses per packet. Cycles and cache misses per
+    packet that grow with the threads while instructions don't point at
+    cache lines the threads fight over.
+
+    With -l the bench also plays an application reading events every that
+    many packets. It decodes each event and acts on it for -a microseconds,
+    and reports how long the events took in each stage from the URB
+    completing (kmdf/filter/generic/latency.h). The application times the
+    stages with CLOCK_MONOTONIC_RAW in 100ns units, so the driver's stamps
+    are mapped onto it like they are on a system with two clocks. It
+    checks every event and voice frame was stamped after the read before
+    it, unless -e let the filter hold it, in order and no later than its
+    read, that the stages follow one another, and that the mapped clock
+    puts each read within the reader's own timing of it, off by no more
+    than the clock sample's round trip and 1000 ppm of drift. It exits with
+    2 if any of that is wrong.
+
+    To check the filter's voice accounting, -drop, -dup, -swap and -cut
+    lose, repeat, reorder and shorten that many in a thousand voice frames
+    before they get to the filter. The bench then prints the voice
+    sessions the filter counted next to what it did to the frames.
+    Generated frames count themselves in their first byte, which the bench
+    tells the filter along with their rate. Generating on one thread, the
+    bench follows each frame it sent to where and when it reached the
+    filter, and exits with 2 unless the frames, missing, duplicates,
+    reordered, late and short frames the filter counted come out the same.
+
+    With -G the generated touches are taps, clicks, swipes and scrolls,
+    labelled as they are generated, and the application also runs the
+    events through the gesture recognizer (kmdf/filter/generic/gesture.h).
+    The bench then prints how many of each it recognized, took for another
+    or missed, how many it made up, and how long after the touch came down
+    it recognized them, and exits with 2 unless it recognized each touch
+    as the gesture it was generated as and made none up.
+
+    With -S the application runs the positions of the touch events through
+    the smoothing of kmdf/filter/generic/smooth.h, like the filter does
+    with IOCTL_SET_SMOOTH_CONFIG, and reports how much jitter it took out
+    against how far behind the reports it put the positions. With -ci the
+    generated moves arrive in the lumps of a connection interval.
+
+    With -B the bench doesn't load the filter but runs the button engine
+    of kmdf/filter/generic/buttons.h on its own, on that many simulated
+    remotes per -j thread for -g seconds of injected time. Each remote
+    means one click, double click, long press or chord at a time, and the
+    bench prints how many of each the engine got right, wrong, at the
+    wrong time, missed or made up, how late the timer wheel let them be,
+    and how many transitions a second a thread takes. It exits with 2 if
+    any action was not right.
+
+    With -R the bench doesn't load the filter either, but compiles report
+    maps (kmdf/filter/generic/reportmap.h): a keyboard's, a mouse's, a
+    consumer control's, a touchpad's and one the Siri Remote could have,
+    checking what a report of each decodes into and which fields the
+    filter would take buttons and touches from, then that many random
+    maps, whose reports are checked bit by bit against how the maps were
+    built, and the same maps cut short and with bytes changed, which must
+    compile into consistent fields or not at all. Reports of the Siri map
+    must make the same events as the fixed layout does. It prints what
+    compiling and decoding cost and exits with 2 if anything was off.
+
+    With -M the host reads the Report Map of each generated remote after
+    connecting, the Siri map of -R, in reads as long as the ATT_MTU
+    allows. The bench then checks with IOCTL_GET_REPORT_MAPS that the
+    filter put each one together and decodes the remote's reports with it,
+    and exits with 2 if it didn't.
+
+    With -C the bench connects one remote streaming voice and injects the
+    anomaly of each capture trigger in turn: a notification gap, a packet
+    shorter than its HCI header says, a write the adapter fails and a
+    stall the watchdog sees. It checks that each freezes PreTrigger of the
+    packets it passed before the anomaly and PostTrigger from it on, as
+    they were on the pipe. It then attaches the filter to a second adapter,
+    freezes the windows of one or both with failed writes and checks that
+    IOCTL_GET_CAPTURE hands out the first frozen one, then the other, and
+    the first adapter's live one once none is frozen. It exits with 2 if a
+    window was off.
+
+    With -I the bench replays what the stack exchanges with several
+    adapters when it starts, Read Local Version Information, Read Buffer
+    Size and LE Read Buffer Size, and with two remotes when they connect,
+    an ATT MTU exchange each, one of them written and read in MDLs. Each
+    adapter gets a filter of its own. The bench checks the limits, MTUs
+    and header fix IOCTL_GET_ADAPTER_INFO reports and how long a voice
+    frame reaches the stack, and exits with 2 if any was off.
+
+    With -L the bench churns remotes on a few more handles than the filter
+    has connection slots: they connect, reuse handles the filter still
+    knows, exchange MTUs before their connection event so the filter
+    adopts them, and mostly disconnect without the filter seeing it, so it
+    has to evict slots. After every step it checks IOCTL_GET_ADAPTER_INFO
+    against what the filter must know and exits with 2 if it was off.
+
+    With -P the bench checks the profile the hardware IDs of the supported
+    adapters, and some malformed ones, pick, then runs random and mutated
+    packets in every framing through the matchers of each profile, checks
+    what they say against the packet's fields and times them. A filter
+    loaded for each adapter must redirect a notification in its own
+    framing only. The bench exits with 2 if anything was off.
+
+    With -T the bench loads random and mutated trace filter programs
+    through TraceFilterLoad, checks it takes exactly the ones public.h
+    allows, and runs each it took over synthesized and short random
+    packets against a reference interpreter, which also counts the steps:
+    none may take more than the program has instructions. Then it times
+    TraceFilterRun per packet for a few typical programs and the longest
+    one there can be, and exits with 2 if anything was off.
+
+    With -K the bench checks the tracepoint ring keeps records whole and
+    in order and counts the ones it overwrote, with one writer and with
+    several writing while a reader drains it. It times a tracepoint with
+    its keyword off and on, then what each packet through the filter
+    costs with no keywords, the default ones and every URB traced, and
+    exits with 2 if the ring was off or the keywords didn't decide what
+    got written.
+
+    With -Z the bench encodes synthesized traffic with the capture stream
+    encoding, a capture window every so often, and reports how much
+    smaller it gets and how fast it encodes and decodes. Every record and
+    window must decode to what went in, and items cut short must ask for
+    more without changing the decoder. Random bytes and mutated pieces of
+    the stream must decode to nothing the encoder could not have written,
+    and the bench exits with 2 if anything was off.
+
+    With -W the bench coalesces the trackpad and button reports of the
+    generated traffic with windows from 0 to 50 ms, flushing every
+    millisecond like the filter's timer, and reports how many events the
+    reports became. Every edge must come in order and after the moves
+    before it, every move must merge reports no further apart than the
+    window, and the deltas must rebuild each position exactly. The bench
+    exits with 2 if anything was off.
+
+    With -V four remotes hold the voice button while they press buttons,
+    at voice rates up to 1000 frames a second each, and a reader with room
+    for a few voice frames reads the events every 20 ms. Every button
+    change must be read in order, in the first read after it, and none
+    may be lost, however many voice frames the ring drops. The bench
+    reports the latency and exits with 2 if a change was late, lost or out
+    of order.
+
+    With -F the bench queues that many events of a few remotes for 1, 2, 4
+    and 8 subscribers reading at their own pace with subscriptions of
+    their own, the slowest less often than the ring holds events. Each
+    must read every edge it wanted in order unless the ring turned it
+    away, and then count it as lost, and the deltas must rebuild every
+    position. The bench reports what was turned away and what queuing and
+    taking cost per event, and exits with 2 if anything was off or the
+    fast readers alone lost anything.
+
+    With -A four remotes connect and are activated by the filter while the
+    host keeps their connections busy with ATT requests and write
+    commands, on a controller with as few as one LE buffer. The controller
+    must never get more packets than it has buffers, the host must never
+    get back a buffer it didn't use nor a response it didn't ask for, and
+    no remote may have two ATT requests outstanding. The bench reports how
+    many host packets were held back and for how long, and how long the
+    activations took, and exits with 2 if anything was off.
+
+    With -X the host exchanges ATT requests and responses with four
+    remotes, two of which the filter activates each time they connect.
+    The remotes answer late, with errors, by dropping the connection or
+    not at all, and send responses nobody asked for, while the adapter
+    takes its time and fails some writes. The bench moves the interrupt
+    time itself, works out the counts and histograms IOCTL_GET_ATT_STATS
+    must report, the timeouts after 30 s too, and exits with 2 if they
+    were off.
+
+    With -H the bench replays sessions of up to four remotes streaming
+    voice and button reports through the stall watchdog, each session ten
+    minutes of interrupt time on its own gap, actions and header fix mode.
+    The remotes pause for less than the gap, just past it, well past it or
+    for minutes, or disconnect. The bench jumps the interrupt time from one
+    notification or check to the next, works out which pauses the watchdog
+    must count as stalls and by when, and which connections it must apply
+    the header fix to, and exits with 2 if it was off.
+
+    Linux only, built from the repository root with e.g.
+
+        cc -O2 -c -D_KERNEL_MODE -Ikmdf/filter/usermode -Ikmdf/filter/generic -Iinc
+           -Wno-unknown-pragmas -Wno-multichar
+           kmdf/filter/generic/{filter,hci,profile,tracefilter,capture,tracepoint,
+           coalesce,eventqueue,activate,aclflow,atttrack,watchdog,voicestats,capstream,synth,
+           latency,gesture,smooth,timerwheel,buttons,reportmap,reportsnoop}.c
+           kmdf/filter/usermode/shim.c
+        c++ -O2 -D_KERNEL_MODE -Ikmdf/filter/usermode -Ikmdf/filter/generic -Iinc
+           exe/FilterBench/FilterBench.cpp *.o -lpthread -o FilterBench
+
+Environment:
+
+    usermode console application, POSIX
+
+--*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "shim.h"
+#include "capstream.h"
+#include "synth.h"
+#include "latency.h"
+#include "gesture.h"
+#include "smooth.h"
+#include "buttons.h"
+#include "reportmap.h"
+#include "coalesce.h"
+#include "eventqueue.h"
+#include "hci.h"
+#include "activate.h"
+#include "atttrack.h"
+#include "profile.h"
+#include "tracefilter.h"
+#include "tracepoints.h"
+#include "tracepoint.h"
+
+extern "C" DRIVER_INITIALIZE DriverEntry;
+
+#define BENCH_PIPE_EVENTS   0
+#define BENCH_PIPE_ACL_IN   1
+#define BENCH_PIPE_ACL_OUT  2
+#define BENCH_PIPES         3
+
+#define BENCH_BUFFER_SIZE   1024
+
+#define BENCH_PATH_ACL_IN   0
+#define BENCH_PATH_ACL_OUT  1
+#define BENCH_PATH_EVENT    2
+#define BENCH_PATH_TIMER    3
+#define BENCH_PATHS         4
+
+#define BENCH_MAX_THREADS   64
+
+const char *	PathNames[BENCH_PATHS] = { "ACL in", "ACL out", "HCI event", "Timers" };
+const char *	TypeNames[SYNTH_PACKET_TYPES] = { "Connect", "Button", "Touch", "Move", "Voice", "GATT" };
+
+typedef struct _BENCH_PATH {
+
+	ULONGLONG	Packets;
+	ULONGLONG	Nanoseconds;
+
+} BENCH_PATH, *PBENCH_PATH;
+
+//
+// Latency of a packet through the filter. Times under 8 ns have their own
+// bucket, the others are in 8 buckets per power of 2, so a percentile is
+// off by at most an eighth.
+//
+#define BENCH_LATENCY_STEPS     8
+#define BENCH_LATENCY_BUCKETS   (62 * BENCH_LATENCY_STEPS)
+
+typedef struct _BENCH_LATENCY {
+
+	ULONGLONG	Count[BENCH_LATENCY_BUCKETS];
+	ULONGLONG	Max;
+
+} BENCH_LATENCY, *PBENCH_LATENCY;
+
+//
+// Perf counters of a thread, in user mode.
+//
+#define BENCH_COUNTER_CYCLES        0
+#define BENCH_COUNTER_INSTRUCTIONS  1
+#define BENCH_COUNTER_CACHE_MISSES  2
+#define BENCH_COUNTERS              3
+
+typedef struct _BENCH_STATS {
+
+	BENCH_PATH		Paths[BENCH_PATHS];
+	BENCH_PATH		Types[SYNTH_PACKET_TYPES];
+	BENCH_LATENCY	Latency;
+	ULONGLONG		Hidden;			// reads the filter sent down again
+	ULONGLONG		Counters[BENCH_COUNTERS];
+	BOOLEAN			Counted;		// the counters could be opened
+
+} BENCH_STATS, *PBENCH_STATS;
+
+//
+// A read the stack keeps pending. It stays at the adapter until a packet
+// comes in on its pipe.
+//
+typedef struct _BENCH_READER {
+
+	URB			Urb;
+	UCHAR		Buffer[BENCH_BUFFER_SIZE];
+	BOOLEAN		Submitted;		// by the stack, not yet completed to it
+	WDFREQUEST	Pending;		// at the adapter
+
+} BENCH_READER, *PBENCH_READER;
+
+//
+// What a thread passing packets through the filter keeps to itself, its
+// own reads like the stack has several outstanding. Threads are cache
+// line aligned, the bench shouldn't add false sharing of its own.
+//
+typedef struct alignas(64) _BENCH_THREAD {
+
+	BENCH_READER	Readers[BENCH_PIPES];
+	URB				WriteUrb;
+	UCHAR			WriteBuffer[BENCH_BUFFER_SIZE];
+	BENCH_STATS		Stats;
+
+} BENCH_THREAD, *PBENCH_THREAD;
+
+//
+// The adapter below the filter and the stack above it.
+//
+typedef struct _BENCH_ADAPTER {
+
+	WDFDEVICE				Device;
+	UCHAR					Pipes[BENCH_PIPES];		// their addresses are the pipe handles
+
+	std::atomic<ULONGLONG>	Injected;				// writes the filter sent on its own
+	std::atomic<ULONGLONG>	Failed;					// URBs completed to the stack with an error
+	BOOLEAN					FailWrites;				// the stack's writes can't be sent
+
+	//
+	// Sees every packet written on the ACL out pipe, the filter's too,
+	// before it completes, and fails it if it returns FALSE. NULL for
+	// none.
+	//
+	BOOLEAN					(*Written)(PURB Urb, const UCHAR *Data, ULONG Length);
+
+} BENCH_ADAPTER, *PBENCH_ADAPTER;
+
+BENCH_ADAPTER	Adapter;
+
+//
+// The first is the main thread's, the others the workers of -j.
+//
+BENCH_THREAD	Threads[1 + BENCH_MAX_THREADS];
+
+//
+// The application reading events.
+//
+#define BENCH_READER_FREQUENCY  10000000
+
+typedef struct _BENCH_CONSUMER {
+
+	SHIM_HANDLE					Handle;
+	ULONG						Every;			// packets between reads, 0 for no reader
+	ULONG						ActionTicks;	// acting on an event takes that long
+	ULONGLONG					Packets;
+	ULONGLONG					Reads;
+	ULONGLONG					Lost;
+	ULONGLONG					VoiceLost;
+	PFILTER_EVENT_BUFFER_HEADER	Buffer;
+	ULONG						Size;
+	LATENCY_TRACKER				Input;
+	LATENCY_TRACKER				Voice;
+	USHORT						Buttons;		// what the decoding keeps
+	LONG						X;
+	LONG						Y;
+	ULONG						Checksum;
+	BOOLEAN						Coalescing;		// moves may wait in the filter past a read
+	LONGLONG					Opened;			// driver counter when it subscribed
+	LONGLONG					LastTaken;		// Taken of the read before
+	ULONGLONG					Stamps;			// timestamps checked
+	ULONGLONG					Wrong;			// out of order or outside their window
+	LONGLONG					MaxSkew;		// reader ticks Taken mapped outside the read
+
+} BENCH_CONSUMER, *PBENCH_CONSUMER;
+
+BENCH_CONSUMER	Consumer;
+
+//
+// What happens to voice frames on their way to the filter, each in that
+// many of a thousand frames.
+//
+typedef struct _BENCH_IMPAIR {
+
+	ULONG		DropPerMille;
+	ULONG		DupPerMille;
+	ULONG		SwapPerMille;		// held back until after the connection's next frame
+	ULONG		CutPerMille;		// to half their value
+	ULONG		Random;
+	ULONGLONG	Dropped;
+	ULONGLONG	Duplicated;
+	ULONGLONG	Swapped;
+	ULONGLONG	Cut;
+	BOOLEAN		Holding;
+	BOOLEAN		HeldCut;
+	USHORT		HeldHandle;
+	ULONG		HeldLength;
+	ULONGLONG	HeldIndex;
+	UCHAR		Held[BENCH_BUFFER_SIZE];
+	UCHAR		Shortened[BENCH_BUFFER_SIZE];
+
+} BENCH_IMPAIR, *PBENCH_IMPAIR;
+
+BENCH_IMPAIR	Impair;
+
+//
+// What the filter's voice accounting should come to, worked out from the
+// frames each connection sent and the ones that reached the filter, in
+// the order and at the time they did. Frames are numbered as they are
+// sent, the filter only sees the 8 bit counter in their first byte.
+//
+typedef struct _BENCH_VOICE_STREAM {
+
+	BOOLEAN		Active;				// a session is going on
+	BOOLEAN		Full;				// a frame not cut came in this session
+	USHORT		Handle;
+	ULONGLONG	Sent;
+	ULONGLONG	First;				// frame the session started with
+	ULONGLONG	Latest;				// latest frame sent that came in
+	ULONGLONG	Distinct;			// frames from First on that came in
+	LONGLONG	End;				// time the last frame came in
+	ULONGLONG	Seen[256];			// frame + 1, by frame modulo 256
+
+} BENCH_VOICE_STREAM, *PBENCH_VOICE_STREAM;
+
+typedef struct _BENCH_VOICE_TRUTH {
+
+	BOOLEAN					Checked;	// the filter's totals are checked against these
+	LONGLONG				Period;		// ticks between frames, 0 if Late isn't checked
+	FILTER_VOICE_SESSION	Totals;
+	BENCH_VOICE_STREAM		Streams[HCI_MAX_CONNECTIONS];
+
+} BENCH_VOICE_TRUTH, *PBENCH_VOICE_TRUTH;
+
+BENCH_VOICE_TRUTH	VoiceTruth;
+
+//
+// The gestures the generated touches were, in the order they came down,
+// and how the recognizer did on them.
+//
+#define BENCH_GESTURE_LABELS	16
+
+typedef struct _BENCH_LABEL {
+
+	LONGLONG	Start;			// interrupt time of the touch down
+	LONGLONG	End;			// and of the lift, SYNTH_NEVER until then
+	UCHAR		Type;
+	BOOLEAN		Matched;
+
+} BENCH_LABEL, *PBENCH_LABEL;
+
+typedef struct _BENCH_GESTURES {
+
+	BOOLEAN				Enabled;
+	GESTURE_STATE		State;
+	struct {
+		ULONG			Head;
+		ULONG			Count;
+		BENCH_LABEL		Labels[BENCH_GESTURE_LABELS];
+	}					Remotes[HCI_MAX_CONNECTIONS];
+	ULONGLONG			Labelled[GESTURE_TYPES];
+	ULONGLONG			Recognized[GESTURE_TYPES][GESTURE_TYPES];	// by label, GESTURE_NONE for missed
+	ULONGLONG			Extra[GESTURE_TYPES];						// without a touch to go with
+	ULONGLONG			Reports[GESTURE_TYPES];						// summed over the right ones
+	ULONG				MaxReports[GESTURE_TYPES];
+	LATENCY_HISTOGRAM	Latency[GESTURE_TYPES];						// start to recognition, ns
+
+} BENCH_GESTURES, *PBENCH_GESTURES;
+
+BENCH_GESTURES	Gestures;
+
+//
+// The smoothing of the trackpad positions, run by the application on the
+// events as they are read, one per report, next to the positions
+// reported. The speed of the reported positions over at least
+// BENCH_SMOOTH_SPAN tells a finger about still from one moving: jitter
+// is the second difference of consecutive positions while it is still,
+// lag how far behind the reported position the smoothed one is along the
+// speed while it moves.
+//
+#define BENCH_SMOOTH_HISTORY	16
+#define BENCH_SMOOTH_CONTACTS	2
+#define BENCH_SMOOTH_SPAN		(20 * 10000)	// 100ns units
+#define BENCH_SMOOTH_MIN_SPEED	0.5				// units per ms
+
+typedef struct _BENCH_SMOOTH_CONTACT {
+
+	SMOOTH_CONTACT	Smooth;
+	ULONG			Points;			// since the touch down
+	LONGLONG		Time[BENCH_SMOOTH_HISTORY];
+	LONG			X[BENCH_SMOOTH_HISTORY];
+	LONG			Y[BENCH_SMOOTH_HISTORY];
+	LONG			SmoothX[BENCH_SMOOTH_HISTORY];
+	LONG			SmoothY[BENCH_SMOOTH_HISTORY];
+
+} BENCH_SMOOTH_CONTACT, *PBENCH_SMOOTH_CONTACT;
+
+typedef struct _BENCH_SMOOTH {
+
+	BOOLEAN					Enabled;
+	FILTER_SMOOTH_CONFIG	Config;
+	SMOOTH_PARAMS			Params;
+	USHORT					Handles[HCI_MAX_CONNECTIONS];
+	BENCH_SMOOTH_CONTACT	Contacts[HCI_MAX_CONNECTIONS][BENCH_SMOOTH_CONTACTS];
+	ULONGLONG				Moves;
+	BENCH_LATENCY			Step;
+	ULONGLONG				Compared;
+	ULONGLONG				Jitters;
+	double					Jitter;			// sums of squares
+	double					SmoothJitter;
+	ULONGLONG				Lags;
+	double					Lag;			// ms
+	double					Error;			// units
+
+} BENCH_SMOOTH, *PBENCH_SMOOTH;
+
+BENCH_SMOOTH	Smoothing;
+
+//
+// The button engine of -B, run on its own without the filter. Each thread
+// simulates its remotes pressing buttons with the intent of one action at
+// a time, a quiet gap between them longer than a double click waits, and
+// checks that the engine emits that action, at its time. The transitions
+// are scheduled on a timer wheel of their own and handed to the engine a
+// tick at a time, like a reader of events would, and only the engine is
+// timed.
+//
+#define BENCH_BUTTON_STEPS		8
+#define BENCH_BUTTON_BUTTONS	10
+#define BENCH_BUTTON_TICK		(BUTTON_TICK_MS * 10000)	// 100ns units
+
+const BUTTON_RULE	BenchButtonRules[] = {
+	{ 0x0001, BUTTON_ACTION_CLICK, 100 }, { 0x0002, BUTTON_ACTION_CLICK, 101 },
+	{ 0x0004, BUTTON_ACTION_CLICK, 102 }, { 0x0008, BUTTON_ACTION_CLICK, 103 },
+	{ 0x0010, BUTTON_ACTION_CLICK, 104 }, { 0x0020, BUTTON_ACTION_CLICK, 105 },
+	{ 0x0040, BUTTON_ACTION_CLICK, 106 }, { 0x0080, BUTTON_ACTION_CLICK, 107 },
+	{ 0x0100, BUTTON_ACTION_CLICK, 108 }, { 0x0200, BUTTON_ACTION_CLICK, 109 },
+	{ 0x0001, BUTTON_ACTION_DOUBLE, 200 }, { 0x0002, BUTTON_ACTION_DOUBLE, 201 },
+	{ 0x0004, BUTTON_ACTION_DOUBLE, 202 }, { 0x0008, BUTTON_ACTION_DOUBLE, 203 },
+	{ 0x0001, BUTTON_ACTION_LONG, 300 }, { 0x0002, BUTTON_ACTION_LONG, 301 },
+	{ 0x0004, BUTTON_ACTION_LONG, 302 }, { 0x0010, BUTTON_ACTION_LONG, 304 },
+	{ 0x0020, BUTTON_ACTION_LONG, 305 }, { 0x0100, BUTTON_ACTION_LONG, 308 },
+	{ 0x0003, BUTTON_ACTION_CHORD, 400 }, { 0x000C, BUTTON_ACTION_CHORD, 401 },
+	{ 0x0070, BUTTON_ACTION_CHORD, 402 }, { 0x0300, BUTTON_ACTION_CHORD, 403 },
+};
+
+typedef struct _BENCH_BUTTON_EXPECT {
+
+	BOOLEAN		Valid;
+	UCHAR		Kind;
+	ULONG		Action;
+	LONGLONG	Time;
+
+} BENCH_BUTTON_EXPECT, *PBENCH_BUTTON_EXPECT;
+
+typedef struct _BENCH_BUTTON_REMOTE {
+
+	TIMER_WHEEL_ENTRY	Timer;			// first, of its next step
+	ULONG				Index;
+	ULONG				Step;
+	ULONG				Steps;
+	LONGLONG			Times[BENCH_BUTTON_STEPS];
+	USHORT				Buttons[BENCH_BUTTON_STEPS];
+	BENCH_BUTTON_EXPECT	Next;			// of the steps, from their first
+	BENCH_BUTTON_EXPECT	Expected;		// of the steps before
+
+} BENCH_BUTTON_REMOTE, *PBENCH_BUTTON_REMOTE;
+
+typedef struct _BENCH_TRANSITION {
+
+	ULONG		Remote;
+	USHORT		Buttons;
+	LONGLONG	Time;
+
+} BENCH_TRANSITION, *PBENCH_TRANSITION;
+
+typedef struct alignas(64) _BENCH_BUTTONS {
+
+	ULONG					Random;
+	ULONG					RemoteCount;
+	const BUTTON_MAP *		Map;
+	BUTTON_ENGINE			Engine;
+	PBUTTON_REMOTE			Remotes;
+	PBENCH_BUTTON_REMOTE	Simulated;
+	TIMER_WHEEL				Schedule;
+	PBENCH_TRANSITION		Batch;
+	ULONG					Batched;
+	LONGLONG				Now;			// of the engine call going on
+
+	ULONGLONG				Transitions;
+	ULONGLONG				Fired;			// timers the wheel fired
+	ULONGLONG				Ticks;
+	ULONGLONG				Nanoseconds;
+	BENCH_LATENCY			Tick;			// the engine's work of a tick, ns
+	ULONGLONG				Expected[BUTTON_ACTION_KINDS];
+	ULONGLONG				Right[BUTTON_ACTION_KINDS];
+	ULONGLONG				Wrong[BUTTON_ACTION_KINDS];		// by what was expected
+	ULONGLONG				OffTime[BUTTON_ACTION_KINDS];
+	ULONGLONG				Missed[BUTTON_ACTION_KINDS];
+	ULONGLONG				Extra[BUTTON_ACTION_KINDS];
+	BENCH_LATENCY			Late[BUTTON_ACTION_KINDS];		// emitted after their time, ns
+
+} BENCH_BUTTONS, *PBENCH_BUTTONS;
+
+//
+// A thread's each, like Threads.
+//
+BENCH_BUTTONS	ButtonBench[BENCH_MAX_THREADS];
+
+//
+// The report maps of -R and -M. Each real one comes with a report and
+// some of the values it decodes into, and the layout flags the filter
+// picks for that report. The Siri map is one the remote could have: its
+// reports decode like the fixed layout of coalesce.h does them, a button
+// report of 2 bytes and a trackpad report of 11.
+//
+#define BENCH_MAP_CHECKS		5
+#define BENCH_SIRI_REPORTS		100000
+
+typedef struct _BENCH_REPORT_MAP {
+
+	const char *	Name;
+	const UCHAR *	Map;
+	ULONG			Length;
+	UCHAR			ReportId;
+	ULONG			ReportBytes;
+	ULONG			Fields;					// of the report
+	UCHAR			Layout;					// COALESCE_LAYOUT_* of the report
+	UCHAR			Report[16];
+	ULONG			Values;					// Report decodes into
+	REPORT_VALUE	Checks[BENCH_MAP_CHECKS];	// some of them
+
+} BENCH_REPORT_MAP, *PBENCH_REPORT_MAP;
+
+const UCHAR BenchKeyboardMap[] = {
+	0x05, 0x01, 0x09, 0x06, 0xA1, 0x01, 0x05, 0x07, 0x19, 0xE0, 0x29, 0xE7, 0x15, 0x00, 0x25, 0x01,
+	0x75, 0x01, 0x95, 0x08, 0x81, 0x02, 0x95, 0x01, 0x75, 0x08, 0x81, 0x01, 0x95, 0x05, 0x75, 0x01,
+	0x05, 0x08, 0x19, 0x01, 0x29, 0x05, 0x91, 0x02, 0x95, 0x01, 0x75, 0x03, 0x91, 0x01, 0x95, 0x06,
+	0x75, 0x08, 0x15, 0x00, 0x25, 0x65, 0x05, 0x07, 0x19, 0x00, 0x29, 0x65, 0x81, 0x00, 0xC0,
+};
+
+const UCHAR BenchMouseMap[] = {
+	0x05, 0x01, 0x09, 0x02, 0xA1, 0x01, 0x09, 0x01, 0xA1, 0x00, 0x05, 0x09, 0x19, 0x01, 0x29, 0x03,
+	0x15, 0x00, 0x25, 0x01, 0x95, 0x03, 0x75, 0x01, 0x81, 0x02, 0x95, 0x01, 0x75, 0x05, 0x81, 0x01,
+	0x05, 0x01, 0x09, 0x30, 0x09, 0x31, 0x15, 0x81, 0x25, 0x7F, 0x75, 0x08, 0x95, 0x02, 0x81, 0x06,
+	0xC0, 0xC0,
+};
+
+const UCHAR BenchConsumerMap[] = {
+	0x05, 0x0C, 0x09, 0x01, 0xA1, 0x01, 0x85, 0x03, 0x15, 0x00, 0x26, 0xFF, 0x03, 0x19, 0x00, 0x2A,
+	0xFF, 0x03, 0x75, 0x10, 0x95, 0x01, 0x81, 0x00, 0xC0,
+};
+
+//
+// A precision touchpad's finger, with physical extents and units.
+//
+const UCHAR BenchTouchpadMap[] = {
+	0x05, 0x0D, 0x09, 0x05, 0xA1, 0x01, 0x85, 0x01, 0x09, 0x22, 0xA1, 0x02, 0x15, 0x00, 0x25, 0x01,
+	0x09, 0x47, 0x09, 0x42, 0x95, 0x02, 0x75, 0x01, 0x81, 0x02, 0x95, 0x01, 0x75, 0x02, 0x25, 0x03,
+	0x09, 0x51, 0x81, 0x02, 0x75, 0x01, 0x95, 0x04, 0x81, 0x03, 0x05, 0x01, 0x15, 0x00, 0x26, 0xFF,
+	0x0F, 0x75, 0x10, 0x55, 0x0E, 0x65, 0x11, 0x09, 0x30, 0x35, 0x00, 0x46, 0xB5, 0x04, 0x95, 0x01,
+	0x81, 0x02, 0x46, 0x8A, 0x03, 0x09, 0x31, 0x81, 0x02, 0xC0, 0x55, 0x0C, 0x66, 0x01, 0x10, 0x47,
+	0xFF, 0xFF, 0x00, 0x00, 0x27, 0xFF, 0xFF, 0x00, 0x00, 0x75, 0x10, 0x95, 0x01, 0x05, 0x0D, 0x09,
+	0x56, 0x81, 0x02, 0x09, 0x54, 0x25, 0x7F, 0x95, 0x01, 0x75, 0x08, 0x81, 0x02, 0x05, 0x09, 0x09,
+	0x01, 0x25, 0x01, 0x75, 0x01, 0x95, 0x01, 0x81, 0x02, 0x95, 0x07, 0x81, 0x03, 0xC0,
+};
+
+//
+// Report 1 the buttons, report 2 the buttons and the trackpad: contact
+// and tip switch a nibble each, X and Y 12 bits, 5 bytes not decoded.
+//
+const UCHAR BenchSiriMap[] = {
+	0x05, 0x01, 0x09, 0x02, 0xA1, 0x01, 0x85, 0x01, 0x05, 0x09, 0x19, 0x01, 0x29, 0x10, 0x15, 0x00,
+	0x25, 0x01, 0x75, 0x01, 0x95, 0x10, 0x81, 0x02, 0x85, 0x02, 0x19, 0x01, 0x29, 0x10, 0x81, 0x02,
+	0x05, 0x0D, 0x09, 0x51, 0x25, 0x0F, 0x75, 0x04, 0x95, 0x01, 0x81, 0x02, 0x09, 0x42, 0x81, 0x02,
+	0x05, 0x01, 0x09, 0x30, 0x09, 0x31, 0x26, 0xFF, 0x0F, 0x75, 0x0C, 0x95, 0x02, 0x81, 0x02, 0x75,
+	0x08, 0x95, 0x05, 0x81, 0x01, 0xC0,
+};
+
+const BENCH_REPORT_MAP BenchReportMaps[] = {
+	{ "Keyboard", BenchKeyboardMap, sizeof(BenchKeyboardMap), 0, 8, 2, 0,
+		{ 0x02, 0x00, 0x04, 0x05 }, 10,
+		{ { 0x07, 0xE0, 0 }, { 0x07, 0xE1, 1 }, { 0x07, 0x04, 1 }, { 0x07, 0x05, 1 } } },
+	{ "Mouse", BenchMouseMap, sizeof(BenchMouseMap), 0, 3, 2, COALESCE_LAYOUT_BUTTONS,
+		{ 0x01, 0xFE, 0x05 }, 5,
+		{ { 0x09, 0x01, 1 }, { 0x09, 0x03, 0 }, { 0x01, 0x30, -2 }, { 0x01, 0x31, 5 } } },
+	{ "Consumer", BenchConsumerMap, sizeof(BenchConsumerMap), 3, 2, 1, 0,
+		{ 0xE9, 0x00 }, 1,
+		{ { 0x0C, 0xE9, 1 } } },
+	{ "Touchpad", BenchTouchpadMap, sizeof(BenchTouchpadMap), 1, 9, 8,
+		COALESCE_LAYOUT_BUTTONS | COALESCE_LAYOUT_TOUCH | COALESCE_LAYOUT_CONTACT | COALESCE_LAYOUT_TOUCHING,
+		{ 0x07, 0x34, 0x12, 0x78, 0x06, 0x10, 0x00, 0x01, 0x01 }, 8,
+		{ { 0x0D, 0x42, 1 }, { 0x0D, 0x51, 1 }, { 0x01, 0x30, 0x1234 }, { 0x01, 0x31, 0x678 }, { 0x09, 0x01, 1 } } },
+	{ "Siri", BenchSiriMap, sizeof(BenchSiriMap), 2, 11, 4,
+		COALESCE_LAYOUT_BUTTONS | COALESCE_LAYOUT_TOUCH | COALESCE_LAYOUT_CONTACT | COALESCE_LAYOUT_TOUCHING,
+		{ 0x01, 0x00, 0x30, 0x23, 0x61, 0x45, 0xCA, 0x8A, 0x07, 0x02, 0xA2 }, 20,
+		{ { 0x09, 0x01, 1 }, { 0x09, 0x02, 0 }, { 0x0D, 0x51, 0 }, { 0x0D, 0x42, 3 }, { 0x01, 0x31, 0x456 } } },
+};
+
+//
+// A random report map of -R, and the elements of its input reports it was
+// built with, in the order of their bits.
+//
+#define BENCH_GEN_REPORTS		3
+#define BENCH_GEN_ELEMENTS		60
+#define BENCH_GEN_MAP_BYTES		FILTER_REPORT_MAP_MAX
+
+typedef struct _BENCH_ELEMENT {
+
+	UCHAR		Report;
+	UCHAR		BitSize;
+	BOOLEAN		Array;
+	USHORT		BitOffset;
+	USHORT		UsagePage;
+	USHORT		Usage;				// of a variable, UsageMin of an array
+	USHORT		UsageMax;
+	LONG		LogicalMin;
+	LONG		LogicalMax;
+
+} BENCH_ELEMENT, *PBENCH_ELEMENT;
+
+typedef struct _BENCH_GEN_MAP {
+
+	ULONG			Random;
+	UCHAR			Map[BENCH_GEN_MAP_BYTES];
+	ULONG			Length;
+	BOOLEAN			HasIds;
+	BOOLEAN			Used[BENCH_GEN_REPORTS];		// has an input item
+	ULONG			Bits[BENCH_GEN_REPORTS];
+	ULONG			ElementCount;
+	BENCH_ELEMENT	Elements[BENCH_GEN_ELEMENTS];
+
+} BENCH_GEN_MAP, *PBENCH_GEN_MAP;
+
+ULONG
+PipeIndex(
+	USBD_PIPE_HANDLE	PipeHandle
+)
+{
+	for (ULONG i = 0; i < BENCH_PIPES; i++) {
+		if (PipeHandle == &Adapter.Pipes[i])
+			return i;
+	}
+
+	return BENCH_PIPES;
+}
+
+//
+// The thread a URB of the bench belongs to, NULL for one of the filter's.
+//
+PBENCH_THREAD
+UrbThread(
+	PURB	Urb
+)
+{
+	PUCHAR p = (PUCHAR)Urb;
+
+	if (p < (PUCHAR)Threads || p >= (PUCHAR)(Threads + ARRAYSIZE(Threads)))
+		return NULL;
+
+	return &Threads[(p - (PUCHAR)Threads) / sizeof(BENCH_THREAD)];
+}
+
+PBENCH_READER
+UrbReader(
+	PURB	Urb
+)
+{
+	PBENCH_THREAD thread = UrbThread(Urb);
+
+	if (thread != NULL) {
+		for (ULONG i = 0; i < BENCH_PIPES; i++) {
+			if (Urb == &thread->Readers[i].Urb)
+				return &thread->Readers[i];
+		}
+	}
+
+	return NULL;
+}
+
+//
+// The adapter. Everything but reads is done right away.
+//
+BOOLEAN
+AdapterSend(
+	PVOID		Context,
+	WDFREQUEST	Request,
+	PURB		Urb
+)
+{
+	UNREFERENCED_PARAMETER(Context);
+
+	if (Urb != NULL && Urb->UrbHeader.Function == URB_FUNCTION_SELECT_CONFIGURATION) {
+		PUSBD_INTERFACE_INFORMATION interfaceInfo = &Urb->UrbSelectConfiguration.Interface;
+
+		for (ULONG i = 0; i < interfaceInfo->NumberOfPipes; i++) {
+			PUSBD_PIPE_INFORMATION pipe = &interfaceInfo->Pipes[i];
+
+			if (pipe->EndpointAddress == 0x81)
+				pipe->PipeHandle = &Adapter.Pipes[BENCH_PIPE_EVENTS];
+			else if (pipe->EndpointAddress == 0x82)
+				pipe->PipeHandle = &Adapter.Pipes[BENCH_PIPE_ACL_IN];
+			else
+				pipe->PipeHandle = &Adapter.Pipes[BENCH_PIPE_ACL_OUT];
+		}
+	} else if (Urb != NULL && Urb->UrbHeader.Function == URB_FUNCTION_BULK_OR_INTERRUPT_TRANSFER) {
+		ULONG pipe = PipeIndex(Urb->UrbBulkOrInterruptTransfer.PipeHandle);
+
+		if (pipe == BENCH_PIPES)
+			return FALSE;
+
+		if (Urb->UrbBulkOrInterruptTransfer.TransferFlags & USBD_TRANSFER_DIRECTION_IN) {
+			PBENCH_READER reader = UrbReader(Urb);
+
+			if (reader == NULL)
+				return FALSE;
+
+			reader->Pending = Request;
+			return TRUE;
+		}
+
+		if (Adapter.Written != NULL && pipe == BENCH_PIPE_ACL_OUT) {
+			PMDL mdl = Urb->UrbBulkOrInterruptTransfer.TransferBufferMDL;
+
+			if (!Adapter.Written(Urb,
+					Urb->UrbBulkOrInterruptTransfer.TransferBuffer != NULL ?
+						(const UCHAR *)Urb->UrbBulkOrInterruptTransfer.TransferBuffer : (const UCHAR *)mdl->MappedSystemVa,
+					Urb->UrbBulkOrInterruptTransfer.TransferBufferLength))
+				return FALSE;
+		}
+
+		if (UrbThread(Urb) == NULL)
+			Adapter.Injected++;
+		else if (Adapter.FailWrites)
+			return FALSE;
+	}
+
+	if (Urb != NULL)
+		Urb->UrbHeader.Status = USBD_STATUS_SUCCESS;
+
+	ShimCompleteLowerRequest(Request, STATUS_SUCCESS);
+
+	return TRUE;
+}
+
+//
+// The stack above, a completed read is submitted again with the next
+// packet on its pipe.
+//
+VOID
+StackComplete(
+	PVOID		Context,
+	PURB		Urb,
+	NTSTATUS	Status
+)
+{
+	PBENCH_READER reader = UrbReader(Urb);
+
+	UNREFERENCED_PARAMETER(Context);
+
+	if (!NT_SUCCESS(Status))
+		Adapter.Failed++;
+
+	if (reader != NULL)
+		reader->Submitted = FALSE;
+}
+
+NTSTATUS
+SelectConfiguration()
+{
+	USB_CONFIGURATION_DESCRIPTOR	configuration;
+	UCHAR							buffer[sizeof(struct _URB_SELECT_CONFIGURATION) + 2 * sizeof(USBD_PIPE_INFORMATION)];
+	PURB							urb = (PURB)buffer;
+	PUSBD_INTERFACE_INFORMATION		interfaceInfo = &urb->UrbSelectConfiguration.Interface;
+	static const UCHAR				endpoints[] = { 0x81, 0x82, 0x02 };
+	static const USBD_PIPE_TYPE		types[] = { UsbdPipeTypeInterrupt, UsbdPipeTypeBulk, UsbdPipeTypeBulk };
+
+	memset(&configuration, 0, sizeof(configuration));
+	memset(buffer, 0, sizeof(buffer));
+
+	urb->UrbHeader.Length = sizeof(buffer);
+	urb->UrbHeader.Function = URB_FUNCTION_SELECT_CONFIGURATION;
+	urb->UrbSelectConfiguration.ConfigurationDescriptor = &configuration;
+
+	interfaceInfo->Length = (USHORT)GET_USBD_INTERFACE_SIZE(3);
+	interfaceInfo->Class = 0xE0;
+	interfaceInfo->NumberOfPipes = 3;
+
+	for (ULONG i = 0; i < 3; i++) {
+		interfaceInfo->Pipes[i].EndpointAddress = endpoints[i];
+		interfaceInfo->Pipes[i].PipeType = types[i];
+		interfaceInfo->Pipes[i].MaximumPacketSize = 64;
+	}
+
+	return ShimSubmitUrb(Adapter.Device, urb);
+}
+
+//
+// Loads the filter and attaches it to the adapter.
+//
+BOOLEAN
+StartFilter(
+	const char *	HardwareId
+)
+{
+	SHIM_DEVICE_CONFIG	config;
+	NTSTATUS			status;
+
+	status = ShimLoadDriver(DriverEntry);
+	if (!NT_SUCCESS(status)) {
+		printf("DriverEntry failed, 0x%x\n", (unsigned)status);
+		return FALSE;
+	}
+
+	memset(&config, 0, sizeof(config));
+	config.HardwareId = HardwareId;
+	config.LowerSend = AdapterSend;
+	config.UpperComplete = StackComplete;
+
+	status = ShimAddDevice(&config, &Adapter.Device);
+	if (!NT_SUCCESS(status)) {
+		printf("Adding the device failed, 0x%x\n", (unsigned)status);
+		ShimUnloadDriver();
+		return FALSE;
+	}
+
+	SelectConfiguration();
+
+	return TRUE;
+}
+
+//
+// Pending reads come back cancelled, like on surprise removal, then the
+// filter is unloaded.
+//
+VOID
+StopFilter()
+{
+	for (ULONG t = 0; t < ARRAYSIZE(Threads); t++) {
+		for (ULONG i = 0; i < BENCH_PIPES; i++) {
+			PBENCH_READER reader = &Threads[t].Readers[i];
+
+			if (reader->Pending != NULL) {
+				WDFREQUEST request = reader->Pending;
+
+				reader->Pending = NULL;
+				reader->Urb.UrbHeader.Status = USBD_STATUS_CANCELED;
+				ShimCompleteLowerRequest(request, STATUS_CANCELLED);
+			}
+		}
+	}
+
+	ShimRemoveDevice(Adapter.Device);
+	ShimUnloadDriver();
+}
+
+ULONGLONG
+Elapsed(
+	std::chrono::steady_clock::time_point	Start
+)
+{
+	return (ULONGLONG)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - Start).count();
+}
+
+ULONG
+LatencyBucket(
+	ULONGLONG	Nanoseconds
+)
+{
+	ULONG msb;
+
+	if (Nanoseconds < BENCH_LATENCY_STEPS)
+		return (ULONG)Nanoseconds;
+
+	msb = 63 - __builtin_clzll(Nanoseconds);
+
+	return (msb - 2) * BENCH_LATENCY_STEPS + (ULONG)((Nanoseconds >> (msb - 3)) & (BENCH_LATENCY_STEPS - 1));
+}
+
+VOID
+LatencyAdd(
+	PBENCH_LATENCY	Latency,
+	ULONGLONG		Nanoseconds
+)
+{
+	Latency->Count[min(LatencyBucket(Nanoseconds), (ULONG)BENCH_LATENCY_BUCKETS - 1)]++;
+	Latency->Max = max(Latency->Max, Nanoseconds);
+}
+
+//
+// The time Percent of the packets took at most, the top of their bucket.
+//
+ULONGLONG
+LatencyPercentile(
+	const BENCH_LATENCY *	Latency,
+	double					Percent
+)
+{
+	ULONGLONG	total = 0;
+	ULONGLONG	seen = 0;
+
+	for (ULONG b = 0; b < BENCH_LATENCY_BUCKETS; b++)
+		total += Latency->Count[b];
+
+	for (ULONG b = 0; b < BENCH_LATENCY_BUCKETS; b++) {
+		seen += Latency->Count[b];
+
+		if (total != 0 && seen >= total * Percent / 100) {
+			ULONG		msb = b / BENCH_LATENCY_STEPS + 2;
+			ULONGLONG	top;
+
+			if (b < BENCH_LATENCY_STEPS)
+				return b;
+
+			top = ((ULONGLONG)(BENCH_LATENCY_STEPS + 1 + b % BENCH_LATENCY_STEPS) << (msb - 3)) - 1;
+
+			return min(top, Latency->Max);
+		}
+	}
+
+	return Latency->Max;
+}
+
+//
+// Runs the timers due by Now, the interrupt time.
+//
+VOID
+RunTimers(
+	PBENCH_THREAD	Thread,
+	LONGLONG		Now
+)
+{
+	ULONGLONG due = ShimNextTimerDue();
+
+	if (due != 0 && due <= (ULONGLONG)Now) {
+		auto start = std::chrono::steady_clock::now();
+
+		Thread->Stats.Paths[BENCH_PATH_TIMER].Packets += ShimRunTimers();
+		Thread->Stats.Paths[BENCH_PATH_TIMER].Nanoseconds += Elapsed(start);
+	}
+}
+
+//
+// Passes a packet through the filter on the reads and writes of Thread,
+// Data holds Captured of its Length bytes. Returns the nanoseconds it
+// took.
+//
+ULONGLONG
+ReplayPacket(
+	PBENCH_THREAD	Thread,
+	UCHAR			Kind,
+	UCHAR			Direction,
+	const UCHAR *	Data,
+	ULONG			Captured,
+	ULONG			Length
+)
+{
+	ULONG		length = min(Length, (ULONG)BENCH_BUFFER_SIZE);
+	ULONG		captured = min(Captured, length);
+	ULONGLONG	nanoseconds = 0;
+	PBENCH_PATH	path;
+
+	if (Direction == HCI_DIRECTION_IN) {
+		ULONG			pipe = Kind == TRACE_KIND_HCI_EVENT ? BENCH_PIPE_EVENTS : BENCH_PIPE_ACL_IN;
+		PBENCH_READER	reader = &Thread->Readers[pipe];
+		WDFREQUEST		request;
+
+		path = &Thread->Stats.Paths[Kind == TRACE_KIND_HCI_EVENT ? BENCH_PATH_EVENT : BENCH_PATH_ACL_IN];
+
+		auto start = std::chrono::steady_clock::now();
+
+		if (!reader->Submitted) {
+			UsbBuildInterruptOrBulkTransferRequest(&reader->Urb,
+				sizeof(struct _URB_BULK_OR_INTERRUPT_TRANSFER),
+				&Adapter.Pipes[pipe],
+				reader->Buffer,
+				NULL,
+				BENCH_BUFFER_SIZE,
+				USBD_TRANSFER_DIRECTION_IN | USBD_SHORT_TRANSFER_OK,
+				NULL);
+
+			reader->Submitted = TRUE;
+			ShimSubmitUrb(Adapter.Device, &reader->Urb);
+		}
+
+		request = reader->Pending;
+		if (request == NULL)
+			return 0;
+
+		reader->Pending = NULL;
+
+		memcpy(reader->Buffer, Data, captured);
+		memset(reader->Buffer + captured, 0, length - captured);
+		reader->Urb.UrbBulkOrInterruptTransfer.TransferBufferLength = length;
+		reader->Urb.UrbHeader.Status = USBD_STATUS_SUCCESS;
+
+		ShimCompleteLowerRequest(request, STATUS_SUCCESS);
+
+		nanoseconds = Elapsed(start);
+
+		if (reader->Pending != NULL)
+			Thread->Stats.Hidden++;
+	} else if (Kind == TRACE_KIND_ACL) {
+		path = &Thread->Stats.Paths[BENCH_PATH_ACL_OUT];
+
+		memcpy(Thread->WriteBuffer, Data, captured);
+		memset(Thread->WriteBuffer + captured, 0, length - captured);
+
+		auto start = std::chrono::steady_clock::now();
+
+		UsbBuildInterruptOrBulkTransferRequest(&Thread->WriteUrb,
+			sizeof(struct _URB_BULK_OR_INTERRUPT_TRANSFER),
+			&Adapter.Pipes[BENCH_PIPE_ACL_OUT],
+			Thread->WriteBuffer,
+			NULL,
+			length,
+			USBD_TRANSFER_DIRECTION_OUT,
+			NULL);
+
+		ShimSubmitUrb(Adapter.Device, &Thread->WriteUrb);
+
+		nanoseconds = Elapsed(start);
+	} else {
+		return 0;
+	}
+
+	path->Nanoseconds += nanoseconds;
+	path->Packets++;
+	LatencyAdd(&Thread->Stats.Latency, nanoseconds);
+
+	return nanoseconds;
+}
+
+BOOLEAN
+ImpairChance(
+	PBENCH_IMPAIR	Impair,
+	ULONG			PerMille
+)
+{
+	ULONG x = Impair->Random;
+
+	if (PerMille == 0)
+		return FALSE;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	Impair->Random = x;
+
+	return x % 1000 < PerMille;
+}
+
+PBENCH_VOICE_STREAM
+VoiceTruthStream(
+	USHORT	Handle
+)
+{
+	for (ULONG i = 0; i < HCI_MAX_CONNECTIONS; i++) {
+		PBENCH_VOICE_STREAM stream = &VoiceTruth.Streams[i];
+
+		if (stream->Handle == Handle || stream->Handle == 0) {
+			stream->Handle = Handle;
+			return stream;
+		}
+	}
+
+	return NULL;
+}
+
+//
+// Counts the missing frames of the session going on into Totals, the
+// ones between its first frame and its latest that never came.
+//
+VOID
+VoiceTruthFinish(
+	PBENCH_VOICE_STREAM		Stream,
+	PFILTER_VOICE_SESSION	Totals
+)
+{
+	if (Stream->Active)
+		Totals->Missing += (ULONG)(Stream->Latest - Stream->First + 1 - Stream->Distinct);
+}
+
+//
+// Numbers a voice frame as its connection sends it.
+//
+ULONGLONG
+VoiceTruthSend(
+	USHORT	Handle
+)
+{
+	PBENCH_VOICE_STREAM stream = VoiceTruthStream(Handle);
+
+	return stream != NULL ? stream->Sent++ : 0;
+}
+
+//
+// Counts a voice frame the filter got, at the interrupt time it got it.
+//
+VOID
+VoiceTruthArrive(
+	USHORT		Handle,
+	ULONGLONG	Index,
+	BOOLEAN		Cut
+)
+{
+	PBENCH_VOICE_STREAM		stream = VoiceTruthStream(Handle);
+	PFILTER_VOICE_SESSION	totals = &VoiceTruth.Totals;
+	LONGLONG				now = (LONGLONG)KeQueryInterruptTime();
+	ULONGLONG *				seen;
+
+	if (stream == NULL)
+		return;
+
+	if (stream->Active && now - stream->End > (LONGLONG)FILTER_VOICE_DEFAULT_GAP_MS * 10000) {
+		VoiceTruthFinish(stream, totals);
+		stream->Active = FALSE;
+	}
+
+	if (!stream->Active) {
+		stream->Active = TRUE;
+		stream->Full = FALSE;
+		stream->First = Index;
+		stream->Latest = Index;
+		stream->Distinct = 0;
+		memset(stream->Seen, 0, sizeof(stream->Seen));
+	} else {
+		if (stream->Seen[Index % 256] == Index + 1)
+			totals->Duplicates++;
+		else if (Index < stream->Latest)
+			totals->Reordered++;
+
+		if (VoiceTruth.Period != 0 && now - stream->End > 2 * VoiceTruth.Period)
+			totals->Late++;
+	}
+
+	seen = &stream->Seen[Index % 256];
+
+	if (*seen != Index + 1 && Index >= stream->First)
+		stream->Distinct++;
+
+	*seen = Index + 1;
+	stream->Latest = max(stream->Latest, Index);
+	stream->End = now;
+
+	if (Cut && stream->Full)
+		totals->Short++;
+
+	stream->Full |= !Cut;
+	totals->Frames++;
+}
+
+//
+// Passes a packet through the filter like ReplayPacket, except for what
+// Impair does to voice frames on the way. Returns the nanoseconds the
+// filter took.
+//
+ULONGLONG
+PassPacket(
+	PBENCH_THREAD	Thread,
+	UCHAR			Kind,
+	UCHAR			Direction,
+	const UCHAR *	Data,
+	ULONG			Captured,
+	ULONG			Length
+)
+{
+	PBENCH_IMPAIR	impair = &Impair;
+	ULONGLONG		nanoseconds;
+	ULONGLONG		index;
+	BOOLEAN			cut = FALSE;
+
+	if (Kind != TRACE_KIND_ACL || Direction != HCI_DIRECTION_IN ||
+		Length <= 30 || Captured != Length || Length > BENCH_BUFFER_SIZE ||
+		Data[ATT_PDU_OFFSET] != ATT_OP_HANDLE_VALUE_NTF)
+		return ReplayPacket(Thread, Kind, Direction, Data, Captured, Length);
+
+	index = VoiceTruthSend(HCI_ACL_HANDLE(Data));
+
+	if (ImpairChance(impair, impair->DropPerMille)) {
+		impair->Dropped++;
+		return 0;
+	}
+
+	if (ImpairChance(impair, impair->CutPerMille)) {
+		ULONG value = (Length - ATT_PDU_OFFSET - 3) / 2;
+
+		Length = ATT_PDU_OFFSET + 3 + value;
+		Captured = Length;
+
+		memcpy(impair->Shortened, Data, Length);
+		impair->Shortened[2] = (UCHAR)(Length - HCI_ACL_HEADER_LENGTH);
+		impair->Shortened[3] = (UCHAR)((Length - HCI_ACL_HEADER_LENGTH) >> 8);
+		impair->Shortened[4] = (UCHAR)(Length - ATT_PDU_OFFSET);
+		impair->Shortened[5] = (UCHAR)((Length - ATT_PDU_OFFSET) >> 8);
+		Data = impair->Shortened;
+
+		impair->Cut++;
+		cut = TRUE;
+	}
+
+	if (!impair->Holding && ImpairChance(impair, impair->SwapPerMille)) {
+		memcpy(impair->Held, Data, Length);
+		impair->HeldLength = Length;
+		impair->HeldHandle = HCI_ACL_HANDLE(Data);
+		impair->HeldIndex = index;
+		impair->HeldCut = cut;
+		impair->Holding = TRUE;
+		impair->Swapped++;
+		return 0;
+	}
+
+	nanoseconds = ReplayPacket(Thread, Kind, Direction, Data, Captured, Length);
+	VoiceTruthArrive(HCI_ACL_HANDLE(Data), index, cut);
+
+	if (ImpairChance(impair, impair->DupPerMille)) {
+		nanoseconds += ReplayPacket(Thread, Kind, Direction, Data, Captured, Length);
+		VoiceTruthArrive(HCI_ACL_HANDLE(Data), index, cut);
+		impair->Duplicated++;
+	}
+
+	if (impair->Holding && impair->HeldHandle == HCI_ACL_HANDLE(Data)) {
+		impair->Holding = FALSE;
+		nanoseconds += ReplayPacket(Thread, Kind, Direction, impair->Held, impair->HeldLength, impair->HeldLength);
+		VoiceTruthArrive(impair->HeldHandle, impair->HeldIndex, impair->HeldCut);
+	}
+
+	return nanoseconds;
+}
+
+//
+// A frame still held back when the traffic ends comes last.
+//
+VOID
+PassHeld(
+	PBENCH_THREAD	Thread
+)
+{
+	if (Impair.Holding) {
+		Impair.Holding = FALSE;
+		ReplayPacket(Thread, TRACE_KIND_ACL, HCI_DIRECTION_IN, Impair.Held, Impair.HeldLength, Impair.HeldLength);
+		VoiceTruthArrive(Impair.HeldHandle, Impair.HeldIndex, Impair.HeldCut);
+	}
+}
+
+LONGLONG
+ReaderCounter()
+{
+	struct timespec	now;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+
+	return (LONGLONG)now.tv_sec * BENCH_READER_FREQUENCY + now.tv_nsec / (1000000000 / BENCH_READER_FREQUENCY);
+}
+
+//
+// Maps the driver's counter onto the reader's, from the fastest of a few
+// samples.
+//
+VOID
+ConsumerSampleClock(
+	PBENCH_CONSUMER	Consumer
+)
+{
+	FILTER_CLOCK	clock;
+	ULONG			bytesReturned;
+
+	for (ULONG i = 0; i < 8; i++) {
+		LONGLONG before = ReaderCounter();
+
+		if (!NT_SUCCESS(ShimDeviceIoControl(Consumer->Handle, IOCTL_GET_CLOCK, NULL, 0,
+			&clock, sizeof(clock), &bytesReturned)))
+			return;
+
+		LONGLONG after = ReaderCounter();
+
+		if (Consumer->Input.Clock.DriverFrequency == 0) {
+			LatencyTrackerInit(&Consumer->Input, clock.Frequency, BENCH_READER_FREQUENCY);
+			LatencyTrackerInit(&Consumer->Voice, clock.Frequency, BENCH_READER_FREQUENCY);
+		}
+
+		LatencyClockSample(&Consumer->Input.Clock, before, clock.PerformanceCounter, after);
+		LatencyClockSample(&Consumer->Voice.Clock, before, clock.PerformanceCounter, after);
+	}
+}
+
+BOOLEAN
+ConsumerOpen(
+	PBENCH_CONSUMER	Consumer
+)
+{
+	FILTER_EVENT_SUBSCRIPTION	subscription;
+	ULONG						bytesReturned;
+	NTSTATUS					status;
+
+	Consumer->Size = sizeof(FILTER_EVENT_BUFFER_HEADER) +
+		FILTER_EVENT_QUEUE_LENGTH * sizeof(FILTER_EVENT) +
+		FILTER_VOICE_QUEUE_LENGTH * sizeof(FILTER_VOICE_FRAME);
+	Consumer->Buffer = (PFILTER_EVENT_BUFFER_HEADER)malloc(Consumer->Size);
+	if (Consumer->Buffer == NULL)
+		return FALSE;
+
+	status = ShimOpenControl(&Consumer->Handle);
+	if (!NT_SUCCESS(status)) {
+		printf("Couldn't open the control device, 0x%x\n", (unsigned)status);
+		free(Consumer->Buffer);
+		return FALSE;
+	}
+
+	subscription.Classes = FILTER_EVENT_CLASS_ALL;
+	subscription.Handle = FILTER_EVENT_ANY_HANDLE;
+	subscription.Attribute = FILTER_EVENT_ANY_HANDLE;
+
+	status = ShimDeviceIoControl(Consumer->Handle, IOCTL_SUBSCRIBE_EVENTS,
+		&subscription, sizeof(subscription), NULL, 0, &bytesReturned);
+	if (!NT_SUCCESS(status)) {
+		printf("IOCTL_SUBSCRIBE_EVENTS failed, 0x%x\n", (unsigned)status);
+		ShimCloseControl(Consumer->Handle);
+		free(Consumer->Buffer);
+		return FALSE;
+	}
+
+	ConsumerSampleClock(Consumer);
+
+	Consumer->Opened = Consumer->Input.Clock.DriverBase;
+	Consumer->LastTaken = Consumer->Opened;
+
+	return TRUE;
+}
+
+//
+// Keeps the label of a generated touch going down, and when it lifts.
+//
+VOID
+GesturesLabel(
+	const SYNTH_PACKET *	Packet
+)
+{
+	ULONG remote = (ULONG)(HCI_ACL_HANDLE(Packet->Data) - SYNTH_FIRST_HANDLE);
+
+	if (!Gestures.Enabled || remote >= HCI_MAX_CONNECTIONS || Packet->Type != SYNTH_PACKET_TOUCH)
+		return;
+
+	auto labels = &Gestures.Remotes[remote];
+
+	if (Packet->Gesture != GESTURE_NONE) {
+		if (labels->Count == BENCH_GESTURE_LABELS) {
+			PBENCH_LABEL oldest = &labels->Labels[labels->Head];
+
+			if (!oldest->Matched)
+				Gestures.Recognized[oldest->Type][GESTURE_NONE]++;
+
+			labels->Head = (labels->Head + 1) % BENCH_GESTURE_LABELS;
+			labels->Count--;
+		}
+
+		PBENCH_LABEL label = &labels->Labels[(labels->Head + labels->Count++) % BENCH_GESTURE_LABELS];
+
+		label->Start = Packet->Time + 1;
+		label->End = SYNTH_NEVER;
+		label->Type = Packet->Gesture;
+		label->Matched = FALSE;
+		Gestures.Labelled[label->Type]++;
+	} else if (labels->Count != 0) {
+		labels->Labels[(labels->Head + labels->Count - 1) % BENCH_GESTURE_LABELS].End = Packet->Time + 1;
+	}
+}
+
+//
+// Matches a gesture with the touch it started in. Touches that lifted
+// before it started and weren't matched were missed, a scroll goes on
+// after its first step.
+//
+VOID
+GesturesCheck(
+	const GESTURE *	Gesture
+)
+{
+	ULONG remote = (ULONG)(Gesture->Handle - SYNTH_FIRST_HANDLE);
+
+	if (remote >= HCI_MAX_CONNECTIONS)
+		return;
+
+	auto labels = &Gestures.Remotes[remote];
+
+	while (labels->Count != 0) {
+		PBENCH_LABEL label = &labels->Labels[labels->Head];
+
+		if (label->End >= Gesture->Start)
+			break;
+
+		if (!label->Matched)
+			Gestures.Recognized[label->Type][GESTURE_NONE]++;
+
+		labels->Head = (labels->Head + 1) % BENCH_GESTURE_LABELS;
+		labels->Count--;
+	}
+
+	PBENCH_LABEL label = &labels->Labels[labels->Head];
+
+	if (labels->Count == 0 || Gesture->Start < label->Start) {
+		Gestures.Extra[Gesture->Type]++;
+		return;
+	}
+
+	if (label->Matched) {
+		if (Gesture->Type != GESTURE_SCROLL)
+			Gestures.Extra[Gesture->Type]++;
+		return;
+	}
+
+	label->Matched = TRUE;
+	Gestures.Recognized[label->Type][Gesture->Type]++;
+
+	if (label->Type == Gesture->Type) {
+		Gestures.Reports[label->Type] += Gesture->Reports;
+		Gestures.MaxReports[label->Type] = max(Gestures.MaxReports[label->Type], Gesture->Reports);
+		LatencyHistogramAdd(&Gestures.Latency[label->Type], (Gesture->Time - Gesture->Start) * 100);
+	}
+}
+
+//
+// What the recognizer made of the labelled touches. Returns FALSE if it
+// took any for another, missed any or made any up.
+//
+BOOLEAN
+PrintGestures()
+{
+	ULONGLONG	right = 0;
+	ULONGLONG	labelled = 0;
+	ULONGLONG	failed = 0;
+
+	if (!Gestures.Enabled)
+		return TRUE;
+
+	//
+	// What is still in the queues lifted before the last read or is still
+	// going, only the first were missed.
+	//
+	for (ULONG i = 0; i < HCI_MAX_CONNECTIONS; i++) {
+		auto labels = &Gestures.Remotes[i];
+
+		for (ULONG j = 0; j < labels->Count; j++) {
+			PBENCH_LABEL label = &labels->Labels[(labels->Head + j) % BENCH_GESTURE_LABELS];
+
+			if (label->Matched)
+				continue;
+
+			if (label->End != SYNTH_NEVER)
+				Gestures.Recognized[label->Type][GESTURE_NONE]++;
+			else
+				Gestures.Labelled[label->Type]--;
+		}
+	}
+
+	printf("\n%-12s %8s %8s %8s %8s %8s %9s %9s %9s %9s %9s\n", "Gesture", "Labelled", "Right", "Wrong", "Missed",
+		"Extra", "Reports", "Max rep", "p50 ms", "p99 ms", "Max ms");
+
+	for (ULONG type = GESTURE_TAP; type < GESTURE_TYPES; type++) {
+		ULONGLONG	wrong = 0;
+		ULONGLONG	count = Gestures.Recognized[type][type];
+		PLATENCY_HISTOGRAM latency = &Gestures.Latency[type];
+
+		for (ULONG as = GESTURE_TAP; as < GESTURE_TYPES; as++)
+			if (as != type)
+				wrong += Gestures.Recognized[type][as];
+
+		printf("%-12s %8llu %8llu %8llu %8llu %8llu %9.1f %9u %9.1f %9.1f %9.1f\n", GestureName(type),
+			(unsigned long long)Gestures.Labelled[type],
+			(unsigned long long)count,
+			(unsigned long long)wrong,
+			(unsigned long long)Gestures.Recognized[type][GESTURE_NONE],
+			(unsigned long long)Gestures.Extra[type],
+			count != 0 ? (double)Gestures.Reports[type] / count : 0.0,
+			(unsigned)Gestures.MaxReports[type],
+			LatencyHistogramPercentile(latency, 500) / 1e6,
+			LatencyHistogramPercentile(latency, 990) / 1e6,
+			latency->Max / 1e6);
+
+		right += count;
+		labelled += Gestures.Labelled[type];
+		failed += wrong + Gestures.Recognized[type][GESTURE_NONE] + Gestures.Extra[type];
+	}
+
+	printf("%llu of %llu gestures recognized right, %llu wrong, missed or made up\n",
+		(unsigned long long)right, (unsigned long long)labelled, (unsigned long long)failed);
+
+	for (ULONG type = GESTURE_TAP; type < GESTURE_TYPES; type++)
+		for (ULONG as = GESTURE_TAP; as < GESTURE_TYPES; as++)
+			if (as != type && Gestures.Recognized[type][as] != 0)
+				printf("  %llu %s taken for %s\n", (unsigned long long)Gestures.Recognized[type][as],
+					GestureName(type), GestureName(as));
+
+	return failed == 0 && right == labelled;
+}
+
+PBENCH_SMOOTH_CONTACT
+SmoothingContact(
+	const FILTER_EVENT *	Event
+)
+{
+	if (Event->Contact >= BENCH_SMOOTH_CONTACTS)
+		return NULL;
+
+	for (ULONG i = 0; i < HCI_MAX_CONNECTIONS; i++) {
+		if (Smoothing.Handles[i] == 0)
+			Smoothing.Handles[i] = Event->Handle;
+
+		if (Smoothing.Handles[i] == Event->Handle)
+			return &Smoothing.Contacts[i][Event->Contact];
+	}
+
+	return NULL;
+}
+
+//
+// Runs a touch event through the smoothing and measures what it did.
+//
+VOID
+SmoothingEvent(
+	const FILTER_EVENT *	Event
+)
+{
+	PBENCH_SMOOTH_CONTACT	contact = SmoothingContact(Event);
+	USHORT					x = Event->X;
+	USHORT					y = Event->Y;
+	ULONG					i;
+
+	if (contact == NULL)
+		return;
+
+	switch (Event->Type) {
+	case FILTER_EVENT_TOUCH_DOWN:
+		SmoothReset(&contact->Smooth, x, y, Event->Time);
+		contact->Points = 0;
+		break;
+	case FILTER_EVENT_TOUCH_MOVE:
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		SmoothStep(&Smoothing.Params, &contact->Smooth, &x, &y, Event->Time);
+		LatencyAdd(&Smoothing.Step, Elapsed(start));
+		Smoothing.Moves++;
+		break;
+	}
+	default:
+		return;
+	}
+
+	i = contact->Points++ % BENCH_SMOOTH_HISTORY;
+	contact->Time[i] = Event->Time;
+	contact->X[i] = Event->X;
+	contact->Y[i] = Event->Y;
+	contact->SmoothX[i] = x;
+	contact->SmoothY[i] = y;
+
+	if (contact->Points < 3)
+		return;
+
+	//
+	// The speed of the reports over the span.
+	//
+	for (ULONG back = 1; back < min(contact->Points, (ULONG)BENCH_SMOOTH_HISTORY); back++) {
+		ULONG	j = (contact->Points - 1 - back) % BENCH_SMOOTH_HISTORY;
+		double	ms = (contact->Time[i] - contact->Time[j]) / 10000.0;
+
+		if (ms < BENCH_SMOOTH_SPAN / 10000.0)
+			continue;
+
+		ULONG	p1 = (contact->Points - 2) % BENCH_SMOOTH_HISTORY;
+		ULONG	p2 = (contact->Points - 3) % BENCH_SMOOTH_HISTORY;
+		double	vx = (contact->X[i] - contact->X[j]) / ms;
+		double	vy = (contact->Y[i] - contact->Y[j]) / ms;
+		double	speed2 = vx * vx + vy * vy;
+		double	dx = contact->X[i] - contact->SmoothX[i];
+		double	dy = contact->Y[i] - contact->SmoothY[i];
+
+		Smoothing.Error += sqrt(dx * dx + dy * dy);
+		Smoothing.Compared++;
+
+		if (speed2 >= BENCH_SMOOTH_MIN_SPEED * BENCH_SMOOTH_MIN_SPEED) {
+			Smoothing.Lag += (dx * vx + dy * vy) / speed2;
+			Smoothing.Lags++;
+			break;
+		}
+
+		dx = contact->X[i] - 2.0 * contact->X[p1] + contact->X[p2];
+		dy = contact->Y[i] - 2.0 * contact->Y[p1] + contact->Y[p2];
+		Smoothing.Jitter += dx * dx + dy * dy;
+
+		dx = contact->SmoothX[i] - 2.0 * contact->SmoothX[p1] + contact->SmoothX[p2];
+		dy = contact->SmoothY[i] - 2.0 * contact->SmoothY[p1] + contact->SmoothY[p2];
+		Smoothing.SmoothJitter += dx * dx + dy * dy;
+		Smoothing.Jitters++;
+		break;
+	}
+}
+
+VOID
+PrintSmoothing()
+{
+	if (!Smoothing.Enabled)
+		return;
+
+	printf("\nSmoothing from %lu mHz, %lu mHz per unit/s, speed at %lu mHz, %lu ms ahead, reports %lu us apart\n",
+		(unsigned long)Smoothing.Config.MinCutoffMilliHz, (unsigned long)Smoothing.Config.Beta,
+		(unsigned long)Smoothing.Config.DerivativeCutoffMilliHz, (unsigned long)Smoothing.Config.LookaheadMs,
+		(unsigned long)Smoothing.Config.ReportUs);
+
+	if (Smoothing.Compared == 0) {
+		printf("No moves to smooth\n");
+		return;
+	}
+
+	double jitter = Smoothing.Jitters != 0 ? sqrt(Smoothing.Jitter / Smoothing.Jitters) : 0.0;
+	double smoothJitter = Smoothing.Jitters != 0 ? sqrt(Smoothing.SmoothJitter / Smoothing.Jitters) : 0.0;
+
+	printf("%llu moves, %llu still: jitter %.2f units reported, %.2f smoothed, %.0f%% less\n",
+		(unsigned long long)Smoothing.Moves, (unsigned long long)Smoothing.Jitters, jitter, smoothJitter,
+		jitter != 0 ? 100 * (1 - smoothJitter / jitter) : 0.0);
+	printf("%llu moving: %.2f ms behind the reports, %.2f units away from them on average\n",
+		(unsigned long long)Smoothing.Lags, Smoothing.Lags != 0 ? Smoothing.Lag / Smoothing.Lags : 0.0,
+		Smoothing.Error / Smoothing.Compared);
+	printf("Step p50 %llu ns, p99 %llu ns, max %llu ns\n",
+		(unsigned long long)LatencyPercentile(&Smoothing.Step, 50),
+		(unsigned long long)LatencyPercentile(&Smoothing.Step, 99),
+		(unsigned long long)Smoothing.Step.Max);
+}
+
+//
+// What an application does with an event: a button bitmap becomes key
+// presses, moves a pointer, with -G the touches become gestures and with
+// -S their positions are smoothed.
+//
+VOID
+ConsumerDecode(
+	PBENCH_CONSUMER		Consumer,
+	const FILTER_EVENT *Event
+)
+{
+	switch (Event->Type) {
+	case FILTER_EVENT_BUTTONS:
+		for (USHORT changed = Event->Buttons ^ Consumer->Buttons; changed != 0; changed &= changed - 1)
+			Consumer->Checksum = Consumer->Checksum * 31 + __builtin_ctz(changed);
+
+		Consumer->Buttons = Event->Buttons;
+		break;
+	case FILTER_EVENT_TOUCH_MOVE:
+		Consumer->X += Event->DeltaX;
+		Consumer->Y += Event->DeltaY;
+		break;
+	default:
+		Consumer->X = Event->X;
+		Consumer->Y = Event->Y;
+		break;
+	}
+
+	if (Smoothing.Enabled)
+		SmoothingEvent(Event);
+
+	if (Gestures.Enabled) {
+		GESTURE	gestures[GESTURE_MAX_EVENT_GESTURES];
+		ULONG	count = GestureEvent(&Gestures.State, Event, gestures);
+
+		for (ULONG i = 0; i < count; i++)
+			GesturesCheck(&gestures[i]);
+	}
+}
+
+VOID
+ConsumerAct(
+	PBENCH_CONSUMER	Consumer,
+	LONGLONG		Decoded
+)
+{
+	while (ReaderCounter() - Decoded < (LONGLONG)Consumer->ActionTicks)
+		;
+}
+
+//
+// Checks the read took its events after the read before, and that the
+// driver's counter maps the moment it took them to within the read on the
+// reader's counter. The mapping may be off by the round trip of the sample
+// it was made from, and the counters drift apart by up to 1000 ppm since.
+//
+VOID
+ConsumerCheckRead(
+	PBENCH_CONSUMER	Consumer,
+	LONGLONG		Taken,
+	LONGLONG		Before,
+	LONGLONG		After
+)
+{
+	const LATENCY_CLOCK *	clock = &Consumer->Input.Clock;
+	LONGLONG				taken = LatencyClockToReader(clock, Taken);
+	LONGLONG				since = After > clock->Base ? After - clock->Base : clock->Base - After;
+	LONGLONG				tolerance = clock->RoundTrip + since / 1000 + BENCH_READER_FREQUENCY / 1000000;
+	LONGLONG				skew = taken < Before ? Before - taken : taken > After ? taken - After : 0;
+
+	Consumer->Stamps++;
+	Consumer->MaxSkew = max(Consumer->MaxSkew, skew);
+
+	if (Taken > Consumer->LastTaken && skew <= tolerance)
+		return;
+
+	if (Consumer->Wrong++ < 8)
+		printf("Read taken at %lld after %lld, mapped %lld ticks outside the read, %lld allowed\n",
+			(long long)Taken, (long long)Consumer->LastTaken, (long long)skew, (long long)tolerance);
+}
+
+//
+// Checks an event or voice frame of a read was stamped no earlier than
+// From and no later than the read took it, and that the reader got to it
+// no earlier than Ready, then decoded and acted on it in turn.
+//
+VOID
+ConsumerCheckStamps(
+	PBENCH_CONSUMER	Consumer,
+	const char *	What,
+	LONGLONG		Stamp,
+	LONGLONG		From,
+	LONGLONG		Taken,
+	LONGLONG		Ready,
+	LONGLONG		Received,
+	LONGLONG		Decoded,
+	LONGLONG		Acted
+)
+{
+	Consumer->Stamps++;
+
+	if (Stamp >= From && Stamp <= Taken && Received >= Ready && Decoded >= Received &&
+		Acted - Decoded >= (LONGLONG)Consumer->ActionTicks)
+		return;
+
+	if (Consumer->Wrong++ < 8)
+		printf("%s stamped at %lld, from %lld, taken at %lld, ready %lld, received %lld, decoded %lld, acted %lld\n",
+			What, (long long)Stamp, (long long)From, (long long)Taken, (long long)Ready,
+			(long long)Received, (long long)Decoded, (long long)Acted);
+}
+
+//
+// Reads what the filter queued, once every Every packets or, with Now,
+// right away.
+//
+VOID
+Consume(
+	PBENCH_CONSUMER	Consumer,
+	BOOLEAN			Now
+)
+{
+	PFILTER_EVENT_BUFFER_HEADER	header = Consumer->Buffer;
+	PFILTER_EVENT				events = (PFILTER_EVENT)(header + 1);
+	PFILTER_VOICE_FRAME			frames;
+	ULONG						bytesReturned;
+	LONGLONG					before;
+	LONGLONG					ready;
+	LONGLONG					received;
+	LONGLONG					decoded;
+	LONGLONG					acted;
+	LONGLONG					from;
+
+	if (Consumer->Every == 0 || (!Now && ++Consumer->Packets % Consumer->Every != 0))
+		return;
+
+	before = ReaderCounter();
+
+	if (!NT_SUCCESS(ShimDeviceIoControl(Consumer->Handle, IOCTL_GET_EVENTS, NULL, 0,
+		header, Consumer->Size, &bytesReturned)))
+		return;
+
+	ready = ReaderCounter();
+	ConsumerCheckRead(Consumer, header->Taken, before, ready);
+
+	//
+	// The counters drift a little, they are sampled again now and then.
+	//
+	if (++Consumer->Reads % 1024 == 0)
+		ConsumerSampleClock(Consumer);
+
+	Consumer->Lost += header->Lost;
+	Consumer->VoiceLost += header->VoiceLost;
+
+	//
+	// Reports came in after the read before and in order, only moves the
+	// filter coalesces may have come in before it.
+	//
+	from = Consumer->Coalescing ? Consumer->Opened : Consumer->LastTaken;
+
+	for (ULONG i = 0; i < header->EventCount; i++) {
+		received = ReaderCounter();
+		ConsumerDecode(Consumer, &events[i]);
+		decoded = ReaderCounter();
+		ConsumerAct(Consumer, decoded);
+		acted = ReaderCounter();
+
+		ConsumerCheckStamps(Consumer, "Event", events[i].Stamp, from, header->Taken, ready, received, decoded, acted);
+		LatencyTrackerAdd(&Consumer->Input, events[i].Stamp, header->Taken, received, decoded, acted);
+
+		if (!Consumer->Coalescing)
+			from = events[i].Stamp;
+		ready = acted;
+	}
+
+	frames = (PFILTER_VOICE_FRAME)(events + header->EventCount);
+	from = Consumer->LastTaken;
+
+	for (ULONG i = 0; i < header->VoiceCount; i++) {
+		received = ReaderCounter();
+
+		for (ULONG j = 0; j < frames[i].CapturedLength; j++)
+			Consumer->Checksum = Consumer->Checksum * 31 + frames[i].Data[j];
+
+		decoded = ReaderCounter();
+		ConsumerAct(Consumer, decoded);
+		acted = ReaderCounter();
+
+		ConsumerCheckStamps(Consumer, "Voice frame", frames[i].Stamp, from, header->Taken, ready, received, decoded, acted);
+		LatencyTrackerAdd(&Consumer->Voice, frames[i].Stamp, header->Taken, received, decoded, acted);
+
+		from = frames[i].Stamp;
+		ready = acted;
+	}
+
+	Consumer->LastTaken = header->Taken;
+}
+
+VOID
+PrintStages(
+	const char *			Title,
+	const LATENCY_TRACKER *	Tracker
+)
+{
+	static const char *	names[LATENCY_STAGES] = { "driver", "delivery", "decode", "action", "total" };
+
+	if (Tracker->Stages[LATENCY_STAGE_TOTAL].Count == 0)
+		return;
+
+	printf("\n%-10s %10s %10s %10s %10s %10s %10s\n", Title, "Count", "Mean us", "p50 us", "p99 us", "p99.9 us", "Max us");
+
+	for (ULONG i = 0; i < LATENCY_STAGES; i++) {
+		const LATENCY_HISTOGRAM * histogram = &Tracker->Stages[i];
+
+		printf("%-10s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f\n", names[i],
+			(unsigned long long)histogram->Count,
+			(double)histogram->Sum / histogram->Count / 1000,
+			LatencyHistogramPercentile(histogram, 500) / 1000.0,
+			LatencyHistogramPercentile(histogram, 990) / 1000.0,
+			LatencyHistogramPercentile(histogram, 999) / 1000.0,
+			histogram->Max / 1000.0);
+	}
+}
+
+//
+// Replays every record of the capture, its times moved by Offset. Returns
+// the time of the last record, 0 if the file isn't a capture.
+//
+LONGLONG
+ReplayCapture(
+	FILE *		File,
+	LONGLONG	Offset
+)
+{
+	static UCHAR			buffer[0x10000];
+	CAPSTREAM_FILE_HEADER	header;
+	CAPSTREAM_STATE			state;
+	FILTER_CAPTURE_HEADER	window;
+	FILTER_CAPTURE_RECORD	record;
+	UCHAR					type;
+	size_t					offset = 0;
+	size_t					available = 0;
+	LONGLONG				last = 0;
+
+	if (fseek(File, 0, SEEK_SET) != 0 ||
+		fread(&header, sizeof(header), 1, File) != 1 ||
+		header.Magic != CAPSTREAM_FILE_MAGIC ||
+		header.Version != CAPSTREAM_FILE_VERSION) {
+		return 0;
+	}
+
+	CapStreamInit(&state);
+
+	for (;;) {
+		LONG n = CapStreamDecode(&state, buffer + offset, (ULONG)(available - offset), &type, &window, &record);
+
+		if (n == CAPSTREAM_NEED_MORE) {
+			memmove(buffer, buffer + offset, available - offset);
+			available -= offset;
+			offset = 0;
+
+			size_t read = fread(buffer + available, 1, sizeof(buffer) - available, File);
+			if (read == 0)
+				break;
+
+			available += read;
+			continue;
+		}
+
+		if (n < 0) {
+			printf("Capture is corrupt\n");
+			break;
+		}
+
+		offset += n;
+
+		if (type == CAPSTREAM_ITEM_WINDOW)
+			continue;
+
+		last = record.Time + Offset;
+		ShimSetInterruptTime((ULONGLONG)last);
+		RunTimers(&Threads[0], last);
+
+		PassPacket(&Threads[0], record.Kind, record.Direction, record.Data, record.CapturedLength, record.Length);
+		Consume(&Consumer, FALSE);
+	}
+
+	PassHeld(&Threads[0]);
+
+	return last;
+}
+
+typedef struct _BENCH_PACING {
+
+	ULONG		Speedup;		// times the real rate, 0 for as fast as it goes
+	ULONGLONG	Behind;			// packets that were late
+	ULONGLONG	MaxLag;			// nanoseconds
+	ULONGLONG	TotalLag;
+
+} BENCH_PACING, *PBENCH_PACING;
+
+//
+// Passes Seconds of generated traffic through the filter. Returns the
+// nanoseconds it took and the packets in Packets.
+//
+ULONGLONG
+Generate(
+	const SYNTH_CONFIG *	Config,
+	ULONG					Seconds,
+	PBENCH_PACING			Pacing,
+	PULONGLONG				Packets
+)
+{
+	static SYNTH_STATE	state;
+	static SYNTH_PACKET	packet;
+	PBENCH_THREAD		thread = &Threads[0];
+	LONGLONG			end = (LONGLONG)Seconds * 10000000;
+	ULONGLONG			packets = 0;
+
+	SynthInit(&state, Config);
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (;;) {
+		SynthNext(&state, &packet);
+
+		if (packet.Time > end)
+			break;
+
+		//
+		// The interrupt time is never 0, that unpins it.
+		//
+		ShimSetInterruptTime((ULONGLONG)packet.Time + 1);
+		RunTimers(thread, packet.Time + 1);
+
+		if (Pacing->Speedup != 0) {
+			auto due = start + std::chrono::nanoseconds(packet.Time * 100 / Pacing->Speedup);
+			auto now = std::chrono::steady_clock::now();
+
+			if (now < due) {
+				std::this_thread::sleep_until(due);
+			} else {
+				ULONGLONG lag = (ULONGLONG)std::chrono::duration_cast<std::chrono::nanoseconds>(now - due).count();
+
+				Pacing->Behind++;
+				Pacing->TotalLag += lag;
+				Pacing->MaxLag = max(Pacing->MaxLag, lag);
+			}
+		}
+
+		GesturesLabel(&packet);
+
+		PBENCH_PATH type = &thread->Stats.Types[packet.Type];
+
+		type->Nanoseconds += PassPacket(thread, packet.Kind, packet.Direction, packet.Data, packet.Length, packet.Length);
+		type->Packets++;
+		packets++;
+
+		Consume(&Consumer, FALSE);
+	}
+
+	PassHeld(thread);
+
+	*Packets = packets;
+
+	return Elapsed(start);
+}
+
+//
+// Perf counters of the calling thread, as one group so they count over the
+// same time. Returns -1 where they can't be opened, in most containers and
+// VMs.
+//
+int
+CountersOpen()
+{
+	static const ULONGLONG	configs[BENCH_COUNTERS] = {
+		PERF_COUNT_HW_CPU_CYCLES,
+		PERF_COUNT_HW_INSTRUCTIONS,
+		PERF_COUNT_HW_CACHE_MISSES,
+	};
+	struct perf_event_attr	attr;
+	int						leader = -1;
+
+	for (ULONG i = 0; i < BENCH_COUNTERS; i++) {
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = configs[i];
+		attr.disabled = leader == -1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP;
+
+		int fd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+
+		if (fd < 0) {
+			if (leader != -1)
+				close(leader);
+			return -1;
+		}
+
+		if (leader == -1)
+			leader = fd;
+	}
+
+	return leader;
+}
+
+VOID
+CountersRead(
+	int				Leader,
+	PBENCH_STATS	Stats
+)
+{
+	ULONGLONG values[1 + BENCH_COUNTERS];
+
+	ioctl(Leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+	if (read(Leader, values, sizeof(values)) == (ssize_t)sizeof(values) && values[0] == BENCH_COUNTERS) {
+		for (ULONG i = 0; i < BENCH_COUNTERS; i++)
+			Stats->Counters[i] = values[1 + i];
+		Stats->Counted = TRUE;
+	}
+}
+
+typedef struct _BENCH_ROUND {
+
+	const SYNTH_CONFIG *	Config;
+	ULONG					Seconds;
+	std::atomic<ULONG>		Ready;
+	std::atomic<BOOLEAN>	Go;
+	std::atomic<ULONG>		Done;
+
+} BENCH_ROUND, *PBENCH_ROUND;
+
+//
+// Pins the calling thread to the Index'th CPU the bench may run on.
+//
+VOID
+PinThread(
+	ULONG	Index
+)
+{
+	cpu_set_t	allowed;
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0 && CPU_COUNT(&allowed) > 0) {
+		ULONG		n = Index % CPU_COUNT(&allowed);
+		cpu_set_t	cpu;
+
+		for (int c = 0; c < CPU_SETSIZE; c++) {
+			if (CPU_ISSET(c, &allowed) && n-- == 0) {
+				CPU_ZERO(&cpu);
+				CPU_SET(c, &cpu);
+				pthread_setaffinity_np(pthread_self(), sizeof(cpu), &cpu);
+				break;
+			}
+		}
+	}
+}
+
+//
+// A worker of -j. Passes Seconds of its own traffic of the remotes through
+// the filter, the remotes are already connected and their Report Maps read.
+//
+VOID
+Worker(
+	PBENCH_ROUND	Round,
+	ULONG			Index
+)
+{
+	PBENCH_THREAD	thread = &Threads[1 + Index];
+	SYNTH_CONFIG	config = *Round->Config;
+	SYNTH_STATE		state;
+	SYNTH_PACKET	packet;
+	LONGLONG		end = (LONGLONG)Round->Seconds * 10000000;
+	int				counters;
+
+	PinThread(Index);
+
+	config.Seed = config.Seed * 31 + Index + 1;
+	SynthInit(&state, &config);
+
+	counters = CountersOpen();
+
+	Round->Ready++;
+	while (!Round->Go)
+		std::this_thread::yield();
+
+	if (counters >= 0)
+		ioctl(counters, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+
+	for (;;) {
+		SynthNext(&state, &packet);
+
+		if (packet.Time > end)
+			break;
+
+		if (packet.Type == SYNTH_PACKET_CONNECT || packet.Type == SYNTH_PACKET_GATT)
+			continue;
+
+		PBENCH_PATH type = &thread->Stats.Types[packet.Type];
+
+		type->Nanoseconds += ReplayPacket(thread, packet.Kind, packet.Direction, packet.Data, packet.Length, packet.Length);
+		type->Packets++;
+	}
+
+	if (counters >= 0) {
+		CountersRead(counters, &thread->Stats);
+		close(counters);
+	}
+
+	Round->Done++;
+}
+
+//
+// Adds Stats to Total. Total only keeps counters when every stats added
+// had them.
+//
+VOID
+AddStats(
+	PBENCH_STATS		Total,
+	const BENCH_STATS *	Stats
+)
+{
+	for (ULONG i = 0; i < BENCH_PATHS; i++) {
+		Total->Paths[i].Packets += Stats->Paths[i].Packets;
+		Total->Paths[i].Nanoseconds += Stats->Paths[i].Nanoseconds;
+	}
+
+	for (ULONG i = 0; i < SYNTH_PACKET_TYPES; i++) {
+		Total->Types[i].Packets += Stats->Types[i].Packets;
+		Total->Types[i].Nanoseconds += Stats->Types[i].Nanoseconds;
+	}
+
+	for (ULONG b = 0; b < BENCH_LATENCY_BUCKETS; b++)
+		Total->Latency.Count[b] += Stats->Latency.Count[b];
+
+	Total->Latency.Max = max(Total->Latency.Max, Stats->Latency.Max);
+	Total->Hidden += Stats->Hidden;
+
+	for (ULONG i = 0; i < BENCH_COUNTERS; i++)
+		Total->Counters[i] += Stats->Counters[i];
+
+	Total->Counted = Total->Counted && Stats->Counted;
+}
+
+//
+// Runs the rounds of -j, on 1, 2, 4 and so on up to Workers threads.
+// Adds the stats of all rounds to All.
+//
+VOID
+Scale(
+	const SYNTH_CONFIG *	Config,
+	ULONG					Seconds,
+	ULONG					Workers,
+	PBENCH_STATS			All
+)
+{
+	static BENCH_STATS	total;
+	double				single = 0;
+
+	//
+	// The workers don't share a clock, the interrupt time follows the real
+	// one from here on.
+	//
+	ShimSetInterruptTime(0);
+
+	printf("%u CPUs, %u remotes, %u s of traffic per thread\n\n",
+		(unsigned)sysconf(_SC_NPROCESSORS_ONLN), (unsigned)Config->Connections, (unsigned)Seconds);
+	printf("%7s %11s %10s %7s %8s %8s %8s %8s %10s %10s %10s\n",
+		"Threads", "Packets", "Packets/s", "Scaling", "p50 ns", "p99 ns", "p99.9 ns", "Max ns",
+		"Cycles/p", "Instr/p", "Misses/p");
+
+	for (ULONG n = 1; ; n = min(n * 2, Workers)) {
+		BENCH_ROUND	round;
+		std::thread	threads[BENCH_MAX_THREADS];
+		ULONGLONG	packets = 0;
+
+		round.Config = Config;
+		round.Seconds = Seconds;
+		round.Ready = 0;
+		round.Go = FALSE;
+		round.Done = 0;
+
+		for (ULONG i = 0; i < n; i++) {
+			//
+			// Only the stats start over, reads stay pending across rounds.
+			//
+			memset(&Threads[1 + i].Stats, 0, sizeof(BENCH_STATS));
+			threads[i] = std::thread(Worker, &round, i);
+		}
+
+		while (round.Ready < n)
+			std::this_thread::yield();
+
+		auto start = std::chrono::steady_clock::now();
+
+		round.Go = TRUE;
+
+		//
+		// The timers run alongside, like DPCs on another CPU.
+		//
+		while (round.Done < n) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			RunTimers(&Threads[0], (LONGLONG)KeQueryInterruptTime());
+		}
+
+		double wall = Elapsed(start) / 1e9;
+
+		for (ULONG i = 0; i < n; i++)
+			threads[i].join();
+
+		memset(&total, 0, sizeof(total));
+		total.Counted = TRUE;
+
+		for (ULONG i = 0; i < n; i++)
+			AddStats(&total, &Threads[1 + i].Stats);
+
+		for (ULONG i = 0; i < SYNTH_PACKET_TYPES; i++)
+			packets += total.Types[i].Packets;
+
+		double rate = wall > 0 ? packets / wall : 0;
+
+		if (n == 1)
+			single = rate;
+
+		printf("%7u %11llu %10.0f %7.2f %8llu %8llu %8llu %8llu",
+			(unsigned)n,
+			(unsigned long long)packets,
+			rate,
+			single > 0 ? rate / single : 0.0,
+			(unsigned long long)LatencyPercentile(&total.Latency, 50),
+			(unsigned long long)LatencyPercentile(&total.Latency, 99),
+			(unsigned long long)LatencyPercentile(&total.Latency, 99.9),
+			(unsigned long long)total.Latency.Max);
+
+		if (total.Counted && packets != 0) {
+			printf(" %10.0f %10.0f %10.2f\n",
+				(double)total.Counters[BENCH_COUNTER_CYCLES] / packets,
+				(double)total.Counters[BENCH_COUNTER_INSTRUCTIONS] / packets,
+				(double)total.Counters[BENCH_COUNTER_CACHE_MISSES] / packets);
+		} else {
+			printf(" %10s %10s %10s\n", "-", "-", "-");
+		}
+
+		AddStats(All, &total);
+
+		if (n == Workers)
+			break;
+	}
+
+	printf("\n");
+}
+
+ULONG
+ButtonsRandom(
+	PBENCH_BUTTONS	Bench,
+	ULONG			Low,
+	ULONG			High
+)
+{
+	ULONG x = Bench->Random;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	Bench->Random = x;
+
+	return Low + x % (High - Low + 1);
+}
+
+//
+// A random time from Low to High, in 100ns units like them.
+//
+LONGLONG
+ButtonsTicks(
+	PBENCH_BUTTONS	Bench,
+	LONGLONG		Low,
+	LONGLONG		High
+)
+{
+	return Low + ButtonsRandom(Bench, 0, (ULONG)(High - Low));
+}
+
+//
+// One of the buttons in Mask, as its index.
+//
+ULONG
+ButtonsPick(
+	PBENCH_BUTTONS	Bench,
+	USHORT			Mask
+)
+{
+	ULONG n = ButtonsRandom(Bench, 1, __builtin_popcount(Mask));
+
+	for (ULONG b = 0; ; b++)
+		if ((Mask & (1 << b)) && --n == 0)
+			return b;
+}
+
+VOID
+ButtonsStep(
+	PBENCH_BUTTON_REMOTE	Remote,
+	LONGLONG				Time,
+	USHORT					Buttons
+)
+{
+	Remote->Times[Remote->Steps] = Time;
+	Remote->Buttons[Remote->Steps] = Buttons;
+	Remote->Steps++;
+}
+
+//
+// Presses, or releases, the buttons of a chord in a random order, starting
+// at Start and within Spread of it. Returns the time of the last one.
+//
+LONGLONG
+ButtonsChordSteps(
+	PBENCH_BUTTONS			Bench,
+	PBENCH_BUTTON_REMOTE	Remote,
+	USHORT					Chord,
+	BOOLEAN					Press,
+	LONGLONG				Start,
+	LONGLONG				Spread
+)
+{
+	LONGLONG	times[BUTTON_MAX_BUTTONS];
+	USHORT		left = Chord;
+	USHORT		held = Press ? 0 : Chord;
+	LONGLONG	last = Start;
+
+	for (ULONG b = 0; b < BUTTON_MAX_BUTTONS; b++)
+		if (Chord & (1 << b))
+			times[b] = ButtonsTicks(Bench, Start, Start + Spread);
+
+	while (left != 0) {
+		ULONG first = BUTTON_MAX_BUTTONS;
+
+		for (ULONG b = 0; b < BUTTON_MAX_BUTTONS; b++)
+			if ((left & (1 << b)) && (first == BUTTON_MAX_BUTTONS || times[b] < times[first]))
+				first = b;
+
+		left &= (USHORT)~(1 << first);
+		held ^= (USHORT)(1 << first);
+		last = times[first];
+		ButtonsStep(Remote, last, held);
+	}
+
+	return last;
+}
+
+//
+// A random time from Low to High, or half the time within 2ms before or
+// after Edge, where a timer wheel alone would get it wrong.
+//
+LONGLONG
+ButtonsEdge(
+	PBENCH_BUTTONS	Bench,
+	LONGLONG		Low,
+	LONGLONG		High,
+	LONGLONG		Edge,
+	BOOLEAN			Before
+)
+{
+	if (ButtonsRandom(Bench, 0, 1))
+		return ButtonsTicks(Bench, Low, High);
+
+	return Before ? ButtonsTicks(Bench, Edge - 20000, Edge - 1) : ButtonsTicks(Bench, Edge, Edge + 20000);
+}
+
+//
+// Plans what a remote does next from Start: a click of any button, a
+// double click or long press of a button that has one, or a chord. Their
+// timing is within the engine's limits, often just. Arms the schedule for
+// its first step.
+//
+VOID
+ButtonsPlan(
+	PBENCH_BUTTONS			Bench,
+	PBENCH_BUTTON_REMOTE	Remote,
+	LONGLONG				Start
+)
+{
+	const BUTTON_MAP *		map = Bench->Map;
+	PBENCH_BUTTON_EXPECT	next = &Remote->Next;
+	LONGLONG				ms = 10000;
+	LONGLONG				t = Start;
+	ULONG					pick = ButtonsRandom(Bench, 0, 9);
+	ULONG					b;
+	USHORT					chord;
+
+	Remote->Step = 0;
+	Remote->Steps = 0;
+	next->Valid = TRUE;
+
+	if (pick < 4) {
+		b = ButtonsRandom(Bench, 0, BENCH_BUTTON_BUTTONS - 1);
+		ButtonsStep(Remote, t, (USHORT)(1 << b));
+		t += ButtonsEdge(Bench, 20 * ms, map->LongTicks - 50 * ms, map->LongTicks, TRUE);
+		ButtonsStep(Remote, t, 0);
+
+		next->Kind = BUTTON_ACTION_CLICK;
+		next->Action = map->Actions[b][BUTTON_ACTION_CLICK];
+		next->Time = t + ((map->DoubleMask & (1 << b)) ? map->DoubleTicks : 0);
+
+	} else if (pick < 6) {
+		b = ButtonsPick(Bench, map->DoubleMask);
+		ButtonsStep(Remote, t, (USHORT)(1 << b));
+		t += ButtonsTicks(Bench, 20 * ms, 120 * ms);
+		ButtonsStep(Remote, t, 0);
+		t += ButtonsEdge(Bench, 20 * ms, map->DoubleTicks - 20 * ms, map->DoubleTicks, TRUE);
+		ButtonsStep(Remote, t, (USHORT)(1 << b));
+
+		next->Kind = BUTTON_ACTION_DOUBLE;
+		next->Action = map->Actions[b][BUTTON_ACTION_DOUBLE];
+		next->Time = t;
+
+		t += ButtonsTicks(Bench, 20 * ms, 120 * ms);
+		ButtonsStep(Remote, t, 0);
+
+	} else if (pick < 8) {
+		b = ButtonsPick(Bench, map->LongMask);
+		ButtonsStep(Remote, t, (USHORT)(1 << b));
+
+		next->Kind = BUTTON_ACTION_LONG;
+		next->Action = map->Actions[b][BUTTON_ACTION_LONG];
+		next->Time = t + map->LongTicks;
+
+		t += ButtonsEdge(Bench, map->LongTicks + 20 * ms, map->LongTicks + 400 * ms, map->LongTicks, FALSE);
+		ButtonsStep(Remote, t, 0);
+
+	} else {
+		b = ButtonsRandom(Bench, 0, map->ChordCount - 1);
+		chord = map->Chords[b];
+		t = ButtonsChordSteps(Bench, Remote, chord, TRUE, t, map->ChordTicks / 2);
+
+		next->Kind = BUTTON_ACTION_CHORD;
+		next->Action = map->ChordActions[b];
+		next->Time = t;
+
+		t += ButtonsTicks(Bench, 50 * ms, 200 * ms);
+		ButtonsChordSteps(Bench, Remote, chord, FALSE, t, 50 * ms);
+	}
+
+	TimerWheelArm(&Bench->Schedule, &Remote->Timer, Remote->Times[0]);
+}
+
+//
+// A remote's next step is due in the tick the schedule is in. Batches it
+// and the steps after it in the same tick, and arms the schedule for the
+// rest, or for the next plan after a quiet gap.
+//
+VOID
+ButtonsDue(
+	PVOID				Context,
+	PTIMER_WHEEL_ENTRY	Entry
+)
+{
+	PBENCH_BUTTONS			bench = (PBENCH_BUTTONS)Context;
+	PBENCH_BUTTON_REMOTE	remote = (PBENCH_BUTTON_REMOTE)Entry;
+	LONGLONG				tick = (LONGLONG)bench->Schedule.Now * bench->Schedule.Tick;
+	LONGLONG				ms = 10000;
+
+	while (remote->Step < remote->Steps && remote->Times[remote->Step] <= tick) {
+		if (remote->Step == 0) {
+			if (remote->Expected.Valid)
+				bench->Missed[remote->Expected.Kind]++;
+
+			remote->Expected = remote->Next;
+			bench->Expected[remote->Expected.Kind]++;
+		}
+
+		PBENCH_TRANSITION transition = &bench->Batch[bench->Batched++];
+
+		transition->Remote = remote->Index;
+		transition->Buttons = remote->Buttons[remote->Step];
+		transition->Time = remote->Times[remote->Step];
+		remote->Step++;
+	}
+
+	if (remote->Step < remote->Steps) {
+		TimerWheelArm(&bench->Schedule, &remote->Timer, remote->Times[remote->Step]);
+	} else {
+		ButtonsPlan(bench, remote, remote->Times[remote->Steps - 1] +
+			ButtonsTicks(bench, bench->Map->DoubleTicks + 50 * ms, bench->Map->DoubleTicks + 1000 * ms));
+	}
+}
+
+//
+// An action the engine emitted, checked against what its remote meant.
+// The check runs inside the engine's timing, it is a few compares.
+//
+VOID
+ButtonsAction(
+	PVOID					Context,
+	const BUTTON_ACTION *	Action
+)
+{
+	PBENCH_BUTTONS			bench = (PBENCH_BUTTONS)Context;
+	PBENCH_BUTTON_EXPECT	expected = &bench->Simulated[Action->Remote].Expected;
+
+	if (!expected->Valid) {
+		bench->Extra[Action->Kind]++;
+		return;
+	}
+
+	expected->Valid = FALSE;
+
+	if (Action->Kind != expected->Kind || Action->Action != expected->Action) {
+		bench->Wrong[expected->Kind]++;
+	} else if (Action->Time != expected->Time) {
+		bench->OffTime[expected->Kind]++;
+	} else {
+		bench->Right[expected->Kind]++;
+		LatencyAdd(&bench->Late[expected->Kind], (ULONGLONG)(bench->Now - Action->Time) * 100);
+	}
+}
+
+//
+// A thread of -B. Simulates Seconds of its remotes, a tick at a time.
+//
+VOID
+ButtonsRun(
+	PBENCH_BUTTONS	Bench,
+	ULONG			Index,
+	ULONG			Seconds
+)
+{
+	LONGLONG	end = (LONGLONG)Seconds * 10000000;
+
+	PinThread(Index);
+
+	Bench->Remotes = (PBUTTON_REMOTE)calloc(Bench->RemoteCount, sizeof(BUTTON_REMOTE));
+	Bench->Simulated = (PBENCH_BUTTON_REMOTE)calloc(Bench->RemoteCount, sizeof(BENCH_BUTTON_REMOTE));
+	Bench->Batch = (PBENCH_TRANSITION)calloc((size_t)Bench->RemoteCount * BENCH_BUTTON_STEPS, sizeof(BENCH_TRANSITION));
+
+	if (Bench->Remotes == NULL || Bench->Simulated == NULL || Bench->Batch == NULL) {
+		free(Bench->Remotes);
+		free(Bench->Simulated);
+		free(Bench->Batch);
+		Bench->Remotes = NULL;
+		return;
+	}
+
+	ButtonEngineInit(&Bench->Engine, Bench->Map, Bench->Remotes, Bench->RemoteCount, 0, ButtonsAction, Bench);
+	TimerWheelInit(&Bench->Schedule, BENCH_BUTTON_TICK, 0);
+
+	//
+	// The remotes start within the first second.
+	//
+	for (ULONG r = 0; r < Bench->RemoteCount; r++) {
+		PBENCH_BUTTON_REMOTE remote = &Bench->Simulated[r];
+
+		TimerWheelInitEntry(&remote->Timer);
+		remote->Index = r;
+		ButtonsPlan(Bench, remote, ButtonsTicks(Bench, 1, 10000000));
+	}
+
+	for (LONGLONG tick = BENCH_BUTTON_TICK; tick <= end; tick += BENCH_BUTTON_TICK) {
+		Bench->Batched = 0;
+		TimerWheelRun(&Bench->Schedule, tick, ButtonsDue, Bench);
+
+		auto start = std::chrono::steady_clock::now();
+
+		for (ULONG i = 0; i < Bench->Batched; i++) {
+			PBENCH_TRANSITION transition = &Bench->Batch[i];
+
+			Bench->Now = transition->Time;
+			ButtonEngineUpdate(&Bench->Engine, transition->Remote, transition->Buttons, transition->Time);
+		}
+
+		Bench->Now = tick;
+		Bench->Fired += ButtonEngineAdvance(&Bench->Engine, tick);
+
+		ULONGLONG nanoseconds = Elapsed(start);
+
+		Bench->Nanoseconds += nanoseconds;
+		LatencyAdd(&Bench->Tick, nanoseconds);
+		Bench->Transitions += Bench->Batched;
+		Bench->Ticks++;
+	}
+
+	//
+	// What was expected and is still to come doesn't count, what was due
+	// by the last tick was missed.
+	//
+	for (ULONG r = 0; r < Bench->RemoteCount; r++) {
+		PBENCH_BUTTON_EXPECT expected = &Bench->Simulated[r].Expected;
+
+		if (!expected->Valid)
+			continue;
+
+		if (expected->Time + BENCH_BUTTON_TICK <= end)
+			Bench->Missed[expected->Kind]++;
+		else
+			Bench->Expected[expected->Kind]--;
+	}
+
+	free(Bench->Remotes);
+	free(Bench->Simulated);
+	free(Bench->Batch);
+}
+
+//
+// Runs -B, Remotes simulated remotes on each of Workers threads for
+// Seconds of injected time, and prints what the engine made of them.
+// Returns FALSE if anything was missed, wrong or made up.
+//
+BOOLEAN
+Buttons(
+	ULONG	Remotes,
+	ULONG	Seconds,
+	ULONG	Workers,
+	ULONG	Seed
+)
+{
+	static BUTTON_MAP		map;
+	static BENCH_BUTTONS	total;
+	std::thread				threads[BENCH_MAX_THREADS];
+	ULONGLONG				wrong = 0;
+	ULONGLONG				right = 0;
+	ULONGLONG				expected = 0;
+
+	if (!ButtonMapCompile(&map, BenchButtonRules, ARRAYSIZE(BenchButtonRules), NULL)) {
+		printf("The button rules don't compile\n");
+		return FALSE;
+	}
+
+	Workers = max(Workers, 1UL);
+
+	for (ULONG i = 0; i < Workers; i++) {
+		memset(&ButtonBench[i], 0, sizeof(BENCH_BUTTONS));
+		ButtonBench[i].Random = (Seed != 0 ? Seed : 0x2545F491) * 31 + i + 1;
+		ButtonBench[i].RemoteCount = Remotes;
+		ButtonBench[i].Map = &map;
+		threads[i] = std::thread(ButtonsRun, &ButtonBench[i], i, Seconds);
+	}
+
+	for (ULONG i = 0; i < Workers; i++)
+		threads[i].join();
+
+	printf("%u remotes on each of %u threads, %u s of injected time\n\n", (unsigned)Remotes, (unsigned)Workers,
+		(unsigned)Seconds);
+	printf("%7s %12s %13s %8s %11s %10s %10s %10s\n", "Thread", "Transitions", "Transitions/s", "ns/tr",
+		"Timers", "Tick p50", "Tick p99", "Tick max");
+
+	memset(&total, 0, sizeof(total));
+
+	for (ULONG i = 0; i < Workers; i++) {
+		PBENCH_BUTTONS bench = &ButtonBench[i];
+
+		if (bench->Remotes == NULL) {
+			printf("Thread %u couldn't allocate its remotes\n", (unsigned)i);
+			return FALSE;
+		}
+
+		printf("%7u %12llu %13.0f %8.1f %11llu %8llu ns %7llu ns %7llu ns\n",
+			(unsigned)i,
+			(unsigned long long)bench->Transitions,
+			bench->Nanoseconds != 0 ? bench->Transitions * 1e9 / bench->Nanoseconds : 0.0,
+			bench->Transitions != 0 ? (double)bench->Nanoseconds / bench->Transitions : 0.0,
+			(unsigned long long)bench->Fired,
+			(unsigned long long)LatencyPercentile(&bench->Tick, 50),
+			(unsigned long long)LatencyPercentile(&bench->Tick, 99),
+			(unsigned long long)bench->Tick.Max);
+
+		for (ULONG k = 0; k < BUTTON_ACTION_KINDS; k++) {
+			total.Expected[k] += bench->Expected[k];
+			total.Right[k] += bench->Right[k];
+			total.Wrong[k] += bench->Wrong[k];
+			total.OffTime[k] += bench->OffTime[k];
+			total.Missed[k] += bench->Missed[k];
+			total.Extra[k] += bench->Extra[k];
+
+			for (ULONG b = 0; b < BENCH_LATENCY_BUCKETS; b++)
+				total.Late[k].Count[b] += bench->Late[k].Count[b];
+
+			total.Late[k].Max = max(total.Late[k].Max, bench->Late[k].Max);
+		}
+	}
+
+	printf("\n%-8s %10s %10s %8s %8s %8s %8s %10s %10s\n", "Action", "Expected", "Right", "Wrong", "Off time",
+		"Missed", "Extra", "Late p50", "Late max");
+
+	for (ULONG k = BUTTON_ACTION_CLICK; k < BUTTON_ACTION_KINDS; k++) {
+		printf("%-8s %10llu %10llu %8llu %8llu %8llu %8llu %7.3f ms %7.3f ms\n", ButtonActionName(k),
+			(unsigned long long)total.Expected[k],
+			(unsigned long long)total.Right[k],
+			(unsigned long long)total.Wrong[k],
+			(unsigned long long)total.OffTime[k],
+			(unsigned long long)total.Missed[k],
+			(unsigned long long)total.Extra[k],
+			LatencyPercentile(&total.Late[k], 50) / 1e6,
+			total.Late[k].Max / 1e6);
+
+		wrong += total.Wrong[k] + total.OffTime[k] + total.Missed[k] + total.Extra[k];
+		right += total.Right[k];
+		expected += total.Expected[k];
+	}
+
+	printf("%llu of %llu actions right\n", (unsigned long long)right, (unsigned long long)expected);
+
+	return wrong == 0;
+}
+
+ULONG
+GenRandom(
+	PBENCH_GEN_MAP	Gen
+)
+{
+	ULONG x = Gen->Random;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	Gen->Random = x;
+
+	return x;
+}
+
+//
+// Puts a short item of Size 0, 1, 2 or 4 bytes.
+//
+VOID
+GenItem(
+	PBENCH_GEN_MAP	Gen,
+	UCHAR			Prefix,
+	ULONG			Data,
+	ULONG			Size
+)
+{
+	Gen->Map[Gen->Length++] = (UCHAR)(Prefix | (Size == 4 ? 3 : Size));
+
+	for (ULONG i = 0; i < Size; i++)
+		Gen->Map[Gen->Length++] = (UCHAR)(Data >> (i * 8));
+}
+
+//
+// Puts an item with a signed value in as few bytes as hold it.
+//
+VOID
+GenSigned(
+	PBENCH_GEN_MAP	Gen,
+	UCHAR			Prefix,
+	LONG			Value
+)
+{
+	GenItem(Gen, Prefix, (ULONG)Value, Value >= -128 && Value <= 127 ? 1 : Value >= -32768 && Value <= 32767 ? 2 : 4);
+}
+
+//
+// Puts an item with an unsigned value in as few bytes as hold it, 0xFF
+// in one byte like descriptors do.
+//
+VOID
+GenUnsigned(
+	PBENCH_GEN_MAP	Gen,
+	UCHAR			Prefix,
+	ULONG			Value
+)
+{
+	GenItem(Gen, Prefix, Value, Value <= 0xFF ? 1 : Value <= 0xFFFF ? 2 : 4);
+}
+
+USHORT
+GenPage(
+	PBENCH_GEN_MAP	Gen
+)
+{
+	static const USHORT pages[] = { 0x01, 0x07, 0x09, 0x0C, 0x0D, 0xFF00 };
+
+	return pages[GenRandom(Gen) % ARRAYSIZE(pages)];
+}
+
+//
+// Puts an Input item of the elements of a variable or an array, with all
+// the globals it needs before it.
+//
+VOID
+GenData(
+	PBENCH_GEN_MAP	Gen,
+	ULONG			Report,
+	BOOLEAN			Array
+)
+{
+	USHORT	pages[3];
+	USHORT	mins[3];
+	USHORT	maxes[3];
+	ULONG	usages = 0;
+	ULONG	size;
+	ULONG	count = 1 + GenRandom(Gen) % 6;
+	USHORT	page = GenPage(Gen);
+	LONG	logicalMin;
+	LONG	logicalMax;
+
+	if (Array) {
+		ULONG range;
+
+		size = 2 + GenRandom(Gen) % 15;
+		count = min(count, 4UL);
+		logicalMin = (LONG)(GenRandom(Gen) % 2);
+		range = 1 + GenRandom(Gen) % min(200UL, (1UL << size) - 1 - logicalMin);
+		logicalMax = logicalMin + (LONG)range - 1;
+
+		pages[0] = page;
+		mins[0] = (USHORT)(1 + GenRandom(Gen) % 500);
+		maxes[0] = (USHORT)(mins[0] + range - 1);
+		usages = 1;
+	} else {
+		size = 1 + GenRandom(Gen) % 32;
+
+		if (size >= 2 && GenRandom(Gen) % 2) {
+			logicalMin = size == 32 ? (LONG)0x80000000 : -(1L << (size - 1));
+			logicalMax = size == 32 ? 0x7FFFFFFF : (1L << (size - 1)) - 1;
+		} else {
+			logicalMin = 0;
+			logicalMax = (LONG)(0xFFFFFFFFUL >> (32 - size));
+		}
+
+		switch (GenRandom(Gen) % 4) {
+		case 0:
+			pages[0] = page;
+			mins[0] = (USHORT)(1 + GenRandom(Gen) % 1000);
+			maxes[0] = (USHORT)(mins[0] + GenRandom(Gen) % count);
+			usages = 1;
+			break;
+		case 1:
+			usages = 1 + GenRandom(Gen) % 3;
+			for (ULONG i = 0; i < usages; i++) {
+				pages[i] = page;
+				mins[i] = maxes[i] = (USHORT)(1 + GenRandom(Gen) % 1000);
+			}
+			break;
+		case 2:
+			pages[0] = GenPage(Gen);
+			mins[0] = maxes[0] = (USHORT)(1 + GenRandom(Gen) % 1000);
+			usages = 1;
+			break;
+		default:
+			break;
+		}
+	}
+
+	if (Gen->ElementCount + count > BENCH_GEN_ELEMENTS)
+		return;
+
+	GenUnsigned(Gen, 0x04, page);
+	GenSigned(Gen, 0x14, logicalMin);
+
+	if (logicalMin < 0)
+		GenSigned(Gen, 0x24, logicalMax);
+	else
+		GenUnsigned(Gen, 0x24, (ULONG)logicalMax);
+
+	GenUnsigned(Gen, 0x74, size);
+	GenUnsigned(Gen, 0x94, count);
+
+	for (ULONG i = 0; i < usages; i++) {
+		if (pages[i] != page) {
+			GenItem(Gen, 0x08, ((ULONG)pages[i] << 16) | mins[i], 4);
+		} else if (mins[i] == maxes[i] && !Array) {
+			GenUnsigned(Gen, 0x08, mins[i]);
+		} else {
+			GenUnsigned(Gen, 0x18, mins[i]);
+			GenUnsigned(Gen, 0x28, maxes[i]);
+		}
+	}
+
+	GenItem(Gen, 0x80, Array ? 0x00 : GenRandom(Gen) % 4 == 0 ? 0x06 : 0x02, 1);
+
+	for (ULONG i = 0; i < count; i++) {
+		PBENCH_ELEMENT	element = &Gen->Elements[Gen->ElementCount++];
+		ULONG			index = i;
+		ULONG			u;
+
+		element->Report = (UCHAR)Report;
+		element->BitSize = (UCHAR)size;
+		element->Array = Array;
+		element->BitOffset = (USHORT)(Gen->Bits[Report] + i * size);
+		element->LogicalMin = logicalMin;
+		element->LogicalMax = logicalMax;
+		element->UsagePage = page;
+		element->Usage = 0;
+
+		if (Array) {
+			element->Usage = mins[0];
+			element->UsageMax = maxes[0];
+			continue;
+		}
+
+		//
+		// The usages in order, the last one again past them.
+		//
+		for (u = 0; u < usages; u++) {
+			if (index <= (ULONG)(maxes[u] - mins[u]))
+				break;
+
+			index -= maxes[u] - mins[u] + 1;
+		}
+
+		if (u < usages) {
+			element->UsagePage = pages[u];
+			element->Usage = (USHORT)(mins[u] + index);
+		} else if (usages != 0) {
+			element->UsagePage = pages[usages - 1];
+			element->Usage = maxes[usages - 1];
+		}
+	}
+
+	Gen->Bits[Report] += size * count;
+	Gen->Used[Report] = TRUE;
+}
+
+//
+// Builds a random report map of up to 3 input reports, with padding,
+// output items, nested collections and pushed globals in between.
+//
+VOID
+GenMap(
+	PBENCH_GEN_MAP	Gen,
+	ULONG			Seed
+)
+{
+	ULONG	reports;
+	ULONG	items;
+	ULONG	depth = 0;
+	UCHAR	id = 0;
+
+	memset(Gen, 0, sizeof(BENCH_GEN_MAP));
+	Gen->Random = Seed != 0 ? Seed : 1;
+
+	Gen->HasIds = GenRandom(Gen) % 3 != 0;
+	reports = Gen->HasIds ? 1 + GenRandom(Gen) % BENCH_GEN_REPORTS : 1;
+	items = 1 + GenRandom(Gen) % 12;
+
+	GenItem(Gen, 0x04, 0x01, 1);
+	GenItem(Gen, 0x08, 0x02, 1);
+	GenItem(Gen, 0xA0, 0x01, 1);
+
+	for (ULONG k = 0; k < items && Gen->Length < BENCH_GEN_MAP_BYTES - 64; k++) {
+		ULONG	report = GenRandom(Gen) % reports;
+		BOOLEAN	push = GenRandom(Gen) % 5 == 0;
+		UCHAR	pushedId = id;
+
+		if (depth < 3 && GenRandom(Gen) % 6 == 0) {
+			GenItem(Gen, 0xA0, 0x00, 1);
+			depth++;
+		}
+
+		if (push)
+			GenItem(Gen, 0xA4, 0, 0);
+
+		if (Gen->HasIds && id != report + 1) {
+			id = (UCHAR)(report + 1);
+			GenItem(Gen, 0x84, id, 1);
+		}
+
+		switch (GenRandom(Gen) % 8) {
+		case 0:
+		{
+			ULONG size = 1 + GenRandom(Gen) % 16;
+			ULONG count = 1 + GenRandom(Gen) % 4;
+
+			GenUnsigned(Gen, 0x74, size);
+			GenUnsigned(Gen, 0x94, count);
+			GenItem(Gen, 0x80, GenRandom(Gen) % 2 ? 0x01 : 0x03, 1);
+
+			Gen->Bits[report] += size * count;
+			Gen->Used[report] = TRUE;
+			break;
+		}
+		case 1:
+			GenUnsigned(Gen, 0x74, 1 + GenRandom(Gen) % 16);
+			GenUnsigned(Gen, 0x94, 1 + GenRandom(Gen) % 4);
+			GenItem(Gen, 0x90, 0x02, 1);
+			break;
+		case 2:
+		case 3:
+			GenData(Gen, report, TRUE);
+			break;
+		default:
+			GenData(Gen, report, FALSE);
+			break;
+		}
+
+		if (push) {
+			GenItem(Gen, 0xB4, 0, 0);
+			id = pushedId;
+		}
+
+		if (depth != 0 && GenRandom(Gen) % 3 == 0) {
+			GenItem(Gen, 0xC0, 0, 0);
+			depth--;
+		}
+	}
+
+	for (; depth != 0; depth--)
+		GenItem(Gen, 0xC0, 0, 0);
+
+	GenItem(Gen, 0xC0, 0, 0);
+}
+
+//
+// Bits of a report, one at a time, not how the filter gets them.
+//
+ULONG
+GenBits(
+	const UCHAR *	Report,
+	ULONG			BitOffset,
+	ULONG			BitSize
+)
+{
+	ULONG bits = 0;
+
+	for (ULONG b = 0; b < BitSize; b++)
+		bits |= (ULONG)((Report[(BitOffset + b) / 8] >> ((BitOffset + b) % 8)) & 1) << b;
+
+	return bits;
+}
+
+//
+// What a report of the map decodes into, from the elements it was built
+// with. Returns the number of values.
+//
+ULONG
+GenExpect(
+	const BENCH_GEN_MAP *	Gen,
+	ULONG					Report,
+	const UCHAR *			Value,
+	PREPORT_VALUE			Values
+)
+{
+	ULONG count = 0;
+
+	for (ULONG i = 0; i < Gen->ElementCount; i++) {
+		const BENCH_ELEMENT *	element = &Gen->Elements[i];
+		ULONG					bits;
+		LONG					value;
+
+		if (element->Report != Report)
+			continue;
+
+		bits = GenBits(Value, element->BitOffset, element->BitSize);
+
+		if (element->LogicalMin < 0 && element->BitSize < 32 && (bits >> (element->BitSize - 1)) != 0)
+			value = (LONG)((LONGLONG)bits - (1LL << element->BitSize));
+		else
+			value = (LONG)bits;
+
+		if (element->Array) {
+			if (value < element->LogicalMin || value > element->LogicalMax)
+				continue;
+
+			Values[count].UsagePage = element->UsagePage;
+			Values[count].Usage = (USHORT)(element->Usage + (value - element->LogicalMin));
+			Values[count].Value = 1;
+		} else {
+			Values[count].UsagePage = element->UsagePage;
+			Values[count].Usage = element->Usage;
+			Values[count].Value = value;
+		}
+
+		count++;
+	}
+
+	return count;
+}
+
+//
+// What holds for any map that compiled: the fields of each report are
+// its own, in it and no larger than 32 bits.
+//
+BOOLEAN
+MapConsistent(
+	const REPORT_MAP *	Map
+)
+{
+	ULONG fields = 0;
+
+	for (ULONG r = 0; r < Map->ReportCount; r++) {
+		const REPORT_INFO * info = &Map->Reports[r];
+
+		if (info->FieldCount == 0)
+			continue;
+
+		if ((ULONG)info->FirstField + info->FieldCount > Map->FieldCount)
+			return FALSE;
+
+		for (ULONG f = info->FirstField; f < (ULONG)info->FirstField + info->FieldCount; f++) {
+			const REPORT_FIELD * field = &Map->Fields[f];
+
+			if (field->Report != r || field->BitSize == 0 || field->BitSize > 32 || field->Count == 0 ||
+				field->BitOffset + (ULONG)field->Count * field->BitSize > info->Bits)
+				return FALSE;
+		}
+
+		fields += info->FieldCount;
+	}
+
+	return fields == Map->FieldCount;
+}
+
+//
+// Decodes a report with the map and the layout the filter would make of
+// it, for whatever they catch on the way.
+//
+VOID
+MapExercise(
+	PBENCH_GEN_MAP		Gen,
+	const REPORT_MAP *	Map
+)
+{
+	static COALESCE_STATE	state;
+	static COALESCE_LAYOUT	layout;
+	REPORT_VALUE			values[256];
+	FILTER_EVENT			events[COALESCE_MAX_REPORT_EVENTS];
+	UCHAR					report[BENCH_GEN_MAP_BYTES];
+
+	CoalesceInit(&state);
+	CoalesceCompileLayout(&layout, SYNTH_FIRST_HANDLE, Map);
+
+	for (ULONG r = 0; r < Map->ReportCount; r++) {
+		ULONG length = min((Map->Reports[r].Bits + 7) / 8 + GenRandom(Gen) % 3, (ULONG)sizeof(report));
+
+		if (length != 0 && GenRandom(Gen) % 2)
+			length--;
+
+		for (ULONG i = 0; i < length; i++)
+			report[i] = (UCHAR)GenRandom(Gen);
+
+		ReportMapDecode(Map, r, report, length, values, ARRAYSIZE(values));
+		CoalesceReport(&state, &layout, 0, SYNTH_FIRST_HANDLE, SIRI_ATT_HID_REPORT, report, length, 1, 1, events);
+	}
+}
+
+//
+// Compiles a real map, checks its report decodes into what it should and
+// the layout the filter makes of it, and times both. Returns FALSE if any
+// of it is off.
+//
+BOOLEAN
+MapCheckReal(
+	const BENCH_REPORT_MAP *	Real,
+	ULONG						Decodes
+)
+{
+	static REPORT_MAP		map;
+	static COALESCE_LAYOUT	layout;
+	REPORT_VALUE			values[64];
+	ULONG					report;
+	ULONG					count = 0;
+	UCHAR					flags = 0;
+	ULONGLONG				compile;
+	ULONGLONG				decode;
+	volatile ULONG			sink = 0;
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (ULONG i = 0; i < 1000; i++)
+		ReportMapCompile(&map, Real->Map, Real->Length);
+
+	compile = Elapsed(start) / 1000;
+
+	if (!ReportMapCompile(&map, Real->Map, Real->Length)) {
+		printf("%-10s doesn't compile\n", Real->Name);
+		return FALSE;
+	}
+
+	report = ReportMapFindReport(&map, Real->ReportId);
+
+	if (report == REPORT_MAP_MAX_REPORTS || !MapConsistent(&map) ||
+		map.Reports[report].Bits != Real->ReportBytes * 8 || map.Reports[report].FieldCount != Real->Fields) {
+		printf("%-10s compiles into the wrong fields\n", Real->Name);
+		return FALSE;
+	}
+
+	start = std::chrono::steady_clock::now();
+
+	for (ULONG i = 0; i < Decodes; i++)
+		sink += ReportMapDecode(&map, report, Real->Report, Real->ReportBytes, values, ARRAYSIZE(values));
+
+	decode = Elapsed(start);
+
+	count = ReportMapDecode(&map, report, Real->Report, Real->ReportBytes, values, ARRAYSIZE(values));
+
+	if (count != Real->Values) {
+		printf("%-10s decodes into %u values, not %u\n", Real->Name, (unsigned)count, (unsigned)Real->Values);
+		return FALSE;
+	}
+
+	for (ULONG c = 0; c < BENCH_MAP_CHECKS && Real->Checks[c].UsagePage != 0; c++) {
+		const REPORT_VALUE *	check = &Real->Checks[c];
+		ULONG					v;
+
+		for (v = 0; v < count; v++) {
+			if (values[v].UsagePage == check->UsagePage && values[v].Usage == check->Usage)
+				break;
+		}
+
+		if (v == count || values[v].Value != check->Value) {
+			printf("%-10s decodes usage %02x:%02x wrong\n", Real->Name, check->UsagePage, check->Usage);
+			return FALSE;
+		}
+	}
+
+	if (CoalesceCompileLayout(&layout, SYNTH_FIRST_HANDLE, &map)) {
+		for (ULONG i = 0; i < layout.ReportCount; i++) {
+			if (layout.Reports[i].Length == Real->ReportBytes)
+				flags = layout.Reports[i].Flags;
+		}
+	}
+
+	if (flags != Real->Layout) {
+		printf("%-10s makes layout 0x%x, not 0x%x\n", Real->Name, flags, Real->Layout);
+		return FALSE;
+	}
+
+	printf("%-10s %6u %6u %6u %7u %10llu %10.1f %12.0f\n", Real->Name,
+		(unsigned)Real->Length,
+		(unsigned)map.FieldCount,
+		(unsigned)Real->ReportBytes,
+		(unsigned)count,
+		(unsigned long long)compile,
+		(double)decode / Decodes,
+		decode != 0 ? Decodes * 1e9 / decode : 0.0);
+
+	return TRUE;
+}
+
+//
+// Passes the buttons and touches of two remotes through the coalescing
+// twice, once decoded with the fixed layout and once with the layout of
+// the Siri map, and times both. Returns FALSE if the events differ.
+//
+BOOLEAN
+MapCheckSiri(
+	ULONG	Seed
+)
+{
+	static REPORT_MAP		map;
+	static COALESCE_LAYOUT	layouts[HCI_MAX_CONNECTIONS];
+	static COALESCE_STATE	fixed;
+	static COALESCE_STATE	mapped;
+	static SYNTH_STATE		synth;
+	static SYNTH_PACKET		packet;
+	static UCHAR			reports[BENCH_SIRI_REPORTS][16];
+	static USHORT			lengths[BENCH_SIRI_REPORTS];
+	static LONGLONG			times[BENCH_SIRI_REPORTS];
+	static UCHAR			streams[BENCH_SIRI_REPORTS];
+	SYNTH_CONFIG			config;
+	FILTER_EVENT			fixedEvents[COALESCE_MAX_REPORT_EVENTS];
+	FILTER_EVENT			mappedEvents[COALESCE_MAX_REPORT_EVENTS];
+	ULONG					count = 0;
+	ULONG					events = 0;
+	ULONGLONG				nanoseconds[2];
+
+	if (!ReportMapCompile(&map, BenchSiriMap, sizeof(BenchSiriMap)))
+		return FALSE;
+
+	for (ULONG i = 0; i < HCI_MAX_CONNECTIONS; i++)
+		CoalesceCompileLayout(&layouts[i], (USHORT)(SYNTH_FIRST_HANDLE + i), &map);
+
+	memset(&config, 0, sizeof(config));
+	config.Connections = 2;
+	config.ButtonHz = SYNTH_DEFAULT_BUTTON_HZ;
+	config.TouchHz = SYNTH_DEFAULT_TOUCH_HZ;
+	config.TouchMs = SYNTH_DEFAULT_TOUCH_MS;
+	config.MoveHz = SYNTH_DEFAULT_MOVE_HZ;
+	config.Gestures = 1;
+	config.Seed = Seed;
+
+	SynthInit(&synth, &config);
+
+	while (count < ARRAYSIZE(lengths)) {
+		SynthNext(&synth, &packet);
+
+		if (packet.Type != SYNTH_PACKET_BUTTON && packet.Type != SYNTH_PACKET_TOUCH &&
+			packet.Type != SYNTH_PACKET_MOVE)
+			continue;
+
+		lengths[count] = (USHORT)min((ULONG)packet.Length - ATT_PDU_OFFSET - 3, (ULONG)sizeof(reports[0]));
+		times[count] = packet.Time;
+		streams[count] = (UCHAR)(HCI_ACL_HANDLE(packet.Data) - SYNTH_FIRST_HANDLE);
+		memcpy(reports[count], packet.Data + ATT_PDU_OFFSET + 3, lengths[count]);
+		count++;
+	}
+
+	for (ULONG pass = 0; pass < 2; pass++) {
+		PCOALESCE_STATE state = pass == 0 ? &fixed : &mapped;
+
+		CoalesceInit(state);
+		CoalesceConfigure(state, 8);
+
+		auto start = std::chrono::steady_clock::now();
+
+		for (ULONG i = 0; i < count; i++) {
+			CoalesceReport(state, pass == 0 ? NULL : &layouts[streams[i]], streams[i],
+				(USHORT)(SYNTH_FIRST_HANDLE + streams[i]), SIRI_ATT_HID_REPORT, reports[i], lengths[i],
+				times[i], times[i], fixedEvents);
+		}
+
+		nanoseconds[pass] = Elapsed(start);
+	}
+
+	CoalesceInit(&fixed);
+	CoalesceConfigure(&fixed, 8);
+	CoalesceInit(&mapped);
+	CoalesceConfigure(&mapped, 8);
+
+	for (ULONG i = 0; i < count; i++) {
+		USHORT	handle = (USHORT)(SYNTH_FIRST_HANDLE + streams[i]);
+
+		memset(fixedEvents, 0, sizeof(fixedEvents));
+		memset(mappedEvents, 0, sizeof(mappedEvents));
+
+		ULONG	a = CoalesceReport(&fixed, NULL, streams[i], handle, SIRI_ATT_HID_REPORT, reports[i], lengths[i],
+					times[i], times[i], fixedEvents);
+		ULONG	b = CoalesceReport(&mapped, &layouts[streams[i]], streams[i], handle, SIRI_ATT_HID_REPORT,
+					reports[i], lengths[i], times[i], times[i], mappedEvents);
+
+		if (a != b || memcmp(fixedEvents, mappedEvents, a * sizeof(FILTER_EVENT)) != 0) {
+			printf("Report %u of the Siri map makes other events than the fixed layout\n", (unsigned)i);
+			return FALSE;
+		}
+
+		events += a;
+	}
+
+	printf("\n%u Siri reports, %u events the same decoded either way, %.1f ns/report with the fixed layout,\n"
+		"%.1f ns/report with the map's\n",
+		(unsigned)count,
+		(unsigned)events,
+		(double)nanoseconds[0] / count,
+		(double)nanoseconds[1] / count);
+
+	return TRUE;
+}
+
+//
+// Runs -R: the real maps, then Maps random maps whose reports are checked
+// against how they were built, then Maps of the maps cut, flipped and
+// shuffled, which must compile into something consistent or not at all.
+// Returns FALSE if anything was off.
+//
+BOOLEAN
+ReportMaps(
+	ULONG	Maps,
+	ULONG	Seed
+)
+{
+	static BENCH_GEN_MAP	gen;
+	static BENCH_GEN_MAP	fuzz;
+	static REPORT_MAP		map;
+	REPORT_VALUE			values[256];
+	REPORT_VALUE			expected[BENCH_GEN_ELEMENTS];
+	UCHAR					report[BENCH_GEN_MAP_BYTES];
+	ULONGLONG				reports = 0;
+	ULONGLONG				decoded = 0;
+	ULONGLONG				nanoseconds = 0;
+	ULONG					compiled = 0;
+	ULONG					wrong = 0;
+	volatile ULONG			sink = 0;
+
+	printf("%-10s %6s %6s %6s %7s %10s %10s %12s\n", "Map", "Bytes", "Fields", "Report", "Values",
+		"Compile ns", "ns/report", "Reports/s");
+
+	for (ULONG i = 0; i < ARRAYSIZE(BenchReportMaps); i++) {
+		if (!MapCheckReal(&BenchReportMaps[i], 1000000))
+			wrong++;
+	}
+
+	if (!MapCheckSiri(Seed))
+		wrong++;
+
+	for (ULONG m = 0; m < Maps; m++) {
+		GenMap(&gen, (Seed != 0 ? Seed : 0x2545F491) * 31 + m);
+
+		if (!ReportMapCompile(&map, gen.Map, gen.Length) || map.HasIds != gen.HasIds || !MapConsistent(&map)) {
+			printf("Random map %u doesn't compile right\n", (unsigned)m);
+			wrong++;
+			continue;
+		}
+
+		for (ULONG r = 0; r < (gen.HasIds ? BENCH_GEN_REPORTS : 1); r++) {
+			ULONG	index = ReportMapFindReport(&map, gen.HasIds ? (UCHAR)(r + 1) : 0);
+			ULONG	bytes = (gen.Bits[r] + 7) / 8;
+
+			if ((index != REPORT_MAP_MAX_REPORTS) != gen.Used[r] ||
+				(gen.Used[r] && map.Reports[index].Bits != gen.Bits[r])) {
+				printf("Random map %u has report %u wrong\n", (unsigned)m, (unsigned)r);
+				wrong++;
+				break;
+			}
+
+			if (!gen.Used[r])
+				continue;
+
+			for (ULONG k = 0; k < 4; k++) {
+				for (ULONG i = 0; i < bytes; i++)
+					report[i] = (UCHAR)GenRandom(&gen);
+
+				//
+				// Decoded a few times over, for a time longer than reading
+				// the clock.
+				//
+				auto start = std::chrono::steady_clock::now();
+
+				for (ULONG i = 0; i < 15; i++)
+					sink += ReportMapDecode(&map, index, report, bytes, values, ARRAYSIZE(values));
+
+				ULONG count = ReportMapDecode(&map, index, report, bytes, values, ARRAYSIZE(values));
+				nanoseconds += Elapsed(start) / 16;
+
+				ULONG expect = GenExpect(&gen, r, report, expected);
+
+				reports++;
+				decoded += count;
+
+				if (count != expect || memcmp(values, expected, count * sizeof(REPORT_VALUE)) != 0) {
+					printf("Random map %u decodes report %u wrong\n", (unsigned)m, (unsigned)r);
+					wrong++;
+					break;
+				}
+			}
+		}
+
+		//
+		// The same map mutated: a few bytes changed, cut short, a byte put
+		// in or taken out.
+		//
+		fuzz = gen;
+
+		switch (GenRandom(&fuzz) % 4) {
+		case 0:
+			for (ULONG k = 1 + GenRandom(&fuzz) % 3; k != 0; k--)
+				fuzz.Map[GenRandom(&fuzz) % fuzz.Length] = (UCHAR)GenRandom(&fuzz);
+			break;
+		case 1:
+			fuzz.Length = GenRandom(&fuzz) % fuzz.Length;
+			break;
+		case 2:
+		{
+			ULONG at = GenRandom(&fuzz) % fuzz.Length;
+
+			if (fuzz.Length < BENCH_GEN_MAP_BYTES) {
+				memmove(&fuzz.Map[at + 1], &fuzz.Map[at], fuzz.Length - at);
+				fuzz.Map[at] = (UCHAR)GenRandom(&fuzz);
+				fuzz.Length++;
+			}
+			break;
+		}
+		default:
+		{
+			ULONG at = GenRandom(&fuzz) % fuzz.Length;
+
+			memmove(&fuzz.Map[at], &fuzz.Map[at + 1], fuzz.Length - at - 1);
+			fuzz.Length--;
+			break;
+		}
+		}
+
+		if (ReportMapCompile(&map, fuzz.Map, fuzz.Length)) {
+			compiled++;
+
+			if (!MapConsistent(&map)) {
+				printf("Mutated map %u compiles into inconsistent fields\n", (unsigned)m);
+				wrong++;
+			}
+
+			MapExercise(&fuzz, &map);
+		}
+	}
+
+	if (Maps != 0) {
+		printf("\n%u random maps, %llu reports decoded into %llu values, %.1f ns/report\n",
+			(unsigned)Maps,
+			(unsigned long long)reports,
+			(unsigned long long)decoded,
+			reports != 0 ? (double)nanoseconds / reports : 0.0);
+		printf("%u of %u mutated maps compiled, all of them consistent\n", (unsigned)compiled, (unsigned)Maps);
+	}
+
+	return wrong == 0;
+}
+
+BOOLEAN
+SendControl(
+	ULONG			IoControlCode,
+	PVOID			Input,
+	ULONG			InputLength,
+	const char *	Name
+)
+{
+	SHIM_HANDLE	handle;
+	ULONG		bytesReturned;
+	NTSTATUS	status;
+
+	status = ShimOpenControl(&handle);
+	if (!NT_SUCCESS(status)) {
+		printf("Couldn't open the control device, 0x%x\n", (unsigned)status);
+		return FALSE;
+	}
+
+	status = ShimDeviceIoControl(handle, IoControlCode, Input, InputLength, NULL, 0, &bytesReturned);
+
+	ShimCloseControl(handle);
+
+	if (!NT_SUCCESS(status)) {
+		printf("%s failed, 0x%x\n", Name, (unsigned)status);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+BOOLEAN
+SetEventConfig(
+	ULONG	CoalesceMs
+)
+{
+	FILTER_EVENT_CONFIG	config;
+
+	config.Enable = 1;
+	config.CoalesceMs = CoalesceMs;
+
+	return SendControl(IOCTL_SET_EVENT_CONFIG, &config, sizeof(config), "IOCTL_SET_EVENT_CONFIG");
+}
+
+//
+// Turns on what a user tracing the filter would: every tracepoint, and
+// capturing on every trigger.
+//
+BOOLEAN
+SetTracing()
+{
+	FILTER_CAPTURE_CONFIG	capture;
+	ULONG					keywords = TRACEPOINT_KEYWORD_URB | TRACEPOINT_KEYWORDS_DEFAULT;
+
+	capture.TriggerMask = FILTER_CAPTURE_TRIGGER_ALL;
+	capture.PreTrigger = FILTER_CAPTURE_RECORDS / 2;
+	capture.PostTrigger = FILTER_CAPTURE_RECORDS / 4;
+	capture.GapMs = 500;
+
+	return SendControl(IOCTL_SET_TRACEPOINT_KEYWORDS, &keywords, sizeof(keywords), "IOCTL_SET_TRACEPOINT_KEYWORDS") &&
+		SendControl(IOCTL_SET_CAPTURE_CONFIG, &capture, sizeof(capture), "IOCTL_SET_CAPTURE_CONFIG");
+}
+
+BOOLEAN
+SetVoiceConfig(
+	USHORT	SequenceOffset,
+	USHORT	FrameHz
+)
+{
+	FILTER_VOICE_CONFIG	config;
+
+	config.SequenceOffset = SequenceOffset;
+	config.FrameHz = FrameHz;
+	config.GapMs = FILTER_VOICE_DEFAULT_GAP_MS;
+
+	return SendControl(IOCTL_SET_VOICE_CONFIG, &config, sizeof(config), "IOCTL_SET_VOICE_CONFIG");
+}
+
+VOID
+PrintVoiceSession(
+	const char *					Name,
+	const FILTER_VOICE_SESSION *	Session
+)
+{
+	printf("%-7s %8.3f %8.3f %7u %7u %5u %7u %5u %5u %7u %9u %9u %7u %7.1f\n", Name,
+		Session->Start / 1e7,
+		(Session->End - Session->Start) / 1e7,
+		(unsigned)Session->Frames,
+		(unsigned)Session->Missing,
+		(unsigned)Session->Duplicates,
+		(unsigned)Session->Reordered,
+		(unsigned)Session->Late,
+		(unsigned)Session->Short,
+		(unsigned)Session->Trimmed,
+		(unsigned)Session->Bytes,
+		(unsigned)Session->ExpectedBytes,
+		(unsigned)Session->JitterUs,
+		Session->MaxGapUs / 1000.0);
+}
+
+//
+// The voice sessions the filter counted, the latest finished ones, the
+// ones going on marked with a *, and the totals of all. When VoiceTruth
+// followed the traffic the totals are checked against it, returns FALSE
+// if they're wrong.
+//
+BOOLEAN
+PrintVoiceStats()
+{
+	static FILTER_VOICE_STATS	stats;
+	FILTER_VOICE_SESSION		total;
+	FILTER_VOICE_SESSION		truth = VoiceTruth.Totals;
+	SHIM_HANDLE					handle;
+	ULONG						bytesReturned;
+	NTSTATUS					status;
+	ULONG						wrong = 0;
+	char						name[16];
+
+	if (!NT_SUCCESS(ShimOpenControl(&handle)))
+		return FALSE;
+
+	status = ShimDeviceIoControl(handle, IOCTL_GET_VOICE_STATS, NULL, 0, &stats, sizeof(stats), &bytesReturned);
+
+	ShimCloseControl(handle);
+
+	if (!NT_SUCCESS(status) || bytesReturned < sizeof(stats))
+		return FALSE;
+
+	total = stats.Totals;
+
+	if (stats.TotalSessions + stats.ActiveCount != 0) {
+		printf("\n%-7s %8s %8s %7s %7s %5s %7s %5s %5s %7s %9s %9s %7s %7s\n", "Session", "Start s", "Length s",
+			"Frames", "Missing", "Dup", "Reorder", "Late", "Short", "Trimmed", "Bytes", "Expected", "Jit us", "Gap ms");
+
+		for (ULONG i = 0; i < stats.SessionCount; i++) {
+			snprintf(name, sizeof(name), "0x%03x", stats.Sessions[i].Handle);
+			PrintVoiceSession(name, &stats.Sessions[i]);
+		}
+
+		for (ULONG i = 0; i < stats.ActiveCount; i++) {
+			const FILTER_VOICE_SESSION * session = &stats.Active[i];
+
+			snprintf(name, sizeof(name), "0x%03x*", session->Handle);
+			PrintVoiceSession(name, session);
+
+			if (stats.TotalSessions == 0 && i == 0)
+				total.Start = session->Start;
+
+			total.End = max(total.End, session->End);
+			total.Frames += session->Frames;
+			total.Missing += session->Missing;
+			total.Duplicates += session->Duplicates;
+			total.Reordered += session->Reordered;
+			total.Late += session->Late;
+			total.Short += session->Short;
+			total.Trimmed += session->Trimmed;
+			total.Bytes += session->Bytes;
+			total.ExpectedBytes += session->ExpectedBytes;
+			total.DeliveredBytes += session->DeliveredBytes;
+			total.JitterUs = max(total.JitterUs, session->JitterUs);
+			total.MaxGapUs = max(total.MaxGapUs, session->MaxGapUs);
+		}
+
+		PrintVoiceSession("Total", &total);
+
+		printf("%u sessions, %u bytes passed up, injected %llu dropped, %llu duplicated, %llu swapped, %llu cut\n",
+			(unsigned)(stats.TotalSessions + stats.ActiveCount),
+			(unsigned)total.DeliveredBytes,
+			(unsigned long long)Impair.Dropped,
+			(unsigned long long)Impair.Duplicated,
+			(unsigned long long)Impair.Swapped,
+			(unsigned long long)Impair.Cut);
+	}
+
+	if (!VoiceTruth.Checked)
+		return TRUE;
+
+	for (ULONG i = 0; i < HCI_MAX_CONNECTIONS; i++)
+		VoiceTruthFinish(&VoiceTruth.Streams[i], &truth);
+
+	const struct {
+		const char *	Name;
+		ULONG			Counted;
+		ULONG			Expected;
+	} checks[] = {
+		{ "frames", total.Frames, truth.Frames },
+		{ "missing", total.Missing, truth.Missing },
+		{ "duplicates", total.Duplicates, truth.Duplicates },
+		{ "reordered", total.Reordered, truth.Reordered },
+		{ "late", total.Late, truth.Late },
+		{ "short", total.Short, truth.Short },
+	};
+
+	for (ULONG i = 0; i < ARRAYSIZE(checks); i++) {
+		if (checks[i].Counted != checks[i].Expected) {
+			printf("Voice %s %u, expected %u\n", checks[i].Name,
+				(unsigned)checks[i].Counted, (unsigned)checks[i].Expected);
+			wrong++;
+		}
+	}
+
+	printf("Voice accounting checked against the frames sent, %u wrong\n", (unsigned)wrong);
+
+	return wrong == 0;
+}
+
+VOID
+PrintPaths(
+	const char *		Title,
+	const char * const *Names,
+	const BENCH_PATH *	Table,
+	ULONG				Count
+)
+{
+	printf("%-10s %12s %12s\n", Title, "Packets", "ns/packet");
+
+	for (ULONG i = 0; i < Count; i++) {
+		if (Table[i].Packets == 0)
+			continue;
+
+		printf("%-10s %12llu %12.1f\n", Names[i],
+			(unsigned long long)Table[i].Packets,
+			(double)Table[i].Nanoseconds / Table[i].Packets);
+	}
+}
+
+//
+// Runs after -M: each remote's Report Map must have been read whole, be
+// the one it was generated with and be what the filter decodes its
+// reports with. Returns FALSE if any isn't.
+//
+BOOLEAN
+CheckReportMaps(
+	ULONG	Connections
+)
+{
+	static FILTER_REPORT_MAPS	maps;
+	SHIM_HANDLE					handle;
+	ULONG						bytesReturned;
+	ULONG						right = 0;
+	NTSTATUS					status;
+
+	if (!NT_SUCCESS(ShimOpenControl(&handle)))
+		return FALSE;
+
+	status = ShimDeviceIoControl(handle, IOCTL_GET_REPORT_MAPS, NULL, 0, &maps, sizeof(maps), &bytesReturned);
+
+	ShimCloseControl(handle);
+
+	if (!NT_SUCCESS(status) || bytesReturned < sizeof(maps)) {
+		printf("IOCTL_GET_REPORT_MAPS failed, 0x%x\n", (unsigned)status);
+		return FALSE;
+	}
+
+	printf("\n%-7s %6s %6s %6s %6s\n", "Handle", "Attr", "State", "Bytes", "Flags");
+
+	for (ULONG i = 0; i < maps.ConnectionCount; i++) {
+		const FILTER_REPORT_MAP * map = &maps.Connections[i];
+
+		printf("0x%03x   0x%04x %6u %6u   0x%02x\n",
+			map->Handle,
+			map->Attribute,
+			(unsigned)map->State,
+			(unsigned)map->Length,
+			map->Flags);
+
+		if (map->State == FILTER_REPORT_MAP_STATE_READ &&
+			(map->Flags & FILTER_REPORT_MAP_DECODING) &&
+			map->Length == sizeof(BenchSiriMap) &&
+			!memcmp(map->Map, BenchSiriMap, sizeof(BenchSiriMap)))
+			right++;
+	}
+
+	printf("%u of %u Report Maps read and decoding\n", (unsigned)right, (unsigned)Connections);
+
+	return right == Connections;
+}
+
+//
+// The anomalies -C injects into a remote streaming voice, one after the
+// other, each with only its own trigger enabled.
+//
+#define BENCH_CAPTURE_PRE		48
+#define BENCH_CAPTURE_POST		16
+#define BENCH_CAPTURE_GAP_MS	200
+#define BENCH_CAPTURE_PASSED	512
+
+typedef struct _BENCH_ANOMALY {
+
+	UCHAR			Trigger;
+	const char *	Name;
+
+} BENCH_ANOMALY, *PBENCH_ANOMALY;
+
+const BENCH_ANOMALY	Anomalies[] = {
+	{ FILTER_CAPTURE_TRIGGER_NOTIFICATION_GAP,	"Notification gap" },
+	{ FILTER_CAPTURE_TRIGGER_TRUNCATED,			"Truncated packet" },
+	{ FILTER_CAPTURE_TRIGGER_SEND_FAILURE,		"Send failure" },
+	{ FILTER_CAPTURE_TRIGGER_WATCHDOG,			"Watchdog stall" },
+};
+
+//
+// The packets passed through the filter since the capture was configured,
+// as the filter should have captured them.
+//
+typedef struct _BENCH_CAPTURE {
+
+	SYNTH_STATE				Synth;
+	SYNTH_PACKET			Packet;			// the next one of the remote
+	LONGLONG				Now;
+	ULONG					Passed;
+	FILTER_CAPTURE_RECORD	Expected[BENCH_CAPTURE_PASSED];
+	UCHAR					Window[sizeof(FILTER_CAPTURE_HEADER) + FILTER_CAPTURE_RECORDS * sizeof(FILTER_CAPTURE_RECORD)];
+
+} BENCH_CAPTURE, *PBENCH_CAPTURE;
+
+BENCH_CAPTURE	CaptureCheck;
+
+//
+// The host turns on notifications of the remote's voice, for the adapter
+// not to take.
+//
+const UCHAR	CaptureFailedWrite[] = {
+	(UCHAR)SYNTH_FIRST_HANDLE, 0x00, 0x09, 0x00, 0x05, 0x00, (UCHAR)L2CAP_CID_ATT, 0x00,
+	ATT_OP_WRITE_REQ, 0x24, 0x00, 0x01, 0x00
+};
+
+VOID
+CapturePass(
+	PBENCH_CAPTURE	Check,
+	LONGLONG		Time,
+	UCHAR			Kind,
+	UCHAR			Direction,
+	const UCHAR *	Data,
+	ULONG			Length
+)
+{
+	ShimSetInterruptTime((ULONGLONG)Time + 1);
+	RunTimers(&Threads[0], Time + 1);
+
+	if (Check->Passed < BENCH_CAPTURE_PASSED) {
+		PFILTER_CAPTURE_RECORD record = &Check->Expected[Check->Passed++];
+
+		memset(record, 0, sizeof(FILTER_CAPTURE_RECORD));
+		record->Time = Time + 1;
+		record->Length = (USHORT)Length;
+		record->Kind = Kind;
+		record->Direction = Direction;
+		record->CapturedLength = (USHORT)min(Length, (ULONG)FILTER_CAPTURE_SNAPLEN);
+		memcpy(record->Data, Data, record->CapturedLength);
+	}
+
+	ReplayPacket(&Threads[0], Kind, Direction, Data, Length, Length);
+}
+
+//
+// Moves the remote on by Ms, passing its packets through the filter or
+// only letting the time pass.
+//
+VOID
+CaptureStream(
+	PBENCH_CAPTURE	Check,
+	ULONG			Ms,
+	BOOLEAN			Pass
+)
+{
+	PSYNTH_PACKET	packet = &Check->Packet;
+	LONGLONG		end = Check->Now + (LONGLONG)Ms * 10000;
+
+	while (packet->Time <= end) {
+		if (Pass) {
+			CapturePass(Check, packet->Time, packet->Kind, packet->Direction, packet->Data, packet->Length);
+		} else {
+			ShimSetInterruptTime((ULONGLONG)packet->Time + 1);
+			RunTimers(&Threads[0], packet->Time + 1);
+		}
+
+		SynthNext(&Check->Synth, packet);
+	}
+
+	Check->Now = end;
+}
+
+//
+// Injects Anomaly and checks the window it froze against what was passed:
+// PreTrigger packets before the first one after the anomaly, PostTrigger
+// from it on, nothing else. Returns FALSE if anything was off.
+//
+BOOLEAN
+CaptureAnomaly(
+	PBENCH_CAPTURE			Check,
+	const BENCH_ANOMALY *	Anomaly
+)
+{
+	PFILTER_CAPTURE_HEADER	header = (PFILTER_CAPTURE_HEADER)Check->Window;
+	PFILTER_CAPTURE_RECORD	records = (PFILTER_CAPTURE_RECORD)(header + 1);
+	FILTER_CAPTURE_CONFIG	config;
+	SHIM_HANDLE				handle;
+	ULONG					bytesReturned;
+	ULONG					trigger;
+	ULONG					wrong = 0;
+	USHORT					expectedHandle = SYNTH_FIRST_HANDLE;
+	NTSTATUS				status;
+
+	config.TriggerMask = Anomaly->Trigger;
+	config.PreTrigger = BENCH_CAPTURE_PRE;
+	config.PostTrigger = BENCH_CAPTURE_POST;
+	config.GapMs = BENCH_CAPTURE_GAP_MS;
+
+	if (!SendControl(IOCTL_SET_CAPTURE_CONFIG, &config, sizeof(config), "IOCTL_SET_CAPTURE_CONFIG"))
+		return FALSE;
+
+	//
+	// Enough for the ring to hold PreTrigger packets, with the remote
+	// starting its voice up to a second after connecting.
+	//
+	Check->Passed = 0;
+	CaptureStream(Check, 3000, TRUE);
+
+	trigger = Check->Passed;
+
+	switch (Anomaly->Trigger) {
+
+	case FILTER_CAPTURE_TRIGGER_NOTIFICATION_GAP:
+		CaptureStream(Check, 4 * BENCH_CAPTURE_GAP_MS, FALSE);
+		break;
+
+	case FILTER_CAPTURE_TRIGGER_TRUNCATED:
+	{
+		//
+		// The next frame loses its end on the way, its headers still
+		// count it.
+		//
+		PSYNTH_PACKET packet = &Check->Packet;
+
+		CapturePass(Check, packet->Time, packet->Kind, packet->Direction, packet->Data, ATT_PDU_OFFSET + 8);
+		SynthNext(&Check->Synth, packet);
+		break;
+	}
+
+	case FILTER_CAPTURE_TRIGGER_SEND_FAILURE:
+		Adapter.FailWrites = TRUE;
+		CapturePass(Check, Check->Now, TRACE_KIND_ACL, HCI_DIRECTION_OUT, CaptureFailedWrite, sizeof(CaptureFailedWrite));
+		Adapter.FailWrites = FALSE;
+
+		trigger = Check->Passed;
+		expectedHandle = HCI_INVALID_HANDLE;
+		break;
+
+	case FILTER_CAPTURE_TRIGGER_WATCHDOG:
+		CaptureStream(Check, 5 * BENCH_CAPTURE_GAP_MS, FALSE);
+		break;
+	}
+
+	CaptureStream(Check, 1000, TRUE);
+
+	status = ShimOpenControl(&handle);
+	if (!NT_SUCCESS(status)) {
+		printf("Couldn't open the control device, 0x%x\n", (unsigned)status);
+		return FALSE;
+	}
+
+	status = ShimDeviceIoControl(handle, IOCTL_GET_CAPTURE, NULL, 0, Check->Window, sizeof(Check->Window), &bytesReturned);
+	if (!NT_SUCCESS(status)) {
+		printf("IOCTL_GET_CAPTURE failed, 0x%x\n", (unsigned)status);
+		ShimCloseControl(handle);
+		return FALSE;
+	}
+
+	if (header->State != FILTER_CAPTURE_FROZEN ||
+		header->Trigger != Anomaly->Trigger ||
+		header->TriggerHandle != expectedHandle ||
+		header->TriggerRecord != BENCH_CAPTURE_PRE ||
+		header->RecordCount != BENCH_CAPTURE_PRE + BENCH_CAPTURE_POST ||
+		trigger < BENCH_CAPTURE_PRE ||
+		trigger + BENCH_CAPTURE_POST > Check->Passed) {
+		wrong++;
+	} else {
+		const FILTER_CAPTURE_RECORD * expected = &Check->Expected[trigger - BENCH_CAPTURE_PRE];
+
+		for (ULONG i = 0; i < header->RecordCount; i++) {
+			if (records[i].Time != expected[i].Time ||
+				records[i].Length != expected[i].Length ||
+				records[i].Kind != expected[i].Kind ||
+				records[i].Direction != expected[i].Direction ||
+				records[i].CapturedLength != expected[i].CapturedLength ||
+				memcmp(records[i].Data, expected[i].Data, expected[i].CapturedLength))
+				wrong++;
+		}
+
+		if (header->TriggerTime < expected[BENCH_CAPTURE_PRE - 1].Time ||
+			header->TriggerTime > expected[BENCH_CAPTURE_PRE].Time)
+			wrong++;
+	}
+
+	printf("%-18s 0x%02x 0x%02x  0x%04x %6u %6u %6s\n",
+		Anomaly->Name,
+		(unsigned)header->Trigger,
+		(unsigned)header->State,
+		(unsigned)header->TriggerHandle,
+		(unsigned)header->TriggerRecord,
+		(unsigned)header->RecordCount,
+		wrong == 0 ? "right" : "wrong");
+
+	//
+	// Reading the window re-armed the ring.
+	//
+	status = ShimDeviceIoControl(handle, IOCTL_GET_CAPTURE, NULL, 0, Check->Window, sizeof(Check->Window), &bytesReturned);
+
+	ShimCloseControl(handle);
+
+	if (!NT_SUCCESS(status) || header->State != FILTER_CAPTURE_ARMED || header->RecordCount != 0) {
+		printf("The window of the %s didn't re-arm\n", Anomaly->Name);
+		wrong++;
+	}
+
+	return wrong == 0;
+}
+
+//
+// Fails a write on Device, which freezes its window right away.
+//
+VOID
+CaptureFailWrite(
+	WDFDEVICE	Device
+)
+{
+	WDFDEVICE device = Adapter.Device;
+
+	Adapter.Device = Device;
+	Adapter.FailWrites = TRUE;
+	ReplayPacket(&Threads[0], TRACE_KIND_ACL, HCI_DIRECTION_OUT, CaptureFailedWrite, sizeof(CaptureFailedWrite), sizeof(CaptureFailedWrite));
+	Adapter.FailWrites = FALSE;
+	Adapter.Device = device;
+}
+
+//
+// Attaches the filter to a second adapter and freezes the windows of one
+// or both by failed sends. IOCTL_GET_CAPTURE must hand out the first
+// adapter's frozen window, leave the other frozen for the next request,
+// and only with none frozen the first adapter's live one. Returns FALSE
+// if any request got another.
+//
+BOOLEAN
+CaptureAdapters(
+	PBENCH_CAPTURE	Check,
+	const char *	HardwareId
+)
+{
+	static const struct {
+		UCHAR	Freeze;			// bit 0 the first adapter, bit 1 the second, before the request
+		ULONG	Adapter;
+		UCHAR	State;
+	} requests[] = {
+		{ 2, 1, FILTER_CAPTURE_FROZEN },
+		{ 0, 0, FILTER_CAPTURE_ARMED },
+		{ 3, 0, FILTER_CAPTURE_FROZEN },
+		{ 0, 1, FILTER_CAPTURE_FROZEN },
+		{ 0, 0, FILTER_CAPTURE_ARMED },
+	};
+	PFILTER_CAPTURE_HEADER	header = (PFILTER_CAPTURE_HEADER)Check->Window;
+	SHIM_DEVICE_CONFIG		device;
+	WDFDEVICE				second;
+	WDFDEVICE				first = Adapter.Device;
+	FILTER_CAPTURE_CONFIG	config;
+	SHIM_HANDLE				handle;
+	ULONG					bytesReturned;
+	ULONG					wrong = 0;
+	NTSTATUS				status;
+
+	memset(&device, 0, sizeof(device));
+	device.HardwareId = HardwareId;
+	device.LowerSend = AdapterSend;
+	device.UpperComplete = StackComplete;
+
+	status = ShimAddDevice(&device, &second);
+	if (!NT_SUCCESS(status)) {
+		printf("Adding the second device failed, 0x%x\n", (unsigned)status);
+		return FALSE;
+	}
+
+	Adapter.Device = second;
+	SelectConfiguration();
+	Adapter.Device = first;
+
+	//
+	// With nothing after the trigger the failed write freezes the window.
+	//
+	config.TriggerMask = FILTER_CAPTURE_TRIGGER_SEND_FAILURE;
+	config.PreTrigger = 4;
+	config.PostTrigger = 0;
+	config.GapMs = BENCH_CAPTURE_GAP_MS;
+
+	status = ShimOpenControl(&handle);
+
+	if (!NT_SUCCESS(status) ||
+		!SendControl(IOCTL_SET_CAPTURE_CONFIG, &config, sizeof(config), "IOCTL_SET_CAPTURE_CONFIG")) {
+		if (NT_SUCCESS(status))
+			ShimCloseControl(handle);
+		ShimRemoveDevice(second);
+		return FALSE;
+	}
+
+	for (ULONG i = 0; i < ARRAYSIZE(requests); i++) {
+		if (requests[i].Freeze & 1)
+			CaptureFailWrite(first);
+		if (requests[i].Freeze & 2)
+			CaptureFailWrite(second);
+
+		memset(Check->Window, 0, sizeof(Check->Window));
+
+		status = ShimDeviceIoControl(handle, IOCTL_GET_CAPTURE, NULL, 0, Check->Window, sizeof(Check->Window), &bytesReturned);
+
+		//
+		// A frozen window ends with the write that failed.
+		//
+		BOOLEAN					frozen = requests[i].State == FILTER_CAPTURE_FROZEN;
+		PFILTER_CAPTURE_RECORD	last = (PFILTER_CAPTURE_RECORD)(header + 1) + header->RecordCount - 1;
+
+		if (!NT_SUCCESS(status) ||
+			header->Adapter != requests[i].Adapter ||
+			header->State != requests[i].State ||
+			header->Trigger != (frozen ? FILTER_CAPTURE_TRIGGER_SEND_FAILURE : 0) ||
+			(frozen ? header->RecordCount == 0 || header->TriggerRecord != header->RecordCount ||
+				last->Direction != HCI_DIRECTION_OUT || last->Length != sizeof(CaptureFailedWrite) :
+				header->RecordCount != 0)) {
+			printf("Request %u got adapter %u's window in state 0x%02x with %u records, expected adapter %u's in 0x%02x\n",
+				(unsigned)i, (unsigned)header->Adapter, (unsigned)header->State, (unsigned)header->RecordCount,
+				(unsigned)requests[i].Adapter, (unsigned)requests[i].State);
+			wrong++;
+		}
+	}
+
+	ShimCloseControl(handle);
+	ShimRemoveDevice(second);
+
+	printf("%u of %u requests of two adapters got the right window\n",
+		(unsigned)(ARRAYSIZE(requests) - wrong), (unsigned)ARRAYSIZE(requests));
+
+	return wrong == 0;
+}
+
+//
+// Loads the filter, connects a remote streaming voice and checks what
+// each capture trigger freezes, then what IOCTL_GET_CAPTURE hands out with
+// a second adapter. Returns FALSE if any window was wrong.
+//
+BOOLEAN
+Captures(
+	const char *	HardwareId
+)
+{
+	PBENCH_CAPTURE			check = &CaptureCheck;
+	SYNTH_CONFIG			synth;
+	FILTER_WATCHDOG_CONFIG	watchdog;
+	ULONG					right = 0;
+
+	if (!StartFilter(HardwareId))
+		return FALSE;
+
+	watchdog.GapMs = BENCH_CAPTURE_GAP_MS;
+	watchdog.Actions = FILTER_WATCHDOG_ACTION_TRIGGER;
+	watchdog.Flags = FILTER_WATCHDOG_ANY_GAP;
+
+	if (!SendControl(IOCTL_SET_WATCHDOG_CONFIG, &watchdog, sizeof(watchdog), "IOCTL_SET_WATCHDOG_CONFIG")) {
+		StopFilter();
+		return FALSE;
+	}
+
+	//
+	// One voice burst that doesn't end.
+	//
+	memset(&synth, 0, sizeof(synth));
+	synth.Connections = 1;
+	synth.VoiceEveryMs = 1000;
+	synth.VoiceBurstMs = 1000;
+	synth.VoiceHz = SYNTH_DEFAULT_VOICE_HZ;
+	synth.VoiceLength = SYNTH_DEFAULT_VOICE_LENGTH;
+
+	SynthInit(&check->Synth, &synth);
+	SynthNext(&check->Synth, &check->Packet);
+
+	printf("%-18s %4s %4s  %6s %6s %6s\n", "Anomaly", "Trig", "State", "Handle", "Pre", "Records");
+
+	for (ULONG i = 0; i < ARRAYSIZE(Anomalies); i++) {
+		if (CaptureAnomaly(check, &Anomalies[i]))
+			right++;
+	}
+
+	printf("%u of %u windows right\n", (unsigned)right, (unsigned)ARRAYSIZE(Anomalies));
+
+	BOOLEAN adapters = CaptureAdapters(check, HardwareId);
+
+	StopFilter();
+
+	return right == ARRAYSIZE(Anomalies) && adapters;
+}
+
+//
+// What the stack exchanges with an adapter when it starts, and with two
+// remotes when they connect, for -I. The first remote's MTU exchange is
+// written and read in buffers, the second one's mostly in MDLs, both must
+// end up with the same trim.
+//
+#define BENCH_INIT_PACKETS		9
+#define BENCH_INIT_VOICE		(ATT_PDU_OFFSET + 3 + SYNTH_DEFAULT_VOICE_LENGTH)
+
+typedef struct _BENCH_INIT_PACKET {
+
+	UCHAR		Kind;
+	UCHAR		Direction;
+	BOOLEAN		Mdl;			// written or read in an MDL instead of a buffer
+	UCHAR		Length;
+	UCHAR		Data[24];
+
+} BENCH_INIT_PACKET, *PBENCH_INIT_PACKET;
+
+typedef struct _BENCH_INIT {
+
+	const char *		Name;
+	const char *		HardwareId;
+	BENCH_INIT_PACKET	Packets[BENCH_INIT_PACKETS];
+
+	//
+	// What IOCTL_GET_ADAPTER_INFO must say after them, the same for both
+	// connections.
+	//
+	UCHAR				Flags;
+	UCHAR				LmpVersion;
+	USHORT				AclDataPacketLength;
+	USHORT				LeAclDataPacketLength;
+	USHORT				DefaultFixAttLength;
+	UCHAR				ConnectionFlags;
+	USHORT				AttMtu;
+	USHORT				FixAttLength;
+
+} BENCH_INIT, *PBENCH_INIT;
+
+#define BENCH_INIT_EVENT(...)		{ TRACE_KIND_HCI_EVENT, HCI_DIRECTION_IN, FALSE, sizeof((UCHAR[]){ __VA_ARGS__ }), { __VA_ARGS__ } }
+#define BENCH_INIT_IN(...)			{ TRACE_KIND_ACL, HCI_DIRECTION_IN, FALSE, sizeof((UCHAR[]){ __VA_ARGS__ }), { __VA_ARGS__ } }
+#define BENCH_INIT_IN_MDL(...)		{ TRACE_KIND_ACL, HCI_DIRECTION_IN, TRUE, sizeof((UCHAR[]){ __VA_ARGS__ }), { __VA_ARGS__ } }
+#define BENCH_INIT_OUT(...)			{ TRACE_KIND_ACL, HCI_DIRECTION_OUT, FALSE, sizeof((UCHAR[]){ __VA_ARGS__ }), { __VA_ARGS__ } }
+#define BENCH_INIT_OUT_MDL(...)		{ TRACE_KIND_ACL, HCI_DIRECTION_OUT, TRUE, sizeof((UCHAR[]){ __VA_ARGS__ }), { __VA_ARGS__ } }
+
+#define BENCH_INIT_CONNECT(Handle)	\
+	BENCH_INIT_EVENT(0x3e, 0x13, 0x01, 0x00, Handle, 0x00, 0x00, 0x00, Handle, 0x5a, 0x5a, 0xc0, 0x7c, 0x28, 0x09, 0x00, 0x04, 0x00, 0xc8, 0x00, 0x00)
+
+#define BENCH_INIT_MTU(Handle, Op, Mtu)	\
+	0x##Handle, 0x00, 0x07, 0x00, 0x03, 0x00, 0x04, 0x00, Op, (UCHAR)(Mtu), (UCHAR)((Mtu) >> 8)
+
+const BENCH_INIT	AdapterInits[] = {
+	{
+		//
+		// Bluetooth 4.0, the upper stack takes no more than the default
+		// MTU whatever was exchanged. No LE buffers of its own.
+		//
+		"CSR8510", "USB\\VID_0A12&PID_0001",
+		{
+			BENCH_INIT_EVENT(0x0e, 0x0c, 0x01, 0x01, 0x10, 0x00, 0x06, 0xbb, 0x22, 0x06, 0x0a, 0x00, 0xbb, 0x22),
+			BENCH_INIT_EVENT(0x0e, 0x0b, 0x01, 0x05, 0x10, 0x00, 0x36, 0x01, 0x40, 0x0a, 0x00, 0x08, 0x00),
+			BENCH_INIT_EVENT(0x0e, 0x07, 0x01, 0x02, 0x20, 0x00, 0x00, 0x00, 0x00),
+			BENCH_INIT_CONNECT(0x40),
+			BENCH_INIT_CONNECT(0x41),
+			BENCH_INIT_OUT(BENCH_INIT_MTU(40, ATT_OP_EXCHANGE_MTU_REQ, 185)),
+			BENCH_INIT_IN(BENCH_INIT_MTU(40, ATT_OP_EXCHANGE_MTU_RSP, 185)),
+			BENCH_INIT_OUT_MDL(BENCH_INIT_MTU(41, ATT_OP_EXCHANGE_MTU_REQ, 185)),
+			BENCH_INIT_IN_MDL(BENCH_INIT_MTU(41, ATT_OP_EXCHANGE_MTU_RSP, 185)),
+		},
+		HCI_ADAPTER_VERSION_VALID | HCI_ADAPTER_BUFFER_VALID | HCI_ADAPTER_LE_BUFFER_VALID,
+		HCI_LMP_VERSION_4_0, 310, 310, HCI_LEGACY_FIX_ATT_LENGTH, 0, 185, HCI_LEGACY_FIX_ATT_LENGTH
+	},
+	{
+		//
+		// Bluetooth 5.2, the exchanged MTU fits the LE buffers.
+		//
+		"Intel AX200", "USB\\VID_8087&PID_0029",
+		{
+			BENCH_INIT_EVENT(0x0e, 0x0c, 0x01, 0x01, 0x10, 0x00, 0x0b, 0x00, 0x01, 0x0b, 0x02, 0x00, 0x00, 0x01),
+			BENCH_INIT_EVENT(0x0e, 0x0b, 0x01, 0x05, 0x10, 0x00, 0xfd, 0x03, 0x60, 0x04, 0x00, 0x01, 0x00),
+			BENCH_INIT_EVENT(0x0e, 0x07, 0x01, 0x02, 0x20, 0x00, 0xfb, 0x00, 0x0f),
+			BENCH_INIT_CONNECT(0x40),
+			BENCH_INIT_CONNECT(0x41),
+			BENCH_INIT_OUT(BENCH_INIT_MTU(40, ATT_OP_EXCHANGE_MTU_REQ, 525)),
+			BENCH_INIT_IN(BENCH_INIT_MTU(40, ATT_OP_EXCHANGE_MTU_RSP, 104)),
+			BENCH_INIT_OUT_MDL(BENCH_INIT_MTU(41, ATT_OP_EXCHANGE_MTU_REQ, 525)),
+			BENCH_INIT_IN_MDL(BENCH_INIT_MTU(41, ATT_OP_EXCHANGE_MTU_RSP, 104)),
+		},
+		HCI_ADAPTER_VERSION_VALID | HCI_ADAPTER_BUFFER_VALID | HCI_ADAPTER_LE_BUFFER_VALID,
+		11, 1021, 251, 0, 0, 104, 103
+	},
+	{
+		//
+		// Bluetooth 4.2, an MTU larger than the LE buffers is cut to them.
+		//
+		"Intel 8265", "USB\\VID_8087&PID_0A2B",
+		{
+			BENCH_INIT_EVENT(0x0e, 0x0c, 0x01, 0x01, 0x10, 0x00, 0x08, 0x00, 0x01, 0x08, 0x02, 0x00, 0x00, 0x01),
+			BENCH_INIT_EVENT(0x0e, 0x0b, 0x01, 0x05, 0x10, 0x00, 0xfd, 0x03, 0x60, 0x04, 0x00, 0x01, 0x00),
+			BENCH_INIT_EVENT(0x0e, 0x07, 0x01, 0x02, 0x20, 0x00, 0x64, 0x00, 0x08),
+			BENCH_INIT_CONNECT(0x40),
+			BENCH_INIT_CONNECT(0x41),
+			BENCH_INIT_OUT(BENCH_INIT_MTU(40, ATT_OP_EXCHANGE_MTU_REQ, 517)),
+			BENCH_INIT_IN(BENCH_INIT_MTU(40, ATT_OP_EXCHANGE_MTU_RSP, 517)),
+			BENCH_INIT_OUT_MDL(BENCH_INIT_MTU(41, ATT_OP_EXCHANGE_MTU_REQ, 517)),
+			BENCH_INIT_IN_MDL(BENCH_INIT_MTU(41, ATT_OP_EXCHANGE_MTU_RSP, 517)),
+		},
+		HCI_ADAPTER_VERSION_VALID | HCI_ADAPTER_BUFFER_VALID | HCI_ADAPTER_LE_BUFFER_VALID,
+		HCI_LMP_VERSION_4_2, 1021, 100, 0, 0, 517, 100 - L2CAP_HEADER_LENGTH - 1
+	},
+	{
+		//
+		// Bluetooth 5.0 with the LE buffers of the spec's minimum, which
+		// don't limit the MTU, and the remote starting the exchange.
+		//
+		"Realtek RTL8761B", "USB\\VID_0BDA&PID_8771",
+		{
+			BENCH_INIT_EVENT(0x0e, 0x0c, 0x01, 0x01, 0x10, 0x00, 0x09, 0x0b, 0x00, 0x09, 0x5d, 0x00, 0x6a, 0x87),
+			BENCH_INIT_EVENT(0x0e, 0x0b, 0x01, 0x05, 0x10, 0x00, 0xfd, 0x03, 0xff, 0x08, 0x00, 0x0c, 0x00),
+			BENCH_INIT_EVENT(0x0e, 0x07, 0x01, 0x02, 0x20, 0x00, 0x1b, 0x00, 0x0f),
+			BENCH_INIT_CONNECT(0x40),
+			BENCH_INIT_CONNECT(0x41),
+			BENCH_INIT_IN(BENCH_INIT_MTU(40, ATT_OP_EXCHANGE_MTU_REQ, 65)),
+			BENCH_INIT_OUT(BENCH_INIT_MTU(40, ATT_OP_EXCHANGE_MTU_RSP, 247)),
+			BENCH_INIT_IN_MDL(BENCH_INIT_MTU(41, ATT_OP_EXCHANGE_MTU_REQ, 65)),
+			BENCH_INIT_OUT_MDL(BENCH_INIT_MTU(41, ATT_OP_EXCHANGE_MTU_RSP, 247)),
+		},
+		HCI_ADAPTER_VERSION_VALID | HCI_ADAPTER_BUFFER_VALID | HCI_ADAPTER_LE_BUFFER_VALID,
+		9, 1021, 27, 0, 0, 65, 64
+	},
+	{
+		//
+		// Bluetooth 5.2 with the remotes connected, but their MTU
+		// exchanges came before the filter started. Nothing bounds the
+		// notifications and nothing is trimmed.
+		//
+		"AX200, no MTU", "USB\\VID_8087&PID_0029",
+		{
+			BENCH_INIT_EVENT(0x0e, 0x0c, 0x01, 0x01, 0x10, 0x00, 0x0b, 0x00, 0x01, 0x0b, 0x02, 0x00, 0x00, 0x01),
+			BENCH_INIT_EVENT(0x0e, 0x0b, 0x01, 0x05, 0x10, 0x00, 0xfd, 0x03, 0x60, 0x04, 0x00, 0x01, 0x00),
+			BENCH_INIT_EVENT(0x0e, 0x07, 0x01, 0x02, 0x20, 0x00, 0xfb, 0x00, 0x0f),
+			BENCH_INIT_CONNECT(0x40),
+			BENCH_INIT_CONNECT(0x41),
+		},
+		HCI_ADAPTER_VERSION_VALID | HCI_ADAPTER_BUFFER_VALID | HCI_ADAPTER_LE_BUFFER_VALID,
+		11, 1021, 251, 0, 0, 0, 0
+	},
+	{
+		//
+		// The filter started after the adapter and the remotes, nothing
+		// is known and nothing is trimmed.
+		//
+		"Late start", "USB\\VID_1234&PID_5678",
+		{
+			BENCH_INIT_OUT(BENCH_INIT_MTU(40, ATT_OP_EXCHANGE_MTU_REQ, 185)),
+			BENCH_INIT_IN(BENCH_INIT_MTU(40, ATT_OP_EXCHANGE_MTU_RSP, 185)),
+			BENCH_INIT_OUT_MDL(BENCH_INIT_MTU(41, ATT_OP_EXCHANGE_MTU_REQ, 185)),
+			BENCH_INIT_IN_MDL(BENCH_INIT_MTU(41, ATT_OP_EXCHANGE_MTU_RSP, 185)),
+		},
+		0, 0, 0, 0, 0, FILTER_CONNECTION_ADOPTED, 185, 0
+	},
+};
+
+//
+// Writes an ACL packet like ReplayPacket does, in an MDL instead of a
+// buffer.
+//
+VOID
+WriteInMdl(
+	PBENCH_THREAD	Thread,
+	const UCHAR *	Data,
+	ULONG			Length
+)
+{
+	static MDL	mdl;
+
+	memcpy(Thread->WriteBuffer, Data, Length);
+
+	mdl.Next = NULL;
+	mdl.MappedSystemVa = Thread->WriteBuffer;
+	mdl.ByteCount = Length;
+
+	UsbBuildInterruptOrBulkTransferRequest(&Thread->WriteUrb,
+		sizeof(struct _URB_BULK_OR_INTERRUPT_TRANSFER),
+		&Adapter.Pipes[BENCH_PIPE_ACL_OUT],
+		NULL,
+		&mdl,
+		Length,
+		USBD_TRANSFER_DIRECTION_OUT,
+		NULL);
+
+	ShimSubmitUrb(Adapter.Device, &Thread->WriteUrb);
+}
+
+//
+// Completes the pending read of the ACL in pipe with a packet, in an MDL
+// instead of the buffer ReplayPacket reads into. Returns FALSE if the
+// filter still holds the read.
+//
+BOOLEAN
+ReadInMdl(
+	PBENCH_THREAD	Thread,
+	const UCHAR *	Data,
+	ULONG			Length
+)
+{
+	static MDL		mdl;
+	PBENCH_READER	reader = &Thread->Readers[BENCH_PIPE_ACL_IN];
+	WDFREQUEST		request;
+
+	if (reader->Submitted)
+		return FALSE;
+
+	mdl.Next = NULL;
+	mdl.MappedSystemVa = reader->Buffer;
+	mdl.ByteCount = BENCH_BUFFER_SIZE;
+
+	UsbBuildInterruptOrBulkTransferRequest(&reader->Urb,
+		sizeof(struct _URB_BULK_OR_INTERRUPT_TRANSFER),
+		&Adapter.Pipes[BENCH_PIPE_ACL_IN],
+		NULL,
+		&mdl,
+		BENCH_BUFFER_SIZE,
+		USBD_TRANSFER_DIRECTION_IN | USBD_SHORT_TRANSFER_OK,
+		NULL);
+
+	reader->Submitted = TRUE;
+	ShimSubmitUrb(Adapter.Device, &reader->Urb);
+
+	request = reader->Pending;
+	if (request == NULL)
+		return FALSE;
+
+	reader->Pending = NULL;
+
+	memcpy(reader->Buffer, Data, Length);
+	reader->Urb.UrbBulkOrInterruptTransfer.TransferBufferLength = Length;
+	reader->Urb.UrbHeader.Status = USBD_STATUS_SUCCESS;
+
+	ShimCompleteLowerRequest(request, STATUS_SUCCESS);
+
+	return TRUE;
+}
+
+//
+// Replays Init through a filter of its own and checks what the filter
+// made of the adapter and the two connections, and how long a voice frame
+// on each reaches the stack. Returns FALSE if anything was off.
+//
+BOOLEAN
+InitSequence(
+	const BENCH_INIT *	Init
+)
+{
+	static FILTER_ADAPTER_INFO	info;
+	PBENCH_THREAD				thread = &Threads[0];
+	SHIM_HANDLE					handle;
+	ULONG						bytesReturned;
+	ULONG						wrong = 0;
+	ULONG						voiceLength[2] = { 0, 0 };
+	NTSTATUS					status;
+
+	if (!StartFilter(Init->HardwareId))
+		return FALSE;
+
+	for (ULONG i = 0; i < BENCH_INIT_PACKETS && Init->Packets[i].Length != 0; i++) {
+		const BENCH_INIT_PACKET * packet = &Init->Packets[i];
+
+		ShimSetInterruptTime((ULONGLONG)(i + 1) * 10000);
+
+		if (!packet->Mdl) {
+			ReplayPacket(thread, packet->Kind, packet->Direction, packet->Data, packet->Length, packet->Length);
+		} else if (packet->Direction == HCI_DIRECTION_OUT) {
+			WriteInMdl(thread, packet->Data, packet->Length);
+		} else if (!ReadInMdl(thread, packet->Data, packet->Length)) {
+			wrong++;
+		}
+	}
+
+	//
+	// A voice frame on each connection, as long as the exchanged MTU
+	// allows.
+	//
+	for (ULONG c = 0; c < 2; c++) {
+		UCHAR frame[BENCH_INIT_VOICE];
+
+		memset(frame, 0, sizeof(frame));
+		frame[0] = (UCHAR)(SYNTH_FIRST_HANDLE + c);
+		frame[1] = HCI_ACL_PB_FIRST_FLUSHABLE << 4;
+		frame[2] = (UCHAR)(BENCH_INIT_VOICE - HCI_ACL_HEADER_LENGTH);
+		frame[4] = (UCHAR)(BENCH_INIT_VOICE - ATT_PDU_OFFSET);
+		frame[6] = (UCHAR)L2CAP_CID_ATT;
+		frame[ATT_PDU_OFFSET] = ATT_OP_HANDLE_VALUE_NTF;
+		frame[ATT_PDU_OFFSET + 1] = (UCHAR)SIRI_ATT_HID_REPORT;
+
+		ReplayPacket(thread, TRACE_KIND_ACL, HCI_DIRECTION_IN, frame, sizeof(frame), sizeof(frame));
+		voiceLength[c] = thread->Readers[BENCH_PIPE_ACL_IN].Urb.UrbBulkOrInterruptTransfer.TransferBufferLength;
+	}
+
+	status = ShimOpenControl(&handle);
+	if (NT_SUCCESS(status)) {
+		status = ShimDeviceIoControl(handle, IOCTL_GET_ADAPTER_INFO, NULL, 0, &info, sizeof(info), &bytesReturned);
+		ShimCloseControl(handle);
+	}
+
+	StopFilter();
+
+	if (!NT_SUCCESS(status)) {
+		printf("IOCTL_GET_ADAPTER_INFO failed, 0x%x\n", (unsigned)status);
+		return FALSE;
+	}
+
+	if ((info.Flags & ~FILTER_ADAPTER_VERSION_PRESUMED) != Init->Flags ||
+		info.LmpVersion != Init->LmpVersion ||
+		info.AclDataPacketLength != Init->AclDataPacketLength ||
+		info.LeAclDataPacketLength != Init->LeAclDataPacketLength ||
+		info.DefaultFixAttLength != Init->DefaultFixAttLength ||
+		info.ConnectionCount != 2)
+		wrong++;
+
+	for (ULONG c = 0; c < min(info.ConnectionCount, (USHORT)2); c++) {
+		const FILTER_CONNECTION_INFO * conn = &info.Connections[c];
+		ULONG expected = BENCH_INIT_VOICE;
+
+		if (Init->FixAttLength != 0 && expected > (ULONG)ATT_PDU_OFFSET + Init->FixAttLength)
+			expected = ATT_PDU_OFFSET + Init->FixAttLength;
+
+		if (conn->Handle != SYNTH_FIRST_HANDLE + c ||
+			conn->Flags != Init->ConnectionFlags ||
+			conn->AttMtu != Init->AttMtu ||
+			conn->FixAttLength != Init->FixAttLength ||
+			voiceLength[c] != expected)
+			wrong++;
+	}
+
+	printf("%-18s %3u %5u %5u %4u %6u %5u %5u %5u %5u %6s\n",
+		Init->Name,
+		(unsigned)info.LmpVersion,
+		(unsigned)info.AclDataPacketLength,
+		(unsigned)info.LeAclDataPacketLength,
+		(unsigned)info.DefaultFixAttLength,
+		(unsigned)info.Connections[0].AttMtu,
+		(unsigned)info.Connections[0].FixAttLength,
+		(unsigned)info.Connections[1].FixAttLength,
+		(unsigned)voiceLength[0],
+		(unsigned)voiceLength[1],
+		wrong == 0 ? "right" : "wrong");
+
+	return wrong == 0;
+}
+
+BOOLEAN
+InitSequences()
+{
+	ULONG right = 0;
+
+	printf("%-18s %3s %5s %5s %4s %6s %5s %5s %5s %5s\n",
+		"Adapter", "LMP", "ACL", "LE", "Fix", "MTU", "Fix", "Fix", "Voice", "Voice");
+	printf("%-18s %3s %5s %5s %4s %6s %5s %5s %5s %5s\n",
+		"", "", "", "", "", "", "", "MDL", "", "MDL");
+
+	for (ULONG i = 0; i < ARRAYSIZE(AdapterInits); i++) {
+		if (InitSequence(&AdapterInits[i]))
+			right++;
+	}
+
+	printf("%u of %u adapters right\n", (unsigned)right, (unsigned)ARRAYSIZE(AdapterInits));
+
+	return right == ARRAYSIZE(AdapterInits);
+}
+
+//
+// Connection churn of -L: remotes connect on a few more handles than the
+// filter has slots, reuse them, send ATT before their connection event
+// and disconnect without the filter seeing it.
+//
+#define BENCH_CHURN_HANDLES		(HCI_MAX_CONNECTIONS + 4)
+
+typedef struct _BENCH_CHURN_HANDLE {
+
+	BOOLEAN		Known;			// the filter should have it in its table
+	BOOLEAN		Adopted;
+	UCHAR		PeerAddress[6];
+	USHORT		AttMtu;
+
+} BENCH_CHURN_HANDLE, *PBENCH_CHURN_HANDLE;
+
+typedef struct _BENCH_CHURN {
+
+	ULONG				Random;
+	BENCH_CHURN_HANDLE	Handles[BENCH_CHURN_HANDLES];
+	ULONG				Known;
+	ULONG				Connects;
+	ULONG				Reused;			// connected again without a disconnection
+	ULONG				Adoptions;
+	ULONG				AdoptedConnects;	// the event came after ATT
+	ULONG				Disconnects;
+	ULONG				Missed;			// disconnections the filter doesn't see
+	ULONG				Evictions;
+	ULONG				Wrong;
+
+} BENCH_CHURN, *PBENCH_CHURN;
+
+ULONG
+ChurnRandom(
+	PBENCH_CHURN	Churn
+)
+{
+	ULONG x = Churn->Random;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	Churn->Random = x;
+
+	return x;
+}
+
+VOID
+ChurnEvent(
+	const UCHAR *	Event,
+	ULONG			Length
+)
+{
+	ReplayPacket(&Threads[0], TRACE_KIND_HCI_EVENT, HCI_DIRECTION_IN, Event, Length, Length);
+}
+
+//
+// Checks the filter's table against the model after a step. A step that
+// needed a slot while all were taken may have evicted one known handle.
+//
+VOID
+ChurnCheck(
+	PBENCH_CHURN	Churn,
+	ULONG			Step,
+	BOOLEAN			Allocated,
+	ULONG			KnownBefore
+)
+{
+	static FILTER_ADAPTER_INFO	info;
+	SHIM_HANDLE					handle;
+	ULONG						bytesReturned;
+	ULONG						evicted = 0;
+	ULONG						wrong = 0;
+	NTSTATUS					status;
+
+	status = ShimOpenControl(&handle);
+	if (NT_SUCCESS(status)) {
+		status = ShimDeviceIoControl(handle, IOCTL_GET_ADAPTER_INFO, NULL, 0, &info, sizeof(info), &bytesReturned);
+		ShimCloseControl(handle);
+	}
+
+	if (!NT_SUCCESS(status)) {
+		Churn->Wrong++;
+		return;
+	}
+
+	for (ULONG h = 0; h < BENCH_CHURN_HANDLES; h++) {
+		PBENCH_CHURN_HANDLE model = &Churn->Handles[h];
+		const FILTER_CONNECTION_INFO * conn = NULL;
+		ULONG found = 0;
+
+		for (ULONG i = 0; i < info.ConnectionCount; i++) {
+			if (info.Connections[i].Handle == SYNTH_FIRST_HANDLE + h) {
+				conn = &info.Connections[i];
+				found++;
+			}
+		}
+
+		if (found > 1) {
+			wrong++;
+		} else if (conn == NULL) {
+			if (model->Known) {
+				model->Known = FALSE;
+				Churn->Known--;
+				evicted++;
+			}
+		} else if (!model->Known) {
+			wrong++;
+		} else {
+			static const UCHAR none[6] = { 0 };
+
+			if (((conn->Flags & FILTER_CONNECTION_ADOPTED) != 0) != model->Adopted ||
+				memcmp(conn->PeerAddress, model->Adopted ? none : model->PeerAddress, 6) ||
+				conn->AttMtu != model->AttMtu ||
+				conn->FixAttLength != info.DefaultFixAttLength)
+				wrong++;
+		}
+	}
+
+	//
+	// Only a step that found the table full may take a slot from another.
+	//
+	if (evicted > (Allocated && KnownBefore >= HCI_MAX_CONNECTIONS ? 1UL : 0UL))
+		wrong++;
+
+	Churn->Evictions += evicted;
+
+	if (info.ConnectionCount != Churn->Known)
+		wrong++;
+
+	if (wrong != 0 && Churn->Wrong < 5)
+		printf("Step %u: the filter's table is off\n", (unsigned)Step);
+
+	Churn->Wrong += wrong;
+}
+
+//
+// Runs Steps of connection churn through the filter, checking its table
+// after each. Returns FALSE if it was ever off.
+//
+BOOLEAN
+Churn(
+	ULONG	Steps,
+	ULONG	Seed
+)
+{
+	static BENCH_CHURN	churn;
+	PBENCH_CHURN		c = &churn;
+
+	memset(c, 0, sizeof(BENCH_CHURN));
+	c->Random = Seed != 0 ? Seed : 0x2545F491;
+
+	if (!StartFilter("USB\\VID_0A12&PID_0001"))
+		return FALSE;
+
+	for (ULONG step = 0; step < Steps; step++) {
+		ULONG				h = ChurnRandom(c) % BENCH_CHURN_HANDLES;
+		PBENCH_CHURN_HANDLE	model = &c->Handles[h];
+		USHORT				handle = (USHORT)(SYNTH_FIRST_HANDLE + h);
+		ULONG				op = ChurnRandom(c) % 100;
+		ULONG				knownBefore = c->Known;
+		BOOLEAN				allocated = FALSE;
+
+		ShimSetInterruptTime((ULONGLONG)(step + 1) * 10000);
+
+		if (op < 45) {
+			UCHAR event[] = {
+				0x3e, 0x13, 0x01, 0x00, (UCHAR)handle, (UCHAR)(handle >> 8), 0x00, 0x01,
+				0, 0, 0, 0, 0, 0, 0x09, 0x00, 0x04, 0x00, 0xc8, 0x00, 0x00
+			};
+
+			for (ULONG i = 0; i < 6; i++)
+				event[8 + i] = (UCHAR)ChurnRandom(c);
+
+			//
+			// A known handle connecting again means the filter missed
+			// its disconnection, it starts over unless it was adopted.
+			//
+			if (!model->Known) {
+				allocated = TRUE;
+				model->Known = TRUE;
+				model->AttMtu = 0;
+				c->Known++;
+			} else if (model->Adopted) {
+				c->AdoptedConnects++;
+			} else {
+				model->AttMtu = 0;
+				c->Reused++;
+			}
+
+			model->Adopted = FALSE;
+			memcpy(model->PeerAddress, &event[8], 6);
+			c->Connects++;
+
+			ChurnEvent(event, sizeof(event));
+		} else if (op < 75) {
+			UCHAR event[] = { HCI_EV_DISCONNECTION_COMPLETE, 0x04, 0x00, (UCHAR)handle, (UCHAR)(handle >> 8), 0x13 };
+
+			//
+			// Most remotes go without the filter hearing of it, their
+			// handles stay in its table.
+			//
+			if (ChurnRandom(c) % 4 != 0) {
+				c->Missed++;
+			} else {
+				if (model->Known) {
+					model->Known = FALSE;
+					c->Known--;
+				}
+
+				c->Disconnects++;
+				ChurnEvent(event, sizeof(event));
+			}
+		} else {
+			USHORT	mtu = (USHORT)(ATT_DEFAULT_LE_MTU + ChurnRandom(c) % 495);
+			UCHAR	request[] = { (UCHAR)handle, 0x00, 0x07, 0x00, 0x03, 0x00, 0x04, 0x00, ATT_OP_EXCHANGE_MTU_REQ, (UCHAR)mtu, (UCHAR)(mtu >> 8) };
+			UCHAR	response[] = { (UCHAR)handle, 0x20, 0x07, 0x00, 0x03, 0x00, 0x04, 0x00, ATT_OP_EXCHANGE_MTU_RSP, (UCHAR)mtu, (UCHAR)(mtu >> 8) };
+
+			if (!model->Known) {
+				allocated = TRUE;
+				model->Known = TRUE;
+				model->Adopted = TRUE;
+				c->Known++;
+				c->Adoptions++;
+			}
+
+			model->AttMtu = mtu;
+
+			ReplayPacket(&Threads[0], TRACE_KIND_ACL, HCI_DIRECTION_OUT, request, sizeof(request), sizeof(request));
+			ReplayPacket(&Threads[0], TRACE_KIND_ACL, HCI_DIRECTION_IN, response, sizeof(response), sizeof(response));
+		}
+
+		ChurnCheck(c, step, allocated, knownBefore);
+	}
+
+	StopFilter();
+
+	printf("%u steps, %u connections, %u on a handle still known, %u after ATT on it, %u adopted,\n",
+		(unsigned)Steps,
+		(unsigned)c->Connects,
+		(unsigned)c->Reused,
+		(unsigned)c->AdoptedConnects,
+		(unsigned)c->Adoptions);
+	printf("%u disconnections seen, %u missed, %u slots evicted, %u times the table was off\n",
+		(unsigned)c->Disconnects,
+		(unsigned)c->Missed,
+		(unsigned)c->Evictions,
+		(unsigned)c->Wrong);
+
+	return c->Wrong == 0;
+}
+
+//
+// Hardware IDs -P picks profiles for, as the property holds them in
+// UTF-16, and the profile each must get.
+//
+typedef struct _BENCH_HARDWARE_ID {
+
+	const char *	Id;
+	ULONG			Chars;			// with the terminating zeros of a multi-sz
+	const char *	Profile;
+	BOOLEAN			Fixed080;		// the remote is always on handle 0x080
+
+} BENCH_HARDWARE_ID, *PBENCH_HARDWARE_ID;
+
+#define BENCH_HARDWARE_ID(Id, Profile, Fixed080)	{ Id, sizeof(Id), Profile, Fixed080 }
+
+const BENCH_HARDWARE_ID	HardwareIds[] = {
+	BENCH_HARDWARE_ID("USB\\VID_1286&PID_2044&REV_3201", "Marvell AVASTAR", TRUE),
+	BENCH_HARDWARE_ID("USB\\VID_1286&PID_2044", "Marvell AVASTAR", TRUE),
+	BENCH_HARDWARE_ID("USB\\VID_0a12&PID_0001&REV_8891", "CSR8510", FALSE),
+	BENCH_HARDWARE_ID("USB\\VID_0A5C&PID_21E8&REV_0112", "Broadcom BCM20702", FALSE),
+	BENCH_HARDWARE_ID("USB\\VID_8087&PID_0A2B&REV_0010", "Intel 8265", FALSE),
+	BENCH_HARDWARE_ID("USB\\VID_8087&PID_0029&REV_0001", "Intel AX200", FALSE),
+	BENCH_HARDWARE_ID("USB\\VID_0BDA&PID_8771&REV_0200\0USB\\VID_0BDA&PID_8771\0", "Realtek RTL8761B", FALSE),
+	BENCH_HARDWARE_ID("USB\\VID_8087&PID_0026&REV_0002", "Generic", FALSE),
+	BENCH_HARDWARE_ID("USB\\VID_2044&PID_1286", "Generic", FALSE),
+	BENCH_HARDWARE_ID("USB\\VID_12&PID_2044", "Generic", FALSE),
+	BENCH_HARDWARE_ID("USB\\VID_1286&PID_20", "Generic", FALSE),
+	BENCH_HARDWARE_ID("USB\\VID_1286", "Generic", FALSE),
+	BENCH_HARDWARE_ID("", "Generic", FALSE),
+};
+
+//
+// Packets the matchers of a profile look for.
+//
+#define BENCH_MATCH_HID_NOTIFICATION	0
+#define BENCH_MATCH_MAGIC_WRITE			1
+#define BENCH_MATCH_NOTIFY_ENABLE		2
+#define BENCH_MATCHERS					3
+
+#define BENCH_MATCH_BATCH				256	// packets timed at once
+
+const char *	MatcherNames[BENCH_MATCHERS] = { "HID notification", "Magic write", "Notify enable" };
+
+//
+// What a matcher of a profile must say about a packet, worked out from
+// its fields rather than by comparing bytes. Controllers that put the
+// remote on handle 0x080 mark notifications first flushable and writes
+// first non flushable, never broadcast, others use any handle and first
+// fragment. The matchers rely on the HCI and L2CAP lengths of a
+// notification fitting a byte.
+//
+BOOLEAN
+MatchExpected(
+	BOOLEAN			Fixed080,
+	ULONG			Matcher,
+	const UCHAR *	Bfr,
+	ULONG			Length
+)
+{
+	ULONG	pb;
+	USHORT	l2capLength;
+	USHORT	attHandle;
+
+	if (Length < ATT_PDU_OFFSET + 3)
+		return FALSE;
+
+	pb = HCI_ACL_PB_FLAG(Bfr);
+	l2capLength = (USHORT)(Bfr[4] | (Bfr[5] << 8));
+	attHandle = (USHORT)(Bfr[ATT_PDU_OFFSET + 1] | (Bfr[ATT_PDU_OFFSET + 2] << 8));
+
+	if (Fixed080) {
+		if (HCI_ACL_HANDLE(Bfr) != 0x080 || (Bfr[1] >> 6) != 0 ||
+			pb != (Matcher == BENCH_MATCH_HID_NOTIFICATION ? HCI_ACL_PB_FIRST_FLUSHABLE : HCI_ACL_PB_FIRST_NON_FLUSHABLE))
+			return FALSE;
+	} else if (pb == HCI_ACL_PB_CONTINUING) {
+		return FALSE;
+	}
+
+	if (L2CAP_CID(Bfr) != L2CAP_CID_ATT)
+		return FALSE;
+
+	switch (Matcher) {
+
+	case BENCH_MATCH_HID_NOTIFICATION:
+		return HCI_ACL_LENGTH(Bfr) < 0x100 && l2capLength < 0x100 &&
+			Bfr[ATT_PDU_OFFSET] == ATT_OP_HANDLE_VALUE_NTF && attHandle == SIRI_ATT_HID_REPORT;
+
+	case BENCH_MATCH_MAGIC_WRITE:
+		return Length == ATT_PDU_OFFSET + 4 && HCI_ACL_LENGTH(Bfr) == L2CAP_HEADER_LENGTH + 4 && l2capLength == 4 &&
+			Bfr[ATT_PDU_OFFSET] == ATT_OP_WRITE_CMD && attHandle == SIRI_ATT_BATTERY_LEVEL &&
+			Bfr[ATT_PDU_OFFSET + 3] == SIRI_MAGIC_VALUE;
+
+	default:
+		return Length == ATT_PDU_OFFSET + 5 && HCI_ACL_LENGTH(Bfr) == L2CAP_HEADER_LENGTH + 5 && l2capLength == 5 &&
+			Bfr[ATT_PDU_OFFSET] == ATT_OP_WRITE_REQ && attHandle == SIRI_ATT_BATTERY_LEVEL_CCCD &&
+			Bfr[ATT_PDU_OFFSET + 3] == 0x01 && Bfr[ATT_PDU_OFFSET + 4] == 0x00;
+	}
+}
+
+ULONG
+ProfileRandom(
+	PULONG	Random
+)
+{
+	ULONG x = *Random;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*Random = x;
+
+	return x;
+}
+
+//
+// One of the packets the matchers look for in random framing, with a few
+// bytes or the length changed half the time. Returns its length.
+//
+ULONG
+MatchPacket(
+	PULONG	Random,
+	PUCHAR	Bfr
+)
+{
+	static const USHORT	handles[] = { 0x080, 0x040, 0x0A3, 0xEFF };
+	USHORT				handle = handles[ProfileRandom(Random) % ARRAYSIZE(handles)];
+	ULONG				kind = ProfileRandom(Random) % BENCH_MATCHERS;
+	ULONG				attLength;
+	ULONG				length;
+
+	switch (kind) {
+
+	case BENCH_MATCH_HID_NOTIFICATION:
+		attLength = 3 + ProfileRandom(Random) % (SYNTH_MAX_VOICE_LENGTH + 1);
+		Bfr[ATT_PDU_OFFSET] = ATT_OP_HANDLE_VALUE_NTF;
+		Bfr[ATT_PDU_OFFSET + 1] = (UCHAR)SIRI_ATT_HID_REPORT;
+		for (ULONG i = 3; i < attLength; i++)
+			Bfr[ATT_PDU_OFFSET + i] = (UCHAR)ProfileRandom(Random);
+		break;
+
+	case BENCH_MATCH_MAGIC_WRITE:
+		attLength = 4;
+		Bfr[ATT_PDU_OFFSET] = ATT_OP_WRITE_CMD;
+		Bfr[ATT_PDU_OFFSET + 1] = (UCHAR)SIRI_ATT_BATTERY_LEVEL;
+		Bfr[ATT_PDU_OFFSET + 3] = SIRI_MAGIC_VALUE;
+		break;
+
+	default:
+		attLength = 5;
+		Bfr[ATT_PDU_OFFSET] = ATT_OP_WRITE_REQ;
+		Bfr[ATT_PDU_OFFSET + 1] = (UCHAR)SIRI_ATT_BATTERY_LEVEL_CCCD;
+		Bfr[ATT_PDU_OFFSET + 3] = 0x01;
+		Bfr[ATT_PDU_OFFSET + 4] = 0x00;
+		break;
+	}
+
+	Bfr[ATT_PDU_OFFSET + 2] = 0x00;
+
+	Bfr[0] = (UCHAR)handle;
+	Bfr[1] = (UCHAR)((handle >> 8) | ((ProfileRandom(Random) % 4) << 4) | (ProfileRandom(Random) % 8 == 0 ? 0x40 : 0));
+	Bfr[2] = (UCHAR)(L2CAP_HEADER_LENGTH + attLength);
+	Bfr[3] = (UCHAR)((L2CAP_HEADER_LENGTH + attLength) >> 8);
+	Bfr[4] = (UCHAR)attLength;
+	Bfr[5] = (UCHAR)(attLength >> 8);
+	Bfr[6] = (UCHAR)L2CAP_CID_ATT;
+	Bfr[7] = 0;
+
+	length = ATT_PDU_OFFSET + attLength;
+
+	if (ProfileRandom(Random) % 2 == 0) {
+		ULONG changes = 1 + ProfileRandom(Random) % 3;
+
+		for (ULONG i = 0; i < changes; i++) {
+			if (ProfileRandom(Random) % 4 == 0)
+				length = length + ProfileRandom(Random) % 3 - 1;
+			else
+				Bfr[ProfileRandom(Random) % min(length, (ULONG)ATT_PDU_OFFSET + 5)] ^= (UCHAR)(1 + ProfileRandom(Random) % 255);
+		}
+	}
+
+	return max(length, 1UL);
+}
+
+//
+// Passes a voice frame of Handle and PB flag through a filter loaded for
+// HardwareId and returns whether the stack got it redirected to the
+// battery power state.
+//
+BOOLEAN
+MatchThroughFilter(
+	const char *	HardwareId,
+	USHORT			Handle,
+	UCHAR			Flags,
+	PBOOLEAN		Redirected
+)
+{
+	UCHAR			frame[BENCH_INIT_VOICE];
+	PBENCH_READER	reader = &Threads[0].Readers[BENCH_PIPE_ACL_IN];
+
+	if (!StartFilter(HardwareId))
+		return FALSE;
+
+	memset(frame, 0, sizeof(frame));
+	frame[0] = (UCHAR)Handle;
+	frame[1] = (UCHAR)((Handle >> 8) | Flags);
+	frame[2] = (UCHAR)(BENCH_INIT_VOICE - HCI_ACL_HEADER_LENGTH);
+	frame[4] = (UCHAR)(BENCH_INIT_VOICE - ATT_PDU_OFFSET);
+	frame[6] = (UCHAR)L2CAP_CID_ATT;
+	frame[ATT_PDU_OFFSET] = ATT_OP_HANDLE_VALUE_NTF;
+	frame[ATT_PDU_OFFSET + 1] = (UCHAR)SIRI_ATT_HID_REPORT;
+
+	ReplayPacket(&Threads[0], TRACE_KIND_ACL, HCI_DIRECTION_IN, frame, sizeof(frame), sizeof(frame));
+
+	*Redirected = reader->Buffer[ATT_PDU_OFFSET + 1] == SIRI_ATT_BATTERY_POWER_STATE;
+
+	StopFilter();
+
+	return TRUE;
+}
+
+//
+// Checks the profile each hardware ID gets, the matchers of every profile
+// against MatchExpected on Packets random packets, and that the filter
+// loaded for each controller redirects the notifications in its framing
+// only. Returns FALSE if anything was off.
+//
+BOOLEAN
+Profiles(
+	ULONG	Packets,
+	ULONG	Seed
+)
+{
+	static UCHAR	packets[BENCH_MATCH_BATCH][SYNTH_MAX_PACKET + 1];
+	static ULONG	lengths[BENCH_MATCH_BATCH];
+	ULONG			wrong = 0;
+
+	printf("%-32s %-18s\n", "Hardware ID", "Profile");
+
+	for (ULONG i = 0; i < ARRAYSIZE(HardwareIds); i++) {
+		const BENCH_HARDWARE_ID *	id = &HardwareIds[i];
+		USHORT						chars[128];
+		USHORT						vendorId = 0;
+		USHORT						productId = 0;
+		PCCONTROLLER_PROFILE		profile;
+		BOOLEAN						right;
+
+		for (ULONG c = 0; c < id->Chars; c++)
+			chars[c] = (UCHAR)id->Id[c];
+
+		ProfileParseHardwareId(chars, id->Chars, &vendorId, &productId);
+		profile = ProfileSelect(vendorId, productId);
+		right = !strcmp(profile->Name, id->Profile);
+
+		printf("%-32s %-18s %s\n", id->Id, profile->Name, right ? "right" : "wrong");
+
+		if (!right)
+			wrong++;
+	}
+
+	printf("\n%-18s %-16s %9s %9s %9s %8s\n", "Profile", "Matcher", "Packets", "Matched", "Wrong", "ns");
+
+	for (ULONG i = 0; i < ARRAYSIZE(HardwareIds); i++) {
+		const BENCH_HARDWARE_ID *	id = &HardwareIds[i];
+		USHORT						chars[128];
+		USHORT						vendorId = 0;
+		USHORT						productId = 0;
+		PCCONTROLLER_PROFILE		profile;
+		BOOLEAN						fixed080;
+		BOOLEAN						redirected;
+		BOOLEAN						other;
+
+		BOOLEAN						seen = FALSE;
+
+		//
+		// Each profile once.
+		//
+		for (ULONG j = 0; j < i; j++)
+			seen |= !strcmp(HardwareIds[j].Profile, id->Profile);
+		if (seen)
+			continue;
+
+		for (ULONG c = 0; c < id->Chars; c++)
+			chars[c] = (UCHAR)id->Id[c];
+
+		ProfileParseHardwareId(chars, id->Chars, &vendorId, &productId);
+		profile = ProfileSelect(vendorId, productId);
+		fixed080 = id->Fixed080;
+
+		for (ULONG m = 0; m < BENCH_MATCHERS; m++) {
+			PPROFILE_MATCH_ROUTINE	match = m == BENCH_MATCH_HID_NOTIFICATION ? profile->MatchHidNotification :
+				m == BENCH_MATCH_MAGIC_WRITE ? profile->MatchMagicWrite : profile->MatchNotifyEnableWrite;
+			ULONG					random = Seed != 0 ? Seed : 0x2545F491;
+			ULONG					matched = 0;
+			ULONG					mismatched = 0;
+			ULONGLONG				nanoseconds = 0;
+
+			for (ULONG p = 0; p < Packets; p += BENCH_MATCH_BATCH) {
+				ULONG	batch = min(Packets - p, (ULONG)BENCH_MATCH_BATCH);
+				BOOLEAN	results[BENCH_MATCH_BATCH];
+
+				for (ULONG b = 0; b < batch; b++)
+					lengths[b] = MatchPacket(&random, packets[b]);
+
+				auto start = std::chrono::steady_clock::now();
+				for (ULONG b = 0; b < batch; b++)
+					results[b] = match(packets[b], lengths[b]);
+				nanoseconds += Elapsed(start);
+
+				for (ULONG b = 0; b < batch; b++) {
+					if (results[b])
+						matched++;
+					if (results[b] != MatchExpected(fixed080, m, packets[b], lengths[b]))
+						mismatched++;
+				}
+			}
+
+			printf("%-18s %-16s %9u %9u %9u %8.1f\n",
+				m == 0 ? profile->Name : "",
+				MatcherNames[m],
+				(unsigned)Packets,
+				(unsigned)matched,
+				(unsigned)mismatched,
+				Packets != 0 ? (double)nanoseconds / Packets : 0.0);
+
+			wrong += mismatched;
+		}
+
+		//
+		// The controller's own framing is redirected, the Marvell one
+		// leaves other handles to the stack.
+		//
+		if (!MatchThroughFilter(id->Id, fixed080 ? 0x080 : 0x040, HCI_ACL_PB_FIRST_FLUSHABLE << 4, &redirected) ||
+			!MatchThroughFilter(id->Id, 0x041, HCI_ACL_PB_FIRST_NON_FLUSHABLE << 4, &other))
+			return FALSE;
+
+		if (!redirected || other == fixed080) {
+			printf("%-18s redirected its own framing %s, another handle %s\n",
+				profile->Name, redirected ? "yes" : "no", other ? "yes" : "no");
+			wrong++;
+		}
+	}
+
+	printf("%u wrong\n", (unsigned)wrong);
+
+	return wrong == 0;
+}
+
+//
+// Trace filter programs -T loads, each run over this many packets.
+//
+#define BENCH_TRACE_PACKETS		64
+#define BENCH_TRACE_TIMED		16384	// synthesized packets the fixed programs are timed on
+
+typedef struct _BENCH_TRACE_PACKET {
+
+	UCHAR		Kind;
+	UCHAR		Direction;
+	ULONG		Length;
+	LONGLONG	Time;
+	PUCHAR		Data;			// allocated at Length, so reading past it is caught
+
+} BENCH_TRACE_PACKET, *PBENCH_TRACE_PACKET;
+
+ULONG
+TraceRandom(
+	PULONG	Random
+)
+{
+	ULONG x = *Random;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*Random = x;
+
+	return x;
+}
+
+//
+// What TraceFilterLoad must make of a program, from public.h rather than
+// the verifier.
+//
+BOOLEAN
+TraceProgramValid(
+	const TRACE_FILTER_PROGRAM *	Program,
+	ULONG							Length
+)
+{
+	if (Length < sizeof(ULONG) || Program->InsnCount > TRACE_FILTER_MAX_INSNS ||
+		Length < sizeof(ULONG) + Program->InsnCount * sizeof(TRACE_FILTER_INSN))
+		return FALSE;
+
+	for (ULONG i = 0; i < Program->InsnCount; i++) {
+		const TRACE_FILTER_INSN *insn = &Program->Insns[i];
+
+		if (insn->Op > TRACE_OP_RATE_LIMIT)
+			return FALSE;
+		if (insn->Op >= TRACE_OP_KIND && insn->Op <= TRACE_OP_ATT_HANDLE && insn->Low > insn->High)
+			return FALSE;
+		if (insn->Op == TRACE_OP_SAMPLE && insn->Low == 0)
+			return FALSE;
+		if (insn->Op == TRACE_OP_RATE_LIMIT && (insn->Low == 0 || insn->High == 0))
+			return FALSE;
+		if (insn->Op > TRACE_OP_REJECT &&
+			(i + 1 + insn->JumpTrue > Program->InsnCount || i + 1 + insn->JumpFalse > Program->InsnCount))
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+//
+// A random program, half the time one that verifies with a few of its
+// fields, its count or its length changed. Returns the length it is
+// loaded with.
+//
+ULONG
+TraceProgram(
+	PULONG					Random,
+	PTRACE_FILTER_PROGRAM	Program
+)
+{
+	static const USHORT	values[] = { 0, 1, 4, 0x1B, 0x23, 0x40, 0x80, 0xFFFF };
+	BOOLEAN				valid = TraceRandom(Random) % 2 == 0;
+	ULONG				count = TraceRandom(Random) % (TRACE_FILTER_MAX_INSNS + (valid ? 1 : 3));
+	ULONG				length;
+
+	Program->InsnCount = count;
+
+	for (ULONG i = 0; i < count; i++) {
+		PTRACE_FILTER_INSN	insn = &Program->Insns[i];
+		ULONG				left = count - i - 1;
+
+		insn->Op = (UCHAR)(TraceRandom(Random) % (valid ? TRACE_OP_RATE_LIMIT + 1 : TRACE_OP_RATE_LIMIT + 3));
+		insn->Reserved = 0;
+		insn->JumpTrue = (UCHAR)(valid ? TraceRandom(Random) % (min(left, 4UL) + 1) : TraceRandom(Random) % 6);
+		insn->JumpFalse = (UCHAR)(valid ? TraceRandom(Random) % (min(left, 4UL) + 1) : TraceRandom(Random) % 6);
+		insn->Low = TraceRandom(Random) % 2 ? values[TraceRandom(Random) % ARRAYSIZE(values)] : (USHORT)TraceRandom(Random);
+		insn->High = TraceRandom(Random) % 2 ? values[TraceRandom(Random) % ARRAYSIZE(values)] : (USHORT)TraceRandom(Random);
+
+		if (valid) {
+			if (insn->Low > insn->High) {
+				USHORT low = insn->Low;
+
+				insn->Low = insn->High;
+				insn->High = low;
+			}
+			if (insn->Op >= TRACE_OP_SAMPLE && insn->Low == 0)
+				insn->Low = 1 + TraceRandom(Random) % 16;
+			if (insn->Op == TRACE_OP_RATE_LIMIT && insn->High == 0)
+				insn->High = 1;
+		}
+	}
+
+	length = sizeof(ULONG) + count * sizeof(TRACE_FILTER_INSN);
+
+	if (valid && TraceRandom(Random) % 2 == 0) {
+		ULONG changes = 1 + TraceRandom(Random) % 3;
+
+		for (ULONG i = 0; i < changes; i++) {
+			ULONG cut = 1 + TraceRandom(Random) % 8;
+
+			switch (TraceRandom(Random) % 4) {
+			case 0:
+				length -= min(length, cut);
+				break;
+			case 1:
+				Program->InsnCount += TraceRandom(Random) % 2 ? 1 : -1;
+				break;
+			default:
+				if (count != 0)
+					((PUCHAR)&Program->Insns[TraceRandom(Random) % count])[TraceRandom(Random) % sizeof(TRACE_FILTER_INSN)] ^=
+						(UCHAR)(1 << TraceRandom(Random) % 8);
+				break;
+			}
+		}
+	}
+
+	return length;
+}
+
+//
+// Runs Filter over a packet the way public.h says a program runs,
+// counting the instructions it steps through.
+//
+BOOLEAN
+TraceReference(
+	PTRACE_FILTER	Filter,
+	UCHAR			Kind,
+	UCHAR			Direction,
+	const UCHAR *	Bfr,
+	ULONG			Length,
+	LONGLONG		Now,
+	PULONG			Steps
+)
+{
+	BOOLEAN	acl = Kind == TRACE_KIND_ACL && Length >= 4 && ((Bfr[1] >> 4) & 3) != 1;
+	BOOLEAN	l2cap = acl && Length >= 8;
+	BOOLEAN	att = l2cap && Length >= 9 && Bfr[6] == 4 && Bfr[7] == 0;
+	UCHAR	op = att ? Bfr[8] : 0;
+	BOOLEAN	attHandle = att && Length >= 11 &&
+		(op == 0x0A || op == 0x0C || op == 0x12 || op == 0x16 || op == 0x1B || op == 0x1D || op == 0x52 || op == 0xD2);
+	ULONG	pc = 0;
+
+	*Steps = 0;
+
+	while (pc < Filter->InsnCount) {
+		const TRACE_FILTER_INSN *	insn = &Filter->Insns[pc];
+		PTRACE_FILTER_INSN_STATE	state = &Filter->State[pc];
+		BOOLEAN						known = TRUE;
+		ULONG						value = 0;
+		BOOLEAN						result;
+
+		(*Steps)++;
+
+		switch (insn->Op) {
+		case TRACE_OP_ACCEPT:
+			return TRUE;
+		case TRACE_OP_REJECT:
+			return FALSE;
+		case TRACE_OP_KIND:
+			value = Kind;
+			break;
+		case TRACE_OP_DIRECTION:
+			value = Direction;
+			break;
+		case TRACE_OP_LENGTH:
+			value = Length;
+			break;
+		case TRACE_OP_ACL_HANDLE:
+			known = acl;
+			value = acl ? (Bfr[0] | (Bfr[1] << 8)) & 0xFFF : 0;
+			break;
+		case TRACE_OP_CID:
+			known = l2cap;
+			value = l2cap ? Bfr[6] | (Bfr[7] << 8) : 0;
+			break;
+		case TRACE_OP_ATT_OPCODE:
+			known = att;
+			value = op;
+			break;
+		case TRACE_OP_ATT_HANDLE:
+			known = attHandle;
+			value = attHandle ? Bfr[9] | (Bfr[10] << 8) : 0;
+			break;
+		}
+
+		if (insn->Op == TRACE_OP_SAMPLE) {
+			result = ++state->Count >= insn->Low;
+			if (result)
+				state->Count = 0;
+		} else if (insn->Op == TRACE_OP_RATE_LIMIT) {
+			LONGLONG capacity = (LONGLONG)insn->High * TRACE_FILTER_TICKS_PER_SECOND;
+
+			if (state->LastTime == 0 || Now < state->LastTime)
+				state->Tokens = capacity;
+			else
+				state->Tokens = min(capacity,
+					state->Tokens + min(Now - state->LastTime, TRACE_FILTER_TICKS_PER_SECOND * 3600) * insn->Low);
+			state->LastTime = Now;
+
+			result = state->Tokens >= TRACE_FILTER_TICKS_PER_SECOND;
+			if (result)
+				state->Tokens -= TRACE_FILTER_TICKS_PER_SECOND;
+		} else {
+			result = known && value >= insn->Low && value <= insn->High;
+		}
+
+		pc += 1 + (result ? insn->JumpTrue : insn->JumpFalse);
+	}
+
+	return FALSE;
+}
+
+//
+// A packet of the synthesized traffic, or a random one of a few bytes.
+//
+VOID
+TracePacket(
+	PULONG				Random,
+	PSYNTH_STATE		Synth,
+	PBENCH_TRACE_PACKET	Packet
+)
+{
+	static SYNTH_PACKET	packet;
+
+	if (TraceRandom(Random) % 4 != 0) {
+		SynthNext(Synth, &packet);
+		Packet->Kind = packet.Kind;
+		Packet->Direction = packet.Direction;
+		Packet->Length = packet.Length;
+		Packet->Time = packet.Time;
+		Packet->Data = (PUCHAR)malloc(max(Packet->Length, 1UL));
+		memcpy(Packet->Data, packet.Data, Packet->Length);
+	} else {
+		Packet->Kind = (UCHAR)(TraceRandom(Random) % 3);
+		Packet->Direction = (UCHAR)(TraceRandom(Random) % 2);
+		Packet->Length = TraceRandom(Random) % 16;
+		Packet->Time = packet.Time;
+		Packet->Data = (PUCHAR)malloc(max(Packet->Length, 1UL));
+		for (ULONG i = 0; i < Packet->Length; i++)
+			Packet->Data[i] = (UCHAR)(i == 6 ? 4 : i == 7 || TraceRandom(Random) % 4 == 0 ? 0 : TraceRandom(Random));
+	}
+}
+
+//
+// Loads Programs random and mutated programs through TraceFilterLoad,
+// checks it takes exactly the ones that verify and leaves the filter be
+// otherwise, and runs each it took over packets against TraceReference,
+// results, sampling and rate limit state and the number of steps, which
+// must stay within the program. Then times TraceFilterRun per packet for
+// a few programs like the ones people load. Returns FALSE if anything was
+// off.
+//
+BOOLEAN
+TraceFilters(
+	ULONG	Programs,
+	ULONG	Seed
+)
+{
+	static UCHAR			programBuffer[sizeof(ULONG) + (TRACE_FILTER_MAX_INSNS + 2) * sizeof(TRACE_FILTER_INSN)];
+	static TRACE_FILTER		filter;
+	static TRACE_FILTER		reference;
+	static TRACE_FILTER		untouched;
+	PTRACE_FILTER_PROGRAM	program = (PTRACE_FILTER_PROGRAM)programBuffer;
+	SYNTH_CONFIG			config;
+	SYNTH_STATE				synth;
+	BENCH_TRACE_PACKET		packets[BENCH_TRACE_PACKETS];
+	ULONG					random = Seed != 0 ? Seed : 0x2545F491;
+	ULONG					loaded = 0;
+	ULONG					packetsRun = 0;
+	ULONG					mostSteps = 0;
+	ULONG					wrong = 0;
+
+	memset(&config, 0, sizeof(config));
+	config.Connections = 2;
+	config.ButtonHz = SYNTH_DEFAULT_BUTTON_HZ;
+	config.TouchHz = SYNTH_DEFAULT_TOUCH_HZ;
+	config.TouchMs = SYNTH_DEFAULT_TOUCH_MS;
+	config.MoveHz = SYNTH_DEFAULT_MOVE_HZ;
+	config.VoiceEveryMs = SYNTH_DEFAULT_VOICE_EVERY_MS;
+	config.VoiceBurstMs = SYNTH_DEFAULT_VOICE_BURST_MS;
+	config.VoiceHz = SYNTH_DEFAULT_VOICE_HZ;
+	config.VoiceLength = SYNTH_DEFAULT_VOICE_LENGTH;
+	config.Seed = random;
+
+	SynthInit(&synth, &config);
+
+	memset(&untouched, 0xA5, sizeof(untouched));
+
+	for (ULONG p = 0; p < Programs; p++) {
+		ULONG	length = TraceProgram(&random, program);
+		PUCHAR	copy = (PUCHAR)malloc(max(length, 1UL));
+		BOOLEAN	valid = TraceProgramValid(program, length);
+		BOOLEAN	taken;
+
+		memcpy(copy, programBuffer, length);
+		memcpy(&filter, &untouched, sizeof(filter));
+
+		taken = TraceFilterLoad(&filter, (const TRACE_FILTER_PROGRAM *)copy, length);
+		free(copy);
+
+		if (taken != valid || (!taken && memcmp(&filter, &untouched, sizeof(filter)) != 0)) {
+			if (wrong++ < 8)
+				printf("program %u of %u instructions, %u bytes: loaded %u, verifies %u\n",
+					(unsigned)p, (unsigned)program->InsnCount, (unsigned)length, taken, valid);
+			continue;
+		}
+
+		if (!taken)
+			continue;
+
+		loaded++;
+
+		for (ULONG i = 0; i < BENCH_TRACE_PACKETS; i++)
+			TracePacket(&random, &synth, &packets[i]);
+
+		for (ULONG i = 0; i < BENCH_TRACE_PACKETS; i++) {
+			PBENCH_TRACE_PACKET	packet = &packets[i];
+			ULONG				steps;
+			BOOLEAN				result;
+			BOOLEAN				expected;
+
+			memcpy(&reference, &filter, sizeof(filter));
+
+			result = TraceFilterRun(&filter, packet->Kind, packet->Direction, packet->Data, packet->Length, packet->Time);
+			expected = TraceReference(&reference, packet->Kind, packet->Direction, packet->Data, packet->Length,
+				packet->Time, &steps);
+
+			mostSteps = max(mostSteps, steps);
+			packetsRun++;
+
+			if (result != expected || steps > filter.InsnCount ||
+				memcmp(filter.State, reference.State, sizeof(filter.State)) != 0) {
+				if (wrong++ < 8)
+					printf("program %u packet %u: %u, expected %u after %u steps of %u\n",
+						(unsigned)p, (unsigned)i, result, expected, (unsigned)steps, (unsigned)filter.InsnCount);
+				memcpy(&filter, &reference, sizeof(filter));
+			}
+		}
+
+		for (ULONG i = 0; i < BENCH_TRACE_PACKETS; i++)
+			free(packets[i].Data);
+	}
+
+	printf("%u programs, %u loaded, %u packets run, at most %u steps, %u wrong\n\n",
+		(unsigned)Programs, (unsigned)loaded, (unsigned)packetsRun, (unsigned)mostSteps, (unsigned)wrong);
+
+	//
+	// Timing on the synthesized traffic alone.
+	//
+	static const struct {
+
+		const char *		Name;
+		ULONG				InsnCount;
+		TRACE_FILTER_INSN	Insns[4];
+
+	} timed[] = {
+		{ "empty", 0, { } },
+		{ "accept", 1, { { TRACE_OP_ACCEPT } } },
+		{ "ATT handle 0x23 in, 1 in 16", 4, {
+			{ TRACE_OP_DIRECTION, 0, 3, 0, HCI_DIRECTION_IN, HCI_DIRECTION_IN },
+			{ TRACE_OP_ATT_HANDLE, 0, 2, 0, SIRI_ATT_HID_REPORT, SIRI_ATT_HID_REPORT },
+			{ TRACE_OP_SAMPLE, 0, 1, 0, 16, 16 },
+			{ TRACE_OP_ACCEPT } } },
+		{ "events or 10 per second", 4, {
+			{ TRACE_OP_KIND, 1, 0, 0, TRACE_KIND_HCI_EVENT, TRACE_KIND_HCI_EVENT },
+			{ TRACE_OP_RATE_LIMIT, 0, 1, 0, 10, 10 },
+			{ TRACE_OP_ACCEPT },
+			{ TRACE_OP_REJECT } } },
+	};
+	static BENCH_TRACE_PACKET	traffic[BENCH_TRACE_TIMED];
+	static SYNTH_PACKET			packet;
+
+	for (ULONG i = 0; i < BENCH_TRACE_TIMED; i++) {
+		SynthNext(&synth, &packet);
+		traffic[i].Kind = packet.Kind;
+		traffic[i].Direction = packet.Direction;
+		traffic[i].Length = packet.Length;
+		traffic[i].Time = packet.Time;
+		traffic[i].Data = (PUCHAR)malloc(max(traffic[i].Length, 1UL));
+		memcpy(traffic[i].Data, packet.Data, traffic[i].Length);
+	}
+
+	printf("%-32s %9s %9s %8s\n", "Program", "Packets", "Dumped", "ns");
+
+	for (ULONG t = 0; t < ARRAYSIZE(timed) + 1; t++) {
+		ULONG		dumped = 0;
+		ULONG		rounds = 64;
+		ULONGLONG	nanoseconds;
+
+		//
+		// And the longest program there can be, 32 tests falling through.
+		//
+		memset(&filter, 0, sizeof(filter));
+		if (t < ARRAYSIZE(timed)) {
+			filter.InsnCount = timed[t].InsnCount;
+			memcpy(filter.Insns, timed[t].Insns, sizeof(timed[t].Insns));
+		} else {
+			filter.InsnCount = TRACE_FILTER_MAX_INSNS;
+			for (ULONG i = 0; i < TRACE_FILTER_MAX_INSNS; i++) {
+				filter.Insns[i].Op = TRACE_OP_LENGTH;
+				filter.Insns[i].Low = 0;
+				filter.Insns[i].High = (USHORT)i;
+			}
+		}
+
+		if (!TraceFilterVerify(filter.Insns, filter.InsnCount)) {
+			printf("%s doesn't verify\n", t < ARRAYSIZE(timed) ? timed[t].Name : "longest");
+			wrong++;
+			continue;
+		}
+
+		auto start = std::chrono::steady_clock::now();
+
+		for (ULONG r = 0; r < rounds; r++) {
+			for (ULONG i = 0; i < BENCH_TRACE_TIMED; i++) {
+				dumped += TraceFilterRun(&filter, traffic[i].Kind, traffic[i].Direction, traffic[i].Data,
+					traffic[i].Length, traffic[i].Time + r * (traffic[BENCH_TRACE_TIMED - 1].Time - traffic[0].Time + 1));
+			}
+		}
+
+		nanoseconds = Elapsed(start);
+
+		printf("%-32s %9u %9u %8.1f\n",
+			t < ARRAYSIZE(timed) ? timed[t].Name : "32 length tests",
+			(unsigned)(rounds * BENCH_TRACE_TIMED),
+			(unsigned)dumped,
+			(double)nanoseconds / (rounds * BENCH_TRACE_TIMED));
+	}
+
+	for (ULONG i = 0; i < BENCH_TRACE_TIMED; i++)
+		free(traffic[i].Data);
+
+	printf("%u wrong\n", (unsigned)wrong);
+
+	return wrong == 0;
+}
+
+//
+// Tracepoint records -K writes on each thread while one reads them.
+//
+#define BENCH_TRACEPOINT_WRITERS	4
+#define BENCH_TRACEPOINT_RECORDS	200000
+#define BENCH_TRACEPOINT_CALLS		10000000	// timed per call
+
+//
+// Reads every record after *Next, checking each with Check. Returns how
+// many were written since, read or lost.
+//
+template <typename CHECK>
+ULONG
+TracepointDrain(
+	PULONG	Next,
+	CHECK	Check
+)
+{
+	static TRACEPOINT_RECORD	records[256];
+	ULONG						written = 0;
+	ULONG						count;
+	ULONG						lost;
+
+	do {
+		count = TracepointRead(*Next, records, ARRAYSIZE(records), Next, &lost);
+
+		for (ULONG i = 0; i < count; i++)
+			Check(&records[i]);
+
+		written += count + lost;
+	} while (count != 0 || lost != 0);
+
+	return written;
+}
+
+//
+// A record of writer Writer, its Count-th, with fields that only go
+// together when nothing tore it.
+//
+VOID
+TracepointWriter(
+	ULONG	Writer
+)
+{
+	for (ULONG i = 0; i < BENCH_TRACEPOINT_RECORDS; i++)
+		TracepointWrite(TRACEPOINT_URB_SUBMIT, TRACEPOINT_LEVEL_VERBOSE, Writer, i, ~(ULONGLONG)i,
+			((ULONGLONG)Writer << 32) | i);
+}
+
+//
+// Checks the tracepoint ring keeps records whole and in order and counts
+// what it overwrote, alone and with writers on several threads, times a
+// tracepoint with its keyword off and on, then what tracing costs each
+// of Packets packets through the filter with no keywords, the default
+// ones and every URB. Returns FALSE if anything was off.
+//
+BOOLEAN
+Tracepoints(
+	ULONG	Packets,
+	ULONG	Seed
+)
+{
+	static const ULONG	keywords[] = { 0, TRACEPOINT_KEYWORDS_DEFAULT, TRACEPOINT_KEYWORDS_DEFAULT | TRACEPOINT_KEYWORD_URB };
+	static const char *	keywordNames[] = { "none", "default", "default and URB" };
+	ULONG				next = 0;
+	ULONG				wrong = 0;
+	ULONG				expected = 0;
+	ULONG				lastSequence = 0;
+	ULONG				lastCount[BENCH_TRACEPOINT_WRITERS];
+	ULONG				read = 0;
+	ULONG				written;
+	ULONG				savedKeywords = TracepointKeywords;
+
+	auto check = [&](PTRACEPOINT_RECORD Record) {
+		ULONG	writer = (ULONG)Record->Fields[0];
+		ULONG	count = (ULONG)Record->Fields[1];
+
+		if (Record->Id != TRACEPOINT_URB_SUBMIT || writer >= BENCH_TRACEPOINT_WRITERS ||
+			Record->Fields[2] != ~(ULONGLONG)count || Record->Fields[3] != (((ULONGLONG)writer << 32) | count) ||
+			(LONG)(Record->Sequence - lastSequence) <= 0 || (LONG)(count - lastCount[writer]) <= 0) {
+			if (wrong++ < 8)
+				printf("record %u of writer %u torn or out of order\n", (unsigned)Record->Sequence, (unsigned)writer);
+		} else {
+			lastSequence = Record->Sequence;
+			lastCount[writer] = count;
+			read++;
+		}
+	};
+
+	TracepointDrain(&next, [](PTRACEPOINT_RECORD) { });
+
+	//
+	// One writer, a few records then more than the ring holds.
+	//
+	for (ULONG round = 0; round < 2; round++) {
+		ULONG records = round == 0 ? 10 : TRACEPOINT_RING_RECORDS + 100;
+		ULONG first = next;
+
+		for (ULONG w = 0; w < BENCH_TRACEPOINT_WRITERS; w++)
+			lastCount[w] = (ULONG)-1;
+		lastSequence = next - 1;
+		read = 0;
+
+		for (ULONG i = 0; i < records; i++)
+			TracepointWrite(TRACEPOINT_URB_SUBMIT, TRACEPOINT_LEVEL_VERBOSE, 0, i, ~(ULONGLONG)i, i);
+
+		written = TracepointDrain(&next, check);
+
+		if (written != records || next - first != records || read != min(records, (ULONG)TRACEPOINT_RING_RECORDS)) {
+			printf("%u records written, %u counted, %u read\n", (unsigned)records, (unsigned)written, (unsigned)read);
+			wrong++;
+		}
+	}
+
+	//
+	// Several writers and a reader.
+	//
+	{
+		std::thread			threads[BENCH_TRACEPOINT_WRITERS];
+		std::atomic<ULONG>	running(BENCH_TRACEPOINT_WRITERS);
+		ULONG				first = next;
+
+		for (ULONG w = 0; w < BENCH_TRACEPOINT_WRITERS; w++)
+			lastCount[w] = (ULONG)-1;
+		lastSequence = next - 1;
+		read = 0;
+		written = 0;
+
+		for (ULONG w = 0; w < BENCH_TRACEPOINT_WRITERS; w++)
+			threads[w] = std::thread([&running](ULONG Writer) { TracepointWriter(Writer); running--; }, w);
+
+		while (running != 0)
+			written += TracepointDrain(&next, check);
+
+		for (ULONG w = 0; w < BENCH_TRACEPOINT_WRITERS; w++)
+			threads[w].join();
+
+		written += TracepointDrain(&next, check);
+		expected = BENCH_TRACEPOINT_WRITERS * BENCH_TRACEPOINT_RECORDS;
+
+		printf("%u writers, %u records, %u read, %u lost\n",
+			(unsigned)BENCH_TRACEPOINT_WRITERS, (unsigned)expected, (unsigned)read, (unsigned)(written - read));
+
+		if (written != expected || next - first != expected) {
+			printf("%u records written, %u counted\n", (unsigned)expected, (unsigned)written);
+			wrong++;
+		}
+	}
+
+	//
+	// A tracepoint off and on.
+	//
+	printf("\n%-28s %8s\n", "Tracepoint", "ns");
+
+	for (ULONG on = 0; on < 2; on++) {
+		volatile ULONG	field = 0;
+
+		TracepointKeywords = on ? TRACEPOINT_KEYWORD_URB : 0;
+
+		auto start = std::chrono::steady_clock::now();
+
+		for (ULONG i = 0; i < BENCH_TRACEPOINT_CALLS; i++)
+			TRACEPOINT(TRACEPOINT_LEVEL_VERBOSE, TRACEPOINT_KEYWORD_URB, TRACEPOINT_URB_SUBMIT, field, i, 0, 0);
+
+		printf("%-28s %8.1f\n", on ? "keyword on" : "keyword off", (double)Elapsed(start) / BENCH_TRACEPOINT_CALLS);
+
+		written = TracepointDrain(&next, [](PTRACEPOINT_RECORD) { });
+		if (written != (on ? BENCH_TRACEPOINT_CALLS : 0)) {
+			printf("%u records for %u calls\n", (unsigned)written, (unsigned)(on ? BENCH_TRACEPOINT_CALLS : 0));
+			wrong++;
+		}
+	}
+
+	//
+	// And through the filter.
+	//
+	printf("\n%-28s %9s %9s %8s\n", "Keywords", "Packets", "Records", "ns");
+
+	for (ULONG k = 0; k < ARRAYSIZE(keywords); k++) {
+		SYNTH_CONFIG		config;
+		SYNTH_STATE			synth;
+		static SYNTH_PACKET	packet;
+		ULONGLONG			nanoseconds = 0;
+		ULONG				keyword = keywords[k];
+
+		memset(&config, 0, sizeof(config));
+		config.Connections = 2;
+		config.ButtonHz = SYNTH_DEFAULT_BUTTON_HZ;
+		config.TouchHz = SYNTH_DEFAULT_TOUCH_HZ;
+		config.TouchMs = SYNTH_DEFAULT_TOUCH_MS;
+		config.MoveHz = SYNTH_DEFAULT_MOVE_HZ;
+		config.VoiceEveryMs = SYNTH_DEFAULT_VOICE_EVERY_MS;
+		config.VoiceBurstMs = SYNTH_DEFAULT_VOICE_BURST_MS;
+		config.VoiceHz = SYNTH_DEFAULT_VOICE_HZ;
+		config.VoiceLength = SYNTH_DEFAULT_VOICE_LENGTH;
+		config.Seed = Seed;
+
+		SynthInit(&synth, &config);
+
+		if (!StartFilter("USB\\VID_0A12&PID_0001"))
+			return FALSE;
+
+		if (!SendControl(IOCTL_SET_TRACEPOINT_KEYWORDS, &keyword, sizeof(keyword), "IOCTL_SET_TRACEPOINT_KEYWORDS")) {
+			StopFilter();
+			return FALSE;
+		}
+
+		TracepointDrain(&next, [](PTRACEPOINT_RECORD) { });
+
+		for (ULONG i = 0; i < Packets; i++) {
+			SynthNext(&synth, &packet);
+			nanoseconds += ReplayPacket(&Threads[0], packet.Kind, packet.Direction, packet.Data, packet.Length,
+				packet.Length);
+		}
+
+		written = TracepointDrain(&next, [](PTRACEPOINT_RECORD) { });
+
+		StopFilter();
+
+		printf("%-28s %9u %9u %8.1f\n", keywordNames[k], (unsigned)Packets, (unsigned)written,
+			(double)nanoseconds / Packets);
+
+		//
+		// Nothing without keywords, a submit and a completion per packet
+		// with the URB one.
+		//
+		if ((keyword == 0 && written != 0) || ((keyword & TRACEPOINT_KEYWORD_URB) && written < 2 * Packets)) {
+			printf("%u records for %u packets\n", (unsigned)written, (unsigned)Packets);
+			wrong++;
+		}
+	}
+
+	TracepointKeywords = savedKeywords;
+
+	printf("%u wrong\n", (unsigned)wrong);
+
+	return wrong == 0;
+}
+
+//
+// -Z starts a capture window every this many records, and cuts and
+// mutates the stream this often.
+//
+#define BENCH_CAPSTREAM_WINDOW		4096
+#define BENCH_CAPSTREAM_PREFIXES	16			// every that many items is fed short
+#define BENCH_CAPSTREAM_FUZZ		100000		// random and mutated inputs decoded
+
+ULONG
+CapStreamRandom(
+	PULONG	Random
+)
+{
+	ULONG x = *Random;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*Random = x;
+
+	return x;
+}
+
+//
+// Decodes whatever In holds, which may be anything, and checks the
+// decoder neither reads past it nor makes up records the encoder couldn't
+// have written. Returns FALSE if it did.
+//
+BOOLEAN
+CapStreamDecodeAny(
+	PCAPSTREAM_STATE	State,
+	const UCHAR *		In,
+	ULONG				InLength
+)
+{
+	FILTER_CAPTURE_HEADER	window;
+	FILTER_CAPTURE_RECORD	record;
+	UCHAR					type;
+	ULONG					offset = 0;
+
+	while (offset < InLength) {
+		LONG n = CapStreamDecode(State, In + offset, InLength - offset, &type, &window, &record);
+
+		if (n == CAPSTREAM_NEED_MORE || n == CAPSTREAM_CORRUPT)
+			return TRUE;
+
+		if (n < 0 || (ULONG)n > InLength - offset)
+			return FALSE;
+
+		if (type != CAPSTREAM_ITEM_WINDOW &&
+			(record.CapturedLength > FILTER_CAPTURE_SNAPLEN || record.CapturedLength > record.Length ||
+			 record.Kind > 1 || record.Direction > 1))
+			return FALSE;
+
+		offset += n;
+	}
+
+	return TRUE;
+}
+
+//
+// Encodes Records records of synthesized traffic, with a capture window
+// every so often, reports how much smaller they get and how fast both
+// ways, and checks they decode to what went in.
+// Items fed short must ask for more without touching the decoder state.
+// Then decodes random bytes and mutated streams. Returns FALSE if
+// anything was off.
+//
+BOOLEAN
+CapStreams(
+	ULONG	Records,
+	ULONG	Seed
+)
+{
+	static CAPSTREAM_STATE	state;
+	static CAPSTREAM_STATE	saved;
+	static SYNTH_PACKET		packet;
+	SYNTH_CONFIG			config;
+	SYNTH_STATE				synth;
+	PFILTER_CAPTURE_RECORD	records = (PFILTER_CAPTURE_RECORD)calloc(Records, sizeof(FILTER_CAPTURE_RECORD));
+	PFILTER_CAPTURE_HEADER	windows = (PFILTER_CAPTURE_HEADER)calloc(Records / BENCH_CAPSTREAM_WINDOW + 1, sizeof(FILTER_CAPTURE_HEADER));
+	PULONG					itemOffsets = (PULONG)calloc(Records + Records / BENCH_CAPSTREAM_WINDOW + 2, sizeof(ULONG));
+	ULONG					encodedSize = (Records + Records / BENCH_CAPSTREAM_WINDOW + 1) * CAPSTREAM_MAX_ITEM_SIZE;
+	PUCHAR					encoded = (PUCHAR)malloc(encodedSize);
+	ULONG					random = Seed != 0 ? Seed : 0x2545F491;
+	ULONGLONG				capturedBytes = 0;
+	ULONG					encodedLength = 0;
+	ULONG					items = 0;
+	ULONG					wrong = 0;
+	ULONGLONG				nanoseconds[2];
+
+	memset(&config, 0, sizeof(config));
+	config.Connections = 4;
+	config.ButtonHz = SYNTH_DEFAULT_BUTTON_HZ;
+	config.TouchHz = SYNTH_DEFAULT_TOUCH_HZ;
+	config.TouchMs = SYNTH_DEFAULT_TOUCH_MS;
+	config.MoveHz = SYNTH_DEFAULT_MOVE_HZ;
+	config.VoiceEveryMs = SYNTH_DEFAULT_VOICE_EVERY_MS;
+	config.VoiceBurstMs = SYNTH_DEFAULT_VOICE_BURST_MS;
+	config.VoiceHz = SYNTH_DEFAULT_VOICE_HZ;
+	config.VoiceLength = SYNTH_DEFAULT_VOICE_LENGTH;
+	config.Seed = random;
+
+	SynthInit(&synth, &config);
+
+	for (ULONG i = 0; i < Records; i++) {
+		PFILTER_CAPTURE_RECORD record = &records[i];
+
+		SynthNext(&synth, &packet);
+
+		record->Time = packet.Time;
+		record->Length = packet.Length;
+		record->Kind = packet.Kind;
+		record->Direction = packet.Direction;
+		record->CapturedLength = (USHORT)min((ULONG)packet.Length, (ULONG)FILTER_CAPTURE_SNAPLEN);
+		memcpy(record->Data, packet.Data, record->CapturedLength);
+
+		capturedBytes += record->CapturedLength;
+
+		if (i % BENCH_CAPSTREAM_WINDOW == 0) {
+			PFILTER_CAPTURE_HEADER window = &windows[i / BENCH_CAPSTREAM_WINDOW];
+
+			window->State = FILTER_CAPTURE_FROZEN;
+			window->Trigger = (UCHAR)(1 << (CapStreamRandom(&random) % 4));
+			window->TriggerHandle = (USHORT)(SYNTH_FIRST_HANDLE + CapStreamRandom(&random) % config.Connections);
+			window->RecordCount = min(Records - i, (ULONG)BENCH_CAPSTREAM_WINDOW);
+			window->TriggerRecord = CapStreamRandom(&random) % window->RecordCount;
+			window->TriggerTime = packet.Time + CapStreamRandom(&random) % 10000;
+		}
+	}
+
+	//
+	// Encoding.
+	//
+	CapStreamInit(&state);
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (ULONG i = 0; i < Records; i++) {
+		ULONG n;
+
+		if (i % BENCH_CAPSTREAM_WINDOW == 0) {
+			itemOffsets[items++] = encodedLength;
+			encodedLength += CapStreamEncodeWindow(&state, &windows[i / BENCH_CAPSTREAM_WINDOW],
+				encoded + encodedLength, encodedSize - encodedLength);
+		}
+
+		itemOffsets[items++] = encodedLength;
+		n = CapStreamEncode(&state, &records[i], encoded + encodedLength, encodedSize - encodedLength);
+		if (n == 0) {
+			printf("record %u didn't encode\n", (unsigned)i);
+			wrong++;
+		}
+		encodedLength += n;
+	}
+
+	nanoseconds[0] = Elapsed(start);
+	itemOffsets[items] = encodedLength;
+
+	//
+	// Decoding, timed whole, then checked.
+	//
+	for (ULONG pass = 0; pass < 2; pass++) {
+		FILTER_CAPTURE_HEADER	window;
+		FILTER_CAPTURE_RECORD	record;
+		UCHAR					type;
+		ULONG					offset = 0;
+		ULONG					recordIndex = 0;
+		ULONG					windowIndex = 0;
+
+		CapStreamInit(&state);
+
+		start = std::chrono::steady_clock::now();
+
+		for (ULONG item = 0; item < items; item++) {
+			LONG n = CapStreamDecode(&state, encoded + offset, encodedLength - offset, &type, &window, &record);
+
+			if (n <= 0) {
+				printf("item %u at %u didn't decode, %d\n", (unsigned)item, (unsigned)offset, (int)n);
+				wrong++;
+				break;
+			}
+
+			offset += n;
+
+			if (pass == 0)
+				continue;
+
+			if (type == CAPSTREAM_ITEM_WINDOW) {
+				const FILTER_CAPTURE_HEADER *expected = &windows[windowIndex++];
+
+				if (window.Trigger != expected->Trigger || window.TriggerHandle != expected->TriggerHandle ||
+					window.RecordCount != expected->RecordCount || window.TriggerRecord != expected->TriggerRecord ||
+					window.TriggerTime != expected->TriggerTime || window.State != FILTER_CAPTURE_FROZEN) {
+					if (wrong++ < 8)
+						printf("window %u decoded wrong\n", (unsigned)windowIndex - 1);
+				}
+			} else {
+				const FILTER_CAPTURE_RECORD *expected = &records[recordIndex++];
+
+				if (record.Time != expected->Time || record.Length != expected->Length ||
+					record.Kind != expected->Kind || record.Direction != expected->Direction ||
+					record.CapturedLength != expected->CapturedLength ||
+					memcmp(record.Data, expected->Data, expected->CapturedLength) != 0) {
+					if (wrong++ < 8)
+						printf("record %u decoded wrong\n", (unsigned)recordIndex - 1);
+				}
+			}
+
+			//
+			// Every prefix of some items must ask for more and leave the
+			// state as it was.
+			//
+			if (item % BENCH_CAPSTREAM_PREFIXES == 0 && item + 1 < items) {
+				ULONG next = itemOffsets[item + 1];
+				ULONG length = itemOffsets[item + 2] - next;
+
+				memcpy(&saved, &state, sizeof(state));
+
+				for (ULONG prefix = 0; prefix < length; prefix++) {
+					PUCHAR	copy = (PUCHAR)malloc(max(prefix, 1UL));
+					LONG	m;
+
+					memcpy(copy, encoded + next, prefix);
+					m = CapStreamDecode(&state, copy, prefix, &type, &window, &record);
+					free(copy);
+
+					if (m != CAPSTREAM_NEED_MORE || memcmp(&saved, &state, sizeof(state)) != 0) {
+						if (wrong++ < 8)
+							printf("item %u cut to %u of %u bytes gave %d\n", (unsigned)item + 1, (unsigned)prefix,
+								(unsigned)length, (int)m);
+						memcpy(&state, &saved, sizeof(state));
+						break;
+					}
+				}
+			}
+		}
+
+		if (pass == 0)
+			nanoseconds[1] = Elapsed(start);
+
+		if (offset != encodedLength || (pass == 1 && (recordIndex != Records || windowIndex != (Records + BENCH_CAPSTREAM_WINDOW - 1) / BENCH_CAPSTREAM_WINDOW))) {
+			printf("decoded %u of %u bytes, %u of %u records\n", (unsigned)offset, (unsigned)encodedLength,
+				(unsigned)recordIndex, (unsigned)Records);
+			wrong++;
+		}
+	}
+
+	printf("%u records, %llu bytes captured, %llu as records, %u encoded\n",
+		(unsigned)Records, (unsigned long long)capturedBytes,
+		(unsigned long long)Records * sizeof(FILTER_CAPTURE_RECORD), (unsigned)encodedLength);
+	printf("%.2f of the captured bytes, %.2f bytes a record\n",
+		(double)encodedLength / capturedBytes, (double)encodedLength / Records);
+	printf("encode %.1f ns a record, %.1f MB/s captured\n",
+		(double)nanoseconds[0] / Records, capturedBytes * 1000.0 / nanoseconds[0]);
+	printf("decode %.1f ns a record, %.1f MB/s captured\n",
+		(double)nanoseconds[1] / Records, capturedBytes * 1000.0 / nanoseconds[1]);
+
+	//
+	// Random bytes, then pieces of the stream with a few bytes changed,
+	// each in a buffer of its own size.
+	//
+	for (ULONG f = 0; f < BENCH_CAPSTREAM_FUZZ; f++) {
+		ULONG	length = 1 + CapStreamRandom(&random) % 128;
+		PUCHAR	input = (PUCHAR)malloc(length);
+		BOOLEAN	mutated = f % 2 == 1 && encodedLength > length;
+
+		if (mutated) {
+			ULONG from = itemOffsets[CapStreamRandom(&random) % items];
+			ULONG changes = 1 + CapStreamRandom(&random) % 3;
+
+			length = min(length, encodedLength - from);
+			memcpy(input, encoded + from, length);
+			for (ULONG c = 0; c < changes; c++)
+				input[CapStreamRandom(&random) % length] ^= (UCHAR)(1 + CapStreamRandom(&random) % 255);
+		} else {
+			for (ULONG i = 0; i < length; i++)
+				input[i] = (UCHAR)CapStreamRandom(&random);
+		}
+
+		//
+		// Half the time on streams of the real traffic, where deltas and
+		// same length tags have something to refer to.
+		//
+		if (CapStreamRandom(&random) % 2 == 0)
+			CapStreamInit(&state);
+
+		if (!CapStreamDecodeAny(&state, input, length)) {
+			if (wrong++ < 8)
+				printf("%s input %u of %u bytes decoded to nonsense\n", mutated ? "mutated" : "random",
+					(unsigned)f, (unsigned)length);
+		}
+
+		free(input);
+	}
+
+	printf("%u random and mutated inputs decoded, %u wrong\n", (unsigned)BENCH_CAPSTREAM_FUZZ, (unsigned)wrong);
+
+	free(records);
+	free(windows);
+	free(itemOffsets);
+	free(encoded);
+
+	return wrong == 0;
+}
+
+//
+// Windows -W coalesces the same traffic with, in ms.
+//
+const ULONG	CoalesceWindows[] = { 0, 4, 8, 16, 33, 50 };
+
+#define BENCH_COALESCE_MOVES	256		// moves of a contact remembered, more than a window merges
+
+typedef struct _BENCH_COALESCE_MOVE {
+
+	LONGLONG	Time;
+	USHORT		X;
+	USHORT		Y;
+
+} BENCH_COALESCE_MOVE, *PBENCH_COALESCE_MOVE;
+
+//
+// What the reports of a contact said, and what its events rebuilt of it.
+//
+typedef struct _BENCH_COALESCE_CONTACT {
+
+	BOOLEAN				Touching;
+	USHORT				X;
+	USHORT				Y;
+	ULONG				Moves;
+	ULONG				Delivered;		// moves delivered in events
+	USHORT				RebuiltX;		// touch down position plus the deltas delivered
+	USHORT				RebuiltY;
+	BENCH_COALESCE_MOVE	History[BENCH_COALESCE_MOVES];
+
+} BENCH_COALESCE_CONTACT, *PBENCH_COALESCE_CONTACT;
+
+typedef struct _BENCH_COALESCE {
+
+	LONGLONG				Window;
+	USHORT					Buttons[HCI_MAX_CONNECTIONS];
+	ULONG					MovesBefore[HCI_MAX_CONNECTIONS][COALESCE_MAX_CONTACTS];	// of the report being coalesced
+	BENCH_COALESCE_CONTACT	Contacts[HCI_MAX_CONNECTIONS][COALESCE_MAX_CONTACTS];
+	FILTER_EVENT			Edges[COALESCE_MAX_REPORT_EVENTS];							// the report must deliver
+	ULONG					EdgeCount;
+	ULONG					Reports;
+	ULONG					MoveEvents;
+	ULONG					Events;
+	ULONG					Wrong;
+
+} BENCH_COALESCE, *PBENCH_COALESCE;
+
+//
+// Works out what a report of the fixed layout changes of its connection,
+// the edges it must deliver, and counts its move.
+//
+VOID
+CoalesceExpect(
+	PBENCH_COALESCE	Bench,
+	ULONG			Stream,
+	const UCHAR *	Value,
+	ULONG			Length,
+	LONGLONG		Now
+)
+{
+	Bench->EdgeCount = 0;
+	memset(Bench->Edges, 0, sizeof(Bench->Edges));
+
+	for (ULONG e = 0; e < COALESCE_MAX_REPORT_EVENTS; e++)
+		Bench->Edges[e].Handle = (USHORT)(SYNTH_FIRST_HANDLE + Stream);
+
+	for (ULONG c = 0; c < COALESCE_MAX_CONTACTS; c++)
+		Bench->MovesBefore[Stream][c] = Bench->Contacts[Stream][c].Moves;
+
+	if (Length < 2)
+		return;
+
+	USHORT buttons = (USHORT)(Value[0] | (Value[1] << 8));
+
+	if (buttons != Bench->Buttons[Stream]) {
+		Bench->Buttons[Stream] = buttons;
+		Bench->Edges[Bench->EdgeCount].Type = FILTER_EVENT_BUTTONS;
+		Bench->Edges[Bench->EdgeCount].Buttons = buttons;
+		Bench->Edges[Bench->EdgeCount++].Contact = 0;
+	}
+
+	if (Length < 6 || (Value[2] & 0x0F) >= COALESCE_MAX_CONTACTS)
+		return;
+
+	ULONG					c = Value[2] & 0x0F;
+	BOOLEAN					touching = (Value[2] & 0xF0) != 0;
+	PBENCH_COALESCE_CONTACT	contact = &Bench->Contacts[Stream][c];
+	USHORT					x = (USHORT)(Value[3] | ((Value[4] & 0x0F) << 8));
+	USHORT					y = (USHORT)((Value[4] >> 4) | (Value[5] << 4));
+
+	if (touching && contact->Touching) {
+		PBENCH_COALESCE_MOVE move = &contact->History[contact->Moves++ % BENCH_COALESCE_MOVES];
+
+		move->Time = Now;
+		move->X = x;
+		move->Y = y;
+		contact->X = x;
+		contact->Y = y;
+	} else if (touching) {
+		contact->Touching = TRUE;
+		contact->X = x;
+		contact->Y = y;
+		Bench->Edges[Bench->EdgeCount].Type = FILTER_EVENT_TOUCH_DOWN;
+		Bench->Edges[Bench->EdgeCount].Buttons = buttons;
+		Bench->Edges[Bench->EdgeCount].X = x;
+		Bench->Edges[Bench->EdgeCount].Y = y;
+		Bench->Edges[Bench->EdgeCount++].Contact = (UCHAR)c;
+	} else if (contact->Touching) {
+		contact->Touching = FALSE;
+		Bench->Edges[Bench->EdgeCount].Type = FILTER_EVENT_TOUCH_UP;
+		Bench->Edges[Bench->EdgeCount].Buttons = buttons;
+		Bench->Edges[Bench->EdgeCount].X = contact->X;
+		Bench->Edges[Bench->EdgeCount].Y = contact->Y;
+		Bench->Edges[Bench->EdgeCount++].Contact = (UCHAR)c;
+	}
+}
+
+VOID
+CoalesceWrong(
+	PBENCH_COALESCE			Bench,
+	const FILTER_EVENT *	Event,
+	const char *			What
+)
+{
+	if (Bench->Wrong++ < 8)
+		printf("%u ms window, event %u of handle 0x%03x contact %u: %s\n",
+			(unsigned)(Bench->Window / 10000), (unsigned)Event->Type, (unsigned)Event->Handle,
+			(unsigned)Event->Contact, What);
+}
+
+//
+// Checks events against what the reports said. An edge must be the next
+// one expected and come after every move before its report, a move must
+// rebuild the position of the last report it merged from the deltas,
+// and merge no reports further apart than the window.
+//
+VOID
+CoalesceCheck(
+	PBENCH_COALESCE			Bench,
+	const FILTER_EVENT *	Events,
+	ULONG					Count
+)
+{
+	ULONG edge = 0;
+
+	for (ULONG i = 0; i < Count; i++) {
+		const FILTER_EVENT *	event = &Events[i];
+		ULONG					stream = event->Handle - SYNTH_FIRST_HANDLE;
+		PBENCH_COALESCE_CONTACT	contact;
+
+		Bench->Events++;
+
+		if (stream >= HCI_MAX_CONNECTIONS || event->Contact >= COALESCE_MAX_CONTACTS) {
+			CoalesceWrong(Bench, event, "not a connection or contact of the traffic");
+			continue;
+		}
+
+		contact = &Bench->Contacts[stream][event->Contact];
+
+		if (event->Type != FILTER_EVENT_TOUCH_MOVE) {
+			const FILTER_EVENT *expected = &Bench->Edges[edge];
+
+			if (edge >= Bench->EdgeCount || event->Type != expected->Type || event->Buttons != expected->Buttons ||
+				event->Contact != expected->Contact ||
+				(event->Type != FILTER_EVENT_BUTTONS && (event->X != expected->X || event->Y != expected->Y))) {
+				CoalesceWrong(Bench, event, "not the edge the report made");
+				continue;
+			}
+
+			edge++;
+
+			for (ULONG c = 0; c < COALESCE_MAX_CONTACTS; c++) {
+				if (Bench->Contacts[stream][c].Delivered != Bench->MovesBefore[stream][c])
+					CoalesceWrong(Bench, event, "before the moves of its connection");
+			}
+
+			if (event->Type == FILTER_EVENT_TOUCH_DOWN) {
+				contact->RebuiltX = event->X;
+				contact->RebuiltY = event->Y;
+			} else if (event->Type == FILTER_EVENT_TOUCH_UP &&
+				(contact->RebuiltX != event->X || contact->RebuiltY != event->Y)) {
+				CoalesceWrong(Bench, event, "touch up where the deltas didn't lead");
+			}
+
+			continue;
+		}
+
+		Bench->MoveEvents++;
+
+		if (event->Reports == 0 || contact->Delivered + event->Reports > contact->Moves ||
+			contact->Moves - contact->Delivered > BENCH_COALESCE_MOVES) {
+			CoalesceWrong(Bench, event, "merges moves that weren't reported");
+			continue;
+		}
+
+		const BENCH_COALESCE_MOVE *first = &contact->History[contact->Delivered % BENCH_COALESCE_MOVES];
+		const BENCH_COALESCE_MOVE *last = &contact->History[(contact->Delivered + event->Reports - 1) % BENCH_COALESCE_MOVES];
+
+		contact->Delivered += event->Reports;
+		contact->RebuiltX = (USHORT)(contact->RebuiltX + event->DeltaX);
+		contact->RebuiltY = (USHORT)(contact->RebuiltY + event->DeltaY);
+
+		if (event->X != last->X || event->Y != last->Y || event->Time != last->Time)
+			CoalesceWrong(Bench, event, "not the position of its last report");
+		if (contact->RebuiltX != event->X || contact->RebuiltY != event->Y)
+			CoalesceWrong(Bench, event, "deltas don't rebuild the position");
+		if (event->Reports > 1 && last->Time - first->Time >= Bench->Window)
+			CoalesceWrong(Bench, event, "merges moves further apart than the window");
+	}
+
+	if (edge != Bench->EdgeCount) {
+		FILTER_EVENT missing = Bench->Edges[edge];
+
+		CoalesceWrong(Bench, &missing, "edge not delivered");
+	}
+
+	Bench->EdgeCount = 0;
+}
+
+//
+// Coalesces Seconds of the trackpad and button reports of Config's
+// traffic with each window, flushing every millisecond like the filter's
+// timer does, and checks every edge, move and position against the
+// reports. Reports how many events the reports became and the time per
+// report. Returns FALSE if anything was off.
+//
+BOOLEAN
+Coalescing(
+	ULONG					Seconds,
+	const SYNTH_CONFIG *	Config
+)
+{
+	static COALESCE_STATE	state;
+	static BENCH_COALESCE	bench;
+	static SYNTH_PACKET		packet;
+	SYNTH_STATE				synth;
+	FILTER_EVENT			events[max(COALESCE_MAX_REPORT_EVENTS, COALESCE_MAX_FLUSH_EVENTS)];
+	ULONG					wrong = 0;
+
+	printf("%-8s %9s %9s %9s %11s %8s\n", "Window", "Reports", "Moves", "Events", "Move events", "ns");
+
+	for (ULONG w = 0; w < ARRAYSIZE(CoalesceWindows); w++) {
+		LONGLONG	flushed = 0;
+		LONGLONG	now = 0;
+		ULONG		moves = 0;
+		ULONGLONG	nanoseconds = 0;
+		ULONG		count;
+
+		memset(&bench, 0, sizeof(bench));
+		bench.Window = (LONGLONG)CoalesceWindows[w] * 10000;
+
+		CoalesceInit(&state);
+		CoalesceConfigure(&state, CoalesceWindows[w]);
+		SynthInit(&synth, Config);
+
+		for (;;) {
+			SynthNext(&synth, &packet);
+			now = packet.Time;
+
+			if (now >= (LONGLONG)Seconds * 10000000)
+				break;
+
+			if (packet.Type != SYNTH_PACKET_BUTTON && packet.Type != SYNTH_PACKET_TOUCH &&
+				packet.Type != SYNTH_PACKET_MOVE)
+				continue;
+
+			if (now - flushed >= 10000) {
+				CoalesceExpect(&bench, 0, NULL, 0, now);
+				count = CoalesceFlush(&state, now, events);
+				CoalesceCheck(&bench, events, count);
+				flushed = now;
+			}
+
+			ULONG			stream = HCI_ACL_HANDLE(packet.Data) - SYNTH_FIRST_HANDLE;
+			const UCHAR *	value = packet.Data + ATT_PDU_OFFSET + 3;
+			ULONG			length = packet.Length - ATT_PDU_OFFSET - 3;
+
+			CoalesceExpect(&bench, stream, value, length, now);
+
+			auto start = std::chrono::steady_clock::now();
+			count = CoalesceReport(&state, NULL, stream, (USHORT)(SYNTH_FIRST_HANDLE + stream), SIRI_ATT_HID_REPORT,
+				value, length, now, now, events);
+			nanoseconds += Elapsed(start);
+
+			CoalesceCheck(&bench, events, count);
+			bench.Reports++;
+		}
+
+		//
+		// Whatever is still held comes out once its window has passed.
+		//
+		CoalesceExpect(&bench, 0, NULL, 0, now);
+		count = CoalesceFlush(&state, now + bench.Window + 1, events);
+		CoalesceCheck(&bench, events, count);
+
+		for (ULONG s = 0; s < HCI_MAX_CONNECTIONS; s++) {
+			for (ULONG c = 0; c < COALESCE_MAX_CONTACTS; c++) {
+				PBENCH_COALESCE_CONTACT contact = &bench.Contacts[s][c];
+
+				moves += contact->Moves;
+
+				if (contact->Delivered != contact->Moves) {
+					printf("%u ms window, handle 0x%03x contact %u: %u of %u moves delivered\n",
+						(unsigned)CoalesceWindows[w], (unsigned)(SYNTH_FIRST_HANDLE + s), (unsigned)c,
+						(unsigned)contact->Delivered, (unsigned)contact->Moves);
+					bench.Wrong++;
+				}
+			}
+		}
+
+		//
+		// No window delivers every move, one wider than the moves are
+		// apart must merge some.
+		//
+		if ((CoalesceWindows[w] == 0 && bench.MoveEvents != moves) ||
+			(Config->MoveHz != 0 && CoalesceWindows[w] * Config->MoveHz > 1000 && moves > 1 && bench.MoveEvents >= moves)) {
+			printf("%u ms window: %u moves became %u events\n", (unsigned)CoalesceWindows[w], (unsigned)moves,
+				(unsigned)bench.MoveEvents);
+			bench.Wrong++;
+		}
+
+		printf("%-5u ms %9u %9u %9u %11u %8.1f\n",
+			(unsigned)CoalesceWindows[w],
+			(unsigned)bench.Reports,
+			(unsigned)moves,
+			(unsigned)bench.Events,
+			(unsigned)bench.MoveEvents,
+			bench.Reports != 0 ? (double)nanoseconds / bench.Reports : 0.0);
+
+		wrong += bench.Wrong;
+	}
+
+	printf("%u wrong\n", (unsigned)wrong);
+
+	return wrong == 0;
+}
+
+//
+// Voice frames per second each remote floods the event reader with in
+// -V, the reader reads every BENCH_FLOOD_READ_MS with room for
+// BENCH_FLOOD_READ_FRAMES voice frames, a lot fewer than the flood.
+//
+const ULONG	FloodVoiceHz[] = { 0, 50, 200, 1000 };
+
+#define BENCH_FLOOD_REMOTES		4
+#define BENCH_FLOOD_BUTTON_HZ	5
+#define BENCH_FLOOD_READ_MS		20
+#define BENCH_FLOOD_READ_FRAMES	16
+#define BENCH_FLOOD_PRESSES		64			// button changes of a remote waiting to be read, at most
+
+typedef struct _BENCH_FLOOD_REMOTE {
+
+	USHORT		Buttons;
+	ULONG		Queued;				// button changes sent
+	ULONG		Read;
+	LONGLONG	Times[BENCH_FLOOD_PRESSES];
+	USHORT		Changes[BENCH_FLOOD_PRESSES];
+
+} BENCH_FLOOD_REMOTE, *PBENCH_FLOOD_REMOTE;
+
+//
+// Reads what waits on Handle and checks each button event is the next
+// change its remote sent. Adds the latency of each to Histogram.
+//
+VOID
+FloodRead(
+	SHIM_HANDLE					Handle,
+	PFILTER_EVENT_BUFFER_HEADER	Header,
+	ULONG						Size,
+	PBENCH_FLOOD_REMOTE			Remotes,
+	LONGLONG					Now,
+	PLATENCY_HISTOGRAM			Histogram,
+	PULONG						Frames,
+	PULONG						Wrong
+)
+{
+	PFILTER_EVENT	events = (PFILTER_EVENT)(Header + 1);
+	ULONG			bytesReturned;
+
+	if (!NT_SUCCESS(ShimDeviceIoControl(Handle, IOCTL_GET_EVENTS, NULL, 0, Header, Size, &bytesReturned))) {
+		(*Wrong)++;
+		return;
+	}
+
+	if (Header->Lost != 0) {
+		printf("%u events lost\n", (unsigned)Header->Lost);
+		(*Wrong)++;
+	}
+
+	*Frames += Header->VoiceCount;
+
+	for (ULONG i = 0; i < Header->EventCount; i++) {
+		const FILTER_EVENT *	event = &events[i];
+		ULONG					remote = (ULONG)(event->Handle - SYNTH_FIRST_HANDLE);
+		PBENCH_FLOOD_REMOTE		flood = &Remotes[remote];
+
+		if (event->Type != FILTER_EVENT_BUTTONS)
+			continue;
+
+		if (remote >= BENCH_FLOOD_REMOTES || flood->Read == flood->Queued ||
+			flood->Changes[flood->Read % BENCH_FLOOD_PRESSES] != event->Buttons) {
+			if ((*Wrong)++ < 8)
+				printf("buttons 0x%04x of handle 0x%03x out of order\n", (unsigned)event->Buttons, (unsigned)event->Handle);
+			continue;
+		}
+
+		LatencyHistogramAdd(Histogram, (Now - flood->Times[flood->Read++ % BENCH_FLOOD_PRESSES]) * 100);
+	}
+}
+
+//
+// Floods the event reader with the voice of remotes that hold the voice
+// button for Seconds while they press buttons, at each rate, and checks
+// every button change is read in order, in the first read after it, and
+// that none is lost, while the voice ring overflows. Returns FALSE if
+// anything was off.
+//
+BOOLEAN
+VoiceFlood(
+	ULONG	Seconds,
+	ULONG	Seed
+)
+{
+	static SYNTH_STATE			synth;
+	static SYNTH_PACKET			packet;
+	static BENCH_FLOOD_REMOTE	remotes[BENCH_FLOOD_REMOTES];
+	static LATENCY_HISTOGRAM	histogram;
+	ULONG						size = sizeof(FILTER_EVENT_BUFFER_HEADER) + BENCH_FLOOD_READ_FRAMES * sizeof(FILTER_VOICE_FRAME);
+	PFILTER_EVENT_BUFFER_HEADER	header = (PFILTER_EVENT_BUFFER_HEADER)malloc(size);
+	ULONG						wrong = 0;
+
+	printf("%-9s %8s %8s %8s %8s %10s %10s %10s\n",
+		"Voice Hz", "Frames", "Read", "Lost", "Changes", "Mean ms", "Max ms", "ns");
+
+	for (ULONG r = 0; r < ARRAYSIZE(FloodVoiceHz); r++) {
+		SYNTH_CONFIG				config;
+		FILTER_EVENT_SUBSCRIPTION	subscription;
+		SHIM_HANDLE					handle;
+		ULONG						bytesReturned;
+		LONGLONG					end = (LONGLONG)Seconds * 10000000;
+		LONGLONG					nextRead = BENCH_FLOOD_READ_MS * 10000;
+		ULONG						frames = 0;
+		ULONG						framesRead = 0;
+		ULONG						voiceLost = 0;
+		ULONG						changes = 0;
+		ULONG						packets = 0;
+		ULONGLONG					nanoseconds = 0;
+
+		memset(&config, 0, sizeof(config));
+		config.Connections = BENCH_FLOOD_REMOTES;
+		config.ButtonHz = BENCH_FLOOD_BUTTON_HZ;
+		config.VoiceEveryMs = FloodVoiceHz[r] != 0 ? 1000 : 0;
+		config.VoiceBurstMs = 1000;
+		config.VoiceHz = FloodVoiceHz[r];
+		config.VoiceLength = SYNTH_DEFAULT_VOICE_LENGTH;
+		config.Seed = Seed;
+
+		memset(remotes, 0, sizeof(remotes));
+		memset(&histogram, 0, sizeof(histogram));
+		SynthInit(&synth, &config);
+
+		if (!StartFilter("USB\\VID_0A12&PID_0001") || !SetEventConfig(0)) {
+			free(header);
+			return FALSE;
+		}
+
+		subscription.Classes = FILTER_EVENT_CLASS_ALL;
+		subscription.Handle = FILTER_EVENT_ANY_HANDLE;
+		subscription.Attribute = FILTER_EVENT_ANY_HANDLE;
+
+		if (!NT_SUCCESS(ShimOpenControl(&handle)) ||
+			!NT_SUCCESS(ShimDeviceIoControl(handle, IOCTL_SUBSCRIBE_EVENTS, &subscription, sizeof(subscription),
+				NULL, 0, &bytesReturned))) {
+			printf("Couldn't subscribe to the events\n");
+			StopFilter();
+			free(header);
+			return FALSE;
+		}
+
+		for (;;) {
+			SynthNext(&synth, &packet);
+
+			if (packet.Time > end)
+				break;
+
+			while (nextRead <= packet.Time) {
+				ShimSetInterruptTime((ULONGLONG)nextRead);
+				header->VoiceLost = 0;
+				FloodRead(handle, header, size, remotes, nextRead, &histogram, &framesRead, &wrong);
+				voiceLost += header->VoiceLost;
+				nextRead += BENCH_FLOOD_READ_MS * 10000;
+			}
+
+			ShimSetInterruptTime((ULONGLONG)packet.Time + 1);
+
+			if (packet.Type == SYNTH_PACKET_BUTTON) {
+				PBENCH_FLOOD_REMOTE	flood = &remotes[HCI_ACL_HANDLE(packet.Data) - SYNTH_FIRST_HANDLE];
+				const UCHAR *		value = packet.Data + ATT_PDU_OFFSET + 3;
+				USHORT				buttons = (USHORT)(value[0] | (value[1] << 8));
+
+				if (buttons != flood->Buttons) {
+					flood->Buttons = buttons;
+					flood->Times[flood->Queued % BENCH_FLOOD_PRESSES] = packet.Time;
+					flood->Changes[flood->Queued++ % BENCH_FLOOD_PRESSES] = buttons;
+					changes++;
+				}
+			} else if (packet.Type == SYNTH_PACKET_VOICE) {
+				frames++;
+			}
+
+			nanoseconds += ReplayPacket(&Threads[0], packet.Kind, packet.Direction, packet.Data, packet.Length,
+				packet.Length);
+			packets++;
+		}
+
+		ShimSetInterruptTime((ULONGLONG)nextRead);
+		header->VoiceLost = 0;
+		FloodRead(handle, header, size, remotes, nextRead, &histogram, &framesRead, &wrong);
+		voiceLost += header->VoiceLost;
+
+		ShimCloseControl(handle);
+		StopFilter();
+
+		for (ULONG i = 0; i < BENCH_FLOOD_REMOTES; i++) {
+			if (remotes[i].Read != remotes[i].Queued) {
+				printf("%u Hz of voice: %u of %u button changes of handle 0x%03x read\n", (unsigned)FloodVoiceHz[r],
+					(unsigned)remotes[i].Read, (unsigned)remotes[i].Queued, (unsigned)(SYNTH_FIRST_HANDLE + i));
+				wrong++;
+			}
+		}
+
+		//
+		// A change is in the first read after it.
+		//
+		if (histogram.Max > BENCH_FLOOD_READ_MS * 1000000ULL) {
+			printf("%u Hz of voice: a button change took %.1f ms to be read\n", (unsigned)FloodVoiceHz[r],
+				histogram.Max / 1e6);
+			wrong++;
+		}
+
+		printf("%-9u %8u %8u %8u %8u %10.2f %10.2f %10.1f\n",
+			(unsigned)FloodVoiceHz[r],
+			(unsigned)frames,
+			(unsigned)framesRead,
+			(unsigned)voiceLost,
+			(unsigned)changes,
+			histogram.Count != 0 ? (double)histogram.Sum / histogram.Count / 1e6 : 0.0,
+			histogram.Max / 1e6,
+			packets != 0 ? (double)nanoseconds / packets : 0.0);
+	}
+
+	free(header);
+
+	printf("%u wrong\n", (unsigned)wrong);
+
+	return wrong == 0;
+}
+
+//
+// Subscribers of -F, each reading every so many events queued with room
+// for so many, the first ones fast enough that nothing may be lost. The
+// last reads slower than the ring is long, so the ring fills up with what
+// it hasn't read.
+//
+typedef struct _BENCH_FANOUT_READER {
+
+	ULONG	Every;
+	ULONG	Room;
+	ULONG	Classes;
+	USHORT	Handle;
+
+} BENCH_FANOUT_READER, *PBENCH_FANOUT_READER;
+
+const BENCH_FANOUT_READER FanoutReaders[FILTER_EVENT_MAX_SUBSCRIBERS] = {
+	{ 1,	64,		FILTER_EVENT_CLASS_ALL,		FILTER_EVENT_ANY_HANDLE },
+	{ 4,	16,		FILTER_EVENT_CLASS_INPUT,	FILTER_EVENT_ANY_HANDLE },
+	{ 16,	64,		FILTER_EVENT_CLASS_INPUT,	SYNTH_FIRST_HANDLE },
+	{ 64,	256,	FILTER_EVENT_CLASS_INPUT,	SYNTH_FIRST_HANDLE + 1 },
+	{ 8,	16,		FILTER_EVENT_CLASS_VOICE,	FILTER_EVENT_ANY_HANDLE },
+	{ 200,	256,	FILTER_EVENT_CLASS_INPUT,	FILTER_EVENT_ANY_HANDLE },
+	{ 300,	32,		FILTER_EVENT_CLASS_INPUT,	SYNTH_FIRST_HANDLE + 2 },
+	{ 1000,	256,	FILTER_EVENT_CLASS_INPUT,	FILTER_EVENT_ANY_HANDLE },
+};
+
+#define BENCH_FANOUT_FAST		5		// readers that must not lose anything on their own
+#define BENCH_FANOUT_REMOTES	4
+#define BENCH_FANOUT_CONTACTS	2
+
+typedef struct _BENCH_FANOUT_CONTACT {
+
+	BOOLEAN		Synced;				// touch down read, no event of it lost since
+	USHORT		X;					// position rebuilt from the deltas
+	USHORT		Y;
+
+} BENCH_FANOUT_CONTACT, *PBENCH_FANOUT_CONTACT;
+
+typedef struct _BENCH_FANOUT_SUBSCRIBER {
+
+	ULONG					Subscriber;
+	ULONG					Next;		// first event queued it hasn't accounted for
+	ULONG					Refused;	// events it wanted turned away since its last read
+	ULONG					Lost;
+	ULONG					Events;
+	BENCH_FANOUT_CONTACT	Contacts[BENCH_FANOUT_REMOTES][BENCH_FANOUT_CONTACTS];
+
+} BENCH_FANOUT_SUBSCRIBER, *PBENCH_FANOUT_SUBSCRIBER;
+
+//
+// An event of -F, whether the queue took it.
+//
+typedef struct _BENCH_FANOUT_EVENT {
+
+	FILTER_EVENT	Event;
+	BOOLEAN			Queued;
+
+} BENCH_FANOUT_EVENT, *PBENCH_FANOUT_EVENT;
+
+BOOLEAN
+FanoutWants(
+	const BENCH_FANOUT_READER *	Reader,
+	const FILTER_EVENT *		Event
+)
+{
+	return (Reader->Classes & FILTER_EVENT_CLASS_INPUT) != 0 &&
+		(Reader->Handle == FILTER_EVENT_ANY_HANDLE || Reader->Handle == Event->Handle);
+}
+
+//
+// Makes the next event of a few remotes, with button changes, touches
+// and mostly moves. Its Time is its index in Log.
+//
+VOID
+FanoutNext(
+	PBENCH_FANOUT_EVENT	Log,
+	ULONG				Index,
+	USHORT *			Buttons,
+	PBOOLEAN			Touching,
+	PUSHORT				Positions,
+	PULONG				Random
+)
+{
+	PFILTER_EVENT	event = &Log[Index].Event;
+	ULONG			remote = TraceRandom(Random) % BENCH_FANOUT_REMOTES;
+	ULONG			contact = TraceRandom(Random) % BENCH_FANOUT_CONTACTS;
+	ULONG			kind = TraceRandom(Random) % 10;
+	ULONG			c = remote * BENCH_FANOUT_CONTACTS + contact;
+
+	memset(event, 0, sizeof(*event));
+	event->Time = Index;
+	event->Stamp = Index;
+	event->Handle = (USHORT)(SYNTH_FIRST_HANDLE + remote);
+	event->Attribute = SIRI_ATT_HID_REPORT;
+	event->Reports = 1;
+
+	if (kind == 0) {
+		Buttons[remote] ^= (USHORT)(1 << (TraceRandom(Random) % 16));
+		event->Type = FILTER_EVENT_BUTTONS;
+	} else {
+		event->Contact = (UCHAR)contact;
+
+		if (kind == 1 || !Touching[c]) {
+			Touching[c] = !Touching[c];
+			event->Type = Touching[c] ? FILTER_EVENT_TOUCH_DOWN : FILTER_EVENT_TOUCH_UP;
+
+			if (Touching[c]) {
+				Positions[2 * c] = (USHORT)(TraceRandom(Random) % 4096);
+				Positions[2 * c + 1] = (USHORT)(TraceRandom(Random) % 4096);
+			}
+		} else {
+			event->Type = FILTER_EVENT_TOUCH_MOVE;
+			event->DeltaX = (SHORT)(TraceRandom(Random) % 33) - 16;
+			event->DeltaY = (SHORT)(TraceRandom(Random) % 33) - 16;
+			Positions[2 * c] = (USHORT)(Positions[2 * c] + event->DeltaX);
+			Positions[2 * c + 1] = (USHORT)(Positions[2 * c + 1] + event->DeltaY);
+		}
+
+		event->X = Positions[2 * c];
+		event->Y = Positions[2 * c + 1];
+	}
+
+	event->Buttons = Buttons[remote];
+}
+
+VOID
+FanoutWrong(
+	ULONG		Reader,
+	ULONG		Index,
+	const char *What,
+	PULONG		Wrong
+)
+{
+	if ((*Wrong)++ < 8)
+		printf("reader %u, event %u: %s\n", (unsigned)Reader, (unsigned)Index, What);
+}
+
+//
+// Reads what waits for a subscriber and checks it against the log: the
+// lost count must be the events it wanted that the queue turned away,
+// every edge it wanted that was queued must come in order, a queued move
+// may only be missing when it was folded into a later event, and the
+// deltas must rebuild every position of a contact nothing was lost of.
+// Returns the events read.
+//
+ULONG
+FanoutRead(
+	PEVENT_QUEUE				Queue,
+	ULONG						Reader,
+	PBENCH_FANOUT_SUBSCRIBER	Sub,
+	const BENCH_FANOUT_EVENT *	Log,
+	ULONG						Logged,
+	PFILTER_EVENT_BUFFER_HEADER	Header,
+	PULONGLONG					Nanoseconds,
+	PULONG						Wrong
+)
+{
+	const BENCH_FANOUT_READER *	reader = &FanoutReaders[Reader];
+	PFILTER_EVENT				events = (PFILTER_EVENT)(Header + 1);
+
+	auto start = std::chrono::steady_clock::now();
+	EventQueueTake(Queue, Sub->Subscriber, Header,
+		sizeof(FILTER_EVENT_BUFFER_HEADER) + reader->Room * sizeof(FILTER_EVENT));
+	*Nanoseconds += Elapsed(start);
+
+	if (Header->Lost != Sub->Refused)
+		FanoutWrong(Reader, Sub->Next, "lost count isn't the events turned away", Wrong);
+
+	Sub->Lost += Header->Lost;
+	Sub->Refused = 0;
+	Sub->Events += Header->EventCount;
+
+	for (ULONG i = 0; i < Header->EventCount; i++) {
+		const FILTER_EVENT *	event = &events[i];
+		ULONG					index = (ULONG)event->Time;
+
+		if (index >= Logged || index < Sub->Next || !Log[index].Queued || !FanoutWants(reader, &Log[index].Event)) {
+			FanoutWrong(Reader, index, "not an event it wanted next", Wrong);
+			continue;
+		}
+
+		for (; Sub->Next < index; Sub->Next++) {
+			const FILTER_EVENT *skipped = &Log[Sub->Next].Event;
+
+			if (!FanoutWants(reader, skipped))
+				continue;
+
+			if (!Log[Sub->Next].Queued) {
+				if (skipped->Type != FILTER_EVENT_BUTTONS)
+					Sub->Contacts[skipped->Handle - SYNTH_FIRST_HANDLE][skipped->Contact].Synced = FALSE;
+			} else if (skipped->Type != FILTER_EVENT_TOUCH_MOVE) {
+				FanoutWrong(Reader, Sub->Next, "edge not read", Wrong);
+			}
+		}
+
+		Sub->Next++;
+
+		const FILTER_EVENT *	logged = &Log[index].Event;
+		ULONG					remote = event->Handle - SYNTH_FIRST_HANDLE;
+
+		if (event->Type != logged->Type || event->Handle != logged->Handle || event->Contact != logged->Contact ||
+			event->Buttons != logged->Buttons || (event->Type != FILTER_EVENT_BUTTONS &&
+			(event->X != logged->X || event->Y != logged->Y))) {
+			FanoutWrong(Reader, index, "not the event queued", Wrong);
+			continue;
+		}
+
+		if (event->Type == FILTER_EVENT_BUTTONS)
+			continue;
+
+		PBENCH_FANOUT_CONTACT contact = &Sub->Contacts[remote][event->Contact];
+
+		if (event->Type == FILTER_EVENT_TOUCH_DOWN) {
+			contact->Synced = TRUE;
+			contact->X = event->X;
+			contact->Y = event->Y;
+			continue;
+		}
+
+		//
+		// A move folded into the touch up leaves its deltas behind, the up
+		// carries the position itself.
+		//
+		if (event->Type == FILTER_EVENT_TOUCH_UP) {
+			contact->Synced = FALSE;
+			continue;
+		}
+
+		contact->X = (USHORT)(contact->X + event->DeltaX);
+		contact->Y = (USHORT)(contact->Y + event->DeltaY);
+
+		if (contact->Synced && (contact->X != event->X || contact->Y != event->Y))
+			FanoutWrong(Reader, index, "deltas don't rebuild the position", Wrong);
+	}
+
+	return Header->EventCount;
+}
+
+//
+// Queues Count events of a few remotes for 1, 2, 4 and 8 subscribers that
+// read at their own pace with their own subscriptions, and checks what
+// each reads against what was queued. The fast readers must lose nothing
+// while they read alone, and no reader may miss an edge that was queued.
+// Reports what was turned away, what queuing and taking cost per event,
+// and returns FALSE if anything was off.
+//
+BOOLEAN
+Fanout(
+	ULONG	Count,
+	ULONG	Seed
+)
+{
+	static EVENT_QUEUE				queue;
+	static BENCH_FANOUT_SUBSCRIBER	subs[FILTER_EVENT_MAX_SUBSCRIBERS];
+	PBENCH_FANOUT_EVENT				log = (PBENCH_FANOUT_EVENT)malloc((size_t)Count * sizeof(BENCH_FANOUT_EVENT));
+	PFILTER_EVENT_BUFFER_HEADER		header = (PFILTER_EVENT_BUFFER_HEADER)malloc(
+										sizeof(FILTER_EVENT_BUFFER_HEADER) + FILTER_EVENT_QUEUE_LENGTH * sizeof(FILTER_EVENT));
+	ULONG							wrong = 0;
+
+	printf("%-11s %9s %9s %9s %9s %9s %9s\n", "Subscribers", "Events", "Refused", "Read", "Lost", "Put ns", "Take ns");
+
+	for (ULONG n = 1; n <= FILTER_EVENT_MAX_SUBSCRIBERS; n *= 2) {
+		USHORT						buttons[BENCH_FANOUT_REMOTES] = { 0 };
+		BOOLEAN						touching[BENCH_FANOUT_REMOTES * BENCH_FANOUT_CONTACTS] = { 0 };
+		USHORT						positions[2 * BENCH_FANOUT_REMOTES * BENCH_FANOUT_CONTACTS] = { 0 };
+		FILTER_EVENT_SUBSCRIPTION	subscription;
+		ULONG						random = Seed != 0 ? Seed : 1;
+		ULONG						refused = 0;
+		ULONG						read = 0;
+		ULONG						lost = 0;
+		ULONGLONG					putNs = 0;
+		ULONGLONG					takeNs = 0;
+
+		EventQueueInit(&queue);
+		memset(subs, 0, sizeof(subs));
+
+		for (ULONG r = 0; r < n; r++) {
+			subscription.Classes = FanoutReaders[r].Classes;
+			subscription.Handle = FanoutReaders[r].Handle;
+			subscription.Attribute = FILTER_EVENT_ANY_HANDLE;
+			subs[r].Subscriber = EventQueueSubscribe(&queue, EVENT_QUEUE_NO_SUBSCRIBER, &subscription);
+		}
+
+		for (ULONG i = 0; i < Count; i++) {
+			ULONG head = queue.EventHead;
+
+			FanoutNext(log, i, buttons, touching, positions, &random);
+
+			auto start = std::chrono::steady_clock::now();
+			EventQueuePut(&queue, &log[i].Event);
+			putNs += Elapsed(start);
+
+			log[i].Queued = queue.EventHead != head;
+
+			if (!log[i].Queued) {
+				refused++;
+
+				for (ULONG r = 0; r < n; r++) {
+					if (FanoutWants(&FanoutReaders[r], &log[i].Event))
+						subs[r].Refused++;
+				}
+			}
+
+			for (ULONG r = 0; r < n; r++) {
+				if ((i + 1) % FanoutReaders[r].Every == 0)
+					read += FanoutRead(&queue, r, &subs[r], log, i + 1, header, &takeNs, &wrong);
+			}
+		}
+
+		//
+		// Drain what is left, then every edge queued must have been read.
+		//
+		for (ULONG r = 0; r < n; r++) {
+			while (FanoutRead(&queue, r, &subs[r], log, Count, header, &takeNs, &wrong) != 0 || header->Lost != 0)
+				;
+
+			for (; subs[r].Next < Count; subs[r].Next++) {
+				if (log[subs[r].Next].Queued && FanoutWants(&FanoutReaders[r], &log[subs[r].Next].Event) &&
+					log[subs[r].Next].Event.Type != FILTER_EVENT_TOUCH_MOVE)
+					FanoutWrong(r, subs[r].Next, "edge not read", &wrong);
+			}
+
+			lost += subs[r].Lost;
+		}
+
+		if (n <= BENCH_FANOUT_FAST && refused != 0) {
+			printf("%u subscribers reading fast: %u events turned away\n", (unsigned)n, (unsigned)refused);
+			wrong++;
+		}
+
+		printf("%-11u %9u %9u %9u %9u %9.1f %9.1f\n",
+			(unsigned)n,
+			(unsigned)Count,
+			(unsigned)refused,
+			(unsigned)read,
+			(unsigned)lost,
+			Count != 0 ? (double)putNs / Count : 0.0,
+			read != 0 ? (double)takeNs / read : 0.0);
+	}
+
+	free(log);
+	free(header);
+
+	printf("%u wrong\n", (unsigned)wrong);
+
+	return wrong == 0;
+}
+
+//
+// The adapter, remotes and host stack of -A. The controller takes as many
+// ACL packets as it has buffers, sends those of a connection on in order,
+// a few a ms, and hands the buffers back with a Number Of Completed
+// Packets event each tick. Each remote answers an ATT request a few ms
+// after it got it. The host keeps to its own count of the buffers, with
+// one ATT request at a time on a connection and as many write commands
+// as it has buffers for, and numbers its writes so the remote sees they
+// come in order.
+//
+#define BENCH_ACTIVATE_REMOTES		FILTER_ACTIVATE_MAX_PEERS
+#define BENCH_ACTIVATE_TICK			2500		// 250 us of interrupt time
+#define BENCH_ACTIVATE_TICKS_PER_MS	4
+#define BENCH_ACTIVATE_HOST_MS		200			// of host traffic, then everything drains
+#define BENCH_ACTIVATE_DRAIN_MS		200
+#define BENCH_ACTIVATE_WRITES		32			// host writes not yet at the adapter, at most
+#define BENCH_ACTIVATE_QUEUED		64			// packets of a connection in the controller, at most
+#define BENCH_ACTIVATE_LENGTH		32
+#define BENCH_ACTIVATE_FAIL			64			// one in that many host writes fails at the adapter
+
+#define BENCH_ACTIVATE_ATT_READ		0x0030		// what the host reads and writes
+#define BENCH_ACTIVATE_ATT_WRITE	0x0032
+#define BENCH_ACTIVATE_ATT_COMMAND	0x0034
+
+typedef struct _BENCH_ACTIVATE_BUFFERS {
+
+	const char *	Name;
+	USHORT			AclTotal;
+	UCHAR			LeTotal;		// 0 shares the ACL buffers
+
+} BENCH_ACTIVATE_BUFFERS, *PBENCH_ACTIVATE_BUFFERS;
+
+const BENCH_ACTIVATE_BUFFERS	ActivateBuffers[] = {
+	{ "LE 1", 8, 1 },
+	{ "LE 2", 8, 2 },
+	{ "LE 4", 10, 4 },
+	{ "Shared 3", 3, 0 },
+};
+
+//
+// A write of the host, it stays its own until the adapter has it.
+//
+typedef struct _BENCH_ACTIVATE_WRITE {
+
+	URB			Urb;
+	UCHAR		Buffer[BENCH_ACTIVATE_LENGTH];
+	BOOLEAN		Busy;
+	BOOLEAN		Held;			// by the filter, it didn't reach the adapter right away
+	LONGLONG	Submitted;		// tick
+
+} BENCH_ACTIVATE_WRITE, *PBENCH_ACTIVATE_WRITE;
+
+typedef struct _BENCH_ACTIVATE_PACKET {
+
+	UCHAR		Length;
+	BOOLEAN		Own;			// the filter's
+	UCHAR		Data[BENCH_ACTIVATE_LENGTH];
+
+} BENCH_ACTIVATE_PACKET, *PBENCH_ACTIVATE_PACKET;
+
+typedef struct _BENCH_ACTIVATE_REMOTE {
+
+	USHORT					Handle;
+	LONGLONG				EncryptAt;		// tick
+	BOOLEAN					Encrypted;
+
+	//
+	// In the controller, Tail - Head packets, and the buffers freed since
+	// the last completion event.
+	//
+	BENCH_ACTIVATE_PACKET	Queued[BENCH_ACTIVATE_QUEUED];
+	ULONG					Head;
+	ULONG					Tail;
+	ULONG					Completed;
+
+	//
+	// At the remote.
+	//
+	BOOLEAN					Answering;		// an ATT request is outstanding
+	BOOLEAN					AnswerOwn;		// and the filter sent it
+	LONGLONG				AnswerAt;		// tick
+	UCHAR					Answer[BENCH_ACTIVATE_LENGTH];
+	UCHAR					AnswerLength;
+	USHORT					Received;		// number the next host write has at least
+
+	//
+	// At the host.
+	//
+	ULONG					HostOut;		// packets it counts in the controller
+	UCHAR					HostRequest;	// ATT request outstanding, 0 for none
+	USHORT					HostSent;		// numbers its packets
+
+} BENCH_ACTIVATE_REMOTE, *PBENCH_ACTIVATE_REMOTE;
+
+typedef struct _BENCH_ACTIVATE {
+
+	ULONG					Random;
+	LONGLONG				Tick;
+	ULONG					Total;			// buffers the remotes draw on
+	ULONG					InUse;
+	BENCH_ACTIVATE_REMOTE	Remotes[BENCH_ACTIVATE_REMOTES];
+	BENCH_ACTIVATE_WRITE	Writes[BENCH_ACTIVATE_WRITES];
+	ULONG					HostPackets;
+	ULONG					Failed;
+	ULONG					OwnPackets;
+	ULONG					Held;
+	ULONG					Hidden;
+	ULONG					Overflows;
+	ULONG					Wrong;
+	LATENCY_HISTOGRAM		HoldLatency;
+
+} BENCH_ACTIVATE, *PBENCH_ACTIVATE;
+
+BENCH_ACTIVATE	Activation;
+
+ULONG
+ActivateRandom()
+{
+	ULONG x = Activation.Random;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	Activation.Random = x;
+
+	return x;
+}
+
+VOID
+ActivateWrong(
+	const char *	What,
+	USHORT			Handle
+)
+{
+	if (Activation.Wrong++ < 8)
+		printf("handle 0x%03x at %.2f ms: %s\n", (unsigned)Handle,
+			(double)Activation.Tick / BENCH_ACTIVATE_TICKS_PER_MS, What);
+}
+
+PBENCH_ACTIVATE_REMOTE
+ActivateRemote(
+	USHORT	Handle
+)
+{
+	for (ULONG r = 0; r < BENCH_ACTIVATE_REMOTES; r++) {
+		if (Activation.Remotes[r].Handle == Handle)
+			return &Activation.Remotes[r];
+	}
+
+	return NULL;
+}
+
+//
+// An ATT packet from or to Remote, Att holds its AttLength bytes.
+//
+ULONG
+ActivatePacket(
+	PUCHAR					Packet,
+	PBENCH_ACTIVATE_REMOTE	Remote,
+	UCHAR					Flags,
+	const UCHAR *			Att,
+	ULONG					AttLength
+)
+{
+	Packet[0] = (UCHAR)Remote->Handle;
+	Packet[1] = (UCHAR)((Remote->Handle >> 8) | (Flags << 4));
+	Packet[2] = (UCHAR)(L2CAP_HEADER_LENGTH + AttLength);
+	Packet[3] = 0;
+	Packet[4] = (UCHAR)AttLength;
+	Packet[5] = 0;
+	Packet[6] = (UCHAR)L2CAP_CID_ATT;
+	Packet[7] = 0;
+	memcpy(&Packet[ATT_PDU_OFFSET], Att, AttLength);
+
+	return ATT_PDU_OFFSET + AttLength;
+}
+
+//
+// The adapter takes a packet into a buffer of the controller. One in
+// BENCH_ACTIVATE_FAIL host writes fails instead, the host doesn't count it
+// and asks again later.
+//
+BOOLEAN
+ActivateWritten(
+	PURB			Urb,
+	const UCHAR *	Data,
+	ULONG			Length
+)
+{
+	PBENCH_ACTIVATE_REMOTE	remote = ActivateRemote(HCI_ACL_HANDLE(Data));
+	PBENCH_ACTIVATE_WRITE	write = NULL;
+	PBENCH_ACTIVATE_PACKET	packet;
+
+	for (ULONG w = 0; w < BENCH_ACTIVATE_WRITES; w++) {
+		if (Urb == &Activation.Writes[w].Urb)
+			write = &Activation.Writes[w];
+	}
+
+	if (remote == NULL || Length > BENCH_ACTIVATE_LENGTH || remote->Tail - remote->Head == BENCH_ACTIVATE_QUEUED) {
+		ActivateWrong("packet the controller can't take", HCI_ACL_HANDLE(Data));
+		return TRUE;
+	}
+
+	if (write != NULL) {
+		write->Busy = FALSE;
+
+		if (ActivateRandom() % BENCH_ACTIVATE_FAIL == 0) {
+			remote->HostOut--;
+			if (Data[ATT_PDU_OFFSET] != ATT_OP_WRITE_CMD)
+				remote->HostRequest = 0;
+			Activation.Failed++;
+			return FALSE;
+		}
+
+		if (write->Held)
+			LatencyHistogramAdd(&Activation.HoldLatency, (Activation.Tick - write->Submitted) * BENCH_ACTIVATE_TICK * 100);
+	} else {
+		Activation.OwnPackets++;
+	}
+
+	if (++Activation.InUse > Activation.Total && Activation.Overflows++ == 0)
+		ActivateWrong("the controller's buffers overflow", remote->Handle);
+
+	packet = &remote->Queued[remote->Tail++ % BENCH_ACTIVATE_QUEUED];
+	packet->Length = (UCHAR)Length;
+	packet->Own = write == NULL;
+	memcpy(packet->Data, Data, Length);
+
+	return TRUE;
+}
+
+//
+// The remote gets a packet the controller sent. It answers a request
+// unless one is outstanding already, that one is answered first.
+//
+VOID
+ActivateReceive(
+	PBENCH_ACTIVATE_REMOTE	Remote,
+	const BENCH_ACTIVATE_PACKET *	Packet
+)
+{
+	UCHAR	op = Packet->Data[ATT_PDU_OFFSET];
+	USHORT	attribute = ATT_HANDLE(Packet->Data);
+	UCHAR	answer[3];
+
+	if (!Packet->Own) {
+		if (op == ATT_OP_WRITE_REQ || op == ATT_OP_WRITE_CMD) {
+			USHORT sequence = (USHORT)(Packet->Data[ATT_PDU_OFFSET + 3] | (Packet->Data[ATT_PDU_OFFSET + 4] << 8));
+
+			if (sequence < Remote->Received)
+				ActivateWrong("host packets out of order", Remote->Handle);
+
+			Remote->Received = (USHORT)(sequence + 1);
+		}
+	} else if (op != ATT_OP_WRITE_REQ || (attribute != SIRI_ATT_HID_REPORT_CCCD && attribute != SIRI_ATT_HID_CONTROL)) {
+		ActivateWrong("the filter sent something else than an activation", Remote->Handle);
+	}
+
+	if (op != ATT_OP_READ_REQ && op != ATT_OP_WRITE_REQ)
+		return;
+
+	if (Remote->Answering) {
+		ActivateWrong("a second ATT request before the first was answered", Remote->Handle);
+		return;
+	}
+
+	answer[0] = op == ATT_OP_READ_REQ ? ATT_OP_READ_RSP : ATT_OP_WRITE_RSP;
+	answer[1] = (UCHAR)Remote->Handle;
+	answer[2] = 0;
+
+	Remote->Answering = TRUE;
+	Remote->AnswerOwn = Packet->Own;
+	Remote->AnswerAt = Activation.Tick + BENCH_ACTIVATE_TICKS_PER_MS + ActivateRandom() % (4 * BENCH_ACTIVATE_TICKS_PER_MS);
+	Remote->AnswerLength = (UCHAR)ActivatePacket(Remote->Answer, Remote, HCI_ACL_PB_FIRST_FLUSHABLE,
+		answer, op == ATT_OP_READ_REQ ? 3 : 1);
+}
+
+//
+// The controller sends a packet of each connection on, mostly, and hands
+// back the buffers in one event. Returns FALSE if it has nothing left.
+//
+BOOLEAN
+ActivateTransmit()
+{
+	PBENCH_READER	reader = &Threads[0].Readers[BENCH_PIPE_EVENTS];
+	UCHAR			event[HCI_EVENT_HEADER_LENGTH + 1 + 4 * BENCH_ACTIVATE_REMOTES];
+	ULONG			count = 0;
+	BOOLEAN			busy = FALSE;
+
+	for (ULONG r = 0; r < BENCH_ACTIVATE_REMOTES; r++) {
+		PBENCH_ACTIVATE_REMOTE remote = &Activation.Remotes[r];
+
+		if (remote->Head != remote->Tail && ActivateRandom() % 4 != 0) {
+			Activation.InUse--;
+			remote->Completed++;
+			ActivateReceive(remote, &remote->Queued[remote->Head++ % BENCH_ACTIVATE_QUEUED]);
+		}
+
+		busy |= remote->Head != remote->Tail;
+	}
+
+	for (ULONG r = 0; r < BENCH_ACTIVATE_REMOTES; r++) {
+		PBENCH_ACTIVATE_REMOTE	remote = &Activation.Remotes[r];
+		PUCHAR					entry = &event[HCI_EVENT_HEADER_LENGTH + 1 + 4 * count];
+
+		if (remote->Completed == 0)
+			continue;
+
+		entry[0] = (UCHAR)remote->Handle;
+		entry[1] = (UCHAR)(remote->Handle >> 8);
+		entry[2] = (UCHAR)remote->Completed;
+		entry[3] = (UCHAR)(remote->Completed >> 8);
+		remote->Completed = 0;
+		count++;
+	}
+
+	if (count == 0)
+		return busy;
+
+	event[0] = HCI_EV_NUMBER_OF_COMPLETED_PACKETS;
+	event[1] = (UCHAR)(1 + 4 * count);
+	event[2] = (UCHAR)count;
+
+	ReplayPacket(&Threads[0], TRACE_KIND_HCI_EVENT, HCI_DIRECTION_IN, event, HCI_EVENT_HEADER_LENGTH + 1 + 4 * count,
+		HCI_EVENT_HEADER_LENGTH + 1 + 4 * count);
+
+	//
+	// What reached the host may only give back buffers it used.
+	//
+	if (!reader->Submitted) {
+		ULONG length = reader->Urb.UrbBulkOrInterruptTransfer.TransferBufferLength;
+
+		for (ULONG i = 0; i < reader->Buffer[2] && HCI_EVENT_HEADER_LENGTH + 1 + 4 * (i + 1) <= length; i++) {
+			const UCHAR *			entry = &reader->Buffer[HCI_EVENT_HEADER_LENGTH + 1 + 4 * i];
+			PBENCH_ACTIVATE_REMOTE	remote = ActivateRemote((USHORT)((entry[0] | (entry[1] << 8)) & 0x0FFF));
+			ULONG					completed = entry[2] | (entry[3] << 8);
+
+			if (remote == NULL || completed == 0 || completed > remote->HostOut) {
+				ActivateWrong("the host got back buffers it didn't use", remote != NULL ? remote->Handle : 0);
+				continue;
+			}
+
+			remote->HostOut -= completed;
+		}
+	}
+
+	return TRUE;
+}
+
+//
+// The remotes answer what is due. The host must get the answers to its
+// own requests and nothing else.
+//
+VOID
+ActivateAnswer()
+{
+	PBENCH_READER reader = &Threads[0].Readers[BENCH_PIPE_ACL_IN];
+
+	for (ULONG r = 0; r < BENCH_ACTIVATE_REMOTES; r++) {
+		PBENCH_ACTIVATE_REMOTE	remote = &Activation.Remotes[r];
+		UCHAR					op;
+
+		if (!remote->Answering || remote->AnswerAt > Activation.Tick)
+			continue;
+
+		remote->Answering = FALSE;
+		op = remote->Answer[ATT_PDU_OFFSET];
+
+		ReplayPacket(&Threads[0], TRACE_KIND_ACL, HCI_DIRECTION_IN, remote->Answer, remote->AnswerLength, remote->AnswerLength);
+
+		if (reader->Submitted) {
+			if (!remote->AnswerOwn)
+				ActivateWrong("the answer to a host request was hidden", remote->Handle);
+			else
+				Activation.Hidden++;
+		} else if (remote->AnswerOwn) {
+			ActivateWrong("the answer to an activation reached the host", remote->Handle);
+		} else if (remote->HostRequest == 0 ||
+			op != (remote->HostRequest == ATT_OP_READ_REQ ? ATT_OP_READ_RSP : ATT_OP_WRITE_RSP)) {
+			ActivateWrong("the host got an answer it didn't ask for", remote->Handle);
+		} else {
+			remote->HostRequest = 0;
+		}
+	}
+}
+
+//
+// The host sends an ATT PDU to Remote if it has a buffer for it by its own
+// count.
+//
+VOID
+ActivateHostSend(
+	PBENCH_ACTIVATE_REMOTE	Remote,
+	UCHAR					Op,
+	USHORT					Attribute
+)
+{
+	PBENCH_ACTIVATE_WRITE	write = NULL;
+	UCHAR					att[5];
+	ULONG					out = 0;
+	ULONG					length;
+
+	for (ULONG r = 0; r < BENCH_ACTIVATE_REMOTES; r++)
+		out += Activation.Remotes[r].HostOut;
+
+	for (ULONG w = 0; w < BENCH_ACTIVATE_WRITES && write == NULL; w++) {
+		if (!Activation.Writes[w].Busy)
+			write = &Activation.Writes[w];
+	}
+
+	if (out >= Activation.Total || write == NULL)
+		return;
+
+	att[0] = Op;
+	att[1] = (UCHAR)Attribute;
+	att[2] = (UCHAR)(Attribute >> 8);
+	att[3] = (UCHAR)Remote->HostSent;
+	att[4] = (UCHAR)(Remote->HostSent >> 8);
+
+	length = ActivatePacket(write->Buffer, Remote, HCI_ACL_PB_FIRST_NON_FLUSHABLE, att, Op == ATT_OP_READ_REQ ? 3 : 5);
+
+	Remote->HostOut++;
+	Remote->HostSent++;
+	if (Op != ATT_OP_WRITE_CMD)
+		Remote->HostRequest = Op;
+
+	write->Busy = TRUE;
+	write->Held = FALSE;
+	write->Submitted = Activation.Tick;
+	Activation.HostPackets++;
+
+	UsbBuildInterruptOrBulkTransferRequest(&write->Urb,
+		sizeof(struct _URB_BULK_OR_INTERRUPT_TRANSFER),
+		&Adapter.Pipes[BENCH_PIPE_ACL_OUT],
+		write->Buffer,
+		NULL,
+		length,
+		USBD_TRANSFER_DIRECTION_OUT,
+		NULL);
+
+	ShimSubmitUrb(Adapter.Device, &write->Urb);
+
+	if (write->Busy) {
+		write->Held = TRUE;
+		Activation.Held++;
+	}
+}
+
+//
+// Runs the remotes and the host for a round on the buffers of Buffers,
+// then lets everything drain and checks each remote was activated.
+// Adds the activation times to ActivateMs.
+//
+VOID
+ActivateRound(
+	const BENCH_ACTIVATE_BUFFERS *	Buffers,
+	ULONG							Seed,
+	PULONG							ActivateMs,
+	PULONG							ActivateMaxMs
+)
+{
+	static FILTER_ADAPTER_INFO	info;
+	FILTER_ACTIVATE_CONFIG		config;
+	PBENCH_THREAD				thread = &Threads[0];
+	SHIM_HANDLE					handle;
+	ULONG						bytesReturned;
+	NTSTATUS					status;
+	BOOLEAN						busy = TRUE;
+	UCHAR						event[24];
+
+	Activation.Random = Seed != 0 ? Seed : 1;
+	Activation.Tick = 1;
+	Activation.Total = Buffers->LeTotal != 0 ? Buffers->LeTotal : Buffers->AclTotal;
+	Activation.InUse = 0;
+	memset(Activation.Remotes, 0, sizeof(Activation.Remotes));
+	memset(Activation.Writes, 0, sizeof(Activation.Writes));
+
+	if (!StartFilter("USB\\VID_0A12&PID_0001")) {
+		Activation.Wrong++;
+		return;
+	}
+
+	memset(&config, 0, sizeof(config));
+	config.Flags = FILTER_ACTIVATE_AUTO;
+	config.PeerCount = BENCH_ACTIVATE_REMOTES;
+
+	for (ULONG r = 0; r < BENCH_ACTIVATE_REMOTES; r++) {
+		PBENCH_ACTIVATE_REMOTE remote = &Activation.Remotes[r];
+
+		remote->Handle = (USHORT)(SYNTH_FIRST_HANDLE + r);
+		remote->EncryptAt = (2 + ActivateRandom() % 40) * BENCH_ACTIVATE_TICKS_PER_MS;
+
+		config.Peers[r].Address[0] = (UCHAR)remote->Handle;
+		config.Peers[r].Address[1] = 0x5a;
+		config.Peers[r].Address[2] = 0x5a;
+		config.Peers[r].Address[3] = 0xc0;
+		config.Peers[r].Address[4] = 0x7c;
+		config.Peers[r].Address[5] = 0x28;
+	}
+
+	if (!SendControl(IOCTL_SET_ACTIVATE_CONFIG, &config, sizeof(config), "IOCTL_SET_ACTIVATE_CONFIG")) {
+		StopFilter();
+		Activation.Wrong++;
+		return;
+	}
+
+	Adapter.Written = ActivateWritten;
+	ShimSetInterruptTime((ULONGLONG)Activation.Tick * BENCH_ACTIVATE_TICK);
+
+	//
+	// The host reads the buffers, then the remotes connect.
+	//
+	{
+		const UCHAR readBufferSize[] = { 0x0e, 0x0b, 0x01, 0x05, 0x10, 0x00, 0xfd, 0x03, 0x60,
+			(UCHAR)Buffers->AclTotal, (UCHAR)(Buffers->AclTotal >> 8), 0x04, 0x00 };
+		const UCHAR leReadBufferSize[] = { 0x0e, 0x07, 0x01, 0x02, 0x20, 0x00, 0xfb, 0x00, Buffers->LeTotal };
+
+		ReplayPacket(thread, TRACE_KIND_HCI_EVENT, HCI_DIRECTION_IN, readBufferSize, sizeof(readBufferSize), sizeof(readBufferSize));
+		ReplayPacket(thread, TRACE_KIND_HCI_EVENT, HCI_DIRECTION_IN, leReadBufferSize, sizeof(leReadBufferSize), sizeof(leReadBufferSize));
+	}
+
+	for (ULONG r = 0; r < BENCH_ACTIVATE_REMOTES; r++) {
+		const UCHAR connect[] = { 0x3e, 0x13, 0x01, 0x00, (UCHAR)(SYNTH_FIRST_HANDLE + r), 0x00, 0x00, 0x00,
+			(UCHAR)(SYNTH_FIRST_HANDLE + r), 0x5a, 0x5a, 0xc0, 0x7c, 0x28, 0x09, 0x00, 0x04, 0x00, 0xc8, 0x00, 0x00 };
+
+		ReplayPacket(thread, TRACE_KIND_HCI_EVENT, HCI_DIRECTION_IN, connect, sizeof(connect), sizeof(connect));
+	}
+
+	for (; Activation.Tick < (BENCH_ACTIVATE_HOST_MS + BENCH_ACTIVATE_DRAIN_MS) * BENCH_ACTIVATE_TICKS_PER_MS; Activation.Tick++) {
+		BOOLEAN host = Activation.Tick < BENCH_ACTIVATE_HOST_MS * BENCH_ACTIVATE_TICKS_PER_MS;
+
+		ShimSetInterruptTime((ULONGLONG)Activation.Tick * BENCH_ACTIVATE_TICK);
+		RunTimers(thread, (LONGLONG)Activation.Tick * BENCH_ACTIVATE_TICK);
+
+		busy = ActivateTransmit();
+		ActivateAnswer();
+
+		for (ULONG r = 0; r < BENCH_ACTIVATE_REMOTES; r++) {
+			PBENCH_ACTIVATE_REMOTE remote = &Activation.Remotes[r];
+
+			busy |= remote->Answering;
+
+			if (!remote->Encrypted && Activation.Tick >= remote->EncryptAt) {
+				event[0] = HCI_EV_ENCRYPTION_CHANGE;
+				event[1] = 4;
+				event[2] = 0;
+				event[3] = (UCHAR)remote->Handle;
+				event[4] = (UCHAR)(remote->Handle >> 8);
+				event[5] = 1;
+
+				remote->Encrypted = TRUE;
+				ReplayPacket(thread, TRACE_KIND_HCI_EVENT, HCI_DIRECTION_IN, event, 6, 6);
+			}
+
+			if (!host)
+				continue;
+
+			if (remote->HostRequest == 0 && ActivateRandom() % 16 == 0) {
+				if (ActivateRandom() % 2 == 0)
+					ActivateHostSend(remote, ATT_OP_READ_REQ, BENCH_ACTIVATE_ATT_READ);
+				else
+					ActivateHostSend(remote, ATT_OP_WRITE_REQ, BENCH_ACTIVATE_ATT_WRITE);
+			}
+
+			if (ActivateRandom() % 2 == 0)
+				ActivateHostSend(remote, ATT_OP_WRITE_CMD, BENCH_ACTIVATE_ATT_COMMAND);
+		}
+
+		for (ULONG w = 0; w < BENCH_ACTIVATE_WRITES; w++)
+			busy |= Activation.Writes[w].Busy;
+
+		if (!host && !busy)
+			break;
+	}
+
+	Adapter.Written = NULL;
+
+	//
+	// Everything must have drained, the host got all its buffers back and
+	// every remote was activated.
+	//
+	for (ULONG w = 0; w < BENCH_ACTIVATE_WRITES; w++) {
+		if (Activation.Writes[w].Busy)
+			ActivateWrong("a host write never reached the adapter", HCI_ACL_HANDLE(Activation.Writes[w].Buffer));
+	}
+
+	for (ULONG r = 0; r < BENCH_ACTIVATE_REMOTES; r++) {
+		PBENCH_ACTIVATE_REMOTE remote = &Activation.Remotes[r];
+
+		if (busy)
+			ActivateWrong("never drained", remote->Handle);
+		else if (remote->HostOut != 0)
+			ActivateWrong("the host never got all its buffers back", remote->Handle);
+		else if (remote->HostRequest != 0)
+			ActivateWrong("a host request was never answered", remote->Handle);
+	}
+
+	status = ShimOpenControl(&handle);
+	if (NT_SUCCESS(status)) {
+		status = ShimDeviceIoControl(handle, IOCTL_GET_ADAPTER_INFO, NULL, 0, &info, sizeof(info), &bytesReturned);
+		ShimCloseControl(handle);
+	}
+
+	StopFilter();
+
+	if (!NT_SUCCESS(status)) {
+		printf("IOCTL_GET_ADAPTER_INFO failed, 0x%x\n", (unsigned)status);
+		Activation.Wrong++;
+		return;
+	}
+
+	for (ULONG r = 0; r < BENCH_ACTIVATE_REMOTES; r++) {
+		const FILTER_CONNECTION_INFO *	conn = NULL;
+
+		for (ULONG c = 0; c < min(info.ConnectionCount, (USHORT)FILTER_MAX_CONNECTIONS); c++) {
+			if (info.Connections[c].Handle == Activation.Remotes[r].Handle)
+				conn = &info.Connections[c];
+		}
+
+		if (conn == NULL || conn->ActivateState != FILTER_ACTIVATE_STATE_DONE) {
+			ActivateWrong("not activated", Activation.Remotes[r].Handle);
+			continue;
+		}
+
+		*ActivateMs += conn->ActivateMs;
+		*ActivateMaxMs = max(*ActivateMaxMs, (ULONG)conn->ActivateMs);
+	}
+}
+
+//
+// Activates four remotes from the filter while the host keeps their
+// connections busy, Rounds times on each split of the controller's
+// buffers, and checks the controller never overflows, the host never
+// gets back a buffer it didn't use nor a response it didn't ask for, and
+// no remote ever has two ATT requests outstanding. Reports how often and
+// how long host packets were held back and how long activating took,
+// and returns FALSE if anything was off.
+//
+BOOLEAN
+Activations(
+	ULONG	Rounds,
+	ULONG	Seed
+)
+{
+	ULONG wrong = 0;
+
+	printf("%-9s %7s %6s %7s %7s %8s %8s %6s %6s %7s %7s %9s\n",
+		"Buffers", "Host", "Failed", "Held", "Ours", "Hold p50", "Hold max", "Hidden", "Wrong", "Act ms", "Act max", "Overflows");
+
+	for (ULONG b = 0; b < ARRAYSIZE(ActivateBuffers); b++) {
+		ULONG activateMs = 0;
+		ULONG activateMaxMs = 0;
+
+		Activation.HostPackets = 0;
+		Activation.Failed = 0;
+		Activation.OwnPackets = 0;
+		Activation.Held = 0;
+		Activation.Hidden = 0;
+		Activation.Overflows = 0;
+		Activation.Wrong = 0;
+		memset(&Activation.HoldLatency, 0, sizeof(Activation.HoldLatency));
+
+		for (ULONG i = 0; i < Rounds; i++)
+			ActivateRound(&ActivateBuffers[b], Seed * 7919 + i * 104729 + b + 1, &activateMs, &activateMaxMs);
+
+		if (Activation.Hidden != Rounds * BENCH_ACTIVATE_REMOTES * ACTIVATE_STEP_COUNT) {
+			printf("%u of %u activation responses hidden\n", (unsigned)Activation.Hidden,
+				(unsigned)(Rounds * BENCH_ACTIVATE_REMOTES * ACTIVATE_STEP_COUNT));
+			Activation.Wrong++;
+		}
+
+		printf("%-9s %7u %6u %7u %7u %8.2f %8.2f %6u %6u %7.1f %7u %9u\n",
+			ActivateBuffers[b].Name,
+			(unsigned)Activation.HostPackets,
+			(unsigned)Activation.Failed,
+			(unsigned)Activation.Held,
+			(unsigned)Activation.OwnPackets,
+			LatencyHistogramPercentile(&Activation.HoldLatency, 500) / 1e6,
+			Activation.HoldLatency.Max / 1e6,
+			(unsigned)Activation.Hidden,
+			(unsigned)Activation.Wrong,
+			Rounds != 0 ? (double)activateMs / (Rounds * BENCH_ACTIVATE_REMOTES) : 0.0,
+			(unsigned)activateMaxMs,
+			(unsigned)Activation.Overflows);
+
+		wrong += Activation.Wrong;
+	}
+
+	printf("%u wrong\n", (unsigned)wrong);
+
+	return wrong == 0;
+}
+
+//
+// ATT exchanges of -X. Four remotes answer the host's requests, mostly
+// within a few ms and now and then after up to 2 s, some with an error
+// response, and the filter activates two of them on its own. The adapter
+// takes up to 5 ms for a write and now and then fails one of the host's,
+// the remotes now and then drop their connection instead of answering and
+// connect again, to be activated again, and send responses nobody asked
+// for. The bench works out what the filter must
+// count from the interrupt times it moved the clock to and compares it
+// with IOCTL_GET_ATT_STATS every few ms.
+//
+#define BENCH_EXCHANGE_REMOTES		4
+#define BENCH_EXCHANGE_PEERS		2			// the first that many are activated
+#define BENCH_EXCHANGE_TICK			2500		// 250 us of interrupt time
+#define BENCH_EXCHANGE_MS			10000		// of interrupt time
+#define BENCH_EXCHANGE_CHECK		16			// ticks between checks
+#define BENCH_EXCHANGE_LENGTH		16
+#define BENCH_EXCHANGE_FAIL			32			// one in that many host requests fails at the adapter
+#define BENCH_EXCHANGE_ERROR		8			// is answered with an error
+#define BENCH_EXCHANGE_SLOW			16			// takes 100 ms to 2 s
+#define BENCH_EXCHANGE_DROP			16			// drops the connection instead
+#define BENCH_EXCHANGE_STRAY		512			// ticks between responses nobody asked for, on average
+
+#define BENCH_EXCHANGE_ATT			0x0030		// what the host reads and writes
+
+#define BENCH_EXCHANGE_ANSWER		0			// how the remote answers a request
+#define BENCH_EXCHANGE_ANSWER_ERROR	1
+#define BENCH_EXCHANGE_ANSWER_DROP	2			// it disconnects
+#define BENCH_EXCHANGE_ANSWER_NONE	3
+
+typedef struct _BENCH_EXCHANGE_REMOTE {
+
+	USHORT						Handle;
+	BOOLEAN						Connected;
+	BOOLEAN						Encrypted;
+	LONGLONG					ConnectAt;		// interrupt time
+	LONGLONG					EncryptAt;
+	ULONG						Completed;		// buffers to hand back
+
+	//
+	// At the remote.
+	//
+	BOOLEAN						Answering;		// an ATT request is outstanding
+	UCHAR						AnswerOrigin;	// FILTER_ATT_ORIGIN_* of it
+	UCHAR						AnswerOp;		// of the request
+	UCHAR						AnswerHow;		// BENCH_EXCHANGE_ANSWER*
+	LONGLONG					AnswerAt;
+
+	//
+	// At the host, one request at a time.
+	//
+	URB							Urb;
+	MDL							Mdl;
+	UCHAR						Buffer[BENCH_EXCHANGE_LENGTH];
+	UCHAR						HostRequest;	// outstanding, 0 for none
+	LONGLONG					HostAt;			// of the next one
+
+	//
+	// What the filter must report, once it saw ATT on the connection, and
+	// when the request of each origin outstanding went down.
+	//
+	BOOLEAN						Present;
+	FILTER_ATT_CONNECTION_STATS	Expected;
+	BOOLEAN						Pending[FILTER_ATT_ORIGINS];
+	LONGLONG					RequestedAt[FILTER_ATT_ORIGINS];
+
+} BENCH_EXCHANGE_REMOTE, *PBENCH_EXCHANGE_REMOTE;
+
+typedef struct _BENCH_EXCHANGE {
+
+	ULONG					Random;
+	LONGLONG				Now;			// interrupt time
+	BOOLEAN					Final;			// the last requests, left unanswered
+	BENCH_EXCHANGE_REMOTE	Remotes[BENCH_EXCHANGE_REMOTES];
+	FILTER_ATT_LATENCY		Totals[FILTER_ATT_ORIGINS];
+	ULONG					Started;
+	ULONG					Failed;
+	ULONG					Drops;
+	ULONG					Strays;
+	ULONG					Checks;
+	ULONG					Wrong;
+
+} BENCH_EXCHANGE, *PBENCH_EXCHANGE;
+
+BENCH_EXCHANGE	Exchange;
+
+ULONG
+ExchangeRandom()
+{
+	ULONG x = Exchange.Random;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	Exchange.Random = x;
+
+	return x;
+}
+
+VOID
+ExchangeWrong(
+	const char *	What,
+	USHORT			Handle
+)
+{
+	if (Exchange.Wrong++ >= 8)
+		return;
+
+	if (Handle == HCI_INVALID_HANDLE)
+		printf("totals at %.2f ms: %s\n", (double)Exchange.Now / BENCH_EXCHANGE_MS, What);
+	else
+		printf("handle 0x%03x at %.2f ms: %s\n", (unsigned)Handle, (double)Exchange.Now / BENCH_EXCHANGE_MS, What);
+}
+
+PBENCH_EXCHANGE_REMOTE
+ExchangeRemote(
+	USHORT	Handle
+)
+{
+	for (ULONG r = 0; r < BENCH_EXCHANGE_REMOTES; r++) {
+		if (Exchange.Remotes[r].Handle == Handle)
+			return &Exchange.Remotes[r];
+	}
+
+	return NULL;
+}
+
+//
+// An ATT packet on Handle, Att holds its AttLength bytes.
+//
+ULONG
+ExchangePacket(
+	PUCHAR			Packet,
+	USHORT			Handle,
+	UCHAR			Flags,
+	const UCHAR *	Att,
+	ULONG			AttLength
+)
+{
+	Packet[0] = (UCHAR)Handle;
+	Packet[1] = (UCHAR)((Handle >> 8) | (Flags << 4));
+	Packet[2] = (UCHAR)(L2CAP_HEADER_LENGTH + AttLength);
+	Packet[3] = 0;
+	Packet[4] = (UCHAR)AttLength;
+	Packet[5] = 0;
+	Packet[6] = (UCHAR)L2CAP_CID_ATT;
+	Packet[7] = 0;
+	memcpy(&Packet[ATT_PDU_OFFSET], Att, AttLength);
+
+	return ATT_PDU_OFFSET + AttLength;
+}
+
+//
+// Histogram bucket of a time as public.h has them.
+//
+ULONG
+ExchangeBucket(
+	LONGLONG	Ticks
+)
+{
+	LONGLONG	ms = Ticks / BENCH_EXCHANGE_MS;
+	ULONG		bucket = 0;
+
+	for (; ms > 0 && bucket < FILTER_ATT_HISTOGRAM_BUCKETS - 1; ms >>= 1)
+		bucket++;
+
+	return bucket;
+}
+
+//
+// What the filter must count for a request of Origin going down on
+// Remote, the adapter taking it, an answer and the request going
+// unanswered.
+//
+VOID
+ExchangeRequested(
+	PBENCH_EXCHANGE_REMOTE	Remote,
+	UCHAR					Origin
+)
+{
+	Remote->Present = TRUE;
+	Remote->Pending[Origin] = TRUE;
+	Remote->RequestedAt[Origin] = Exchange.Now;
+	Remote->Expected.Pending++;
+	Remote->Expected.Origins[Origin].Requests++;
+	Exchange.Totals[Origin].Requests++;
+}
+
+VOID
+ExchangeSent(
+	PBENCH_EXCHANGE_REMOTE	Remote,
+	UCHAR					Origin
+)
+{
+	ULONG bucket = ExchangeBucket(Exchange.Now - Remote->RequestedAt[Origin]);
+
+	Remote->Expected.Origins[Origin].Adapter[bucket]++;
+	Exchange.Totals[Origin].Adapter[bucket]++;
+}
+
+VOID
+ExchangeRecord(
+	PFILTER_ATT_LATENCY	Latency,
+	LONGLONG			Ticks,
+	BOOLEAN				Error
+)
+{
+	ULONG ms = (ULONG)(Ticks / BENCH_EXCHANGE_MS);
+
+	Latency->Responses++;
+	if (Error)
+		Latency->Errors++;
+	Latency->MaxMs = max(Latency->MaxMs, ms);
+	Latency->TotalUs += (ULONGLONG)(Ticks / 10);
+	Latency->RoundTrip[ExchangeBucket(Ticks)]++;
+}
+
+VOID
+ExchangeAnswered(
+	PBENCH_EXCHANGE_REMOTE	Remote,
+	UCHAR					Origin,
+	BOOLEAN					Error
+)
+{
+	LONGLONG ticks = Exchange.Now - Remote->RequestedAt[Origin];
+
+	ExchangeRecord(&Remote->Expected.Origins[Origin], ticks, Error);
+	ExchangeRecord(&Exchange.Totals[Origin], ticks, Error);
+	Remote->Pending[Origin] = FALSE;
+	Remote->Expected.Pending--;
+}
+
+VOID
+ExchangeUnanswered(
+	PBENCH_EXCHANGE_REMOTE	Remote,
+	UCHAR					Origin,
+	BOOLEAN					TimedOut
+)
+{
+	if (!Remote->Pending[Origin])
+		return;
+
+	if (TimedOut) {
+		Remote->Expected.Origins[Origin].Timeouts++;
+		Exchange.Totals[Origin].Timeouts++;
+	} else {
+		Remote->Expected.Origins[Origin].Unanswered++;
+		Exchange.Totals[Origin].Unanswered++;
+	}
+
+	Remote->Pending[Origin] = FALSE;
+	Remote->Expected.Pending--;
+}
+
+//
+// The adapter takes a packet, in up to 5 ms of interrupt time, and the
+// remote gets it. One in BENCH_EXCHANGE_FAIL host requests fails instead.
+//
+BOOLEAN
+ExchangeWritten(
+	PURB			Urb,
+	const UCHAR *	Data,
+	ULONG			Length
+)
+{
+	PBENCH_EXCHANGE_REMOTE	remote = ExchangeRemote(HCI_ACL_HANDLE(Data));
+	UCHAR					origin;
+
+	if (remote == NULL || !remote->Connected || !HCI_IS_ATT_PDU(Data, Length)) {
+		ExchangeWrong("a packet on no connection", HCI_ACL_HANDLE(Data));
+		return TRUE;
+	}
+
+	origin = Urb == &remote->Urb ? FILTER_ATT_ORIGIN_HOST : FILTER_ATT_ORIGIN_FILTER;
+
+	if (origin == FILTER_ATT_ORIGIN_FILTER) {
+		ExchangeRequested(remote, origin);
+	} else if (!Exchange.Final && ExchangeRandom() % BENCH_EXCHANGE_FAIL == 0) {
+		ExchangeUnanswered(remote, origin, FALSE);
+		remote->HostRequest = 0;
+		remote->HostAt = Exchange.Now + ExchangeRandom() % (10 * BENCH_EXCHANGE_MS);
+		Exchange.Failed++;
+		return FALSE;
+	}
+
+	Exchange.Now += ExchangeRandom() % (5 * BENCH_EXCHANGE_MS);
+	ShimSetInterruptTime((ULONGLONG)Exchange.Now);
+
+	ExchangeSent(remote, origin);
+	remote->Completed++;
+
+	if (remote->Answering) {
+		ExchangeWrong("a second ATT request before the first was answered", remote->Handle);
+		return TRUE;
+	}
+
+	remote->Answering = TRUE;
+	remote->AnswerOrigin = origin;
+	remote->AnswerOp = Data[ATT_PDU_OFFSET];
+	remote->AnswerHow = BENCH_EXCHANGE_ANSWER;
+
+	if (Exchange.Final)
+		remote->AnswerHow = BENCH_EXCHANGE_ANSWER_NONE;
+	else if (origin == FILTER_ATT_ORIGIN_HOST && ExchangeRandom() % BENCH_EXCHANGE_DROP == 0)
+		remote->AnswerHow = BENCH_EXCHANGE_ANSWER_DROP;
+	else if (origin == FILTER_ATT_ORIGIN_HOST && ExchangeRandom() % BENCH_EXCHANGE_ERROR == 0)
+		remote->AnswerHow = BENCH_EXCHANGE_ANSWER_ERROR;
+
+	if (origin == FILTER_ATT_ORIGIN_HOST && ExchangeRandom() % BENCH_EXCHANGE_SLOW == 0)
+		remote->AnswerAt = Exchange.Now + (100 + ExchangeRandom() % 1900) * BENCH_EXCHANGE_MS;
+	else
+		remote->AnswerAt = Exchange.Now + BENCH_EXCHANGE_MS + ExchangeRandom() % (40 * BENCH_EXCHANGE_MS);
+
+	return TRUE;
+}
+
+VOID
+ExchangeConnect(
+	PBENCH_EXCHANGE_REMOTE	Remote
+)
+{
+	const UCHAR connect[] = { 0x3e, 0x13, 0x01, 0x00, (UCHAR)Remote->Handle, (UCHAR)(Remote->Handle >> 8), 0x00, 0x00,
+		(UCHAR)Remote->Handle, 0x5a, 0x5a, 0xc0, 0x7c, 0x28, 0x09, 0x00, 0x04, 0x00, 0xc8, 0x00, 0x00 };
+
+	Remote->Connected = TRUE;
+	ReplayPacket(&Threads[0], TRACE_KIND_HCI_EVENT, HCI_DIRECTION_IN, connect, sizeof(connect), sizeof(connect));
+}
+
+//
+// The remote drops the connection, what is outstanding on it goes
+// unanswered and the filter forgets it.
+//
+VOID
+ExchangeDisconnect(
+	PBENCH_EXCHANGE_REMOTE	Remote
+)
+{
+	const UCHAR disconnect[] = { HCI_EV_DISCONNECTION_COMPLETE, 0x04, 0x00,
+		(UCHAR)Remote->Handle, (UCHAR)(Remote->Handle >> 8), 0x13 };
+
+	ExchangeUnanswered(Remote, FILTER_ATT_ORIGIN_HOST, FALSE);
+	ExchangeUnanswered(Remote, FILTER_ATT_ORIGIN_FILTER, FALSE);
+
+	ReplayPacket(&Threads[0], TRACE_KIND_HCI_EVENT, HCI_DIRECTION_IN, disconnect, sizeof(disconnect), sizeof(disconnect));
+
+	Remote->Connected = FALSE;
+	Remote->Encrypted = FALSE;
+	Remote->ConnectAt = Exchange.Now + (5 + ExchangeRandom() % 20) * BENCH_EXCHANGE_MS;
+	Remote->EncryptAt = Remote->ConnectAt + (2 + ExchangeRandom() % 20) * BENCH_EXCHANGE_MS;
+	Remote->Completed = 0;
+	Remote->HostRequest = 0;
+	Remote->Present = FALSE;
+	memset(&Remote->Expected, 0, sizeof(Remote->Expected));
+	Remote->Expected.Handle = Remote->Handle;
+	Exchange.Drops++;
+}
+
+//
+// The controller hands back the buffers of what it sent.
+//
+VOID
+ExchangeComplete()
+{
+	UCHAR	event[HCI_EVENT_HEADER_LENGTH + 1 + 4 * BENCH_EXCHANGE_REMOTES];
+	ULONG	count = 0;
+
+	for (ULONG r = 0; r < BENCH_EXCHANGE_REMOTES; r++) {
+		PBENCH_EXCHANGE_REMOTE	remote = &Exchange.Remotes[r];
+		PUCHAR					entry = &event[HCI_EVENT_HEADER_LENGTH + 1 + 4 * count];
+
+		if (remote->Completed == 0)
+			continue;
+
+		entry[0] = (UCHAR)remote->Handle;
+		entry[1] = (UCHAR)(remote->Handle >> 8);
+		entry[2] = (UCHAR)remote->Completed;
+		entry[3] = (UCHAR)(remote->Completed >> 8);
+		remote->Completed = 0;
+		count++;
+	}
+
+	if (count == 0)
+		return;
+
+	event[0] = HCI_EV_NUMBER_OF_COMPLETED_PACKETS;
+	event[1] = (UCHAR)(1 + 4 * count);
+	event[2] = (UCHAR)count;
+
+	ReplayPacket(&Threads[0], TRACE_KIND_HCI_EVENT, HCI_DIRECTION_IN, event, HCI_EVENT_HEADER_LENGTH + 1 + 4 * count,
+		HCI_EVENT_HEADER_LENGTH + 1 + 4 * count);
+}
+
+//
+// The remotes answer what is due. The host must get the answers to its
+// own requests, the filter's must be hidden.
+//
+VOID
+ExchangeAnswer()
+{
+	PBENCH_READER reader = &Threads[0].Readers[BENCH_PIPE_ACL_IN];
+
+	for (ULONG r = 0; r < BENCH_EXCHANGE_REMOTES; r++) {
+		PBENCH_EXCHANGE_REMOTE	remote = &Exchange.Remotes[r];
+		UCHAR					att[6];
+		UCHAR					packet[BENCH_EXCHANGE_LENGTH];
+		UCHAR					origin;
+		ULONG					attLength;
+		ULONG					length;
+
+		if (!remote->Answering || remote->AnswerHow == BENCH_EXCHANGE_ANSWER_NONE || remote->AnswerAt > Exchange.Now)
+			continue;
+
+		remote->Answering = FALSE;
+
+		if (remote->AnswerHow == BENCH_EXCHANGE_ANSWER_DROP) {
+			ExchangeDisconnect(remote);
+			continue;
+		}
+
+		if (remote->AnswerHow == BENCH_EXCHANGE_ANSWER_ERROR) {
+			att[0] = ATT_OP_ERROR_RSP;
+			att[1] = remote->AnswerOp;
+			att[2] = (UCHAR)BENCH_EXCHANGE_ATT;
+			att[3] = (UCHAR)(BENCH_EXCHANGE_ATT >> 8);
+			att[4] = 0x0a;		// attribute not found
+			attLength = ATT_ERROR_RSP_LENGTH;
+		} else if (remote->AnswerOp == ATT_OP_READ_BY_TYPE_REQ) {
+			att[0] = ATT_OP_READ_BY_TYPE_RSP;
+			att[1] = 4;
+			att[2] = (UCHAR)BENCH_EXCHANGE_ATT;
+			att[3] = (UCHAR)(BENCH_EXCHANGE_ATT >> 8);
+			att[4] = 0x5a;
+			att[5] = 0xa5;
+			attLength = 6;
+		} else if (remote->AnswerOp == ATT_OP_READ_REQ) {
+			att[0] = ATT_OP_READ_RSP;
+			att[1] = 0x5a;
+			att[2] = 0xa5;
+			attLength = 3;
+		} else {
+			att[0] = (UCHAR)(remote->AnswerOp + 1);
+			attLength = 1;
+		}
+
+		origin = remote->AnswerOrigin;
+		ExchangeAnswered(remote, origin, remote->AnswerHow == BENCH_EXCHANGE_ANSWER_ERROR);
+
+		if (origin == FILTER_ATT_ORIGIN_HOST)
+			remote->HostRequest = 0;
+
+		//
+		// The next request may go down before this returns, the filter's
+		// after the host's answer and the host's after ours.
+		//
+		length = ExchangePacket(packet, remote->Handle, HCI_ACL_PB_FIRST_FLUSHABLE, att, attLength);
+		ReplayPacket(&Threads[0], TRACE_KIND_ACL, HCI_DIRECTION_IN, packet, length, length);
+
+		if (reader->Submitted != (origin == FILTER_ATT_ORIGIN_FILTER))
+			ExchangeWrong(reader->Submitted ? "the answer to a host request was hidden" :
+				"the answer to an activation reached the host", remote->Handle);
+
+		if (origin == FILTER_ATT_ORIGIN_HOST) {
+			remote->HostAt = Exchange.Now + ExchangeRandom() % (10 * BENCH_EXCHANGE_MS);
+		}
+	}
+}
+
+//
+// The host sends Remote an ATT request, one in four written in an MDL.
+//
+VOID
+ExchangeHostSend(
+	PBENCH_EXCHANGE_REMOTE	Remote
+)
+{
+	const UCHAR	ops[] = { ATT_OP_READ_REQ, ATT_OP_WRITE_REQ, ATT_OP_READ_BY_TYPE_REQ };
+	UCHAR		att[7];
+	ULONG		attLength = 3;
+	ULONG		length;
+
+	att[0] = Exchange.Final ? ATT_OP_READ_REQ : ops[ExchangeRandom() % ARRAYSIZE(ops)];
+	att[1] = (UCHAR)BENCH_EXCHANGE_ATT;
+	att[2] = (UCHAR)(BENCH_EXCHANGE_ATT >> 8);
+
+	if (att[0] == ATT_OP_WRITE_REQ) {
+		att[3] = 0x01;
+		att[4] = 0x00;
+		attLength = 5;
+	} else if (att[0] == ATT_OP_READ_BY_TYPE_REQ) {
+		att[1] = 0x01;
+		att[2] = 0x00;
+		att[3] = 0xff;
+		att[4] = 0xff;
+		att[5] = 0x4d;		// Report
+		att[6] = 0x2a;
+		attLength = 7;
+	}
+
+	length = ExchangePacket(Remote->Buffer, Remote->Handle, HCI_ACL_PB_FIRST_NON_FLUSHABLE, att, attLength);
+
+	Remote->HostRequest = att[0];
+	Exchange.Started++;
+	ExchangeRequested(Remote, FILTER_ATT_ORIGIN_HOST);
+
+	Remote->Mdl.Next = NULL;
+	Remote->Mdl.MappedSystemVa = Remote->Buffer;
+	Remote->Mdl.ByteCount = length;
+
+	if (ExchangeRandom() % 4 == 0) {
+		UsbBuildInterruptOrBulkTransferRequest(&Remote->Urb,
+			sizeof(struct _URB_BULK_OR_INTERRUPT_TRANSFER),
+			&Adapter.Pipes[BENCH_PIPE_ACL_OUT],
+			NULL,
+			&Remote->Mdl,
+			length,
+			USBD_TRANSFER_DIRECTION_OUT,
+			NULL);
+	} else {
+		UsbBuildInterruptOrBulkTransferRequest(&Remote->Urb,
+			sizeof(struct _URB_BULK_OR_INTERRUPT_TRANSFER),
+			&Adapter.Pipes[BENCH_PIPE_ACL_OUT],
+			Remote->Buffer,
+			NULL,
+			length,
+			USBD_TRANSFER_DIRECTION_OUT,
+			NULL);
+	}
+
+	ShimSubmitUrb(Adapter.Device, &Remote->Urb);
+}
+
+//
+// Reports a difference between what the filter counted for Origin and
+// what it should have.
+//
+VOID
+ExchangeCompare(
+	const FILTER_ATT_LATENCY *	Counted,
+	const FILTER_ATT_LATENCY *	Expected,
+	UCHAR						Origin,
+	USHORT						Handle
+)
+{
+	char what[256];
+
+	if (memcmp(Counted, Expected, sizeof(FILTER_ATT_LATENCY)) == 0)
+		return;
+
+	snprintf(what, sizeof(what),
+		"%s requests %u/%u, responses %u/%u, errors %u/%u, timeouts %u/%u, unanswered %u/%u, "
+		"max %u/%u ms, total %llu/%llu us%s%s, counted/expected",
+		Origin == FILTER_ATT_ORIGIN_HOST ? "host" : "filter",
+		(unsigned)Counted->Requests, (unsigned)Expected->Requests,
+		(unsigned)Counted->Responses, (unsigned)Expected->Responses,
+		(unsigned)Counted->Errors, (unsigned)Expected->Errors,
+		(unsigned)Counted->Timeouts, (unsigned)Expected->Timeouts,
+		(unsigned)Counted->Unanswered, (unsigned)Expected->Unanswered,
+		(unsigned)Counted->MaxMs, (unsigned)Expected->MaxMs,
+		(unsigned long long)Counted->TotalUs, (unsigned long long)Expected->TotalUs,
+		memcmp(Counted->Adapter, Expected->Adapter, sizeof(Counted->Adapter)) != 0 ? ", adapter times differ" : "",
+		memcmp(Counted->RoundTrip, Expected->RoundTrip, sizeof(Counted->RoundTrip)) != 0 ? ", round trips differ" : "");
+
+	ExchangeWrong(what, Handle);
+}
+
+//
+// Checks what IOCTL_GET_ATT_STATS reports against what the filter must
+// have counted.
+//
+VOID
+ExchangeCheck()
+{
+	static FILTER_ATT_STATS	stats;
+	SHIM_HANDLE				handle;
+	ULONG					bytesReturned = 0;
+	ULONG					present = 0;
+	NTSTATUS				status;
+
+	Exchange.Checks++;
+
+	status = ShimOpenControl(&handle);
+	if (NT_SUCCESS(status)) {
+		status = ShimDeviceIoControl(handle, IOCTL_GET_ATT_STATS, NULL, 0, &stats, sizeof(stats), &bytesReturned);
+		ShimCloseControl(handle);
+	}
+
+	if (!NT_SUCCESS(status) || bytesReturned != sizeof(stats)) {
+		ExchangeWrong("IOCTL_GET_ATT_STATS failed", HCI_INVALID_HANDLE);
+		return;
+	}
+
+	for (ULONG r = 0; r < BENCH_EXCHANGE_REMOTES; r++) {
+		PBENCH_EXCHANGE_REMOTE					remote = &Exchange.Remotes[r];
+		const FILTER_ATT_CONNECTION_STATS *		conn = NULL;
+
+		for (ULONG c = 0; c < min(stats.ConnectionCount, (ULONG)FILTER_MAX_CONNECTIONS); c++) {
+			if (stats.Connections[c].Handle == remote->Handle)
+				conn = &stats.Connections[c];
+		}
+
+		if (!remote->Present) {
+			if (conn != NULL)
+				ExchangeWrong("reported after it disconnected", remote->Handle);
+			continue;
+		}
+
+		present++;
+
+		if (conn == NULL) {
+			ExchangeWrong("not reported", remote->Handle);
+			continue;
+		}
+
+		if (conn->Pending != remote->Expected.Pending || conn->Unmatched != remote->Expected.Unmatched) {
+			char what[64];
+
+			snprintf(what, sizeof(what), "pending %u/%u, unmatched %u/%u, counted/expected",
+				(unsigned)conn->Pending, (unsigned)remote->Expected.Pending,
+				(unsigned)conn->Unmatched, (unsigned)remote->Expected.Unmatched);
+			ExchangeWrong(what, remote->Handle);
+		}
+
+		for (UCHAR o = 0; o < FILTER_ATT_ORIGINS; o++)
+			ExchangeCompare(&conn->Origins[o], &remote->Expected.Origins[o], o, remote->Handle);
+	}
+
+	if (stats.ConnectionCount != present)
+		ExchangeWrong("more connections reported than there are", HCI_INVALID_HANDLE);
+
+	for (UCHAR o = 0; o < FILTER_ATT_ORIGINS; o++)
+		ExchangeCompare(&stats.Totals[o], &Exchange.Totals[o], o, HCI_INVALID_HANDLE);
+}
+
+//
+// Replays Count ATT exchanges of the host, and the activations of the
+// filter, on four remotes, checking what the filter counts for them every
+// few ms. Then the host sends a last request to each remote that never
+// answers, and after 30 s they must have timed out. Prints the totals
+// and returns FALSE if anything was off.
+//
+BOOLEAN
+AttExchanges(
+	ULONG	Count,
+	ULONG	Seed
+)
+{
+	PBENCH_THREAD			thread = &Threads[0];
+	FILTER_ACTIVATE_CONFIG	config;
+	ULONG					ticks = 0;
+	BOOLEAN					idle = FALSE;
+	UCHAR					event[6];
+
+	memset(&Exchange, 0, sizeof(Exchange));
+	Exchange.Random = Seed != 0 ? Seed : 1;
+	Exchange.Now = BENCH_EXCHANGE_TICK;
+
+	if (!StartFilter("USB\\VID_0A12&PID_0001"))
+		return FALSE;
+
+	memset(&config, 0, sizeof(config));
+	config.Flags = FILTER_ACTIVATE_AUTO;
+	config.PeerCount = BENCH_EXCHANGE_PEERS;
+
+	for (ULONG r = 0; r < BENCH_EXCHANGE_PEERS; r++) {
+		config.Peers[r].Address[0] = (UCHAR)(SYNTH_FIRST_HANDLE + r);
+		config.Peers[r].Address[1] = 0x5a;
+		config.Peers[r].Address[2] = 0x5a;
+		config.Peers[r].Address[3] = 0xc0;
+		config.Peers[r].Address[4] = 0x7c;
+		config.Peers[r].Address[5] = 0x28;
+	}
+
+	if (!SendControl(IOCTL_SET_ACTIVATE_CONFIG, &config, sizeof(config), "IOCTL_SET_ACTIVATE_CONFIG")) {
+		StopFilter();
+		return FALSE;
+	}
+
+	Adapter.Written = ExchangeWritten;
+	ShimSetInterruptTime((ULONGLONG)Exchange.Now);
+
+	{
+		const UCHAR readBufferSize[] = { 0x0e, 0x0b, 0x01, 0x05, 0x10, 0x00, 0xfd, 0x03, 0x60, 0x08, 0x00, 0x04, 0x00 };
+		const UCHAR leReadBufferSize[] = { 0x0e, 0x07, 0x01, 0x02, 0x20, 0x00, 0xfb, 0x00, 0x08 };
+
+		ReplayPacket(thread, TRACE_KIND_HCI_EVENT, HCI_DIRECTION_IN, readBufferSize, sizeof(readBufferSize), sizeof(readBufferSize));
+		ReplayPacket(thread, TRACE_KIND_HCI_EVENT, HCI_DIRECTION_IN, leReadBufferSize, sizeof(leReadBufferSize), sizeof(leReadBufferSize));
+	}
+
+	for (ULONG r = 0; r < BENCH_EXCHANGE_REMOTES; r++) {
+		PBENCH_EXCHANGE_REMOTE remote = &Exchange.Remotes[r];
+
+		remote->Handle = (USHORT)(SYNTH_FIRST_HANDLE + r);
+		remote->EncryptAt = Exchange.Now + (2 + ExchangeRandom() % 20) * BENCH_EXCHANGE_MS;
+		remote->HostAt = Exchange.Now + ExchangeRandom() % (10 * BENCH_EXCHANGE_MS);
+		remote->Expected.Handle = remote->Handle;
+
+		ExchangeConnect(remote);
+	}
+
+	while (!idle) {
+		Exchange.Now += BENCH_EXCHANGE_TICK;
+		ShimSetInterruptTime((ULONGLONG)Exchange.Now);
+		RunTimers(thread, Exchange.Now);
+
+		ExchangeComplete();
+		ExchangeAnswer();
+
+		idle = Exchange.Started >= Count;
+
+		for (ULONG r = 0; r < BENCH_EXCHANGE_REMOTES; r++) {
+			PBENCH_EXCHANGE_REMOTE remote = &Exchange.Remotes[r];
+
+			if (!remote->Connected) {
+				if (Exchange.Now >= remote->ConnectAt)
+					ExchangeConnect(remote);
+				idle = FALSE;
+				continue;
+			}
+
+			if (!remote->Encrypted && Exchange.Now >= remote->EncryptAt) {
+				event[0] = HCI_EV_ENCRYPTION_CHANGE;
+				event[1] = 4;
+				event[2] = 0;
+				event[3] = (UCHAR)remote->Handle;
+				event[4] = (UCHAR)(remote->Handle >> 8);
+				event[5] = 1;
+
+				remote->Encrypted = TRUE;
+				ReplayPacket(thread, TRACE_KIND_HCI_EVENT, HCI_DIRECTION_IN, event, sizeof(event), sizeof(event));
+			}
+
+			if (Exchange.Started < Count && remote->HostRequest == 0 && Exchange.Now >= remote->HostAt) {
+				ExchangeHostSend(remote);
+			} else if (Exchange.Started < Count && remote->HostRequest == 0 && !remote->Answering &&
+				ExchangeRandom() % BENCH_EXCHANGE_STRAY == 0) {
+				UCHAR	stray[] = { ATT_OP_READ_BLOB_RSP, 0x5a };
+				UCHAR	packet[BENCH_EXCHANGE_LENGTH];
+				ULONG	length = ExchangePacket(packet, remote->Handle, HCI_ACL_PB_FIRST_FLUSHABLE, stray, sizeof(stray));
+
+				remote->Present = TRUE;
+				remote->Expected.Unmatched++;
+				Exchange.Strays++;
+				ReplayPacket(thread, TRACE_KIND_ACL, HCI_DIRECTION_IN, packet, length, length);
+			}
+
+			idle &= remote->Encrypted && !remote->Answering && remote->HostRequest == 0;
+		}
+
+		if (++ticks % BENCH_EXCHANGE_CHECK == 0)
+			ExchangeCheck();
+
+		if (!idle && ticks > (Count + 1) * 4000) {
+			ExchangeWrong("never drained", HCI_INVALID_HANDLE);
+			break;
+		}
+	}
+
+	ExchangeCheck();
+
+	if (Exchange.Totals[FILTER_ATT_ORIGIN_FILTER].Responses < BENCH_EXCHANGE_PEERS * ACTIVATE_STEP_COUNT)
+		ExchangeWrong("the filter didn't activate every peer", HCI_INVALID_HANDLE);
+
+	//
+	// A last request to each remote that is never answered, pending until
+	// ATT gives up on it.
+	//
+	Exchange.Final = TRUE;
+
+	for (ULONG r = 0; r < BENCH_EXCHANGE_REMOTES; r++)
+		ExchangeHostSend(&Exchange.Remotes[r]);
+
+	ExchangeCheck();
+
+	Exchange.Now += ATT_TRACK_TIMEOUT;
+	ShimSetInterruptTime((ULONGLONG)Exchange.Now);
+
+	for (ULONG r = 0; r < BENCH_EXCHANGE_REMOTES; r++)
+		ExchangeUnanswered(&Exchange.Remotes[r], FILTER_ATT_ORIGIN_HOST, TRUE);
+
+	ExchangeCheck();
+
+	Adapter.Written = NULL;
+	StopFilter();
+
+	printf("%-7s %9s %9s %7s %8s %10s %8s %7s\n",
+		"Origin", "Requests", "Responses", "Errors", "Timeouts", "Unanswered", "Mean ms", "Max ms");
+
+	for (UCHAR o = 0; o < FILTER_ATT_ORIGINS; o++) {
+		const FILTER_ATT_LATENCY *latency = &Exchange.Totals[o];
+
+		printf("%-7s %9u %9u %7u %8u %10u %8.2f %7u\n",
+			o == FILTER_ATT_ORIGIN_HOST ? "Host" : "Filter",
+			(unsigned)latency->Requests,
+			(unsigned)latency->Responses,
+			(unsigned)latency->Errors,
+			(unsigned)latency->Timeouts,
+			(unsigned)latency->Unanswered,
+			latency->Responses != 0 ? latency->TotalUs / 1000.0 / latency->Responses : 0.0,
+			(unsigned)latency->MaxMs);
+	}
+
+	printf("%u failed at the adapter, %u connections dropped, %u responses nobody asked for, %u checks\n",
+		(unsigned)Exchange.Failed, (unsigned)Exchange.Drops, (unsigned)Exchange.Strays, (unsigned)Exchange.Checks);
+	printf("%u wrong\n", (unsigned)Exchange.Wrong);
+
+	return Exchange.Wrong == 0;
+}
+
+//
+// Stall watchdog replays of -H. Up to four remotes stream button reports
+// and voice frames in bursts, then pause for less than the gap, just past
+// it, well past it or for minutes, or drop their connection. The bench
+// jumps the interrupt time from one notification or timer to the next, so
+// a replay of minutes runs in a few ms, and follows what the watchdog must
+// make of each pause: a stall that must be seen by the next check after
+// the gap, one the check may or may not still see, or none.
+//
+#define BENCH_STALL_REMOTES			4
+#define BENCH_STALL_TICKS_PER_MS	10000		// of interrupt time
+#define BENCH_STALL_REPLAY_MS		(10 * 60 * 1000)
+#define BENCH_STALL_BURST			40			// notifications in a burst, at most
+#define BENCH_STALL_VOICE			100			// ATT length of a voice frame
+#define BENCH_STALL_LONGEST			(10 * 60 * 1000)	// pause, ms
+
+typedef struct _BENCH_STALL_REMOTE {
+
+	USHORT		Handle;
+	BOOLEAN		Connected;
+	BOOLEAN		Voice;			// the burst is a voice burst
+	LONGLONG	NextAt;			// interrupt time of the next notification, or of connecting
+	ULONG		Burst;			// notifications left in the burst
+
+	//
+	// What the watchdog must make of it.
+	//
+	ULONG		Run;			// notifications in a row, each within the gap
+	LONGLONG	LastAt;
+	BOOLEAN		LastLong;		// as passed up, too long for the header fix
+	BOOLEAN		Due;			// a stall must be seen by LastAt + gap + period
+	BOOLEAN		Stalled;
+	BOOLEAN		Forced;			// the watchdog applied the header fix
+	USHORT		Stalls;
+
+} BENCH_STALL_REMOTE, *PBENCH_STALL_REMOTE;
+
+typedef struct _BENCH_STALL {
+
+	ULONG					Random;
+	LONGLONG				Now;		// interrupt time
+	FILTER_WATCHDOG_CONFIG	Config;
+	ULONG					FixMode;	// FIX_HCI_L2CAP_HEADERS_MODE_*
+	BOOLEAN					Legacy;		// a 4.0 adapter, the fix trims to the legacy length already
+	LONGLONG				Gap;
+	LONGLONG				Period;
+	ULONG					RemoteCount;
+	BENCH_STALL_REMOTE		Remotes[BENCH_STALL_REMOTES];
+	ULONG					Stalls;
+	ULONG					Recoveries;
+
+	//
+	// Over all replays.
+	//
+	ULONGLONG				Notifications;
+	ULONGLONG				ReplayedMs;
+	ULONG					Seen;		// stalls the watchdog had to see
+	ULONG					Maybe;		// it could have missed
+	ULONG					Fixes;
+	ULONG					Drops;
+	ULONG					LateMax;	// percent of the gap a stall was seen after it
+	ULONG					Wrong;
+
+} BENCH_STALL, *PBENCH_STALL;
+
+BENCH_STALL	Stall;
+
+ULONG
+StallRandom()
+{
+	ULONG x = Stall.Random;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	Stall.Random = x;
+
+	return x;
+}
+
+VOID
+StallWrong(
+	const char *	What,
+	USHORT			Handle
+)
+{
+	if (Stall.Wrong++ < 8)
+		printf("handle 0x%03x at %.1f ms, gap %u ms, actions 0x%x, flags 0x%x, fix mode %u: %s\n",
+			(unsigned)Handle, (double)Stall.Now / BENCH_STALL_TICKS_PER_MS, (unsigned)Stall.Config.GapMs,
+			(unsigned)Stall.Config.Actions, (unsigned)Stall.Config.Flags, (unsigned)Stall.FixMode, What);
+}
+
+//
+// Checks the stalls the watchdog counted since the last check against
+// the pauses the remotes made, and what it did about them.
+//
+VOID
+StallSeen()
+{
+	static FILTER_ADAPTER_INFO	info;
+	SHIM_HANDLE					handle;
+	ULONG						bytesReturned;
+	NTSTATUS					status;
+
+	status = ShimOpenControl(&handle);
+	if (NT_SUCCESS(status)) {
+		status = ShimDeviceIoControl(handle, IOCTL_GET_ADAPTER_INFO, NULL, 0, &info, sizeof(info), &bytesReturned);
+		ShimCloseControl(handle);
+	}
+
+	if (!NT_SUCCESS(status)) {
+		StallWrong("IOCTL_GET_ADAPTER_INFO failed", HCI_INVALID_HANDLE);
+		return;
+	}
+
+	for (ULONG r = 0; r < Stall.RemoteCount; r++) {
+		PBENCH_STALL_REMOTE				remote = &Stall.Remotes[r];
+		const FILTER_CONNECTION_INFO *	conn = NULL;
+
+		if (!remote->Connected)
+			continue;
+
+		for (ULONG c = 0; c < min(info.ConnectionCount, (USHORT)FILTER_MAX_CONNECTIONS); c++) {
+			if (info.Connections[c].Handle == remote->Handle)
+				conn = &info.Connections[c];
+		}
+
+		if (conn == NULL) {
+			StallWrong("the filter lost the connection", remote->Handle);
+			continue;
+		}
+
+		if (conn->Stalls != remote->Stalls) {
+			if (conn->Stalls != remote->Stalls + 1 || !remote->Due) {
+				StallWrong("a stall where there was none", remote->Handle);
+			} else if (Stall.Now <= remote->LastAt + Stall.Gap) {
+				StallWrong("a stall before the gap was over", remote->Handle);
+			} else if (Stall.Now > remote->LastAt + Stall.Gap + Stall.Period) {
+				StallWrong("a stall seen later than the check after the gap", remote->Handle);
+			} else {
+				ULONG late = (ULONG)((Stall.Now - remote->LastAt - Stall.Gap) * 100 / Stall.Gap);
+
+				Stall.LateMax = max(Stall.LateMax, late);
+				Stall.Stalls++;
+				remote->Due = FALSE;
+				remote->Stalled = TRUE;
+				remote->Run = 0;
+
+				if ((Stall.Config.Actions & FILTER_WATCHDOG_ACTION_FIX) &&
+					Stall.FixMode != FIX_HCI_L2CAP_HEADERS_MODE_OFF &&
+					!remote->Forced && !Stall.Legacy) {
+					remote->Forced = TRUE;
+					Stall.Fixes++;
+				}
+			}
+
+			remote->Stalls = conn->Stalls;
+		}
+
+		if (((conn->Flags & FILTER_CONNECTION_FIX_FORCED) != 0) != remote->Forced ||
+			conn->FixAttLength != (remote->Forced || Stall.Legacy ? HCI_LEGACY_FIX_ATT_LENGTH : 0))
+			StallWrong(remote->Forced ? "the header fix wasn't applied" : "the header fix was applied", remote->Handle);
+	}
+
+	if (info.Stalls != Stall.Stalls || info.Recoveries != Stall.Recoveries) {
+		char what[80];
+
+		snprintf(what, sizeof(what), "stalls %u/%u, recoveries %u/%u, counted/expected",
+			(unsigned)info.Stalls, (unsigned)Stall.Stalls, (unsigned)info.Recoveries, (unsigned)Stall.Recoveries);
+		StallWrong(what, HCI_INVALID_HANDLE);
+
+		Stall.Stalls = info.Stalls;
+		Stall.Recoveries = info.Recoveries;
+	}
+}
+
+//
+// Remote passes a notification up, a voice frame or a button report, and
+// the upper stack must get it trimmed like the header fix says.
+//
+VOID
+StallNotify(
+	PBENCH_STALL_REMOTE	Remote,
+	BOOLEAN				Voice
+)
+{
+	PBENCH_READER	reader = &Threads[0].Readers[BENCH_PIPE_ACL_IN];
+	UCHAR			packet[ATT_PDU_OFFSET + BENCH_STALL_VOICE];
+	ULONG			attLength = Voice ? BENCH_STALL_VOICE : 5;
+	ULONG			passed = attLength;
+
+	packet[0] = (UCHAR)Remote->Handle;
+	packet[1] = (UCHAR)((Remote->Handle >> 8) | (HCI_ACL_PB_FIRST_FLUSHABLE << 4));
+	packet[2] = (UCHAR)(L2CAP_HEADER_LENGTH + attLength);
+	packet[3] = 0;
+	packet[4] = (UCHAR)attLength;
+	packet[5] = 0;
+	packet[6] = (UCHAR)L2CAP_CID_ATT;
+	packet[7] = 0;
+	packet[8] = ATT_OP_HANDLE_VALUE_NTF;
+	packet[9] = (UCHAR)SIRI_ATT_HID_REPORT;
+	packet[10] = 0;
+	memset(&packet[11], Voice ? 0x5a : 0x00, attLength - 3);
+
+	if (Voice && (Stall.FixMode == FIX_HCI_L2CAP_HEADERS_MODE_ON ||
+		(Stall.FixMode == FIX_HCI_L2CAP_HEADERS_MODE_AUTO && (Remote->Forced || Stall.Legacy))))
+		passed = HCI_LEGACY_FIX_ATT_LENGTH;
+
+	ReplayPacket(&Threads[0], TRACE_KIND_ACL, HCI_DIRECTION_IN, packet, ATT_PDU_OFFSET + attLength, ATT_PDU_OFFSET + attLength);
+
+	if (reader->Submitted || reader->Urb.UrbBulkOrInterruptTransfer.TransferBufferLength != ATT_PDU_OFFSET + passed)
+		StallWrong("the upper stack got the notification trimmed wrong", Remote->Handle);
+
+	Stall.Notifications++;
+
+	if (Stall.Gap == 0)
+		return;
+
+	if (Remote->Run != 0 && Stall.Now - Remote->LastAt <= Stall.Gap)
+		Remote->Run++;
+	else
+		Remote->Run = 1;
+
+	Remote->LastAt = Stall.Now;
+	Remote->LastLong = passed > HCI_LEGACY_FIX_ATT_LENGTH;
+	Remote->Due = FALSE;
+
+	if (Remote->Run < FILTER_WATCHDOG_STREAMING)
+		return;
+
+	if (Remote->Stalled) {
+		Remote->Stalled = FALSE;
+		Stall.Recoveries++;
+	}
+
+	Remote->Due = Remote->LastLong || (Stall.Config.Flags & FILTER_WATCHDOG_ANY_GAP);
+}
+
+//
+// What Remote does next: connects, passes the next notification of its
+// burst up, or after a burst pauses for a while or drops the connection.
+//
+VOID
+StallStep(
+	PBENCH_STALL_REMOTE	Remote
+)
+{
+	LONGLONG	gap = Stall.Gap != 0 ? Stall.Gap : 20 * BENCH_STALL_TICKS_PER_MS;
+	LONGLONG	pause;
+
+	if (!Remote->Connected) {
+		const UCHAR connect[] = { 0x3e, 0x13, 0x01, 0x00, (UCHAR)Remote->Handle, (UCHAR)(Remote->Handle >> 8), 0x00, 0x00,
+			(UCHAR)Remote->Handle, 0x5a, 0x5a, 0xc0, 0x7c, 0x28, 0x09, 0x00, 0x04, 0x00, 0xc8, 0x00, 0x00 };
+
+		ReplayPacket(&Threads[0], TRACE_KIND_HCI_EVENT, HCI_DIRECTION_IN, connect, sizeof(connect), sizeof(connect));
+
+		Remote->Connected = TRUE;
+		Remote->NextAt = Stall.Now + BENCH_STALL_TICKS_PER_MS;
+		return;
+	}
+
+	if (Remote->Burst == 0) {
+		Remote->Burst = 1 + StallRandom() % BENCH_STALL_BURST;
+		Remote->Voice = StallRandom() % 2 == 0;
+	}
+
+	//
+	// A voice burst ends on a button report now and then, like the
+	// remote's does when the button comes up.
+	//
+	StallNotify(Remote, Remote->Voice && (Remote->Burst > 1 || StallRandom() % 2 == 0));
+
+	if (--Remote->Burst != 0) {
+		Remote->NextAt = Stall.Now + 1 + StallRandom() % min(gap, (LONGLONG)30 * BENCH_STALL_TICKS_PER_MS);
+		return;
+	}
+
+	switch (StallRandom() % 8) {
+	case 0:
+	case 1:
+		pause = 1 + StallRandom() % gap;
+		break;
+	case 2:
+		pause = StallRandom() % 2 == 0 ? gap : gap + 1;
+		break;
+	case 3:
+		pause = gap + 1 + StallRandom() % (Stall.Period != 0 ? Stall.Period : gap);
+		break;
+	case 4:
+	case 5:
+		pause = gap + Stall.Period + 1 + StallRandom() % (3 * gap);
+		break;
+	case 6:
+		pause = (LONGLONG)(1000 + StallRandom() % BENCH_STALL_LONGEST) * BENCH_STALL_TICKS_PER_MS;
+		break;
+	default:
+	{
+		//
+		// The remote goes away right after, a quiet remote that
+		// disconnected isn't stalled.
+		//
+		const UCHAR disconnect[] = { HCI_EV_DISCONNECTION_COMPLETE, 0x04, 0x00,
+			(UCHAR)Remote->Handle, (UCHAR)(Remote->Handle >> 8), 0x13 };
+
+		Stall.Now += 1;
+		ShimSetInterruptTime((ULONGLONG)Stall.Now);
+		ReplayPacket(&Threads[0], TRACE_KIND_HCI_EVENT, HCI_DIRECTION_IN, disconnect, sizeof(disconnect), sizeof(disconnect));
+
+		Remote->Connected = FALSE;
+		Remote->Run = 0;
+		Remote->Due = FALSE;
+		Remote->Stalled = FALSE;
+		Remote->Forced = FALSE;
+		Remote->Stalls = 0;
+		Remote->NextAt = Stall.Now + (LONGLONG)(1 + StallRandom() % 10000) * BENCH_STALL_TICKS_PER_MS;
+		Stall.Drops++;
+		return;
+	}
+	}
+
+	if (Remote->Due && pause > Stall.Gap && pause <= Stall.Gap + Stall.Period)
+		Stall.Maybe++;
+	else if (Remote->Due && pause > Stall.Gap)
+		Stall.Seen++;
+
+	Remote->NextAt = Stall.Now + pause;
+}
+
+//
+// Replays BENCH_STALL_REPLAY_MS of interrupt time on a random watchdog
+// configuration and header fix mode.
+//
+VOID
+StallReplay()
+{
+	static const ULONG	gaps[] = { 0, 20, 50, 100, 500, 2000 };
+	PBENCH_THREAD		thread = &Threads[0];
+	ULONG				fixIoctls[] = { IOCTL_FIX_HCI_L2CAP_HEADERS_OFF, IOCTL_FIX_HCI_L2CAP_HEADERS_ON,
+							IOCTL_FIX_HCI_L2CAP_HEADERS_AUTO, IOCTL_FIX_HCI_L2CAP_HEADERS_AUTO };
+	LONGLONG			end;
+	ULONG				fix;
+
+	Stall.Config.GapMs = gaps[StallRandom() % ARRAYSIZE(gaps)];
+	Stall.Config.Actions = StallRandom() % 4;
+	Stall.Config.Flags = StallRandom() % 3 == 0 ? FILTER_WATCHDOG_ANY_GAP : 0;
+	Stall.Gap = (LONGLONG)Stall.Config.GapMs * BENCH_STALL_TICKS_PER_MS;
+	Stall.Period = (LONGLONG)max(Stall.Config.GapMs / 2, (ULONG)20) * BENCH_STALL_TICKS_PER_MS;
+	Stall.RemoteCount = 1 + StallRandom() % BENCH_STALL_REMOTES;
+	Stall.Legacy = StallRandom() % 4 == 0;
+	Stall.Stalls = 0;
+	Stall.Recoveries = 0;
+	Stall.Now = BENCH_STALL_TICKS_PER_MS;
+	end = Stall.Now + (LONGLONG)BENCH_STALL_REPLAY_MS * BENCH_STALL_TICKS_PER_MS;
+
+	fix = StallRandom() % ARRAYSIZE(fixIoctls);
+	Stall.FixMode = fix == 0 ? FIX_HCI_L2CAP_HEADERS_MODE_OFF :
+		fix == 1 ? FIX_HCI_L2CAP_HEADERS_MODE_ON : FIX_HCI_L2CAP_HEADERS_MODE_AUTO;
+
+	memset(Stall.Remotes, 0, sizeof(Stall.Remotes));
+
+	for (ULONG r = 0; r < Stall.RemoteCount; r++) {
+		Stall.Remotes[r].Handle = (USHORT)(SYNTH_FIRST_HANDLE + r);
+		Stall.Remotes[r].NextAt = Stall.Now + StallRandom() % (100 * BENCH_STALL_TICKS_PER_MS);
+	}
+
+	ShimSetInterruptTime((ULONGLONG)Stall.Now);
+
+	//
+	// The CSR8510 is taken for a 4.0 adapter, the AX200 not known until it
+	// says so, which it doesn't here.
+	//
+	if (!StartFilter(Stall.Legacy ? "USB\\VID_0A12&PID_0001" : "USB\\VID_8087&PID_0029")) {
+		Stall.Wrong++;
+		return;
+	}
+
+	if (!SendControl(fixIoctls[fix], NULL, 0, "IOCTL_FIX_HCI_L2CAP_HEADERS") ||
+		!SendControl(IOCTL_SET_WATCHDOG_CONFIG, &Stall.Config, sizeof(Stall.Config), "IOCTL_SET_WATCHDOG_CONFIG")) {
+		StopFilter();
+		Stall.Wrong++;
+		return;
+	}
+
+	while (Stall.Now < end) {
+		LONGLONG	next = end;
+		ULONGLONG	due = ShimNextTimerDue();
+
+		for (ULONG r = 0; r < Stall.RemoteCount; r++)
+			next = min(next, Stall.Remotes[r].NextAt);
+
+		if (due != 0 && (LONGLONG)due < next)
+			next = (LONGLONG)due;
+
+		Stall.Now = max(Stall.Now, next);
+		ShimSetInterruptTime((ULONGLONG)Stall.Now);
+
+		//
+		// A check and a notification at the same time, the check goes
+		// first.
+		//
+		if (due != 0 && (LONGLONG)due <= Stall.Now) {
+			RunTimers(thread, Stall.Now);
+			StallSeen();
+		}
+
+		for (ULONG r = 0; r < Stall.RemoteCount; r++) {
+			PBENCH_STALL_REMOTE remote = &Stall.Remotes[r];
+
+			if (remote->Due && Stall.Now > remote->LastAt + Stall.Gap + Stall.Period) {
+				StallWrong("a stall the watchdog never saw", remote->Handle);
+				remote->Due = FALSE;
+			}
+
+			if (remote->NextAt <= Stall.Now)
+				StallStep(remote);
+		}
+	}
+
+	StallSeen();
+
+	Stall.ReplayedMs += BENCH_STALL_REPLAY_MS;
+
+	SendControl(IOCTL_FIX_HCI_L2CAP_HEADERS_AUTO, NULL, 0, "IOCTL_FIX_HCI_L2CAP_HEADERS_AUTO");
+	StopFilter();
+}
+
+//
+// Replays Replays sessions of remotes streaming and pausing through the
+// stall watchdog, each on its own configuration, and checks every stall
+// it had to see was seen once, by the first check after the gap, that it
+// saw none where there was none, and that the header fix was applied
+// where it had to be. Reports how late the stalls were seen and how fast
+// the replay runs, and returns FALSE if anything was off.
+//
+BOOLEAN
+StallReplays(
+	ULONG	Replays,
+	ULONG	Seed
+)
+{
+	FILTER_WATCHDOG_CONFIG	config;
+	ULONG					stalls = 0;
+	ULONG					recoveries = 0;
+
+	memset(&Stall, 0, sizeof(Stall));
+	Stall.Random = Seed != 0 ? Seed : 1;
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (ULONG i = 0; i < Replays; i++) {
+		StallReplay();
+		stalls += Stall.Stalls;
+		recoveries += Stall.Recoveries;
+	}
+
+	double seconds = Elapsed(start) / 1e9;
+
+	//
+	// The adapters to come get the default again.
+	//
+	config.GapMs = FILTER_WATCHDOG_DEFAULT_GAP_MS;
+	config.Actions = FILTER_WATCHDOG_ACTION_DEFAULT;
+	config.Flags = 0;
+
+	if (StartFilter("USB\\VID_0A12&PID_0001")) {
+		SendControl(IOCTL_SET_WATCHDOG_CONFIG, &config, sizeof(config), "IOCTL_SET_WATCHDOG_CONFIG");
+		StopFilter();
+	}
+
+	printf("%u replays, %.1f h of interrupt time in %.2f s, %.0f times real time\n",
+		(unsigned)Replays, Stall.ReplayedMs / 3600e3, seconds, seconds > 0 ? Stall.ReplayedMs / 1e3 / seconds : 0.0);
+	printf("%llu notifications, %u connections dropped\n", (unsigned long long)Stall.Notifications, (unsigned)Stall.Drops);
+	printf("%u stalls, %u had to be seen, %u could have been missed, seen at most %u%% of the gap late\n",
+		(unsigned)stalls, (unsigned)Stall.Seen, (unsigned)Stall.Maybe, (unsigned)Stall.LateMax);
+	printf("%u recoveries, header fix applied %u times\n", (unsigned)recoveries, (unsigned)Stall.Fixes);
+	printf("%u wrong\n", (unsigned)Stall.Wrong);
+
+	return Stall.Wrong == 0;
+}
+
+VOID
+Usage()
+{
+	printf("Usage: FilterBench <capture> [options]\n");
+	printf("       FilterBench -g <seconds> [options]\n");
+	printf("       FilterBench -B <remotes> -g <seconds> [-j <threads>] [-seed <n>]\n");
+	printf("       FilterBench -R <maps> [-seed <n>]\n");
+	printf("       FilterBench -C\n");
+	printf("       FilterBench -I\n");
+	printf("       FilterBench -L <steps> [-seed <n>]\n");
+	printf("       FilterBench -P <packets> [-seed <n>]\n");
+	printf("       FilterBench -T <programs> [-seed <n>]\n");
+	printf("       FilterBench -K <packets> [-seed <n>]\n");
+	printf("       FilterBench -Z <records> [-seed <n>]\n");
+	printf("       FilterBench -V <seconds> [-seed <n>]\n");
+	printf("       FilterBench -F <events> [-seed <n>]\n");
+	printf("       FilterBench -A <rounds> [-seed <n>]\n");
+	printf("       FilterBench -X <exchanges> [-seed <n>]\n");
+	printf("       FilterBench -H <replays> [-seed <n>]\n");
+	printf("       FilterBench -W <seconds> [-c <remotes>] [-b <hz>] [-p <hz>] [-m <hz>] [-ci <ms>] [-seed <n>]\n");
+	printf("-n <count> to replay the capture that many times\n");
+	printf("-g <seconds> of traffic to generate instead of replaying a capture\n");
+	printf("-c <remotes> generating traffic, default 1, at most %u\n", HCI_MAX_CONNECTIONS);
+	printf("-b <hz> button presses per remote, default %u\n", SYNTH_DEFAULT_BUTTON_HZ);
+	printf("-p <hz> trackpad touches per remote, default %u\n", SYNTH_DEFAULT_TOUCH_HZ);
+	printf("-m <hz> trackpad moves while touched, default %u\n", SYNTH_DEFAULT_MOVE_HZ);
+	printf("-s <hz> voice frames during a burst, default %u, 0 for no voice\n", SYNTH_DEFAULT_VOICE_HZ);
+	printf("-seed <n> of the generated traffic\n");
+	printf("-x <times> the real rate to generate at, default as fast as it goes\n");
+	printf("-j <threads> to generate the traffic on 1, 2, 4 up to that many threads, at most %u\n", BENCH_MAX_THREADS);
+	printf("-id <hardware id> of the adapter, default USB\\VID_0A12&PID_0001\n");
+	printf("-e <ms> to decode reports into events, coalescing moves over that many ms\n");
+	printf("-l <packets> to read the events every that many packets and time their stages,\n");
+	printf("   decodes reports into events without -e, and check their timestamps\n");
+	printf("-a <us> acting on an event read with -l takes, default 0\n");
+	printf("-drop, -dup, -swap, -cut <per mille> of the voice frames to lose, repeat, reorder\n");
+	printf("   or cut short before the filter and check the voice sessions it counts, not with -j\n");
+	printf("-q <offset> of the frame counter in a voice frame of the capture, -hz <n> their rate\n");
+	printf("-f to always apply the HCI/L2CAP headers fix\n");
+	printf("-ci <ms> connection interval the generated moves are sent at, default each as it is\n");
+	printf("   sampled\n");
+	printf("-S <ms> to smooth the trackpad positions as they are read, predicting <ms> ahead, and\n");
+	printf("   measure the jitter and lag it makes, reading the events every 8 packets without -l\n");
+	printf("-min, -beta, -d <mHz> the cutoff when still, its rise per unit/s and the speed's cutoff\n");
+	printf("   of -S, default %u, %u and %u\n", FILTER_SMOOTH_DEFAULT_MIN_CUTOFF, FILTER_SMOOTH_DEFAULT_BETA,
+		FILTER_SMOOTH_DEFAULT_D_CUTOFF);
+	printf("-report <us> of -S, default %u, 0 for the arrival times\n", FILTER_SMOOTH_DEFAULT_REPORT_US);
+	printf("-G to generate touches that are gestures and check what the gesture recognizer\n");
+	printf("   makes of them, reading the events every 8 packets without -l, not with -j\n");
+	printf("-B <remotes> to press buttons on that many simulated remotes per thread for -g seconds\n");
+	printf("   of injected time and check and time the actions the button engine makes of them,\n");
+	printf("   without the filter, on -j threads\n");
+	printf("-R <maps> to check and time compiling report maps and decoding reports with them, the\n");
+	printf("   real ones and that many random and mutated ones, without the filter\n");
+	printf("-M to have the host read a Report Map of each generated remote and check the filter\n");
+	printf("   decodes its reports with it\n");
+	printf("-C to inject a notification gap, a truncated packet, a failed send and a watchdog\n");
+	printf("   stall and check the capture window each trigger freezes, also with two adapters\n");
+	printf("-I to replay the init sequences of several adapters and MTU exchanges, some written\n");
+	printf("   and read in MDLs, and check the limits and header fix the filter works out\n");
+	printf("-L <steps> of remotes connecting, disconnecting mostly unseen, reusing handles and\n");
+	printf("   sending ATT before their connection event, checking the filter's connection table\n");
+	printf("-P <packets> to run through the matchers of each profile, checking and timing them,\n");
+	printf("   after checking the profiles hardware IDs pick\n");
+	printf("-T <programs> to load, random and mutated, checking which the trace filter takes and\n");
+	printf("   what they do with packets, then time it\n");
+	printf("-K <packets> to check the tracepoint ring and time tracing them through the filter\n");
+	printf("-Z <records> to encode and decode as a capture stream, checking the round trip and\n");
+	printf("   decoding random and mutated streams\n");
+	printf("-W <seconds> of generated reports to coalesce with several windows, checking the\n");
+	printf("   events and counting them\n");
+	printf("-V <seconds> of remotes pressing buttons while flooding the event reader with voice,\n");
+	printf("   checking every press is read in time\n");
+	printf("-F <events> to queue for up to %u subscribers reading at their own pace, checking\n",
+		FILTER_EVENT_MAX_SUBSCRIBERS);
+	printf("   what each reads and loses\n");
+	printf("-A <rounds> of activating remotes while the host keeps them busy, on several splits\n");
+	printf("   of the controller's buffers, checking the buffers and ATT requests the filter adds\n");
+	printf("-X <exchanges> of ATT with remotes answering late, in error or not at all, checking what\n");
+	printf("   the filter counts for them\n");
+	printf("-H <replays> of remotes streaming and pausing through the stall watchdog on random\n");
+	printf("   configurations, checking the stalls it sees and the header fix it applies\n");
+	printf("-t to trace like a user would, every tracepoint and capture trigger\n");
+	printf("-v to print the driver's debug output\n");
+}
+
+int
+main(
+	int		argc,
+	char *	argv[]
+)
+{
+	SYNTH_CONFIG		synth;
+	BENCH_PACING		pacing;
+	static BENCH_STATS	total;
+	const char *		capture = NULL;
+	const char *		hardwareId = "USB\\VID_0A12&PID_0001";
+	ULONG				repeat = 1;
+	ULONG				seconds = 0;
+	ULONG				workers = 0;
+	ULONG				buttonRemotes = 0;
+	ULONG				churnSteps = 0;
+	ULONG				profilePackets = 0;
+	ULONG				tracePrograms = 0;
+	ULONG				tracepointPackets = 0;
+	ULONG				capStreamRecords = 0;
+	ULONG				coalesceSeconds = 0;
+	ULONG				floodSeconds = 0;
+	ULONG				fanoutEvents = 0;
+	ULONG				activateRounds = 0;
+	ULONG				attExchanges = 0;
+	ULONG				stallReplays = 0;
+	LONG				coalesceMs = -1;
+	LONG				reportMaps = -1;
+	BOOLEAN				readMaps = FALSE;
+	BOOLEAN				captures = FALSE;
+	BOOLEAN				initSequences = FALSE;
+	BOOLEAN				mapsRight = TRUE;
+	BOOLEAN				voiceRight;
+	BOOLEAN				gesturesRight;
+	BOOLEAN				stampsRight = TRUE;
+	BOOLEAN				trace = FALSE;
+	BOOLEAN				fix = FALSE;
+	USHORT				sequenceOffset = FILTER_VOICE_NO_SEQUENCE;
+	USHORT				frameHz = 0;
+	LONGLONG			offset = 1;
+	ULONGLONG			generated = 0;
+	ULONGLONG			elapsed = 0;
+	ULONGLONG			failed;
+	FILE *				file = NULL;
+
+	memset(&synth, 0, sizeof(synth));
+	synth.Connections = 1;
+	synth.ButtonHz = SYNTH_DEFAULT_BUTTON_HZ;
+	synth.TouchHz = SYNTH_DEFAULT_TOUCH_HZ;
+	synth.TouchMs = SYNTH_DEFAULT_TOUCH_MS;
+	synth.MoveHz = SYNTH_DEFAULT_MOVE_HZ;
+	synth.VoiceEveryMs = SYNTH_DEFAULT_VOICE_EVERY_MS;
+	synth.VoiceBurstMs = SYNTH_DEFAULT_VOICE_BURST_MS;
+	synth.VoiceHz = SYNTH_DEFAULT_VOICE_HZ;
+	synth.VoiceLength = SYNTH_DEFAULT_VOICE_LENGTH;
+
+	memset(&pacing, 0, sizeof(pacing));
+
+	Smoothing.Config.Enable = 1;
+	Smoothing.Config.MinCutoffMilliHz = FILTER_SMOOTH_DEFAULT_MIN_CUTOFF;
+	Smoothing.Config.Beta = FILTER_SMOOTH_DEFAULT_BETA;
+	Smoothing.Config.DerivativeCutoffMilliHz = FILTER_SMOOTH_DEFAULT_D_CUTOFF;
+	Smoothing.Config.ReportUs = FILTER_SMOOTH_DEFAULT_REPORT_US;
+
+	for (int i = 1; i < argc; i++) {
+		const char * arg = argv[i];
+		const char * value = i + 1 < argc ? argv[i + 1] : NULL;
+
+		if (arg[0] != '-' && capture == NULL) {
+			capture = arg;
+		} else if (!strcmp(arg, "-v")) {
+			ShimDebugOutput = TRUE;
+		} else if (!strcmp(arg, "-t")) {
+			trace = TRUE;
+		} else if (!strcmp(arg, "-f")) {
+			fix = TRUE;
+		} else if (!strcmp(arg, "-G")) {
+			synth.Gestures = 1;
+		} else if (!strcmp(arg, "-M")) {
+			readMaps = TRUE;
+		} else if (!strcmp(arg, "-C")) {
+			captures = TRUE;
+		} else if (!strcmp(arg, "-I")) {
+			initSequences = TRUE;
+		} else if (value == NULL) {
+			Usage();
+			return 1;
+		} else if (!strcmp(arg, "-n")) {
+			repeat = max(strtoul(value, NULL, 0), 1UL);
+			i++;
+		} else if (!strcmp(arg, "-g")) {
+			seconds = strtoul(value, NULL, 0);
+			i++;
+		} else if (!strcmp(arg, "-c")) {
+			synth.Connections = min(strtoul(value, NULL, 0), (unsigned long)HCI_MAX_CONNECTIONS);
+			i++;
+		} else if (!strcmp(arg, "-b")) {
+			synth.ButtonHz = strtoul(value, NULL, 0);
+			i++;
+		} else if (!strcmp(arg, "-p")) {
+			synth.TouchHz = strtoul(value, NULL, 0);
+			i++;
+		} else if (!strcmp(arg, "-m")) {
+			synth.MoveHz = strtoul(value, NULL, 0);
+			i++;
+		} else if (!strcmp(arg, "-s")) {
+			synth.VoiceHz = strtoul(value, NULL, 0);
+			i++;
+		} else if (!strcmp(arg, "-seed")) {
+			synth.Seed = strtoul(value, NULL, 0);
+			i++;
+		} else if (!strcmp(arg, "-x")) {
+			pacing.Speedup = strtoul(value, NULL, 0);
+			i++;
+		} else if (!strcmp(arg, "-B")) {
+			buttonRemotes = strtoul(value, NULL, 0);
+			i++;
+		} else if (!strcmp(arg, "-L")) {
+			churnSteps = strtoul(value, NULL, 0);
+			i++;
+		} else if (!strcmp(arg, "-P")) {
+			profilePackets = strtoul(value, NULL, 0);
+			i++;
+		} else if (!strcmp(arg, "-T")) {
+			tracePrograms = strtoul(value, NULL, 0);
+			i++;
+		} else if (!strcmp(arg, "-K")) {
+			tracepointPackets = strtoul(value, NULL, 0);
+			i++;
+		} else if (!strcmp(arg, "-Z")) {
+			capStreamRecords = strtoul(value, NULL, 0);
+			i++;
+		} else if (!strcmp(arg, "-W")) {
+			coalesceSeconds = strtoul(value, NULL, 0);
+			i++;
+		} else if (!strcmp(arg, "-V")) {
+			floodSeconds = strtoul(value, NULL, 0);
+			i++;
+		} else if (!strcmp(arg, "-F")) {
+			fanoutEvents = strtoul(value, NULL, 0);
+			i++;
+		} else if (!strcmp(arg, "-A")) {
+			activateRounds = strtoul(value, NULL, 0);
+			i++;
+		} else if (!strcmp(arg, "-X")) {
+			attExchanges = strtoul(value, NULL, 0);
+			i++;
+		} else if (!strcmp(arg, "-H")) {
+			stallReplays = strtoul(value, NULL, 0);
+			i++;
+		} else if (!strcmp(arg, "-R")) {
+			reportMaps = (LONG)strtoul(value, NULL, 0);
+			i++;
+		} else if (!strcmp(arg, "-j")) {
+			workers = min(strtoul(value, NULL, 0), (unsigned long)BENCH_MAX_THREADS);
+			i++;
+		} else if (!strcmp(arg, "-id")) {
+			hardwareId = value;
+			i++;
+		} else if (!strcmp(arg, "-e")) {
+			coalesceMs = (LONG)strtoul(value, NULL, 0);
+			i++;
+		} else if (!strcmp(arg, "-l")) {
+			Consumer.Every = strtoul(value, NULL, 0);
+			i++;
+		} else if (!strcmp(arg, "-a")) {
+			Consumer.ActionTicks = strtoul(value, NULL, 0) * (BENCH_READER_FREQUENCY / 1000000);
+			i++;
+		} else if (!strcmp(arg, "-drop")) {
+			Impair.DropPerMille = strtoul(value, NULL, 0);
+			i++;
+		} else if (!strcmp(arg, "-dup")) {
+			Impair.DupPerMille = strtoul(value, NULL, 0);
+			i++;
+		} else if (!strcmp(arg, "-swap")) {
+			Impair.SwapPerMille = strtoul(value, NULL, 0);
+			i++;
+		} else if (!strcmp(arg, "-cut")) {
+			Impair.CutPerMille = strtoul(value, NULL, 0);
+			i++;
+		} else if (!strcmp(arg, "-q")) {
+			sequenceOffset = (USHORT)strtoul(value, NULL, 0);
+			i++;
+		} else if (!strcmp(arg, "-hz")) {
+			frameHz = (USHORT)strtoul(value, NULL, 0);
+			i++;
+		} else if (!strcmp(arg, "-ci")) {
+			synth.IntervalUs = strtoul(value, NULL, 0) * 1000;
+			i++;
+		} else if (!strcmp(arg, "-S")) {
+			Smoothing.Enabled = TRUE;
+			Smoothing.Config.LookaheadMs = strtoul(value, NULL, 0);
+			i++;
+		} else if (!strcmp(arg, "-min")) {
+			Smoothing.Config.MinCutoffMilliHz = strtoul(value, NULL, 0);
+			i++;
+		} else if (!strcmp(arg, "-beta")) {
+			Smoothing.Config.Beta = strtoul(value, NULL, 0);
+			i++;
+		} else if (!strcmp(arg, "-d")) {
+			Smoothing.Config.DerivativeCutoffMilliHz = strtoul(value, NULL, 0);
+			i++;
+		} else if (!strcmp(arg, "-report")) {
+			Smoothing.Config.ReportUs = strtoul(value, NULL, 0);
+			i++;
+		} else {
+			Usage();
+			return 1;
+		}
+	}
+
+	//
+	// The button engine runs on its own, the filter isn't loaded.
+	//
+	if (buttonRemotes != 0) {
+		if (capture != NULL || seconds == 0) {
+			Usage();
+			return 1;
+		}
+
+		return Buttons(buttonRemotes, seconds, workers, synth.Seed) ? 0 : 2;
+	}
+
+	//
+	// So does the report map compiler and decoder.
+	//
+	if (reportMaps >= 0) {
+		if (capture != NULL || seconds != 0) {
+			Usage();
+			return 1;
+		}
+
+		return ReportMaps((ULONG)reportMaps, synth.Seed) ? 0 : 2;
+	}
+
+	//
+	// And the connection churn.
+	//
+	if (churnSteps != 0) {
+		if (capture != NULL || seconds != 0) {
+			Usage();
+			return 1;
+		}
+
+		return Churn(churnSteps, synth.Seed) ? 0 : 2;
+	}
+
+	//
+	// And the controller profiles.
+	//
+	if (profilePackets != 0) {
+		if (capture != NULL || seconds != 0) {
+			Usage();
+			return 1;
+		}
+
+		return Profiles(profilePackets, synth.Seed) ? 0 : 2;
+	}
+
+	//
+	// And the trace filter.
+	//
+	if (tracePrograms != 0) {
+		if (capture != NULL || seconds != 0) {
+			Usage();
+			return 1;
+		}
+
+		return TraceFilters(tracePrograms, synth.Seed) ? 0 : 2;
+	}
+
+	//
+	// And the tracepoints.
+	//
+	if (tracepointPackets != 0) {
+		if (capture != NULL || seconds != 0) {
+			Usage();
+			return 1;
+		}
+
+		return Tracepoints(tracepointPackets, synth.Seed) ? 0 : 2;
+	}
+
+	//
+	// And the capture stream encoding.
+	//
+	if (capStreamRecords != 0) {
+		if (capture != NULL || seconds != 0) {
+			Usage();
+			return 1;
+		}
+
+		return CapStreams(capStreamRecords, synth.Seed) ? 0 : 2;
+	}
+
+	//
+	// And the coalescer.
+	//
+	if (coalesceSeconds != 0) {
+		if (capture != NULL || seconds != 0) {
+			Usage();
+			return 1;
+		}
+
+		return Coalescing(coalesceSeconds, &synth) ? 0 : 2;
+	}
+
+	//
+	// And button latency under a voice flood.
+	//
+	if (floodSeconds != 0) {
+		if (capture != NULL || seconds != 0) {
+			Usage();
+			return 1;
+		}
+
+		return VoiceFlood(floodSeconds, synth.Seed) ? 0 : 2;
+	}
+
+	//
+	// And the event queue fanned out to its subscribers.
+	//
+	if (fanoutEvents != 0) {
+		if (capture != NULL || seconds != 0) {
+			Usage();
+			return 1;
+		}
+
+		return Fanout(fanoutEvents, synth.Seed) ? 0 : 2;
+	}
+
+	//
+	// And the activations sharing the controller's buffers with the host.
+	//
+	if (activateRounds != 0) {
+		if (capture != NULL || seconds != 0) {
+			Usage();
+			return 1;
+		}
+
+		return Activations(activateRounds, synth.Seed) ? 0 : 2;
+	}
+
+	//
+	// And what the filter counts of ATT exchanges.
+	//
+	if (attExchanges != 0) {
+		if (capture != NULL || seconds != 0) {
+			Usage();
+			return 1;
+		}
+
+		return AttExchanges(attExchanges, synth.Seed) ? 0 : 2;
+	}
+
+	//
+	// And the stalls the watchdog sees.
+	//
+	if (stallReplays != 0) {
+		if (capture != NULL || seconds != 0) {
+			Usage();
+			return 1;
+		}
+
+		return StallReplays(stallReplays, synth.Seed) ? 0 : 2;
+	}
+
+	//
+	// So does each adapter's init sequence.
+	//
+	if (initSequences) {
+		if (capture != NULL || seconds != 0) {
+			Usage();
+			return 1;
+		}
+
+		return InitSequences() ? 0 : 2;
+	}
+
+	//
+	// The capture triggers get a filter of their own.
+	//
+	if (captures) {
+		if (capture != NULL || seconds != 0) {
+			Usage();
+			return 1;
+		}
+
+		return Captures(hardwareId) ? 0 : 2;
+	}
+
+	//
+	// The host reads each remote's Report Map after connecting.
+	//
+	if (readMaps) {
+		if (capture != NULL) {
+			Usage();
+			return 1;
+		}
+
+		synth.ReportMap = BenchSiriMap;
+		synth.ReportMapLength = sizeof(BenchSiriMap);
+	}
+
+	if ((capture == NULL) == (seconds == 0) ||
+		(workers != 0 && (capture != NULL || Consumer.Every != 0 ||
+			Impair.DropPerMille + Impair.DupPerMille + Impair.SwapPerMille + Impair.CutPerMille != 0))) {
+		Usage();
+		return 1;
+	}
+
+	Impair.Random = synth.Seed != 0 ? synth.Seed : 0x2545F491;
+
+	if (synth.Gestures) {
+		if (capture != NULL || workers != 0) {
+			Usage();
+			return 1;
+		}
+
+		Gestures.Enabled = TRUE;
+		GestureInit(&Gestures.State, NULL);
+
+		if (Consumer.Every == 0)
+			Consumer.Every = 8;
+	}
+
+	//
+	// Every move is an event of its own, the smoothing runs per report.
+	//
+	if (Smoothing.Enabled) {
+		if (workers != 0 || coalesceMs > 0) {
+			Usage();
+			return 1;
+		}
+
+		SmoothConfigure(&Smoothing.Params, &Smoothing.Config);
+
+		if (Consumer.Every == 0)
+			Consumer.Every = 8;
+	}
+
+	//
+	// Generated voice frames count themselves in their first byte.
+	//
+	if (capture == NULL) {
+		sequenceOffset = 0;
+		frameHz = (USHORT)synth.VoiceHz;
+	}
+
+	//
+	// One thread passing generated frames, the voice accounting must come
+	// out as VoiceTruth follows it.
+	//
+	VoiceTruth.Checked = capture == NULL && workers == 0;
+	VoiceTruth.Period = frameHz != 0 ? 10000000 / frameHz : 0;
+
+	if (capture != NULL) {
+		file = fopen(capture, "rb");
+		if (file == NULL) {
+			printf("Couldn't open %s\n", capture);
+			return 1;
+		}
+	}
+
+	if (!StartFilter(hardwareId)) {
+		if (file != NULL)
+			fclose(file);
+		return 1;
+	}
+
+	if (Consumer.Every != 0 && coalesceMs < 0)
+		coalesceMs = 0;
+
+	Consumer.Coalescing = coalesceMs > 0;
+
+	if ((coalesceMs >= 0 && !SetEventConfig((ULONG)coalesceMs)) ||
+		(trace && !SetTracing()) ||
+		(fix && !SendControl(IOCTL_FIX_HCI_L2CAP_HEADERS_ON, NULL, 0, "IOCTL_FIX_HCI_L2CAP_HEADERS_ON")) ||
+		!SetVoiceConfig(sequenceOffset, frameHz) ||
+		(Consumer.Every != 0 && !ConsumerOpen(&Consumer))) {
+		StopFilter();
+		if (file != NULL)
+			fclose(file);
+		return 1;
+	}
+
+	if (file != NULL) {
+		for (ULONG i = 0; i < repeat; i++) {
+			LONGLONG last = ReplayCapture(file, offset);
+
+			if (last == 0) {
+				printf("%s is not a capture file\n", capture);
+				break;
+			}
+
+			//
+			// The next pass starts a second after this one ended.
+			//
+			offset = last + 10000000;
+		}
+
+		fclose(file);
+	} else if (workers != 0) {
+		//
+		// The main thread connects the remotes, the workers then share
+		// them.
+		//
+		SYNTH_CONFIG connect = synth;
+
+		connect.ButtonHz = 0;
+		connect.TouchHz = 0;
+		connect.VoiceHz = 0;
+		Generate(&connect, 0, &pacing, &generated);
+
+		Scale(&synth, seconds, workers, &total);
+	} else {
+		elapsed = Generate(&synth, seconds, &pacing, &generated);
+	}
+
+	if (Consumer.Every != 0) {
+		Consume(&Consumer, TRUE);
+		ShimCloseControl(Consumer.Handle);
+		free(Consumer.Buffer);
+	}
+
+	failed = Adapter.Failed;
+
+	voiceRight = PrintVoiceStats();
+	gesturesRight = PrintGestures();
+	PrintSmoothing();
+
+	if (readMaps)
+		mapsRight = CheckReportMaps(synth.Connections);
+
+	StopFilter();
+
+	AddStats(&total, &Threads[0].Stats);
+
+	PrintPaths("Path", PathNames, total.Paths, BENCH_PATHS);
+
+	if (capture == NULL) {
+		printf("\n");
+		PrintPaths("Report", TypeNames, total.Types, SYNTH_PACKET_TYPES);
+	}
+
+	if (capture == NULL && workers == 0) {
+		double wall = (double)elapsed / 1e9;
+
+		printf("\n%u remotes, %llu packets of %u s in %.3f s, %.0f packets/s, %.1f times the real rate\n",
+			(unsigned)synth.Connections,
+			(unsigned long long)generated,
+			(unsigned)seconds,
+			wall,
+			wall > 0 ? generated / wall : 0.0,
+			wall > 0 ? seconds / wall : 0.0);
+
+		if (pacing.Speedup != 0) {
+			printf("Paced at %u times, %llu packets late, by %.1f us on average and %.1f us at most\n",
+				(unsigned)pacing.Speedup,
+				(unsigned long long)pacing.Behind,
+				pacing.Behind != 0 ? (double)pacing.TotalLag / pacing.Behind / 1000 : 0.0,
+				(double)pacing.MaxLag / 1000);
+		}
+	}
+
+	if (workers == 0) {
+		printf("Latency p50 %llu ns, p99 %llu ns, p99.9 %llu ns, max %llu ns\n",
+			(unsigned long long)LatencyPercentile(&total.Latency, 50),
+			(unsigned long long)LatencyPercentile(&total.Latency, 99),
+			(unsigned long long)LatencyPercentile(&total.Latency, 99.9),
+			(unsigned long long)total.Latency.Max);
+	}
+
+	printf("Hidden reads %llu, injected writes %llu, failed URBs %llu\n",
+		(unsigned long long)total.Hidden,
+		(unsigned long long)Adapter.Injected.load(),
+		(unsigned long long)failed);
+
+	if (Consumer.Every != 0) {
+		PrintStages("Input", &Consumer.Input);
+		PrintStages("Voice", &Consumer.Voice);
+
+		printf("\n%llu reads, %llu events and %llu voice frames lost, clock sampled to %.1f us\n",
+			(unsigned long long)Consumer.Reads,
+			(unsigned long long)Consumer.Lost,
+			(unsigned long long)Consumer.VoiceLost,
+			(double)Consumer.Input.Clock.RoundTrip / (BENCH_READER_FREQUENCY / 1000000));
+
+		ULONGLONG negative = 0;
+
+		for (ULONG i = 0; i < LATENCY_STAGES; i++)
+			negative += Consumer.Input.Stages[i].Negative + Consumer.Voice.Stages[i].Negative;
+
+		printf("%llu timestamps checked, %llu out of order or outside their window, %llu stage times below 0, "
+			"reads mapped at most %.1f us outside themselves\n",
+			(unsigned long long)Consumer.Stamps,
+			(unsigned long long)Consumer.Wrong,
+			(unsigned long long)negative,
+			(double)Consumer.MaxSkew / (BENCH_READER_FREQUENCY / 1000000));
+
+		stampsRight = Consumer.Wrong == 0 && negative == 0;
+	}
+
+	return mapsRight && voiceRight && gesturesRight && stampsRight ? 0 : 2;
+}
@@ -0,0 +1,173 @@
+/*
+ * IGattTransport of a simulated remote, for timing activation without one.
+ *
+ * Every call first takes HostDelay, the stack's own latency, which calls
+ * issued together overlap. A request then waits for the connection's one
+ * ATT request in flight and takes RoundTrip for each request/response pair
+ * it is made of. Writes without response don't wait for anything over the
+ * air.
+ */
+using System;
+using System.Threading;
+using System.Threading.Tasks;
+
+namespace ConsoleApp
+{
+    sealed class MockGattTransport : IGattTransport
+    {
+        //
+        // ATT exchanges of an uncached discovery: the service by UUID and the
+        // empty page that ends it, the characteristics and theirs, and the
+        // descriptors of the battery level and theirs.
+        //
+        const int ServiceRoundTrips = 2;
+        const int CharacteristicRoundTrips = 2;
+        const int DescriptorRoundTrips = 2;
+
+        readonly SemaphoreSlim bearer = new SemaphoreSlim(1, 1);
+        int roundTrips;
+        int outstanding;
+        int mostOutstanding;
+
+        public MockGattTransport(TimeSpan roundTrip, TimeSpan hostDelay)
+        {
+            RoundTrip = roundTrip;
+            HostDelay = hostDelay;
+            SystemCache = true;
+            Handles = new GattHandleMap
+            {
+                BatteryLevel = 0x002a,
+                BatteryLevelDescriptors = new ushort[] { 0x002c, 0x002d },
+                BatteryPowerState = 0x002f,
+            };
+        }
+
+        public TimeSpan RoundTrip { get; }
+
+        public TimeSpan HostDelay { get; }
+
+        /// <summary>
+        ///     Whether the system kept the remote's attributes from an earlier
+        ///     discovery, else a cached discovery goes over the air too.
+        /// </summary>
+        public bool SystemCache { get; set; }
+
+        /// <summary>
+        ///     The remote's attribute layout.
+        /// </summary>
+        public GattHandleMap Handles { get; set; }
+
+        public int RoundTrips
+        {
+            get { return Volatile.Read(ref roundTrips); }
+        }
+
+        /// <summary>
+        ///     Most calls that were issued and not yet answered at once.
+        /// </summary>
+        public int MostOutstanding
+        {
+            get { return Volatile.Read(ref mostOutstanding); }
+        }
+
+        async Task Request(int exchanges)
+        {
+            var now = Interlocked.Increment(ref outstanding);
+            int most;
+
+            while ((most = Volatile.Read(ref mostOutstanding)) < now &&
+                Interlocked.CompareExchange(ref mostOutstanding, now, most) != most)
+            {
+            }
+
+            try
+            {
+                await Task.Delay(HostDelay);
+
+                if (exchanges == 0)
+                    return;
+
+                await bearer.WaitAsync();
+
+                try
+                {
+                    for (int i = 0; i < exchanges; i++)
+                        await Task.Delay(RoundTrip);
+
+                    Interlocked.Add(ref roundTrips, exchanges);
+                }
+                finally
+                {
+                    bearer.Release();
+                }
+            }
+            finally
+            {
+                Interlocked.Decrement(ref outstanding);
+            }
+        }
+
+        GattHandleMap Copy()
+        {
+            return new GattHandleMap
+            {
+                BatteryLevel = Handles.BatteryLevel,
+                BatteryLevelDescriptors = (ushort[])Handles.BatteryLevelDescriptors.Clone(),
+                BatteryPowerState = Handles.BatteryPowerState,
+            };
+        }
+
+        public async Task<GattHandleMap> DiscoverAsync(bool cached)
+        {
+            if (cached && SystemCache)
+            {
+                await Request(0);
+            }
+            else
+            {
+                await Request(ServiceRoundTrips);
+                await Request(CharacteristicRoundTrips);
+                await Request(DescriptorRoundTrips);
+            }
+
+            return Copy();
+        }
+
+        bool Known(ushort handle)
+        {
+            return handle != 0 &&
+                (handle == Handles.BatteryLevel ||
+                 handle == Handles.BatteryPowerState ||
+                 Array.IndexOf(Handles.BatteryLevelDescriptors, handle) >= 0);
+        }
+
+        public async Task<byte[]> ReadAsync(ushort handle)
+        {
+            await Request(1);
+            return handle == Handles.BatteryLevel ? new byte[] { 100 } : null;
+        }
+
+        public async Task<bool> WriteAsync(ushort handle, byte[] value, bool withResponse)
+        {
+            await Request(withResponse ? 1 : 0);
+            return Known(handle);
+        }
+
+        public async Task<bool> WriteDescriptorAsync(ushort handle, byte[] value)
+        {
+            await Request(1);
+            return Known(handle);
+        }
+
+        public async Task<bool> SubscribeAsync(ushort handle, NotificationChannel channel)
+        {
+            await Request(1);
+            return Known(handle);
+        }
+
+        public void Dispose()
+        {
+            bearer.Dispose();
+        }
+    }
+}
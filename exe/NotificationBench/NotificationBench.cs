@@ -0,0 +1,134 @@
+/*
+ * Measures the console app's notification processing against the handler
+ * it replaced, on any platform with BenchmarkDotNet:
+ *
+ *     dotnet run -c Release --project exe/NotificationBench
+ *
+ * Both print every notification as a hex line to a writer that flushes
+ * like the console does and throws the text away, so what is measured is
+ * the processing and the allocations, not the terminal.
+ */
+using System;
+using System.IO;
+using System.Text;
+
+using BenchmarkDotNet.Attributes;
+using BenchmarkDotNet.Running;
+
+namespace ConsoleApp
+{
+    [MemoryDiagnoser]
+    public class NotificationBenchmarks
+    {
+        const int Notifications = 1024;
+
+        /// <summary>
+        ///     20 bytes for button and trackpad reports, 104 for voice frames.
+        /// </summary>
+        [Params(20, 104)]
+        public int ValueLength;
+
+        byte[][] values;
+        TextWriter output;
+        NotificationPipeline pipeline;
+
+        [GlobalSetup]
+        public void Setup()
+        {
+            var random = new Random(1);
+
+            values = new byte[Notifications][];
+
+            for (int i = 0; i < Notifications; i++)
+            {
+                values[i] = new byte[ValueLength];
+                random.NextBytes(values[i]);
+            }
+
+            output = new StreamWriter(Stream.Null) { AutoFlush = true };
+            pipeline = new NotificationPipeline(output);
+        }
+
+        [GlobalCleanup]
+        public void Cleanup()
+        {
+            pipeline.Dispose();
+        }
+
+        /// <summary>
+        ///     The ValueChanged handler before the pipeline, with the copy out of the
+        ///     IBuffer done like CryptographicBuffer.CopyToByteArray does it.
+        /// </summary>
+        static void CurrentHandler(byte[] value, TextWriter output)
+        {
+            byte[] data = new byte[value.Length];
+            string strData = null;
+
+            Buffer.BlockCopy(value, 0, data, 0, value.Length);
+
+            StringBuilder hex = new StringBuilder(data.Length * 2);
+
+            for (int j = 0; j < data.Length; j++)
+            {
+                char ch = Convert.ToChar(data[j]);
+                hex.AppendFormat(" {0:x2}", data[j]);
+
+                if (ch != '\0')
+                {
+                    strData = strData + ch;
+                }
+            }
+
+            if (data.Length > 13 && data.Length < 100)
+                hex.AppendFormat("...<- Voice data most likely truncated.");
+
+            output.WriteLine($"Notification :{hex}");
+        }
+
+        [Benchmark(Baseline = true, OperationsPerInvoke = Notifications)]
+        public void Handler()
+        {
+            for (int i = 0; i < Notifications; i++)
+                CurrentHandler(values[i], output);
+        }
+
+        /// <summary>
+        ///     The callback's half and the consumer's half on one thread, filling the
+        ///     channel and then processing what queued up in batches.
+        /// </summary>
+        [Benchmark(OperationsPerInvoke = Notifications)]
+        public void Pipeline()
+        {
+            var channel = pipeline.Channel;
+
+            for (int i = 0; i < Notifications; i++)
+            {
+                if (i % NotificationPipeline.DefaultCapacity == 0)
+                    Drain();
+
+                channel.TryPublish(values[i], values[i].Length, i);
+            }
+
+            Drain();
+        }
+
+        void Drain()
+        {
+            while (pipeline.ProcessBatch(false) != 0)
+            {
+            }
+        }
+    }
+
+    static class NotificationBench
+    {
+        static int Main(string[] args)
+        {
+            if (args.Length == 1 && args[0] == "--check")
+                return StartupBenchmarks.Check(Console.Out) ? 0 : 2;
+
+            BenchmarkSwitcher.FromTypes(new[] { typeof(NotificationBenchmarks), typeof(StartupBenchmarks) }).Run(args);
+            return 0;
+        }
+    }
+}
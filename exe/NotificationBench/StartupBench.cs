@@ -0,0 +1,210 @@
+/*
+ * Times activating a remote over MockGattTransport: discovering the handles
+ * or taking the kept ones, then subscribing, enabling the battery level's
+ * descriptors and sending the magic packet. The baseline discovers every
+ * time and waits for each write before the next, like the console app did.
+ *
+ *     dotnet run -c Release --project exe/NotificationBench -- --filter *Startup*
+ *
+ * With --check instead it activates once per case, with kept handles that
+ * still answer, changed, don't parse or aren't in the system's cache, and
+ * checks the round trips each took, the kept map and how many writes were
+ * in flight at once. It exits with 2 if anything was off.
+ */
+using System;
+using System.IO;
+using System.Linq;
+using System.Threading.Tasks;
+
+using BenchmarkDotNet.Attributes;
+
+namespace ConsoleApp
+{
+    [MemoryDiagnoser]
+    public class StartupBenchmarks
+    {
+        /// <summary>
+        ///     Two connection events of a 15ms connection interval.
+        /// </summary>
+        static readonly TimeSpan RoundTrip = TimeSpan.FromMilliseconds(30);
+        static readonly TimeSpan HostDelay = TimeSpan.FromMilliseconds(2);
+
+        static readonly Action<string> Quiet = message => { };
+
+        [Params(false, true)]
+        public bool KeptHandles;
+
+        [Params(false, true)]
+        public bool Pipelined;
+
+        string cachePath;
+        NotificationChannel channel;
+
+        [GlobalSetup]
+        public void Setup()
+        {
+            cachePath = Path.Combine(Path.GetTempPath(), "NotificationBench.gatt");
+            channel = new NotificationChannel(NotificationPipeline.DefaultCapacity, NotificationPipeline.DefaultBufferSize);
+
+            using (var transport = new MockGattTransport(RoundTrip, HostDelay))
+                transport.Handles.Save(cachePath);
+        }
+
+        [GlobalCleanup]
+        public void Cleanup()
+        {
+            File.Delete(cachePath);
+        }
+
+        [Benchmark]
+        public async Task<bool> Startup()
+        {
+            using (var transport = new MockGattTransport(RoundTrip, HostDelay))
+            {
+                var map = await RemoteActivation.GetHandleMapAsync(transport, KeptHandles ? cachePath : null, Quiet);
+
+                return await RemoteActivation.ActivateAsync(transport, map, channel, Pipelined, Quiet);
+            }
+        }
+
+        //
+        // Round trips of an uncached discovery, and of activating: the
+        // subscription and the two descriptor writes, the magic packet has no
+        // response.
+        //
+        const int DiscoveryRoundTrips = 6;
+        const int ActivationRoundTrips = 3;
+
+        static readonly GattHandleMap Moved = new GattHandleMap
+        {
+            BatteryLevel = 0x0032,
+            BatteryLevelDescriptors = new ushort[] { 0x0034, 0x0035 },
+            BatteryPowerState = 0x0037,
+        };
+
+        /// <summary>
+        ///     Activates over a fresh MockGattTransport once, with the file at
+        ///     cachePath as setup left it, and checks what it took. Returns the
+        ///     number of things that were off.
+        /// </summary>
+        static async Task<int> CheckCase(string name, string cachePath, Action<MockGattTransport> setup,
+            bool pipelined, int roundTrips, bool activated, TextWriter output)
+        {
+            var channel = new NotificationChannel(NotificationPipeline.DefaultCapacity, NotificationPipeline.DefaultBufferSize);
+            var wrong = 0;
+
+            using (var transport = new MockGattTransport(TimeSpan.FromMilliseconds(1), TimeSpan.FromMilliseconds(1)))
+            {
+                setup(transport);
+
+                var map = await RemoteActivation.GetHandleMapAsync(transport, cachePath, Quiet);
+                var result = map != null && await RemoteActivation.ActivateAsync(transport, map, channel, pipelined, Quiet);
+                var kept = GattHandleMap.Load(cachePath);
+                var writes = map != null ? map.BatteryLevelDescriptors.Length + (map.BatteryPowerState != 0 ? 1 : 0) : 0;
+
+                output.WriteLine("{0,-30} {1,-10} {2,6} {3,12}", name, pipelined ? "pipelined" : "one by one",
+                    transport.RoundTrips, transport.MostOutstanding);
+
+                if (result != activated)
+                {
+                    output.WriteLine("  activation {0}", result ? "succeeded" : "failed");
+                    wrong++;
+                }
+
+                if (transport.RoundTrips != roundTrips)
+                {
+                    output.WriteLine("  {0} round trips, expected {1}", transport.RoundTrips, roundTrips);
+                    wrong++;
+                }
+
+                if (!transport.Handles.Equals(kept))
+                {
+                    output.WriteLine("  the kept handles aren't the remote's");
+                    wrong++;
+                }
+
+                if (transport.MostOutstanding != (pipelined ? writes : 1))
+                {
+                    output.WriteLine("  {0} calls outstanding at once", transport.MostOutstanding);
+                    wrong++;
+                }
+            }
+
+            return wrong;
+        }
+
+        /// <summary>
+        ///     Activates with a map of a descriptor the remote doesn't have, which
+        ///     must fail. Returns the number of things that were off.
+        /// </summary>
+        static async Task<int> CheckStale(bool pipelined, TextWriter output)
+        {
+            var channel = new NotificationChannel(NotificationPipeline.DefaultCapacity, NotificationPipeline.DefaultBufferSize);
+
+            using (var transport = new MockGattTransport(TimeSpan.FromMilliseconds(1), TimeSpan.FromMilliseconds(1)))
+            {
+                var map = new GattHandleMap
+                {
+                    BatteryLevel = transport.Handles.BatteryLevel,
+                    BatteryLevelDescriptors = transport.Handles.BatteryLevelDescriptors.Concat(new ushort[] { 0x0099 }).ToArray(),
+                    BatteryPowerState = transport.Handles.BatteryPowerState,
+                };
+
+                var result = await RemoteActivation.ActivateAsync(transport, map, channel, pipelined, Quiet);
+
+                output.WriteLine("{0,-30} {1,-10} {2,6} {3,12}", "descriptor gone", pipelined ? "pipelined" : "one by one",
+                    transport.RoundTrips, transport.MostOutstanding);
+
+                if (result)
+                {
+                    output.WriteLine("  activation succeeded");
+                    return 1;
+                }
+            }
+
+            return 0;
+        }
+
+        /// <summary>
+        ///     Checks activation with and without kept handles and pipelining.
+        ///     Returns false if anything was off.
+        /// </summary>
+        public static bool Check(TextWriter output)
+        {
+            var cachePath = Path.Combine(Path.GetTempPath(), "NotificationBench.check.gatt");
+            var wrong = 0;
+
+            output.WriteLine("{0,-30} {1,-10} {2,6} {3,12}", "case", "writes", "trips", "outstanding");
+
+            foreach (var pipelined in new[] { false, true })
+            {
+                File.Delete(cachePath);
+
+                wrong += CheckCase("no kept handles", cachePath, transport => { },
+                    pipelined, DiscoveryRoundTrips + ActivationRoundTrips, true, output).Result;
+
+                wrong += CheckCase("kept handles", cachePath, transport => { },
+                    pipelined, 1 + ActivationRoundTrips, true, output).Result;
+
+                wrong += CheckCase("kept, not in the system cache", cachePath, transport => transport.SystemCache = false,
+                    pipelined, DiscoveryRoundTrips + 1 + ActivationRoundTrips, true, output).Result;
+
+                wrong += CheckCase("kept, remote changed", cachePath, transport => transport.Handles = Moved,
+                    pipelined, DiscoveryRoundTrips + ActivationRoundTrips, true, output).Result;
+
+                File.WriteAllText(cachePath, "batterylevel=0xzz\n");
+
+                wrong += CheckCase("kept, doesn't parse", cachePath, transport => { },
+                    pipelined, DiscoveryRoundTrips + ActivationRoundTrips, true, output).Result;
+
+                wrong += CheckStale(pipelined, output).Result;
+            }
+
+            File.Delete(cachePath);
+
+            output.WriteLine("{0} wrong", wrong);
+
+            return wrong == 0;
+        }
+    }
+}
@@ -24,16 +24,36 @@ Environment:
 #include <conio.h>
 #include <dontuse.h>
 
-#define IOCTL_FIX_HCI_L2CAP_HEADERS_ON CTL_CODE(FILE_DEVICE_UNKNOWN, 0x11, METHOD_BUFFERED, FILE_READ_DATA)
-#define IOCTL_FIX_HCI_L2CAP_HEADERS_OFF CTL_CODE(FILE_DEVICE_UNKNOWN,0x10, METHOD_BUFFERED, FILE_READ_DATA)
-#define IOCTL_DEBUG_DATA_IN_ON CTL_CODE(FILE_DEVICE_UNKNOWN, 0x21, METHOD_BUFFERED, FILE_READ_DATA)
-#define IOCTL_DEBUG_DATA_IN_OFF CTL_CODE(FILE_DEVICE_UNKNOWN, 0x20, METHOD_BUFFERED, FILE_READ_DATA)
-#define IOCTL_DEBUG_DATA_OUT_ON CTL_CODE(FILE_DEVICE_UNKNOWN, 0x31, METHOD_BUFFERED, FILE_READ_DATA)
-#define IOCTL_DEBUG_DATA_OUT_OFF CTL_CODE(FILE_DEVICE_UNKNOWN, 0x30, METHOD_BUFFERED, FILE_READ_DATA)
+#include "public.h"
+#include "tracepoints.h"
+#include "capstream.h"
+#include "latency.h"
+#include "gesture.h"
+#include "buttons.h"
+#include "reportmap.h"
 
 BOOL bFixHciL2cap = FALSE;
+BOOL bNoFixHciL2cap = FALSE;
 BOOL bDebugDataIn = FALSE;
 BOOL bDebugDataOut = FALSE;
+PCHAR pTraceFilter = NULL;
+BOOL bGetCapture = FALSE;
+PCHAR pCaptureFile = NULL;
+PCHAR pTracepointKeywords = NULL;
+BOOL bGetTracepoints = FALSE;
+BOOL bGetAttStats = FALSE;
+PCHAR pEventConfig = NULL;
+PCHAR pSmoothConfig = NULL;
+BOOL bReadEvents = FALSE;
+BOOL bGestures = FALSE;
+BOOL bButtons = FALSE;
+PCHAR pSubscription = NULL;
+PCHAR pActivateConfig = NULL;
+PCHAR pWatchdogConfig = NULL;
+PCHAR pVoiceConfig = NULL;
+BOOL bGetVoiceStats = FALSE;
+BOOL bGetReportMaps = FALSE;
+PCHAR pReportMap = NULL;
 
 HANDLE hControlDevice;
 
@@ -41,9 +61,53 @@ VOID
 Usage()
 {
 	printf("Usage:\n");
-	printf("-f to apply HCI/L2CAP headers fix for BLE 4.0\n");
+	printf("-f to always apply HCI/L2CAP headers fix for BLE 4.0\n");
+	printf("-n to never apply HCI/L2CAP headers fix\n");
+	printf("   (by default the filter applies it when it detects the adapter needs it)\n");
 	printf("-i to DbgPrint() incoming data to a kernel debug log viewer like Sysinternals DebugView\n");
 	printf("-o to DbgPrint() outgoing data to a kernel debug log viewer like Sysinternals DebugView\n");
+	printf("-t <filter> to only DbgPrint() packets matching all of the comma separated terms\n");
+	printf("   in, out, acl, event, handle=<n>[-<n>], cid=<n>[-<n>], op=<n>[-<n>], att=<n>[-<n>],\n");
+	printf("   len=<n>[-<n>], every=<n> (every nth packet), rate=<n>[/<burst>] (packets per second)\n");
+	printf("   e.g. -t out,op=0x12,att=0x29 for the write request enabling battery notifications\n");
+	printf("   notifications are matched after the filter changed att handle 0x23 to 0x2b\n");
+	printf("-c to print the packets around the last capture trigger (notification gap,\n");
+	printf("   truncated packet, failed send or watchdog stall) and re-arm it\n");
+	printf("-w <file> to also append that capture to a compact capture file\n");
+	printf("-k <keywords> to enable the driver's tracepoints, comma separated urb, rewrite,\n");
+	printf("   error, activate or a mask (default rewrite,error,activate)\n");
+	printf("-p to print the tracepoint records the driver kept\n");
+	printf("-l to print how long the remotes took to answer ATT requests\n");
+	printf("-e <ms> to have the driver decode button and trackpad reports into events,\n");
+	printf("   merging the trackpad moves within <ms> (0 merges nothing), -e off to stop\n");
+	printf("-m <smoothing> to have the driver smooth the trackpad positions with the comma separated\n");
+	printf("   terms ahead=<ms> (predicted ahead, default 0), min=<mHz> (cutoff when still, default %u),\n",
+		FILTER_SMOOTH_DEFAULT_MIN_CUTOFF);
+	printf("   beta=<mHz per unit/s> (default %u), d=<mHz> (cutoff of the speed, default %u),\n",
+		FILTER_SMOOTH_DEFAULT_BETA, FILTER_SMOOTH_DEFAULT_D_CUTOFF);
+	printf("   report=<us> (the remote's report period, default %u), or off\n", FILTER_SMOOTH_DEFAULT_REPORT_US);
+	printf("-r to print the events and count the voice frames as they come until a key is pressed,\n");
+	printf("   then how long they took from the adapter to being printed\n");
+	printf("-u <subscription> to only read what matches all of the comma separated terms\n");
+	printf("   input, voice, conn=<n>, att=<n> (implies -r)\n");
+	printf("-g to also print the taps, clicks, swipes and scrolls the events make (implies -r)\n");
+	printf("-b to also print the clicks, double clicks, long presses and chords of the buttons,\n");
+	printf("   of every button and of neighbouring pairs of bits (implies -r)\n");
+	printf("-a <activation> to have the driver activate the remotes with the comma separated\n");
+	printf("   addresses itself as they connect, aa:bb:cc:dd:ee:ff or aa:bb:cc:dd:ee:ff/random,\n");
+	printf("   nolearn to not also activate the remotes this application activated, or off\n");
+	printf("-s <watchdog> to set the notification stall watchdog with the comma separated terms\n");
+	printf("   <ms> (gap counted as a stall, default 500), trigger (the capture), fix (force the\n");
+	printf("   headers fix on the connection), count (neither), any (also gaps after short\n");
+	printf("   notifications), or off\n");
+	printf("-q <voice> to set how the driver counts the voice sessions with the comma separated\n");
+	printf("   terms seq=<n> (offset of the frame counter in the value, none if it has none),\n");
+	printf("   hz=<n> (frames per second), <ms> (gap ending a session, default 250)\n");
+	printf("-v to print the voice sessions, frames lost, repeated, reordered, late and trimmed\n");
+	printf("-h to print the HID report maps the driver read of the remotes and the fields it\n");
+	printf("   decodes their reports with\n");
+	printf("-d <handle>:<file> to give the driver the report map of the connection with <handle>,\n");
+	printf("   for a remote whose report map the host cached and doesn't read again\n");
 	return;
 }
 
@@ -71,6 +135,1306 @@ int SendIoctlToFilterDevice(DWORD ioctlControlRequest, const char * ioctlControl
 	return 1;
 }
 
+BOOL
+ParseRange(
+	PCHAR value,
+	USHORT * low,
+	USHORT * high
+)
+{
+	PCHAR end;
+
+	*low = (USHORT)strtoul(value, &end, 0);
+	*high = *low;
+
+	if (*end == '-' || *end == '/')
+		*high = (USHORT)strtoul(end + 1, &end, 0);
+
+	return end != value && *end == '\0';
+}
+
+//
+// Turns "-t" terms into a trace predicate. Every term is a test that
+// jumps to the final REJECT when it fails, passing all of them reaches
+// the ACCEPT before it.
+//
+BOOL
+BuildTraceFilter(
+	PCHAR filter,
+	PTRACE_FILTER_PROGRAM program
+)
+{
+	CHAR	terms[256];
+	PCHAR	context = NULL;
+	ULONG	n = 0;
+
+	strncpy_s(terms, sizeof(terms), filter, _TRUNCATE);
+
+	for (PCHAR term = strtok_s(terms, ",", &context); term != NULL; term = strtok_s(NULL, ",", &context)) {
+		PTRACE_FILTER_INSN insn = &program->Insns[n];
+		PCHAR value = strchr(term, '=');
+
+		if (n + 2 >= TRACE_FILTER_MAX_INSNS) {
+			printf("Too many trace filter terms\n");
+			return FALSE;
+		}
+
+		ZeroMemory(insn, sizeof(*insn));
+
+		if (value)
+			*value++ = '\0';
+
+		if (!_stricmp(term, "in") || !_stricmp(term, "out")) {
+			insn->Op = TRACE_OP_DIRECTION;
+			insn->Low = insn->High = !_stricmp(term, "in") ? 1 : 0;
+		} else if (!_stricmp(term, "acl") || !_stricmp(term, "event")) {
+			insn->Op = TRACE_OP_KIND;
+			insn->Low = insn->High = !_stricmp(term, "acl") ? TRACE_KIND_ACL : TRACE_KIND_HCI_EVENT;
+		} else if (value && !_stricmp(term, "handle")) {
+			insn->Op = TRACE_OP_ACL_HANDLE;
+		} else if (value && !_stricmp(term, "cid")) {
+			insn->Op = TRACE_OP_CID;
+		} else if (value && !_stricmp(term, "op")) {
+			insn->Op = TRACE_OP_ATT_OPCODE;
+		} else if (value && !_stricmp(term, "att")) {
+			insn->Op = TRACE_OP_ATT_HANDLE;
+		} else if (value && !_stricmp(term, "len")) {
+			insn->Op = TRACE_OP_LENGTH;
+		} else if (value && !_stricmp(term, "every")) {
+			insn->Op = TRACE_OP_SAMPLE;
+		} else if (value && !_stricmp(term, "rate")) {
+			insn->Op = TRACE_OP_RATE_LIMIT;
+		} else {
+			printf("Unknown trace filter term %s\n", term);
+			return FALSE;
+		}
+
+		if (value && !ParseRange(value, &insn->Low, &insn->High)) {
+			printf("Bad trace filter value %s\n", value);
+			return FALSE;
+		}
+
+		//
+		// A rate without a burst allows one second worth of packets at once.
+		//
+		if (insn->Op == TRACE_OP_RATE_LIMIT && !strpbrk(value, "-/"))
+			insn->High = insn->Low;
+
+		n++;
+	}
+
+	for (ULONG i = 0; i < n; i++)
+		program->Insns[i].JumpFalse = (UCHAR)(n - i);
+
+	ZeroMemory(&program->Insns[n], 2 * sizeof(TRACE_FILTER_INSN));
+	program->Insns[n].Op = TRACE_OP_ACCEPT;
+	program->Insns[n + 1].Op = TRACE_OP_REJECT;
+	program->InsnCount = n + 2;
+
+	return TRUE;
+}
+
+int SendTraceFilter()
+{
+	union {
+		TRACE_FILTER_PROGRAM	program;
+		UCHAR					buffer[TRACE_FILTER_PROGRAM_SIZE(TRACE_FILTER_MAX_INSNS)];
+	} trace;
+	ULONG	bytes;
+
+	trace.program.InsnCount = 0;
+
+	if (pTraceFilter && !BuildTraceFilter(pTraceFilter, &trace.program)) {
+		Usage();
+		return 0;
+	}
+
+	if (!DeviceIoControl(hControlDevice,
+		IOCTL_SET_TRACE_FILTER,
+		&trace, TRACE_FILTER_PROGRAM_SIZE(trace.program.InsnCount),
+		NULL, 0,
+		&bytes, NULL)) {
+		printf("IOCTL_SET_TRACE_FILTER request failed:0x%x\n", GetLastError());
+		return 0;
+	}
+
+	printf("Ioctl IOCTL_SET_TRACE_FILTER to SiriRemoteFilter device succeeded (%lu instructions)\n",
+		trace.program.InsnCount);
+
+	return 1;
+}
+
+VOID
+WriteCapture(
+	PFILTER_CAPTURE_HEADER header,
+	PFILTER_CAPTURE_RECORD records
+)
+{
+	CAPSTREAM_STATE			state;
+	CAPSTREAM_FILE_HEADER	fileHeader;
+	UCHAR	item[CAPSTREAM_MAX_ITEM_SIZE];
+	ULONG	length;
+	FILE *	file;
+
+	if (fopen_s(&file, pCaptureFile, "ab") != 0) {
+		printf("Failed to open %s\n", pCaptureFile);
+		return;
+	}
+
+	//
+	// Every window starts afresh, so windows are just appended.
+	//
+	fseek(file, 0, SEEK_END);
+	if (ftell(file) == 0) {
+		fileHeader.Magic = CAPSTREAM_FILE_MAGIC;
+		fileHeader.Version = CAPSTREAM_FILE_VERSION;
+		fwrite(&fileHeader, sizeof(fileHeader), 1, file);
+	}
+
+	CapStreamInit(&state);
+
+	length = CapStreamEncodeWindow(&state, header, item, sizeof(item));
+	fwrite(item, 1, length, file);
+
+	for (ULONG i = 0; i < header->RecordCount; i++) {
+		length = CapStreamEncode(&state, &records[i], item, sizeof(item));
+		fwrite(item, 1, length, file);
+	}
+
+	printf("  appended to %s (%ld bytes)\n", pCaptureFile, ftell(file));
+
+	fclose(file);
+}
+
+VOID
+PrintCapture()
+{
+	const char * triggers[] = { "", "notification gap", "truncated packet", "", "send failure", "", "", "", "watchdog stall" };
+	PFILTER_CAPTURE_HEADER	header;
+	PFILTER_CAPTURE_RECORD	records;
+	ULONG	size = sizeof(FILTER_CAPTURE_HEADER) + FILTER_CAPTURE_RECORDS * sizeof(FILTER_CAPTURE_RECORD);
+	ULONG	bytes;
+
+	header = (PFILTER_CAPTURE_HEADER)malloc(size);
+	if (!header)
+		return;
+
+	records = (PFILTER_CAPTURE_RECORD)(header + 1);
+
+	if (!DeviceIoControl(hControlDevice,
+		IOCTL_GET_CAPTURE,
+		NULL, 0,
+		header, size,
+		&bytes, NULL)) {
+		printf("IOCTL_GET_CAPTURE request failed:0x%x\n", GetLastError());
+		free(header);
+		return;
+	}
+
+	if (header->State != FILTER_CAPTURE_FROZEN) {
+		printf("\nNo capture triggered yet\n");
+		free(header);
+		return;
+	}
+
+	printf("\nAdapter %lu: capture triggered by %s on handle 0x%x\n", header->Adapter,
+		header->Trigger < 9 ? triggers[header->Trigger] : "?", header->TriggerHandle);
+
+	for (ULONG i = 0; i < header->RecordCount; i++) {
+		PFILTER_CAPTURE_RECORD record = &records[i];
+
+		if (i == header->TriggerRecord)
+			printf("  ---- trigger ----\n");
+
+		printf("  %+9.3f ms %s %s %3d:", (record->Time - header->TriggerTime) / 10000.0,
+			record->Direction ? "IN " : "OUT", record->Kind == TRACE_KIND_HCI_EVENT ? "EVT" : "ACL",
+			record->Length);
+
+		for (USHORT j = 0; j < record->CapturedLength; j++)
+			printf(" %02x", record->Data[j]);
+
+		printf("%s\n", record->CapturedLength < record->Length ? " ..." : "");
+	}
+
+	if (pCaptureFile)
+		WriteCapture(header, records);
+
+	free(header);
+}
+
+int SendTracepointKeywords()
+{
+	ULONG	keywords = 0;
+	ULONG	bytes;
+	CHAR	terms[128];
+	PCHAR	context = NULL;
+
+	strncpy_s(terms, sizeof(terms), pTracepointKeywords, _TRUNCATE);
+
+	for (PCHAR term = strtok_s(terms, ",", &context); term != NULL; term = strtok_s(NULL, ",", &context)) {
+		if (!_stricmp(term, "urb"))
+			keywords |= TRACEPOINT_KEYWORD_URB;
+		else if (!_stricmp(term, "rewrite"))
+			keywords |= TRACEPOINT_KEYWORD_REWRITE;
+		else if (!_stricmp(term, "error"))
+			keywords |= TRACEPOINT_KEYWORD_ERROR;
+		else if (!_stricmp(term, "activate"))
+			keywords |= TRACEPOINT_KEYWORD_ACTIVATE;
+		else if (term[0] >= '0' && term[0] <= '9')
+			keywords |= strtoul(term, NULL, 0);
+		else {
+			Usage();
+			return 0;
+		}
+	}
+
+	if (!DeviceIoControl(hControlDevice,
+		IOCTL_SET_TRACEPOINT_KEYWORDS,
+		&keywords, sizeof(keywords),
+		NULL, 0,
+		&bytes, NULL)) {
+		printf("IOCTL_SET_TRACEPOINT_KEYWORDS request failed:0x%x\n", GetLastError());
+		return 0;
+	}
+
+	printf("Ioctl IOCTL_SET_TRACEPOINT_KEYWORDS to SiriRemoteFilter device succeeded (0x%lx)\n", keywords);
+
+	return 1;
+}
+
+int SendEventConfig()
+{
+	FILTER_EVENT_CONFIG	config;
+	ULONG	bytes;
+
+	config.Enable = _stricmp(pEventConfig, "off") != 0;
+	config.CoalesceMs = config.Enable ? strtoul(pEventConfig, NULL, 0) : 0;
+
+	if (!DeviceIoControl(hControlDevice,
+		IOCTL_SET_EVENT_CONFIG,
+		&config, sizeof(config),
+		NULL, 0,
+		&bytes, NULL)) {
+		printf("IOCTL_SET_EVENT_CONFIG request failed:0x%x\n", GetLastError());
+		return 0;
+	}
+
+	if (config.Enable)
+		printf("Ioctl IOCTL_SET_EVENT_CONFIG to SiriRemoteFilter device succeeded (%lu ms)\n", config.CoalesceMs);
+	else
+		printf("Ioctl IOCTL_SET_EVENT_CONFIG to SiriRemoteFilter device succeeded (off)\n");
+
+	return 1;
+}
+
+int SendActivateConfig()
+{
+	FILTER_ACTIVATE_CONFIG	config;
+	ULONG	bytes;
+	CHAR	terms[256];
+	PCHAR	context = NULL;
+	unsigned int	address[6];
+	char	type[8];
+	int		fields;
+
+	memset(&config, 0, sizeof(config));
+	config.Flags = FILTER_ACTIVATE_DEFAULT;
+
+	strncpy_s(terms, sizeof(terms), pActivateConfig, _TRUNCATE);
+
+	for (PCHAR term = strtok_s(terms, ",", &context); term != NULL; term = strtok_s(NULL, ",", &context)) {
+		type[0] = '\0';
+		fields = sscanf_s(term, "%2x:%2x:%2x:%2x:%2x:%2x/%7s",
+			&address[5], &address[4], &address[3], &address[2], &address[1], &address[0],
+			type, (unsigned)sizeof(type));
+
+		if (!_stricmp(term, "off"))
+			config.Flags &= ~FILTER_ACTIVATE_AUTO;
+		else if (!_stricmp(term, "nolearn"))
+			config.Flags &= ~FILTER_ACTIVATE_LEARN;
+		else if ((fields == 6 || (fields == 7 && !_stricmp(type, "random"))) &&
+			config.PeerCount < FILTER_ACTIVATE_MAX_PEERS) {
+			PFILTER_ACTIVATE_PEER peer = &config.Peers[config.PeerCount++];
+
+			peer->AddressType = fields == 7 ? 1 : 0;
+			for (int i = 0; i < 6; i++)
+				peer->Address[i] = (UCHAR)address[i];
+		}
+		else {
+			Usage();
+			return 0;
+		}
+	}
+
+	if (!DeviceIoControl(hControlDevice,
+		IOCTL_SET_ACTIVATE_CONFIG,
+		&config, sizeof(config),
+		NULL, 0,
+		&bytes, NULL)) {
+		printf("IOCTL_SET_ACTIVATE_CONFIG request failed:0x%x\n", GetLastError());
+		return 0;
+	}
+
+	printf("Ioctl IOCTL_SET_ACTIVATE_CONFIG to SiriRemoteFilter device succeeded (%s, %lu remotes)\n",
+		(config.Flags & FILTER_ACTIVATE_AUTO) ? "on" : "off", config.PeerCount);
+
+	return 1;
+}
+
+int SendWatchdogConfig()
+{
+	FILTER_WATCHDOG_CONFIG	config;
+	ULONG	bytes;
+	CHAR	terms[128];
+	PCHAR	context = NULL;
+	PCHAR	end;
+	ULONG	actions = 0;
+	BOOL	anyAction = FALSE;
+
+	config.GapMs = FILTER_WATCHDOG_DEFAULT_GAP_MS;
+	config.Actions = FILTER_WATCHDOG_ACTION_DEFAULT;
+	config.Flags = 0;
+
+	strncpy_s(terms, sizeof(terms), pWatchdogConfig, _TRUNCATE);
+
+	for (PCHAR term = strtok_s(terms, ",", &context); term != NULL; term = strtok_s(NULL, ",", &context)) {
+		if (!_stricmp(term, "off"))
+			config.GapMs = 0;
+		else if (!_stricmp(term, "trigger")) {
+			actions |= FILTER_WATCHDOG_ACTION_TRIGGER;
+			anyAction = TRUE;
+		}
+		else if (!_stricmp(term, "fix")) {
+			actions |= FILTER_WATCHDOG_ACTION_FIX;
+			anyAction = TRUE;
+		}
+		else if (!_stricmp(term, "count"))
+			anyAction = TRUE;
+		else if (!_stricmp(term, "any"))
+			config.Flags |= FILTER_WATCHDOG_ANY_GAP;
+		else {
+			config.GapMs = strtoul(term, &end, 0);
+			if (end == term || *end != '\0' || config.GapMs == 0) {
+				Usage();
+				return 0;
+			}
+		}
+	}
+
+	if (anyAction)
+		config.Actions = actions;
+
+	if (!DeviceIoControl(hControlDevice,
+		IOCTL_SET_WATCHDOG_CONFIG,
+		&config, sizeof(config),
+		NULL, 0,
+		&bytes, NULL)) {
+		printf("IOCTL_SET_WATCHDOG_CONFIG request failed:0x%x\n", GetLastError());
+		return 0;
+	}
+
+	if (config.GapMs)
+		printf("Ioctl IOCTL_SET_WATCHDOG_CONFIG to SiriRemoteFilter device succeeded (%lu ms%s%s)\n", config.GapMs,
+			(config.Actions & FILTER_WATCHDOG_ACTION_TRIGGER) ? ", trigger" : "",
+			(config.Actions & FILTER_WATCHDOG_ACTION_FIX) ? ", fix" : "");
+	else
+		printf("Ioctl IOCTL_SET_WATCHDOG_CONFIG to SiriRemoteFilter device succeeded (off)\n");
+
+	return 1;
+}
+
+int SendSmoothConfig()
+{
+	FILTER_SMOOTH_CONFIG	config;
+	ULONG	bytes;
+	CHAR	terms[128];
+	PCHAR	context = NULL;
+	PCHAR	end;
+	PCHAR	number;
+	PULONG	field;
+
+	config.Enable = _stricmp(pSmoothConfig, "off") != 0;
+	config.MinCutoffMilliHz = FILTER_SMOOTH_DEFAULT_MIN_CUTOFF;
+	config.Beta = FILTER_SMOOTH_DEFAULT_BETA;
+	config.DerivativeCutoffMilliHz = FILTER_SMOOTH_DEFAULT_D_CUTOFF;
+	config.LookaheadMs = 0;
+	config.ReportUs = FILTER_SMOOTH_DEFAULT_REPORT_US;
+
+	strncpy_s(terms, sizeof(terms), config.Enable ? pSmoothConfig : "", _TRUNCATE);
+
+	for (PCHAR term = strtok_s(terms, ",", &context); term != NULL; term = strtok_s(NULL, ",", &context)) {
+		if (!_strnicmp(term, "ahead=", 6)) {
+			field = &config.LookaheadMs;
+			number = term + 6;
+		}
+		else if (!_strnicmp(term, "min=", 4)) {
+			field = &config.MinCutoffMilliHz;
+			number = term + 4;
+		}
+		else if (!_strnicmp(term, "beta=", 5)) {
+			field = &config.Beta;
+			number = term + 5;
+		}
+		else if (!_strnicmp(term, "d=", 2)) {
+			field = &config.DerivativeCutoffMilliHz;
+			number = term + 2;
+		}
+		else if (!_strnicmp(term, "report=", 7)) {
+			field = &config.ReportUs;
+			number = term + 7;
+		}
+		else if (!_stricmp(term, "on")) {
+			continue;
+		}
+		else {
+			Usage();
+			return 0;
+		}
+
+		*field = strtoul(number, &end, 0);
+		if (end == number || *end != '\0') {
+			Usage();
+			return 0;
+		}
+	}
+
+	if (!DeviceIoControl(hControlDevice,
+		IOCTL_SET_SMOOTH_CONFIG,
+		&config, sizeof(config),
+		NULL, 0,
+		&bytes, NULL)) {
+		printf("IOCTL_SET_SMOOTH_CONFIG request failed:0x%x\n", GetLastError());
+		return 0;
+	}
+
+	if (config.Enable)
+		printf("Ioctl IOCTL_SET_SMOOTH_CONFIG to SiriRemoteFilter device succeeded (%lu ms ahead)\n", config.LookaheadMs);
+	else
+		printf("Ioctl IOCTL_SET_SMOOTH_CONFIG to SiriRemoteFilter device succeeded (off)\n");
+
+	return 1;
+}
+
+int SendVoiceConfig()
+{
+	FILTER_VOICE_CONFIG	config;
+	ULONG	bytes;
+	CHAR	terms[128];
+	PCHAR	context = NULL;
+	PCHAR	end;
+	ULONG	value;
+
+	config.SequenceOffset = FILTER_VOICE_NO_SEQUENCE;
+	config.FrameHz = 0;
+	config.GapMs = FILTER_VOICE_DEFAULT_GAP_MS;
+
+	strncpy_s(terms, sizeof(terms), pVoiceConfig, _TRUNCATE);
+
+	for (PCHAR term = strtok_s(terms, ",", &context); term != NULL; term = strtok_s(NULL, ",", &context)) {
+		if (!_stricmp(term, "seq=none"))
+			config.SequenceOffset = FILTER_VOICE_NO_SEQUENCE;
+		else if (!_strnicmp(term, "seq=", 4)) {
+			value = strtoul(term + 4, &end, 0);
+			if (end == term + 4 || *end != '\0' || value >= FILTER_VOICE_NO_SEQUENCE) {
+				Usage();
+				return 0;
+			}
+			config.SequenceOffset = (USHORT)value;
+		}
+		else if (!_strnicmp(term, "hz=", 3)) {
+			value = strtoul(term + 3, &end, 0);
+			if (end == term + 3 || *end != '\0' || value > 0xFFFF) {
+				Usage();
+				return 0;
+			}
+			config.FrameHz = (USHORT)value;
+		}
+		else {
+			config.GapMs = strtoul(term, &end, 0);
+			if (end == term || *end != '\0' || config.GapMs == 0) {
+				Usage();
+				return 0;
+			}
+		}
+	}
+
+	if (!DeviceIoControl(hControlDevice,
+		IOCTL_SET_VOICE_CONFIG,
+		&config, sizeof(config),
+		NULL, 0,
+		&bytes, NULL)) {
+		printf("IOCTL_SET_VOICE_CONFIG request failed:0x%x\n", GetLastError());
+		return 0;
+	}
+
+	printf("Ioctl IOCTL_SET_VOICE_CONFIG to SiriRemoteFilter device succeeded\n");
+
+	return 1;
+}
+
+int SendReportMap()
+{
+	static FILTER_REPORT_MAP	map;
+	ULONG	bytes;
+	PCHAR	end;
+	ULONG	handle;
+	FILE *	file;
+
+	handle = strtoul(pReportMap, &end, 0);
+	if (end == pReportMap || *end != ':' || handle > 0x0EFF) {
+		Usage();
+		return 0;
+	}
+
+	if (fopen_s(&file, end + 1, "rb") != 0) {
+		printf("Failed to open %s\n", end + 1);
+		return 0;
+	}
+
+	memset(&map, 0, sizeof(map));
+	map.Handle = (USHORT)handle;
+	map.Length = (USHORT)fread(map.Map, 1, sizeof(map.Map), file);
+
+	fclose(file);
+
+	if (!DeviceIoControl(hControlDevice,
+		IOCTL_SET_REPORT_MAP,
+		&map, sizeof(map),
+		NULL, 0,
+		&bytes, NULL)) {
+		printf("IOCTL_SET_REPORT_MAP request failed:0x%x\n", GetLastError());
+		return 0;
+	}
+
+	printf("Ioctl IOCTL_SET_REPORT_MAP to SiriRemoteFilter device succeeded (%u bytes for 0x%03x)\n",
+		map.Length, map.Handle);
+
+	return 1;
+}
+
+BOOL
+SubscribeEvents()
+{
+	FILTER_EVENT_SUBSCRIPTION	subscription;
+	ULONG	bytes;
+	CHAR	terms[128];
+	PCHAR	context = NULL;
+
+	subscription.Classes = 0;
+	subscription.Handle = FILTER_EVENT_ANY_HANDLE;
+	subscription.Attribute = FILTER_EVENT_ANY_HANDLE;
+
+	if (pSubscription) {
+		strncpy_s(terms, sizeof(terms), pSubscription, _TRUNCATE);
+
+		for (PCHAR term = strtok_s(terms, ",", &context); term != NULL; term = strtok_s(NULL, ",", &context)) {
+			if (!_stricmp(term, "input"))
+				subscription.Classes |= FILTER_EVENT_CLASS_INPUT;
+			else if (!_stricmp(term, "voice"))
+				subscription.Classes |= FILTER_EVENT_CLASS_VOICE;
+			else if (!_strnicmp(term, "conn=", 5))
+				subscription.Handle = (USHORT)strtoul(term + 5, NULL, 0);
+			else if (!_strnicmp(term, "att=", 4))
+				subscription.Attribute = (USHORT)strtoul(term + 4, NULL, 0);
+			else {
+				Usage();
+				return FALSE;
+			}
+		}
+	}
+
+	if (subscription.Classes == 0)
+		subscription.Classes = FILTER_EVENT_CLASS_ALL;
+
+	if (!DeviceIoControl(hControlDevice,
+		IOCTL_SUBSCRIBE_EVENTS,
+		&subscription, sizeof(subscription),
+		NULL, 0,
+		&bytes, NULL)) {
+		printf("IOCTL_SUBSCRIBE_EVENTS request failed:0x%x\n", GetLastError());
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+LONGLONG
+Counter()
+{
+	LARGE_INTEGER	counter;
+
+	QueryPerformanceCounter(&counter);
+
+	return counter.QuadPart;
+}
+
+VOID
+PrintLatency(
+	const char *			Title,
+	const LATENCY_TRACKER *	Tracker
+)
+{
+	const char * names[LATENCY_STAGES] = { "driver", "delivery", "decode", "action", "total" };
+
+	if (Tracker->Stages[LATENCY_STAGE_TOTAL].Count == 0)
+		return;
+
+	printf("\n  %-10s %8s %10s %10s %10s %10s\n", Title, "Count", "Mean us", "p50 us", "p99 us", "Max us");
+
+	for (ULONG i = 0; i < LATENCY_STAGES; i++) {
+		const LATENCY_HISTOGRAM * histogram = &Tracker->Stages[i];
+
+		printf("  %-10s %8llu %10.1f %10.1f %10.1f %10.1f\n", names[i],
+			histogram->Count,
+			(double)histogram->Sum / histogram->Count / 1000,
+			LatencyHistogramPercentile(histogram, 500) / 1000.0,
+			LatencyHistogramPercentile(histogram, 990) / 1000.0,
+			histogram->Max / 1000.0);
+	}
+}
+
+//
+// The button actions of -b. The meaning of the remote's button bits isn't
+// known, so every button clicks, double clicks and long presses, and the
+// neighbouring pairs of bits are chords.
+//
+typedef struct _BUTTON_PRINT {
+
+	LONGLONG	Start;
+	ULONG		Remotes;
+	USHORT		Handles[HCI_MAX_CONNECTIONS];
+	ULONG		Actions;
+
+} BUTTON_PRINT, *PBUTTON_PRINT;
+
+BOOLEAN
+ButtonsCompile(
+	PBUTTON_MAP	Map
+)
+{
+	BUTTON_RULE	rules[3 * BUTTON_MAX_BUTTONS + BUTTON_MAX_BUTTONS / 2];
+	ULONG		count = 0;
+
+	for (ULONG b = 0; b < BUTTON_MAX_BUTTONS; b++) {
+		for (UCHAR kind = BUTTON_ACTION_CLICK; kind <= BUTTON_ACTION_LONG; kind++) {
+			rules[count].Buttons = (USHORT)(1 << b);
+			rules[count].Kind = kind;
+			rules[count].Action = count + 1;
+			count++;
+		}
+	}
+
+	for (ULONG b = 0; b < BUTTON_MAX_BUTTONS; b += 2) {
+		rules[count].Buttons = (USHORT)(3 << b);
+		rules[count].Kind = BUTTON_ACTION_CHORD;
+		rules[count].Action = count + 1;
+		count++;
+	}
+
+	return ButtonMapCompile(Map, rules, count, NULL);
+}
+
+VOID
+ButtonsPrint(
+	PVOID					Context,
+	const BUTTON_ACTION *	Action
+)
+{
+	PBUTTON_PRINT print = (PBUTTON_PRINT)Context;
+
+	printf("  %10.3f ms 0x%03x %-7s 0x%04x\n",
+		(Action->Time - print->Start) / 10000.0, print->Handles[Action->Remote],
+		ButtonActionName(Action->Kind), Action->Buttons);
+	print->Actions++;
+}
+
+//
+// The engine's remote of a connection, the first HCI_MAX_CONNECTIONS
+// connections seen get one.
+//
+ULONG
+ButtonsRemote(
+	PBUTTON_PRINT	Print,
+	USHORT			Handle
+)
+{
+	for (ULONG i = 0; i < Print->Remotes; i++)
+		if (Print->Handles[i] == Handle)
+			return i;
+
+	if (Print->Remotes == HCI_MAX_CONNECTIONS)
+		return HCI_MAX_CONNECTIONS;
+
+	Print->Handles[Print->Remotes] = Handle;
+
+	return Print->Remotes++;
+}
+
+//
+// The interrupt time events are stamped with, now, from the counter read
+// with it by IOCTL_GET_CLOCK.
+//
+LONGLONG
+InterruptTimeNow(
+	const FILTER_CLOCK *	Clock
+)
+{
+	LONGLONG ticks = Counter() - Clock->PerformanceCounter;
+
+	return Clock->InterruptTime + ticks / Clock->Frequency * 10000000 +
+		ticks % Clock->Frequency * 10000000 / Clock->Frequency;
+}
+
+VOID
+ReadEvents()
+{
+	const char * types[] = { "", "buttons", "down", "move", "up" };
+	PFILTER_EVENT_BUFFER_HEADER	header;
+	PFILTER_EVENT	events;
+	PFILTER_VOICE_FRAME	frames;
+	ULONG	size = sizeof(FILTER_EVENT_BUFFER_HEADER) + 64 * sizeof(FILTER_EVENT) + 16 * sizeof(FILTER_VOICE_FRAME);
+	ULONG	bytes;
+	ULONG	reports = 0;
+	ULONG	delivered = 0;
+	ULONG	voiceFrames = 0;
+	ULONG	voiceBytes = 0;
+	LONGLONG	start = 0;
+	LONGLONG	received;
+	LONGLONG	decoded;
+	FILTER_CLOCK	clock;
+	LARGE_INTEGER	frequency;
+	BOOL	timed;
+	char	line[128];
+	static LATENCY_TRACKER	input;
+	static LATENCY_TRACKER	voice;
+	static GESTURE_STATE	gestureState;
+	GESTURE	gestures[GESTURE_MAX_EVENT_GESTURES];
+	ULONG	gestureCount = 0;
+	static BUTTON_MAP	buttonMap;
+	static BUTTON_ENGINE	buttonEngine;
+	static BUTTON_REMOTE	buttonRemotes[HCI_MAX_CONNECTIONS];
+	BUTTON_PRINT	buttonPrint;
+	LONGLONG	now = 0;
+	LONGLONG	advanced = 0;
+
+	header = (PFILTER_EVENT_BUFFER_HEADER)malloc(size);
+	if (!header)
+		return;
+
+	events = (PFILTER_EVENT)(header + 1);
+
+	if (!SubscribeEvents()) {
+		free(header);
+		return;
+	}
+
+	//
+	// The driver stamps with the counter QueryPerformanceCounter reads, so
+	// its stamps need no mapping, only its frequency.
+	//
+	QueryPerformanceFrequency(&frequency);
+
+	timed = DeviceIoControl(hControlDevice,
+		IOCTL_GET_CLOCK,
+		NULL, 0,
+		&clock, sizeof(clock),
+		&bytes, NULL);
+
+	if (timed) {
+		LatencyTrackerInit(&input, clock.Frequency, frequency.QuadPart);
+		LatencyTrackerInit(&voice, clock.Frequency, frequency.QuadPart);
+	}
+
+	GestureInit(&gestureState, NULL);
+
+	memset(&buttonPrint, 0, sizeof(buttonPrint));
+
+	if (bButtons && !ButtonsCompile(&buttonMap)) {
+		printf("The button rules don't compile\n");
+		bButtons = FALSE;
+	}
+
+	//
+	// Without the clock the button timeouts only run up to the latest
+	// event.
+	//
+	if (bButtons) {
+		advanced = timed ? InterruptTimeNow(&clock) : 0;
+		ButtonEngineInit(&buttonEngine, &buttonMap, buttonRemotes, HCI_MAX_CONNECTIONS,
+			advanced, ButtonsPrint, &buttonPrint);
+	}
+
+	printf("\nEvents (press any key to stop):\n");
+
+	while (!_kbhit()) {
+		//
+		// Every event taken was stamped before now, so the button timeouts
+		// can run up to it once the events are in.
+		//
+		if (timed)
+			now = InterruptTimeNow(&clock);
+
+		if (!DeviceIoControl(hControlDevice,
+			IOCTL_GET_EVENTS,
+			NULL, 0,
+			header, size,
+			&bytes, NULL)) {
+			printf("IOCTL_GET_EVENTS request failed:0x%x\n", GetLastError());
+			break;
+		}
+
+		if (header->Lost)
+			printf("  ---- %lu events lost ----\n", header->Lost);
+
+		if (header->VoiceLost)
+			printf("  ---- %lu voice frames lost ----\n", header->VoiceLost);
+
+		for (ULONG i = 0; i < header->EventCount; i++) {
+			PFILTER_EVENT event = &events[i];
+
+			received = Counter();
+
+			if (start == 0) {
+				start = event->Time;
+				buttonPrint.Start = start;
+			}
+
+			if (event->Type == FILTER_EVENT_BUTTONS)
+				_snprintf_s(line, sizeof(line), _TRUNCATE, "  %10.3f ms 0x%03x %-7s 0x%04x\n",
+					(event->Time - start) / 10000.0, event->Handle, types[event->Type], event->Buttons);
+			else
+				_snprintf_s(line, sizeof(line), _TRUNCATE, "  %10.3f ms 0x%03x %-7s contact %d at %4d,%4d delta %+d,%+d (%d reports)\n",
+					(event->Time - start) / 10000.0, event->Handle,
+					event->Type < 5 ? types[event->Type] : "?", event->Contact,
+					event->X, event->Y, event->DeltaX, event->DeltaY, event->Reports);
+
+			decoded = Counter();
+
+			fputs(line, stdout);
+
+			if (timed)
+				LatencyTrackerAdd(&input, event->Stamp, header->Taken, received, decoded, Counter());
+
+			reports += event->Reports;
+			delivered++;
+
+			//
+			// An event stamped as the previous read was taken is behind
+			// where the timeouts ran to, it counts as then.
+			//
+			if (bButtons && event->Type == FILTER_EVENT_BUTTONS) {
+				advanced = max(advanced, event->Time);
+				ButtonEngineUpdate(&buttonEngine, ButtonsRemote(&buttonPrint, event->Handle),
+					event->Buttons, advanced);
+			}
+
+			if (!bGestures)
+				continue;
+
+			for (ULONG j = 0, count = GestureEvent(&gestureState, event, gestures); j < count; j++) {
+				printf("  %10.3f ms 0x%03x %-11s contact %d %+d,%+d after %.1f ms (%lu reports)\n",
+					(gestures[j].Time - start) / 10000.0, gestures[j].Handle, GestureName(gestures[j].Type),
+					gestures[j].Contact, gestures[j].DeltaX, gestures[j].DeltaY,
+					(gestures[j].Time - gestures[j].Start) / 10000.0, gestures[j].Reports);
+				gestureCount++;
+			}
+		}
+
+		if (bButtons) {
+			advanced = max(advanced, now);
+			ButtonEngineAdvance(&buttonEngine, advanced);
+		}
+
+		frames = (PFILTER_VOICE_FRAME)(events + header->EventCount);
+
+		for (ULONG i = 0; i < header->VoiceCount; i++) {
+			received = Counter();
+
+			voiceFrames++;
+			voiceBytes += frames[i].Length;
+
+			if (timed)
+				LatencyTrackerAdd(&voice, frames[i].Stamp, header->Taken, received, received, received);
+		}
+
+		if (header->VoiceCount)
+			printf("  %lu voice frames, %lu bytes so far\n", voiceFrames, voiceBytes);
+
+		if (header->EventCount == 0 && header->VoiceCount == 0)
+			Sleep(10);
+	}
+
+	_getch();
+
+	printf("  %lu reports in %lu events, %lu voice frames\n", reports, delivered, voiceFrames);
+
+	if (bGestures)
+		printf("  %lu gestures\n", gestureCount);
+
+	if (bButtons)
+		printf("  %lu button actions\n", buttonPrint.Actions);
+
+	PrintLatency("Input", &input);
+	PrintLatency("Voice", &voice);
+
+	free(header);
+}
+
+//
+// Names and field types of the tracepoints, from the schema in tracepoints.h
+//
+typedef struct _TRACEPOINT_INFO {
+	const char *	Name;
+	const char *	FieldNames[TRACEPOINT_MAX_FIELDS];
+	UCHAR			FieldTypes[TRACEPOINT_MAX_FIELDS];
+} TRACEPOINT_INFO;
+
+#define TRACEPOINT_SCHEMA_INFO(Id, Name, F0, T0, F1, T1, F2, T2, F3, T3) \
+	{ Name, { F0, F1, F2, F3 }, \
+	  { TRACEPOINT_FIELD_##T0, TRACEPOINT_FIELD_##T1, TRACEPOINT_FIELD_##T2, TRACEPOINT_FIELD_##T3 } },
+
+const TRACEPOINT_INFO TracepointInfo[TRACEPOINT_COUNT] = {
+	{ "None" },
+	TRACEPOINT_SCHEMA(TRACEPOINT_SCHEMA_INFO)
+};
+
+VOID
+PrintTracepoints()
+{
+	const char * levels[] = { "", "ERR", "INF", "VRB" };
+	PTRACEPOINT_BUFFER_HEADER	header;
+	PTRACEPOINT_RECORD	records;
+	ULONG	size = sizeof(TRACEPOINT_BUFFER_HEADER) + 256 * sizeof(TRACEPOINT_RECORD);
+	ULONG	sequence = 0;
+	ULONG	bytes;
+	LONGLONG	start = 0;
+
+	header = (PTRACEPOINT_BUFFER_HEADER)malloc(size);
+	if (!header)
+		return;
+
+	records = (PTRACEPOINT_RECORD)(header + 1);
+
+	printf("\nTracepoints:\n");
+
+	do {
+		if (!DeviceIoControl(hControlDevice,
+			IOCTL_GET_TRACEPOINTS,
+			&sequence, sizeof(sequence),
+			header, size,
+			&bytes, NULL)) {
+			printf("IOCTL_GET_TRACEPOINTS request failed:0x%x\n", GetLastError());
+			break;
+		}
+
+		if (header->Lost)
+			printf("  ---- %lu records lost ----\n", header->Lost);
+
+		for (ULONG i = 0; i < header->RecordCount; i++) {
+			PTRACEPOINT_RECORD record = &records[i];
+			const TRACEPOINT_INFO *info;
+
+			if (start == 0)
+				start = record->Time;
+
+			printf("  %10.3f ms %s", (record->Time - start) / 10000.0,
+				record->Level < 4 ? levels[record->Level] : "?");
+
+			if (record->Id >= TRACEPOINT_COUNT) {
+				printf(" %u\n", record->Id);
+				continue;
+			}
+
+			info = &TracepointInfo[record->Id];
+			printf(" %s", info->Name);
+
+			for (ULONG j = 0; j < TRACEPOINT_MAX_FIELDS; j++) {
+				switch (info->FieldTypes[j]) {
+				case TRACEPOINT_FIELD_DEC:
+					printf(" %s=%llu", info->FieldNames[j], record->Fields[j]);
+					break;
+				case TRACEPOINT_FIELD_HEX:
+					printf(" %s=0x%llx", info->FieldNames[j], record->Fields[j]);
+					break;
+				case TRACEPOINT_FIELD_PTR:
+					printf(" %s=0x%016llx", info->FieldNames[j], record->Fields[j]);
+					break;
+				case TRACEPOINT_FIELD_STATUS:
+					printf(" %s=0x%08lx", info->FieldNames[j], (ULONG)record->Fields[j]);
+					break;
+				}
+			}
+
+			printf("\n");
+		}
+
+		sequence = header->NextSequence;
+
+	} while (header->RecordCount == 256);
+
+	free(header);
+}
+
+VOID
+PrintAdapterInfo()
+{
+	FILTER_ADAPTER_INFO	info[4];
+	ULONG	bytes;
+	const char * fixModes[] = { "off", "on", "auto" };
+	const char * activateStates[] = { "", "waiting for encryption", "activating", "activated", "activation failed", "activated by an application" };
+
+	if (!DeviceIoControl(hControlDevice,
+		IOCTL_GET_ADAPTER_INFO,
+		NULL, 0,
+		info, sizeof(info),
+		&bytes, NULL)) {
+		printf("IOCTL_GET_ADAPTER_INFO request failed:0x%x\n", GetLastError());
+		return;
+	}
+
+	for (ULONG i = 0; i < bytes / sizeof(FILTER_ADAPTER_INFO); i++) {
+		printf("\nAdapter %lu: HCI/L2CAP headers fix %s\n", i,
+			info[i].FixMode < 3 ? fixModes[info[i].FixMode] : "?");
+
+		if (info[i].Flags & FILTER_ADAPTER_VERSION_PRESUMED)
+			printf("  LMP version %d, presumed from the controller profile\n", info[i].LmpVersion);
+		else if (info[i].Flags & FILTER_ADAPTER_VERSION_VALID)
+			printf("  LMP version %d, subversion 0x%x, manufacturer 0x%x\n",
+				info[i].LmpVersion, info[i].LmpSubversion, info[i].Manufacturer);
+		else
+			printf("  LMP version not seen\n");
+
+		if (info[i].Flags & FILTER_ADAPTER_LE_BUFFER_VALID)
+			printf("  LE ACL data packet length %d\n", info[i].LeAclDataPacketLength);
+
+		printf("  Notifications trimmed to %d ATT bytes by default (0 = untouched)\n",
+			info[i].DefaultFixAttLength);
+
+		if (info[i].Stalls)
+			printf("  %lu notification stalls, %lu recovered\n", info[i].Stalls, info[i].Recoveries);
+
+		for (USHORT j = 0; j < info[i].ConnectionCount && j < FILTER_MAX_CONNECTIONS; j++) {
+			PFILTER_CONNECTION_INFO conn = &info[i].Connections[j];
+
+			if (conn->Flags & FILTER_CONNECTION_ADOPTED)
+				printf("  Connection 0x%03x (connected before the filter saw it)", conn->Handle);
+			else
+				printf("  Connection 0x%03x to %02X:%02X:%02X:%02X:%02X:%02X", conn->Handle,
+					conn->PeerAddress[5], conn->PeerAddress[4], conn->PeerAddress[3],
+					conn->PeerAddress[2], conn->PeerAddress[1], conn->PeerAddress[0]);
+
+			printf(": ATT MTU %d, trimmed to %d", conn->AttMtu, conn->FixAttLength);
+
+			if (conn->Flags & FILTER_CONNECTION_FIX_FORCED)
+				printf(" (forced after a stall)");
+
+			if (conn->Stalls)
+				printf(", %d stalls", conn->Stalls);
+
+			if (conn->ActivateState == FILTER_ACTIVATE_STATE_DONE)
+				printf(", %s in %d ms", activateStates[conn->ActivateState], conn->ActivateMs);
+			else if (conn->ActivateState == FILTER_ACTIVATE_STATE_FAILED && conn->ActivateError)
+				printf(", %s (ATT error 0x%02x)", activateStates[conn->ActivateState], conn->ActivateError);
+			else if (conn->ActivateState != FILTER_ACTIVATE_STATE_NONE && conn->ActivateState < 6)
+				printf(", %s", activateStates[conn->ActivateState]);
+
+			printf("\n");
+		}
+	}
+}
+
+VOID
+PrintAttLatency(
+	const char * origin,
+	PFILTER_ATT_LATENCY latency
+)
+{
+	if (latency->Requests == 0 && latency->Responses == 0)
+		return;
+
+	printf("    %-6s %lu requests, %lu responses (%lu errors), %lu timed out, %lu unanswered",
+		origin, latency->Requests, latency->Responses, latency->Errors,
+		latency->Timeouts, latency->Unanswered);
+
+	if (latency->Responses)
+		printf(", mean %llu.%03llu ms, max %lu ms",
+			latency->TotalUs / latency->Responses / 1000,
+			latency->TotalUs / latency->Responses % 1000,
+			latency->MaxMs);
+
+	printf("\n");
+
+	for (int histogram = 0; histogram < 2; histogram++) {
+		PULONG buckets = histogram ? latency->RoundTrip : latency->Adapter;
+
+		printf("      %-10s", histogram ? "round trip" : "adapter");
+
+		for (int i = 0; i < FILTER_ATT_HISTOGRAM_BUCKETS; i++) {
+			if (!buckets[i])
+				continue;
+
+			if (i == 0)
+				printf(" <1ms:%lu", buckets[i]);
+			else if (i == FILTER_ATT_HISTOGRAM_BUCKETS - 1)
+				printf(" >=%lums:%lu", 1UL << (i - 1), buckets[i]);
+			else
+				printf(" %lu-%lums:%lu", 1UL << (i - 1), 1UL << i, buckets[i]);
+		}
+
+		printf("\n");
+	}
+}
+
+VOID
+PrintAttStats()
+{
+	FILTER_ATT_STATS	stats[4];
+	ULONG	bytes;
+	const char * origins[] = { "host", "filter" };
+
+	if (!DeviceIoControl(hControlDevice,
+		IOCTL_GET_ATT_STATS,
+		NULL, 0,
+		stats, sizeof(stats),
+		&bytes, NULL)) {
+		printf("IOCTL_GET_ATT_STATS request failed:0x%x\n", GetLastError());
+		return;
+	}
+
+	for (ULONG i = 0; i < bytes / sizeof(FILTER_ATT_STATS); i++) {
+		printf("\nAdapter %lu ATT round trips:\n", i);
+
+		for (int o = 0; o < FILTER_ATT_ORIGINS; o++)
+			PrintAttLatency(origins[o], &stats[i].Totals[o]);
+
+		for (ULONG j = 0; j < stats[i].ConnectionCount && j < FILTER_MAX_CONNECTIONS; j++) {
+			PFILTER_ATT_CONNECTION_STATS conn = &stats[i].Connections[j];
+
+			printf("  Connection 0x%03x: %d outstanding, %lu responses to requests not seen\n",
+				conn->Handle, conn->Pending, conn->Unmatched);
+
+			for (int o = 0; o < FILTER_ATT_ORIGINS; o++)
+				PrintAttLatency(origins[o], &conn->Origins[o]);
+		}
+	}
+}
+
+VOID
+PrintVoiceSession(
+	const char * name,
+	PFILTER_VOICE_SESSION session
+)
+{
+	printf("  %-8s %5lu frames in %llu.%03llu s to att 0x%02x, %lu missing, %lu repeated, %lu reordered, %lu late,\n",
+		name, session->Frames,
+		(session->End - session->Start) / 10000000,
+		(session->End - session->Start) / 10000 % 1000,
+		session->Attribute, session->Missing, session->Duplicates,
+		session->Reordered, session->Late);
+	printf("           %lu short, %lu trimmed, %lu of %lu bytes expected came, %lu passed up, jitter %lu.%03lu ms, longest gap %lu.%03lu ms\n",
+		session->Short, session->Trimmed, session->Bytes, session->ExpectedBytes,
+		session->DeliveredBytes,
+		session->JitterUs / 1000, session->JitterUs % 1000,
+		session->MaxGapUs / 1000, session->MaxGapUs % 1000);
+}
+
+VOID
+PrintVoiceStats()
+{
+	static FILTER_VOICE_STATS	stats[4];
+	ULONG	bytes;
+	CHAR	name[16];
+
+	if (!DeviceIoControl(hControlDevice,
+		IOCTL_GET_VOICE_STATS,
+		NULL, 0,
+		stats, sizeof(stats),
+		&bytes, NULL)) {
+		printf("IOCTL_GET_VOICE_STATS request failed:0x%x\n", GetLastError());
+		return;
+	}
+
+	for (ULONG i = 0; i < bytes / sizeof(FILTER_VOICE_STATS); i++) {
+		printf("\nAdapter %lu voice sessions, %lu since the adapter started:\n", i, stats[i].TotalSessions);
+
+		for (ULONG j = 0; j < stats[i].SessionCount && j < FILTER_VOICE_SESSIONS; j++) {
+			sprintf_s(name, sizeof(name), "0x%03x", stats[i].Sessions[j].Handle);
+			PrintVoiceSession(name, &stats[i].Sessions[j]);
+		}
+
+		for (ULONG j = 0; j < stats[i].ActiveCount && j < FILTER_MAX_CONNECTIONS; j++) {
+			sprintf_s(name, sizeof(name), "0x%03x*", stats[i].Active[j].Handle);
+			PrintVoiceSession(name, &stats[i].Active[j]);
+		}
+
+		if (stats[i].TotalSessions)
+			PrintVoiceSession("total", &stats[i].Totals);
+	}
+}
+
+VOID
+PrintReportMap(
+	PFILTER_REPORT_MAP map
+)
+{
+	static const char * states[] = { "none", "reading", "read", "set" };
+	static REPORT_MAP	compiled;
+
+	printf("  Connection 0x%03x: report map att 0x%02x %s, %u bytes%s%s\n",
+		map->Handle, map->Attribute,
+		map->State < ARRAYSIZE(states) ? states[map->State] : "?",
+		map->Length,
+		(map->Flags & FILTER_REPORT_MAP_COMPILED) ? ", compiled" : "",
+		(map->Flags & FILTER_REPORT_MAP_DECODING) ? ", decoding reports" : "");
+
+	for (ULONG i = 0; i < map->Length && i < FILTER_REPORT_MAP_MAX; i++)
+		printf("%s%02x%s", i % 16 ? " " : "    ", map->Map[i], i % 16 == 15 || i + 1 == map->Length ? "\n" : "");
+
+	if (map->Length == 0 || !ReportMapCompile(&compiled, map->Map, min(map->Length, FILTER_REPORT_MAP_MAX)))
+		return;
+
+	for (ULONG r = 0; r < compiled.ReportCount; r++) {
+		PREPORT_INFO info = &compiled.Reports[r];
+
+		printf("    Report %u, %u bits:\n", info->Id, info->Bits);
+
+		for (ULONG f = info->FirstField; f < (ULONG)info->FirstField + info->FieldCount; f++) {
+			PREPORT_FIELD field = &compiled.Fields[f];
+
+			printf("      bit %3u %2u x %2u bits %-5s %04x:%04x-%04x logical %ld to %ld%s%s\n",
+				field->BitOffset, field->Count, field->BitSize,
+				(field->Flags & REPORT_FIELD_ARRAY) ? "array" : "var",
+				field->UsagePage, field->UsageMin, field->UsageMax,
+				field->LogicalMin, field->LogicalMax,
+				(field->Flags & REPORT_FIELD_RELATIVE) ? " relative" : "",
+				(field->Flags & REPORT_FIELD_SIGNED) ? " signed" : "");
+		}
+	}
+}
+
+VOID
+PrintReportMaps()
+{
+	static FILTER_REPORT_MAPS	maps[4];
+	ULONG	bytes;
+
+	if (!DeviceIoControl(hControlDevice,
+		IOCTL_GET_REPORT_MAPS,
+		NULL, 0,
+		maps, sizeof(maps),
+		&bytes, NULL)) {
+		printf("IOCTL_GET_REPORT_MAPS request failed:0x%x\n", GetLastError());
+		return;
+	}
+
+	for (ULONG i = 0; i < bytes / sizeof(FILTER_REPORT_MAPS); i++) {
+		printf("\nAdapter %lu report maps:\n", i);
+
+		for (ULONG j = 0; j < maps[i].ConnectionCount && j < FILTER_MAX_CONNECTIONS; j++)
+			PrintReportMap(&maps[i].Connections[j]);
+	}
+}
+
 INT __cdecl
 main(
 	_In_ int argc,
@@ -89,6 +1453,10 @@ main(
 			case 'F':
 				bFixHciL2cap = TRUE;
 				break;
+			case 'n':
+			case 'N':
+				bNoFixHciL2cap = TRUE;
+				break;
 			case 'i':
 			case 'I':
 				bDebugDataIn = TRUE;
@@ -97,6 +1465,122 @@ main(
 			case 'O':
 				bDebugDataOut = TRUE;
 				break;
+			case 'c':
+			case 'C':
+				bGetCapture = TRUE;
+				break;
+			case 'w':
+			case 'W':
+				if (i + 1 >= argc) {
+					Usage();
+					return retValue;
+				}
+				pCaptureFile = argv[++i];
+				bGetCapture = TRUE;
+				break;
+			case 'k':
+			case 'K':
+				if (i + 1 >= argc) {
+					Usage();
+					return retValue;
+				}
+				pTracepointKeywords = argv[++i];
+				break;
+			case 'p':
+			case 'P':
+				bGetTracepoints = TRUE;
+				break;
+			case 'e':
+			case 'E':
+				if (i + 1 >= argc) {
+					Usage();
+					return retValue;
+				}
+				pEventConfig = argv[++i];
+				break;
+			case 'm':
+			case 'M':
+				if (i + 1 >= argc) {
+					Usage();
+					return retValue;
+				}
+				pSmoothConfig = argv[++i];
+				break;
+			case 'r':
+			case 'R':
+				bReadEvents = TRUE;
+				break;
+			case 'u':
+			case 'U':
+				if (i + 1 >= argc) {
+					Usage();
+					return retValue;
+				}
+				pSubscription = argv[++i];
+				bReadEvents = TRUE;
+				break;
+			case 'g':
+			case 'G':
+				bGestures = TRUE;
+				bReadEvents = TRUE;
+				break;
+			case 'b':
+			case 'B':
+				bButtons = TRUE;
+				bReadEvents = TRUE;
+				break;
+			case 'l':
+			case 'L':
+				bGetAttStats = TRUE;
+				break;
+			case 'a':
+			case 'A':
+				if (i + 1 >= argc) {
+					Usage();
+					return retValue;
+				}
+				pActivateConfig = argv[++i];
+				break;
+			case 's':
+			case 'S':
+				if (i + 1 >= argc) {
+					Usage();
+					return retValue;
+				}
+				pWatchdogConfig = argv[++i];
+				break;
+			case 'q':
+			case 'Q':
+				if (i + 1 >= argc) {
+					Usage();
+					return retValue;
+				}
+				pVoiceConfig = argv[++i];
+				break;
+			case 'v':
+			case 'V':
+				bGetVoiceStats = TRUE;
+				break;
+			case 'h':
+			case 'H':
+				bGetReportMaps = TRUE;
+				break;
+			case 'd':
+			case 'D':
+				if (i + 1 >= argc) {
+					Usage();
+					return retValue;
+				}
+				pReportMap = argv[++i];
+				break;
+			case 't':
+			case 'T':
+				if (i + 1 >= argc) {
+					Usage();
+					return retValue;
+				}
+				pTraceFilter = argv[++i];
+				break;
 			default:
 				Usage();
 				return retValue;
@@ -141,7 +1625,7 @@ main(
 			goto exit;
 		}
 	}
-	else
+	else if (bNoFixHciL2cap)
 	{
 		if (!SendIoctlToFilterDevice(IOCTL_FIX_HCI_L2CAP_HEADERS_OFF, "IOCTL_FIX_HCI_L2CAP_HEADERS_OFF"))
 		{
@@ -149,6 +1633,14 @@ main(
 			goto exit;
 		}
 	}
+	else
+	{
+		if (!SendIoctlToFilterDevice(IOCTL_FIX_HCI_L2CAP_HEADERS_AUTO, "IOCTL_FIX_HCI_L2CAP_HEADERS_AUTO"))
+		{
+			retValue = 1;
+			goto exit;
+		}
+	}
 
 	if (bDebugDataIn)
 	{
@@ -184,6 +1676,74 @@ main(
 		}
 	}
 
+	if (!SendTraceFilter())
+	{
+		retValue = 1;
+		goto exit;
+	}
+
+	if (pTracepointKeywords && !SendTracepointKeywords())
+	{
+		retValue = 1;
+		goto exit;
+	}
+
+	if (pEventConfig && !SendEventConfig())
+	{
+		retValue = 1;
+		goto exit;
+	}
+
+	if (pSmoothConfig && !SendSmoothConfig())
+	{
+		retValue = 1;
+		goto exit;
+	}
+
+	if (pActivateConfig && !SendActivateConfig())
+	{
+		retValue = 1;
+		goto exit;
+	}
+
+	if (pWatchdogConfig && !SendWatchdogConfig())
+	{
+		retValue = 1;
+		goto exit;
+	}
+
+	if (pVoiceConfig && !SendVoiceConfig())
+	{
+		retValue = 1;
+		goto exit;
+	}
+
+	if (pReportMap && !SendReportMap())
+	{
+		retValue = 1;
+		goto exit;
+	}
+
+	PrintAdapterInfo();
+
+	if (bGetCapture)
+		PrintCapture();
+
+	if (bGetTracepoints)
+		PrintTracepoints();
+
+	if (bGetAttStats)
+		PrintAttStats();
+
+	if (bGetVoiceStats)
+		PrintVoiceStats();
+
+	if (bGetReportMaps)
+		PrintReportMaps();
+
+	if (bReadEvents)
+		ReadEvents();
+
 	printf("\nPress any key to exit...\n");
 	fflush(stdin);
 	ch = _getche();
@@ -0,0 +1,691 @@
+/*++
+
+Based of Windows Driver Samples - Toaster Project
+https://github.com/microsoft/Windows-driver-samples/tree/master/general/toaster
+
+Module Name:
+
+    public.h
+
+Abstract:
+
+    Ioctls and structures shared between the SiriRemote filter driver and
+    the usermode applications talking to its control device.
+
+Environment:
+
+    Kernel mode and usermode
+
+--*/
+
+#if !defined(_PUBLIC_H_)
+#define _PUBLIC_H_
+
+#define IOCTL_FIX_HCI_L2CAP_HEADERS_OFF     CTL_CODE(FILE_DEVICE_UNKNOWN, 0x10, METHOD_BUFFERED, FILE_READ_DATA)
+#define IOCTL_FIX_HCI_L2CAP_HEADERS_ON      CTL_CODE(FILE_DEVICE_UNKNOWN, 0x11, METHOD_BUFFERED, FILE_READ_DATA)
+#define IOCTL_FIX_HCI_L2CAP_HEADERS_AUTO    CTL_CODE(FILE_DEVICE_UNKNOWN, 0x12, METHOD_BUFFERED, FILE_READ_DATA)
+#define IOCTL_DEBUG_DATA_IN_OFF             CTL_CODE(FILE_DEVICE_UNKNOWN, 0x20, METHOD_BUFFERED, FILE_READ_DATA)
+#define IOCTL_DEBUG_DATA_IN_ON              CTL_CODE(FILE_DEVICE_UNKNOWN, 0x21, METHOD_BUFFERED, FILE_READ_DATA)
+#define IOCTL_DEBUG_DATA_OUT_OFF            CTL_CODE(FILE_DEVICE_UNKNOWN, 0x30, METHOD_BUFFERED, FILE_READ_DATA)
+#define IOCTL_DEBUG_DATA_OUT_ON             CTL_CODE(FILE_DEVICE_UNKNOWN, 0x31, METHOD_BUFFERED, FILE_READ_DATA)
+
+//
+// Output: one FILTER_ADAPTER_INFO per adapter the filter is attached to,
+// as many as fit in the output buffer.
+//
+#define IOCTL_GET_ADAPTER_INFO              CTL_CODE(FILE_DEVICE_UNKNOWN, 0x40, METHOD_BUFFERED, FILE_READ_DATA)
+
+//
+// Input: a TRACE_FILTER_PROGRAM deciding which packets DEBUG_DATA_IN/OUT
+// dump. A program without instructions dumps everything again.
+//
+#define IOCTL_SET_TRACE_FILTER              CTL_CODE(FILE_DEVICE_UNKNOWN, 0x50, METHOD_BUFFERED, FILE_READ_DATA)
+
+//
+// Input: FILTER_CAPTURE_CONFIG, applied to every adapter.
+//
+#define IOCTL_SET_CAPTURE_CONFIG            CTL_CODE(FILE_DEVICE_UNKNOWN, 0x60, METHOD_BUFFERED, FILE_READ_DATA)
+
+//
+// Output: FILTER_CAPTURE_HEADER followed by its records. Returns the first
+// frozen capture window of any adapter and re-arms that adapter, or the
+// state of the first adapter with no records if nothing triggered.
+//
+#define IOCTL_GET_CAPTURE                   CTL_CODE(FILE_DEVICE_UNKNOWN, 0x61, METHOD_BUFFERED, FILE_READ_DATA)
+
+//
+// Input: ULONG of TRACEPOINT_KEYWORD_* to enable, see tracepoints.h.
+//
+#define IOCTL_SET_TRACEPOINT_KEYWORDS       CTL_CODE(FILE_DEVICE_UNKNOWN, 0x70, METHOD_BUFFERED, FILE_READ_DATA)
+
+//
+// Input: ULONG sequence of the first record wanted, 0 for the oldest kept.
+// Output: TRACEPOINT_BUFFER_HEADER followed by its records.
+//
+#define IOCTL_GET_TRACEPOINTS               CTL_CODE(FILE_DEVICE_UNKNOWN, 0x71, METHOD_BUFFERED, FILE_READ_DATA)
+
+//
+// Input: FILTER_EVENT_CONFIG, applied to every adapter.
+//
+#define IOCTL_SET_EVENT_CONFIG              CTL_CODE(FILE_DEVICE_UNKNOWN, 0x80, METHOD_BUFFERED, FILE_READ_DATA)
+
+//
+// Output: FILTER_EVENT_BUFFER_HEADER followed by the events and then the
+// voice frames matching the handle's subscription, each oldest first.
+// Returns at once, with nothing if nothing is queued. Fails with
+// STATUS_INVALID_DEVICE_STATE on a handle that didn't subscribe.
+//
+#define IOCTL_GET_EVENTS                    CTL_CODE(FILE_DEVICE_UNKNOWN, 0x81, METHOD_BUFFERED, FILE_READ_DATA)
+
+//
+// Input: FILTER_EVENT_SUBSCRIPTION. Subscribes the handle the request is
+// sent on, or changes the subscription it has. Closing the handle ends it.
+//
+#define IOCTL_SUBSCRIBE_EVENTS              CTL_CODE(FILE_DEVICE_UNKNOWN, 0x82, METHOD_BUFFERED, FILE_READ_DATA)
+
+//
+// Output: FILTER_CLOCK, the driver's clocks read together, for mapping the
+// Stamp of events onto the reader's clock.
+//
+#define IOCTL_GET_CLOCK                     CTL_CODE(FILE_DEVICE_UNKNOWN, 0x83, METHOD_BUFFERED, FILE_READ_DATA)
+
+//
+// Input: FILTER_SMOOTH_CONFIG, applied to every adapter.
+//
+#define IOCTL_SET_SMOOTH_CONFIG             CTL_CODE(FILE_DEVICE_UNKNOWN, 0x84, METHOD_BUFFERED, FILE_READ_DATA)
+
+//
+// Input: FILTER_ACTIVATE_CONFIG, applied to every adapter.
+//
+#define IOCTL_SET_ACTIVATE_CONFIG           CTL_CODE(FILE_DEVICE_UNKNOWN, 0x90, METHOD_BUFFERED, FILE_READ_DATA)
+
+//
+// Output: one FILTER_ATT_STATS per adapter the filter is attached to, as
+// many as fit in the output buffer.
+//
+#define IOCTL_GET_ATT_STATS                 CTL_CODE(FILE_DEVICE_UNKNOWN, 0xA0, METHOD_BUFFERED, FILE_READ_DATA)
+
+//
+// Input: FILTER_WATCHDOG_CONFIG, applied to every adapter.
+//
+#define IOCTL_SET_WATCHDOG_CONFIG           CTL_CODE(FILE_DEVICE_UNKNOWN, 0xB0, METHOD_BUFFERED, FILE_READ_DATA)
+
+//
+// Input: FILTER_VOICE_CONFIG, applied to every adapter.
+//
+#define IOCTL_SET_VOICE_CONFIG              CTL_CODE(FILE_DEVICE_UNKNOWN, 0xC0, METHOD_BUFFERED, FILE_READ_DATA)
+
+//
+// Output: one FILTER_VOICE_STATS per adapter the filter is attached to, as
+// many as fit in the output buffer.
+//
+#define IOCTL_GET_VOICE_STATS               CTL_CODE(FILE_DEVICE_UNKNOWN, 0xC1, METHOD_BUFFERED, FILE_READ_DATA)
+
+//
+// Output: one FILTER_REPORT_MAPS per adapter the filter is attached to, as
+// many as fit in the output buffer.
+//
+#define IOCTL_GET_REPORT_MAPS               CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD0, METHOD_BUFFERED, FILE_READ_DATA)
+
+//
+// Input: FILTER_REPORT_MAP, the map of the connection with its Handle on
+// every adapter. Fails with STATUS_INVALID_PARAMETER for a map that doesn't
+// compile and STATUS_NOT_FOUND if no adapter has the connection.
+//
+#define IOCTL_SET_REPORT_MAP                CTL_CODE(FILE_DEVICE_UNKNOWN, 0xD1, METHOD_BUFFERED, FILE_READ_DATA)
+
+//
+// When the HCI/L2CAP header fix is applied to incoming notifications.
+// AUTO decides per adapter and connection from the adapter's LE limits
+// and the exchanged ATT MTU, ON and OFF override it.
+//
+#define FIX_HCI_L2CAP_HEADERS_MODE_OFF      0
+#define FIX_HCI_L2CAP_HEADERS_MODE_ON       1
+#define FIX_HCI_L2CAP_HEADERS_MODE_AUTO     2
+
+#define FILTER_MAX_CONNECTIONS              8
+
+//
+// The filter never saw the connection complete, it only knows the
+// connection from its traffic.
+//
+#define FILTER_CONNECTION_ADOPTED           0x01
+#define FILTER_CONNECTION_ENCRYPTED         0x02
+#define FILTER_CONNECTION_FIX_FORCED        0x04    // the watchdog applied the header fix
+
+typedef struct _FILTER_CONNECTION_INFO {
+
+    USHORT  Handle;
+    USHORT  AttMtu;         // exchanged ATT MTU, 0 if no exchange was seen
+    USHORT  FixAttLength;   // ATT length notifications are trimmed to, 0 for none
+    UCHAR   Flags;          // FILTER_CONNECTION_*
+    UCHAR   PeerAddressType;
+    UCHAR   PeerAddress[6]; // little endian, as in HCI
+    UCHAR   ActivateState;  // FILTER_ACTIVATE_STATE_*
+    UCHAR   ActivateError;  // ATT error that failed the activation
+    USHORT  ActivateMs;     // from connection complete to activated
+    USHORT  Stalls;         // the watchdog saw on the connection
+
+} FILTER_CONNECTION_INFO, *PFILTER_CONNECTION_INFO;
+
+#define FILTER_ADAPTER_VERSION_VALID        0x01
+#define FILTER_ADAPTER_BUFFER_VALID         0x02
+#define FILTER_ADAPTER_LE_BUFFER_VALID      0x04
+#define FILTER_ADAPTER_VERSION_PRESUMED     0x08    // LmpVersion is from the controller profile
+
+typedef struct _FILTER_ADAPTER_INFO {
+
+    UCHAR   Flags;          // FILTER_ADAPTER_*_VALID
+    UCHAR   FixMode;        // FIX_HCI_L2CAP_HEADERS_MODE_*
+    UCHAR   HciVersion;
+    UCHAR   LmpVersion;
+    USHORT  Manufacturer;
+    USHORT  LmpSubversion;
+    USHORT  AclDataPacketLength;
+    USHORT  LeAclDataPacketLength;
+    USHORT  DefaultFixAttLength;
+    USHORT  ConnectionCount;
+    ULONG   Stalls;         // the watchdog saw on the adapter, since it started
+    ULONG   Recoveries;     // stalled connections that streamed again
+
+    FILTER_CONNECTION_INFO Connections[FILTER_MAX_CONNECTIONS];
+
+} FILTER_ADAPTER_INFO, *PFILTER_ADAPTER_INFO;
+
+//
+// Trace predicates
+//
+// A program is a list of tests. Each test compares one property of the
+// packet with [Low, High] and continues JumpTrue or JumpFalse instructions
+// past the next one. Jumps only go forward, so a program runs at most once
+// through. Running off the end rejects the packet.
+//
+#define TRACE_FILTER_MAX_INSNS              32
+
+#define TRACE_OP_ACCEPT                     0x00
+#define TRACE_OP_REJECT                     0x01
+#define TRACE_OP_KIND                       0x02    // TRACE_KIND_*
+#define TRACE_OP_DIRECTION                  0x03    // 0 out, 1 in
+#define TRACE_OP_LENGTH                     0x04    // transfer length
+#define TRACE_OP_ACL_HANDLE                 0x05    // false for events and continuing fragments
+#define TRACE_OP_CID                        0x06
+#define TRACE_OP_ATT_OPCODE                 0x07
+#define TRACE_OP_ATT_HANDLE                 0x08    // false for ATT PDUs without a handle
+#define TRACE_OP_SAMPLE                     0x09    // true every Low-th time it is reached
+#define TRACE_OP_RATE_LIMIT                 0x0A    // true for Low per second, bursts of High
+
+#define TRACE_KIND_ACL                      0
+#define TRACE_KIND_HCI_EVENT                1
+
+typedef struct _TRACE_FILTER_INSN {
+
+    UCHAR   Op;         // TRACE_OP_*
+    UCHAR   JumpTrue;
+    UCHAR   JumpFalse;
+    UCHAR   Reserved;
+    USHORT  Low;
+    USHORT  High;
+
+} TRACE_FILTER_INSN, *PTRACE_FILTER_INSN;
+
+typedef struct _TRACE_FILTER_PROGRAM {
+
+    ULONG               InsnCount;
+    TRACE_FILTER_INSN   Insns[1];   // InsnCount of them
+
+} TRACE_FILTER_PROGRAM, *PTRACE_FILTER_PROGRAM;
+
+#define TRACE_FILTER_PROGRAM_SIZE(InsnCount) \
+    (FIELD_OFFSET(TRACE_FILTER_PROGRAM, Insns) + (InsnCount) * sizeof(TRACE_FILTER_INSN))
+
+//
+// Triggered capture
+//
+// Every adapter keeps the last packets in a small ring. When a trigger
+// fires the ring keeps PreTrigger packets from before it, records
+// PostTrigger more and then freezes until the window is read with
+// IOCTL_GET_CAPTURE.
+//
+#define FILTER_CAPTURE_RECORDS              128
+#define FILTER_CAPTURE_SNAPLEN              64
+
+#define FILTER_CAPTURE_TRIGGER_NOTIFICATION_GAP 0x01    // streaming connection went quiet
+#define FILTER_CAPTURE_TRIGGER_TRUNCATED        0x02    // ACL transfer shorter than its HCI header says
+#define FILTER_CAPTURE_TRIGGER_SEND_FAILURE     0x04    // WdfRequestSend failed
+#define FILTER_CAPTURE_TRIGGER_WATCHDOG         0x08    // the watchdog saw a stall
+#define FILTER_CAPTURE_TRIGGER_ALL              0x0F
+
+#define FILTER_CAPTURE_ARMED                0
+#define FILTER_CAPTURE_TRIGGERED            1   // recording the packets after the trigger
+#define FILTER_CAPTURE_FROZEN               2
+
+typedef struct _FILTER_CAPTURE_CONFIG {
+
+    ULONG   TriggerMask;    // FILTER_CAPTURE_TRIGGER_*, 0 stops capturing
+    USHORT  PreTrigger;     // PreTrigger + PostTrigger < FILTER_CAPTURE_RECORDS
+    USHORT  PostTrigger;
+    ULONG   GapMs;          // notification gap that counts as a stall
+
+} FILTER_CAPTURE_CONFIG, *PFILTER_CAPTURE_CONFIG;
+
+typedef struct _FILTER_CAPTURE_RECORD {
+
+    LONGLONG    Time;           // interrupt time, 100ns units
+    USHORT      Length;         // transfer length on the pipe
+    UCHAR       Kind;           // TRACE_KIND_*
+    UCHAR       Direction;      // 0 out, 1 in
+    USHORT      CapturedLength; // bytes of Data used
+    USHORT      Reserved;
+    UCHAR       Data[FILTER_CAPTURE_SNAPLEN];
+
+} FILTER_CAPTURE_RECORD, *PFILTER_CAPTURE_RECORD;
+
+typedef struct _FILTER_CAPTURE_HEADER {
+
+    UCHAR       State;          // FILTER_CAPTURE_*
+    UCHAR       Trigger;        // FILTER_CAPTURE_TRIGGER_* that fired
+    USHORT      TriggerHandle;  // connection it fired on, 0xFFFF for none
+    ULONG       Adapter;        // index of the adapter the window is from
+    ULONG       RecordCount;
+    ULONG       TriggerRecord;  // first record at or after the trigger
+    LONGLONG    TriggerTime;
+
+} FILTER_CAPTURE_HEADER, *PFILTER_CAPTURE_HEADER;
+
+//
+// Remote events
+//
+// The filter decodes the hid reports it redirects into button and touch
+// events and queues them for IOCTL_GET_EVENTS, so a reader doesn't need a
+// GATT notification per report. Trackpad moves of a contact that arrive
+// within CoalesceMs of the first one are merged into one event with the
+// summed deltas and the latest position. Button changes, touch down and
+// touch up are never merged.
+//
+// Voice frames go through a queue of their own, so a held voice button
+// can't delay a press. A read takes every queued event before any voice
+// frame.
+//
+// Up to FILTER_EVENT_MAX_SUBSCRIBERS handles can subscribe, each reading
+// the one copy of the queues through cursors of its own. A full event
+// queue makes room by folding its oldest move into the next move of the
+// contact, as long as no subscriber has read one but not the other. When
+// there is none to fold the new event is turned away and counted in the
+// Lost of the subscribers that wanted it, a queued event is never dropped
+// unread. So edges are only missed once the queue holds nothing but edges
+// its slowest subscriber hasn't read. The voice queue drops its oldest
+// frame when it is full.
+//
+// Events and voice frames carry the performance counter of when the URB
+// with their last report completed, and a read the counter of when it took
+// them, so a reader can tell how long its input spent in the driver. The
+// counter is KeQueryPerformanceCounter's, which on Windows is the one
+// QueryPerformanceCounter reads too. IOCTL_GET_CLOCK gives its frequency
+// and a sample of it with the interrupt time, for readers with another
+// clock.
+//
+#define FILTER_EVENT_QUEUE_LENGTH           256
+#define FILTER_VOICE_QUEUE_LENGTH           64
+#define FILTER_VOICE_SNAPLEN                128
+#define FILTER_EVENT_MAX_SUBSCRIBERS        8
+
+#define FILTER_EVENT_CLASS_INPUT            0x01    // FILTER_EVENTs
+#define FILTER_EVENT_CLASS_VOICE            0x02    // FILTER_VOICE_FRAMEs
+#define FILTER_EVENT_CLASS_ALL              0x03
+
+#define FILTER_EVENT_ANY_HANDLE             0xFFFF
+
+#define FILTER_EVENT_BUTTONS                1   // button bitmap changed
+#define FILTER_EVENT_TOUCH_DOWN             2
+#define FILTER_EVENT_TOUCH_MOVE             3
+#define FILTER_EVENT_TOUCH_UP               4
+
+typedef struct _FILTER_EVENT_CONFIG {
+
+    ULONG   Enable;         // 0 stops decoding reports into events
+    ULONG   CoalesceMs;     // 0 delivers every move
+
+} FILTER_EVENT_CONFIG, *PFILTER_EVENT_CONFIG;
+
+//
+// Trackpad smoothing
+//
+// The remote's reports come in lumps of a connection interval, and their
+// positions are a few units noisy. Smoothing runs every position of a
+// touch through a One-Euro filter before it is coalesced: a low pass
+// whose cutoff is MinCutoffMilliHz while the finger is still and rises by
+// Beta milliHz per unit a second of its speed, so slow moves lose their
+// noise and fast ones keep up. The speed is itself low passed at
+// DerivativeCutoffMilliHz. With LookaheadMs the position is then
+// predicted that far ahead along the speed, to make up for the time the
+// reports spent on the air.
+//
+// Reports closer together than ReportUs are taken as sent ReportUs apart,
+// since the ones that share a connection event arrive at about the same
+// time. A touch down starts over at its own position, so the smoothing
+// never carries from one touch to the next, and a touch up carries the
+// last position delivered.
+//
+#define FILTER_SMOOTH_DEFAULT_MIN_CUTOFF    1000    // milliHz
+#define FILTER_SMOOTH_DEFAULT_BETA          20      // milliHz per unit/s
+#define FILTER_SMOOTH_DEFAULT_D_CUTOFF      1000    // milliHz
+#define FILTER_SMOOTH_DEFAULT_REPORT_US     11111   // 90 reports a second
+
+typedef struct _FILTER_SMOOTH_CONFIG {
+
+    ULONG   Enable;                     // 0 delivers the positions as reported
+    ULONG   MinCutoffMilliHz;
+    ULONG   Beta;
+    ULONG   DerivativeCutoffMilliHz;
+    ULONG   LookaheadMs;                // 0 predicts nothing
+    ULONG   ReportUs;                   // 0 takes the reports' arrival times
+
+} FILTER_SMOOTH_CONFIG, *PFILTER_SMOOTH_CONFIG;
+
+typedef struct _FILTER_EVENT_SUBSCRIPTION {
+
+    ULONG   Classes;        // FILTER_EVENT_CLASS_*
+    USHORT  Handle;         // connection, FILTER_EVENT_ANY_HANDLE for all
+    USHORT  Attribute;      // ATT handle the reports came in on, FILTER_EVENT_ANY_HANDLE for all
+
+} FILTER_EVENT_SUBSCRIPTION, *PFILTER_EVENT_SUBSCRIPTION;
+
+typedef struct _FILTER_EVENT {
+
+    LONGLONG    Time;       // interrupt time of the last report in the event, 100ns units
+    USHORT      Handle;     // connection the reports came in on
+    UCHAR       Type;       // FILTER_EVENT_*
+    UCHAR       Contact;    // touch events only
+    USHORT      Buttons;    // bitmap after the event
+    USHORT      Reports;    // reports merged into the event
+    USHORT      X;          // latest position of the contact
+    USHORT      Y;
+    SHORT       DeltaX;     // movement since the previous event of the contact
+    SHORT       DeltaY;
+    USHORT      Attribute;  // ATT handle the reports came in on
+    USHORT      Reserved[3];
+    LONGLONG    Stamp;      // performance counter at the completion of the last report's URB
+
+} FILTER_EVENT, *PFILTER_EVENT;
+
+typedef struct _FILTER_VOICE_FRAME {
+
+    LONGLONG    Time;           // interrupt time, 100ns units
+    USHORT      Handle;
+    USHORT      Length;         // length of the notification value
+    USHORT      CapturedLength; // bytes of Data used
+    USHORT      Attribute;      // ATT handle of the notification
+    LONGLONG    Stamp;          // performance counter at the completion of the URB
+    UCHAR       Data[FILTER_VOICE_SNAPLEN];
+
+} FILTER_VOICE_FRAME, *PFILTER_VOICE_FRAME;
+
+typedef struct _FILTER_EVENT_BUFFER_HEADER {
+
+    ULONG   EventCount;
+    ULONG   Lost;           // events this handle missed since its last read
+    ULONG   VoiceCount;
+    ULONG   VoiceLost;      // voice frames this handle missed since its last read
+    LONGLONG Taken;         // performance counter when the read took them
+
+} FILTER_EVENT_BUFFER_HEADER, *PFILTER_EVENT_BUFFER_HEADER;
+
+typedef struct _FILTER_CLOCK {
+
+    LONGLONG    PerformanceCounter;
+    LONGLONG    Frequency;          // performance counter ticks per second
+    LONGLONG    InterruptTime;      // 100ns units
+
+} FILTER_CLOCK, *PFILTER_CLOCK;
+
+//
+// Activation
+//
+// The remote only sends hid reports once notifications are enabled on its
+// hid report and the magic value is written to its hid control. With
+// FILTER_ACTIVATE_AUTO the filter writes both itself as soon as a remote it
+// knows is connected and encrypted, and hides the write responses from the
+// host stack. A remote is known when it is in Peers or, with
+// FILTER_ACTIVATE_LEARN, once an application activated it through the
+// battery service.
+//
+#define FILTER_ACTIVATE_MAX_PEERS           4
+
+#define FILTER_ACTIVATE_AUTO                0x01
+#define FILTER_ACTIVATE_LEARN               0x02
+#define FILTER_ACTIVATE_DEFAULT             (FILTER_ACTIVATE_AUTO | FILTER_ACTIVATE_LEARN)
+
+#define FILTER_ACTIVATE_STATE_NONE          0   // not a remote we know
+#define FILTER_ACTIVATE_STATE_WAITING       1   // for encryption
+#define FILTER_ACTIVATE_STATE_SENDING       2
+#define FILTER_ACTIVATE_STATE_DONE          3
+#define FILTER_ACTIVATE_STATE_FAILED        4
+#define FILTER_ACTIVATE_STATE_BY_HOST       5   // an application activated it
+
+typedef struct _FILTER_ACTIVATE_PEER {
+
+    UCHAR   AddressType;    // as in LE Connection Complete
+    UCHAR   Address[6];     // little endian, as in HCI
+    UCHAR   Reserved;
+
+} FILTER_ACTIVATE_PEER, *PFILTER_ACTIVATE_PEER;
+
+typedef struct _FILTER_ACTIVATE_CONFIG {
+
+    ULONG                   Flags;      // FILTER_ACTIVATE_*
+    ULONG                   PeerCount;  // replaces the known remotes, learned ones too
+    FILTER_ACTIVATE_PEER    Peers[FILTER_ACTIVATE_MAX_PEERS];
+
+} FILTER_ACTIVATE_CONFIG, *PFILTER_ACTIVATE_CONFIG;
+
+//
+// ATT transactions
+//
+// The filter times every ATT request that goes down to a remote until its
+// response, or error response, comes back. The host stack's requests and
+// the filter's own writes are counted apart. Adapter is the part of the
+// time until the adapter completed the transfer, the rest is spent on the
+// air and in the remote. A request not answered within the 30 seconds ATT
+// allows counts as a timeout, one still outstanding when the connection
+// goes as unanswered.
+//
+// Histogram bucket 0 counts times under 1 ms, bucket n times from 2^(n-1)
+// up to 2^n ms, the last bucket everything longer.
+//
+#define FILTER_ATT_HISTOGRAM_BUCKETS        16
+
+#define FILTER_ATT_ORIGIN_HOST              0
+#define FILTER_ATT_ORIGIN_FILTER            1   // activation writes
+#define FILTER_ATT_ORIGINS                  2
+
+typedef struct _FILTER_ATT_LATENCY {
+
+    ULONG       Requests;
+    ULONG       Responses;  // error responses included
+    ULONG       Errors;
+    ULONG       Timeouts;
+    ULONG       Unanswered;
+    ULONG       MaxMs;
+    ULONGLONG   TotalUs;    // of all the responses, for the mean
+    ULONG       Adapter[FILTER_ATT_HISTOGRAM_BUCKETS];
+    ULONG       RoundTrip[FILTER_ATT_HISTOGRAM_BUCKETS];
+
+} FILTER_ATT_LATENCY, *PFILTER_ATT_LATENCY;
+
+typedef struct _FILTER_ATT_CONNECTION_STATS {
+
+    USHORT              Handle;
+    UCHAR               Pending;    // requests outstanding
+    UCHAR               Reserved;
+    ULONG               Unmatched;  // responses to requests never seen
+    FILTER_ATT_LATENCY  Origins[FILTER_ATT_ORIGINS];
+
+} FILTER_ATT_CONNECTION_STATS, *PFILTER_ATT_CONNECTION_STATS;
+
+typedef struct _FILTER_ATT_STATS {
+
+    ULONG                       ConnectionCount;
+    ULONG                       Reserved;
+
+    //
+    // Of every connection since the adapter started, the ones gone too.
+    //
+    FILTER_ATT_LATENCY          Totals[FILTER_ATT_ORIGINS];
+
+    FILTER_ATT_CONNECTION_STATS Connections[FILTER_MAX_CONNECTIONS];
+
+} FILTER_ATT_STATS, *PFILTER_ATT_STATS;
+
+//
+// Stall watchdog
+//
+// The upper stack can hang on a notification longer than it accepts, the
+// remote then looks dead until it reconnects. The watchdog follows the
+// notifications passed up on each connection. Once one streamed
+// FILTER_WATCHDOG_STREAMING notifications in a row, each within GapMs of
+// the previous one, going quiet for longer than GapMs right after a
+// notification too long for the header fix counts as a stall. Button and
+// trackpad streams end on short reports, and voice on the button report
+// after it, so they don't look stalled. With FILTER_WATCHDOG_ANY_GAP any
+// gap of a streaming connection counts.
+//
+// Stalls are always counted. FILTER_WATCHDOG_ACTION_TRIGGER also fires the
+// watchdog capture trigger, FILTER_WATCHDOG_ACTION_FIX trims the
+// notifications of the connection from then on like the manual header fix,
+// unless the fix was turned off. A stalled connection that streams again
+// counts as recovered.
+//
+#define FILTER_WATCHDOG_STREAMING           8
+#define FILTER_WATCHDOG_DEFAULT_GAP_MS      500
+
+#define FILTER_WATCHDOG_ACTION_TRIGGER      0x01
+#define FILTER_WATCHDOG_ACTION_FIX          0x02
+#define FILTER_WATCHDOG_ACTION_DEFAULT      (FILTER_WATCHDOG_ACTION_TRIGGER | FILTER_WATCHDOG_ACTION_FIX)
+
+#define FILTER_WATCHDOG_ANY_GAP             0x01
+
+typedef struct _FILTER_WATCHDOG_CONFIG {
+
+    ULONG   GapMs;          // 0 stops the watchdog
+    ULONG   Actions;        // FILTER_WATCHDOG_ACTION_*
+    ULONG   Flags;          // FILTER_WATCHDOG_*
+
+} FILTER_WATCHDOG_CONFIG, *PFILTER_WATCHDOG_CONFIG;
+
+//
+// Voice accounting
+//
+// The filter follows the voice notifications of each connection in
+// sessions. A session starts with the first voice frame and ends when the
+// connection sends none for GapMs, disconnects or starts a session on
+// another handle. Each adapter keeps its FILTER_VOICE_SESSIONS latest
+// finished sessions and the ones going on.
+//
+// A frame shorter than the longest of its session was cut before it got
+// to the filter, one the header fix trimmed reaches the upper stack cut.
+// Frames the remote sent that never came in are counted from the frame
+// counter at SequenceOffset of the value, which wraps at 256, or without
+// one from the frames FrameHz says the session should have had. Without
+// either they aren't counted. A duplicate repeats the counter of the frame
+// before it, or without a counter all its bytes. Frames a reader missed
+// are the VoiceLost of its reads.
+//
+// Jitter is the interarrival jitter of RFC 3550 against the period of
+// FrameHz, or without it the mean gap of the session so far.
+//
+#define FILTER_VOICE_SESSIONS               8
+#define FILTER_VOICE_DEFAULT_GAP_MS         250
+#define FILTER_VOICE_NO_SEQUENCE            0xFFFF
+
+typedef struct _FILTER_VOICE_CONFIG {
+
+    USHORT  SequenceOffset; // byte of the value counting frames, FILTER_VOICE_NO_SEQUENCE for none
+    USHORT  FrameHz;        // frames per second a remote sends, 0 if not known
+    ULONG   GapMs;          // a pause this long ends a session
+
+} FILTER_VOICE_CONFIG, *PFILTER_VOICE_CONFIG;
+
+typedef struct _FILTER_VOICE_SESSION {
+
+    LONGLONG    Start;          // interrupt time of the first frame, 100ns units
+    LONGLONG    End;            // and of the last
+    USHORT      Handle;
+    USHORT      Attribute;
+    ULONG       Frames;         // that came in, duplicates too
+    ULONG       Missing;        // sent and never came in
+    ULONG       Duplicates;
+    ULONG       Reordered;      // came in after a frame sent later
+    ULONG       Late;           // came more than two periods after the previous frame
+    ULONG       Short;          // cut before the filter got them
+    ULONG       Trimmed;        // cut by the header fix
+    ULONG       Bytes;          // of the values that came in
+    ULONG       ExpectedBytes;  // at the longest length, of the frames sent
+    ULONG       DeliveredBytes; // passed up after the header fix
+    ULONG       JitterUs;
+    ULONG       MaxGapUs;
+    ULONG       Reserved;
+
+} FILTER_VOICE_SESSION, *PFILTER_VOICE_SESSION;
+
+typedef struct _FILTER_VOICE_STATS {
+
+    ULONG                   SessionCount;   // finished sessions in Sessions
+    ULONG                   ActiveCount;    // sessions going on in Active
+    ULONG                   TotalSessions;  // finished since the adapter started
+    ULONG                   Reserved;
+
+    //
+    // Of every finished session, counts summed and the highest JitterUs
+    // and MaxGapUs. Start and End are the first session's and the last's.
+    //
+    FILTER_VOICE_SESSION    Totals;
+
+    FILTER_VOICE_SESSION    Sessions[FILTER_VOICE_SESSIONS];    // oldest first
+    FILTER_VOICE_SESSION    Active[FILTER_MAX_CONNECTIONS];
+
+} FILTER_VOICE_STATS, *PFILTER_VOICE_STATS;
+
+//
+// HID report maps
+//
+// The filter keeps the Report Map, the HID report descriptor, of each
+// connection as the host reads it: it learns the handle of the Report Map
+// characteristic from the host's discovery of the characteristics, then
+// puts together the values of the reads of that handle. A host that kept
+// the GATT database of a bonded remote may neither discover nor read it
+// again, IOCTL_SET_REPORT_MAP gives the filter the map then.
+//
+// With a map that compiles and has the buttons or the trackpad position of
+// an input report, the filter decodes the reports of that length with it
+// rather than with the layout it knows, see coalesce.h.
+//
+#define FILTER_REPORT_MAP_MAX               512     // longest an attribute value can be
+
+#define FILTER_REPORT_MAP_STATE_NONE        0
+#define FILTER_REPORT_MAP_STATE_READING     1
+#define FILTER_REPORT_MAP_STATE_READ        2
+#define FILTER_REPORT_MAP_STATE_SET         3   // with IOCTL_SET_REPORT_MAP
+
+#define FILTER_REPORT_MAP_COMPILED          0x01
+#define FILTER_REPORT_MAP_DECODING          0x02    // the filter decodes with it
+
+typedef struct _FILTER_REPORT_MAP {
+
+    USHORT  Handle;         // of the connection
+    USHORT  Attribute;      // of the Report Map value, 0 if not discovered
+    UCHAR   State;          // FILTER_REPORT_MAP_STATE_*
+    UCHAR   Flags;          // FILTER_REPORT_MAP_*
+    USHORT  Length;
+    UCHAR   Map[FILTER_REPORT_MAP_MAX];
+
+} FILTER_REPORT_MAP, *PFILTER_REPORT_MAP;
+
+typedef struct _FILTER_REPORT_MAPS {
+
+    ULONG               ConnectionCount;
+    ULONG               Reserved;
+    FILTER_REPORT_MAP   Connections[FILTER_MAX_CONNECTIONS];
+
+} FILTER_REPORT_MAPS, *PFILTER_REPORT_MAPS;
+
+#endif
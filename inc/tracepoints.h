@@ -0,0 +1,111 @@
+/*++
+
+Module Name:
+
+    tracepoints.h
+
+Abstract:
+
+    Binary tracepoint records of the SiriRemote filter driver and the
+    schema describing them, shared with the usermode tools decoding them.
+
+    A record carries the tracepoint id and up to four 64 bit fields. The
+    schema below gives each field its name and how it is shown, the driver
+    never formats anything.
+
+Environment:
+
+    Kernel mode and usermode
+
+--*/
+
+#if !defined(_TRACEPOINTS_H_)
+#define _TRACEPOINTS_H_
+
+//
+// Levels, a tracepoint above TRACEPOINT_COMPILED_LEVEL is not compiled in.
+//
+#define TRACEPOINT_LEVEL_ERROR              1
+#define TRACEPOINT_LEVEL_INFO               2
+#define TRACEPOINT_LEVEL_VERBOSE            3
+
+//
+// Keywords, enabled at run time with IOCTL_SET_TRACEPOINT_KEYWORDS.
+//
+#define TRACEPOINT_KEYWORD_URB              0x00000001  // every URB down and back up
+#define TRACEPOINT_KEYWORD_REWRITE          0x00000002  // packets the filter changed
+#define TRACEPOINT_KEYWORD_ERROR            0x00000004
+#define TRACEPOINT_KEYWORD_ACTIVATE         0x00000008  // writes the filter sends itself
+
+#define TRACEPOINT_KEYWORDS_DEFAULT         (TRACEPOINT_KEYWORD_REWRITE | TRACEPOINT_KEYWORD_ERROR | TRACEPOINT_KEYWORD_ACTIVATE)
+
+//
+// How a field is shown
+//
+#define TRACEPOINT_FIELD_NONE               0
+#define TRACEPOINT_FIELD_DEC                1
+#define TRACEPOINT_FIELD_HEX                2
+#define TRACEPOINT_FIELD_PTR                3
+#define TRACEPOINT_FIELD_STATUS             4
+
+//
+// Transfer buffer kinds for TRACEPOINT_TRANSFER_BUFFER
+//
+#define TRACEPOINT_BUFFER_NONE              0
+#define TRACEPOINT_BUFFER_FLAT              1
+#define TRACEPOINT_BUFFER_MDL               2
+#define TRACEPOINT_BUFFER_FLAT_AND_MDL      3   // MDL ignored
+
+//
+// TP(Id, Name, Field0, Type0, Field1, Type1, Field2, Type2, Field3, Type3)
+//
+#define TRACEPOINT_SCHEMA(TP) \
+    TP(TRACEPOINT_INTERNAL_IOCTL,   "InternalIoctl",    "Code", HEX,            "", NONE,               "", NONE,               "", NONE) \
+    TP(TRACEPOINT_URB_SUBMIT,       "UrbSubmit",        "Urb", PTR,             "Function", HEX,        "TransferFlags", HEX,   "TransferBufferLength", DEC) \
+    TP(TRACEPOINT_URB_COMPLETE,     "UrbComplete",      "Urb", PTR,             "Function", HEX,        "Status", STATUS,       "TransferBufferLength", DEC) \
+    TP(TRACEPOINT_TRANSFER_BUFFER,  "TransferBuffer",   "Urb", PTR,             "Kind", DEC,            "", NONE,               "", NONE) \
+    TP(TRACEPOINT_MDL_MAP_FAILED,   "MdlMapFailed",     "Urb", PTR,             "", NONE,               "", NONE,               "", NONE) \
+    TP(TRACEPOINT_ATT_REWRITE,      "AttRewrite",       "Handle", HEX,          "Opcode", HEX,          "AttHandle", HEX,       "NewAttHandle", HEX) \
+    TP(TRACEPOINT_HEADER_FIX,       "HeaderFix",        "Handle", HEX,          "TransferBufferLength", DEC, "FixAttLength", DEC, "", NONE) \
+    TP(TRACEPOINT_SEND_FAILED,      "SendFailed",       "Status", STATUS,       "", NONE,               "", NONE,               "", NONE) \
+    TP(TRACEPOINT_ACTIVATE_SEND,    "ActivateSend",     "Handle", HEX,          "AttHandle", HEX,       "Length", DEC,          "", NONE) \
+    TP(TRACEPOINT_ACTIVATE_RESPONSE, "ActivateResponse", "Handle", HEX,         "State", DEC,           "Error", HEX,           "ActivateMs", DEC) \
+    TP(TRACEPOINT_WATCHDOG_STALL,   "WatchdogStall",    "Handle", HEX,          "GapMs", DEC,           "Actions", HEX,         "", NONE) \
+    TP(TRACEPOINT_ACL_HOLD,         "AclHold",          "Handle", HEX,          "Length", DEC,          "", NONE,               "", NONE)
+
+#define TRACEPOINT_SCHEMA_ID(Id, ...) Id,
+
+typedef enum _TRACEPOINT_ID {
+
+    TRACEPOINT_NONE = 0,
+    TRACEPOINT_SCHEMA(TRACEPOINT_SCHEMA_ID)
+    TRACEPOINT_COUNT
+
+} TRACEPOINT_ID;
+
+#define TRACEPOINT_MAX_FIELDS               4
+
+typedef struct _TRACEPOINT_RECORD {
+
+    ULONG       Sequence;   // 1 for the first record ever written
+    USHORT      Id;         // TRACEPOINT_ID
+    UCHAR       Level;
+    UCHAR       Reserved;
+    LONGLONG    Time;       // interrupt time, 100ns units
+    ULONGLONG   Fields[TRACEPOINT_MAX_FIELDS];
+
+} TRACEPOINT_RECORD, *PTRACEPOINT_RECORD;
+
+//
+// Output of IOCTL_GET_TRACEPOINTS, followed by RecordCount records.
+//
+typedef struct _TRACEPOINT_BUFFER_HEADER {
+
+    ULONG       NextSequence;   // pass back in the next request
+    ULONG       Lost;           // overwritten before they were read
+    ULONG       RecordCount;
+    ULONG       Keywords;       // TRACEPOINT_KEYWORD_* enabled
+
+} TRACEPOINT_BUFFER_HEADER, *PTRACEPOINT_BUFFER_HEADER;
+
+#endif
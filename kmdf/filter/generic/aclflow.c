@@ -0,0 +1,428 @@
+/*++
+
+Module Name:
+
+    aclflow.c
+
+Abstract:
+
+    ACL buffer accounting, see aclflow.h.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "aclflow.h"
+
+#define READ_USHORT(Bfr)    ((USHORT)((Bfr)[0] | ((Bfr)[1] << 8)))
+
+VOID
+AclFlowInit(
+    PACL_FLOW_STATE State
+    )
+{
+    ULONG i;
+
+    RtlZeroMemory(State, sizeof(ACL_FLOW_STATE));
+
+    for (i = 0; i < HCI_MAX_CONNECTIONS; i++) {
+        State->Connections[i].Handle = HCI_INVALID_HANDLE;
+    }
+}
+
+VOID
+AclFlowSetBuffers(
+    PACL_FLOW_STATE State,
+    USHORT          AclTotal,
+    USHORT          LeTotal
+    )
+{
+    State->Totals[ACL_FLOW_POOL_ACL] = AclTotal;
+    State->Totals[ACL_FLOW_POOL_LE] = LeTotal;
+}
+
+static PACL_FLOW_CONNECTION
+AclFlowSlot(
+    PACL_FLOW_STATE State,
+    ULONG           Stream,
+    USHORT          Handle
+    )
+/*++
+
+Routine Description:
+
+    The slot counting the packets on Handle. A connection the link state
+    adopted without a connection complete takes its free slot here.
+
+--*/
+{
+    PACL_FLOW_CONNECTION conn;
+
+    if (Stream >= HCI_MAX_CONNECTIONS) {
+        return &State->Connections[ACL_FLOW_OTHER];
+    }
+
+    conn = &State->Connections[Stream];
+
+    if (conn->Handle == HCI_INVALID_HANDLE) {
+        conn->Handle = Handle;
+    }
+
+    return conn->Handle == Handle ? conn : &State->Connections[ACL_FLOW_OTHER];
+}
+
+static ULONG
+AclFlowPool(
+    PACL_FLOW_STATE State,
+    ULONG           Index
+    )
+{
+    return Index < HCI_MAX_CONNECTIONS && State->Totals[ACL_FLOW_POOL_LE] != 0 ?
+        ACL_FLOW_POOL_LE : ACL_FLOW_POOL_ACL;
+}
+
+static VOID
+AclFlowPoolUse(
+    PACL_FLOW_STATE State,
+    ULONG           Pool,
+    PULONG          Host,
+    PULONG          Own,
+    PULONG          Waiting,
+    PULONG          Total
+    )
+/*++
+
+Routine Description:
+
+    Adds up the packets in the buffers of a pool, and ours waiting for
+    one. A total that was never read is taken to be one buffer.
+
+--*/
+{
+    ULONG i;
+
+    *Host = 0;
+    *Own = 0;
+    *Waiting = 0;
+
+    for (i = 0; i <= ACL_FLOW_OTHER; i++) {
+        if (AclFlowPool(State, i) == Pool) {
+            *Host += State->Connections[i].Host;
+            *Own += State->Connections[i].Own;
+            *Waiting += State->Connections[i].WaitingLength != 0 ? 1 : 0;
+        }
+    }
+
+    *Total = max(State->Totals[Pool], 1);
+}
+
+VOID
+AclFlowConnected(
+    PACL_FLOW_STATE State,
+    ULONG           Stream,
+    USHORT          Handle
+    )
+{
+    if (Stream >= HCI_MAX_CONNECTIONS) {
+        return;
+    }
+
+    RtlZeroMemory(&State->Connections[Stream], sizeof(ACL_FLOW_CONNECTION));
+    State->Connections[Stream].Handle = Handle;
+}
+
+VOID
+AclFlowDisconnected(
+    PACL_FLOW_STATE State,
+    ULONG           Stream
+    )
+/*++
+
+Routine Description:
+
+    The controller flushes the packets of a connection that is gone, their
+    buffers are free again without a completion.
+
+--*/
+{
+    if (Stream >= HCI_MAX_CONNECTIONS) {
+        return;
+    }
+
+    RtlZeroMemory(&State->Connections[Stream], sizeof(ACL_FLOW_CONNECTION));
+    State->Connections[Stream].Handle = HCI_INVALID_HANDLE;
+}
+
+BOOLEAN
+AclFlowHostMaySend(
+    PACL_FLOW_STATE State,
+    ULONG           Stream,
+    USHORT          Handle
+    )
+/*++
+
+Routine Description:
+
+    TRUE if a host packet can go down now. The host keeps to its own count,
+    so only while packets of ours are in the pool or waiting for it it has
+    to leave room for them.
+
+--*/
+{
+    PACL_FLOW_CONNECTION    conn = AclFlowSlot(State, Stream, Handle);
+    ULONG                   host;
+    ULONG                   own;
+    ULONG                   waiting;
+    ULONG                   total;
+
+    AclFlowPoolUse(State, AclFlowPool(State, (ULONG)(conn - State->Connections)), &host, &own, &waiting, &total);
+
+    return own + waiting == 0 || host + own + waiting < total;
+}
+
+VOID
+AclFlowHostSent(
+    PACL_FLOW_STATE State,
+    ULONG           Stream,
+    USHORT          Handle
+    )
+{
+    PACL_FLOW_CONNECTION conn = AclFlowSlot(State, Stream, Handle);
+
+    if (conn->Host < 0xFFFF) {
+        conn->Host++;
+    }
+}
+
+VOID
+AclFlowHostFailed(
+    PACL_FLOW_STATE State,
+    ULONG           Stream,
+    USHORT          Handle
+    )
+/*++
+
+Routine Description:
+
+    A host packet that was counted never made it to the controller.
+
+--*/
+{
+    PACL_FLOW_CONNECTION conn = AclFlowSlot(State, Stream, Handle);
+
+    if (conn->Host != 0) {
+        conn->Host--;
+    }
+}
+
+BOOLEAN
+AclFlowOwnSend(
+    PACL_FLOW_STATE State,
+    ULONG           Stream,
+    const UCHAR     *Packet,
+    ULONG           Length
+    )
+/*++
+
+Routine Description:
+
+    Counts a packet of ours if a buffer is free for it, otherwise keeps it
+    until AclFlowNextWaiting hands it back. A packet still waiting on the
+    connection is replaced, the activation that sent it has moved on.
+
+Return Value:
+
+    TRUE if the packet is to be sent now.
+
+--*/
+{
+    PACL_FLOW_CONNECTION    conn = AclFlowSlot(State, Stream, HCI_ACL_HANDLE(Packet));
+    ULONG                   host;
+    ULONG                   own;
+    ULONG                   waiting;
+    ULONG                   total;
+
+    conn->WaitingLength = 0;
+
+    AclFlowPoolUse(State, AclFlowPool(State, (ULONG)(conn - State->Connections)), &host, &own, &waiting, &total);
+
+    if (host + own < total) {
+        conn->Own++;
+        return TRUE;
+    }
+
+    if (Length <= sizeof(conn->Waiting)) {
+        RtlCopyMemory(conn->Waiting, Packet, Length);
+        conn->WaitingLength = (USHORT)Length;
+    }
+
+    return FALSE;
+}
+
+ULONG
+AclFlowNextWaiting(
+    PACL_FLOW_STATE State,
+    PULONG          Stream,
+    PUCHAR          Packet
+    )
+/*++
+
+Routine Description:
+
+    Hands back a waiting packet of ours that a buffer was freed for, and
+    counts it.
+
+Return Value:
+
+    Length of the packet to send, 0 for none.
+
+--*/
+{
+    PACL_FLOW_CONNECTION    conn;
+    ULONG                   host;
+    ULONG                   own;
+    ULONG                   waiting;
+    ULONG                   total;
+    ULONG                   length;
+    ULONG                   i;
+
+    for (i = 0; i <= ACL_FLOW_OTHER; i++) {
+        conn = &State->Connections[i];
+
+        if (conn->WaitingLength == 0) {
+            continue;
+        }
+
+        AclFlowPoolUse(State, AclFlowPool(State, i), &host, &own, &waiting, &total);
+
+        if (host + own < total) {
+            length = conn->WaitingLength;
+            RtlCopyMemory(Packet, conn->Waiting, length);
+            conn->WaitingLength = 0;
+            conn->Own++;
+            *Stream = i;
+            return length;
+        }
+    }
+
+    return 0;
+}
+
+VOID
+AclFlowOwnFailed(
+    PACL_FLOW_STATE State,
+    ULONG           Stream,
+    USHORT          Handle
+    )
+/*++
+
+Routine Description:
+
+    A packet of ours that was counted never made it to the controller.
+
+--*/
+{
+    PACL_FLOW_CONNECTION conn = AclFlowSlot(State, Stream, Handle);
+
+    if (conn->Own != 0) {
+        conn->Own--;
+    }
+}
+
+ULONG
+AclFlowCompletedPackets(
+    PACL_FLOW_STATE State,
+    PUCHAR          Bfr,
+    ULONG           Length
+    )
+/*++
+
+Routine Description:
+
+    Takes the buffers the controller handed back off the connections and
+    removes ours from the Number Of Completed Packets event, in place.
+
+    code len n  handle count ...
+     13  05  01  40 00  02 00
+
+    The controller completes a connection's packets in the order they went
+    down, but which of them were ours isn't in the event, so a completion
+    goes to our packets first. The host then never gets a buffer back that
+    it doesn't have out, only some of them a little later.
+
+Return Value:
+
+    Length of the event as the host is to see it, 0 if nothing is left of
+    it for the host. Anything but a Number Of Completed Packets event
+    keeps its length.
+
+--*/
+{
+    PACL_FLOW_CONNECTION    conn;
+    PUCHAR                  entry;
+    ULONG                   count;
+    ULONG                   kept = 0;
+    ULONG                   completed;
+    ULONG                   own;
+    USHORT                  handle;
+    ULONG                   i;
+    ULONG                   j;
+
+    if (Length < HCI_EVENT_HEADER_LENGTH + 1 || Bfr[0] != HCI_EV_NUMBER_OF_COMPLETED_PACKETS) {
+        return Length;
+    }
+
+    count = Bfr[2];
+
+    if (Bfr[1] < 1 + 4 * count || Length < HCI_EVENT_HEADER_LENGTH + 1 + 4 * count) {
+        return Length;
+    }
+
+    for (i = 0; i < count; i++) {
+        entry = &Bfr[HCI_EVENT_HEADER_LENGTH + 1 + 4 * i];
+        handle = READ_USHORT(&entry[0]) & 0x0FFF;
+        completed = READ_USHORT(&entry[2]);
+
+        conn = &State->Connections[ACL_FLOW_OTHER];
+
+        for (j = 0; j < HCI_MAX_CONNECTIONS; j++) {
+            if (State->Connections[j].Handle == handle) {
+                conn = &State->Connections[j];
+                break;
+            }
+        }
+
+        own = min(completed, (ULONG)conn->Own);
+        conn->Own = (USHORT)(conn->Own - own);
+        completed -= own;
+        conn->Host = (USHORT)(conn->Host - min(completed, (ULONG)conn->Host));
+
+        //
+        // An entry that was all ours goes, the rest move up over it.
+        //
+        if (completed == 0 && own != 0) {
+            continue;
+        }
+
+        Bfr[HCI_EVENT_HEADER_LENGTH + 1 + 4 * kept] = entry[0];
+        Bfr[HCI_EVENT_HEADER_LENGTH + 1 + 4 * kept + 1] = entry[1];
+        Bfr[HCI_EVENT_HEADER_LENGTH + 1 + 4 * kept + 2] = (UCHAR)completed;
+        Bfr[HCI_EVENT_HEADER_LENGTH + 1 + 4 * kept + 3] = (UCHAR)(completed >> 8);
+        kept++;
+    }
+
+    if (kept == count) {
+        return Length;
+    }
+
+    if (kept == 0) {
+        return 0;
+    }
+
+    Bfr[1] = (UCHAR)(1 + 4 * kept);
+    Bfr[2] = (UCHAR)kept;
+
+    return HCI_EVENT_HEADER_LENGTH + 1 + 4 * kept;
+}
@@ -0,0 +1,152 @@
+/*++
+
+Module Name:
+
+    aclflow.h
+
+Abstract:
+
+    HCI ACL flow control for the packets the filter sends itself.
+
+    The controller takes a fixed number of ACL packets, given by Read
+    Buffer Size and LE Read Buffer Size, and hands each buffer back with a
+    Number Of Completed Packets event once the packet went out. The host
+    stack only sends while it has buffers left by its own count, so a packet
+    of ours can only go down while one is free, and its completion has to
+    be taken out of the event before the host sees it, or the host counts
+    a buffer it never used and overruns the controller.
+
+    Every ACL packet going down the out pipe is counted against its
+    connection and every completion taken off again, the filter's own
+    first. A packet of ours without a free buffer waits here, one per
+    connection, which is all an activation ever has outstanding. While one
+    of ours is in the controller the host may believe in a buffer that
+    isn't free, so its packets are held back until one is.
+
+    Connections with dedicated LE buffers draw on those, everything else,
+    BR/EDR links and handles the link state doesn't know, on the ACL
+    buffers. The caller serializes all calls for one ACL_FLOW_STATE.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "hci.h"
+#include "activate.h"
+
+#if !defined(_ACLFLOW_H_)
+#define _ACLFLOW_H_
+
+#define ACL_FLOW_POOL_ACL               0
+#define ACL_FLOW_POOL_LE                1
+#define ACL_FLOW_POOLS                  2
+
+//
+// Slot counting the packets on handles without a connection slot.
+//
+#define ACL_FLOW_OTHER                  HCI_MAX_CONNECTIONS
+
+typedef struct _ACL_FLOW_CONNECTION {
+
+    USHORT      Handle;         // HCI_INVALID_HANDLE while the slot is free
+    USHORT      Host;           // packets in the controller, the host's
+    USHORT      Own;            // and ours
+    USHORT      WaitingLength;  // of our packet waiting for a buffer, 0 for none
+    UCHAR       Waiting[ACTIVATE_MAX_PACKET];
+
+} ACL_FLOW_CONNECTION, *PACL_FLOW_CONNECTION;
+
+typedef struct _ACL_FLOW_STATE {
+
+    //
+    // Buffers of the controller, 0 until the host read them. An LE total
+    // of 0 shares the ACL buffers.
+    //
+    USHORT                  Totals[ACL_FLOW_POOLS];
+
+    //
+    // Indexed like the connection slots of the link state, then
+    // ACL_FLOW_OTHER.
+    //
+    ACL_FLOW_CONNECTION     Connections[HCI_MAX_CONNECTIONS + 1];
+
+} ACL_FLOW_STATE, *PACL_FLOW_STATE;
+
+VOID
+AclFlowInit(
+    PACL_FLOW_STATE State
+    );
+
+VOID
+AclFlowSetBuffers(
+    PACL_FLOW_STATE State,
+    USHORT          AclTotal,
+    USHORT          LeTotal
+    );
+
+VOID
+AclFlowConnected(
+    PACL_FLOW_STATE State,
+    ULONG           Stream,
+    USHORT          Handle
+    );
+
+VOID
+AclFlowDisconnected(
+    PACL_FLOW_STATE State,
+    ULONG           Stream
+    );
+
+BOOLEAN
+AclFlowHostMaySend(
+    PACL_FLOW_STATE State,
+    ULONG           Stream,
+    USHORT          Handle
+    );
+
+VOID
+AclFlowHostSent(
+    PACL_FLOW_STATE State,
+    ULONG           Stream,
+    USHORT          Handle
+    );
+
+VOID
+AclFlowHostFailed(
+    PACL_FLOW_STATE State,
+    ULONG           Stream,
+    USHORT          Handle
+    );
+
+BOOLEAN
+AclFlowOwnSend(
+    PACL_FLOW_STATE State,
+    ULONG           Stream,
+    const UCHAR     *Packet,
+    ULONG           Length
+    );
+
+ULONG
+AclFlowNextWaiting(
+    PACL_FLOW_STATE State,
+    PULONG          Stream,
+    PUCHAR          Packet
+    );
+
+VOID
+AclFlowOwnFailed(
+    PACL_FLOW_STATE State,
+    ULONG           Stream,
+    USHORT          Handle
+    );
+
+ULONG
+AclFlowCompletedPackets(
+    PACL_FLOW_STATE State,
+    PUCHAR          Bfr,
+    ULONG           Length
+    );
+
+#endif
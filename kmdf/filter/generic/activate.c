@@ -0,0 +1,592 @@
+/*++
+
+Module Name:
+
+    activate.c
+
+Abstract:
+
+    Remote activation state machine, see activate.h.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "activate.h"
+#include "profile.h"
+
+#define ACTIVATE_TICKS_PER_MS   10000
+
+//
+// The writes of an activation, in the order the console application
+// makes them.
+//
+static const struct {
+    USHORT  Attribute;
+    UCHAR   Length;
+    UCHAR   Value[2];
+} ActivateWrites[ACTIVATE_STEP_COUNT] = {
+    { SIRI_ATT_HID_REPORT_CCCD, 2, { 0x01, 0x00 } },
+    { SIRI_ATT_HID_CONTROL,     1, { SIRI_MAGIC_VALUE } },
+};
+
+VOID
+ActivateInit(
+    PACTIVATE_STATE State
+    )
+{
+    ULONG i;
+
+    RtlZeroMemory(State, sizeof(ACTIVATE_STATE));
+
+    State->Flags = FILTER_ACTIVATE_DEFAULT;
+
+    for (i = 0; i < HCI_MAX_CONNECTIONS; i++) {
+        State->Connections[i].Handle = HCI_INVALID_HANDLE;
+    }
+}
+
+BOOLEAN
+ActivateConfigure(
+    PACTIVATE_STATE                 State,
+    const FILTER_ACTIVATE_CONFIG    *Config
+    )
+/*++
+
+Routine Description:
+
+    Replaces the flags and the known remotes. Turning FILTER_ACTIVATE_AUTO
+    off stops the activations still waiting, writes already sent finish.
+
+Return Value:
+
+    FALSE if the configuration is invalid.
+
+--*/
+{
+    ULONG i;
+
+    if (Config->PeerCount > FILTER_ACTIVATE_MAX_PEERS) {
+        return FALSE;
+    }
+
+    State->Flags = Config->Flags;
+    State->PeerCount = Config->PeerCount;
+    State->NextPeer = 0;
+    RtlCopyMemory(State->Peers, Config->Peers, Config->PeerCount * sizeof(FILTER_ACTIVATE_PEER));
+
+    if (!(State->Flags & FILTER_ACTIVATE_AUTO)) {
+        for (i = 0; i < HCI_MAX_CONNECTIONS; i++) {
+            PACTIVATE_CONNECTION conn = &State->Connections[i];
+
+            if (conn->State == FILTER_ACTIVATE_STATE_WAITING ||
+                (conn->State == FILTER_ACTIVATE_STATE_SENDING && !conn->Sent)) {
+                conn->State = FILTER_ACTIVATE_STATE_NONE;
+            }
+        }
+    }
+
+    return TRUE;
+}
+
+static BOOLEAN
+ActivateIsKnown(
+    PACTIVATE_STATE State,
+    UCHAR           PeerAddressType,
+    const UCHAR     *PeerAddress
+    )
+/*++
+
+Routine Description:
+
+    Looks a remote up among the known ones. Only bit 0 of the address type
+    tells public from random, the identity address types of the enhanced
+    connection complete set bit 1 on top.
+
+--*/
+{
+    ULONG i;
+
+    for (i = 0; i < State->PeerCount; i++) {
+        if (((State->Peers[i].AddressType ^ PeerAddressType) & 0x01) == 0 &&
+            RtlEqualMemory(State->Peers[i].Address, PeerAddress, sizeof(State->Peers[i].Address))) {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+static PACTIVATE_CONNECTION
+ActivateLookup(
+    PACTIVATE_STATE State,
+    ULONG           Stream,
+    USHORT          Handle
+    )
+{
+    if (Stream >= HCI_MAX_CONNECTIONS || State->Connections[Stream].Handle != Handle) {
+        return NULL;
+    }
+
+    return &State->Connections[Stream];
+}
+
+static BOOLEAN
+ActivateTracking(
+    PACTIVATE_CONNECTION Conn
+    )
+/*++
+
+Routine Description:
+
+    TRUE while the requests on the connection are counted, from the
+    connection of a known remote until its activation ended.
+
+--*/
+{
+    return Conn->State == FILTER_ACTIVATE_STATE_WAITING ||
+           Conn->State == FILTER_ACTIVATE_STATE_SENDING;
+}
+
+static VOID
+ActivateRemovePending(
+    PACTIVATE_CONNECTION    Conn,
+    ULONG                   Index
+    )
+{
+    UCHAR below = (UCHAR)((1 << Index) - 1);
+
+    Conn->Ours = (UCHAR)((Conn->Ours & below) | ((Conn->Ours >> 1) & ~below));
+    Conn->Pending--;
+}
+
+static ULONG
+ActivateNext(
+    PACTIVATE_CONNECTION    Conn,
+    PUCHAR                  Packet
+    )
+/*++
+
+Routine Description:
+
+    Builds the next write of an activation once nothing is outstanding on
+    the connection.
+
+    ---HCI----- ---L2CAP--- ----ATT-----
+    80 00 08 00 04 00 04 00 12 1d 00 af
+
+Return Value:
+
+    Length of the packet to send, 0 for none.
+
+--*/
+{
+    ULONG attLength;
+
+    if (Conn->State != FILTER_ACTIVATE_STATE_SENDING || Conn->Sent || Conn->Pending != 0) {
+        return 0;
+    }
+
+    attLength = 3 + ActivateWrites[Conn->Step].Length;
+
+    Packet[0] = (UCHAR)Conn->Handle;
+    Packet[1] = (UCHAR)(((Conn->Handle >> 8) & 0x0F) | (HCI_ACL_PB_FIRST_NON_FLUSHABLE << 4));
+    Packet[2] = (UCHAR)(L2CAP_HEADER_LENGTH + attLength);
+    Packet[3] = 0;
+    Packet[4] = (UCHAR)attLength;
+    Packet[5] = 0;
+    Packet[6] = (UCHAR)L2CAP_CID_ATT;
+    Packet[7] = 0;
+    Packet[8] = ATT_OP_WRITE_REQ;
+    Packet[9] = (UCHAR)ActivateWrites[Conn->Step].Attribute;
+    Packet[10] = (UCHAR)(ActivateWrites[Conn->Step].Attribute >> 8);
+    RtlCopyMemory(&Packet[11], ActivateWrites[Conn->Step].Value, ActivateWrites[Conn->Step].Length);
+
+    Conn->Sent = TRUE;
+    Conn->Ours = 0x01;
+    Conn->Pending = 1;
+
+    return ATT_PDU_OFFSET + attLength;
+}
+
+VOID
+ActivateConnected(
+    PACTIVATE_STATE State,
+    ULONG           Stream,
+    USHORT          Handle,
+    UCHAR           PeerAddressType,
+    const UCHAR     *PeerAddress,
+    LONGLONG        Now
+    )
+/*++
+
+Routine Description:
+
+    Starts a connection over in its slot. A known remote waits for its
+    link to be encrypted.
+
+--*/
+{
+    PACTIVATE_CONNECTION conn;
+
+    if (Stream >= HCI_MAX_CONNECTIONS) {
+        return;
+    }
+
+    conn = &State->Connections[Stream];
+
+    RtlZeroMemory(conn, sizeof(ACTIVATE_CONNECTION));
+    conn->Handle = Handle;
+    conn->ConnectedAt = Now;
+
+    if ((State->Flags & FILTER_ACTIVATE_AUTO) &&
+        ActivateIsKnown(State, PeerAddressType, PeerAddress)) {
+        conn->State = FILTER_ACTIVATE_STATE_WAITING;
+    }
+}
+
+VOID
+ActivateDisconnected(
+    PACTIVATE_STATE State,
+    ULONG           Stream
+    )
+{
+    if (Stream >= HCI_MAX_CONNECTIONS) {
+        return;
+    }
+
+    RtlZeroMemory(&State->Connections[Stream], sizeof(ACTIVATE_CONNECTION));
+    State->Connections[Stream].Handle = HCI_INVALID_HANDLE;
+}
+
+ULONG
+ActivateEncrypted(
+    PACTIVATE_STATE State,
+    ULONG           Stream,
+    USHORT          Handle,
+    PUCHAR          Packet
+    )
+/*++
+
+Routine Description:
+
+    The link of a connection was encrypted, a waiting activation starts.
+
+Return Value:
+
+    Length of the packet to send, 0 for none.
+
+--*/
+{
+    PACTIVATE_CONNECTION conn = ActivateLookup(State, Stream, Handle);
+
+    if (conn == NULL) {
+        return 0;
+    }
+
+    conn->Encrypted = TRUE;
+
+    if (conn->State == FILTER_ACTIVATE_STATE_WAITING) {
+        conn->State = FILTER_ACTIVATE_STATE_SENDING;
+        conn->Step = ACTIVATE_STEP_NOTIFY_ENABLE;
+    }
+
+    return ActivateNext(conn, Packet);
+}
+
+BOOLEAN
+ActivateHostRequest(
+    PACTIVATE_STATE State,
+    ULONG           Stream,
+    const UCHAR     *Bfr,
+    ULONG           Length
+    )
+/*++
+
+Routine Description:
+
+    Counts an ATT request the host sends on a connection being activated.
+
+Return Value:
+
+    FALSE if a write of ours is outstanding, the request isn't counted and
+    has to wait until the response to ours was hidden.
+
+--*/
+{
+    PACTIVATE_CONNECTION conn;
+
+    if (!HCI_IS_ATT_PDU(Bfr, Length) || !ATT_IS_REQUEST(Bfr[ATT_PDU_OFFSET])) {
+        return TRUE;
+    }
+
+    conn = ActivateLookup(State, Stream, HCI_ACL_HANDLE(Bfr));
+
+    if (conn == NULL || !ActivateTracking(conn)) {
+        return TRUE;
+    }
+
+    if (conn->Sent) {
+        return FALSE;
+    }
+
+    //
+    // A host that doesn't wait for its responses would overflow Ours,
+    // stop telling them apart rather than guess.
+    //
+    if (conn->Pending < 8) {
+        conn->Pending++;
+    }
+
+    return TRUE;
+}
+
+ULONG
+ActivateHostFailed(
+    PACTIVATE_STATE State,
+    ULONG           Stream,
+    const UCHAR     *Bfr,
+    ULONG           Length,
+    PUCHAR          Packet
+    )
+/*++
+
+Routine Description:
+
+    A host request that was counted never made it to the adapter, it won't
+    be answered. It is the newest of the host's outstanding.
+
+Return Value:
+
+    Length of the write of ours to send now, 0 for none.
+
+--*/
+{
+    PACTIVATE_CONNECTION    conn;
+    ULONG                   i;
+
+    if (!HCI_IS_ATT_PDU(Bfr, Length) || !ATT_IS_REQUEST(Bfr[ATT_PDU_OFFSET])) {
+        return 0;
+    }
+
+    conn = ActivateLookup(State, Stream, HCI_ACL_HANDLE(Bfr));
+
+    if (conn == NULL || !ActivateTracking(conn)) {
+        return 0;
+    }
+
+    for (i = conn->Pending; i-- > 0;) {
+        if (!(conn->Ours & (1 << i))) {
+            ActivateRemovePending(conn, i);
+            break;
+        }
+    }
+
+    return ActivateNext(conn, Packet);
+}
+
+VOID
+ActivateByHost(
+    PACTIVATE_STATE State,
+    ULONG           Stream,
+    USHORT          Handle,
+    UCHAR           PeerAddressType,
+    const UCHAR     *PeerAddress,
+    LONGLONG        Now
+    )
+/*++
+
+Routine Description:
+
+    An application activated a remote the old way. With
+    FILTER_ACTIVATE_LEARN the remote becomes known, and the connection
+    doesn't need activating again unless a write of ours is already out.
+
+Arguments:
+
+    PeerAddress - NULL if the connection was adopted and the address isn't
+        known.
+
+--*/
+{
+    PACTIVATE_CONNECTION conn;
+
+    if (Stream >= HCI_MAX_CONNECTIONS) {
+        return;
+    }
+
+    if (PeerAddress != NULL &&
+        (State->Flags & FILTER_ACTIVATE_LEARN) &&
+        !ActivateIsKnown(State, PeerAddressType, PeerAddress)) {
+
+        PFILTER_ACTIVATE_PEER peer;
+
+        if (State->PeerCount < FILTER_ACTIVATE_MAX_PEERS) {
+            peer = &State->Peers[State->PeerCount++];
+        } else {
+            peer = &State->Peers[State->NextPeer];
+            State->NextPeer = (State->NextPeer + 1) % FILTER_ACTIVATE_MAX_PEERS;
+        }
+
+        RtlZeroMemory(peer, sizeof(FILTER_ACTIVATE_PEER));
+        peer->AddressType = PeerAddressType;
+        RtlCopyMemory(peer->Address, PeerAddress, sizeof(peer->Address));
+    }
+
+    conn = &State->Connections[Stream];
+
+    if (conn->Handle != Handle) {
+        RtlZeroMemory(conn, sizeof(ACTIVATE_CONNECTION));
+        conn->Handle = Handle;
+        conn->ConnectedAt = Now;
+    }
+
+    if (conn->Sent || conn->State == FILTER_ACTIVATE_STATE_DONE) {
+        return;
+    }
+
+    conn->State = FILTER_ACTIVATE_STATE_BY_HOST;
+    conn->ActivateMs = (USHORT)min((Now - conn->ConnectedAt) / ACTIVATE_TICKS_PER_MS, 0xFFFF);
+}
+
+BOOLEAN
+ActivateResponse(
+    PACTIVATE_STATE State,
+    ULONG           Stream,
+    const UCHAR     *Bfr,
+    ULONG           Length,
+    LONGLONG        Now,
+    PUCHAR          Packet,
+    PULONG          PacketLength
+    )
+/*++
+
+Routine Description:
+
+    Matches an ATT response from a remote being activated with the oldest
+    request outstanding.
+
+Arguments:
+
+    Packet, PacketLength - Receive the next write to send, the length is 0
+        for none.
+
+Return Value:
+
+    TRUE if the response is to a write of ours and must be hidden from the
+    host.
+
+--*/
+{
+    PACTIVATE_CONNECTION    conn;
+    UCHAR                   op;
+    UCHAR                   error = 0;
+    BOOLEAN                 fits;
+    ULONG                   i;
+
+    *PacketLength = 0;
+
+    if (!HCI_IS_ATT_PDU(Bfr, Length) || !ATT_IS_RESPONSE(Bfr[ATT_PDU_OFFSET])) {
+        return FALSE;
+    }
+
+    conn = ActivateLookup(State, Stream, HCI_ACL_HANDLE(Bfr));
+
+    if (conn == NULL || !ActivateTracking(conn) || conn->Pending == 0) {
+        return FALSE;
+    }
+
+    op = Bfr[ATT_PDU_OFFSET];
+
+    if (op == ATT_OP_ERROR_RSP) {
+        if (Length < ATT_PDU_OFFSET + ATT_ERROR_RSP_LENGTH) {
+            return FALSE;
+        }
+        error = Bfr[ATT_PDU_OFFSET + 4];
+    }
+
+    fits = op == ATT_OP_WRITE_RSP ||
+           (op == ATT_OP_ERROR_RSP &&
+            Bfr[ATT_PDU_OFFSET + 1] == ATT_OP_WRITE_REQ &&
+            (Bfr[ATT_PDU_OFFSET + 2] | (Bfr[ATT_PDU_OFFSET + 3] << 8)) == ActivateWrites[conn->Step].Attribute);
+
+    if (!(conn->Ours & 0x01)) {
+        ActivateRemovePending(conn, 0);
+        *PacketLength = ActivateNext(conn, Packet);
+        return FALSE;
+    }
+
+    if (!fits) {
+        //
+        // Ours is still out, the host's request went down before it.
+        //
+        for (i = 1; i < conn->Pending; i++) {
+            if (!(conn->Ours & (1 << i))) {
+                ActivateRemovePending(conn, i);
+                break;
+            }
+        }
+        return FALSE;
+    }
+
+    ActivateRemovePending(conn, 0);
+    conn->Sent = FALSE;
+
+    if (op == ATT_OP_WRITE_RSP) {
+        if (++conn->Step == ACTIVATE_STEP_COUNT) {
+            conn->State = FILTER_ACTIVATE_STATE_DONE;
+            conn->ActivateMs = (USHORT)min((Now - conn->ConnectedAt) / ACTIVATE_TICKS_PER_MS, 0xFFFF);
+        }
+    } else if ((error == ATT_ERR_INSUFFICIENT_AUTHENTICATION ||
+                error == ATT_ERR_INSUFFICIENT_ENCRYPTION ||
+                error == ATT_ERR_INSUFFICIENT_ENC_KEY_SIZE) &&
+               ++conn->Attempts < ACTIVATE_MAX_ATTEMPTS) {
+        //
+        // Try again once the link is encrypted again, e.g. after the host
+        // paired the remote afresh.
+        //
+        conn->State = FILTER_ACTIVATE_STATE_WAITING;
+        conn->Encrypted = FALSE;
+    } else {
+        conn->State = FILTER_ACTIVATE_STATE_FAILED;
+        conn->Error = error;
+    }
+
+    *PacketLength = ActivateNext(conn, Packet);
+
+    return TRUE;
+}
+
+VOID
+ActivateSendFailed(
+    PACTIVATE_STATE State,
+    ULONG           Stream,
+    USHORT          Handle
+    )
+/*++
+
+Routine Description:
+
+    A write of ours never made it to the adapter, the activation fails.
+
+--*/
+{
+    PACTIVATE_CONNECTION    conn = ActivateLookup(State, Stream, Handle);
+    ULONG                   i;
+
+    if (conn == NULL || !conn->Sent) {
+        return;
+    }
+
+    for (i = 0; i < conn->Pending; i++) {
+        if (conn->Ours & (1 << i)) {
+            ActivateRemovePending(conn, i);
+            break;
+        }
+    }
+
+    conn->Sent = FALSE;
+    conn->State = FILTER_ACTIVATE_STATE_FAILED;
+}
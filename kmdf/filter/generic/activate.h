@@ -0,0 +1,168 @@
+/*++
+
+Module Name:
+
+    activate.h
+
+Abstract:
+
+    Activates a remote from the filter, without waiting for an application.
+
+    Activation is the two writes the console application has always made
+    through the battery service and the filter rewrote on their way down:
+    notifications enabled on the hid report, then the magic value written to
+    hid control. Here the filter builds both as write requests itself once
+    a remote it knows is connected and its link is encrypted, the remote
+    refuses them before.
+
+    ATT allows one request at a time on a connection and the host stack
+    doesn't know about ours. Every request the host sends and every response
+    that comes back is passed in, so a write is only sent while the host has
+    nothing outstanding and the response to it can be told apart from the
+    host's and hidden. A host request that comes while ours is outstanding
+    is held back by the caller until the response to ours was hidden. One
+    that crossed ours on the way down is answered in order, so a response
+    that doesn't fit ours where ours is expected belongs to the host.
+
+    The caller sends the packets returned and serializes all calls for one
+    ACTIVATE_STATE.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "hci.h"
+#include "public.h"
+
+#if !defined(_ACTIVATE_H_)
+#define _ACTIVATE_H_
+
+//
+// ---HCI----- ---L2CAP--- -----ATT------
+// 80 00 09 00 05 00 04 00 12 24 00 01 00
+//
+#define ACTIVATE_MAX_PACKET             16
+
+//
+// Times an activation is started over after the remote refused it for
+// lack of encryption.
+//
+#define ACTIVATE_MAX_ATTEMPTS           2
+
+#define ACTIVATE_STEP_NOTIFY_ENABLE     0
+#define ACTIVATE_STEP_MAGIC             1
+#define ACTIVATE_STEP_COUNT             2
+
+typedef struct _ACTIVATE_CONNECTION {
+
+    USHORT      Handle;         // HCI_INVALID_HANDLE while the slot is free
+    UCHAR       State;          // FILTER_ACTIVATE_STATE_*
+    UCHAR       Step;           // ACTIVATE_STEP_* to send or outstanding
+    BOOLEAN     Sent;           // Step is outstanding
+    BOOLEAN     Encrypted;
+    UCHAR       Attempts;
+    UCHAR       Error;          // ATT error that failed the activation
+    UCHAR       Pending;        // ATT requests outstanding, the host's and ours
+    UCHAR       Ours;           // bit n set if the nth oldest of them is ours
+    USHORT      ActivateMs;
+    LONGLONG    ConnectedAt;
+
+} ACTIVATE_CONNECTION, *PACTIVATE_CONNECTION;
+
+typedef struct _ACTIVATE_STATE {
+
+    ULONG                   Flags;      // FILTER_ACTIVATE_*
+    ULONG                   PeerCount;
+    ULONG                   NextPeer;   // learned peers replace the known ones round robin
+    FILTER_ACTIVATE_PEER    Peers[FILTER_ACTIVATE_MAX_PEERS];
+
+    //
+    // Indexed like the connection slots of the link state.
+    //
+    ACTIVATE_CONNECTION     Connections[HCI_MAX_CONNECTIONS];
+
+} ACTIVATE_STATE, *PACTIVATE_STATE;
+
+VOID
+ActivateInit(
+    PACTIVATE_STATE State
+    );
+
+BOOLEAN
+ActivateConfigure(
+    PACTIVATE_STATE                 State,
+    const FILTER_ACTIVATE_CONFIG    *Config
+    );
+
+VOID
+ActivateConnected(
+    PACTIVATE_STATE State,
+    ULONG           Stream,
+    USHORT          Handle,
+    UCHAR           PeerAddressType,
+    const UCHAR     *PeerAddress,
+    LONGLONG        Now
+    );
+
+VOID
+ActivateDisconnected(
+    PACTIVATE_STATE State,
+    ULONG           Stream
+    );
+
+ULONG
+ActivateEncrypted(
+    PACTIVATE_STATE State,
+    ULONG           Stream,
+    USHORT          Handle,
+    PUCHAR          Packet
+    );
+
+BOOLEAN
+ActivateHostRequest(
+    PACTIVATE_STATE State,
+    ULONG           Stream,
+    const UCHAR     *Bfr,
+    ULONG           Length
+    );
+
+ULONG
+ActivateHostFailed(
+    PACTIVATE_STATE State,
+    ULONG           Stream,
+    const UCHAR     *Bfr,
+    ULONG           Length,
+    PUCHAR          Packet
+    );
+
+VOID
+ActivateByHost(
+    PACTIVATE_STATE State,
+    ULONG           Stream,
+    USHORT          Handle,
+    UCHAR           PeerAddressType,
+    const UCHAR     *PeerAddress,
+    LONGLONG        Now
+    );
+
+BOOLEAN
+ActivateResponse(
+    PACTIVATE_STATE State,
+    ULONG           Stream,
+    const UCHAR     *Bfr,
+    ULONG           Length,
+    LONGLONG        Now,
+    PUCHAR          Packet,
+    PULONG          PacketLength
+    );
+
+VOID
+ActivateSendFailed(
+    PACTIVATE_STATE State,
+    ULONG           Stream,
+    USHORT          Handle
+    );
+
+#endif
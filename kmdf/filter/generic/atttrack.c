@@ -0,0 +1,412 @@
+/*++
+
+Module Name:
+
+    atttrack.c
+
+Abstract:
+
+    ATT transaction timing, see atttrack.h.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "atttrack.h"
+
+#define ATT_TRACK_TICKS_PER_US  10
+#define ATT_TRACK_TICKS_PER_MS  10000
+
+VOID
+AttTrackInit(
+    PATT_TRACK_STATE State
+    )
+{
+    ULONG i;
+
+    RtlZeroMemory(State, sizeof(ATT_TRACK_STATE));
+
+    for (i = 0; i < HCI_MAX_CONNECTIONS; i++) {
+        State->Connections[i].Stats.Handle = HCI_INVALID_HANDLE;
+    }
+}
+
+static ULONG
+AttTrackBucket(
+    LONGLONG Ticks
+    )
+/*++
+
+Routine Description:
+
+    Histogram bucket of a time, see FILTER_ATT_HISTOGRAM_BUCKETS.
+
+--*/
+{
+    LONGLONG    ms = Ticks / ATT_TRACK_TICKS_PER_MS;
+    ULONG       bucket = 0;
+
+    while (ms > 0 && bucket < FILTER_ATT_HISTOGRAM_BUCKETS - 1) {
+        ms >>= 1;
+        bucket++;
+    }
+
+    return bucket;
+}
+
+static VOID
+AttTrackRemove(
+    PATT_TRACK_CONNECTION   Conn,
+    ULONG                   Index
+    )
+{
+    ULONG i;
+
+    for (i = Index + 1; i < Conn->Pending; i++) {
+        Conn->Requests[i - 1] = Conn->Requests[i];
+    }
+
+    Conn->Pending--;
+    Conn->Stats.Pending = (UCHAR)Conn->Pending;
+}
+
+static VOID
+AttTrackUnanswered(
+    PATT_TRACK_STATE        State,
+    PATT_TRACK_CONNECTION   Conn,
+    ULONG                   Index,
+    BOOLEAN                 TimedOut
+    )
+{
+    UCHAR origin = Conn->Requests[Index].Origin;
+
+    if (TimedOut) {
+        Conn->Stats.Origins[origin].Timeouts++;
+        State->Totals[origin].Timeouts++;
+    } else {
+        Conn->Stats.Origins[origin].Unanswered++;
+        State->Totals[origin].Unanswered++;
+    }
+
+    AttTrackRemove(Conn, Index);
+}
+
+static VOID
+AttTrackExpire(
+    PATT_TRACK_STATE        State,
+    PATT_TRACK_CONNECTION   Conn,
+    LONGLONG                Now
+    )
+{
+    while (Conn->Pending != 0 && Now - Conn->Requests[0].RequestedAt >= ATT_TRACK_TIMEOUT) {
+        AttTrackUnanswered(State, Conn, 0, TRUE);
+    }
+}
+
+static VOID
+AttTrackReset(
+    PATT_TRACK_STATE        State,
+    PATT_TRACK_CONNECTION   Conn,
+    USHORT                  Handle
+    )
+/*++
+
+Routine Description:
+
+    Starts a slot over, the requests still outstanding go unanswered.
+
+--*/
+{
+    while (Conn->Pending != 0) {
+        AttTrackUnanswered(State, Conn, 0, FALSE);
+    }
+
+    RtlZeroMemory(Conn, sizeof(ATT_TRACK_CONNECTION));
+    Conn->Stats.Handle = Handle;
+}
+
+static PATT_TRACK_CONNECTION
+AttTrackLookup(
+    PATT_TRACK_STATE    State,
+    ULONG               Stream,
+    USHORT              Handle
+    )
+/*++
+
+Routine Description:
+
+    Returns the slot of a connection, started over if it held another
+    connection before.
+
+--*/
+{
+    PATT_TRACK_CONNECTION conn;
+
+    if (Stream >= HCI_MAX_CONNECTIONS) {
+        return NULL;
+    }
+
+    conn = &State->Connections[Stream];
+
+    if (conn->Stats.Handle != Handle) {
+        AttTrackReset(State, conn, Handle);
+    }
+
+    return conn;
+}
+
+VOID
+AttTrackDisconnected(
+    PATT_TRACK_STATE    State,
+    ULONG               Stream
+    )
+{
+    if (Stream >= HCI_MAX_CONNECTIONS) {
+        return;
+    }
+
+    AttTrackReset(State, &State->Connections[Stream], HCI_INVALID_HANDLE);
+}
+
+VOID
+AttTrackRequest(
+    PATT_TRACK_STATE    State,
+    ULONG               Stream,
+    UCHAR               Origin,
+    const UCHAR         *Bfr,
+    ULONG               Length,
+    LONGLONG            Now
+    )
+/*++
+
+Routine Description:
+
+    Starts timing an ATT request going down.
+
+Arguments:
+
+    Origin - FILTER_ATT_ORIGIN_* of the request.
+
+--*/
+{
+    PATT_TRACK_CONNECTION   conn;
+    PATT_TRACK_REQUEST      request;
+
+    if (!HCI_IS_ATT_PDU(Bfr, Length) ||
+        !ATT_IS_REQUEST(Bfr[ATT_PDU_OFFSET]) ||
+        Origin >= FILTER_ATT_ORIGINS) {
+        return;
+    }
+
+    conn = AttTrackLookup(State, Stream, HCI_ACL_HANDLE(Bfr));
+    if (conn == NULL) {
+        return;
+    }
+
+    AttTrackExpire(State, conn, Now);
+
+    //
+    // A host that doesn't wait for its responses, give up on the oldest.
+    //
+    if (conn->Pending == ATT_TRACK_MAX_PENDING) {
+        AttTrackUnanswered(State, conn, 0, FALSE);
+    }
+
+    request = &conn->Requests[conn->Pending++];
+    request->Opcode = Bfr[ATT_PDU_OFFSET];
+    request->Origin = Origin;
+    request->Sent = FALSE;
+    request->RequestedAt = Now;
+
+    conn->Stats.Pending = (UCHAR)conn->Pending;
+    conn->Stats.Origins[Origin].Requests++;
+    State->Totals[Origin].Requests++;
+}
+
+VOID
+AttTrackSent(
+    PATT_TRACK_STATE    State,
+    ULONG               Stream,
+    UCHAR               Origin,
+    const UCHAR         *Bfr,
+    ULONG               Length,
+    BOOLEAN             Success,
+    LONGLONG            Now
+    )
+/*++
+
+Routine Description:
+
+    The adapter completed the transfer of an ATT request. Transfers complete
+    in the order they went down, so it is the oldest request of its origin
+    and opcode not sent yet. A request that failed to go out is forgotten
+    and counted unanswered.
+
+--*/
+{
+    PATT_TRACK_CONNECTION   conn;
+    PATT_TRACK_REQUEST      request;
+    LONGLONG                ticks;
+    ULONG                   i;
+
+    if (!HCI_IS_ATT_PDU(Bfr, Length) || !ATT_IS_REQUEST(Bfr[ATT_PDU_OFFSET])) {
+        return;
+    }
+
+    if (Stream >= HCI_MAX_CONNECTIONS ||
+        State->Connections[Stream].Stats.Handle != HCI_ACL_HANDLE(Bfr)) {
+        return;
+    }
+
+    conn = &State->Connections[Stream];
+
+    for (i = 0; i < conn->Pending; i++) {
+        request = &conn->Requests[i];
+
+        if (request->Sent ||
+            request->Origin != Origin ||
+            request->Opcode != Bfr[ATT_PDU_OFFSET]) {
+            continue;
+        }
+
+        if (!Success) {
+            AttTrackUnanswered(State, conn, i, FALSE);
+            return;
+        }
+
+        request->Sent = TRUE;
+
+        ticks = Now - request->RequestedAt;
+        conn->Stats.Origins[Origin].Adapter[AttTrackBucket(ticks)]++;
+        State->Totals[Origin].Adapter[AttTrackBucket(ticks)]++;
+        return;
+    }
+}
+
+static VOID
+AttTrackRecord(
+    PFILTER_ATT_LATENCY Latency,
+    LONGLONG            Ticks,
+    BOOLEAN             Error
+    )
+{
+    ULONG ms = (ULONG)min(Ticks / ATT_TRACK_TICKS_PER_MS, 0xFFFFFFFF);
+
+    Latency->Responses++;
+
+    if (Error) {
+        Latency->Errors++;
+    }
+
+    Latency->MaxMs = max(Latency->MaxMs, ms);
+    Latency->TotalUs += (ULONGLONG)(Ticks / ATT_TRACK_TICKS_PER_US);
+    Latency->RoundTrip[AttTrackBucket(Ticks)]++;
+}
+
+VOID
+AttTrackResponse(
+    PATT_TRACK_STATE    State,
+    ULONG               Stream,
+    const UCHAR         *Bfr,
+    ULONG               Length,
+    LONGLONG            Now
+    )
+/*++
+
+Routine Description:
+
+    Stops timing the request an ATT response coming up answers. Requests
+    the adapter has go first, the response can beat the completion of a
+    transfer though.
+
+--*/
+{
+    PATT_TRACK_CONNECTION   conn;
+    PATT_TRACK_REQUEST      request;
+    UCHAR                   op;
+    UCHAR                   requestOp;
+    LONGLONG                ticks;
+    ULONG                   pass;
+    ULONG                   i;
+
+    if (!HCI_IS_ATT_PDU(Bfr, Length) || !ATT_IS_RESPONSE(Bfr[ATT_PDU_OFFSET])) {
+        return;
+    }
+
+    conn = AttTrackLookup(State, Stream, HCI_ACL_HANDLE(Bfr));
+    if (conn == NULL) {
+        return;
+    }
+
+    AttTrackExpire(State, conn, Now);
+
+    op = Bfr[ATT_PDU_OFFSET];
+
+    if (op == ATT_OP_ERROR_RSP) {
+        if (Length < ATT_PDU_OFFSET + ATT_ERROR_RSP_LENGTH) {
+            return;
+        }
+        requestOp = Bfr[ATT_PDU_OFFSET + 1];
+    } else {
+        requestOp = (UCHAR)(op - 1);
+    }
+
+    for (pass = 0; pass < 2; pass++) {
+        for (i = 0; i < conn->Pending; i++) {
+            request = &conn->Requests[i];
+
+            if (request->Opcode != requestOp || (pass == 0 && !request->Sent)) {
+                continue;
+            }
+
+            ticks = Now - request->RequestedAt;
+
+            AttTrackRecord(&conn->Stats.Origins[request->Origin], ticks, op == ATT_OP_ERROR_RSP);
+            AttTrackRecord(&State->Totals[request->Origin], ticks, op == ATT_OP_ERROR_RSP);
+
+            AttTrackRemove(conn, i);
+            return;
+        }
+    }
+
+    conn->Stats.Unmatched++;
+}
+
+VOID
+AttTrackGetStats(
+    PATT_TRACK_STATE    State,
+    LONGLONG            Now,
+    PFILTER_ATT_STATS   Stats
+    )
+/*++
+
+Routine Description:
+
+    Fills in the statistics of the connections for IOCTL_GET_ATT_STATS,
+    after counting the requests that timed out by now.
+
+--*/
+{
+    PATT_TRACK_CONNECTION   conn;
+    ULONG                   i;
+
+    C_ASSERT(HCI_MAX_CONNECTIONS == FILTER_MAX_CONNECTIONS);
+
+    RtlZeroMemory(Stats, sizeof(FILTER_ATT_STATS));
+
+    for (i = 0; i < HCI_MAX_CONNECTIONS; i++) {
+        conn = &State->Connections[i];
+
+        if (conn->Stats.Handle == HCI_INVALID_HANDLE) {
+            continue;
+        }
+
+        AttTrackExpire(State, conn, Now);
+
+        Stats->Connections[Stats->ConnectionCount++] = conn->Stats;
+    }
+
+    RtlCopyMemory(Stats->Totals, State->Totals, sizeof(Stats->Totals));
+}
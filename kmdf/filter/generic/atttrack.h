@@ -0,0 +1,120 @@
+/*++
+
+Module Name:
+
+    atttrack.h
+
+Abstract:
+
+    Times the ATT requests going down to the remotes until their responses
+    come back, per connection.
+
+    A client has one request outstanding at a time, but the filter's own
+    writes can overlap the host stack's, so a connection keeps a short list
+    of requests in the order they went down. A response is matched with the
+    oldest request of the opcode it answers that reached the adapter, a
+    host request the filter holds back behind one of its own can't have
+    been answered yet; a response that fits none was to a request sent
+    before the filter saw the connection.
+
+    Every request is timed from when it went down the filter, the adapter
+    part until the adapter completed its transfer. The caller serializes
+    all calls for one ATT_TRACK_STATE.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "hci.h"
+#include "public.h"
+
+#if !defined(_ATTTRACK_H_)
+#define _ATTTRACK_H_
+
+#define ATT_TRACK_MAX_PENDING           4
+
+//
+// ATT transaction timeout, 30 s in 100ns units.
+//
+#define ATT_TRACK_TIMEOUT               (30LL * 1000 * 1000 * 10)
+
+typedef struct _ATT_TRACK_REQUEST {
+
+    UCHAR       Opcode;
+    UCHAR       Origin;         // FILTER_ATT_ORIGIN_*
+    BOOLEAN     Sent;           // the adapter completed the transfer
+    UCHAR       Reserved;
+    LONGLONG    RequestedAt;
+
+} ATT_TRACK_REQUEST, *PATT_TRACK_REQUEST;
+
+typedef struct _ATT_TRACK_CONNECTION {
+
+    ULONG                       Pending;
+    ATT_TRACK_REQUEST           Requests[ATT_TRACK_MAX_PENDING];    // oldest first
+    FILTER_ATT_CONNECTION_STATS Stats;                              // Handle is the slot's
+
+} ATT_TRACK_CONNECTION, *PATT_TRACK_CONNECTION;
+
+typedef struct _ATT_TRACK_STATE {
+
+    FILTER_ATT_LATENCY      Totals[FILTER_ATT_ORIGINS];
+
+    //
+    // Indexed like the connection slots of the link state.
+    //
+    ATT_TRACK_CONNECTION    Connections[HCI_MAX_CONNECTIONS];
+
+} ATT_TRACK_STATE, *PATT_TRACK_STATE;
+
+VOID
+AttTrackInit(
+    PATT_TRACK_STATE State
+    );
+
+VOID
+AttTrackDisconnected(
+    PATT_TRACK_STATE    State,
+    ULONG               Stream
+    );
+
+VOID
+AttTrackRequest(
+    PATT_TRACK_STATE    State,
+    ULONG               Stream,
+    UCHAR               Origin,
+    const UCHAR         *Bfr,
+    ULONG               Length,
+    LONGLONG            Now
+    );
+
+VOID
+AttTrackSent(
+    PATT_TRACK_STATE    State,
+    ULONG               Stream,
+    UCHAR               Origin,
+    const UCHAR         *Bfr,
+    ULONG               Length,
+    BOOLEAN             Success,
+    LONGLONG            Now
+    );
+
+VOID
+AttTrackResponse(
+    PATT_TRACK_STATE    State,
+    ULONG               Stream,
+    const UCHAR         *Bfr,
+    ULONG               Length,
+    LONGLONG            Now
+    );
+
+VOID
+AttTrackGetStats(
+    PATT_TRACK_STATE    State,
+    LONGLONG            Now,
+    PFILTER_ATT_STATS   Stats
+    );
+
+#endif
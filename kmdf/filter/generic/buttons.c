@@ -0,0 +1,477 @@
+/*++
+
+Module Name:
+
+    buttons.c
+
+Abstract:
+
+    Button actions from button bitmasks, see buttons.h.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "buttons.h"
+
+#define BUTTON_TICKS_PER_MS         10000
+
+static ULONG
+ButtonCount(
+    ULONG   Buttons
+    )
+{
+    ULONG   count = 0;
+
+    for (; Buttons != 0; Buttons &= Buttons - 1) {
+        count++;
+    }
+
+    return count;
+}
+
+static ULONG
+ButtonIndex(
+    ULONG   Button
+    )
+{
+    ULONG   index = 0;
+
+    while ((Button >>= 1) != 0) {
+        index++;
+    }
+
+    return index;
+}
+
+BOOLEAN
+ButtonMapCompile(
+    PBUTTON_MAP             Map,
+    const BUTTON_RULE       *Rules,
+    ULONG                   Count,
+    const BUTTON_TIMING     *Timing
+    )
+/*++
+
+Routine Description:
+
+    Lays the rules out as a table of each button's actions by kind, and a
+    list of chords with the most buttons first.
+
+--*/
+{
+    const BUTTON_RULE   *rule;
+    ULONG               *action;
+    USHORT              chord;
+    ULONG               chordAction;
+    ULONG               i;
+    ULONG               j;
+
+    RtlZeroMemory(Map, sizeof(BUTTON_MAP));
+
+    Map->DoubleTicks = (LONGLONG)(Timing != NULL ? Timing->DoubleMs : BUTTON_DEFAULT_DOUBLE_MS) * BUTTON_TICKS_PER_MS;
+    Map->LongTicks = (LONGLONG)(Timing != NULL ? Timing->LongMs : BUTTON_DEFAULT_LONG_MS) * BUTTON_TICKS_PER_MS;
+    Map->ChordTicks = (LONGLONG)(Timing != NULL ? Timing->ChordMs : BUTTON_DEFAULT_CHORD_MS) * BUTTON_TICKS_PER_MS;
+
+    for (i = 0; i < Count; i++) {
+        rule = &Rules[i];
+
+        if (rule->Action == 0) {
+            return FALSE;
+        }
+
+        switch (rule->Kind) {
+
+        case BUTTON_ACTION_CLICK:
+        case BUTTON_ACTION_DOUBLE:
+        case BUTTON_ACTION_LONG:
+            if (ButtonCount(rule->Buttons) != 1) {
+                return FALSE;
+            }
+
+            action = &Map->Actions[ButtonIndex(rule->Buttons)][rule->Kind];
+
+            if (*action != 0) {
+                return FALSE;
+            }
+
+            *action = rule->Action;
+
+            if (rule->Kind == BUTTON_ACTION_DOUBLE) {
+                Map->DoubleMask |= rule->Buttons;
+            } else if (rule->Kind == BUTTON_ACTION_LONG) {
+                Map->LongMask |= rule->Buttons;
+            }
+            break;
+
+        case BUTTON_ACTION_CHORD:
+            if (ButtonCount(rule->Buttons) < 2 || Map->ChordCount == BUTTON_MAX_CHORDS) {
+                return FALSE;
+            }
+
+            for (j = 0; j < Map->ChordCount; j++) {
+                if (Map->Chords[j] == rule->Buttons) {
+                    return FALSE;
+                }
+            }
+
+            Map->Chords[Map->ChordCount] = rule->Buttons;
+            Map->ChordActions[Map->ChordCount] = rule->Action;
+            Map->ChordCount++;
+            Map->ChordMask |= rule->Buttons;
+            break;
+
+        default:
+            return FALSE;
+        }
+    }
+
+    //
+    // Insertion sort, keeping the order of the rules among chords of as
+    // many buttons.
+    //
+    for (i = 1; i < Map->ChordCount; i++) {
+        chord = Map->Chords[i];
+        chordAction = Map->ChordActions[i];
+
+        for (j = i; j > 0 && ButtonCount(Map->Chords[j - 1]) < ButtonCount(chord); j--) {
+            Map->Chords[j] = Map->Chords[j - 1];
+            Map->ChordActions[j] = Map->ChordActions[j - 1];
+        }
+
+        Map->Chords[j] = chord;
+        Map->ChordActions[j] = chordAction;
+    }
+
+    return TRUE;
+}
+
+static VOID
+ButtonEmit(
+    PBUTTON_ENGINE  Engine,
+    ULONG           Remote,
+    UCHAR           Kind,
+    USHORT          Buttons,
+    ULONG           Action,
+    LONGLONG        Time
+    )
+{
+    BUTTON_ACTION   emitted;
+
+    if (Action == 0) {
+        return;
+    }
+
+    emitted.Time = Time;
+    emitted.Remote = Remote;
+    emitted.Kind = Kind;
+    emitted.Buttons = Buttons;
+    emitted.Action = Action;
+
+    Engine->Routine(Engine->Context, &emitted);
+}
+
+static VOID
+ButtonArm(
+    PBUTTON_ENGINE  Engine,
+    PBUTTON_REMOTE  Remote,
+    PBUTTON_KEY     Key,
+    LONGLONG        Deadline
+    )
+{
+    Key->Deadline = Deadline;
+    Remote->Timed |= (USHORT)(1 << Key->Index);
+
+    TimerWheelArm(&Engine->Wheel, &Key->Timer, Deadline);
+}
+
+static VOID
+ButtonCancel(
+    PBUTTON_ENGINE  Engine,
+    PBUTTON_REMOTE  Remote,
+    PBUTTON_KEY     Key
+    )
+{
+    Remote->Timed &= (USHORT)~(1 << Key->Index);
+
+    TimerWheelCancel(&Engine->Wheel, &Key->Timer);
+}
+
+static VOID
+ButtonExpire(
+    PBUTTON_ENGINE  Engine,
+    PBUTTON_REMOTE  Remote,
+    PBUTTON_KEY     Key
+    )
+/*++
+
+Routine Description:
+
+    A key's timer ran out: a held button is a long press, a released one
+    was a click with no second press.
+
+--*/
+{
+    const BUTTON_MAP    *map = Engine->Map;
+    USHORT              button = (USHORT)(1 << Key->Index);
+
+    Remote->Timed &= (USHORT)~button;
+
+    if (Key->Phase == BUTTON_PHASE_DOWN) {
+        Remote->Consumed |= button;
+        ButtonEmit(Engine, Key->Remote, BUTTON_ACTION_LONG, button,
+                   map->Actions[Key->Index][BUTTON_ACTION_LONG], Key->Deadline);
+
+    } else if (Key->Phase == BUTTON_PHASE_RELEASED) {
+        Key->Phase = BUTTON_PHASE_IDLE;
+        ButtonEmit(Engine, Key->Remote, BUTTON_ACTION_CLICK, button,
+                   map->Actions[Key->Index][BUTTON_ACTION_CLICK], Key->Deadline);
+    }
+}
+
+static VOID
+ButtonTimer(
+    PVOID               Context,
+    PTIMER_WHEEL_ENTRY  Entry
+    )
+{
+    PBUTTON_ENGINE  engine = (PBUTTON_ENGINE)Context;
+    PBUTTON_KEY     key = (PBUTTON_KEY)Entry;
+
+    ButtonExpire(engine, &engine->Remotes[key->Remote], key);
+}
+
+static VOID
+ButtonSettle(
+    PBUTTON_ENGINE  Engine,
+    PBUTTON_REMOTE  Remote,
+    LONGLONG        Now
+    )
+/*++
+
+Routine Description:
+
+    Fires a remote's timers due by Now, earliest first, whether the wheel
+    got to them or not.
+
+--*/
+{
+    PBUTTON_KEY key;
+    PBUTTON_KEY due;
+    ULONG       timed;
+    ULONG       i;
+
+    while (Remote->Timed != 0) {
+        due = NULL;
+
+        for (i = 0, timed = Remote->Timed; timed != 0; i++, timed >>= 1) {
+            key = &Remote->Keys[i];
+
+            if ((timed & 1) && key->Deadline <= Now &&
+                (due == NULL || key->Deadline < due->Deadline)) {
+                due = key;
+            }
+        }
+
+        if (due == NULL) {
+            break;
+        }
+
+        TimerWheelCancel(&Engine->Wheel, &due->Timer);
+        ButtonExpire(Engine, Remote, due);
+    }
+}
+
+static VOID
+ButtonChords(
+    PBUTTON_ENGINE  Engine,
+    PBUTTON_REMOTE  Remote,
+    ULONG           Index,
+    USHORT          Pressed,
+    LONGLONG        Now
+    )
+{
+    const BUTTON_MAP    *map = Engine->Map;
+    USHORT              chord;
+    ULONG               members;
+    ULONG               c;
+    ULONG               i;
+
+    for (c = 0; c < map->ChordCount; c++) {
+        chord = map->Chords[c];
+
+        if ((chord & Pressed) == 0 ||
+            (chord & Remote->Buttons) != chord ||
+            (chord & Remote->Consumed) != 0) {
+            continue;
+        }
+
+        for (i = 0, members = chord; members != 0; i++, members >>= 1) {
+            if ((members & 1) && Now - Remote->Keys[i].Since > map->ChordTicks) {
+                break;
+            }
+        }
+
+        if (members != 0) {
+            continue;
+        }
+
+        for (i = 0, members = chord; members != 0; i++, members >>= 1) {
+            if (members & 1) {
+                ButtonCancel(Engine, Remote, &Remote->Keys[i]);
+            }
+        }
+
+        Remote->Consumed |= chord;
+        ButtonEmit(Engine, Index, BUTTON_ACTION_CHORD, chord, map->ChordActions[c], Now);
+    }
+}
+
+VOID
+ButtonEngineInit(
+    PBUTTON_ENGINE          Engine,
+    const BUTTON_MAP        *Map,
+    PBUTTON_REMOTE          Remotes,
+    ULONG                   RemoteCount,
+    LONGLONG                Now,
+    PBUTTON_ACTION_ROUTINE  Routine,
+    PVOID                   Context
+    )
+{
+    PBUTTON_KEY key;
+    ULONG       r;
+    ULONG       i;
+
+    Engine->Map = Map;
+    Engine->Remotes = Remotes;
+    Engine->RemoteCount = RemoteCount;
+    Engine->Routine = Routine;
+    Engine->Context = Context;
+
+    TimerWheelInit(&Engine->Wheel, BUTTON_TICK_MS * BUTTON_TICKS_PER_MS, Now);
+
+    RtlZeroMemory(Remotes, RemoteCount * sizeof(BUTTON_REMOTE));
+
+    for (r = 0; r < RemoteCount; r++) {
+        for (i = 0; i < BUTTON_MAX_BUTTONS; i++) {
+            key = &Remotes[r].Keys[i];
+            TimerWheelInitEntry(&key->Timer);
+            key->Remote = r;
+            key->Index = (UCHAR)i;
+            key->Phase = BUTTON_PHASE_IDLE;
+        }
+    }
+}
+
+VOID
+ButtonEngineUpdate(
+    PBUTTON_ENGINE  Engine,
+    ULONG           Remote,
+    USHORT          Buttons,
+    LONGLONG        Now
+    )
+/*++
+
+Routine Description:
+
+    Settles the remote's due timeouts, then handles its releases before
+    its presses, so a release and press together finish the old press
+    first.
+
+--*/
+{
+    const BUTTON_MAP    *map = Engine->Map;
+    PBUTTON_REMOTE      remote;
+    PBUTTON_KEY         key;
+    USHORT              released;
+    USHORT              pressed;
+    USHORT              button;
+    ULONG               changed;
+    ULONG               i;
+
+    if (Remote >= Engine->RemoteCount) {
+        return;
+    }
+
+    remote = &Engine->Remotes[Remote];
+
+    ButtonSettle(Engine, remote, Now);
+
+    released = (USHORT)(remote->Buttons & ~Buttons);
+    pressed = (USHORT)(Buttons & ~remote->Buttons);
+    remote->Buttons = Buttons;
+
+    for (i = 0, changed = released; changed != 0; i++, changed >>= 1) {
+        if (!(changed & 1)) {
+            continue;
+        }
+
+        key = &remote->Keys[i];
+        button = (USHORT)(1 << i);
+        ButtonCancel(Engine, remote, key);
+
+        if (remote->Consumed & button) {
+            remote->Consumed &= (USHORT)~button;
+            key->Phase = BUTTON_PHASE_IDLE;
+
+        } else if (map->DoubleMask & button) {
+            key->Phase = BUTTON_PHASE_RELEASED;
+            key->Since = Now;
+            ButtonArm(Engine, remote, key, Now + map->DoubleTicks);
+
+        } else {
+            key->Phase = BUTTON_PHASE_IDLE;
+            ButtonEmit(Engine, Remote, BUTTON_ACTION_CLICK, button,
+                       map->Actions[i][BUTTON_ACTION_CLICK], Now);
+        }
+    }
+
+    for (i = 0, changed = pressed; changed != 0; i++, changed >>= 1) {
+        if (!(changed & 1)) {
+            continue;
+        }
+
+        key = &remote->Keys[i];
+        button = (USHORT)(1 << i);
+
+        if (key->Phase == BUTTON_PHASE_RELEASED) {
+            ButtonCancel(Engine, remote, key);
+            remote->Consumed |= button;
+            ButtonEmit(Engine, Remote, BUTTON_ACTION_DOUBLE, button,
+                       map->Actions[i][BUTTON_ACTION_DOUBLE], Now);
+
+        } else if (map->LongMask & button) {
+            ButtonArm(Engine, remote, key, Now + map->LongTicks);
+        }
+
+        key->Phase = BUTTON_PHASE_DOWN;
+        key->Since = Now;
+    }
+
+    if (pressed & map->ChordMask) {
+        ButtonChords(Engine, remote, Remote, pressed, Now);
+    }
+}
+
+ULONG
+ButtonEngineAdvance(
+    PBUTTON_ENGINE  Engine,
+    LONGLONG        Now
+    )
+{
+    return TimerWheelRun(&Engine->Wheel, Now, ButtonTimer, Engine);
+}
+
+const char *
+ButtonActionName(
+    ULONG   Kind
+    )
+{
+    static const char * names[BUTTON_ACTION_KINDS] = {
+        "none", "click", "double", "long", "chord"
+    };
+
+    return Kind < BUTTON_ACTION_KINDS ? names[Kind] : "?";
+}
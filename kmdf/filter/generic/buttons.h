@@ -0,0 +1,221 @@
+/*++
+
+Module Name:
+
+    buttons.h
+
+Abstract:
+
+    Turns the button bitmasks of the remotes into actions: clicks, double
+    clicks, long presses and chords, from a table of rules compiled once.
+
+    The engine is fed each remote's buttons as they change, with the time
+    they changed at, and advanced as time goes by without changes. Time
+    is only what the caller says it is, in 100ns units, so a reader feeds
+    it event times and a test feeds it whatever it likes.
+
+    CLICK       the release of a button, when the press was not used by
+                anything else. With a DOUBLE rule for the button it waits
+                DoubleMs for a second press first, and is emitted when that
+                runs out.
+    DOUBLE      the second press of a button within DoubleMs of the first
+                one's release. Its release emits nothing.
+    LONG        a button held LongMs, emitted then rather than on release.
+                Its release emits nothing.
+    CHORD       the press that makes all of a chord's buttons held, within
+                ChordMs of each other. None of the presses of the chord emit
+                anything else. When one press completes more than one chord,
+                the one with the most buttons goes first.
+
+    Rules only say what action each of these is. A button without a rule
+    of a kind never waits for it, so a button with no DOUBLE rule clicks
+    as it is released.
+
+    Timeouts are kept in a timer wheel of 1ms ticks, so advancing fires
+    them up to a tick late. Every change of a remote first settles that
+    remote's timeouts due by its time, so what is emitted never depends
+    on how often the engine is advanced, only when.
+
+    Nothing is allocated: the caller gives the engine its remotes. The
+    caller serializes all calls for one engine.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "portable.h"
+#include "timerwheel.h"
+
+#if !defined(_BUTTONS_H_)
+#define _BUTTONS_H_
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define BUTTON_ACTION_NONE          0
+#define BUTTON_ACTION_CLICK         1
+#define BUTTON_ACTION_DOUBLE        2
+#define BUTTON_ACTION_LONG          3
+#define BUTTON_ACTION_CHORD         4
+#define BUTTON_ACTION_KINDS         5
+
+#define BUTTON_MAX_BUTTONS          16
+#define BUTTON_MAX_CHORDS           8
+
+#define BUTTON_DEFAULT_DOUBLE_MS    250
+#define BUTTON_DEFAULT_LONG_MS      600
+#define BUTTON_DEFAULT_CHORD_MS     80
+
+#define BUTTON_TICK_MS              1
+
+typedef struct _BUTTON_RULE {
+
+    USHORT  Buttons;    // one button, or the two or more of a chord
+    UCHAR   Kind;       // BUTTON_ACTION_*
+    ULONG   Action;     // the caller's, not 0
+
+} BUTTON_RULE, *PBUTTON_RULE;
+
+typedef struct _BUTTON_TIMING {
+
+    ULONG   DoubleMs;
+    ULONG   LongMs;
+    ULONG   ChordMs;
+
+} BUTTON_TIMING, *PBUTTON_TIMING;
+
+typedef struct _BUTTON_MAP {
+
+    LONGLONG    DoubleTicks;
+    LONGLONG    LongTicks;
+    LONGLONG    ChordTicks;
+
+    USHORT      DoubleMask;     // buttons with a DOUBLE rule
+    USHORT      LongMask;       // buttons with a LONG rule
+    USHORT      ChordMask;      // buttons in a chord
+
+    ULONG       Actions[BUTTON_MAX_BUTTONS][BUTTON_ACTION_KINDS];
+
+    //
+    // Most buttons first.
+    //
+    ULONG       ChordCount;
+    USHORT      Chords[BUTTON_MAX_CHORDS];
+    ULONG       ChordActions[BUTTON_MAX_CHORDS];
+
+} BUTTON_MAP, *PBUTTON_MAP;
+
+#define BUTTON_PHASE_IDLE           0
+#define BUTTON_PHASE_DOWN           1   // held, a long press until its timer
+#define BUTTON_PHASE_RELEASED       2   // a double click until its timer
+
+typedef struct _BUTTON_KEY {
+
+    TIMER_WHEEL_ENTRY   Timer;      // first, the wheel hands it back
+    LONGLONG            Since;      // of the press or release of the phase
+    LONGLONG            Deadline;   // of the timer, exactly
+    ULONG               Remote;
+    UCHAR               Index;
+    UCHAR               Phase;      // BUTTON_PHASE_*
+
+} BUTTON_KEY, *PBUTTON_KEY;
+
+typedef struct _BUTTON_REMOTE {
+
+    USHORT      Buttons;    // held
+    USHORT      Consumed;   // held, and their release emits nothing
+    USHORT      Timed;      // with their timer armed
+    BUTTON_KEY  Keys[BUTTON_MAX_BUTTONS];
+
+} BUTTON_REMOTE, *PBUTTON_REMOTE;
+
+typedef struct _BUTTON_ACTION {
+
+    LONGLONG    Time;       // of the change, or the timeout, that emitted it
+    ULONG       Remote;
+    UCHAR       Kind;       // BUTTON_ACTION_*
+    USHORT      Buttons;
+    ULONG       Action;     // of the rule
+
+} BUTTON_ACTION, *PBUTTON_ACTION;
+
+typedef VOID BUTTON_ACTION_ROUTINE(
+    PVOID                   Context,
+    const BUTTON_ACTION     *Action
+    );
+
+typedef BUTTON_ACTION_ROUTINE *PBUTTON_ACTION_ROUTINE;
+
+typedef struct _BUTTON_ENGINE {
+
+    const BUTTON_MAP        *Map;
+    PBUTTON_REMOTE          Remotes;
+    ULONG                   RemoteCount;
+    PBUTTON_ACTION_ROUTINE  Routine;
+    PVOID                   Context;
+    TIMER_WHEEL             Wheel;
+
+} BUTTON_ENGINE, *PBUTTON_ENGINE;
+
+//
+// Compiles Count rules, Timing NULL takes the defaults. Returns FALSE for
+// a rule of no known kind, of no action, with the wrong number of buttons
+// for its kind, or of a kind and buttons another rule has already.
+//
+BOOLEAN
+ButtonMapCompile(
+    PBUTTON_MAP             Map,
+    const BUTTON_RULE       *Rules,
+    ULONG                   Count,
+    const BUTTON_TIMING     *Timing
+    );
+
+//
+// Starts RemoteCount remotes with nothing held at Now. The map is not
+// copied.
+//
+VOID
+ButtonEngineInit(
+    PBUTTON_ENGINE          Engine,
+    const BUTTON_MAP        *Map,
+    PBUTTON_REMOTE          Remotes,
+    ULONG                   RemoteCount,
+    LONGLONG                Now,
+    PBUTTON_ACTION_ROUTINE  Routine,
+    PVOID                   Context
+    );
+
+//
+// The buttons a remote holds from Now. Now never goes back for a remote,
+// nor behind the latest ButtonEngineAdvance.
+//
+VOID
+ButtonEngineUpdate(
+    PBUTTON_ENGINE  Engine,
+    ULONG           Remote,
+    USHORT          Buttons,
+    LONGLONG        Now
+    );
+
+//
+// Fires the timeouts due by Now, returns the number fired.
+//
+ULONG
+ButtonEngineAdvance(
+    PBUTTON_ENGINE  Engine,
+    LONGLONG        Now
+    );
+
+const char *
+ButtonActionName(
+    ULONG   Kind
+    );
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -0,0 +1,493 @@
+/*++
+
+Module Name:
+
+    capstream.c
+
+Abstract:
+
+    Streaming encoder and decoder of captured packets, see capstream.h.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "capstream.h"
+
+#define CAPSTREAM_NO_HANDLE     0xFFFF
+
+typedef struct _CAPSTREAM_READER {
+
+    const UCHAR *   Bfr;
+    ULONG           Length;
+    ULONG           Offset;
+    BOOLEAN         Short;      // ran past the end of the input
+    BOOLEAN         Corrupt;
+
+} CAPSTREAM_READER, *PCAPSTREAM_READER;
+
+VOID
+CapStreamInit(
+    PCAPSTREAM_STATE State
+    )
+{
+    RtlZeroMemory(State, sizeof(CAPSTREAM_STATE));
+}
+
+static ULONG
+CapStreamPutVarint(
+    PUCHAR      Out,
+    ULONGLONG   Value
+    )
+{
+    ULONG n = 0;
+
+    while (Value >= 0x80) {
+        Out[n++] = (UCHAR)(Value | 0x80);
+        Value >>= 7;
+    }
+    Out[n++] = (UCHAR)Value;
+
+    return n;
+}
+
+static ULONG
+CapStreamPutTime(
+    PCAPSTREAM_STATE    State,
+    PUCHAR              Out,
+    LONGLONG            Time
+    )
+{
+    LONGLONG delta = Time - State->LastTime;
+
+    State->LastTime = Time;
+
+    return CapStreamPutVarint(Out, ((ULONGLONG)delta << 1) ^ (ULONGLONG)(delta >> 63));
+}
+
+static ULONGLONG
+CapStreamGetVarint(
+    PCAPSTREAM_READER Reader
+    )
+{
+    ULONGLONG   value = 0;
+    ULONG       shift;
+
+    for (shift = 0; shift < 64; shift += 7) {
+        UCHAR b;
+
+        if (Reader->Offset >= Reader->Length) {
+            Reader->Short = TRUE;
+            return 0;
+        }
+
+        b = Reader->Bfr[Reader->Offset++];
+        value |= (ULONGLONG)(b & 0x7F) << shift;
+
+        if (!(b & 0x80)) {
+            return value;
+        }
+    }
+
+    Reader->Corrupt = TRUE;
+
+    return 0;
+}
+
+static LONGLONG
+CapStreamGetTime(
+    PCAPSTREAM_READER   Reader,
+    LONGLONG            LastTime
+    )
+{
+    ULONGLONG zigzag = CapStreamGetVarint(Reader);
+
+    return LastTime + (LONGLONG)((zigzag >> 1) ^ (0 - (zigzag & 1)));
+}
+
+static USHORT
+CapStreamHandle(
+    const FILTER_CAPTURE_RECORD *Record
+    )
+{
+    if (Record->Kind != TRACE_KIND_ACL || Record->CapturedLength < 2) {
+        return CAPSTREAM_NO_HANDLE;
+    }
+
+    return (USHORT)((Record->Data[0] | (Record->Data[1] << 8)) & 0x0FFF);
+}
+
+ULONG
+CapStreamEncodeWindow(
+    PCAPSTREAM_STATE                State,
+    const FILTER_CAPTURE_HEADER     *Window,
+    PUCHAR                          Out,
+    ULONG                           OutLength
+    )
+/*++
+
+Routine Description:
+
+    Encodes the start of a capture window. The records of the window
+    follow, encoded with CapStreamEncode.
+
+Return Value:
+
+    Bytes written, 0 if OutLength is below CAPSTREAM_MAX_ITEM_SIZE.
+
+--*/
+{
+    ULONG n = 0;
+    ULONG i;
+
+    if (OutLength < CAPSTREAM_MAX_ITEM_SIZE) {
+        return 0;
+    }
+
+    for (i = 0; i < CAPSTREAM_MAX_STREAMS; i++) {
+        State->Streams[i].InUse = FALSE;
+    }
+    State->NextSlot = 0;
+
+    Out[n++] = CAPSTREAM_ITEM_WINDOW << CAPSTREAM_TAG_TYPE_SHIFT;
+    n += CapStreamPutVarint(&Out[n], Window->Adapter);
+    n += CapStreamPutVarint(&Out[n], Window->Trigger);
+    n += CapStreamPutVarint(&Out[n], Window->TriggerHandle);
+    n += CapStreamPutVarint(&Out[n], Window->RecordCount);
+    n += CapStreamPutVarint(&Out[n], Window->TriggerRecord);
+    n += CapStreamPutTime(State, &Out[n], Window->TriggerTime);
+
+    return n;
+}
+
+static ULONG
+CapStreamEncodeXor(
+    const UCHAR *   Data,
+    const UCHAR *   Previous,
+    ULONG           Length,
+    PUCHAR          Out
+    )
+/*++
+
+Routine Description:
+
+    Codes Data XOR Previous as (zero run, literal count, literals) pairs.
+    A single zero byte stays in the literal, it is cheaper than a new pair.
+
+--*/
+{
+    ULONG n = 0;
+    ULONG i = 0;
+
+    while (i < Length) {
+        ULONG zeros = 0;
+        ULONG start;
+
+        while (i < Length && Data[i] == Previous[i]) {
+            zeros++;
+            i++;
+        }
+
+        start = i;
+        while (i < Length &&
+               (Data[i] != Previous[i] ||
+                (i + 1 < Length && Data[i + 1] != Previous[i + 1]))) {
+            i++;
+        }
+
+        n += CapStreamPutVarint(&Out[n], zeros);
+        n += CapStreamPutVarint(&Out[n], i - start);
+
+        for (; start < i; start++) {
+            Out[n++] = Data[start] ^ Previous[start];
+        }
+    }
+
+    return n;
+}
+
+ULONG
+CapStreamEncode(
+    PCAPSTREAM_STATE                State,
+    const FILTER_CAPTURE_RECORD     *Record,
+    PUCHAR                          Out,
+    ULONG                           OutLength
+    )
+/*++
+
+Routine Description:
+
+    Encodes a captured packet against the previous packet of its stream.
+
+Return Value:
+
+    Bytes written, 0 if OutLength is below CAPSTREAM_MAX_ITEM_SIZE or the
+    record is malformed.
+
+--*/
+{
+    UCHAR               delta[CAPSTREAM_MAX_ITEM_SIZE + FILTER_CAPTURE_SNAPLEN];
+    UCHAR               kindDirection = (UCHAR)((Record->Kind & 1) | ((Record->Direction & 1) << 1));
+    USHORT              handle = CapStreamHandle(Record);
+    LONGLONG            lastTime = State->LastTime;
+    PCAPSTREAM_STREAM   stream = NULL;
+    ULONG               slot;
+    ULONG               n = 0;
+    UCHAR               tag;
+
+    if (OutLength < CAPSTREAM_MAX_ITEM_SIZE ||
+        Record->CapturedLength > FILTER_CAPTURE_SNAPLEN ||
+        Record->CapturedLength > Record->Length) {
+        return 0;
+    }
+
+    for (slot = 0; slot < CAPSTREAM_MAX_STREAMS; slot++) {
+        if (State->Streams[slot].InUse &&
+            State->Streams[slot].KindDirection == kindDirection &&
+            State->Streams[slot].Handle == handle) {
+            stream = &State->Streams[slot];
+            break;
+        }
+    }
+
+    tag = 0;
+    if (stream == NULL) {
+        slot = State->NextSlot;
+        State->NextSlot = (State->NextSlot + 1) % CAPSTREAM_MAX_STREAMS;
+    } else if (stream->Length == Record->Length &&
+               stream->CapturedLength == Record->CapturedLength) {
+        tag |= CAPSTREAM_TAG_SAME_LENGTH;
+    }
+
+    Out[n++] = (UCHAR)(tag | slot | (CAPSTREAM_ITEM_LITERAL << CAPSTREAM_TAG_TYPE_SHIFT));
+    n += CapStreamPutVarint(&Out[n], kindDirection);
+    n += CapStreamPutVarint(&Out[n], handle);
+    n += CapStreamPutTime(State, &Out[n], Record->Time);
+    if (!(tag & CAPSTREAM_TAG_SAME_LENGTH)) {
+        n += CapStreamPutVarint(&Out[n], Record->Length);
+        n += CapStreamPutVarint(&Out[n], Record->CapturedLength);
+    }
+    RtlCopyMemory(&Out[n], Record->Data, Record->CapturedLength);
+    n += Record->CapturedLength;
+
+    //
+    // Keep the delta instead if it is smaller.
+    //
+    if (stream != NULL) {
+        ULONG deltaLength = 0;
+
+        State->LastTime = lastTime;
+
+        delta[deltaLength++] = (UCHAR)(tag | slot | (CAPSTREAM_ITEM_DELTA << CAPSTREAM_TAG_TYPE_SHIFT));
+        deltaLength += CapStreamPutTime(State, &delta[deltaLength], Record->Time);
+        if (!(tag & CAPSTREAM_TAG_SAME_LENGTH)) {
+            deltaLength += CapStreamPutVarint(&delta[deltaLength], Record->Length);
+            deltaLength += CapStreamPutVarint(&delta[deltaLength], Record->CapturedLength);
+        }
+        deltaLength += CapStreamEncodeXor(Record->Data, stream->Data, Record->CapturedLength, &delta[deltaLength]);
+
+        if (deltaLength < n) {
+            RtlCopyMemory(Out, delta, deltaLength);
+            n = deltaLength;
+        }
+    } else {
+        stream = &State->Streams[slot];
+    }
+
+    stream->InUse = TRUE;
+    stream->KindDirection = kindDirection;
+    stream->Handle = handle;
+    stream->Length = Record->Length;
+    stream->CapturedLength = Record->CapturedLength;
+    RtlZeroMemory(stream->Data, sizeof(stream->Data));
+    RtlCopyMemory(stream->Data, Record->Data, Record->CapturedLength);
+
+    return n;
+}
+
+LONG
+CapStreamDecode(
+    PCAPSTREAM_STATE        State,
+    const UCHAR             *In,
+    ULONG                   InLength,
+    PUCHAR                  ItemType,
+    PFILTER_CAPTURE_HEADER  Window,
+    PFILTER_CAPTURE_RECORD  Record
+    )
+/*++
+
+Routine Description:
+
+    Decodes the next item. State only changes when a whole item could be
+    decoded, so on CAPSTREAM_NEED_MORE the caller appends input and calls
+    again with the same start.
+
+Arguments:
+
+    ItemType - Receives CAPSTREAM_ITEM_WINDOW, with Window filled in, or
+        CAPSTREAM_ITEM_LITERAL or _DELTA, with Record filled in.
+
+Return Value:
+
+    Bytes consumed, CAPSTREAM_NEED_MORE or CAPSTREAM_CORRUPT.
+
+--*/
+{
+    CAPSTREAM_READER    reader;
+    PCAPSTREAM_STREAM   stream;
+    UCHAR               tag;
+    UCHAR               type;
+    ULONG               slot;
+    ULONG               i;
+
+    if (InLength == 0) {
+        return CAPSTREAM_NEED_MORE;
+    }
+
+    reader.Bfr = In;
+    reader.Length = InLength;
+    reader.Offset = 1;
+    reader.Short = FALSE;
+    reader.Corrupt = FALSE;
+
+    tag = In[0];
+    type = (tag >> CAPSTREAM_TAG_TYPE_SHIFT) & 3;
+    slot = tag & CAPSTREAM_TAG_SLOT_MASK;
+    stream = &State->Streams[slot];
+
+    if (tag & 0x80) {
+        return CAPSTREAM_CORRUPT;
+    }
+
+    *ItemType = type;
+
+    switch (type) {
+    case CAPSTREAM_ITEM_WINDOW:
+        RtlZeroMemory(Window, sizeof(FILTER_CAPTURE_HEADER));
+        Window->State = FILTER_CAPTURE_FROZEN;
+        Window->Adapter = (ULONG)CapStreamGetVarint(&reader);
+        Window->Trigger = (UCHAR)CapStreamGetVarint(&reader);
+        Window->TriggerHandle = (USHORT)CapStreamGetVarint(&reader);
+        Window->RecordCount = (ULONG)CapStreamGetVarint(&reader);
+        Window->TriggerRecord = (ULONG)CapStreamGetVarint(&reader);
+        Window->TriggerTime = CapStreamGetTime(&reader, State->LastTime);
+        if (reader.Short || reader.Corrupt) {
+            break;
+        }
+
+        for (i = 0; i < CAPSTREAM_MAX_STREAMS; i++) {
+            State->Streams[i].InUse = FALSE;
+        }
+        State->NextSlot = 0;
+        State->LastTime = Window->TriggerTime;
+        return (LONG)reader.Offset;
+
+    case CAPSTREAM_ITEM_LITERAL:
+    case CAPSTREAM_ITEM_DELTA: {
+        UCHAR   kindDirection;
+        USHORT  handle;
+
+        if (type == CAPSTREAM_ITEM_LITERAL) {
+            ULONGLONG value = CapStreamGetVarint(&reader);
+
+            kindDirection = (UCHAR)value;
+            handle = (USHORT)CapStreamGetVarint(&reader);
+            if (value > 3) {
+                return CAPSTREAM_CORRUPT;
+            }
+        } else {
+            if (!stream->InUse) {
+                return CAPSTREAM_CORRUPT;
+            }
+            kindDirection = stream->KindDirection;
+            handle = stream->Handle;
+        }
+
+        RtlZeroMemory(Record, sizeof(FILTER_CAPTURE_RECORD));
+        Record->Kind = kindDirection & 1;
+        Record->Direction = (kindDirection >> 1) & 1;
+        Record->Time = CapStreamGetTime(&reader, State->LastTime);
+
+        if (tag & CAPSTREAM_TAG_SAME_LENGTH) {
+            if (!stream->InUse) {
+                return CAPSTREAM_CORRUPT;
+            }
+            Record->Length = stream->Length;
+            Record->CapturedLength = stream->CapturedLength;
+        } else {
+            ULONGLONG length = CapStreamGetVarint(&reader);
+            ULONGLONG capturedLength = CapStreamGetVarint(&reader);
+
+            if (length > 0xFFFF ||
+                capturedLength > FILTER_CAPTURE_SNAPLEN ||
+                capturedLength > length) {
+                reader.Corrupt = !reader.Short;
+                break;
+            }
+            Record->Length = (USHORT)length;
+            Record->CapturedLength = (USHORT)capturedLength;
+        }
+
+        if (reader.Short || reader.Corrupt) {
+            break;
+        }
+
+        if (type == CAPSTREAM_ITEM_LITERAL) {
+            if (reader.Length - reader.Offset < Record->CapturedLength) {
+                reader.Short = TRUE;
+                break;
+            }
+            RtlCopyMemory(Record->Data, &In[reader.Offset], Record->CapturedLength);
+            reader.Offset += Record->CapturedLength;
+        } else {
+            i = 0;
+            while (i < Record->CapturedLength) {
+                ULONGLONG zeros = CapStreamGetVarint(&reader);
+                ULONGLONG literals = CapStreamGetVarint(&reader);
+
+                if (reader.Short || reader.Corrupt) {
+                    break;
+                }
+                if (zeros + literals == 0 ||
+                    zeros + literals > (ULONGLONG)(Record->CapturedLength - i)) {
+                    reader.Corrupt = TRUE;
+                    break;
+                }
+                if (reader.Length - reader.Offset < literals) {
+                    reader.Short = TRUE;
+                    break;
+                }
+
+                for (; zeros != 0; zeros--, i++) {
+                    Record->Data[i] = stream->Data[i];
+                }
+                for (; literals != 0; literals--, i++) {
+                    Record->Data[i] = stream->Data[i] ^ In[reader.Offset++];
+                }
+            }
+            if (reader.Short || reader.Corrupt) {
+                break;
+            }
+        }
+
+        State->LastTime = Record->Time;
+
+        stream->InUse = TRUE;
+        stream->KindDirection = kindDirection;
+        stream->Handle = handle;
+        stream->Length = Record->Length;
+        stream->CapturedLength = Record->CapturedLength;
+        RtlZeroMemory(stream->Data, sizeof(stream->Data));
+        RtlCopyMemory(stream->Data, Record->Data, Record->CapturedLength);
+
+        return (LONG)reader.Offset;
+    }
+
+    default:
+        return CAPSTREAM_CORRUPT;
+    }
+
+    return reader.Corrupt ? CAPSTREAM_CORRUPT : CAPSTREAM_NEED_MORE;
+}
@@ -0,0 +1,145 @@
+/*++
+
+Module Name:
+
+    capstream.h
+
+Abstract:
+
+    Compact encoding of captured packets, for keeping long sessions on disk.
+
+    Consecutive notifications on a connection mostly repeat the HCI, L2CAP
+    and ATT headers and differ in a few payload bytes. Each packet is
+    therefore coded against the previous packet of its stream, a stream
+    being the kind, direction and ACL handle. The bytes are XORed with the
+    previous packet and the result is stored as runs of zero bytes and
+    literal bytes, so an unchanged header costs one run. Times are stored
+    as varint deltas.
+
+    Encoder and decoder keep the same CAPSTREAM_MAX_STREAMS streams, replaced
+    round robin, so both run in fixed memory however long the capture is.
+
+    An encoded item is a tag byte, bits 0-3 the stream slot, bits 4-5 the
+    item type and bit 6 set when the lengths are those of the previous
+    packet of the stream, followed by:
+
+    LITERAL     varint kind | direction << 1, varint handle, zigzag varint
+                time delta, [varint length, varint captured length],
+                captured bytes. Starts a stream in the slot.
+
+    DELTA       zigzag varint time delta, [varint length, varint captured
+                length], then (varint zero run, varint literal count, XORed
+                literal bytes) pairs until the captured length is covered.
+
+    WINDOW      (slot bits 0) varint adapter, trigger, trigger handle,
+                record count, trigger record, zigzag varint trigger time
+                delta. Starts a capture window and forgets all streams, so
+                decoding can start at any window.
+
+    A packet is stored as a literal whenever its delta wouldn't be smaller.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "portable.h"
+#include "public.h"
+
+#if !defined(_CAPSTREAM_H_)
+#define _CAPSTREAM_H_
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define CAPSTREAM_MAX_STREAMS       16
+
+#define CAPSTREAM_ITEM_LITERAL      0
+#define CAPSTREAM_ITEM_DELTA        1
+#define CAPSTREAM_ITEM_WINDOW       2
+
+#define CAPSTREAM_TAG_SLOT_MASK     0x0F
+#define CAPSTREAM_TAG_TYPE_SHIFT    4
+#define CAPSTREAM_TAG_SAME_LENGTH   0x40
+
+//
+// Largest encoded item, a literal with every varint at its longest.
+//
+#define CAPSTREAM_MAX_ITEM_SIZE     (1 + 1 + 3 + 10 + 3 + 3 + FILTER_CAPTURE_SNAPLEN)
+
+//
+// What CapStreamDecode returns when it can't decode an item.
+//
+#define CAPSTREAM_NEED_MORE         0
+#define CAPSTREAM_CORRUPT           (-1)
+
+//
+// Start of a capture file, followed by encoded items.
+//
+#define CAPSTREAM_FILE_MAGIC        0x53435253  // 'SRCS'
+#define CAPSTREAM_FILE_VERSION      1
+
+typedef struct _CAPSTREAM_FILE_HEADER {
+
+    ULONG   Magic;
+    ULONG   Version;
+
+} CAPSTREAM_FILE_HEADER, *PCAPSTREAM_FILE_HEADER;
+
+typedef struct _CAPSTREAM_STREAM {
+
+    BOOLEAN InUse;
+    UCHAR   KindDirection;
+    USHORT  Handle;
+    USHORT  Length;
+    USHORT  CapturedLength;
+    UCHAR   Data[FILTER_CAPTURE_SNAPLEN];
+
+} CAPSTREAM_STREAM, *PCAPSTREAM_STREAM;
+
+typedef struct _CAPSTREAM_STATE {
+
+    LONGLONG            LastTime;
+    ULONG               NextSlot;
+    CAPSTREAM_STREAM    Streams[CAPSTREAM_MAX_STREAMS];
+
+} CAPSTREAM_STATE, *PCAPSTREAM_STATE;
+
+VOID
+CapStreamInit(
+    PCAPSTREAM_STATE State
+    );
+
+ULONG
+CapStreamEncodeWindow(
+    PCAPSTREAM_STATE                State,
+    const FILTER_CAPTURE_HEADER     *Window,
+    PUCHAR                          Out,
+    ULONG                           OutLength
+    );
+
+ULONG
+CapStreamEncode(
+    PCAPSTREAM_STATE                State,
+    const FILTER_CAPTURE_RECORD     *Record,
+    PUCHAR                          Out,
+    ULONG                           OutLength
+    );
+
+LONG
+CapStreamDecode(
+    PCAPSTREAM_STATE        State,
+    const UCHAR             *In,
+    ULONG                   InLength,
+    PUCHAR                  ItemType,
+    PFILTER_CAPTURE_HEADER  Window,
+    PFILTER_CAPTURE_RECORD  Record
+    );
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
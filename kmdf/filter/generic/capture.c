@@ -0,0 +1,328 @@
+/*++
+
+Module Name:
+
+    capture.c
+
+Abstract:
+
+    Pre-trigger capture ring and triggers. The caller serializes all calls
+    for one CAPTURE_STATE.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "capture.h"
+
+#define CAPTURE_TICKS_PER_MS    10000
+
+VOID
+CaptureInit(
+    PCAPTURE_STATE State
+    )
+{
+    FILTER_CAPTURE_CONFIG config;
+
+    RtlZeroMemory(State, sizeof(CAPTURE_STATE));
+
+    config.TriggerMask = FILTER_CAPTURE_TRIGGER_ALL;
+    config.PreTrigger = CAPTURE_DEFAULT_PRE_TRIGGER;
+    config.PostTrigger = CAPTURE_DEFAULT_POST_TRIGGER;
+    config.GapMs = CAPTURE_DEFAULT_GAP_MS;
+
+    CaptureConfigure(State, &config);
+}
+
+BOOLEAN
+CaptureConfigure(
+    PCAPTURE_STATE                  State,
+    const FILTER_CAPTURE_CONFIG     *Config
+    )
+/*++
+
+Routine Description:
+
+    Applies a new configuration and re-arms, dropping any window that
+    was frozen.
+
+Return Value:
+
+    FALSE if the window doesn't fit the ring or the gap is 0, nothing
+    changes then.
+
+--*/
+{
+    ULONG i;
+
+    if ((ULONG)Config->PreTrigger + Config->PostTrigger >= FILTER_CAPTURE_RECORDS ||
+        Config->GapMs == 0) {
+        return FALSE;
+    }
+
+    State->Config = *Config;
+    State->GapTicks = (LONGLONG)Config->GapMs * CAPTURE_TICKS_PER_MS;
+    State->State = FILTER_CAPTURE_ARMED;
+
+    for (i = 0; i < HCI_MAX_CONNECTIONS; i++) {
+        CaptureResetStream(State, i);
+    }
+
+    return TRUE;
+}
+
+VOID
+CaptureResetStream(
+    PCAPTURE_STATE  State,
+    ULONG           Stream
+    )
+/*++
+
+Routine Description:
+
+    Forgets what a connection slot streamed, when it connects or
+    disconnects. A remote that disconnects is quiet, not stalled.
+
+--*/
+{
+    if (Stream < HCI_MAX_CONNECTIONS) {
+        RtlZeroMemory(&State->Streams[Stream], sizeof(CAPTURE_STREAM));
+    }
+}
+
+BOOLEAN
+CaptureTrigger(
+    PCAPTURE_STATE  State,
+    UCHAR           Trigger,
+    USHORT          Handle,
+    LONGLONG        Now
+    )
+/*++
+
+Routine Description:
+
+    Fires a trigger. The packets captured from here on are the ones after
+    it. Ignored unless the trigger is enabled and the ring is armed.
+
+Return Value:
+
+    TRUE if the trigger fired.
+
+--*/
+{
+    if (!(State->Config.TriggerMask & Trigger) ||
+        State->State != FILTER_CAPTURE_ARMED) {
+        return FALSE;
+    }
+
+    State->Trigger = Trigger;
+    State->TriggerHandle = Handle;
+    State->TriggerTime = Now;
+    State->TriggerIndex = State->Head;
+    State->PostRemaining = State->Config.PostTrigger;
+    State->State = State->PostRemaining != 0 ? FILTER_CAPTURE_TRIGGERED : FILTER_CAPTURE_FROZEN;
+
+    return TRUE;
+}
+
+BOOLEAN
+CaptureCheckGaps(
+    PCAPTURE_STATE  State,
+    LONGLONG        Now
+    )
+/*++
+
+Routine Description:
+
+    Fires the gap trigger for the first streaming connection that has been
+    quiet for longer than the gap. The connection stops counting as
+    streaming either way, so one stall fires once.
+
+--*/
+{
+    ULONG i;
+
+    for (i = 0; i < HCI_MAX_CONNECTIONS; i++) {
+        PCAPTURE_STREAM stream = &State->Streams[i];
+
+        if (stream->Notifications >= CAPTURE_STREAMING_NOTIFICATIONS &&
+            Now - stream->LastNotification > State->GapTicks) {
+            stream->Notifications = 0;
+            return CaptureTrigger(State,
+                                  FILTER_CAPTURE_TRIGGER_NOTIFICATION_GAP,
+                                  stream->Handle,
+                                  Now);
+        }
+    }
+
+    return FALSE;
+}
+
+static VOID
+CaptureRecord(
+    PCAPTURE_STATE  State,
+    UCHAR           Kind,
+    UCHAR           Direction,
+    PUCHAR          Bfr,
+    ULONG           Length,
+    LONGLONG        Now
+    )
+{
+    PFILTER_CAPTURE_RECORD record;
+
+    if (State->State == FILTER_CAPTURE_FROZEN) {
+        return;
+    }
+
+    record = &State->Ring[State->Head % FILTER_CAPTURE_RECORDS];
+    record->Time = Now;
+    record->Length = (USHORT)min(Length, 0xFFFF);
+    record->Kind = Kind;
+    record->Direction = Direction;
+    record->CapturedLength = (USHORT)min(Length, FILTER_CAPTURE_SNAPLEN);
+    record->Reserved = 0;
+    RtlCopyMemory(record->Data, Bfr, record->CapturedLength);
+
+    State->Head++;
+
+    if (State->State == FILTER_CAPTURE_TRIGGERED &&
+        --State->PostRemaining == 0) {
+        State->State = FILTER_CAPTURE_FROZEN;
+    }
+}
+
+BOOLEAN
+CapturePacket(
+    PCAPTURE_STATE  State,
+    UCHAR           Kind,
+    UCHAR           Direction,
+    ULONG           Stream,
+    PUCHAR          Bfr,
+    ULONG           Length,
+    LONGLONG        Now
+    )
+/*++
+
+Routine Description:
+
+    Captures a packet as it is on the pipe, i.e. packets from the adapter
+    before the filter rewrites them and packets to it as they are sent,
+    and runs the triggers it can fire.
+
+Arguments:
+
+    Kind - TRACE_KIND_* of the packet.
+
+    Direction - HCI_DIRECTION_*.
+
+    Stream - Connection slot of an ACL packet, CAPTURE_NO_STREAM otherwise.
+
+    Bfr, Length - The packet.
+
+    Now - Current time in 100ns units.
+
+Return Value:
+
+    TRUE if a trigger fired.
+
+--*/
+{
+    BOOLEAN triggered;
+
+    if (State->Config.TriggerMask == 0) {
+        return FALSE;
+    }
+
+    triggered = CaptureCheckGaps(State, Now);
+
+    //
+    // The trigger packet is the first one after the trigger.
+    //
+    if (Kind == TRACE_KIND_ACL &&
+        Direction == HCI_DIRECTION_IN &&
+        Length >= HCI_ACL_HEADER_LENGTH &&
+        Length < (ULONG)HCI_ACL_HEADER_LENGTH + HCI_ACL_LENGTH(Bfr)) {
+        triggered |= CaptureTrigger(State,
+                                    FILTER_CAPTURE_TRIGGER_TRUNCATED,
+                                    HCI_ACL_HANDLE(Bfr),
+                                    Now);
+    }
+
+    CaptureRecord(State, Kind, Direction, Bfr, Length, Now);
+
+    if (Stream < HCI_MAX_CONNECTIONS &&
+        Direction == HCI_DIRECTION_IN &&
+        HCI_IS_ATT_PDU(Bfr, Length) &&
+        Bfr[ATT_PDU_OFFSET] == ATT_OP_HANDLE_VALUE_NTF) {
+        PCAPTURE_STREAM stream = &State->Streams[Stream];
+
+        if (stream->Notifications != 0 &&
+            Now - stream->LastNotification <= State->GapTicks) {
+            stream->Notifications++;
+        } else {
+            stream->Notifications = 1;
+        }
+
+        stream->LastNotification = Now;
+        stream->Handle = HCI_ACL_HANDLE(Bfr);
+    }
+
+    return triggered;
+}
+
+ULONG
+CaptureExport(
+    PCAPTURE_STATE          State,
+    PFILTER_CAPTURE_HEADER  Header,
+    PFILTER_CAPTURE_RECORD  Records,
+    ULONG                   MaxRecords
+    )
+/*++
+
+Routine Description:
+
+    Copies out a frozen window, oldest record first, and re-arms. While
+    nothing is frozen only the header is filled in.
+
+Return Value:
+
+    Number of records copied.
+
+--*/
+{
+    ULONG pre;
+    ULONG first;
+    ULONG count;
+    ULONG i;
+
+    RtlZeroMemory(Header, sizeof(FILTER_CAPTURE_HEADER));
+    Header->State = State->State;
+    Header->TriggerHandle = HCI_INVALID_HANDLE;
+
+    if (State->State != FILTER_CAPTURE_FROZEN) {
+        return 0;
+    }
+
+    //
+    // Early on the ring may not hold PreTrigger packets yet.
+    //
+    pre = min((ULONG)State->Config.PreTrigger, State->TriggerIndex);
+    first = State->TriggerIndex - pre;
+    count = min(State->Head - first, MaxRecords);
+
+    for (i = 0; i < count; i++) {
+        Records[i] = State->Ring[(first + i) % FILTER_CAPTURE_RECORDS];
+    }
+
+    Header->Trigger = State->Trigger;
+    Header->TriggerHandle = State->TriggerHandle;
+    Header->TriggerTime = State->TriggerTime;
+    Header->TriggerRecord = pre;
+    Header->RecordCount = count;
+
+    State->State = FILTER_CAPTURE_ARMED;
+
+    return count;
+}
@@ -0,0 +1,132 @@
+/*++
+
+Module Name:
+
+    capture.h
+
+Abstract:
+
+    Pre-trigger capture ring and the triggers that freeze it.
+
+    The ring always holds the last FILTER_CAPTURE_RECORDS packets of an
+    adapter, cut to FILTER_CAPTURE_SNAPLEN bytes. A trigger keeps the
+    configured number of packets from before it, records the packets after
+    it and freezes the window until it is exported, so an intermittent stall
+    can be looked at without capturing everything all the time.
+
+    A connection counts as streaming once CAPTURE_STREAMING_NOTIFICATIONS
+    notifications arrived in a row, each within the gap of the previous
+    one, like trackpad moves or voice. A streaming connection that then
+    goes longer than the gap without a notification fires the gap trigger.
+    Gaps are checked whenever a packet is captured, on any pipe.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "hci.h"
+#include "public.h"
+
+#if !defined(_CAPTURE_H_)
+#define _CAPTURE_H_
+
+C_ASSERT((FILTER_CAPTURE_RECORDS & (FILTER_CAPTURE_RECORDS - 1)) == 0);
+
+#define CAPTURE_STREAMING_NOTIFICATIONS 8
+
+#define CAPTURE_DEFAULT_PRE_TRIGGER     64
+#define CAPTURE_DEFAULT_POST_TRIGGER    32
+#define CAPTURE_DEFAULT_GAP_MS          200
+
+//
+// Passed as Stream for packets that don't belong to a tracked connection.
+//
+#define CAPTURE_NO_STREAM               ((ULONG)-1)
+
+typedef struct _CAPTURE_STREAM {
+
+    LONGLONG    LastNotification;
+    ULONG       Notifications;  // in a row, each within the gap of the previous
+    USHORT      Handle;
+
+} CAPTURE_STREAM, *PCAPTURE_STREAM;
+
+typedef struct _CAPTURE_STATE {
+
+    FILTER_CAPTURE_CONFIG   Config;
+    LONGLONG                GapTicks;
+
+    UCHAR                   State;          // FILTER_CAPTURE_*
+    UCHAR                   Trigger;
+    USHORT                  TriggerHandle;
+    LONGLONG                TriggerTime;
+    ULONG                   TriggerIndex;   // Head when the trigger fired
+    ULONG                   PostRemaining;
+
+    //
+    // Records ever written, the next one goes to Head % FILTER_CAPTURE_RECORDS.
+    //
+    ULONG                   Head;
+
+    //
+    // Indexed like the connection slots of the link state.
+    //
+    CAPTURE_STREAM          Streams[HCI_MAX_CONNECTIONS];
+
+    FILTER_CAPTURE_RECORD   Ring[FILTER_CAPTURE_RECORDS];
+
+} CAPTURE_STATE, *PCAPTURE_STATE;
+
+VOID
+CaptureInit(
+    PCAPTURE_STATE State
+    );
+
+BOOLEAN
+CaptureConfigure(
+    PCAPTURE_STATE                  State,
+    const FILTER_CAPTURE_CONFIG     *Config
+    );
+
+VOID
+CaptureResetStream(
+    PCAPTURE_STATE  State,
+    ULONG           Stream
+    );
+
+BOOLEAN
+CaptureTrigger(
+    PCAPTURE_STATE  State,
+    UCHAR           Trigger,
+    USHORT          Handle,
+    LONGLONG        Now
+    );
+
+BOOLEAN
+CaptureCheckGaps(
+    PCAPTURE_STATE  State,
+    LONGLONG        Now
+    );
+
+BOOLEAN
+CapturePacket(
+    PCAPTURE_STATE  State,
+    UCHAR           Kind,
+    UCHAR           Direction,
+    ULONG           Stream,
+    PUCHAR          Bfr,
+    ULONG           Length,
+    LONGLONG        Now
+    );
+
+ULONG
+CaptureExport(
+    PCAPTURE_STATE          State,
+    PFILTER_CAPTURE_HEADER  Header,
+    PFILTER_CAPTURE_RECORD  Records,
+    ULONG                   MaxRecords
+    );
+
+#endif
@@ -0,0 +1,453 @@
+/*++
+
+Module Name:
+
+    coalesce.c
+
+Abstract:
+
+    Hid report decoding and trackpad move coalescing. The caller serializes
+    all calls for one COALESCE_STATE.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "coalesce.h"
+
+#define COALESCE_TICKS_PER_MS   10000
+
+//
+// What a report says, whichever layout it was decoded with.
+//
+typedef struct _COALESCE_DECODED {
+
+    BOOLEAN     HasButtons;
+    BOOLEAN     HasTouch;
+    BOOLEAN     Touching;
+    ULONG       Contact;
+    USHORT      Buttons;
+    USHORT      X;
+    USHORT      Y;
+
+} COALESCE_DECODED, *PCOALESCE_DECODED;
+
+VOID
+CoalesceInit(
+    PCOALESCE_STATE State
+    )
+{
+    ULONG i;
+
+    RtlZeroMemory(State, sizeof(COALESCE_STATE));
+
+    for (i = 0; i < HCI_MAX_CONNECTIONS; i++) {
+        State->Connections[i].Handle = HCI_INVALID_HANDLE;
+    }
+}
+
+VOID
+CoalesceConfigure(
+    PCOALESCE_STATE State,
+    ULONG           WindowMs
+    )
+/*++
+
+Routine Description:
+
+    Sets the window moves are merged in. Moves already held keep the
+    window they started with.
+
+--*/
+{
+    State->Window = (LONGLONG)WindowMs * COALESCE_TICKS_PER_MS;
+}
+
+VOID
+CoalesceSmooth(
+    PCOALESCE_STATE             State,
+    const FILTER_SMOOTH_CONFIG  *Config
+    )
+/*++
+
+Routine Description:
+
+    Sets the smoothing of the positions. Touches going on take it from
+    their next move.
+
+--*/
+{
+    SmoothConfigure(&State->Smooth, Config);
+}
+
+BOOLEAN
+CoalesceCompileLayout(
+    PCOALESCE_LAYOUT    Layout,
+    USHORT              Handle,
+    const REPORT_MAP    *Map
+    )
+{
+    PCOALESCE_REPORT_LAYOUT report;
+    const REPORT_FIELD      *field;
+    ULONG                   i;
+    ULONG                   j;
+
+    RtlZeroMemory(Layout, sizeof(COALESCE_LAYOUT));
+    Layout->Handle = Handle;
+
+    for (i = 0; i < Map->ReportCount && Layout->ReportCount < COALESCE_MAX_LAYOUT_REPORTS; i++) {
+        report = &Layout->Reports[Layout->ReportCount];
+        RtlZeroMemory(report, sizeof(COALESCE_REPORT_LAYOUT));
+
+        report->Length = (USHORT)((Map->Reports[i].Bits + 7) / 8);
+
+        for (j = 0; j < Map->Reports[i].FieldCount; j++) {
+            field = &Map->Fields[Map->Reports[i].FirstField + j];
+
+            if (field->UsagePage == HID_PAGE_BUTTON && field->BitSize == 1 &&
+                (field->Flags & REPORT_FIELD_ARRAY) == 0) {
+                report->Buttons = *field;
+                report->Buttons.Count = (USHORT)min(field->Count, 32);
+                report->Flags |= COALESCE_LAYOUT_BUTTONS;
+                break;
+            }
+        }
+
+        if (ReportMapFindUsage(Map, i, HID_PAGE_GENERIC_DESKTOP, HID_USAGE_X, &report->X) &&
+            ReportMapFindUsage(Map, i, HID_PAGE_GENERIC_DESKTOP, HID_USAGE_Y, &report->Y) &&
+            ((report->X.Flags | report->Y.Flags) & REPORT_FIELD_RELATIVE) == 0) {
+            report->Flags |= COALESCE_LAYOUT_TOUCH;
+
+            if (ReportMapFindUsage(Map, i, HID_PAGE_DIGITIZER, HID_USAGE_CONTACT_ID, &report->Contact)) {
+                report->Flags |= COALESCE_LAYOUT_CONTACT;
+            }
+
+            if (ReportMapFindUsage(Map, i, HID_PAGE_DIGITIZER, HID_USAGE_TIP_SWITCH, &report->Touching)) {
+                report->Flags |= COALESCE_LAYOUT_TOUCHING;
+            }
+        }
+
+        if (report->Flags != 0) {
+            Layout->ReportCount++;
+        }
+    }
+
+    return Layout->ReportCount != 0;
+}
+
+static USHORT
+CoalescePosition(
+    LONG Value
+    )
+{
+    return (USHORT)min(max(Value, 0), 0xFFFF);
+}
+
+static VOID
+CoalesceDecode(
+    const COALESCE_LAYOUT   *Layout,
+    USHORT                  Handle,
+    const UCHAR             *Value,
+    ULONG                   Length,
+    PCOALESCE_DECODED       Decoded
+    )
+/*++
+
+Routine Description:
+
+    Decodes a report with the report of the connection's layout of its
+    length, or with the fixed layout.
+
+--*/
+{
+    const COALESCE_REPORT_LAYOUT    *report;
+    ULONG                           bits;
+    ULONG                           i;
+
+    RtlZeroMemory(Decoded, sizeof(COALESCE_DECODED));
+
+    if (Layout != NULL && Layout->Handle == Handle) {
+
+        for (i = 0; i < Layout->ReportCount; i++) {
+            report = &Layout->Reports[i];
+
+            if (report->Length != Length) {
+                continue;
+            }
+
+            //
+            // Button usages count from 1, usage 0 is no button.
+            //
+            if (report->Flags & COALESCE_LAYOUT_BUTTONS) {
+                bits = ReportMapBits(Value, Length, report->Buttons.BitOffset, report->Buttons.Count);
+                Decoded->HasButtons = TRUE;
+                Decoded->Buttons = (USHORT)(report->Buttons.UsageMin != 0 ?
+                                            bits << (min(report->Buttons.UsageMin, 17) - 1) :
+                                            bits >> 1);
+            }
+
+            if (report->Flags & COALESCE_LAYOUT_TOUCH) {
+                Decoded->HasTouch = TRUE;
+                Decoded->Touching = TRUE;
+                Decoded->X = CoalescePosition(ReportMapElement(&report->X, Value, Length, 0));
+                Decoded->Y = CoalescePosition(ReportMapElement(&report->Y, Value, Length, 0));
+
+                if (report->Flags & COALESCE_LAYOUT_CONTACT) {
+                    Decoded->Contact = (ULONG)ReportMapElement(&report->Contact, Value, Length, 0);
+                }
+
+                if (report->Flags & COALESCE_LAYOUT_TOUCHING) {
+                    Decoded->Touching = ReportMapElement(&report->Touching, Value, Length, 0) != 0;
+                }
+            }
+
+            return;
+        }
+    }
+
+    if (Length < SIRI_REPORT_BUTTONS_LENGTH) {
+        return;
+    }
+
+    Decoded->HasButtons = TRUE;
+    Decoded->Buttons = (USHORT)(Value[SIRI_REPORT_BUTTONS] | (Value[SIRI_REPORT_BUTTONS + 1] << 8));
+
+    if (Length < SIRI_REPORT_TOUCH_LENGTH) {
+        return;
+    }
+
+    Decoded->HasTouch = TRUE;
+    Decoded->Contact = SIRI_REPORT_CONTACT_ID(Value[SIRI_REPORT_CONTACT]);
+    Decoded->Touching = SIRI_REPORT_CONTACT_TOUCHING(Value[SIRI_REPORT_CONTACT]);
+    Decoded->X = (USHORT)(Value[SIRI_REPORT_POSITION] | ((Value[SIRI_REPORT_POSITION + 1] & 0x0F) << 8));
+    Decoded->Y = (USHORT)((Value[SIRI_REPORT_POSITION + 1] >> 4) | (Value[SIRI_REPORT_POSITION + 2] << 4));
+}
+
+static VOID
+CoalesceMakeEvent(
+    PFILTER_EVENT           Event,
+    UCHAR                   Type,
+    PCOALESCE_CONNECTION    Conn,
+    ULONG                   Contact,
+    LONGLONG                Now,
+    LONGLONG                Stamp
+    )
+{
+    RtlZeroMemory(Event, sizeof(FILTER_EVENT));
+
+    Event->Time = Now;
+    Event->Stamp = Stamp;
+    Event->Handle = Conn->Handle;
+    Event->Attribute = Conn->Attribute;
+    Event->Type = Type;
+    Event->Contact = (UCHAR)Contact;
+    Event->Buttons = Conn->Buttons;
+    Event->Reports = 1;
+    Event->X = Conn->Contacts[Contact].X;
+    Event->Y = Conn->Contacts[Contact].Y;
+}
+
+static ULONG
+CoalesceDeliverHeld(
+    PCOALESCE_CONNECTION    Conn,
+    PFILTER_EVENT           Events
+    )
+{
+    ULONG count = 0;
+    ULONG i;
+
+    for (i = 0; i < COALESCE_MAX_CONTACTS; i++) {
+        if (Conn->Contacts[i].Held) {
+            Events[count++] = Conn->Contacts[i].Event;
+            Conn->Contacts[i].Held = FALSE;
+        }
+    }
+
+    return count;
+}
+
+ULONG
+CoalesceReport(
+    PCOALESCE_STATE         State,
+    const COALESCE_LAYOUT   *Layout,
+    ULONG                   Stream,
+    USHORT                  Handle,
+    USHORT                  Attribute,
+    const UCHAR             *Value,
+    ULONG                   Length,
+    LONGLONG                Now,
+    LONGLONG                Stamp,
+    PFILTER_EVENT           Events
+    )
+/*++
+
+Routine Description:
+
+    Decodes a hid report and returns the events it delivers.
+
+Arguments:
+
+    Layout - Of the connection's Report Map, NULL or one for another
+        handle to decode with the fixed layout.
+
+    Stream - Connection slot of the link state the report came in on.
+
+    Handle - ACL handle of that connection. A slot that changed handle
+        starts over, moves held for the old connection are dropped.
+
+    Attribute - ATT handle of the notification.
+
+    Value, Length - The ATT value of the notification.
+
+    Stamp - Performance counter at the completion of the report's URB,
+        passed through to the events.
+
+    Events - Receives up to COALESCE_MAX_REPORT_EVENTS events.
+
+Return Value:
+
+    Number of events delivered, oldest first.
+
+--*/
+{
+    PCOALESCE_CONNECTION    conn;
+    PCOALESCE_CONTACT       contact;
+    COALESCE_DECODED        decoded;
+    ULONG                   count = 0;
+    USHORT                  x;
+    USHORT                  y;
+
+    if (Stream >= HCI_MAX_CONNECTIONS) {
+        return 0;
+    }
+
+    CoalesceDecode(Layout, Handle, Value, Length, &decoded);
+
+    if (!decoded.HasButtons && !decoded.HasTouch) {
+        return 0;
+    }
+
+    conn = &State->Connections[Stream];
+
+    if (conn->Handle != Handle) {
+        RtlZeroMemory(conn, sizeof(COALESCE_CONNECTION));
+        conn->Handle = Handle;
+    }
+
+    conn->Attribute = Attribute;
+
+    if (decoded.HasButtons && decoded.Buttons != conn->Buttons) {
+        count += CoalesceDeliverHeld(conn, &Events[count]);
+
+        conn->Buttons = decoded.Buttons;
+        CoalesceMakeEvent(&Events[count++], FILTER_EVENT_BUTTONS, conn, 0, Now, Stamp);
+    }
+
+    if (!decoded.HasTouch || decoded.Contact >= COALESCE_MAX_CONTACTS) {
+        return count;
+    }
+
+    contact = &conn->Contacts[decoded.Contact];
+    x = decoded.X;
+    y = decoded.Y;
+
+    if (decoded.Touching && contact->Touching) {
+
+        if (State->Smooth.Enabled) {
+            SmoothStep(&State->Smooth, &contact->Smooth, &x, &y, Now);
+        }
+
+        if (contact->Held && Now - contact->HeldSince < State->Window) {
+            contact->Event.Time = Now;
+            contact->Event.Stamp = Stamp;
+            contact->Event.Buttons = conn->Buttons;
+            contact->Event.Reports++;
+        } else {
+            if (contact->Held) {
+                Events[count++] = contact->Event;
+            }
+
+            CoalesceMakeEvent(&contact->Event, FILTER_EVENT_TOUCH_MOVE, conn, decoded.Contact, Now, Stamp);
+            contact->Held = TRUE;
+            contact->HeldSince = Now;
+        }
+
+        contact->Event.X = x;
+        contact->Event.Y = y;
+        contact->Event.DeltaX = (SHORT)(contact->Event.DeltaX + (x - contact->X));
+        contact->Event.DeltaY = (SHORT)(contact->Event.DeltaY + (y - contact->Y));
+        contact->X = x;
+        contact->Y = y;
+
+        if (State->Window == 0) {
+            Events[count++] = contact->Event;
+            contact->Held = FALSE;
+        }
+
+    } else if (decoded.Touching) {
+
+        count += CoalesceDeliverHeld(conn, &Events[count]);
+
+        contact->Touching = TRUE;
+        contact->X = x;
+        contact->Y = y;
+        SmoothReset(&contact->Smooth, x, y, Now);
+        CoalesceMakeEvent(&Events[count++], FILTER_EVENT_TOUCH_DOWN, conn, decoded.Contact, Now, Stamp);
+
+    } else if (contact->Touching) {
+
+        //
+        // The position of the lift report isn't reliable, touch up carries
+        // the last one seen.
+        //
+        count += CoalesceDeliverHeld(conn, &Events[count]);
+
+        contact->Touching = FALSE;
+        CoalesceMakeEvent(&Events[count++], FILTER_EVENT_TOUCH_UP, conn, decoded.Contact, Now, Stamp);
+    }
+
+    return count;
+}
+
+ULONG
+CoalesceFlush(
+    PCOALESCE_STATE State,
+    LONGLONG        Now,
+    PFILTER_EVENT   Events
+    )
+/*++
+
+Routine Description:
+
+    Delivers the moves whose window has passed.
+
+Arguments:
+
+    Events - Receives up to COALESCE_MAX_FLUSH_EVENTS events.
+
+Return Value:
+
+    Number of events delivered.
+
+--*/
+{
+    PCOALESCE_CONTACT   contact;
+    ULONG               count = 0;
+    ULONG               i;
+    ULONG               j;
+
+    for (i = 0; i < HCI_MAX_CONNECTIONS; i++) {
+        for (j = 0; j < COALESCE_MAX_CONTACTS; j++) {
+            contact = &State->Connections[i].Contacts[j];
+
+            if (contact->Held && Now - contact->HeldSince >= State->Window) {
+                Events[count++] = contact->Event;
+                contact->Held = FALSE;
+            }
+        }
+    }
+
+    return count;
+}
@@ -0,0 +1,206 @@
+/*++
+
+Module Name:
+
+    coalesce.h
+
+Abstract:
+
+    Turns the hid reports of a remote into button and touch events and
+    coalesces trackpad moves.
+
+    The trackpad reports far faster than a UI redraws. Consecutive moves of
+    a contact that arrive within the window of the first one are merged into
+    one event carrying the summed deltas and the latest position. Button
+    changes, touch down and touch up are never merged and first deliver the
+    moves of their connection that are still held, so a reader sees every
+    edge in order and after the position that led to it. Moves of different
+    contacts can be delivered out of order with each other.
+
+    Held moves are delivered by the report that ends their window or by
+    CoalesceFlush once the window has passed.
+
+    With smoothing configured, the positions of a touch go through its
+    contact's filter (smooth.h) before they are coalesced, and the deltas
+    are those of the smoothed positions.
+
+    Reports are decoded with the layout below, or with a layout compiled
+    from the remote's Report Map (reportmap.h) when the caller has one. HOGP
+    notifications don't say which report they are, so a compiled layout
+    tells them apart by length: a report of the length of one of its input
+    reports is decoded with that report's fields, any other with the layout
+    below.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "hci.h"
+#include "public.h"
+#include "smooth.h"
+#include "reportmap.h"
+
+#if !defined(_COALESCE_H_)
+#define _COALESCE_H_
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+//
+// Value of a notification on the hid report handle
+//
+// 00 02                                   buttons
+// 01 00 32 a2 4d 09 e6 18 ca 8a 07 02 a2  buttons, trackpad
+//
+// Buttons are a little endian bitmap. In a trackpad report the next byte
+// holds the contact in bits 0-3 and is 0 in bits 4-7 once the finger is
+// lifted, followed by X and Y as 12 bit little endian values packed into
+// 3 bytes. The bytes after that aren't decoded.
+//
+#define SIRI_REPORT_BUTTONS                 0
+#define SIRI_REPORT_CONTACT                 2
+#define SIRI_REPORT_POSITION                3
+#define SIRI_REPORT_BUTTONS_LENGTH          2
+#define SIRI_REPORT_TOUCH_LENGTH            6
+
+#define SIRI_REPORT_CONTACT_ID(b)           ((b) & 0x0F)
+#define SIRI_REPORT_CONTACT_TOUCHING(b)     (((b) & 0xF0) != 0)
+
+//
+// Fields of an input report of a Report Map, by usage
+//
+// Buttons      the first variable field of the Button page, a bitmap of
+//              buttons from its UsageMin, the buttons past 16 left out
+// X, Y         Generic Desktop X and Y, absolute, a touch report has both;
+//              a mouse's moves are no touch
+// Contact      Digitizer Contact Identifier, contact 0 without one
+// Touching     Digitizer Tip Switch, not 0 while the finger is down, always
+//              down without one
+//
+#define COALESCE_MAX_LAYOUT_REPORTS         4
+
+#define COALESCE_LAYOUT_BUTTONS             0x01
+#define COALESCE_LAYOUT_TOUCH               0x02
+#define COALESCE_LAYOUT_CONTACT             0x04
+#define COALESCE_LAYOUT_TOUCHING            0x08
+
+typedef struct _COALESCE_REPORT_LAYOUT {
+
+    USHORT          Length;     // bytes of a notification of the report
+    UCHAR           Flags;      // COALESCE_LAYOUT_*
+    UCHAR           Reserved;
+    REPORT_FIELD    Buttons;
+    REPORT_FIELD    X;
+    REPORT_FIELD    Y;
+    REPORT_FIELD    Contact;
+    REPORT_FIELD    Touching;
+
+} COALESCE_REPORT_LAYOUT, *PCOALESCE_REPORT_LAYOUT;
+
+typedef struct _COALESCE_LAYOUT {
+
+    USHORT                  Handle;         // of the connection it is for
+    USHORT                  ReportCount;    // 0 decodes everything with the fixed layout
+    COALESCE_REPORT_LAYOUT  Reports[COALESCE_MAX_LAYOUT_REPORTS];
+
+} COALESCE_LAYOUT, *PCOALESCE_LAYOUT;
+
+#define COALESCE_MAX_CONTACTS               2
+
+//
+// Most events one report or one flush can deliver.
+//
+#define COALESCE_MAX_REPORT_EVENTS          (COALESCE_MAX_CONTACTS + 2)
+#define COALESCE_MAX_FLUSH_EVENTS           (HCI_MAX_CONNECTIONS * COALESCE_MAX_CONTACTS)
+
+typedef struct _COALESCE_CONTACT {
+
+    BOOLEAN         Touching;
+    BOOLEAN         Held;           // Event holds moves not delivered yet
+    USHORT          X;
+    USHORT          Y;
+    LONGLONG        HeldSince;
+    FILTER_EVENT    Event;
+    SMOOTH_CONTACT  Smooth;
+
+} COALESCE_CONTACT, *PCOALESCE_CONTACT;
+
+typedef struct _COALESCE_CONNECTION {
+
+    USHORT              Handle;
+    USHORT              Attribute;  // of the last report
+    USHORT              Buttons;
+    COALESCE_CONTACT    Contacts[COALESCE_MAX_CONTACTS];
+
+} COALESCE_CONNECTION, *PCOALESCE_CONNECTION;
+
+typedef struct _COALESCE_STATE {
+
+    LONGLONG            Window;     // 100ns units, 0 delivers every move
+    SMOOTH_PARAMS       Smooth;
+
+    //
+    // Indexed like the connection slots of the link state.
+    //
+    COALESCE_CONNECTION Connections[HCI_MAX_CONNECTIONS];
+
+} COALESCE_STATE, *PCOALESCE_STATE;
+
+VOID
+CoalesceInit(
+    PCOALESCE_STATE State
+    );
+
+VOID
+CoalesceConfigure(
+    PCOALESCE_STATE State,
+    ULONG           WindowMs
+    );
+
+VOID
+CoalesceSmooth(
+    PCOALESCE_STATE             State,
+    const FILTER_SMOOTH_CONFIG  *Config
+    );
+
+//
+// Picks the fields of the input reports of a compiled Report Map for the
+// connection with Handle. Returns FALSE if no report has buttons or a
+// touch, the layout then decodes everything with the fixed layout.
+//
+BOOLEAN
+CoalesceCompileLayout(
+    PCOALESCE_LAYOUT    Layout,
+    USHORT              Handle,
+    const REPORT_MAP    *Map
+    );
+
+ULONG
+CoalesceReport(
+    PCOALESCE_STATE         State,
+    const COALESCE_LAYOUT   *Layout,
+    ULONG                   Stream,
+    USHORT                  Handle,
+    USHORT                  Attribute,
+    const UCHAR             *Value,
+    ULONG                   Length,
+    LONGLONG                Now,
+    LONGLONG                Stamp,
+    PFILTER_EVENT           Events
+    );
+
+ULONG
+CoalesceFlush(
+    PCOALESCE_STATE State,
+    LONGLONG        Now,
+    PFILTER_EVENT   Events
+    );
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
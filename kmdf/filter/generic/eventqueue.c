@@ -0,0 +1,364 @@
+/*++
+
+Module Name:
+
+    eventqueue.c
+
+Abstract:
+
+    Event and voice rings shared by the subscribers. The caller serializes
+    all calls for one EVENT_QUEUE.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "eventqueue.h"
+
+#define EVENT_QUEUE_SLOT(Index)     ((Index) % FILTER_EVENT_QUEUE_LENGTH)
+
+VOID
+EventQueueInit(
+    PEVENT_QUEUE Queue
+    )
+{
+    RtlZeroMemory(Queue, sizeof(EVENT_QUEUE));
+}
+
+ULONG
+EventQueueSubscribe(
+    PEVENT_QUEUE                        Queue,
+    ULONG                               Subscriber,
+    const FILTER_EVENT_SUBSCRIPTION     *Subscription
+    )
+/*++
+
+Routine Description:
+
+    Changes the subscription of a subscriber, or adds one that reads from
+    the next entries queued.
+
+Arguments:
+
+    Subscriber - The subscriber to change, EVENT_QUEUE_NO_SUBSCRIBER to add
+        one.
+
+Return Value:
+
+    The subscriber, EVENT_QUEUE_NO_SUBSCRIBER if all are taken.
+
+--*/
+{
+    PEVENT_SUBSCRIBER   sub;
+    ULONG               i;
+
+    if (Subscriber == EVENT_QUEUE_NO_SUBSCRIBER) {
+        for (i = 0; i < FILTER_EVENT_MAX_SUBSCRIBERS; i++) {
+            if (!Queue->Subscribers[i].InUse) {
+                break;
+            }
+        }
+
+        if (i == FILTER_EVENT_MAX_SUBSCRIBERS) {
+            return EVENT_QUEUE_NO_SUBSCRIBER;
+        }
+
+        Subscriber = i;
+        sub = &Queue->Subscribers[i];
+        sub->InUse = TRUE;
+        sub->EventNext = Queue->EventHead;
+        sub->VoiceNext = Queue->VoiceHead;
+        sub->EventLost = 0;
+    }
+
+    Queue->Subscribers[Subscriber].Subscription = *Subscription;
+
+    return Subscriber;
+}
+
+VOID
+EventQueueUnsubscribe(
+    PEVENT_QUEUE    Queue,
+    ULONG           Subscriber
+    )
+{
+    Queue->Subscribers[Subscriber].InUse = FALSE;
+}
+
+static BOOLEAN
+EventQueueFoldMove(
+    PEVENT_QUEUE Queue
+    )
+/*++
+
+Routine Description:
+
+    Makes room in a full event ring by taking out its oldest move that is
+    followed by another event of its contact. Its deltas go to that event
+    when it is a move too.
+
+    A subscriber that has read the move but not the event after it would
+    get the deltas twice, so only moves with no cursor between them and
+    that event are taken.
+
+Return Value:
+
+    FALSE if there is no such move.
+
+--*/
+{
+    PFILTER_EVENT       move = NULL;
+    PFILTER_EVENT       event;
+    PEVENT_SUBSCRIBER   sub;
+    ULONG               first;
+    ULONG               next;
+    ULONG               i;
+
+    for (first = Queue->EventTail; first != Queue->EventHead && move == NULL; first++) {
+        if (Queue->Events[EVENT_QUEUE_SLOT(first)].Type != FILTER_EVENT_TOUCH_MOVE) {
+            continue;
+        }
+
+        for (next = first + 1; next != Queue->EventHead; next++) {
+            event = &Queue->Events[EVENT_QUEUE_SLOT(next)];
+
+            if (event->Handle == Queue->Events[EVENT_QUEUE_SLOT(first)].Handle &&
+                event->Type != FILTER_EVENT_BUTTONS &&
+                event->Contact == Queue->Events[EVENT_QUEUE_SLOT(first)].Contact) {
+                break;
+            }
+        }
+
+        if (next == Queue->EventHead) {
+            continue;
+        }
+
+        for (i = 0; i < FILTER_EVENT_MAX_SUBSCRIBERS; i++) {
+            sub = &Queue->Subscribers[i];
+
+            if (sub->InUse &&
+                (LONG)(sub->EventNext - first) > 0 &&
+                (LONG)(sub->EventNext - next) <= 0) {
+                break;
+            }
+        }
+
+        if (i == FILTER_EVENT_MAX_SUBSCRIBERS) {
+            move = &Queue->Events[EVENT_QUEUE_SLOT(first)];
+            break;
+        }
+    }
+
+    if (move == NULL) {
+        return FALSE;
+    }
+
+    if (event->Type == FILTER_EVENT_TOUCH_MOVE) {
+        event->DeltaX = (SHORT)(event->DeltaX + move->DeltaX);
+        event->DeltaY = (SHORT)(event->DeltaY + move->DeltaY);
+        event->Reports = (USHORT)(event->Reports + move->Reports);
+    }
+
+    //
+    // Close the gap, moving the older events up. A cursor at or before the
+    // move moves up with the entry it points to, one past the event it was
+    // folded into points to the same entry as before.
+    //
+    for (i = (ULONG)(move - Queue->Events); i != EVENT_QUEUE_SLOT(Queue->EventTail); i = EVENT_QUEUE_SLOT(i - 1)) {
+        Queue->Events[i] = Queue->Events[EVENT_QUEUE_SLOT(i - 1)];
+    }
+
+    Queue->EventTail++;
+
+    for (i = 0; i < FILTER_EVENT_MAX_SUBSCRIBERS; i++) {
+        if ((LONG)(Queue->Subscribers[i].EventNext - first) <= 0) {
+            Queue->Subscribers[i].EventNext++;
+        }
+    }
+
+    return TRUE;
+}
+
+static BOOLEAN
+EventQueueWanted(
+    const FILTER_EVENT_SUBSCRIPTION *Subscription,
+    ULONG                           Class,
+    USHORT                          Handle,
+    USHORT                          Attribute
+    )
+{
+    return (Subscription->Classes & Class) != 0 &&
+           (Subscription->Handle == FILTER_EVENT_ANY_HANDLE || Subscription->Handle == Handle) &&
+           (Subscription->Attribute == FILTER_EVENT_ANY_HANDLE || Subscription->Attribute == Attribute);
+}
+
+VOID
+EventQueuePut(
+    PEVENT_QUEUE        Queue,
+    const FILTER_EVENT  *Event
+    )
+/*++
+
+Routine Description:
+
+    Queues an event for the subscribers. When the ring is full it lets go
+    of what every subscriber has read, or else folds a move. When neither
+    makes room the event is turned away and counted as lost by the
+    subscribers that want it, an event already queued never goes unread.
+
+--*/
+{
+    PEVENT_SUBSCRIBER   sub;
+    ULONG               oldest = Queue->EventHead;
+    ULONG               i;
+
+    if (Queue->EventHead - Queue->EventTail == FILTER_EVENT_QUEUE_LENGTH) {
+
+        for (i = 0; i < FILTER_EVENT_MAX_SUBSCRIBERS; i++) {
+            sub = &Queue->Subscribers[i];
+
+            if (sub->InUse && (LONG)(sub->EventNext - oldest) < 0) {
+                oldest = sub->EventNext;
+            }
+        }
+
+        if ((LONG)(oldest - Queue->EventTail) > 0) {
+            Queue->EventTail = oldest;
+        } else if (!EventQueueFoldMove(Queue)) {
+            for (i = 0; i < FILTER_EVENT_MAX_SUBSCRIBERS; i++) {
+                sub = &Queue->Subscribers[i];
+
+                if (sub->InUse &&
+                    EventQueueWanted(&sub->Subscription, FILTER_EVENT_CLASS_INPUT, Event->Handle, Event->Attribute)) {
+                    sub->EventLost++;
+                }
+            }
+
+            return;
+        }
+    }
+
+    Queue->Events[EVENT_QUEUE_SLOT(Queue->EventHead++)] = *Event;
+}
+
+VOID
+EventQueuePutVoice(
+    PEVENT_QUEUE    Queue,
+    USHORT          Handle,
+    USHORT          Attribute,
+    const UCHAR     *Value,
+    ULONG           Length,
+    LONGLONG        Now,
+    LONGLONG        Stamp
+    )
+/*++
+
+Routine Description:
+
+    Queues the value of a voice notification, cut to FILTER_VOICE_SNAPLEN
+    bytes.
+
+--*/
+{
+    PFILTER_VOICE_FRAME frame;
+
+    if (Queue->VoiceHead - Queue->VoiceTail == FILTER_VOICE_QUEUE_LENGTH) {
+        Queue->VoiceTail++;
+    }
+
+    frame = &Queue->Voice[Queue->VoiceHead++ % FILTER_VOICE_QUEUE_LENGTH];
+
+    frame->Time = Now;
+    frame->Stamp = Stamp;
+    frame->Handle = Handle;
+    frame->Length = (USHORT)Length;
+    frame->CapturedLength = (USHORT)min(Length, FILTER_VOICE_SNAPLEN);
+    frame->Attribute = Attribute;
+    RtlCopyMemory(frame->Data, Value, frame->CapturedLength);
+}
+
+ULONG
+EventQueueTake(
+    PEVENT_QUEUE                Queue,
+    ULONG                       Subscriber,
+    PFILTER_EVENT_BUFFER_HEADER Header,
+    ULONG                       Length
+    )
+/*++
+
+Routine Description:
+
+    Copies the events a subscriber wants that fit after Header, then as
+    many of the voice frames it wants as fit after those, and moves its
+    cursors past them.
+
+Arguments:
+
+    Header, Length - Output buffer, at least a FILTER_EVENT_BUFFER_HEADER.
+
+Return Value:
+
+    Bytes used.
+
+--*/
+{
+    PEVENT_SUBSCRIBER   sub = &Queue->Subscribers[Subscriber];
+    PFILTER_EVENT       events = (PFILTER_EVENT)(Header + 1);
+    PFILTER_EVENT       event;
+    PFILTER_VOICE_FRAME frames;
+    PFILTER_VOICE_FRAME frame;
+    ULONG               room = Length - sizeof(FILTER_EVENT_BUFFER_HEADER);
+
+    Header->EventCount = 0;
+    Header->Lost = sub->EventLost;
+    Header->VoiceCount = 0;
+    Header->VoiceLost = 0;
+
+    if ((LONG)(sub->EventNext - Queue->EventTail) < 0) {
+        Header->Lost += Queue->EventTail - sub->EventNext;
+        sub->EventNext = Queue->EventTail;
+    }
+
+    sub->EventLost = 0;
+
+    for (; sub->EventNext != Queue->EventHead; sub->EventNext++) {
+        event = &Queue->Events[EVENT_QUEUE_SLOT(sub->EventNext)];
+
+        if (!EventQueueWanted(&sub->Subscription, FILTER_EVENT_CLASS_INPUT, event->Handle, event->Attribute)) {
+            continue;
+        }
+
+        if (room < sizeof(FILTER_EVENT)) {
+            break;
+        }
+
+        events[Header->EventCount++] = *event;
+        room -= sizeof(FILTER_EVENT);
+    }
+
+    if ((LONG)(sub->VoiceNext - Queue->VoiceTail) < 0) {
+        Header->VoiceLost = Queue->VoiceTail - sub->VoiceNext;
+        sub->VoiceNext = Queue->VoiceTail;
+    }
+
+    frames = (PFILTER_VOICE_FRAME)(events + Header->EventCount);
+
+    for (; sub->VoiceNext != Queue->VoiceHead; sub->VoiceNext++) {
+        frame = &Queue->Voice[sub->VoiceNext % FILTER_VOICE_QUEUE_LENGTH];
+
+        if (!EventQueueWanted(&sub->Subscription, FILTER_EVENT_CLASS_VOICE, frame->Handle, frame->Attribute)) {
+            continue;
+        }
+
+        if (room < sizeof(FILTER_VOICE_FRAME)) {
+            break;
+        }
+
+        frames[Header->VoiceCount++] = *frame;
+        room -= sizeof(FILTER_VOICE_FRAME);
+    }
+
+    return Length - room;
+}
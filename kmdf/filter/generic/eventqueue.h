@@ -0,0 +1,139 @@
+/*++
+
+Module Name:
+
+    eventqueue.h
+
+Abstract:
+
+    Queues of what waits for IOCTL_GET_EVENTS, one per delivery class, and
+    the subscribers reading them.
+
+    Button and touch events are latency critical and few. Voice frames come
+    in bursts of dozens a second while the voice button is held and are
+    only worth having while they are fresh. Each class has its own ring and
+    overflow policy, and a read always drains the events first, so however
+    many voice frames are waiting a press is in the next read.
+
+    Every subscriber reads the same rings through a cursor per ring and its
+    own subscription, nothing is copied per subscriber. A ring only has to
+    hold what its slowest subscriber hasn't read, a full event ring first
+    lets go of what every subscriber has read.
+
+    When that leaves no room, it folds its oldest move into the next event
+    of the same contact. The deltas go along when that is a move, a touch
+    down or up carries the position itself. A subscriber that has read the
+    move but not that event would get the deltas twice, so moves with a
+    cursor between them and their event stay. Only when there is no move to
+    fold is the new event turned away, and the subscribers that wanted it
+    count it as lost on their next read. An event once queued is never
+    dropped unread, so no subscriber misses an edge before the ring is full
+    of what it hasn't read.
+
+    The voice ring drops its oldest frame when it is full.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "portable.h"
+#include "public.h"
+
+#if !defined(_EVENTQUEUE_H_)
+#define _EVENTQUEUE_H_
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+C_ASSERT((FILTER_EVENT_QUEUE_LENGTH & (FILTER_EVENT_QUEUE_LENGTH - 1)) == 0);
+C_ASSERT((FILTER_VOICE_QUEUE_LENGTH & (FILTER_VOICE_QUEUE_LENGTH - 1)) == 0);
+
+#define EVENT_QUEUE_NO_SUBSCRIBER   ((ULONG)-1)
+
+typedef struct _EVENT_SUBSCRIBER {
+
+    BOOLEAN                     InUse;
+    FILTER_EVENT_SUBSCRIPTION   Subscription;
+
+    //
+    // Index of the next entry to read in each ring.
+    //
+    ULONG                       EventNext;
+    ULONG                       VoiceNext;
+
+    //
+    // Events it wanted that a full ring turned away since its last read.
+    //
+    ULONG                       EventLost;
+
+} EVENT_SUBSCRIBER, *PEVENT_SUBSCRIBER;
+
+typedef struct _EVENT_QUEUE {
+
+    //
+    // Entries ever queued, the next one queued goes to Head % the ring
+    // length. Entries before Tail are gone.
+    //
+    ULONG               EventHead;
+    ULONG               EventTail;
+    ULONG               VoiceHead;
+    ULONG               VoiceTail;
+
+    EVENT_SUBSCRIBER    Subscribers[FILTER_EVENT_MAX_SUBSCRIBERS];
+
+    FILTER_EVENT        Events[FILTER_EVENT_QUEUE_LENGTH];
+    FILTER_VOICE_FRAME  Voice[FILTER_VOICE_QUEUE_LENGTH];
+
+} EVENT_QUEUE, *PEVENT_QUEUE;
+
+VOID
+EventQueueInit(
+    PEVENT_QUEUE Queue
+    );
+
+ULONG
+EventQueueSubscribe(
+    PEVENT_QUEUE                        Queue,
+    ULONG                               Subscriber,
+    const FILTER_EVENT_SUBSCRIPTION     *Subscription
+    );
+
+VOID
+EventQueueUnsubscribe(
+    PEVENT_QUEUE    Queue,
+    ULONG           Subscriber
+    );
+
+VOID
+EventQueuePut(
+    PEVENT_QUEUE        Queue,
+    const FILTER_EVENT  *Event
+    );
+
+VOID
+EventQueuePutVoice(
+    PEVENT_QUEUE    Queue,
+    USHORT          Handle,
+    USHORT          Attribute,
+    const UCHAR     *Value,
+    ULONG           Length,
+    LONGLONG        Now,
+    LONGLONG        Stamp
+    );
+
+ULONG
+EventQueueTake(
+    PEVENT_QUEUE                Queue,
+    ULONG                       Subscriber,
+    PFILTER_EVENT_BUFFER_HEADER Header,
+    ULONG                       Length
+    );
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
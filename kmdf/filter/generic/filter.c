@@ -33,14 +33,44 @@ Environment:
 
 //Global bool variables used by our filter driver and set from the userland 
 //application. 
-//FIX_HCI_L2CAP_HEADERS is set to apply a fix to usb packet headers when 
+//FIX_HCI_L2CAP_HEADERS selects when to apply a fix to usb packet headers when 
 //the system has designated that the bluetooth adapter le version can't 
 //handle more than 23 att bytes of data. (This turns out to not be the 
 //case and the raw data is full length from BTHUSB lower module)
-BOOLEAN FIX_HCI_L2CAP_HEADERS = FALSE;
+//By default (FIX_HCI_L2CAP_HEADERS_MODE_AUTO) we decide per adapter and 
+//connection from what we snoop of the adapter's le limits and the att mtu 
+//exchange, the userland application can still force it on or off.
+UCHAR FIX_HCI_L2CAP_HEADERS = FIX_HCI_L2CAP_HEADERS_MODE_AUTO;
 BOOLEAN DEBUG_DATA_IN = FALSE;
 BOOLEAN DEBUG_DATA_OUT = FALSE;
 
+//Trace predicate narrowing down what DEBUG_DATA_IN/OUT dump, uploaded from
+//the userland application. -1 while there is none and everything is dumped,
+//otherwise the slot holding the program (see FilterTraceWanted).
+FILTER_TRACE_SLOT FilterTraceSlots[2];
+volatile LONG FilterTraceActive = -1;
+
+//Button and touch events decoded from the hid reports and voice frames for
+//IOCTL_GET_EVENTS, off until the userland application configures them. The
+//lock serializes the queues and the coalescing state of every adapter.
+KSPIN_LOCK FilterEventLock;
+EVENT_QUEUE FilterEventQueue;
+FILTER_EVENT_CONFIG FilterEventConfig;
+
+//How the trackpad positions are smoothed before they are coalesced, see
+//smooth.h. Serialized by FilterEventLock like the coalescing state.
+FILTER_SMOOTH_CONFIG FilterSmoothConfig;
+
+//Whether the filter activates remotes itself and which, applied to every
+//adapter. Remotes learned from the userland application stay per adapter.
+FILTER_ACTIVATE_CONFIG FilterActivateConfig;
+
+//How the stall watchdog of every adapter runs, see watchdog.h.
+FILTER_WATCHDOG_CONFIG FilterWatchdogConfig;
+
+//How the voice sessions of every adapter are counted, see voicestats.h.
+FILTER_VOICE_CONFIG FilterVoiceConfig;
+
 //Code for Dump copied from the internet, cant recall who to credit???
 void Dump(int Direction, unsigned char * Bfr, size_t Count)
 {
@@ -109,6 +139,7 @@ WDFWAITLOCK     FilterDeviceCollectionLock;
 #ifdef ALLOC_PRAGMA
 #pragma alloc_text (INIT, DriverEntry)
 #pragma alloc_text (PAGE, FilterEvtDeviceAdd)
+#pragma alloc_text (PAGE, FilterSelectProfile)
 #pragma alloc_text (PAGE, FilterEvtDeviceContextCleanup)
 #endif
 
@@ -128,6 +159,7 @@ WDFDEVICE       ControlDevice = NULL;
 #pragma alloc_text (PAGE, FilterCreateControlDevice)
 #pragma alloc_text (PAGE, FilterDeleteControlDevice)
 #pragma alloc_text (PAGE, FilterEvtIoInternalDeviceControl)
+#pragma alloc_text (PAGE, FilterSetTraceFilter)
 #endif
 
 NTSTATUS
@@ -217,6 +249,22 @@ Return Value:
         KdPrint( ("WdfWaitLockCreate failed with status 0x%x\n", status));
         return status;
     }
+
+    KeInitializeSpinLock(&FilterEventLock);
+    EventQueueInit(&FilterEventQueue);
+
+    FilterActivateConfig.Flags = FILTER_ACTIVATE_DEFAULT;
+
+    FilterWatchdogConfig.GapMs = FILTER_WATCHDOG_DEFAULT_GAP_MS;
+    FilterWatchdogConfig.Actions = FILTER_WATCHDOG_ACTION_DEFAULT;
+
+    FilterVoiceConfig.SequenceOffset = FILTER_VOICE_NO_SEQUENCE;
+    FilterVoiceConfig.GapMs = FILTER_VOICE_DEFAULT_GAP_MS;
+
+    FilterSmoothConfig.MinCutoffMilliHz = FILTER_SMOOTH_DEFAULT_MIN_CUTOFF;
+    FilterSmoothConfig.Beta = FILTER_SMOOTH_DEFAULT_BETA;
+    FilterSmoothConfig.DerivativeCutoffMilliHz = FILTER_SMOOTH_DEFAULT_D_CUTOFF;
+    FilterSmoothConfig.ReportUs = FILTER_SMOOTH_DEFAULT_REPORT_US;
     
     return status;
 }
@@ -253,14 +301,24 @@ Return Value:
 	KdPrint(("SiriRemote Lower Filter Driver - FilterEvtDeviceAdd.\n"));
 
     WDF_OBJECT_ATTRIBUTES   deviceAttributes;
+    WDF_OBJECT_ATTRIBUTES   requestAttributes;
     PFILTER_EXTENSION       filterExt;
     NTSTATUS                status;
     WDFDEVICE               device;
     WDF_IO_QUEUE_CONFIG     ioQueueConfig;
+    WDF_TIMER_CONFIG        timerConfig;
+    WDF_OBJECT_ATTRIBUTES   timerAttributes;
+    PCCONTROLLER_PROFILE    profile;
+    ULONG                   i;
 
     PAGED_CODE ();
 
     UNREFERENCED_PARAMETER(Driver);
+
+    //
+    // The hardware ID can only be queried before the device is created.
+    //
+    profile = FilterSelectProfile(DeviceInit);
     
     //
     // Tell the framework that you are filter driver. Framework
@@ -269,6 +327,13 @@ Return Value:
     //
     WdfFdoInitSetFilter(DeviceInit);
 
+    //
+    // Requests remember the length of their URB, see FilterActivateResponse,
+    // and ACL packets what they were counted against, see FilterHoldAclPacket.
+    //
+    WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&requestAttributes, FILTER_REQUEST_CONTEXT);
+    WdfDeviceInitSetRequestAttributes(DeviceInit, &requestAttributes);
+
     //
     // Specify the size of device extension where we track per device
     // context.
@@ -297,6 +362,60 @@ Return Value:
 
     filterExt = FilterGetData(device);
 
+    filterExt->WdfDevice = device;
+    filterExt->Profile = profile;
+
+    KeInitializeSpinLock(&filterExt->LinkStateLock);
+    HciInitLinkState(&filterExt->LinkState);
+
+    KeInitializeSpinLock(&filterExt->CaptureLock);
+    CaptureInit(&filterExt->Capture);
+
+    CoalesceInit(&filterExt->Coalesce);
+    CoalesceConfigure(&filterExt->Coalesce, FilterEventConfig.CoalesceMs);
+    CoalesceSmooth(&filterExt->Coalesce, &FilterSmoothConfig);
+
+    KeInitializeSpinLock(&filterExt->ActivateLock);
+    ActivateInit(&filterExt->Activate);
+    ActivateConfigure(&filterExt->Activate, &FilterActivateConfig);
+
+    KeInitializeSpinLock(&filterExt->AclFlowLock);
+    AclFlowInit(&filterExt->AclFlow);
+
+    KeInitializeSpinLock(&filterExt->AttTrackLock);
+    AttTrackInit(&filterExt->AttTrack);
+
+    KeInitializeSpinLock(&filterExt->WatchdogLock);
+    WatchdogInit(&filterExt->Watchdog);
+    WatchdogConfigure(&filterExt->Watchdog, &FilterWatchdogConfig);
+
+    KeInitializeSpinLock(&filterExt->VoiceStatsLock);
+    VoiceStatsInit(&filterExt->VoiceStats);
+    VoiceStatsConfigure(&filterExt->VoiceStats, &FilterVoiceConfig);
+
+    KeInitializeSpinLock(&filterExt->ReportMapLock);
+    ReportSnoopInit(&filterExt->ReportSnoop);
+
+    for (i = 0; i < HCI_MAX_CONNECTIONS; i++) {
+        filterExt->Layouts[i].Handle = HCI_INVALID_HANDLE;
+    }
+
+    WDF_TIMER_CONFIG_INIT(&timerConfig, FilterEvtWatchdogTimer);
+    timerConfig.AutomaticSerialization = FALSE;
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&timerAttributes);
+    timerAttributes.ParentObject = device;
+
+    status = WdfTimerCreate(&timerConfig, &timerAttributes, &filterExt->WatchdogTimer);
+    if (!NT_SUCCESS(status)) {
+        KdPrint( ("WdfTimerCreate failed 0x%x\n", status));
+        return status;
+    }
+
+    if (profile->PresumedLmpVersion != 0) {
+        HciPresumeLmpVersion(&filterExt->LinkState, profile->PresumedLmpVersion);
+    }
+
     //
     // Add this device to the FilterDevice collection.
     //
@@ -352,9 +471,69 @@ Return Value:
         return status;
     }
 
+    //
+    // ACL packets waiting for a buffer of the controller, see
+    // FilterHoldAclPacket.
+    //
+    WDF_IO_QUEUE_CONFIG_INIT(&ioQueueConfig, WdfIoQueueDispatchManual);
+
+    status = WdfIoQueueCreate(device,
+                            &ioQueueConfig,
+                            WDF_NO_OBJECT_ATTRIBUTES,
+                            &filterExt->HoldQueue
+                            );
+    if (!NT_SUCCESS(status)) {
+        KdPrint( ("WdfIoQueueCreate failed 0x%x\n", status));
+        return status;
+    }
+
     return status;
 }
 
+PCCONTROLLER_PROFILE
+FilterSelectProfile(
+    IN PWDFDEVICE_INIT DeviceInit
+    )
+/*++
+Routine Description:
+
+    Picks the controller profile from the adapter's hardware ID. Adapters
+    we can't identify get the generic profile rather than no filtering.
+
+--*/
+{
+    WCHAR                   hardwareId[128];
+    ULONG                   resultLength = 0;
+    USHORT                  vendorId = 0;
+    USHORT                  productId = 0;
+    PCCONTROLLER_PROFILE    profile;
+    NTSTATUS                status;
+
+    PAGED_CODE();
+
+    RtlZeroMemory(hardwareId, sizeof(hardwareId));
+
+    status = WdfFdoInitQueryProperty(DeviceInit,
+                                     DevicePropertyHardwareID,
+                                     sizeof(hardwareId) - sizeof(WCHAR),
+                                     hardwareId,
+                                     &resultLength);
+    if (!NT_SUCCESS(status)) {
+        KdPrint( ("WdfFdoInitQueryProperty failed with status code 0x%x\n", status));
+    } else if (!ProfileParseHardwareId((const USHORT *)hardwareId,
+                                       resultLength / sizeof(WCHAR),
+                                       &vendorId,
+                                       &productId)) {
+        KdPrint(("No VID/PID in hardware ID %ws\n", hardwareId));
+    }
+
+    profile = ProfileSelect(vendorId, productId);
+
+    KdPrint(("Adapter %04x:%04x, using the %s profile\n", vendorId, productId, profile->Name));
+
+    return profile;
+}
+
 NTSTATUS
 FilterCreateControlDevice(
 	WDFDEVICE Device
@@ -389,6 +568,8 @@ Return Value:
 	WDFDEVICE                   controlDevice = NULL;
 	WDF_OBJECT_ATTRIBUTES       controlAttributes;
 	WDF_IO_QUEUE_CONFIG         ioQueueConfig;
+	WDF_FILEOBJECT_CONFIG       fileConfig;
+	WDF_OBJECT_ATTRIBUTES       fileAttributes;
 	BOOLEAN                     bCreate = FALSE;
 	NTSTATUS                    status;
 	WDFQUEUE                    queue;
@@ -440,6 +621,20 @@ Return Value:
 	//
 	WdfDeviceInitSetExclusive(pInit, FALSE);
 
+	//
+	// Every handle can subscribe to the events on its own, track them
+	// through a context on the file object.
+	//
+	WDF_FILEOBJECT_CONFIG_INIT(&fileConfig,
+		FilterEvtDeviceFileCreate,
+		WDF_NO_EVENT_CALLBACK,
+		FilterEvtFileCleanup);
+
+	WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(&fileAttributes,
+		CONTROL_FILE_CONTEXT);
+
+	WdfDeviceInitSetFileObjectConfig(pInit, &fileConfig, &fileAttributes);
+
 	status = WdfDeviceInitAssignName(pInit, &ntDeviceName);
 
 	if (!NT_SUCCESS(status)) {
@@ -548,6 +743,8 @@ Return Value:
 
     KdPrint(("SiriRemote Lower Filter Driver - FilterEvtDeviceContextCleanup\n"));
 
+    WdfTimerStop(FilterGetData(Device)->WatchdogTimer, TRUE);
+
     WdfWaitLockAcquire(FilterDeviceCollectionLock, NULL);
 
     count = WdfCollectionGetCount(FilterDeviceCollection);
@@ -603,6 +800,52 @@ Return Value:
     }
 }
 
+VOID
+FilterEvtDeviceFileCreate(
+    IN WDFDEVICE     Device,
+    IN WDFREQUEST    Request,
+    IN WDFFILEOBJECT FileObject
+    )
+/*++
+
+Routine Description:
+
+    A handle is opened on the control device. It starts without a
+    subscription.
+
+--*/
+{
+    UNREFERENCED_PARAMETER(Device);
+
+    ControlFileGetData(FileObject)->Subscriber = EVENT_QUEUE_NO_SUBSCRIBER;
+
+    WdfRequestComplete(Request, STATUS_SUCCESS);
+}
+
+VOID
+FilterEvtFileCleanup(
+    IN WDFFILEOBJECT FileObject
+    )
+/*++
+
+Routine Description:
+
+    The last handle to a file object is closed, its subscription ends.
+
+--*/
+{
+    PCONTROL_FILE_CONTEXT   fileContext = ControlFileGetData(FileObject);
+    KIRQL                   irql;
+
+    if (fileContext->Subscriber != EVENT_QUEUE_NO_SUBSCRIBER) {
+        KeAcquireSpinLock(&FilterEventLock, &irql);
+        EventQueueUnsubscribe(&FilterEventQueue, fileContext->Subscriber);
+        KeReleaseSpinLock(&FilterEventLock, irql);
+
+        fileContext->Subscriber = EVENT_QUEUE_NO_SUBSCRIBER;
+    }
+}
+
 VOID
 FilterEvtIoDeviceControl(
     IN WDFQUEUE      Queue,
@@ -638,23 +881,35 @@ Return Value:
 
 --*/
 {
-#define IOCTL_FIX_HCI_L2CAP_HEADERS_ON CTL_CODE(FILE_DEVICE_UNKNOWN, 0X11, METHOD_BUFFERED, FILE_READ_DATA)
-#define IOCTL_FIX_HCI_L2CAP_HEADERS_OFF CTL_CODE(FILE_DEVICE_UNKNOWN, 0X10, METHOD_BUFFERED, FILE_READ_DATA)
-#define IOCTL_DEBUG_DATA_IN_ON CTL_CODE(FILE_DEVICE_UNKNOWN, 0x21, METHOD_BUFFERED, FILE_READ_DATA)
-#define IOCTL_DEBUG_DATA_IN_OFF CTL_CODE(FILE_DEVICE_UNKNOWN, 0x20, METHOD_BUFFERED, FILE_READ_DATA)
-#define IOCTL_DEBUG_DATA_OUT_ON CTL_CODE(FILE_DEVICE_UNKNOWN, 0x31, METHOD_BUFFERED, FILE_READ_DATA)
-#define IOCTL_DEBUG_DATA_OUT_OFF CTL_CODE(FILE_DEVICE_UNKNOWN, 0x30, METHOD_BUFFERED, FILE_READ_DATA)
-
-    //ULONG					i;
-    //ULONG					noItems;
-    //WDFDEVICE				device;
-	//WDFMEMORY				outputMemory;
-    //PFILTER_EXTENSION		filterExt;
+    ULONG					i;
+    ULONG					noItems;
+    WDFDEVICE				device;
+    PFILTER_EXTENSION		filterExt;
+    PFILTER_ADAPTER_INFO	adapterInfo;
+    PFILTER_ATT_STATS		attStats;
+    PFILTER_CLOCK			filterClock;
+    LARGE_INTEGER			frequency;
+    PTRACE_FILTER_PROGRAM	traceProgram;
+    size_t					traceProgramLength;
+    PFILTER_CAPTURE_CONFIG	captureConfig;
+    PFILTER_CAPTURE_HEADER	captureHeader;
+    PULONG					tracepointArg;
+    PTRACEPOINT_BUFFER_HEADER	tracepointHeader;
+    ULONG					firstSequence;
+    PFILTER_EVENT_CONFIG	eventConfig;
+    PFILTER_SMOOTH_CONFIG	smoothConfig;
+    PFILTER_EVENT_BUFFER_HEADER	eventHeader;
+    PFILTER_EVENT_SUBSCRIPTION	eventSubscription;
+    PFILTER_ACTIVATE_CONFIG	activateConfig;
+    PFILTER_WATCHDOG_CONFIG	watchdogConfig;
+    PFILTER_VOICE_CONFIG	voiceConfig;
+    PFILTER_VOICE_STATS		voiceStats;
+    PFILTER_REPORT_MAPS		reportMaps;
+    PFILTER_REPORT_MAP		reportMap;
     NTSTATUS				status = STATUS_SUCCESS;
 	size_t					bytesTransferred = 0;
 
     UNREFERENCED_PARAMETER(Queue);
-    UNREFERENCED_PARAMETER(OutputBufferLength);
     UNREFERENCED_PARAMETER(InputBufferLength);
 
     PAGED_CODE();
@@ -665,10 +920,13 @@ Return Value:
 
 	switch (IoControlCode) {
 	case IOCTL_FIX_HCI_L2CAP_HEADERS_ON:
-		FIX_HCI_L2CAP_HEADERS = TRUE;
+		FIX_HCI_L2CAP_HEADERS = FIX_HCI_L2CAP_HEADERS_MODE_ON;
 		break;
 	case IOCTL_FIX_HCI_L2CAP_HEADERS_OFF:
-		FIX_HCI_L2CAP_HEADERS = FALSE;
+		FIX_HCI_L2CAP_HEADERS = FIX_HCI_L2CAP_HEADERS_MODE_OFF;
+		break;
+	case IOCTL_FIX_HCI_L2CAP_HEADERS_AUTO:
+		FIX_HCI_L2CAP_HEADERS = FIX_HCI_L2CAP_HEADERS_MODE_AUTO;
 		break;
 	case IOCTL_DEBUG_DATA_IN_ON:
 		DEBUG_DATA_IN = TRUE;
@@ -682,6 +940,335 @@ Return Value:
 	case IOCTL_DEBUG_DATA_OUT_OFF:
 		DEBUG_DATA_OUT = FALSE;
 		break;
+	case IOCTL_GET_ADAPTER_INFO:
+		status = WdfRequestRetrieveOutputBuffer(Request,
+			sizeof(FILTER_ADAPTER_INFO),
+			(PVOID*)&adapterInfo,
+			NULL);
+		if (!NT_SUCCESS(status)) {
+			break;
+		}
+
+		WdfWaitLockAcquire(FilterDeviceCollectionLock, NULL);
+
+		noItems = WdfCollectionGetCount(FilterDeviceCollection);
+
+		for (i = 0; i < noItems &&
+			bytesTransferred + sizeof(FILTER_ADAPTER_INFO) <= OutputBufferLength; i++) {
+			device = WdfCollectionGetItem(FilterDeviceCollection, i);
+
+			filterExt = FilterGetData(device);
+
+			FilterGetAdapterInfo(filterExt, &adapterInfo[i]);
+
+			bytesTransferred += sizeof(FILTER_ADAPTER_INFO);
+		}
+
+		WdfWaitLockRelease(FilterDeviceCollectionLock);
+		break;
+	case IOCTL_SET_TRACE_FILTER:
+		status = WdfRequestRetrieveInputBuffer(Request,
+			FIELD_OFFSET(TRACE_FILTER_PROGRAM, Insns),
+			(PVOID*)&traceProgram,
+			&traceProgramLength);
+		if (!NT_SUCCESS(status)) {
+			break;
+		}
+
+		status = FilterSetTraceFilter(traceProgram, (ULONG)traceProgramLength);
+		break;
+	case IOCTL_SET_CAPTURE_CONFIG:
+		status = WdfRequestRetrieveInputBuffer(Request,
+			sizeof(FILTER_CAPTURE_CONFIG),
+			(PVOID*)&captureConfig,
+			NULL);
+		if (!NT_SUCCESS(status)) {
+			break;
+		}
+
+		status = FilterSetCaptureConfig(captureConfig);
+		break;
+	case IOCTL_GET_CAPTURE:
+		status = WdfRequestRetrieveOutputBuffer(Request,
+			sizeof(FILTER_CAPTURE_HEADER),
+			(PVOID*)&captureHeader,
+			NULL);
+		if (!NT_SUCCESS(status)) {
+			break;
+		}
+
+		RtlZeroMemory(captureHeader, sizeof(FILTER_CAPTURE_HEADER));
+		captureHeader->TriggerHandle = HCI_INVALID_HANDLE;
+		bytesTransferred = sizeof(FILTER_CAPTURE_HEADER);
+
+		WdfWaitLockAcquire(FilterDeviceCollectionLock, NULL);
+
+		noItems = WdfCollectionGetCount(FilterDeviceCollection);
+
+		//
+		// The first frozen window wins, the others stay frozen for the
+		// next request. Exporting a window re-arms it, so only when none
+		// is frozen is the first adapter's live window exported.
+		//
+		for (i = 0; i < noItems; i++) {
+			filterExt = FilterGetData(WdfCollectionGetItem(FilterDeviceCollection, i));
+
+			if (filterExt->Capture.State == FILTER_CAPTURE_FROZEN) {
+				break;
+			}
+		}
+
+		if (i == noItems) {
+			i = 0;
+		}
+
+		if (i < noItems) {
+			filterExt = FilterGetData(WdfCollectionGetItem(FilterDeviceCollection, i));
+
+			FilterGetCapture(filterExt,
+				captureHeader,
+				(PFILTER_CAPTURE_RECORD)(captureHeader + 1),
+				(ULONG)((OutputBufferLength - sizeof(FILTER_CAPTURE_HEADER)) / sizeof(FILTER_CAPTURE_RECORD)));
+
+			captureHeader->Adapter = i;
+			bytesTransferred = sizeof(FILTER_CAPTURE_HEADER) +
+				captureHeader->RecordCount * sizeof(FILTER_CAPTURE_RECORD);
+		}
+
+		WdfWaitLockRelease(FilterDeviceCollectionLock);
+		break;
+	case IOCTL_SET_TRACEPOINT_KEYWORDS:
+		status = WdfRequestRetrieveInputBuffer(Request,
+			sizeof(ULONG),
+			(PVOID*)&tracepointArg,
+			NULL);
+		if (!NT_SUCCESS(status)) {
+			break;
+		}
+
+		TracepointKeywords = *tracepointArg;
+		break;
+	case IOCTL_GET_TRACEPOINTS:
+		status = WdfRequestRetrieveInputBuffer(Request,
+			sizeof(ULONG),
+			(PVOID*)&tracepointArg,
+			NULL);
+		if (!NT_SUCCESS(status)) {
+			break;
+		}
+
+		status = WdfRequestRetrieveOutputBuffer(Request,
+			sizeof(TRACEPOINT_BUFFER_HEADER),
+			(PVOID*)&tracepointHeader,
+			NULL);
+		if (!NT_SUCCESS(status)) {
+			break;
+		}
+
+		//
+		// Input and output share the system buffer, read the sequence first.
+		//
+		firstSequence = *tracepointArg;
+
+		tracepointHeader->Keywords = TracepointKeywords;
+		tracepointHeader->RecordCount = TracepointRead(firstSequence,
+			(PTRACEPOINT_RECORD)(tracepointHeader + 1),
+			(ULONG)((OutputBufferLength - sizeof(TRACEPOINT_BUFFER_HEADER)) / sizeof(TRACEPOINT_RECORD)),
+			&tracepointHeader->NextSequence,
+			&tracepointHeader->Lost);
+
+		bytesTransferred = sizeof(TRACEPOINT_BUFFER_HEADER) +
+			tracepointHeader->RecordCount * sizeof(TRACEPOINT_RECORD);
+		break;
+	case IOCTL_SET_EVENT_CONFIG:
+		status = WdfRequestRetrieveInputBuffer(Request,
+			sizeof(FILTER_EVENT_CONFIG),
+			(PVOID*)&eventConfig,
+			NULL);
+		if (!NT_SUCCESS(status)) {
+			break;
+		}
+
+		status = FilterSetEventConfig(eventConfig);
+		break;
+	case IOCTL_GET_EVENTS:
+		status = WdfRequestRetrieveOutputBuffer(Request,
+			sizeof(FILTER_EVENT_BUFFER_HEADER),
+			(PVOID*)&eventHeader,
+			NULL);
+		if (!NT_SUCCESS(status)) {
+			break;
+		}
+
+		if (ControlFileGetData(WdfRequestGetFileObject(Request))->Subscriber == EVENT_QUEUE_NO_SUBSCRIBER) {
+			status = STATUS_INVALID_DEVICE_STATE;
+			break;
+		}
+
+		bytesTransferred = FilterGetEvents(ControlFileGetData(WdfRequestGetFileObject(Request)),
+			eventHeader,
+			(ULONG)OutputBufferLength);
+		break;
+	case IOCTL_SUBSCRIBE_EVENTS:
+		status = WdfRequestRetrieveInputBuffer(Request,
+			sizeof(FILTER_EVENT_SUBSCRIPTION),
+			(PVOID*)&eventSubscription,
+			NULL);
+		if (!NT_SUCCESS(status)) {
+			break;
+		}
+
+		status = FilterSubscribeEvents(ControlFileGetData(WdfRequestGetFileObject(Request)),
+			eventSubscription);
+		break;
+	case IOCTL_GET_CLOCK:
+		status = WdfRequestRetrieveOutputBuffer(Request,
+			sizeof(FILTER_CLOCK),
+			(PVOID*)&filterClock,
+			NULL);
+		if (!NT_SUCCESS(status)) {
+			break;
+		}
+
+		filterClock->PerformanceCounter = KeQueryPerformanceCounter(&frequency).QuadPart;
+		filterClock->InterruptTime = (LONGLONG)KeQueryInterruptTime();
+		filterClock->Frequency = frequency.QuadPart;
+
+		bytesTransferred = sizeof(FILTER_CLOCK);
+		break;
+	case IOCTL_SET_SMOOTH_CONFIG:
+		status = WdfRequestRetrieveInputBuffer(Request,
+			sizeof(FILTER_SMOOTH_CONFIG),
+			(PVOID*)&smoothConfig,
+			NULL);
+		if (!NT_SUCCESS(status)) {
+			break;
+		}
+
+		status = FilterSetSmoothConfig(smoothConfig);
+		break;
+	case IOCTL_SET_ACTIVATE_CONFIG:
+		status = WdfRequestRetrieveInputBuffer(Request,
+			sizeof(FILTER_ACTIVATE_CONFIG),
+			(PVOID*)&activateConfig,
+			NULL);
+		if (!NT_SUCCESS(status)) {
+			break;
+		}
+
+		status = FilterSetActivateConfig(activateConfig);
+		break;
+	case IOCTL_GET_ATT_STATS:
+		status = WdfRequestRetrieveOutputBuffer(Request,
+			sizeof(FILTER_ATT_STATS),
+			(PVOID*)&attStats,
+			NULL);
+		if (!NT_SUCCESS(status)) {
+			break;
+		}
+
+		WdfWaitLockAcquire(FilterDeviceCollectionLock, NULL);
+
+		noItems = WdfCollectionGetCount(FilterDeviceCollection);
+
+		for (i = 0; i < noItems &&
+			bytesTransferred + sizeof(FILTER_ATT_STATS) <= OutputBufferLength; i++) {
+			device = WdfCollectionGetItem(FilterDeviceCollection, i);
+
+			filterExt = FilterGetData(device);
+
+			FilterGetAttStats(filterExt, &attStats[i]);
+
+			bytesTransferred += sizeof(FILTER_ATT_STATS);
+		}
+
+		WdfWaitLockRelease(FilterDeviceCollectionLock);
+		break;
+	case IOCTL_SET_WATCHDOG_CONFIG:
+		status = WdfRequestRetrieveInputBuffer(Request,
+			sizeof(FILTER_WATCHDOG_CONFIG),
+			(PVOID*)&watchdogConfig,
+			NULL);
+		if (!NT_SUCCESS(status)) {
+			break;
+		}
+
+		status = FilterSetWatchdogConfig(watchdogConfig);
+		break;
+	case IOCTL_SET_VOICE_CONFIG:
+		status = WdfRequestRetrieveInputBuffer(Request,
+			sizeof(FILTER_VOICE_CONFIG),
+			(PVOID*)&voiceConfig,
+			NULL);
+		if (!NT_SUCCESS(status)) {
+			break;
+		}
+
+		status = FilterSetVoiceConfig(voiceConfig);
+		break;
+	case IOCTL_GET_VOICE_STATS:
+		status = WdfRequestRetrieveOutputBuffer(Request,
+			sizeof(FILTER_VOICE_STATS),
+			(PVOID*)&voiceStats,
+			NULL);
+		if (!NT_SUCCESS(status)) {
+			break;
+		}
+
+		WdfWaitLockAcquire(FilterDeviceCollectionLock, NULL);
+
+		noItems = WdfCollectionGetCount(FilterDeviceCollection);
+
+		for (i = 0; i < noItems &&
+			bytesTransferred + sizeof(FILTER_VOICE_STATS) <= OutputBufferLength; i++) {
+			device = WdfCollectionGetItem(FilterDeviceCollection, i);
+
+			filterExt = FilterGetData(device);
+
+			FilterGetVoiceStats(filterExt, &voiceStats[i]);
+
+			bytesTransferred += sizeof(FILTER_VOICE_STATS);
+		}
+
+		WdfWaitLockRelease(FilterDeviceCollectionLock);
+		break;
+	case IOCTL_GET_REPORT_MAPS:
+		status = WdfRequestRetrieveOutputBuffer(Request,
+			sizeof(FILTER_REPORT_MAPS),
+			(PVOID*)&reportMaps,
+			NULL);
+		if (!NT_SUCCESS(status)) {
+			break;
+		}
+
+		WdfWaitLockAcquire(FilterDeviceCollectionLock, NULL);
+
+		noItems = WdfCollectionGetCount(FilterDeviceCollection);
+
+		for (i = 0; i < noItems &&
+			bytesTransferred + sizeof(FILTER_REPORT_MAPS) <= OutputBufferLength; i++) {
+			device = WdfCollectionGetItem(FilterDeviceCollection, i);
+
+			filterExt = FilterGetData(device);
+
+			FilterGetReportMaps(filterExt, &reportMaps[i]);
+
+			bytesTransferred += sizeof(FILTER_REPORT_MAPS);
+		}
+
+		WdfWaitLockRelease(FilterDeviceCollectionLock);
+		break;
+	case IOCTL_SET_REPORT_MAP:
+		status = WdfRequestRetrieveInputBuffer(Request,
+			sizeof(FILTER_REPORT_MAP),
+			(PVOID*)&reportMap,
+			NULL);
+		if (!NT_SUCCESS(status)) {
+			break;
+		}
+
+		status = FilterSetReportMap(reportMap);
+		break;
 	default:
 		status = STATUS_NOT_IMPLEMENTED; //Or STATUS_INVALID_DEVICE_REQUEST;
 		break;
@@ -723,11 +1310,14 @@ FilterEvtIoInternalDeviceControl(
 	PFILTER_EXTENSION               filterExt;
 	NTSTATUS                        status = STATUS_SUCCESS;
 	WDFDEVICE                       device;
+	PUCHAR                          aclPacket = NULL;
+	ULONG                           aclLength = 0;
 
 	UNREFERENCED_PARAMETER(OutputBufferLength);
 	UNREFERENCED_PARAMETER(InputBufferLength);
 
-	KdPrint(("SiriRemote Lower Filter Driver - FilterEvtIoInternalDeviceControl.\n"));
+	TRACEPOINT(TRACEPOINT_LEVEL_VERBOSE, TRACEPOINT_KEYWORD_URB, TRACEPOINT_INTERNAL_IOCTL,
+		IoControlCode, 0, 0, 0);
 
 	device = WdfIoQueueGetDevice(Queue);
 
@@ -743,21 +1333,18 @@ FilterEvtIoInternalDeviceControl(
 
 			pUrb = (PURB)IoGetCurrentIrpStackLocation(WdfRequestWdmGetIrp(Request))->Parameters.Others.Argument1;
 
-			KdPrint(("URB_FUNCTION: %x\n", pUrb->UrbHeader.Function));
+			TRACEPOINT(TRACEPOINT_LEVEL_VERBOSE, TRACEPOINT_KEYWORD_URB, TRACEPOINT_URB_SUBMIT,
+				TRACEPOINT_PTR(pUrb),
+				pUrb->UrbHeader.Function,
+				pUrb->UrbHeader.Function == URB_FUNCTION_BULK_OR_INTERRUPT_TRANSFER ? pUrb->UrbBulkOrInterruptTransfer.TransferFlags : 0,
+				pUrb->UrbHeader.Function == URB_FUNCTION_BULK_OR_INTERRUPT_TRANSFER ? pUrb->UrbBulkOrInterruptTransfer.TransferBufferLength : 0);
 
 			switch (pUrb->UrbHeader.Function)
 			{
 			case URB_FUNCTION_BULK_OR_INTERRUPT_TRANSFER: {
 
-				KdPrint(("URB_FUNCTION_BULK_OR_INTERRUPT_TRANSFER\n"));
-
-				KdPrint(("Urb @ 0x%08x (header length: %d, function: %04x)!\n", pUrb, pUrb->UrbHeader.Length, pUrb->UrbHeader.Function));
-
 				struct _URB_BULK_OR_INTERRUPT_TRANSFER *pBulkOrInterruptTransfer = (struct _URB_BULK_OR_INTERRUPT_TRANSFER *) pUrb;
 
-				KdPrint(("TransferFlags: %lu\n", pBulkOrInterruptTransfer->TransferFlags));
-				KdPrint(("TransferBufferLength: %lu\n", pBulkOrInterruptTransfer->TransferBufferLength));
-
 				BOOLEAN bReadFromDevice = (BOOLEAN)(pBulkOrInterruptTransfer->TransferFlags & USBD_TRANSFER_DIRECTION_IN);
 
 				//Direction Out
@@ -770,12 +1357,10 @@ FilterEvtIoInternalDeviceControl(
 
 					if ((PUCHAR)pBulkOrInterruptTransfer->TransferBuffer)
 					{
-						KdPrint(("TransferBuffer has flat specified.\n"));
-
-						if (pBulkOrInterruptTransfer->TransferBufferMDL)
-						{
-							KdPrint(("??? weird transfer buffer, both MDL and flat specified. Ignoring MDL\n"));
-						}
+						TRACEPOINT(TRACEPOINT_LEVEL_VERBOSE, TRACEPOINT_KEYWORD_URB, TRACEPOINT_TRANSFER_BUFFER,
+							TRACEPOINT_PTR(pUrb),
+							pBulkOrInterruptTransfer->TransferBufferMDL ? TRACEPOINT_BUFFER_FLAT_AND_MDL : TRACEPOINT_BUFFER_FLAT,
+							0, 0);
 
 						/*
 						if (pBulkOrInterruptTransfer->TransferBufferLength == 15)
@@ -811,157 +1396,2260 @@ FilterEvtIoInternalDeviceControl(
 						}
 						*/
 
-						if (pBulkOrInterruptTransfer->TransferBufferLength == 12)
+						unsigned char * Bfr = (PUCHAR)pBulkOrInterruptTransfer->TransferBuffer;
+
+						//intercept a write with no response request and replace with our write
+						//---HCI----- ---L2CAP--- ----ATT----
+						//80 00 08 00 04 00 04 00 52 28 00 AF
+						if (filterExt->Profile->MatchMagicWrite(Bfr, pBulkOrInterruptTransfer->TransferBufferLength))
+						{
+							TRACEPOINT(TRACEPOINT_LEVEL_INFO, TRACEPOINT_KEYWORD_REWRITE, TRACEPOINT_ATT_REWRITE,
+								HCI_ACL_HANDLE(Bfr), Bfr[8], Bfr[9], SIRI_ATT_HID_CONTROL);
+							Bfr[8] = ATT_OP_WRITE_REQ; //change to write request from 0x52 (write without response)
+							Bfr[9] = SIRI_ATT_HID_CONTROL; //change att handle from 0x28 to 0x1d
+
+							FilterActivateByHost(filterExt, HCI_ACL_HANDLE(Bfr));
+						}
+
+						//intercept a write with response request and replace with our write
+						//---HCI----- ---L2CAP--- -----ATT------
+						//80 00 09 00 05 00 04 00 12 29 00 01 00
+						if (filterExt->Profile->MatchNotifyEnableWrite(Bfr, pBulkOrInterruptTransfer->TransferBufferLength))
+						{
+							TRACEPOINT(TRACEPOINT_LEVEL_INFO, TRACEPOINT_KEYWORD_REWRITE, TRACEPOINT_ATT_REWRITE,
+								HCI_ACL_HANDLE(Bfr), Bfr[8], Bfr[9], SIRI_ATT_HID_REPORT_CCCD);
+							Bfr[9] = SIRI_ATT_HID_REPORT_CCCD; //change att handle from 0x29 to 0x24
+						}
+
+
+						/*
+						if (pBulkOrInterruptTransfer->TransferBufferLength == 11)
 						{
-							//intercept a write with no response request and replace with our write
-							//---HCI----- ---L2CAP--- ----ATT----
-							//80 00 08 00 04 00 04 00 52 28 00 AF
+							//intercept a mtu request
+							//---HCI----- ---L2CAP--- --ATT---
+							//80 00 07 00 03 00 04 00 02 0d 02
 
 							unsigned char * Bfr = (PUCHAR)pBulkOrInterruptTransfer->TransferBuffer;
 
 							if (Bfr[0] == 0x80 &&
 								Bfr[1] == 0x00 &&
-								Bfr[2] == 0x08 &&
+								Bfr[2] == 0x07 &&
 								Bfr[3] == 0x00 &&
-								Bfr[4] == 0x04 &&
+								Bfr[4] == 0x03 &&
 								Bfr[5] == 0x00 &&
 								Bfr[6] == 0x04 &&
 								Bfr[7] == 0x00 &&
-								Bfr[8] == 0x52 &&
-								Bfr[9] == 0x28 &&
-								Bfr[10] == 0x00 &&
-								Bfr[11] == 0xAF)
-							{
-								KdPrint(("Writing 0xAF (magic value) to att handle 0x1d (hid att handle)\n"));
-								Bfr[8] = 0x12; //change to write request from 0x52 (write without response)
-								Bfr[9] = 0x1d; //change att handle from 0x28 to 0x1d
+								Bfr[8] == 0x02 &&
+								Bfr[9] == 0x0d &&
+								Bfr[10] == 0x02)
+							{
+								KdPrint(("Changing mtu request from 525 0x20D to 104 0x68\n"));
+								Bfr[9] = 0x68;
+								Bfr[10] = 0x00;
 							}
 						}
+						*/
+
+						FilterSnoopAclPacket(filterExt, HCI_DIRECTION_OUT, (PUCHAR)pBulkOrInterruptTransfer->TransferBuffer, pBulkOrInterruptTransfer->TransferBufferLength);
+
+						aclPacket = Bfr;
+
+						FilterAttTrackRequest(filterExt, FILTER_ATT_ORIGIN_HOST, Bfr, pBulkOrInterruptTransfer->TransferBufferLength);
+
+						FilterReportSnoopRequest(filterExt, Bfr, pBulkOrInterruptTransfer->TransferBufferLength);
+
+						FilterCapturePacket(filterExt, TRACE_KIND_ACL, HCI_DIRECTION_OUT, Bfr, pBulkOrInterruptTransfer->TransferBufferLength);
+
+						if (FilterTraceWanted(TRACE_KIND_ACL, HCI_DIRECTION_OUT, Bfr, pBulkOrInterruptTransfer->TransferBufferLength))
+							Dump(USBD_TRANSFER_DIRECTION_OUT, (PUCHAR)pBulkOrInterruptTransfer->TransferBuffer, pBulkOrInterruptTransfer->TransferBufferLength);
+					}
+					else if (pBulkOrInterruptTransfer->TransferBufferMDL)
+					{
+						TRACEPOINT(TRACEPOINT_LEVEL_VERBOSE, TRACEPOINT_KEYWORD_URB, TRACEPOINT_TRANSFER_BUFFER,
+							TRACEPOINT_PTR(pUrb), TRACEPOINT_BUFFER_MDL, 0, 0);
+
+						#pragma warning(disable : 4995) //MmGetSystemAddressForMdl is deprecated so ignore warning
+						PUCHAR pMDLBuf = (PUCHAR)MmGetSystemAddressForMdl(pBulkOrInterruptTransfer->TransferBufferMDL);
+						if (pMDLBuf)
+						{
+							FilterSnoopAclPacket(filterExt, HCI_DIRECTION_OUT, pMDLBuf, pBulkOrInterruptTransfer->TransferBufferLength);
+
+							aclPacket = pMDLBuf;
+
+							FilterAttTrackRequest(filterExt, FILTER_ATT_ORIGIN_HOST, pMDLBuf, pBulkOrInterruptTransfer->TransferBufferLength);
+
+							FilterReportSnoopRequest(filterExt, pMDLBuf, pBulkOrInterruptTransfer->TransferBufferLength);
+
+							FilterCapturePacket(filterExt, TRACE_KIND_ACL, HCI_DIRECTION_OUT, pMDLBuf, pBulkOrInterruptTransfer->TransferBufferLength);
+
+							if (FilterTraceWanted(TRACE_KIND_ACL, HCI_DIRECTION_OUT, pMDLBuf, pBulkOrInterruptTransfer->TransferBufferLength))
+								Dump(USBD_TRANSFER_DIRECTION_OUT, pMDLBuf, pBulkOrInterruptTransfer->TransferBufferLength);
+						}
+						else
+						{
+							TRACEPOINT(TRACEPOINT_LEVEL_ERROR, TRACEPOINT_KEYWORD_ERROR, TRACEPOINT_MDL_MAP_FAILED,
+								TRACEPOINT_PTR(pUrb), 0, 0, 0);
+						}
+					}
+					else
+					{
+						TRACEPOINT(TRACEPOINT_LEVEL_VERBOSE, TRACEPOINT_KEYWORD_URB, TRACEPOINT_TRANSFER_BUFFER,
+							TRACEPOINT_PTR(pUrb), TRACEPOINT_BUFFER_NONE, 0, 0);
+					}
+
+					//Only packets on the ACL out pipe take a buffer of the controller
+					if (filterExt->AclOutPipe != NULL &&
+						pBulkOrInterruptTransfer->PipeHandle != filterExt->AclOutPipe)
+						aclPacket = NULL;
+
+					aclLength = pBulkOrInterruptTransfer->TransferBufferLength;
+				}
+				//Kept so a read whose packet we hide can go down again
+				else
+				{
+					FilterRequestGetData(Request)->TransferBufferLength = pBulkOrInterruptTransfer->TransferBufferLength;
+				}
+
+				break;
+			}
+			case URB_FUNCTION_CLASS_DEVICE: {
+				// My code Here
+				break;
+			}
+			default:
+				break;
+			}
+		}
+		default:
+			//status = STATUS_INVALID_DEVICE_REQUEST;
+			break;
+	}
+
+	if (!NT_SUCCESS(status)) {
+		WdfRequestComplete(Request, status);
+		return;
+	}
+
+	//
+	// An ACL packet the controller has no buffer for yet, or an ATT request
+	// that would cross a write of ours, waits in the hold queue.
+	//
+	if (aclPacket != NULL && FilterHoldAclPacket(filterExt, Request, aclPacket, aclLength)) {
+		return;
+	}
+
+	//
+	// Forward the request down. WdfDeviceGetIoTarget returns
+	// the default target, which represents the device attached to us below in
+	// the stack.
+	//
+#if FORWARD_REQUEST_WITH_COMPLETION
+	//
+	// Use this routine to forward a request if you are interested in post
+	// processing the IRP.
+	//
+	FilterForwardRequestWithCompletionRoutine(Request,
+		WdfDeviceGetIoTarget(device));
+#else
+	FilterForwardRequest(Request, WdfDeviceGetIoTarget(device));
+#endif
+
+	return;
+}
+
+PUCHAR
+FilterGetTransferBuffer(
+    IN struct _URB_BULK_OR_INTERRUPT_TRANSFER *pBulkOrInterruptTransfer
+    )
+/*++
+Routine Description:
+
+    Returns a system address for the transfer buffer of a bulk or
+    interrupt URB, whether it was given flat or as an MDL.
+
+--*/
+{
+    if (pBulkOrInterruptTransfer->TransferBuffer) {
+        return (PUCHAR)pBulkOrInterruptTransfer->TransferBuffer;
+    }
+
+    if (pBulkOrInterruptTransfer->TransferBufferMDL) {
+        return (PUCHAR)MmGetSystemAddressForMdlSafe(pBulkOrInterruptTransfer->TransferBufferMDL,
+                                                    NormalPagePriority | MdlMappingNoExecute);
+    }
+
+    return NULL;
+}
+
+#define FilterMatchEndpoint(ProfileEndpoint, EndpointAddress) \
+    ((ProfileEndpoint) == 0 || (ProfileEndpoint) == (EndpointAddress))
+
+VOID
+FilterSnoopSelectConfiguration(
+    IN PFILTER_EXTENSION FilterExt,
+    IN PURB              Urb
+    )
+/*++
+Routine Description:
+
+    Remembers the pipe handles of the bluetooth interface from a completed
+    select configuration request, so the completion routine can tell HCI
+    events from ACL data. The SCO interface only has isochronous pipes and
+    is skipped by the pipe type checks, the profile's endpoint addresses
+    keep us off vendor interfaces.
+
+--*/
+{
+    PCCONTROLLER_PROFILE        profile = FilterExt->Profile;
+    PUSBD_INTERFACE_INFORMATION interfaceInfo;
+    PUCHAR                      end;
+    ULONG                       i;
+
+    FilterExt->EventPipe = NULL;
+    FilterExt->AclInPipe = NULL;
+    FilterExt->AclOutPipe = NULL;
+
+    //
+    // No configuration descriptor means the adapter is being unconfigured.
+    //
+    if (Urb->UrbSelectConfiguration.ConfigurationDescriptor == NULL) {
+        return;
+    }
+
+    interfaceInfo = &Urb->UrbSelectConfiguration.Interface;
+    end = (PUCHAR)Urb + Urb->UrbHeader.Length;
+
+    while ((PUCHAR)interfaceInfo + sizeof(USBD_INTERFACE_INFORMATION) <= end &&
+           interfaceInfo->Length != 0 &&
+           (PUCHAR)interfaceInfo + interfaceInfo->Length <= end) {
+
+        for (i = 0; i < interfaceInfo->NumberOfPipes; i++) {
+            PUSBD_PIPE_INFORMATION pipe = &interfaceInfo->Pipes[i];
+
+            if (pipe->PipeType == UsbdPipeTypeInterrupt &&
+                USB_ENDPOINT_DIRECTION_IN(pipe->EndpointAddress)) {
+                if (FilterExt->EventPipe == NULL &&
+                    FilterMatchEndpoint(profile->EventEndpoint, pipe->EndpointAddress)) {
+                    FilterExt->EventPipe = pipe->PipeHandle;
+                }
+            } else if (pipe->PipeType == UsbdPipeTypeBulk) {
+                if (USB_ENDPOINT_DIRECTION_IN(pipe->EndpointAddress)) {
+                    if (FilterExt->AclInPipe == NULL &&
+                        FilterMatchEndpoint(profile->AclInEndpoint, pipe->EndpointAddress)) {
+                        FilterExt->AclInPipe = pipe->PipeHandle;
+                    }
+                } else {
+                    if (FilterExt->AclOutPipe == NULL &&
+                        FilterMatchEndpoint(profile->AclOutEndpoint, pipe->EndpointAddress)) {
+                        FilterExt->AclOutPipe = pipe->PipeHandle;
+                    }
+                }
+            }
+        }
+
+        interfaceInfo = (PUSBD_INTERFACE_INFORMATION)((PUCHAR)interfaceInfo + interfaceInfo->Length);
+    }
+
+    KdPrint(("Event pipe 0x%p, ACL in pipe 0x%p, ACL out pipe 0x%p\n",
+        FilterExt->EventPipe, FilterExt->AclInPipe, FilterExt->AclOutPipe));
+}
+
+VOID
+FilterSnoopHciEvent(
+    IN PFILTER_EXTENSION FilterExt,
+    IN PUCHAR            Bfr,
+    IN ULONG             Length
+    )
+/*++
+Routine Description:
+
+    Passes an HCI event from the interrupt pipe to the link state so the
+    header fix follows the adapter's LE limits and our packets its buffers,
+    and starts the activation of a known remote once its link is encrypted.
+
+--*/
+{
+    KIRQL           irql;
+    HCI_LINK_CHANGE change;
+    PHCI_CONNECTION conn;
+    ULONG           stream = HCI_MAX_CONNECTIONS;
+    USHORT          handle = HCI_INVALID_HANDLE;
+    UCHAR           peerAddressType = 0;
+    UCHAR           peerAddress[6] = { 0 };
+    UCHAR           packet[ACTIVATE_MAX_PACKET];
+    ULONG           packetLength = 0;
+    USHORT          aclTotal;
+    USHORT          leTotal;
+
+    KeAcquireSpinLock(&FilterExt->LinkStateLock, &irql);
+    change = HciProcessEvent(&FilterExt->LinkState, Bfr, Length, &conn);
+    aclTotal = FilterExt->LinkState.Adapter.TotalAclDataPackets;
+    leTotal = FilterExt->LinkState.Adapter.TotalLeAclDataPackets;
+
+    //
+    // Once the lock is dropped the slot can be reset for another
+    // connection, so what is needed of it is copied here.
+    //
+    if (conn != NULL) {
+        stream = (ULONG)(conn - FilterExt->LinkState.Connections);
+        handle = conn->Handle;
+        peerAddressType = conn->PeerAddressType;
+        RtlCopyMemory(peerAddress, conn->PeerAddress, sizeof(peerAddress));
+    }
+
+    KeReleaseSpinLock(&FilterExt->LinkStateLock, irql);
+
+    switch (change) {
+    case HciLinkAdapterChanged:
+        KdPrint(("Adapter lmp version %d, acl length %d, le acl length %d, fix att length %d\n",
+            FilterExt->LinkState.Adapter.LmpVersion,
+            FilterExt->LinkState.Adapter.AclDataPacketLength,
+            FilterExt->LinkState.Adapter.LeAclDataPacketLength,
+            FilterExt->LinkState.DefaultFixAttLength));
+
+        KeAcquireSpinLock(&FilterExt->AclFlowLock, &irql);
+        AclFlowSetBuffers(&FilterExt->AclFlow, aclTotal, leTotal);
+        KeReleaseSpinLock(&FilterExt->AclFlowLock, irql);
+        break;
+    case HciLinkConnected:
+    case HciLinkDisconnected:
+        KeAcquireSpinLock(&FilterExt->AclFlowLock, &irql);
+        if (change == HciLinkConnected) {
+            AclFlowConnected(&FilterExt->AclFlow, stream, handle);
+        } else {
+            AclFlowDisconnected(&FilterExt->AclFlow, stream);
+        }
+        KeReleaseSpinLock(&FilterExt->AclFlowLock, irql);
+
+        KeAcquireSpinLock(&FilterExt->CaptureLock, &irql);
+        CaptureResetStream(&FilterExt->Capture, stream);
+        KeReleaseSpinLock(&FilterExt->CaptureLock, irql);
+
+        KeAcquireSpinLock(&FilterExt->AttTrackLock, &irql);
+        AttTrackDisconnected(&FilterExt->AttTrack, stream);
+        KeReleaseSpinLock(&FilterExt->AttTrackLock, irql);
+
+        KeAcquireSpinLock(&FilterExt->WatchdogLock, &irql);
+        WatchdogResetStream(&FilterExt->Watchdog, stream);
+        KeReleaseSpinLock(&FilterExt->WatchdogLock, irql);
+
+        KeAcquireSpinLock(&FilterExt->VoiceStatsLock, &irql);
+        VoiceStatsResetStream(&FilterExt->VoiceStats, stream);
+        KeReleaseSpinLock(&FilterExt->VoiceStatsLock, irql);
+
+        KeAcquireSpinLock(&FilterExt->ReportMapLock, &irql);
+        ReportSnoopDisconnected(&FilterExt->ReportSnoop, stream);
+        KeReleaseSpinLock(&FilterExt->ReportMapLock, irql);
+
+        KeAcquireSpinLock(&FilterEventLock, &irql);
+        RtlZeroMemory(&FilterExt->Layouts[stream], sizeof(COALESCE_LAYOUT));
+        FilterExt->Layouts[stream].Handle = HCI_INVALID_HANDLE;
+        KeReleaseSpinLock(&FilterEventLock, irql);
+        break;
+    default:
+        break;
+    }
+
+    if (stream < HCI_MAX_CONNECTIONS) {
+        KeAcquireSpinLock(&FilterExt->ActivateLock, &irql);
+
+        switch (change) {
+        case HciLinkConnected:
+            ActivateConnected(&FilterExt->Activate,
+                              stream,
+                              handle,
+                              peerAddressType,
+                              peerAddress,
+                              (LONGLONG)KeQueryInterruptTime());
+            break;
+        case HciLinkDisconnected:
+            ActivateDisconnected(&FilterExt->Activate, stream);
+            break;
+        case HciLinkEncrypted:
+            packetLength = ActivateEncrypted(&FilterExt->Activate, stream, handle, packet);
+            break;
+        default:
+            break;
+        }
+
+        KeReleaseSpinLock(&FilterExt->ActivateLock, irql);
+
+        if (packetLength != 0) {
+            FilterInjectAclPacket(FilterExt, stream, packet, packetLength);
+        }
+    }
+
+    //
+    // Held packets may go now that the buffers are known, or those of a
+    // connection that is gone were freed.
+    //
+    if (change == HciLinkAdapterChanged || change == HciLinkDisconnected) {
+        FilterReleaseAclPackets(FilterExt);
+    }
+
+    switch (change) {
+    case HciLinkConnected:
+        KdPrint(("Connected handle 0x%x to %02x:%02x:%02x:%02x:%02x:%02x\n",
+            handle,
+            peerAddress[5], peerAddress[4], peerAddress[3],
+            peerAddress[2], peerAddress[1], peerAddress[0]));
+        break;
+    case HciLinkDisconnected:
+        KdPrint(("Disconnected, slot %d freed\n", (int)stream));
+        break;
+    case HciLinkEncrypted:
+        KdPrint(("Encrypted handle 0x%x\n", handle));
+        break;
+    default:
+        break;
+    }
+}
+
+VOID
+FilterSnoopAclPacket(
+    IN PFILTER_EXTENSION FilterExt,
+    IN int               Direction,
+    IN PUCHAR            Bfr,
+    IN ULONG             Length
+    )
+/*++
+Routine Description:
+
+    Passes ATT MTU exchanges to the link state. Everything else returns
+    after a few byte compares without taking the lock.
+
+--*/
+{
+    KIRQL irql;
+
+    if (!HCI_IS_LINK_STATE_PDU(Bfr, Length)) {
+        return;
+    }
+
+    KeAcquireSpinLock(&FilterExt->LinkStateLock, &irql);
+    HciProcessAclPacket(&FilterExt->LinkState, Direction, Bfr, Length);
+    KeReleaseSpinLock(&FilterExt->LinkStateLock, irql);
+
+    KdPrint(("ATT MTU exchange on handle 0x%x, fix att length %d\n",
+        HCI_ACL_HANDLE(Bfr), HciGetFixAttLength(&FilterExt->LinkState, HCI_ACL_HANDLE(Bfr))));
+}
+
+USHORT
+FilterGetFixAttLength(
+    IN PFILTER_EXTENSION FilterExt,
+    IN USHORT            Handle
+    )
+/*++
+Routine Description:
+
+    Returns the ATT length incoming notifications on a connection are
+    trimmed to by the HCI/L2CAP header fix, 0 to leave them alone.
+
+--*/
+{
+    switch (FIX_HCI_L2CAP_HEADERS) {
+    case FIX_HCI_L2CAP_HEADERS_MODE_ON:
+        return HCI_LEGACY_FIX_ATT_LENGTH;
+    case FIX_HCI_L2CAP_HEADERS_MODE_AUTO:
+        return HciGetFixAttLength(&FilterExt->LinkState, Handle);
+    default:
+        return 0;
+    }
+}
+
+BOOLEAN
+FilterTraceWanted(
+    IN UCHAR    Kind,
+    IN UCHAR    Direction,
+    IN PUCHAR   Bfr,
+    IN ULONG    Length
+    )
+/*++
+Routine Description:
+
+    Decides whether a packet is dumped, before anything is formatted.
+    Checks DEBUG_DATA_IN/OUT first so the predicate costs nothing while
+    dumping is off.
+
+    The reader count is taken before the active slot is checked again, so
+    once FilterSetTraceFilter has seen no readers on the idle slot nobody
+    can start reading it until it is flipped active.
+
+--*/
+{
+    LONG    active;
+    BOOLEAN wanted;
+
+    if (Direction == HCI_DIRECTION_IN ? !DEBUG_DATA_IN : !DEBUG_DATA_OUT) {
+        return FALSE;
+    }
+
+    for (;;) {
+        active = FilterTraceActive;
+
+        if (active < 0) {
+            return TRUE;
+        }
+
+        InterlockedIncrement(&FilterTraceSlots[active].Readers);
+
+        if (active == FilterTraceActive) {
+            break;
+        }
+
+        InterlockedDecrement(&FilterTraceSlots[active].Readers);
+    }
+
+    wanted = TraceFilterRun(&FilterTraceSlots[active].Filter,
+                            Kind,
+                            Direction,
+                            Bfr,
+                            Length,
+                            (LONGLONG)KeQueryInterruptTime());
+
+    InterlockedDecrement(&FilterTraceSlots[active].Readers);
+
+    return wanted;
+}
+
+NTSTATUS
+FilterSetTraceFilter(
+    IN PTRACE_FILTER_PROGRAM Program,
+    IN ULONG                 Length
+    )
+/*++
+Routine Description:
+
+    Loads a trace predicate from IOCTL_SET_TRACE_FILTER into the idle slot
+    and makes it the active one. An empty program removes the predicate.
+    Only called from the control device's sequential queue, so there is
+    one writer at a time.
+
+--*/
+{
+    LARGE_INTEGER   interval;
+    LONG            idle;
+
+    PAGED_CODE();
+
+    if (Program->InsnCount == 0) {
+        InterlockedExchange(&FilterTraceActive, -1);
+        KdPrint(("Trace filter removed\n"));
+        return STATUS_SUCCESS;
+    }
+
+    idle = (FilterTraceActive == 0) ? 1 : 0;
+
+    //
+    // Readers that picked the slot before it was last flipped idle are
+    // still finishing, they are never more than one packet long.
+    //
+    interval.QuadPart = -10000; // 1ms
+    while (FilterTraceSlots[idle].Readers != 0) {
+        KeDelayExecutionThread(KernelMode, FALSE, &interval);
+    }
+
+    if (!TraceFilterLoad(&FilterTraceSlots[idle].Filter, Program, Length)) {
+        KdPrint(("Trace filter rejected\n"));
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    InterlockedExchange(&FilterTraceActive, idle);
+
+    KdPrint(("Trace filter of %lu instructions loaded\n", Program->InsnCount));
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+FilterCapturePacket(
+    IN PFILTER_EXTENSION FilterExt,
+    IN UCHAR             Kind,
+    IN UCHAR             Direction,
+    IN PUCHAR            Bfr,
+    IN ULONG             Length
+    )
+/*++
+Routine Description:
+
+    Adds a packet to the adapter's capture ring. Incoming ATT traffic is
+    tied to its connection slot for the notification gap trigger.
+
+--*/
+{
+    KIRQL           irql;
+    ULONG           stream = CAPTURE_NO_STREAM;
+    PHCI_CONNECTION conn;
+    BOOLEAN         triggered;
+
+    if (Kind == TRACE_KIND_ACL &&
+        Direction == HCI_DIRECTION_IN &&
+        HCI_IS_ATT_PDU(Bfr, Length)) {
+        conn = HciLookupConnection(&FilterExt->LinkState, HCI_ACL_HANDLE(Bfr));
+        if (conn != NULL) {
+            stream = (ULONG)(conn - FilterExt->LinkState.Connections);
+        }
+    }
+
+    KeAcquireSpinLock(&FilterExt->CaptureLock, &irql);
+    triggered = CapturePacket(&FilterExt->Capture,
+                              Kind,
+                              Direction,
+                              stream,
+                              Bfr,
+                              Length,
+                              (LONGLONG)KeQueryInterruptTime());
+    KeReleaseSpinLock(&FilterExt->CaptureLock, irql);
+
+    if (triggered) {
+        KdPrint(("Capture triggered (0x%x) on handle 0x%x\n",
+            FilterExt->Capture.Trigger, FilterExt->Capture.TriggerHandle));
+    }
+}
+
+VOID
+FilterCaptureTrigger(
+    IN PFILTER_EXTENSION FilterExt,
+    IN UCHAR             Trigger
+    )
+/*++
+Routine Description:
+
+    Fires a capture trigger that isn't tied to a packet.
+
+--*/
+{
+    KIRQL   irql;
+    BOOLEAN triggered;
+
+    KeAcquireSpinLock(&FilterExt->CaptureLock, &irql);
+    triggered = CaptureTrigger(&FilterExt->Capture,
+                               Trigger,
+                               HCI_INVALID_HANDLE,
+                               (LONGLONG)KeQueryInterruptTime());
+    KeReleaseSpinLock(&FilterExt->CaptureLock, irql);
+
+    if (triggered) {
+        KdPrint(("Capture triggered (0x%x)\n", Trigger));
+    }
+}
+
+NTSTATUS
+FilterSetCaptureConfig(
+    IN PFILTER_CAPTURE_CONFIG Config
+    )
+/*++
+Routine Description:
+
+    Applies the capture configuration to every adapter. The control
+    device's dispatch is pageable, so the capture locks are taken here.
+
+--*/
+{
+    KIRQL               irql;
+    ULONG               i;
+    ULONG               noItems;
+    PFILTER_EXTENSION   filterExt;
+    NTSTATUS            status = STATUS_SUCCESS;
+
+    WdfWaitLockAcquire(FilterDeviceCollectionLock, NULL);
+
+    noItems = WdfCollectionGetCount(FilterDeviceCollection);
+
+    for (i = 0; i < noItems && NT_SUCCESS(status); i++) {
+        filterExt = FilterGetData(WdfCollectionGetItem(FilterDeviceCollection, i));
+
+        KeAcquireSpinLock(&filterExt->CaptureLock, &irql);
+        if (!CaptureConfigure(&filterExt->Capture, Config)) {
+            status = STATUS_INVALID_PARAMETER;
+        }
+        KeReleaseSpinLock(&filterExt->CaptureLock, irql);
+    }
+
+    WdfWaitLockRelease(FilterDeviceCollectionLock);
+
+    return status;
+}
+
+VOID
+FilterGetCapture(
+    IN PFILTER_EXTENSION        FilterExt,
+    OUT PFILTER_CAPTURE_HEADER  Header,
+    OUT PFILTER_CAPTURE_RECORD  Records,
+    IN ULONG                    MaxRecords
+    )
+/*++
+Routine Description:
+
+    Exports the adapter's capture window for IOCTL_GET_CAPTURE, re-arming
+    a frozen one.
+
+--*/
+{
+    KIRQL irql;
+
+    KeAcquireSpinLock(&FilterExt->CaptureLock, &irql);
+    CaptureExport(&FilterExt->Capture, Header, Records, MaxRecords);
+    KeReleaseSpinLock(&FilterExt->CaptureLock, irql);
+}
+
+VOID
+FilterQueueHidReport(
+    IN PFILTER_EXTENSION FilterExt,
+    IN PUCHAR            Bfr,
+    IN ULONG             Length,
+    IN LONGLONG          Stamp
+    )
+/*++
+Routine Description:
+
+    Decodes a hid report notification into events and queues the ones the
+    coalescer delivers. The packet has already been matched as a hid report
+    notification and snooped, so its connection is tracked. Stamp is the
+    performance counter when its URB completed.
+
+--*/
+{
+    KIRQL           irql;
+    PHCI_CONNECTION conn;
+    FILTER_EVENT    events[COALESCE_MAX_REPORT_EVENTS];
+    ULONG           valueLength;
+    ULONG           count;
+    ULONG           i;
+
+    conn = HciLookupConnection(&FilterExt->LinkState, HCI_ACL_HANDLE(Bfr));
+    if (conn == NULL || L2CAP_LENGTH(Bfr) < 3) {
+        return;
+    }
+
+    //
+    // The value follows the notification's opcode and handle.
+    //
+    valueLength = min((ULONG)L2CAP_LENGTH(Bfr), Length - ATT_PDU_OFFSET) - 3;
+
+    KeAcquireSpinLock(&FilterEventLock, &irql);
+
+    count = CoalesceReport(&FilterExt->Coalesce,
+                           &FilterExt->Layouts[conn - FilterExt->LinkState.Connections],
+                           (ULONG)(conn - FilterExt->LinkState.Connections),
+                           HCI_ACL_HANDLE(Bfr),
+                           ATT_HANDLE(Bfr),
+                           Bfr + ATT_PDU_OFFSET + 3,
+                           valueLength,
+                           (LONGLONG)KeQueryInterruptTime(),
+                           Stamp,
+                           events);
+
+    for (i = 0; i < count; i++) {
+        EventQueuePut(&FilterEventQueue, &events[i]);
+    }
+
+    KeReleaseSpinLock(&FilterEventLock, irql);
+}
+
+VOID
+FilterQueueVoice(
+    IN PUCHAR            Bfr,
+    IN ULONG             Length,
+    IN LONGLONG          Stamp
+    )
+/*++
+Routine Description:
+
+    Queues the value of a voice notification as a voice frame.
+
+--*/
+{
+    KIRQL   irql;
+
+    if (L2CAP_LENGTH(Bfr) < 3) {
+        return;
+    }
+
+    KeAcquireSpinLock(&FilterEventLock, &irql);
+    EventQueuePutVoice(&FilterEventQueue,
+                       HCI_ACL_HANDLE(Bfr),
+                       ATT_HANDLE(Bfr),
+                       Bfr + ATT_PDU_OFFSET + 3,
+                       min((ULONG)L2CAP_LENGTH(Bfr), Length - ATT_PDU_OFFSET) - 3,
+                       (LONGLONG)KeQueryInterruptTime(),
+                       Stamp);
+    KeReleaseSpinLock(&FilterEventLock, irql);
+}
+
+NTSTATUS
+FilterSetEventConfig(
+    IN PFILTER_EVENT_CONFIG Config
+    )
+/*++
+Routine Description:
+
+    Applies the event configuration to every adapter. Turning events off
+    drops the moves held, subscribers can still read what is queued.
+
+--*/
+{
+    KIRQL               irql;
+    ULONG               i;
+    ULONG               noItems;
+    PFILTER_EXTENSION   filterExt;
+
+    WdfWaitLockAcquire(FilterDeviceCollectionLock, NULL);
+
+    noItems = WdfCollectionGetCount(FilterDeviceCollection);
+
+    KeAcquireSpinLock(&FilterEventLock, &irql);
+
+    FilterEventConfig = *Config;
+
+    for (i = 0; i < noItems; i++) {
+        filterExt = FilterGetData(WdfCollectionGetItem(FilterDeviceCollection, i));
+
+        if (!Config->Enable) {
+            CoalesceInit(&filterExt->Coalesce);
+            CoalesceSmooth(&filterExt->Coalesce, &FilterSmoothConfig);
+        }
+
+        CoalesceConfigure(&filterExt->Coalesce, Config->CoalesceMs);
+    }
+
+    KeReleaseSpinLock(&FilterEventLock, irql);
+
+    WdfWaitLockRelease(FilterDeviceCollectionLock);
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+FilterSetSmoothConfig(
+    IN PFILTER_SMOOTH_CONFIG Config
+    )
+/*++
+Routine Description:
+
+    Applies the trackpad smoothing to every adapter. Touches going on
+    take it from their next move.
+
+--*/
+{
+    KIRQL               irql;
+    ULONG               i;
+    ULONG               noItems;
+    PFILTER_EXTENSION   filterExt;
+
+    WdfWaitLockAcquire(FilterDeviceCollectionLock, NULL);
+
+    noItems = WdfCollectionGetCount(FilterDeviceCollection);
+
+    KeAcquireSpinLock(&FilterEventLock, &irql);
+
+    FilterSmoothConfig = *Config;
+
+    for (i = 0; i < noItems; i++) {
+        filterExt = FilterGetData(WdfCollectionGetItem(FilterDeviceCollection, i));
+        CoalesceSmooth(&filterExt->Coalesce, Config);
+    }
+
+    KeReleaseSpinLock(&FilterEventLock, irql);
+
+    WdfWaitLockRelease(FilterDeviceCollectionLock);
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+FilterSubscribeEvents(
+    IN PCONTROL_FILE_CONTEXT        FileContext,
+    IN PFILTER_EVENT_SUBSCRIPTION   Subscription
+    )
+/*++
+Routine Description:
+
+    Subscribes a handle to the events, or changes its subscription.
+
+--*/
+{
+    KIRQL   irql;
+    ULONG   subscriber;
+
+    KeAcquireSpinLock(&FilterEventLock, &irql);
+    subscriber = EventQueueSubscribe(&FilterEventQueue, FileContext->Subscriber, Subscription);
+    KeReleaseSpinLock(&FilterEventLock, irql);
+
+    if (subscriber == EVENT_QUEUE_NO_SUBSCRIBER) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    FileContext->Subscriber = subscriber;
+
+    return STATUS_SUCCESS;
+}
+
+ULONG
+FilterGetEvents(
+    IN PCONTROL_FILE_CONTEXT        FileContext,
+    OUT PFILTER_EVENT_BUFFER_HEADER Header,
+    IN ULONG                        Length
+    )
+/*++
+Routine Description:
+
+    Queues the held moves whose window has passed, then reads the events
+    and voice frames a subscribed handle wants from its cursors on.
+
+Return Value:
+
+    Bytes of the output buffer used.
+
+--*/
+{
+    KIRQL               irql;
+    ULONG               i;
+    ULONG               j;
+    ULONG               noItems;
+    ULONG               count;
+    ULONG               used;
+    LONGLONG            now = (LONGLONG)KeQueryInterruptTime();
+    PFILTER_EXTENSION   filterExt;
+    FILTER_EVENT        events[COALESCE_MAX_FLUSH_EVENTS];
+
+    WdfWaitLockAcquire(FilterDeviceCollectionLock, NULL);
+
+    noItems = WdfCollectionGetCount(FilterDeviceCollection);
+
+    for (i = 0; i < noItems; i++) {
+        filterExt = FilterGetData(WdfCollectionGetItem(FilterDeviceCollection, i));
+
+        KeAcquireSpinLock(&FilterEventLock, &irql);
+
+        count = CoalesceFlush(&filterExt->Coalesce, now, events);
+
+        for (j = 0; j < count; j++) {
+            EventQueuePut(&FilterEventQueue, &events[j]);
+        }
+
+        KeReleaseSpinLock(&FilterEventLock, irql);
+    }
+
+    WdfWaitLockRelease(FilterDeviceCollectionLock);
+
+    KeAcquireSpinLock(&FilterEventLock, &irql);
+    used = EventQueueTake(&FilterEventQueue, FileContext->Subscriber, Header, Length);
+    KeReleaseSpinLock(&FilterEventLock, irql);
+
+    Header->Taken = KeQueryPerformanceCounter(NULL).QuadPart;
+
+    return used;
+}
+
+VOID
+FilterInjectAclPacket(
+    IN PFILTER_EXTENSION FilterExt,
+    IN ULONG             Stream,
+    IN PUCHAR            Bfr,
+    IN ULONG             Length
+    )
+/*++
+Routine Description:
+
+    Sends an ACL packet of our own once the controller has a buffer for
+    it, until then it waits in the flow control state and goes down from
+    FilterReleaseAclPackets.
+
+--*/
+{
+    KIRQL   irql;
+    BOOLEAN send;
+
+    KeAcquireSpinLock(&FilterExt->AclFlowLock, &irql);
+    send = AclFlowOwnSend(&FilterExt->AclFlow, Stream, Bfr, Length);
+    KeReleaseSpinLock(&FilterExt->AclFlowLock, irql);
+
+    if (send) {
+        FilterSendAclPacket(FilterExt, Stream, Bfr, Length);
+    }
+}
+
+VOID
+FilterSendAclPacket(
+    IN PFILTER_EXTENSION FilterExt,
+    IN ULONG             Stream,
+    IN PUCHAR            Bfr,
+    IN ULONG             Length
+    )
+/*++
+Routine Description:
+
+    Sends an ACL packet of our own down the ACL out pipe, on a request and
+    URB of our own that are freed once it completes. A packet that doesn't
+    make it gives its buffer back and fails the activation it belongs to.
+
+--*/
+{
+    WDF_OBJECT_ATTRIBUTES   attributes;
+    WDFIOTARGET             target = WdfDeviceGetIoTarget(FilterExt->WdfDevice);
+    WDFREQUEST              request = NULL;
+    WDFMEMORY               memory;
+    PFILTER_INJECT_BUFFER   inject;
+    NTSTATUS                status;
+    KIRQL                   irql;
+
+    if (FilterExt->AclOutPipe == NULL || Length > ACTIVATE_MAX_PACKET) {
+        status = STATUS_INVALID_DEVICE_STATE;
+        goto failed;
+    }
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+    attributes.ParentObject = FilterExt->WdfDevice;
+
+    status = WdfRequestCreate(&attributes, target, &request);
+    if (!NT_SUCCESS(status)) {
+        goto failed;
+    }
+
+    WDF_OBJECT_ATTRIBUTES_INIT(&attributes);
+    attributes.ParentObject = request;
+
+    status = WdfMemoryCreate(&attributes,
+                             NonPagedPoolNx,
+                             FILTER_POOL_TAG,
+                             sizeof(FILTER_INJECT_BUFFER),
+                             &memory,
+                             (PVOID*)&inject);
+    if (!NT_SUCCESS(status)) {
+        goto failed;
+    }
+
+    RtlZeroMemory(inject, sizeof(FILTER_INJECT_BUFFER));
+    inject->FilterExt = FilterExt;
+    inject->Stream = Stream;
+    RtlCopyMemory(inject->Data, Bfr, Length);
+
+    UsbBuildInterruptOrBulkTransferRequest((PURB)&inject->Urb,
+                                           sizeof(struct _URB_BULK_OR_INTERRUPT_TRANSFER),
+                                           FilterExt->AclOutPipe,
+                                           inject->Data,
+                                           NULL,
+                                           Length,
+                                           USBD_TRANSFER_DIRECTION_OUT,
+                                           NULL);
+
+    status = WdfIoTargetFormatRequestForInternalIoctlOthers(target,
+                                                            request,
+                                                            IOCTL_INTERNAL_USB_SUBMIT_URB,
+                                                            memory,
+                                                            NULL,
+                                                            NULL,
+                                                            NULL,
+                                                            NULL,
+                                                            NULL);
+    if (!NT_SUCCESS(status)) {
+        goto failed;
+    }
+
+    WdfRequestSetCompletionRoutine(request, FilterInjectCompletionRoutine, inject);
+
+    FilterCapturePacket(FilterExt, TRACE_KIND_ACL, HCI_DIRECTION_OUT, inject->Data, Length);
+
+    if (FilterTraceWanted(TRACE_KIND_ACL, HCI_DIRECTION_OUT, inject->Data, Length))
+        Dump(USBD_TRANSFER_DIRECTION_OUT, inject->Data, Length);
+
+    TRACEPOINT(TRACEPOINT_LEVEL_INFO, TRACEPOINT_KEYWORD_ACTIVATE, TRACEPOINT_ACTIVATE_SEND,
+               HCI_ACL_HANDLE(Bfr), ATT_HANDLE(Bfr), Length, 0);
+
+    FilterAttTrackRequest(FilterExt, FILTER_ATT_ORIGIN_FILTER, inject->Data, Length);
+
+    if (WdfRequestSend(request, target, WDF_NO_SEND_OPTIONS)) {
+        return;
+    }
+
+    status = WdfRequestGetStatus(request);
+
+    FilterAttTrackSent(FilterExt, FILTER_ATT_ORIGIN_FILTER, inject->Data, Length, FALSE);
+
+failed:
+    TRACEPOINT(TRACEPOINT_LEVEL_ERROR, TRACEPOINT_KEYWORD_ERROR, TRACEPOINT_SEND_FAILED,
+               TRACEPOINT_STATUS(status), 0, 0, 0);
+
+    if (request != NULL) {
+        WdfObjectDelete(request);
+    }
+
+    KeAcquireSpinLock(&FilterExt->AclFlowLock, &irql);
+    AclFlowOwnFailed(&FilterExt->AclFlow, Stream, HCI_ACL_HANDLE(Bfr));
+    KeReleaseSpinLock(&FilterExt->AclFlowLock, irql);
+
+    KeAcquireSpinLock(&FilterExt->ActivateLock, &irql);
+    ActivateSendFailed(&FilterExt->Activate, Stream, HCI_ACL_HANDLE(Bfr));
+    KeReleaseSpinLock(&FilterExt->ActivateLock, irql);
+
+    FilterReleaseAclPackets(FilterExt);
+}
+
+VOID
+FilterInjectCompletionRoutine(
+    IN WDFREQUEST                  Request,
+    IN WDFIOTARGET                 Target,
+    PWDF_REQUEST_COMPLETION_PARAMS CompletionParams,
+    IN WDFCONTEXT                  Context
+    )
+/*++
+Routine Description:
+
+    Completion routine of the packets we send ourselves.
+
+--*/
+{
+    PFILTER_INJECT_BUFFER   inject = (PFILTER_INJECT_BUFFER)Context;
+    NTSTATUS                status = CompletionParams->IoStatus.Status;
+    KIRQL                   irql;
+
+    UNREFERENCED_PARAMETER(Target);
+
+    FilterAttTrackSent(inject->FilterExt,
+                       FILTER_ATT_ORIGIN_FILTER,
+                       inject->Data,
+                       inject->Urb.TransferBufferLength,
+                       NT_SUCCESS(status));
+
+    if (!NT_SUCCESS(status)) {
+        TRACEPOINT(TRACEPOINT_LEVEL_ERROR, TRACEPOINT_KEYWORD_ERROR, TRACEPOINT_SEND_FAILED,
+                   TRACEPOINT_STATUS(status), 0, 0, 0);
+        FilterCaptureTrigger(inject->FilterExt, FILTER_CAPTURE_TRIGGER_SEND_FAILURE);
+
+        KeAcquireSpinLock(&inject->FilterExt->AclFlowLock, &irql);
+        AclFlowOwnFailed(&inject->FilterExt->AclFlow, inject->Stream, HCI_ACL_HANDLE(inject->Data));
+        KeReleaseSpinLock(&inject->FilterExt->AclFlowLock, irql);
+
+        KeAcquireSpinLock(&inject->FilterExt->ActivateLock, &irql);
+        ActivateSendFailed(&inject->FilterExt->Activate, inject->Stream, HCI_ACL_HANDLE(inject->Data));
+        KeReleaseSpinLock(&inject->FilterExt->ActivateLock, irql);
+
+        FilterReleaseAclPackets(inject->FilterExt);
+    }
+
+    //
+    // Frees inject along with the request.
+    //
+    WdfObjectDelete(Request);
+}
+
+BOOLEAN
+FilterHoldAclPacket(
+    IN PFILTER_EXTENSION FilterExt,
+    IN WDFREQUEST        Request,
+    IN PUCHAR            Bfr,
+    IN ULONG             Length
+    )
+/*++
+Routine Description:
+
+    Counts an ACL packet the host sends against the controller's buffers,
+    or holds it while packets of ours leave no buffer for it or while it is
+    an ATT request that would cross a write of ours. Nothing goes past the
+    packets held already, FilterReleaseAclPackets sends on what can go in
+    the order it came.
+
+Return Value:
+
+    TRUE if the request is held and no longer the caller's.
+
+--*/
+{
+    PFILTER_REQUEST_CONTEXT context = FilterRequestGetData(Request);
+    PHCI_CONNECTION         conn;
+    WDFREQUEST              held;
+    NTSTATUS                status;
+    KIRQL                   irql;
+
+    if (Length < HCI_ACL_HEADER_LENGTH) {
+        return FALSE;
+    }
+
+    conn = HciLookupConnection(&FilterExt->LinkState, HCI_ACL_HANDLE(Bfr));
+
+    context->Stream = conn != NULL ? (ULONG)(conn - FilterExt->LinkState.Connections) : HCI_MAX_CONNECTIONS;
+    context->AclPacket = Bfr;
+    context->TransferBufferLength = Length;
+
+    KeAcquireSpinLock(&FilterExt->AclFlowLock, &irql);
+
+    status = WdfIoQueueFindRequest(FilterExt->HoldQueue, NULL, NULL, NULL, &held);
+    if (NT_SUCCESS(status)) {
+        WdfObjectDereference(held);
+    } else if (AclFlowHostMaySend(&FilterExt->AclFlow, context->Stream, HCI_ACL_HANDLE(Bfr)) &&
+               FilterActivateHostRequest(FilterExt, context->Stream, Bfr, Length)) {
+        AclFlowHostSent(&FilterExt->AclFlow, context->Stream, HCI_ACL_HANDLE(Bfr));
+        KeReleaseSpinLock(&FilterExt->AclFlowLock, irql);
+        return FALSE;
+    }
+
+    status = WdfRequestForwardToIoQueue(Request, FilterExt->HoldQueue);
+    if (!NT_SUCCESS(status)) {
+        //
+        // Goes down the way it always has.
+        //
+        AclFlowHostSent(&FilterExt->AclFlow, context->Stream, HCI_ACL_HANDLE(Bfr));
+    }
+
+    KeReleaseSpinLock(&FilterExt->AclFlowLock, irql);
+
+    if (!NT_SUCCESS(status)) {
+        return FALSE;
+    }
+
+    TRACEPOINT(TRACEPOINT_LEVEL_VERBOSE, TRACEPOINT_KEYWORD_ACTIVATE, TRACEPOINT_ACL_HOLD,
+               HCI_ACL_HANDLE(Bfr), Length, 0, 0);
+
+    //
+    // What held it may only have been packets of another connection.
+    //
+    FilterReleaseAclPackets(FilterExt);
+
+    return TRUE;
+}
+
+static WDFREQUEST
+FilterNextHeldRequest(
+    IN PFILTER_EXTENSION FilterExt
+    )
+/*++
+Routine Description:
+
+    Takes the oldest held packet that can go down now off the hold queue
+    and counts it. A connection whose oldest held packet has to wait keeps
+    the ones after it. Called with AclFlowLock held.
+
+--*/
+{
+    WDFREQUEST              found;
+    WDFREQUEST              previous = NULL;
+    WDFREQUEST              request = NULL;
+    PFILTER_REQUEST_CONTEXT context;
+    ULONG                   blocked = 0;
+    USHORT                  handle;
+
+    while (NT_SUCCESS(WdfIoQueueFindRequest(FilterExt->HoldQueue, previous, NULL, NULL, &found))) {
+        if (previous != NULL) {
+            WdfObjectDereference(previous);
+        }
+        previous = found;
+
+        context = FilterRequestGetData(found);
+        handle = HCI_ACL_HANDLE(context->AclPacket);
+
+        if (blocked & (1 << context->Stream)) {
+            continue;
+        }
+
+        if (!AclFlowHostMaySend(&FilterExt->AclFlow, context->Stream, handle) ||
+            !FilterActivateHostRequest(FilterExt, context->Stream, context->AclPacket, context->TransferBufferLength)) {
+            blocked |= 1 << context->Stream;
+            continue;
+        }
+
+        if (NT_SUCCESS(WdfIoQueueRetrieveFoundRequest(FilterExt->HoldQueue, found, &request))) {
+            AclFlowHostSent(&FilterExt->AclFlow, context->Stream, handle);
+        }
+        break;
+    }
+
+    if (previous != NULL) {
+        WdfObjectDereference(previous);
+    }
+
+    return request;
+}
+
+VOID
+FilterReleaseAclPackets(
+    IN PFILTER_EXTENSION FilterExt
+    )
+/*++
+Routine Description:
+
+    Sends whatever waits for a buffer of the controller and has one now,
+    our packets first. Called whenever buffers were freed or a write of
+    ours was answered, everything is sent with no lock held.
+
+--*/
+{
+    WDFIOTARGET target = WdfDeviceGetIoTarget(FilterExt->WdfDevice);
+    WDFREQUEST  request;
+    UCHAR       packet[ACTIVATE_MAX_PACKET];
+    ULONG       packetLength;
+    ULONG       stream;
+    KIRQL       irql;
+
+    for (;;) {
+        request = NULL;
+
+        KeAcquireSpinLock(&FilterExt->AclFlowLock, &irql);
+        packetLength = AclFlowNextWaiting(&FilterExt->AclFlow, &stream, packet);
+        if (packetLength == 0) {
+            request = FilterNextHeldRequest(FilterExt);
+        }
+        KeReleaseSpinLock(&FilterExt->AclFlowLock, irql);
+
+        if (packetLength != 0) {
+            FilterSendAclPacket(FilterExt, stream, packet, packetLength);
+            continue;
+        }
+
+        if (request == NULL) {
+            break;
+        }
+
+#if FORWARD_REQUEST_WITH_COMPLETION
+        FilterForwardRequestWithCompletionRoutine(request, target);
+#else
+        FilterForwardRequest(request, target);
+#endif
+    }
+}
+
+ULONG
+FilterAclFlowCompleted(
+    IN PFILTER_EXTENSION FilterExt,
+    IN PUCHAR            Bfr,
+    IN ULONG             Length
+    )
+/*++
+Routine Description:
+
+    Gives the buffers of a Number Of Completed Packets event back and takes
+    the completions of our packets out of it, then sends what waited for
+    the buffers. Every other event returns after a byte compare without
+    taking the lock.
+
+Return Value:
+
+    Length of the event for the host, 0 if it must not reach the host.
+
+--*/
+{
+    KIRQL   irql;
+    ULONG   length;
+
+    if (Length < HCI_EVENT_HEADER_LENGTH || Bfr[0] != HCI_EV_NUMBER_OF_COMPLETED_PACKETS) {
+        return Length;
+    }
+
+    KeAcquireSpinLock(&FilterExt->AclFlowLock, &irql);
+    length = AclFlowCompletedPackets(&FilterExt->AclFlow, Bfr, Length);
+    KeReleaseSpinLock(&FilterExt->AclFlowLock, irql);
+
+    FilterReleaseAclPackets(FilterExt);
+
+    return length;
+}
+
+VOID
+FilterHostPacketFailed(
+    IN PFILTER_EXTENSION FilterExt,
+    IN WDFREQUEST        Request
+    )
+/*++
+Routine Description:
+
+    A host packet the adapter failed never took the buffer it was counted
+    against, and an ATT request in it won't be answered, it counts as
+    unanswered and a write of ours waiting for it may go.
+
+--*/
+{
+    PFILTER_REQUEST_CONTEXT context = FilterRequestGetData(Request);
+    UCHAR                   packet[ACTIVATE_MAX_PACKET];
+    ULONG                   packetLength;
+    KIRQL                   irql;
+
+    FilterAttTrackSent(FilterExt,
+                       FILTER_ATT_ORIGIN_HOST,
+                       context->AclPacket,
+                       context->TransferBufferLength,
+                       FALSE);
+
+    KeAcquireSpinLock(&FilterExt->AclFlowLock, &irql);
+    AclFlowHostFailed(&FilterExt->AclFlow, context->Stream, HCI_ACL_HANDLE(context->AclPacket));
+    KeReleaseSpinLock(&FilterExt->AclFlowLock, irql);
+
+    KeAcquireSpinLock(&FilterExt->ActivateLock, &irql);
+    packetLength = ActivateHostFailed(&FilterExt->Activate,
+                                      context->Stream,
+                                      context->AclPacket,
+                                      context->TransferBufferLength,
+                                      packet);
+    KeReleaseSpinLock(&FilterExt->ActivateLock, irql);
+
+    if (packetLength != 0) {
+        FilterInjectAclPacket(FilterExt, context->Stream, packet, packetLength);
+    }
+
+    FilterReleaseAclPackets(FilterExt);
+}
+
+BOOLEAN
+FilterActivateHostRequest(
+    IN PFILTER_EXTENSION FilterExt,
+    IN ULONG             Stream,
+    IN PUCHAR            Bfr,
+    IN ULONG             Length
+    )
+/*++
+Routine Description:
+
+    Counts the ATT requests the host sends, so our writes wait for the
+    host's to be answered, and holds the host's back while a write of ours
+    is outstanding, until its response was hidden. Everything else returns
+    after a few byte compares without taking the lock. Called with
+    AclFlowLock held.
+
+Return Value:
+
+    FALSE if the request has to wait for the response to our write.
+
+--*/
+{
+    KIRQL   irql;
+    BOOLEAN send;
+
+    if (!HCI_IS_ATT_PDU(Bfr, Length) || !ATT_IS_REQUEST(Bfr[ATT_PDU_OFFSET]) ||
+        Stream >= HCI_MAX_CONNECTIONS) {
+        return TRUE;
+    }
+
+    KeAcquireSpinLock(&FilterExt->ActivateLock, &irql);
+    send = ActivateHostRequest(&FilterExt->Activate, Stream, Bfr, Length);
+    KeReleaseSpinLock(&FilterExt->ActivateLock, irql);
+
+    return send;
+}
+
+VOID
+FilterActivateByHost(
+    IN PFILTER_EXTENSION FilterExt,
+    IN USHORT            Handle
+    )
+/*++
+Routine Description:
+
+    The userland application sent the magic write, the remote on the
+    connection is one we can activate ourselves next time.
+
+--*/
+{
+    KIRQL           irql;
+    PHCI_CONNECTION conn;
+    ULONG           stream;
+    BOOLEAN         adopted;
+    UCHAR           peerAddressType;
+    UCHAR           peerAddress[6];
+
+    //
+    // The peer is copied under the lock, the slot may be reused after it.
+    //
+    KeAcquireSpinLock(&FilterExt->LinkStateLock, &irql);
+
+    conn = HciLookupConnection(&FilterExt->LinkState, Handle);
+    if (conn == NULL) {
+        KeReleaseSpinLock(&FilterExt->LinkStateLock, irql);
+        return;
+    }
+
+    stream = (ULONG)(conn - FilterExt->LinkState.Connections);
+    adopted = (conn->Flags & HCI_CONNECTION_ADOPTED) != 0;
+    peerAddressType = conn->PeerAddressType;
+    RtlCopyMemory(peerAddress, conn->PeerAddress, sizeof(peerAddress));
+
+    KeReleaseSpinLock(&FilterExt->LinkStateLock, irql);
+
+    KeAcquireSpinLock(&FilterExt->ActivateLock, &irql);
+    ActivateByHost(&FilterExt->Activate,
+                   stream,
+                   Handle,
+                   peerAddressType,
+                   adopted ? NULL : peerAddress,
+                   (LONGLONG)KeQueryInterruptTime());
+    KeReleaseSpinLock(&FilterExt->ActivateLock, irql);
+}
+
+BOOLEAN
+FilterActivateResponse(
+    IN PFILTER_EXTENSION FilterExt,
+    IN PUCHAR            Bfr,
+    IN ULONG             Length
+    )
+/*++
+Routine Description:
+
+    Passes ATT responses to the activation and sends the write that comes
+    next. Everything else returns after a few byte compares without taking
+    the lock.
+
+Return Value:
+
+    TRUE if the response is to a write of ours and must not reach the host.
+
+--*/
+{
+    KIRQL                   irql;
+    PHCI_CONNECTION         conn;
+    PACTIVATE_CONNECTION    activate;
+    ULONG                   stream;
+    UCHAR                   packet[ACTIVATE_MAX_PACKET];
+    ULONG                   packetLength;
+    BOOLEAN                 hide;
+    UCHAR                   state;
+    UCHAR                   error;
+    USHORT                  activateMs;
+
+    if (!HCI_IS_ATT_PDU(Bfr, Length) || !ATT_IS_RESPONSE(Bfr[ATT_PDU_OFFSET])) {
+        return FALSE;
+    }
+
+    conn = HciLookupConnection(&FilterExt->LinkState, HCI_ACL_HANDLE(Bfr));
+    if (conn == NULL) {
+        return FALSE;
+    }
+
+    stream = (ULONG)(conn - FilterExt->LinkState.Connections);
+    activate = &FilterExt->Activate.Connections[stream];
+
+    KeAcquireSpinLock(&FilterExt->ActivateLock, &irql);
+    hide = ActivateResponse(&FilterExt->Activate,
+                            stream,
+                            Bfr,
+                            Length,
+                            (LONGLONG)KeQueryInterruptTime(),
+                            packet,
+                            &packetLength);
+    state = activate->State;
+    error = activate->Error;
+    activateMs = activate->ActivateMs;
+    KeReleaseSpinLock(&FilterExt->ActivateLock, irql);
+
+    if (hide) {
+        TRACEPOINT(TRACEPOINT_LEVEL_INFO, TRACEPOINT_KEYWORD_ACTIVATE, TRACEPOINT_ACTIVATE_RESPONSE,
+                   HCI_ACL_HANDLE(Bfr), state, error, activateMs);
+    }
+
+    if (packetLength != 0) {
+        FilterInjectAclPacket(FilterExt, stream, packet, packetLength);
+    }
+
+    //
+    // Host requests held back behind ours may go now.
+    //
+    if (hide) {
+        FilterReleaseAclPackets(FilterExt);
+    }
+
+    return hide;
+}
+
+NTSTATUS
+FilterSetActivateConfig(
+    IN PFILTER_ACTIVATE_CONFIG Config
+    )
+/*++
+Routine Description:
+
+    Applies the activation configuration to every adapter and keeps it for
+    the adapters still to come.
+
+--*/
+{
+    KIRQL               irql;
+    ULONG               i;
+    ULONG               noItems;
+    PFILTER_EXTENSION   filterExt;
+
+    if (Config->PeerCount > FILTER_ACTIVATE_MAX_PEERS) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    WdfWaitLockAcquire(FilterDeviceCollectionLock, NULL);
+
+    FilterActivateConfig = *Config;
+
+    noItems = WdfCollectionGetCount(FilterDeviceCollection);
+
+    for (i = 0; i < noItems; i++) {
+        filterExt = FilterGetData(WdfCollectionGetItem(FilterDeviceCollection, i));
+
+        KeAcquireSpinLock(&filterExt->ActivateLock, &irql);
+        ActivateConfigure(&filterExt->Activate, Config);
+        KeReleaseSpinLock(&filterExt->ActivateLock, irql);
+    }
+
+    WdfWaitLockRelease(FilterDeviceCollectionLock);
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+FilterAttTrackRequest(
+    IN PFILTER_EXTENSION FilterExt,
+    IN UCHAR             Origin,
+    IN PUCHAR            Bfr,
+    IN ULONG             Length
+    )
+/*++
+Routine Description:
+
+    Starts timing an ATT request going down. Everything else returns after
+    a few byte compares without taking the lock.
+
+--*/
+{
+    KIRQL           irql;
+    PHCI_CONNECTION conn;
+
+    if (!HCI_IS_ATT_PDU(Bfr, Length) || !ATT_IS_REQUEST(Bfr[ATT_PDU_OFFSET])) {
+        return;
+    }
+
+    conn = HciLookupConnection(&FilterExt->LinkState, HCI_ACL_HANDLE(Bfr));
+    if (conn == NULL) {
+        return;
+    }
+
+    KeAcquireSpinLock(&FilterExt->AttTrackLock, &irql);
+    AttTrackRequest(&FilterExt->AttTrack,
+                    (ULONG)(conn - FilterExt->LinkState.Connections),
+                    Origin,
+                    Bfr,
+                    Length,
+                    (LONGLONG)KeQueryInterruptTime());
+    KeReleaseSpinLock(&FilterExt->AttTrackLock, irql);
+}
+
+VOID
+FilterAttTrackSent(
+    IN PFILTER_EXTENSION FilterExt,
+    IN UCHAR             Origin,
+    IN PUCHAR            Bfr,
+    IN ULONG             Length,
+    IN BOOLEAN           Success
+    )
+/*++
+Routine Description:
+
+    Notes when the adapter completed the transfer of an ATT request, or
+    that it failed.
+
+--*/
+{
+    KIRQL           irql;
+    PHCI_CONNECTION conn;
+
+    if (!HCI_IS_ATT_PDU(Bfr, Length) || !ATT_IS_REQUEST(Bfr[ATT_PDU_OFFSET])) {
+        return;
+    }
+
+    conn = HciLookupConnection(&FilterExt->LinkState, HCI_ACL_HANDLE(Bfr));
+    if (conn == NULL) {
+        return;
+    }
+
+    KeAcquireSpinLock(&FilterExt->AttTrackLock, &irql);
+    AttTrackSent(&FilterExt->AttTrack,
+                 (ULONG)(conn - FilterExt->LinkState.Connections),
+                 Origin,
+                 Bfr,
+                 Length,
+                 Success,
+                 (LONGLONG)KeQueryInterruptTime());
+    KeReleaseSpinLock(&FilterExt->AttTrackLock, irql);
+}
+
+VOID
+FilterAttTrackResponse(
+    IN PFILTER_EXTENSION FilterExt,
+    IN PUCHAR            Bfr,
+    IN ULONG             Length
+    )
+/*++
+Routine Description:
+
+    Stops timing the request an ATT response answers, the filter's own
+    writes included.
+
+--*/
+{
+    KIRQL           irql;
+    PHCI_CONNECTION conn;
+
+    if (!HCI_IS_ATT_PDU(Bfr, Length) || !ATT_IS_RESPONSE(Bfr[ATT_PDU_OFFSET])) {
+        return;
+    }
+
+    conn = HciLookupConnection(&FilterExt->LinkState, HCI_ACL_HANDLE(Bfr));
+    if (conn == NULL) {
+        return;
+    }
+
+    KeAcquireSpinLock(&FilterExt->AttTrackLock, &irql);
+    AttTrackResponse(&FilterExt->AttTrack,
+                     (ULONG)(conn - FilterExt->LinkState.Connections),
+                     Bfr,
+                     Length,
+                     (LONGLONG)KeQueryInterruptTime());
+    KeReleaseSpinLock(&FilterExt->AttTrackLock, irql);
+}
+
+VOID
+FilterGetAttStats(
+    IN PFILTER_EXTENSION    FilterExt,
+    OUT PFILTER_ATT_STATS   Stats
+    )
+/*++
+Routine Description:
+
+    Fills in the ATT round trips of the adapter for IOCTL_GET_ATT_STATS.
+
+--*/
+{
+    KIRQL irql;
+
+    KeAcquireSpinLock(&FilterExt->AttTrackLock, &irql);
+    AttTrackGetStats(&FilterExt->AttTrack, (LONGLONG)KeQueryInterruptTime(), Stats);
+    KeReleaseSpinLock(&FilterExt->AttTrackLock, irql);
+}
+
+VOID
+FilterWatchdogNotification(
+    IN PFILTER_EXTENSION FilterExt,
+    IN PUCHAR            Bfr,
+    IN ULONG             AttLength
+    )
+/*++
+Routine Description:
+
+    Tells the watchdog about a hid notification passed up, and starts its
+    timer when a connection starts streaming.
+
+Arguments:
+
+    AttLength - ATT length of the notification as the upper stack gets it.
+
+--*/
+{
+    KIRQL           irql;
+    PHCI_CONNECTION conn;
+    BOOLEAN         schedule;
+    ULONG           period;
+
+    conn = HciLookupConnection(&FilterExt->LinkState, HCI_ACL_HANDLE(Bfr));
+    if (conn == NULL) {
+        return;
+    }
+
+    KeAcquireSpinLock(&FilterExt->WatchdogLock, &irql);
+    schedule = WatchdogNotification(&FilterExt->Watchdog,
+                                    (ULONG)(conn - FilterExt->LinkState.Connections),
+                                    HCI_ACL_HANDLE(Bfr),
+                                    AttLength,
+                                    (LONGLONG)KeQueryInterruptTime());
+    period = WatchdogPeriod(&FilterExt->Watchdog);
+    KeReleaseSpinLock(&FilterExt->WatchdogLock, irql);
+
+    if (schedule) {
+        WdfTimerStart(FilterExt->WatchdogTimer, WDF_REL_TIMEOUT_IN_MS(period));
+    }
+}
+
+VOID
+FilterEvtWatchdogTimer(
+    IN WDFTIMER Timer
+    )
+/*++
+Routine Description:
+
+    Looks for stalled connections and carries out the configured actions
+    on them. Runs again while a connection still streams.
+
+--*/
+{
+    PFILTER_EXTENSION   filterExt = FilterGetData(WdfTimerGetParentObject(Timer));
+    WATCHDOG_STALL      stalls[HCI_MAX_CONNECTIONS];
+    LONGLONG            now = (LONGLONG)KeQueryInterruptTime();
+    KIRQL               irql;
+    ULONG               count;
+    ULONG               actions;
+    ULONG               period;
+    ULONG               i;
+    BOOLEAN             reschedule;
+    BOOLEAN             triggered;
+    BOOLEAN             fixed;
+
+    KeAcquireSpinLock(&filterExt->WatchdogLock, &irql);
+    count = WatchdogCheck(&filterExt->Watchdog, now, stalls, &reschedule);
+    actions = filterExt->Watchdog.Config.Actions;
+    period = WatchdogPeriod(&filterExt->Watchdog);
+    KeReleaseSpinLock(&filterExt->WatchdogLock, irql);
+
+    for (i = 0; i < count; i++) {
+        triggered = FALSE;
+        fixed = FALSE;
+
+        if (actions & FILTER_WATCHDOG_ACTION_TRIGGER) {
+            KeAcquireSpinLock(&filterExt->CaptureLock, &irql);
+            triggered = CaptureTrigger(&filterExt->Capture,
+                                       FILTER_CAPTURE_TRIGGER_WATCHDOG,
+                                       stalls[i].Handle,
+                                       now);
+            KeReleaseSpinLock(&filterExt->CaptureLock, irql);
+        }
+
+        //
+        // Off means the userland application wants notifications untouched.
+        //
+        if ((actions & FILTER_WATCHDOG_ACTION_FIX) &&
+            FIX_HCI_L2CAP_HEADERS != FIX_HCI_L2CAP_HEADERS_MODE_OFF) {
+            KeAcquireSpinLock(&filterExt->LinkStateLock, &irql);
+            fixed = HciForceFixAttLength(&filterExt->LinkState, stalls[i].Handle);
+            KeReleaseSpinLock(&filterExt->LinkStateLock, irql);
+        }
+
+        TRACEPOINT(TRACEPOINT_LEVEL_ERROR, TRACEPOINT_KEYWORD_ERROR, TRACEPOINT_WATCHDOG_STALL,
+                   stalls[i].Handle, stalls[i].GapMs,
+                   (triggered ? FILTER_WATCHDOG_ACTION_TRIGGER : 0) | (fixed ? FILTER_WATCHDOG_ACTION_FIX : 0), 0);
+
+        KdPrint(("Handle 0x%x stalled for %d ms%s%s\n",
+            stalls[i].Handle, stalls[i].GapMs,
+            triggered ? ", capture triggered" : "",
+            fixed ? ", header fix applied" : ""));
+    }
+
+    if (reschedule) {
+        WdfTimerStart(Timer, WDF_REL_TIMEOUT_IN_MS(period));
+    }
+}
+
+NTSTATUS
+FilterSetWatchdogConfig(
+    IN PFILTER_WATCHDOG_CONFIG Config
+    )
+/*++
+Routine Description:
+
+    Applies the watchdog configuration to every adapter and keeps it for
+    the adapters still to come.
+
+--*/
+{
+    KIRQL               irql;
+    ULONG               i;
+    ULONG               noItems;
+    PFILTER_EXTENSION   filterExt;
+
+    if ((Config->Actions & ~FILTER_WATCHDOG_ACTION_DEFAULT) != 0 ||
+        (Config->Flags & ~FILTER_WATCHDOG_ANY_GAP) != 0) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    WdfWaitLockAcquire(FilterDeviceCollectionLock, NULL);
+
+    FilterWatchdogConfig = *Config;
+
+    noItems = WdfCollectionGetCount(FilterDeviceCollection);
+
+    for (i = 0; i < noItems; i++) {
+        filterExt = FilterGetData(WdfCollectionGetItem(FilterDeviceCollection, i));
+
+        KeAcquireSpinLock(&filterExt->WatchdogLock, &irql);
+        WatchdogConfigure(&filterExt->Watchdog, Config);
+        KeReleaseSpinLock(&filterExt->WatchdogLock, irql);
+    }
+
+    WdfWaitLockRelease(FilterDeviceCollectionLock);
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+FilterVoiceStatsFrame(
+    IN PFILTER_EXTENSION FilterExt,
+    IN PUCHAR            Bfr,
+    IN ULONG             Length,
+    IN ULONG             FixAttLength
+    )
+/*++
+Routine Description:
+
+    Counts a voice notification in the session of its connection.
+
+Arguments:
+
+    Length - Length of the packet as it came in, its headers may already
+        be trimmed.
+
+    FixAttLength - ATT length the header fix trimmed it to, 0 if it didn't.
+
+--*/
+{
+    KIRQL           irql;
+    PHCI_CONNECTION conn;
+    ULONG           valueLength;
+
+    conn = HciLookupConnection(&FilterExt->LinkState, HCI_ACL_HANDLE(Bfr));
+    if (conn == NULL || Length < ATT_PDU_OFFSET + 3) {
+        return;
+    }
+
+    valueLength = Length - ATT_PDU_OFFSET - 3;
+
+    KeAcquireSpinLock(&FilterExt->VoiceStatsLock, &irql);
+    VoiceStatsFrame(&FilterExt->VoiceStats,
+                    (ULONG)(conn - FilterExt->LinkState.Connections),
+                    HCI_ACL_HANDLE(Bfr),
+                    ATT_HANDLE(Bfr),
+                    Bfr + ATT_PDU_OFFSET + 3,
+                    valueLength,
+                    valueLength,
+                    FixAttLength != 0 ? FixAttLength - 3 : valueLength,
+                    (LONGLONG)KeQueryInterruptTime());
+    KeReleaseSpinLock(&FilterExt->VoiceStatsLock, irql);
+}
+
+NTSTATUS
+FilterSetVoiceConfig(
+    IN PFILTER_VOICE_CONFIG Config
+    )
+/*++
+Routine Description:
+
+    Applies the voice accounting configuration to every adapter and keeps
+    it for the adapters still to come.
+
+--*/
+{
+    KIRQL               irql;
+    ULONG               i;
+    ULONG               noItems;
+    PFILTER_EXTENSION   filterExt;
+
+    WdfWaitLockAcquire(FilterDeviceCollectionLock, NULL);
+
+    FilterVoiceConfig = *Config;
+
+    noItems = WdfCollectionGetCount(FilterDeviceCollection);
+
+    for (i = 0; i < noItems; i++) {
+        filterExt = FilterGetData(WdfCollectionGetItem(FilterDeviceCollection, i));
+
+        KeAcquireSpinLock(&filterExt->VoiceStatsLock, &irql);
+        VoiceStatsConfigure(&filterExt->VoiceStats, Config);
+        KeReleaseSpinLock(&filterExt->VoiceStatsLock, irql);
+    }
+
+    WdfWaitLockRelease(FilterDeviceCollectionLock);
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+FilterGetVoiceStats(
+    IN PFILTER_EXTENSION    FilterExt,
+    OUT PFILTER_VOICE_STATS Stats
+    )
+/*++
+Routine Description:
+
+    Fills in the voice sessions of the adapter for IOCTL_GET_VOICE_STATS.
+
+--*/
+{
+    KIRQL irql;
+
+    KeAcquireSpinLock(&FilterExt->VoiceStatsLock, &irql);
+    VoiceStatsGet(&FilterExt->VoiceStats, (LONGLONG)KeQueryInterruptTime(), Stats);
+    KeReleaseSpinLock(&FilterExt->VoiceStatsLock, irql);
+}
+
+VOID
+FilterInstallReportMap(
+    IN PFILTER_EXTENSION FilterExt,
+    IN ULONG             Stream
+    )
+/*++
+Routine Description:
 
-						if (pBulkOrInterruptTransfer->TransferBufferLength == 13)
-						{
-							//intercept a write with response request and replace with our write
-							//---HCI----- ---L2CAP--- -----ATT------
-							//80 00 09 00 05 00 04 00 12 29 00 01 00
+    Compiles the Report Map of a connection and decodes its reports with
+    the layout from then on. A map that doesn't compile, or has no buttons
+    or trackpad in it, leaves the connection with the fixed layout.
 
-							unsigned char * Bfr = (PUCHAR)pBulkOrInterruptTransfer->TransferBuffer;
+    Called with ReportMapLock held.
 
-							if (Bfr[0] == 0x80 &&
-								Bfr[1] == 0x00 &&
-								Bfr[2] == 0x09 &&
-								Bfr[3] == 0x00 &&
-								Bfr[4] == 0x05 &&
-								Bfr[5] == 0x00 &&
-								Bfr[6] == 0x04 &&
-								Bfr[7] == 0x00 &&
-								Bfr[8] == 0x12 &&
-								Bfr[9] == 0x29 &&
-								Bfr[10] == 0x00 &&
-								Bfr[11] == 0x01 &&
-								Bfr[12] == 0x00)
-							{
-								KdPrint(("Writing 0x0100 to att handle 0x24 (hid notify)\n"));
-								Bfr[9] = 0x24; //change att handle from 0x29 to 0x24
-							}
-						}
+--*/
+{
+    KIRQL               irql;
+    PFILTER_REPORT_MAP  map = &FilterExt->ReportSnoop.Connections[Stream].Map;
+    PCOALESCE_LAYOUT    layout = &FilterExt->Layouts[Stream];
+    BOOLEAN             compiled;
 
+    map->Flags = 0;
 
-						/*
-						if (pBulkOrInterruptTransfer->TransferBufferLength == 11)
-						{
-							//intercept a mtu request
-							//---HCI----- ---L2CAP--- --ATT---
-							//80 00 07 00 03 00 04 00 02 0d 02
+    compiled = ReportMapCompile(&FilterExt->ReportMapScratch, map->Map, map->Length);
 
-							unsigned char * Bfr = (PUCHAR)pBulkOrInterruptTransfer->TransferBuffer;
+    KeAcquireSpinLock(&FilterEventLock, &irql);
 
-							if (Bfr[0] == 0x80 &&
-								Bfr[1] == 0x00 &&
-								Bfr[2] == 0x07 &&
-								Bfr[3] == 0x00 &&
-								Bfr[4] == 0x03 &&
-								Bfr[5] == 0x00 &&
-								Bfr[6] == 0x04 &&
-								Bfr[7] == 0x00 &&
-								Bfr[8] == 0x02 &&
-								Bfr[9] == 0x0d &&
-								Bfr[10] == 0x02)
-							{
-								KdPrint(("Changing mtu request from 525 0x20D to 104 0x68\n"));
-								Bfr[9] = 0x68;
-								Bfr[10] = 0x00;
-							}
-						}
-						*/
+    if (compiled) {
+        map->Flags |= FILTER_REPORT_MAP_COMPILED;
 
-						Dump(USBD_TRANSFER_DIRECTION_OUT, (PUCHAR)pBulkOrInterruptTransfer->TransferBuffer, pBulkOrInterruptTransfer->TransferBufferLength);
-					}
-					else if (pBulkOrInterruptTransfer->TransferBufferMDL)
-					{
-						KdPrint(("TransferBuffer has MDL specified.\n"));
+        if (CoalesceCompileLayout(layout, map->Handle, &FilterExt->ReportMapScratch)) {
+            map->Flags |= FILTER_REPORT_MAP_DECODING;
+        }
+    } else {
+        RtlZeroMemory(layout, sizeof(COALESCE_LAYOUT));
+        layout->Handle = HCI_INVALID_HANDLE;
+    }
 
-						#pragma warning(disable : 4995) //MmGetSystemAddressForMdl is deprecated so ignore warning
-						PUCHAR pMDLBuf = (PUCHAR)MmGetSystemAddressForMdl(pBulkOrInterruptTransfer->TransferBufferMDL);
-						if (pMDLBuf)
-						{
-							Dump(USBD_TRANSFER_DIRECTION_OUT, pMDLBuf, pBulkOrInterruptTransfer->TransferBufferLength);
-						}
-						else
-						{
-							KdPrint(("Could not get MmGetSystemAddressForMdl.\n"));
-						}
-					}
-					else
-					{
-						KdPrint(("Both flat and MDL not specified.\n"));
-					}
+    KeReleaseSpinLock(&FilterEventLock, irql);
 
-				}
-				else
-				{
-					KdPrint(("NoTransferBuffer\n"));
-				}
+    KdPrint(("Report map of handle 0x%x, %d bytes, %s\n",
+        map->Handle,
+        map->Length,
+        (map->Flags & FILTER_REPORT_MAP_DECODING) ? "decoding" :
+        (map->Flags & FILTER_REPORT_MAP_COMPILED) ? "nothing to decode" : "not compiled"));
+}
+
+VOID
+FilterReportSnoopRequest(
+    IN PFILTER_EXTENSION FilterExt,
+    IN PUCHAR            Bfr,
+    IN ULONG             Length
+    )
+/*++
+Routine Description:
 
+    Follows the host's discovery and reads of the Report Map going down.
 
-				break;
-			}
-			case URB_FUNCTION_CLASS_DEVICE: {
-				// My code Here
-				KdPrint(("URB_FUNCTION_CLASS_DEVICE\n"));
-				break;
-			}
-			default:
-				KdPrint(("URB_FUNCTION_UNKNOWN\n"));
-				break;
-			}
-		}
-		default:
-			//status = STATUS_INVALID_DEVICE_REQUEST;
-			break;
-	}
+--*/
+{
+    KIRQL           irql;
+    PHCI_CONNECTION conn;
+    ULONG           stream;
 
-	if (!NT_SUCCESS(status)) {
-		WdfRequestComplete(Request, status);
-		return;
-	}
+    if (!HCI_IS_ATT_PDU(Bfr, Length) || !ATT_IS_REQUEST(Bfr[ATT_PDU_OFFSET])) {
+        return;
+    }
 
-	//
-	// Forward the request down. WdfDeviceGetIoTarget returns
-	// the default target, which represents the device attached to us below in
-	// the stack.
-	//
-#if FORWARD_REQUEST_WITH_COMPLETION
-	//
-	// Use this routine to forward a request if you are interested in post
-	// processing the IRP.
-	//
-	FilterForwardRequestWithCompletionRoutine(Request,
-		WdfDeviceGetIoTarget(device));
-#else
-	FilterForwardRequest(Request, WdfDeviceGetIoTarget(device));
-#endif
+    conn = HciLookupConnection(&FilterExt->LinkState, HCI_ACL_HANDLE(Bfr));
+    if (conn == NULL) {
+        return;
+    }
 
-	return;
+    stream = (ULONG)(conn - FilterExt->LinkState.Connections);
+
+    KeAcquireSpinLock(&FilterExt->ReportMapLock, &irql);
+
+    if (ReportSnoopRequest(&FilterExt->ReportSnoop, stream, Bfr, Length)) {
+        FilterInstallReportMap(FilterExt, stream);
+    }
+
+    KeReleaseSpinLock(&FilterExt->ReportMapLock, irql);
+}
+
+VOID
+FilterReportSnoopResponse(
+    IN PFILTER_EXTENSION FilterExt,
+    IN PUCHAR            Bfr,
+    IN ULONG             Length
+    )
+/*++
+Routine Description:
+
+    Picks the Report Map out of the responses to the host's reads coming
+    up.
+
+--*/
+{
+    KIRQL           irql;
+    PHCI_CONNECTION conn;
+    ULONG           stream;
+    ULONG           mtu;
+
+    if (!HCI_IS_ATT_PDU(Bfr, Length) || !ATT_IS_RESPONSE(Bfr[ATT_PDU_OFFSET])) {
+        return;
+    }
+
+    conn = HciLookupConnection(&FilterExt->LinkState, HCI_ACL_HANDLE(Bfr));
+    if (conn == NULL) {
+        return;
+    }
+
+    stream = (ULONG)(conn - FilterExt->LinkState.Connections);
+    mtu = (conn->LocalMtu != 0 && conn->RemoteMtu != 0) ?
+          min(conn->LocalMtu, conn->RemoteMtu) : ATT_DEFAULT_LE_MTU;
+
+    KeAcquireSpinLock(&FilterExt->ReportMapLock, &irql);
+
+    if (ReportSnoopResponse(&FilterExt->ReportSnoop, stream, Bfr, Length, mtu)) {
+        FilterInstallReportMap(FilterExt, stream);
+    }
+
+    KeReleaseSpinLock(&FilterExt->ReportMapLock, irql);
+}
+
+NTSTATUS
+FilterSetReportMap(
+    IN PFILTER_REPORT_MAP Map
+    )
+/*++
+Routine Description:
+
+    Gives a connection a Report Map, for a host that kept the remote's
+    GATT database and doesn't read the map again.
+
+--*/
+{
+    KIRQL               irql;
+    ULONG               i;
+    ULONG               noItems;
+    ULONG               stream;
+    PFILTER_EXTENSION   filterExt;
+    PHCI_CONNECTION     conn;
+    NTSTATUS            status = STATUS_NOT_FOUND;
+
+    if (Map->Length == 0 || Map->Length > FILTER_REPORT_MAP_MAX) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    WdfWaitLockAcquire(FilterDeviceCollectionLock, NULL);
+
+    noItems = WdfCollectionGetCount(FilterDeviceCollection);
+
+    for (i = 0; i < noItems; i++) {
+        filterExt = FilterGetData(WdfCollectionGetItem(FilterDeviceCollection, i));
+
+        conn = HciLookupConnection(&filterExt->LinkState, Map->Handle);
+        if (conn == NULL) {
+            continue;
+        }
+
+        stream = (ULONG)(conn - filterExt->LinkState.Connections);
+
+        KeAcquireSpinLock(&filterExt->ReportMapLock, &irql);
+
+        ReportSnoopSet(&filterExt->ReportSnoop, stream, Map->Handle, Map->Map, Map->Length);
+        FilterInstallReportMap(filterExt, stream);
+
+        status = (filterExt->ReportSnoop.Connections[stream].Map.Flags & FILTER_REPORT_MAP_COMPILED) ?
+                 STATUS_SUCCESS : STATUS_INVALID_PARAMETER;
+
+        KeReleaseSpinLock(&filterExt->ReportMapLock, irql);
+        break;
+    }
+
+    WdfWaitLockRelease(FilterDeviceCollectionLock);
+
+    return status;
+}
+
+VOID
+FilterGetReportMaps(
+    IN PFILTER_EXTENSION    FilterExt,
+    OUT PFILTER_REPORT_MAPS Maps
+    )
+/*++
+Routine Description:
+
+    Fills in the Report Maps of the adapter's connections for
+    IOCTL_GET_REPORT_MAPS.
+
+--*/
+{
+    KIRQL irql;
+
+    KeAcquireSpinLock(&FilterExt->ReportMapLock, &irql);
+    ReportSnoopGet(&FilterExt->ReportSnoop, Maps);
+    KeReleaseSpinLock(&FilterExt->ReportMapLock, irql);
+}
+
+VOID
+FilterGetAdapterInfo(
+    IN PFILTER_EXTENSION    FilterExt,
+    OUT PFILTER_ADAPTER_INFO Info
+    )
+/*++
+Routine Description:
+
+    Fills in what we know about the adapter for IOCTL_GET_ADAPTER_INFO.
+
+--*/
+{
+    KIRQL               irql;
+    PHCI_LINK_STATE     state = &FilterExt->LinkState;
+    ULONG               slots[HCI_MAX_CONNECTIONS];
+    ULONG               i;
+
+    C_ASSERT(HCI_MAX_CONNECTIONS == FILTER_MAX_CONNECTIONS);
+
+    RtlZeroMemory(Info, sizeof(FILTER_ADAPTER_INFO));
+
+    KeAcquireSpinLock(&FilterExt->LinkStateLock, &irql);
+
+    Info->Flags = state->Adapter.Flags;
+    Info->FixMode = FIX_HCI_L2CAP_HEADERS;
+    Info->HciVersion = state->Adapter.HciVersion;
+    Info->LmpVersion = state->Adapter.LmpVersion;
+    Info->Manufacturer = state->Adapter.Manufacturer;
+    Info->LmpSubversion = state->Adapter.LmpSubversion;
+    Info->AclDataPacketLength = state->Adapter.AclDataPacketLength;
+    Info->LeAclDataPacketLength = state->Adapter.LeAclDataPacketLength;
+    Info->DefaultFixAttLength = state->DefaultFixAttLength;
+
+    for (i = 0; i < HCI_MAX_CONNECTIONS; i++) {
+        PHCI_CONNECTION conn = &state->Connections[i];
+        PFILTER_CONNECTION_INFO connInfo;
+
+        if (conn->Handle == HCI_INVALID_HANDLE) {
+            continue;
+        }
+
+        slots[Info->ConnectionCount] = i;
+        connInfo = &Info->Connections[Info->ConnectionCount++];
+        connInfo->Handle = conn->Handle;
+        connInfo->Flags = conn->Flags;
+        connInfo->PeerAddressType = conn->PeerAddressType;
+        RtlCopyMemory(connInfo->PeerAddress, conn->PeerAddress, sizeof(connInfo->PeerAddress));
+        connInfo->AttMtu = (conn->LocalMtu != 0 && conn->RemoteMtu != 0) ?
+                           min(conn->LocalMtu, conn->RemoteMtu) : 0;
+        connInfo->FixAttLength = conn->FixAttLength;
+    }
+
+    KeReleaseSpinLock(&FilterExt->LinkStateLock, irql);
+
+    KeAcquireSpinLock(&FilterExt->ActivateLock, &irql);
+
+    for (i = 0; i < Info->ConnectionCount; i++) {
+        PACTIVATE_CONNECTION activate = &FilterExt->Activate.Connections[slots[i]];
+
+        if (activate->Handle == Info->Connections[i].Handle) {
+            Info->Connections[i].ActivateState = activate->State;
+            Info->Connections[i].ActivateError = activate->Error;
+            Info->Connections[i].ActivateMs = activate->ActivateMs;
+        }
+    }
+
+    KeReleaseSpinLock(&FilterExt->ActivateLock, irql);
+
+    KeAcquireSpinLock(&FilterExt->WatchdogLock, &irql);
+
+    Info->Stalls = FilterExt->Watchdog.Stalls;
+    Info->Recoveries = FilterExt->Watchdog.Recoveries;
+
+    for (i = 0; i < Info->ConnectionCount; i++) {
+        PWATCHDOG_STREAM stream = &FilterExt->Watchdog.Streams[slots[i]];
+
+        if (stream->Handle == Info->Connections[i].Handle) {
+            Info->Connections[i].Stalls = stream->Stalls;
+        }
+    }
+
+    KeReleaseSpinLock(&FilterExt->WatchdogLock, irql);
 }
 
 VOID
@@ -991,7 +3679,19 @@ Routine Description:
 
     if (ret == FALSE) {
         status = WdfRequestGetStatus (Request);
-        KdPrint( ("WdfRequestSend failed: 0x%x\n", status));
+        TRACEPOINT(TRACEPOINT_LEVEL_ERROR, TRACEPOINT_KEYWORD_ERROR, TRACEPOINT_SEND_FAILED,
+                   TRACEPOINT_STATUS(status), 0, 0, 0);
+        FilterCaptureTrigger(FilterGetData(WdfIoTargetGetDevice(Target)),
+                             FILTER_CAPTURE_TRIGGER_SEND_FAILURE);
+
+        //
+        // It never went down, give back the buffer it was counted
+        // against.
+        //
+        if (FilterRequestGetData(Request)->AclPacket != NULL) {
+            FilterHostPacketFailed(FilterGetData(WdfIoTargetGetDevice(Target)), Request);
+        }
+
         WdfRequestComplete(Request, status);
     }
 
@@ -1034,7 +3734,19 @@ Routine Description:
 
     if (ret == FALSE) {
         status = WdfRequestGetStatus (Request);
-        KdPrint( ("WdfRequestSend failed: 0x%x\n", status));
+        TRACEPOINT(TRACEPOINT_LEVEL_ERROR, TRACEPOINT_KEYWORD_ERROR, TRACEPOINT_SEND_FAILED,
+                   TRACEPOINT_STATUS(status), 0, 0, 0);
+        FilterCaptureTrigger(FilterGetData(WdfIoTargetGetDevice(Target)),
+                             FILTER_CAPTURE_TRIGGER_SEND_FAILURE);
+
+        //
+        // It never went down, give back the buffer it was counted
+        // against.
+        //
+        if (FilterRequestGetData(Request)->AclPacket != NULL) {
+            FilterHostPacketFailed(FilterGetData(WdfIoTargetGetDevice(Target)), Request);
+        }
+
         WdfRequestComplete(Request, status);
     }
 
@@ -1068,21 +3780,38 @@ Return Value:
 
 --*/
 {
-    UNREFERENCED_PARAMETER(Target);
     UNREFERENCED_PARAMETER(Context);
 
 	//WDFMEMORY   buffer = CompletionParams->Parameters.Ioctl.Output.Buffer;
 	NTSTATUS    status = CompletionParams->IoStatus.Status;
+	BOOLEAN     hide = FALSE;
+
+	//Stamped before anything else, the latency of events counts from here
+	LONGLONG    stamp = FilterEventConfig.Enable ? KeQueryPerformanceCounter(NULL).QuadPart : 0;
 
-	KdPrint(("SiriRemote Lower Filter Driver - FilterRequestCompletionRoutine"));
+	PFILTER_EXTENSION filterExt = FilterGetData(WdfIoTargetGetDevice(Target));
 
 	PIO_STACK_LOCATION stack = IoGetCurrentIrpStackLocation(WdfRequestWdmGetIrp(Request));
 
+	if (stack->Parameters.DeviceIoControl.IoControlCode == IOCTL_INTERNAL_USB_SUBMIT_URB) {
+		PURB pCompletedUrb = (PURB)stack->Parameters.Others.Argument1;
+
+		TRACEPOINT(TRACEPOINT_LEVEL_VERBOSE, TRACEPOINT_KEYWORD_URB, TRACEPOINT_URB_COMPLETE,
+			TRACEPOINT_PTR(pCompletedUrb),
+			pCompletedUrb->UrbHeader.Function,
+			TRACEPOINT_STATUS(status),
+			pCompletedUrb->UrbHeader.Function == URB_FUNCTION_BULK_OR_INTERRUPT_TRANSFER ? pCompletedUrb->UrbBulkOrInterruptTransfer.TransferBufferLength : 0);
+	}
+
 	//KdPrint(("CompletionParams->Type: %x\n", CompletionParams->Type)); //Types: WdfRequestTypeDeviceControlInternal
 	//KdPrint(("Parameters.Ioctl.Output.Length: %d\n", CompletionParams->Parameters.Ioctl.Output.Length));
 	//KdPrint(("Parameters.Ioctl.IoControlCode: %x (%lu)\n", CompletionParams->Parameters.Ioctl.IoControlCode, CompletionParams->Parameters.Ioctl.IoControlCode));
 	//KdPrint(("stack->Parameters.DeviceIoControl.IoControlCode: %x (%lu)\n", stack->Parameters.DeviceIoControl.IoControlCode, stack->Parameters.DeviceIoControl.IoControlCode));
 
+	//A packet the adapter failed never took the buffer it was counted against
+	if (!NT_SUCCESS(status) && FilterRequestGetData(Request)->AclPacket != NULL)
+		FilterHostPacketFailed(filterExt, Request);
+
 	//CompletionParams->Parameters.Ioctl.IoControlCode
 	if (NT_SUCCESS(status) &&
 		stack->Parameters.DeviceIoControl.IoControlCode == IOCTL_INTERNAL_USB_SUBMIT_URB) {
@@ -1097,30 +3826,92 @@ Return Value:
 		{
 		case URB_FUNCTION_BULK_OR_INTERRUPT_TRANSFER: {
 
-			KdPrint(("URB_FUNCTION_BULK_OR_INTERRUPT_TRANSFER\n"));
+			struct _URB_BULK_OR_INTERRUPT_TRANSFER *pBulkOrInterruptTransfer = (struct _URB_BULK_OR_INTERRUPT_TRANSFER *) pUrb;
 
-			KdPrint(("Urb @ 0x%08x (header length: %d, function: %04x)!\n", pUrb, pUrb->UrbHeader.Length, pUrb->UrbHeader.Function));
+			BOOLEAN bReadFromDevice = (BOOLEAN)(pBulkOrInterruptTransfer->TransferFlags & USBD_TRANSFER_DIRECTION_IN);
 
-			struct _URB_BULK_OR_INTERRUPT_TRANSFER *pBulkOrInterruptTransfer = (struct _URB_BULK_OR_INTERRUPT_TRANSFER *) pUrb;
+			//HCI events from the interrupt pipe, we snoop these for the adapter's
+			//limits and only touch the completions of our own packets.
+			if (bReadFromDevice &&
+				filterExt->EventPipe != NULL &&
+				pBulkOrInterruptTransfer->PipeHandle == filterExt->EventPipe)
+			{
+				PUCHAR pEventBuf = FilterGetTransferBuffer(pBulkOrInterruptTransfer);
 
-			KdPrint(("TransferFlags: %lu\n", pBulkOrInterruptTransfer->TransferFlags));
-			KdPrint(("TransferBufferLength: %lu\n", pBulkOrInterruptTransfer->TransferBufferLength));
+				if (pEventBuf)
+				{
+					FilterSnoopHciEvent(filterExt, pEventBuf, pBulkOrInterruptTransfer->TransferBufferLength);
 
-			BOOLEAN bReadFromDevice = (BOOLEAN)(pBulkOrInterruptTransfer->TransferFlags & USBD_TRANSFER_DIRECTION_IN);
+					FilterCapturePacket(filterExt, TRACE_KIND_HCI_EVENT, HCI_DIRECTION_IN, pEventBuf, pBulkOrInterruptTransfer->TransferBufferLength);
+
+					if (FilterTraceWanted(TRACE_KIND_HCI_EVENT, HCI_DIRECTION_IN, pEventBuf, pBulkOrInterruptTransfer->TransferBufferLength))
+						Dump(USBD_TRANSFER_DIRECTION_IN, pEventBuf, pBulkOrInterruptTransfer->TransferBufferLength);
+
+					//Completions of our own packets, the host never counted those
+					pBulkOrInterruptTransfer->TransferBufferLength = FilterAclFlowCompleted(filterExt, pEventBuf, pBulkOrInterruptTransfer->TransferBufferLength);
+
+					//Read the next event into the same URB if nothing is left for the host
+					if (pBulkOrInterruptTransfer->TransferBufferLength == 0)
+					{
+						pBulkOrInterruptTransfer->TransferBufferLength = FilterRequestGetData(Request)->TransferBufferLength;
+						pUrb->UrbHeader.Status = USBD_STATUS_SUCCESS;
+						hide = TRUE;
+					}
+				}
+
+				break;
+			}
+
+			//ATT requests the adapter took, the rest of their round trip is on the air
+			if (!bReadFromDevice)
+			{
+				if (filterExt->AclOutPipe == NULL ||
+					pBulkOrInterruptTransfer->PipeHandle == filterExt->AclOutPipe)
+				{
+					PUCHAR pAclBuf = FilterGetTransferBuffer(pBulkOrInterruptTransfer);
+
+					if (pAclBuf)
+						FilterAttTrackSent(filterExt, FILTER_ATT_ORIGIN_HOST, pAclBuf, pBulkOrInterruptTransfer->TransferBufferLength, TRUE);
+				}
+
+				break;
+			}
+
+			//Only the ACL in pipe carries notifications, once we know which one it is
+			if (bReadFromDevice &&
+				filterExt->AclInPipe != NULL &&
+				pBulkOrInterruptTransfer->PipeHandle != filterExt->AclInPipe)
+			{
+				break;
+			}
 
 			//Direction In
 			if (bReadFromDevice)
 			{
 				if ((PUCHAR)pBulkOrInterruptTransfer->TransferBuffer)
 				{
-					KdPrint(("TransferBuffer has flat specified.\n"));
+					TRACEPOINT(TRACEPOINT_LEVEL_VERBOSE, TRACEPOINT_KEYWORD_URB, TRACEPOINT_TRANSFER_BUFFER,
+						TRACEPOINT_PTR(pUrb),
+						pBulkOrInterruptTransfer->TransferBufferMDL ? TRACEPOINT_BUFFER_FLAT_AND_MDL : TRACEPOINT_BUFFER_FLAT,
+						0, 0);
+
+					FilterSnoopAclPacket(filterExt, HCI_DIRECTION_IN, (PUCHAR)pBulkOrInterruptTransfer->TransferBuffer, pBulkOrInterruptTransfer->TransferBufferLength);
+
+					FilterCapturePacket(filterExt, TRACE_KIND_ACL, HCI_DIRECTION_IN, (PUCHAR)pBulkOrInterruptTransfer->TransferBuffer, pBulkOrInterruptTransfer->TransferBufferLength);
+
+					FilterAttTrackResponse(filterExt, (PUCHAR)pBulkOrInterruptTransfer->TransferBuffer, pBulkOrInterruptTransfer->TransferBufferLength);
 
-					if (pBulkOrInterruptTransfer->TransferBufferMDL)
+					FilterReportSnoopResponse(filterExt, (PUCHAR)pBulkOrInterruptTransfer->TransferBuffer, pBulkOrInterruptTransfer->TransferBufferLength);
+
+					//A response to a write we sent ourselves, the host never asked for it
+					if (FilterActivateResponse(filterExt, (PUCHAR)pBulkOrInterruptTransfer->TransferBuffer, pBulkOrInterruptTransfer->TransferBufferLength))
 					{
-						KdPrint(("??? weird transfer buffer, both MDL and flat specified. Ignoring MDL\n"));
-					}
+						if (FilterTraceWanted(TRACE_KIND_ACL, HCI_DIRECTION_IN, (PUCHAR)pBulkOrInterruptTransfer->TransferBuffer, pBulkOrInterruptTransfer->TransferBufferLength))
+							Dump(USBD_TRANSFER_DIRECTION_IN, (PUCHAR)pBulkOrInterruptTransfer->TransferBuffer, pBulkOrInterruptTransfer->TransferBufferLength);
 
-					if (pBulkOrInterruptTransfer->TransferBufferLength <= 24)
+						hide = TRUE;
+					}
+					else if (pBulkOrInterruptTransfer->TransferBufferLength <= 24)
 					{
 						//intercept a HID Notify and replace with a BatteryPowerState Notify
 						//this way we can get back hid notifications under the battery service
@@ -1134,23 +3925,20 @@ Return Value:
 
 						unsigned char * Bfr = (PUCHAR)pBulkOrInterruptTransfer->TransferBuffer;
 
-						if (Bfr[0] == 0x80 &&
-							Bfr[1] == 0x20 &&
-							//Bfr[2] == 0x09 &&
-							Bfr[3] == 0x00 &&
-							//Bfr[4] == 0x05 &&
-							Bfr[5] == 0x00 &&
-							Bfr[6] == 0x04 &&
-							Bfr[7] == 0x00 &&
-							Bfr[8] == 0x1b &&
-							Bfr[9] == 0x23 &&
-							Bfr[10] == 0x00)
+						if (filterExt->Profile->MatchHidNotification(Bfr, pBulkOrInterruptTransfer->TransferBufferLength))
 						{
-							KdPrint(("Changing att handle from 0x23 (hid notify) to 0x2b (BatterPowerState Notify)\n"));
-							Bfr[9] = 0x2b; //change att handle from 0x23 (hid notify) to 0x2b (BatterPowerState Notify)
+							if (FilterEventConfig.Enable)
+								FilterQueueHidReport(filterExt, Bfr, pBulkOrInterruptTransfer->TransferBufferLength, stamp);
+
+							TRACEPOINT(TRACEPOINT_LEVEL_VERBOSE, TRACEPOINT_KEYWORD_REWRITE, TRACEPOINT_ATT_REWRITE,
+								HCI_ACL_HANDLE(Bfr), Bfr[8], Bfr[9], SIRI_ATT_BATTERY_POWER_STATE);
+							Bfr[9] = SIRI_ATT_BATTERY_POWER_STATE; //change att handle from 0x23 (hid notify) to 0x2b (BatterPowerState Notify)
+
+							FilterWatchdogNotification(filterExt, Bfr, pBulkOrInterruptTransfer->TransferBufferLength - ATT_PDU_OFFSET);
 						}
 
-						DumpSingleLine(USBD_TRANSFER_DIRECTION_IN, (PUCHAR)pBulkOrInterruptTransfer->TransferBuffer, pBulkOrInterruptTransfer->TransferBufferLength);
+						if (FilterTraceWanted(TRACE_KIND_ACL, HCI_DIRECTION_IN, Bfr, pBulkOrInterruptTransfer->TransferBufferLength))
+							DumpSingleLine(USBD_TRANSFER_DIRECTION_IN, (PUCHAR)pBulkOrInterruptTransfer->TransferBuffer, pBulkOrInterruptTransfer->TransferBufferLength);
 					}
 
 					//Bug in ble adapter/system
@@ -1164,83 +3952,121 @@ Return Value:
 					//If we dont set TransferBufferLength we seem to be getting the full data in DebugView bypassing this 
 					//ble 4.0 lme limitation??? However at the console applications if we dont set TransferBufferLength
 					//the voice notifications dont come through
+					//Unless forced on or off from userland, whether and how far to trim is worked out per adapter and 
+					//connection from the lmp version, le buffer size and att mtu exchange we snoop (see hci.c). 
 					else if (pBulkOrInterruptTransfer->TransferBufferLength > 30)
 					{
 						unsigned char * Bfr = (PUCHAR)pBulkOrInterruptTransfer->TransferBuffer;
 
-						if (Bfr[0] == 0x80 &&
-							Bfr[1] == 0x20 &&
-							//Bfr[2] == 0x09 &&
-							Bfr[3] == 0x00 &&
-							//Bfr[4] == 0x05 &&
-							Bfr[5] == 0x00 &&
-							Bfr[6] == 0x04 &&
-							Bfr[7] == 0x00 &&
-							Bfr[8] == 0x1b &&
-							Bfr[9] == 0x23 &&
-							Bfr[10] == 0x00)
+						if (filterExt->Profile->MatchHidNotification(Bfr, pBulkOrInterruptTransfer->TransferBufferLength))
 						{
-							if (FIX_HCI_L2CAP_HEADERS)
+							USHORT fixAttLength = FilterGetFixAttLength(filterExt, HCI_ACL_HANDLE(Bfr));
+
+							//Queue the whole frame before the headers are trimmed, the event
+							//reader gets the voice data the upper stack doesn't
+							if (FilterEventConfig.Enable)
+								FilterQueueVoice(Bfr, pBulkOrInterruptTransfer->TransferBufferLength, stamp);
+
+							if (fixAttLength != 0 &&
+								pBulkOrInterruptTransfer->TransferBufferLength > (ULONG)ATT_PDU_OFFSET + fixAttLength)
 							{
-								KdPrint(("Fixing HCI, L2CAP headers.\n"));
-								Bfr[2] = 0x1A; //in HCI max 26 chars for l2cap + att
-								Bfr[4] = 0x16; //in L2CAP max 22 chars for att
+								TRACEPOINT(TRACEPOINT_LEVEL_VERBOSE, TRACEPOINT_KEYWORD_REWRITE, TRACEPOINT_HEADER_FIX,
+									HCI_ACL_HANDLE(Bfr), pBulkOrInterruptTransfer->TransferBufferLength, fixAttLength, 0);
+								Bfr[2] = (UCHAR)(L2CAP_HEADER_LENGTH + fixAttLength); //in HCI max 26 chars for l2cap + att on ble 4.0
+								Bfr[3] = (UCHAR)((L2CAP_HEADER_LENGTH + fixAttLength) >> 8);
+								Bfr[4] = (UCHAR)fixAttLength; //in L2CAP max 22 chars for att on ble 4.0
+								Bfr[5] = (UCHAR)(fixAttLength >> 8);
+							}
+							else
+							{
+								fixAttLength = 0;
 							}
 
-							Bfr[9] = 0x2b; //change att handle from 0x23 (hid notify) to 0x2b (BatterPowerState Notify)
+							FilterVoiceStatsFrame(filterExt, Bfr, pBulkOrInterruptTransfer->TransferBufferLength, fixAttLength);
+
+							Bfr[9] = SIRI_ATT_BATTERY_POWER_STATE; //change att handle from 0x23 (hid notify) to 0x2b (BatterPowerState Notify)
 
 							//Dump to debug before modifying TransferBufferLength for the upper stack, 
 							//this way we can at least pull the voice data from DebugView
-							DumpSingleLine(USBD_TRANSFER_DIRECTION_IN, (PUCHAR)pBulkOrInterruptTransfer->TransferBuffer, pBulkOrInterruptTransfer->TransferBufferLength);
+							if (FilterTraceWanted(TRACE_KIND_ACL, HCI_DIRECTION_IN, Bfr, pBulkOrInterruptTransfer->TransferBufferLength))
+								DumpSingleLine(USBD_TRANSFER_DIRECTION_IN, (PUCHAR)pBulkOrInterruptTransfer->TransferBuffer, pBulkOrInterruptTransfer->TransferBufferLength);
 
-							if (FIX_HCI_L2CAP_HEADERS)
-								pBulkOrInterruptTransfer->TransferBufferLength = 30;
+							if (fixAttLength != 0)
+								pBulkOrInterruptTransfer->TransferBufferLength = ATT_PDU_OFFSET + fixAttLength;
+
+							//An untrimmed frame is what hangs the upper stack
+							FilterWatchdogNotification(filterExt, Bfr, pBulkOrInterruptTransfer->TransferBufferLength - ATT_PDU_OFFSET);
 						}
 					}
 					else
 					{
-						Dump(USBD_TRANSFER_DIRECTION_IN, (PUCHAR)pBulkOrInterruptTransfer->TransferBuffer, pBulkOrInterruptTransfer->TransferBufferLength);
+						if (FilterTraceWanted(TRACE_KIND_ACL, HCI_DIRECTION_IN, (PUCHAR)pBulkOrInterruptTransfer->TransferBuffer, pBulkOrInterruptTransfer->TransferBufferLength))
+							Dump(USBD_TRANSFER_DIRECTION_IN, (PUCHAR)pBulkOrInterruptTransfer->TransferBuffer, pBulkOrInterruptTransfer->TransferBufferLength);
 					}
 				}
 				else if (pBulkOrInterruptTransfer->TransferBufferMDL)
 				{
-					KdPrint(("TransferBuffer has MDL specified.\n"));
+					TRACEPOINT(TRACEPOINT_LEVEL_VERBOSE, TRACEPOINT_KEYWORD_URB, TRACEPOINT_TRANSFER_BUFFER,
+						TRACEPOINT_PTR(pUrb), TRACEPOINT_BUFFER_MDL, 0, 0);
 
 					#pragma warning(disable : 4995) //MmGetSystemAddressForMdl is deprecated so ignore warning
 					PUCHAR pMDLBuf = (PUCHAR)MmGetSystemAddressForMdl(pBulkOrInterruptTransfer->TransferBufferMDL);
 					if (pMDLBuf)
 					{
-						Dump(USBD_TRANSFER_DIRECTION_IN, pMDLBuf, pBulkOrInterruptTransfer->TransferBufferLength);
+						FilterSnoopAclPacket(filterExt, HCI_DIRECTION_IN, pMDLBuf, pBulkOrInterruptTransfer->TransferBufferLength);
+
+						FilterCapturePacket(filterExt, TRACE_KIND_ACL, HCI_DIRECTION_IN, pMDLBuf, pBulkOrInterruptTransfer->TransferBufferLength);
+
+						if (FilterTraceWanted(TRACE_KIND_ACL, HCI_DIRECTION_IN, pMDLBuf, pBulkOrInterruptTransfer->TransferBufferLength))
+							Dump(USBD_TRANSFER_DIRECTION_IN, pMDLBuf, pBulkOrInterruptTransfer->TransferBufferLength);
+
+						FilterAttTrackResponse(filterExt, pMDLBuf, pBulkOrInterruptTransfer->TransferBufferLength);
+
+						FilterReportSnoopResponse(filterExt, pMDLBuf, pBulkOrInterruptTransfer->TransferBufferLength);
+
+						hide = FilterActivateResponse(filterExt, pMDLBuf, pBulkOrInterruptTransfer->TransferBufferLength);
 					}
 					else
 					{
-						KdPrint(("Could not get MmGetSystemAddressForMdl.\n"));
+						TRACEPOINT(TRACEPOINT_LEVEL_ERROR, TRACEPOINT_KEYWORD_ERROR, TRACEPOINT_MDL_MAP_FAILED,
+							TRACEPOINT_PTR(pUrb), 0, 0, 0);
 					}
 				}
 				else
 				{
-					KdPrint(("Both flat and MDL not specified.\n"));
+					TRACEPOINT(TRACEPOINT_LEVEL_VERBOSE, TRACEPOINT_KEYWORD_URB, TRACEPOINT_TRANSFER_BUFFER,
+						TRACEPOINT_PTR(pUrb), TRACEPOINT_BUFFER_NONE, 0, 0);
 				}
 
 			}
-			else
+
+			//Read the next packet into the same URB instead of completing it
+			if (hide)
 			{
-				KdPrint(("NoTransferBuffer\n"));
+				pBulkOrInterruptTransfer->TransferBufferLength = FilterRequestGetData(Request)->TransferBufferLength;
+				pUrb->UrbHeader.Status = USBD_STATUS_SUCCESS;
 			}
 
 			break;
 		}
+		case URB_FUNCTION_SELECT_CONFIGURATION: {
+			FilterSnoopSelectConfiguration(filterExt, pUrb);
+			break;
+		}
 		case URB_FUNCTION_CLASS_DEVICE: {
 			// My code Here
-			KdPrint(("URB_FUNCTION_CLASS_DEVICE\n"));
 			break;
 		}
 		default:
-			KdPrint(("URB_FUNCTION_UNKNOWN\n"));
 			break;
 		}
 	}
 
+	if (hide) {
+		FilterForwardRequestWithCompletionRoutine(Request, Target);
+		return;
+	}
+
     WdfRequestComplete(Request, CompletionParams->IoStatus.Status);
 
     return;
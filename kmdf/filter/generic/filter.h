@@ -22,6 +22,21 @@ Environment:
 #include <wdmsec.h> // for SDDLs
 #define NTSTRSAFE_LIB
 #include <ntstrsafe.h>
+#include "usbdrivr.h"
+
+#include "public.h"
+#include "profile.h"
+#include "tracefilter.h"
+#include "capture.h"
+#include "tracepoint.h"
+#include "coalesce.h"
+#include "eventqueue.h"
+#include "activate.h"
+#include "aclflow.h"
+#include "atttrack.h"
+#include "watchdog.h"
+#include "voicestats.h"
+#include "reportsnoop.h"
 
 #if !defined(_FILTER_H_)
 #define _FILTER_H_
@@ -29,6 +44,8 @@ Environment:
 
 #define DRIVERNAME "Generic.sys: "
 
+#define FILTER_POOL_TAG 'tfRS'
+
 //
 // Change the following define to 1 if you want to forward
 // the request with a completion routine.
@@ -39,7 +56,87 @@ Environment:
 typedef struct _FILTER_EXTENSION
 {
     WDFDEVICE WdfDevice;
-    // More context data here
+
+    //
+    // What we know about the controller, picked from its hardware ID.
+    //
+    PCCONTROLLER_PROFILE Profile;
+
+    //
+    // Pipes of the adapter's bluetooth interface, picked up from the
+    // select configuration request. HCI events come in on the interrupt
+    // pipe and ACL data on the bulk pipes.
+    //
+    USBD_PIPE_HANDLE EventPipe;
+    USBD_PIPE_HANDLE AclInPipe;
+    USBD_PIPE_HANDLE AclOutPipe;
+
+    //
+    // What we snooped about the adapter and its connections. The lock
+    // serializes changes, lookups from the completion routine don't take it.
+    //
+    KSPIN_LOCK       LinkStateLock;
+    HCI_LINK_STATE   LinkState;
+
+    //
+    // Pre-trigger capture ring, see capture.c.
+    //
+    KSPIN_LOCK       CaptureLock;
+    CAPTURE_STATE    Capture;
+
+    //
+    // Trackpad moves held back for coalescing, serialized by FilterEventLock.
+    //
+    COALESCE_STATE   Coalesce;
+
+    //
+    // Layout of each connection's reports, compiled from its Report Map,
+    // serialized by FilterEventLock. Indexed like the connection slots.
+    //
+    COALESCE_LAYOUT  Layouts[HCI_MAX_CONNECTIONS];
+
+    //
+    // Remotes the filter activates itself, see activate.c.
+    //
+    KSPIN_LOCK       ActivateLock;
+    ACTIVATE_STATE   Activate;
+
+    //
+    // Controller buffers the ACL packets going down take, see aclflow.c.
+    // Host packets waiting for one, or for the response to a write of ours,
+    // are held in HoldQueue. Taken before ActivateLock.
+    //
+    KSPIN_LOCK       AclFlowLock;
+    ACL_FLOW_STATE   AclFlow;
+    WDFQUEUE         HoldQueue;
+
+    //
+    // ATT request round trips, see atttrack.c.
+    //
+    KSPIN_LOCK       AttTrackLock;
+    ATT_TRACK_STATE  AttTrack;
+
+    //
+    // Notification stalls, see watchdog.c. The timer only runs while a
+    // connection streams.
+    //
+    KSPIN_LOCK       WatchdogLock;
+    WATCHDOG_STATE   Watchdog;
+    WDFTIMER         WatchdogTimer;
+
+    //
+    // Voice sessions, see voicestats.c.
+    //
+    KSPIN_LOCK       VoiceStatsLock;
+    VOICE_STATS_STATE VoiceStats;
+
+    //
+    // Report Maps read by the host, see reportsnoop.c, and the table the
+    // last one compiled into. Taken before FilterEventLock.
+    //
+    KSPIN_LOCK       ReportMapLock;
+    REPORT_SNOOP_STATE ReportSnoop;
+    REPORT_MAP       ReportMapScratch;
 
 }FILTER_EXTENSION, *PFILTER_EXTENSION;
 
@@ -47,6 +144,54 @@ typedef struct _FILTER_EXTENSION
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(FILTER_EXTENSION,
                                         FilterGetData)
 
+//
+// Context of the requests coming down the filter device.
+//
+typedef struct _FILTER_REQUEST_CONTEXT {
+
+    //
+    // Of a bulk or interrupt URB as it came down, so a read whose packet
+    // we hide can be sent down again.
+    //
+    ULONG   TransferBufferLength;
+
+    //
+    // Of an ACL packet going down, the connection slot it is counted
+    // against and the packet, NULL for anything else.
+    //
+    ULONG   Stream;
+    PUCHAR  AclPacket;
+
+} FILTER_REQUEST_CONTEXT, *PFILTER_REQUEST_CONTEXT;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(FILTER_REQUEST_CONTEXT,
+                                        FilterRequestGetData)
+
+//
+// Memory of a request the filter sends down on its own, the URB has to
+// come first.
+//
+typedef struct _FILTER_INJECT_BUFFER {
+
+    struct _URB_BULK_OR_INTERRUPT_TRANSFER  Urb;
+    PFILTER_EXTENSION                       FilterExt;
+    ULONG                                   Stream;
+    UCHAR                                   Data[ACTIVATE_MAX_PACKET];
+
+} FILTER_INJECT_BUFFER, *PFILTER_INJECT_BUFFER;
+
+//
+// One of the two trace predicate slots. Completion routines count
+// themselves in as readers of the active slot, a new program is only
+// written to the other one once its readers are gone.
+//
+typedef struct _FILTER_TRACE_SLOT {
+
+    volatile LONG   Readers;
+    TRACE_FILTER    Filter;
+
+} FILTER_TRACE_SLOT, *PFILTER_TRACE_SLOT;
+
 #define NTDEVICE_NAME_STRING      L"\\Device\\SiriRemoteFilter"
 #define SYMBOLIC_NAME_STRING      L"\\DosDevices\\SiriRemoteFilter"
 
@@ -58,6 +203,18 @@ typedef struct _CONTROL_DEVICE_EXTENSION {
 
 WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(CONTROL_DEVICE_EXTENSION,
                                              ControlGetData)
+
+//
+// Context of a handle opened on the control device.
+//
+typedef struct _CONTROL_FILE_CONTEXT {
+
+    ULONG   Subscriber; // in FilterEventQueue, EVENT_QUEUE_NO_SUBSCRIBER until it subscribes
+
+} CONTROL_FILE_CONTEXT, *PCONTROL_FILE_CONTEXT;
+
+WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(CONTROL_FILE_CONTEXT,
+                                             ControlFileGetData)
 DRIVER_INITIALIZE DriverEntry;
 
 EVT_WDF_DRIVER_DEVICE_ADD FilterEvtDeviceAdd;
@@ -65,6 +222,10 @@ EVT_WDF_DRIVER_UNLOAD FilterEvtDriverUnload;
 EVT_WDF_DEVICE_CONTEXT_CLEANUP FilterEvtDeviceContextCleanup;
 EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL FilterEvtIoDeviceControl;
 EVT_WDF_IO_QUEUE_IO_INTERNAL_DEVICE_CONTROL FilterEvtIoInternalDeviceControl;
+EVT_WDF_DEVICE_FILE_CREATE FilterEvtDeviceFileCreate;
+EVT_WDF_FILE_CLEANUP FilterEvtFileCleanup;
+EVT_WDF_REQUEST_COMPLETION_ROUTINE FilterInjectCompletionRoutine;
+EVT_WDF_TIMER FilterEvtWatchdogTimer;
 
 NTSTATUS
 FilterCreateControlDevice(
@@ -82,6 +243,289 @@ FilterForwardRequest(
     IN WDFIOTARGET Target
     );
 
+PUCHAR
+FilterGetTransferBuffer(
+    IN struct _URB_BULK_OR_INTERRUPT_TRANSFER *pBulkOrInterruptTransfer
+    );
+
+PCCONTROLLER_PROFILE
+FilterSelectProfile(
+    IN PWDFDEVICE_INIT DeviceInit
+    );
+
+VOID
+FilterSnoopSelectConfiguration(
+    IN PFILTER_EXTENSION FilterExt,
+    IN PURB              Urb
+    );
+
+VOID
+FilterSnoopHciEvent(
+    IN PFILTER_EXTENSION FilterExt,
+    IN PUCHAR            Bfr,
+    IN ULONG             Length
+    );
+
+VOID
+FilterSnoopAclPacket(
+    IN PFILTER_EXTENSION FilterExt,
+    IN int               Direction,
+    IN PUCHAR            Bfr,
+    IN ULONG             Length
+    );
+
+USHORT
+FilterGetFixAttLength(
+    IN PFILTER_EXTENSION FilterExt,
+    IN USHORT            Handle
+    );
+
+BOOLEAN
+FilterTraceWanted(
+    IN UCHAR    Kind,
+    IN UCHAR    Direction,
+    IN PUCHAR   Bfr,
+    IN ULONG    Length
+    );
+
+NTSTATUS
+FilterSetTraceFilter(
+    IN PTRACE_FILTER_PROGRAM Program,
+    IN ULONG                 Length
+    );
+
+VOID
+FilterCapturePacket(
+    IN PFILTER_EXTENSION FilterExt,
+    IN UCHAR             Kind,
+    IN UCHAR             Direction,
+    IN PUCHAR            Bfr,
+    IN ULONG             Length
+    );
+
+VOID
+FilterCaptureTrigger(
+    IN PFILTER_EXTENSION FilterExt,
+    IN UCHAR             Trigger
+    );
+
+NTSTATUS
+FilterSetCaptureConfig(
+    IN PFILTER_CAPTURE_CONFIG Config
+    );
+
+VOID
+FilterGetCapture(
+    IN PFILTER_EXTENSION        FilterExt,
+    OUT PFILTER_CAPTURE_HEADER  Header,
+    OUT PFILTER_CAPTURE_RECORD  Records,
+    IN ULONG                    MaxRecords
+    );
+
+VOID
+FilterQueueHidReport(
+    IN PFILTER_EXTENSION FilterExt,
+    IN PUCHAR            Bfr,
+    IN ULONG             Length,
+    IN LONGLONG          Stamp
+    );
+
+NTSTATUS
+FilterSetEventConfig(
+    IN PFILTER_EVENT_CONFIG Config
+    );
+
+NTSTATUS
+FilterSetSmoothConfig(
+    IN PFILTER_SMOOTH_CONFIG Config
+    );
+
+VOID
+FilterQueueVoice(
+    IN PUCHAR            Bfr,
+    IN ULONG             Length,
+    IN LONGLONG          Stamp
+    );
+
+NTSTATUS
+FilterSubscribeEvents(
+    IN PCONTROL_FILE_CONTEXT        FileContext,
+    IN PFILTER_EVENT_SUBSCRIPTION   Subscription
+    );
+
+ULONG
+FilterGetEvents(
+    IN PCONTROL_FILE_CONTEXT        FileContext,
+    OUT PFILTER_EVENT_BUFFER_HEADER Header,
+    IN ULONG                        Length
+    );
+
+VOID
+FilterInjectAclPacket(
+    IN PFILTER_EXTENSION FilterExt,
+    IN ULONG             Stream,
+    IN PUCHAR            Bfr,
+    IN ULONG             Length
+    );
+
+VOID
+FilterSendAclPacket(
+    IN PFILTER_EXTENSION FilterExt,
+    IN ULONG             Stream,
+    IN PUCHAR            Bfr,
+    IN ULONG             Length
+    );
+
+BOOLEAN
+FilterHoldAclPacket(
+    IN PFILTER_EXTENSION FilterExt,
+    IN WDFREQUEST        Request,
+    IN PUCHAR            Bfr,
+    IN ULONG             Length
+    );
+
+VOID
+FilterReleaseAclPackets(
+    IN PFILTER_EXTENSION FilterExt
+    );
+
+ULONG
+FilterAclFlowCompleted(
+    IN PFILTER_EXTENSION FilterExt,
+    IN PUCHAR            Bfr,
+    IN ULONG             Length
+    );
+
+VOID
+FilterHostPacketFailed(
+    IN PFILTER_EXTENSION FilterExt,
+    IN WDFREQUEST        Request
+    );
+
+BOOLEAN
+FilterActivateHostRequest(
+    IN PFILTER_EXTENSION FilterExt,
+    IN ULONG             Stream,
+    IN PUCHAR            Bfr,
+    IN ULONG             Length
+    );
+
+VOID
+FilterActivateByHost(
+    IN PFILTER_EXTENSION FilterExt,
+    IN USHORT            Handle
+    );
+
+BOOLEAN
+FilterActivateResponse(
+    IN PFILTER_EXTENSION FilterExt,
+    IN PUCHAR            Bfr,
+    IN ULONG             Length
+    );
+
+NTSTATUS
+FilterSetActivateConfig(
+    IN PFILTER_ACTIVATE_CONFIG Config
+    );
+
+VOID
+FilterAttTrackRequest(
+    IN PFILTER_EXTENSION FilterExt,
+    IN UCHAR             Origin,
+    IN PUCHAR            Bfr,
+    IN ULONG             Length
+    );
+
+VOID
+FilterAttTrackSent(
+    IN PFILTER_EXTENSION FilterExt,
+    IN UCHAR             Origin,
+    IN PUCHAR            Bfr,
+    IN ULONG             Length,
+    IN BOOLEAN           Success
+    );
+
+VOID
+FilterAttTrackResponse(
+    IN PFILTER_EXTENSION FilterExt,
+    IN PUCHAR            Bfr,
+    IN ULONG             Length
+    );
+
+VOID
+FilterGetAttStats(
+    IN PFILTER_EXTENSION    FilterExt,
+    OUT PFILTER_ATT_STATS   Stats
+    );
+
+VOID
+FilterWatchdogNotification(
+    IN PFILTER_EXTENSION FilterExt,
+    IN PUCHAR            Bfr,
+    IN ULONG             AttLength
+    );
+
+NTSTATUS
+FilterSetWatchdogConfig(
+    IN PFILTER_WATCHDOG_CONFIG Config
+    );
+
+VOID
+FilterVoiceStatsFrame(
+    IN PFILTER_EXTENSION FilterExt,
+    IN PUCHAR            Bfr,
+    IN ULONG             Length,
+    IN ULONG             FixAttLength
+    );
+
+NTSTATUS
+FilterSetVoiceConfig(
+    IN PFILTER_VOICE_CONFIG Config
+    );
+
+VOID
+FilterGetVoiceStats(
+    IN PFILTER_EXTENSION    FilterExt,
+    OUT PFILTER_VOICE_STATS Stats
+    );
+
+VOID
+FilterReportSnoopRequest(
+    IN PFILTER_EXTENSION FilterExt,
+    IN PUCHAR            Bfr,
+    IN ULONG             Length
+    );
+
+VOID
+FilterReportSnoopResponse(
+    IN PFILTER_EXTENSION FilterExt,
+    IN PUCHAR            Bfr,
+    IN ULONG             Length
+    );
+
+VOID
+FilterInstallReportMap(
+    IN PFILTER_EXTENSION FilterExt,
+    IN ULONG             Stream
+    );
+
+NTSTATUS
+FilterSetReportMap(
+    IN PFILTER_REPORT_MAP Map
+    );
+
+VOID
+FilterGetReportMaps(
+    IN PFILTER_EXTENSION    FilterExt,
+    OUT PFILTER_REPORT_MAPS Maps
+    );
+
+VOID
+FilterGetAdapterInfo(
+    IN PFILTER_EXTENSION    FilterExt,
+    OUT PFILTER_ADAPTER_INFO Info
+    );
+
 #if FORWARD_REQUEST_WITH_COMPLETION
 
 VOID
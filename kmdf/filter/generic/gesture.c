@@ -0,0 +1,261 @@
+/*++
+
+Module Name:
+
+    gesture.c
+
+Abstract:
+
+    Gesture recognition from touch and button events, see gesture.h.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "gesture.h"
+
+#define GESTURE_TICKS_PER_MS        10000
+
+static PGESTURE_CONNECTION
+GestureConnection(
+    PGESTURE_STATE  State,
+    USHORT          Handle
+    )
+{
+    PGESTURE_CONNECTION conn;
+    PGESTURE_CONNECTION quietest = &State->Connections[0];
+    ULONG               i;
+
+    for (i = 0; i < HCI_MAX_CONNECTIONS; i++) {
+        conn = &State->Connections[i];
+
+        if (conn->Used && conn->Handle == Handle) {
+            return conn;
+        }
+    }
+
+    for (i = 0; i < HCI_MAX_CONNECTIONS; i++) {
+        conn = &State->Connections[i];
+
+        if (!conn->Used) {
+            quietest = conn;
+            break;
+        }
+
+        if (conn->Last < quietest->Last) {
+            quietest = conn;
+        }
+    }
+
+    RtlZeroMemory(quietest, sizeof(GESTURE_CONNECTION));
+    quietest->Used = TRUE;
+    quietest->Handle = Handle;
+
+    return quietest;
+}
+
+static VOID
+GestureMake(
+    PGESTURE            Gesture,
+    UCHAR               Type,
+    const FILTER_EVENT  *Event,
+    LONGLONG            Start,
+    ULONG               Reports,
+    LONG                DeltaX,
+    LONG                DeltaY
+    )
+{
+    Gesture->Time = Event->Time;
+    Gesture->Start = Start;
+    Gesture->Handle = Event->Handle;
+    Gesture->Type = Type;
+    Gesture->Contact = Event->Contact;
+    Gesture->DeltaX = (SHORT)DeltaX;
+    Gesture->DeltaY = (SHORT)DeltaY;
+    Gesture->Reports = Reports;
+}
+
+static ULONG
+GestureMove(
+    PGESTURE_STATE      State,
+    PGESTURE_CONTACT    Contact,
+    const FILTER_EVENT  *Event,
+    USHORT              PreviousX,
+    USHORT              PreviousY,
+    PGESTURE            Gesture
+    )
+/*++
+
+Routine Description:
+
+    Decides what a pending touch is once it moved, and emits the steps of
+    a scroll. The contact is at the event's position already.
+
+--*/
+{
+    LONG        dx = (LONG)Contact->X - Contact->StartX;
+    LONG        dy = (LONG)Contact->Y - Contact->StartY;
+    LONG        ax = dx < 0 ? -dx : dx;
+    LONG        ay = dy < 0 ? -dy : dy;
+    LONGLONG    elapsed = Event->Time - Contact->Start;
+    UCHAR       type;
+
+    if (Contact->Phase == GESTURE_PHASE_SCROLLING) {
+        dx = (LONG)Contact->X - PreviousX;
+        dy = (LONG)Contact->Y - PreviousY;
+
+        if (dx == 0 && dy == 0) {
+            return 0;
+        }
+
+        GestureMake(Gesture, GESTURE_SCROLL, Event, Contact->Start, Contact->Reports, dx, dy);
+        return 1;
+    }
+
+    if (Contact->Phase != GESTURE_PHASE_PENDING) {
+        return 0;
+    }
+
+    if (ax > State->Config.TapSlop || ay > State->Config.TapSlop) {
+        Contact->Moved = TRUE;
+    }
+
+    if (elapsed <= State->SwipeTicks &&
+        max(ax, ay) >= (LONG)State->Config.SwipeDistance &&
+        max(ax, ay) >= 2 * min(ax, ay)) {
+
+        if (ax > ay) {
+            type = dx < 0 ? GESTURE_SWIPE_LEFT : GESTURE_SWIPE_RIGHT;
+        } else {
+            type = dy < 0 ? GESTURE_SWIPE_UP : GESTURE_SWIPE_DOWN;
+        }
+
+        Contact->Phase = GESTURE_PHASE_DONE;
+        GestureMake(Gesture, type, Event, Contact->Start, Contact->Reports, dx, dy);
+        return 1;
+    }
+
+    if (elapsed > State->SwipeTicks && Contact->Moved) {
+        Contact->Phase = GESTURE_PHASE_SCROLLING;
+        GestureMake(Gesture, GESTURE_SCROLL, Event, Contact->Start, Contact->Reports, dx, dy);
+        return 1;
+    }
+
+    return 0;
+}
+
+VOID
+GestureInit(
+    PGESTURE_STATE          State,
+    const GESTURE_CONFIG    *Config
+    )
+{
+    RtlZeroMemory(State, sizeof(GESTURE_STATE));
+
+    if (Config != NULL) {
+        State->Config = *Config;
+    } else {
+        State->Config.ClickMask = GESTURE_DEFAULT_CLICK_MASK;
+        State->Config.TapSlop = GESTURE_DEFAULT_TAP_SLOP;
+        State->Config.TapMs = GESTURE_DEFAULT_TAP_MS;
+        State->Config.SwipeMs = GESTURE_DEFAULT_SWIPE_MS;
+        State->Config.SwipeDistance = GESTURE_DEFAULT_SWIPE_DISTANCE;
+    }
+
+    State->TapTicks = (LONGLONG)State->Config.TapMs * GESTURE_TICKS_PER_MS;
+    State->SwipeTicks = (LONGLONG)State->Config.SwipeMs * GESTURE_TICKS_PER_MS;
+}
+
+ULONG
+GestureEvent(
+    PGESTURE_STATE      State,
+    const FILTER_EVENT  *Event,
+    PGESTURE            Gestures
+    )
+{
+    PGESTURE_CONNECTION conn = GestureConnection(State, Event->Handle);
+    PGESTURE_CONTACT    contact;
+    USHORT              pressed;
+    USHORT              x;
+    USHORT              y;
+    ULONG               count = 0;
+    ULONG               i;
+
+    conn->Last = Event->Time;
+
+    if (Event->Type == FILTER_EVENT_BUTTONS) {
+        pressed = (USHORT)(Event->Buttons & ~conn->Buttons & State->Config.ClickMask);
+        conn->Buttons = Event->Buttons;
+
+        if (pressed == 0) {
+            return 0;
+        }
+
+        for (i = 0; i < GESTURE_MAX_CONTACTS; i++) {
+            if (conn->Contacts[i].Phase != GESTURE_PHASE_UP) {
+                conn->Contacts[i].Phase = GESTURE_PHASE_DONE;
+            }
+        }
+
+        GestureMake(&Gestures[count++], GESTURE_CLICK, Event, Event->Time, Event->Reports, 0, 0);
+        return count;
+    }
+
+    if (Event->Contact >= GESTURE_MAX_CONTACTS) {
+        return 0;
+    }
+
+    contact = &conn->Contacts[Event->Contact];
+
+    switch (Event->Type) {
+
+    case FILTER_EVENT_TOUCH_DOWN:
+        contact->Phase = GESTURE_PHASE_PENDING;
+        contact->Moved = FALSE;
+        contact->Start = Event->Time;
+        contact->Reports = Event->Reports;
+        contact->X = contact->StartX = Event->X;
+        contact->Y = contact->StartY = Event->Y;
+        break;
+
+    case FILTER_EVENT_TOUCH_MOVE:
+        if (contact->Phase == GESTURE_PHASE_UP) {
+            break;
+        }
+
+        x = contact->X;
+        y = contact->Y;
+        contact->X = Event->X;
+        contact->Y = Event->Y;
+        contact->Reports += Event->Reports;
+        count = GestureMove(State, contact, Event, x, y, &Gestures[count]);
+        break;
+
+    case FILTER_EVENT_TOUCH_UP:
+        contact->Reports += Event->Reports;
+
+        if (contact->Phase == GESTURE_PHASE_PENDING && !contact->Moved &&
+            Event->Time - contact->Start <= State->TapTicks) {
+            GestureMake(&Gestures[count++], GESTURE_TAP, Event, contact->Start, contact->Reports, 0, 0);
+        }
+
+        contact->Phase = GESTURE_PHASE_UP;
+        break;
+    }
+
+    return count;
+}
+
+const char *
+GestureName(
+    ULONG   Type
+    )
+{
+    static const char * names[GESTURE_TYPES] = {
+        "none", "tap", "click", "swipe left", "swipe right", "swipe up", "swipe down", "scroll"
+    };
+
+    return Type < GESTURE_TYPES ? names[Type] : "?";
+}
@@ -0,0 +1,174 @@
+/*++
+
+Module Name:
+
+    gesture.h
+
+Abstract:
+
+    Recognizes taps, clicks, swipes and scrolls in the touch and button
+    events of IOCTL_GET_EVENTS, for readers that want gestures rather than
+    positions.
+
+    Events are fed one at a time as they are read. A gesture is emitted by
+    the event that makes it unambiguous, not after a delay:
+
+    CLICK       the press of a button in ClickMask. It takes over the
+                touches going on, they emit nothing else.
+    SWIPE_*     a touch that got SwipeDistance away from where it came down
+                within SwipeMs, mostly along one axis, emitted by the move
+                that got there. Up is towards Y 0, left towards X 0.
+    SCROLL      a touch that moved more than TapSlop but could no longer be
+                a swipe, emitted by every move from then on with the
+                movement since the previous one. The first carries all of
+                it since the touch came down.
+    TAP         a touch lifted within TapMs that never moved more than
+                TapSlop, emitted by the touch up.
+
+    A touch that is neither, like one held still, emits nothing.
+
+    Only event times are looked at, so a touch that stops moving within
+    SwipeMs becomes a scroll with the next event after SwipeMs. At the
+    remote's 90 reports a second that is one report late at most.
+
+    The state is a few fields per contact of each connection, nothing is
+    allocated, and each event takes the same few steps.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "portable.h"
+#include "public.h"
+#include "hci.h"
+
+#if !defined(_GESTURE_H_)
+#define _GESTURE_H_
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define GESTURE_NONE                0
+#define GESTURE_TAP                 1
+#define GESTURE_CLICK               2
+#define GESTURE_SWIPE_LEFT          3
+#define GESTURE_SWIPE_RIGHT         4
+#define GESTURE_SWIPE_UP            5
+#define GESTURE_SWIPE_DOWN          6
+#define GESTURE_SCROLL              7
+#define GESTURE_TYPES               8
+
+#define GESTURE_MAX_CONTACTS        2
+
+//
+// Most gestures one event emits.
+//
+#define GESTURE_MAX_EVENT_GESTURES  1
+
+//
+// Trackpad positions are 12 bits.
+//
+#define GESTURE_DEFAULT_CLICK_MASK      0x0001
+#define GESTURE_DEFAULT_TAP_MS          200
+#define GESTURE_DEFAULT_TAP_SLOP        64
+#define GESTURE_DEFAULT_SWIPE_MS        300
+#define GESTURE_DEFAULT_SWIPE_DISTANCE  600
+
+typedef struct _GESTURE_CONFIG {
+
+    USHORT  ClickMask;      // buttons the trackpad press reports
+    USHORT  TapSlop;        // movement a tap or a click can have
+    ULONG   TapMs;
+    ULONG   SwipeMs;
+    ULONG   SwipeDistance;
+
+} GESTURE_CONFIG, *PGESTURE_CONFIG;
+
+typedef struct _GESTURE {
+
+    LONGLONG    Time;       // of the event that emitted it
+    LONGLONG    Start;      // of the touch down, or the press of a click
+    USHORT      Handle;
+    UCHAR       Type;       // GESTURE_*
+    UCHAR       Contact;
+    SHORT       DeltaX;     // swipes from the touch down, scrolls from the previous one
+    SHORT       DeltaY;
+    ULONG       Reports;    // from the touch down or press to the event that emitted it
+
+} GESTURE, *PGESTURE;
+
+#define GESTURE_PHASE_UP            0
+#define GESTURE_PHASE_PENDING       1   // could still be a tap or a swipe
+#define GESTURE_PHASE_SCROLLING     2
+#define GESTURE_PHASE_DONE          3   // emitted what it will, until the touch up
+
+typedef struct _GESTURE_CONTACT {
+
+    UCHAR       Phase;      // GESTURE_PHASE_*
+    BOOLEAN     Moved;      // more than TapSlop since the touch down
+    USHORT      X;          // latest position
+    USHORT      Y;
+    USHORT      StartX;
+    USHORT      StartY;
+    ULONG       Reports;
+    LONGLONG    Start;
+
+} GESTURE_CONTACT, *PGESTURE_CONTACT;
+
+typedef struct _GESTURE_CONNECTION {
+
+    USHORT              Handle;
+    BOOLEAN             Used;
+    USHORT              Buttons;
+    LONGLONG            Last;       // time of its latest event
+    GESTURE_CONTACT     Contacts[GESTURE_MAX_CONTACTS];
+
+} GESTURE_CONNECTION, *PGESTURE_CONNECTION;
+
+typedef struct _GESTURE_STATE {
+
+    GESTURE_CONFIG      Config;
+    LONGLONG            TapTicks;
+    LONGLONG            SwipeTicks;
+
+    //
+    // A connection takes a free slot with its first event, or the one
+    // quiet the longest.
+    //
+    GESTURE_CONNECTION  Connections[HCI_MAX_CONNECTIONS];
+
+} GESTURE_STATE, *PGESTURE_STATE;
+
+//
+// Config NULL takes the defaults.
+//
+VOID
+GestureInit(
+    PGESTURE_STATE          State,
+    const GESTURE_CONFIG    *Config
+    );
+
+//
+// Feeds an event, returns the number of gestures it emitted into Gestures,
+// which has room for GESTURE_MAX_EVENT_GESTURES.
+//
+ULONG
+GestureEvent(
+    PGESTURE_STATE      State,
+    const FILTER_EVENT  *Event,
+    PGESTURE            Gestures
+    );
+
+const char *
+GestureName(
+    ULONG   Type
+    );
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -0,0 +1,633 @@
+/*++
+
+Module Name:
+
+    hci.c
+
+Abstract:
+
+    Snoops the HCI events and ATT MTU exchanges passing through the filter
+    to decide, per adapter and connection, whether incoming notifications
+    need the HCI/L2CAP header fix, and keeps the table of connections.
+
+    Nothing in here touches WDF. The caller serializes calls that change
+    the link state; HciLookupConnection and HciGetFixAttLength only read
+    and may be called from any number of completion routines at once.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "hci.h"
+
+#define READ_USHORT(Bfr)    ((USHORT)((Bfr)[0] | ((Bfr)[1] << 8)))
+
+static USHORT
+HciComputeFixAttLength(
+    PHCI_ADAPTER_INFO Adapter,
+    USHORT            LocalMtu,
+    USHORT            RemoteMtu
+    )
+/*++
+
+Routine Description:
+
+    Works out the longest ATT PDU the upper stack accepts on a connection.
+    Notifications longer than the returned length have their HCI/L2CAP
+    headers and TransferBufferLength trimmed to it.
+
+    The upper stack limits ATT to the default LE MTU on Bluetooth 4.0
+    controllers (LMP 6), whatever MTU was exchanged. That is what hangs HID
+    notifications at the first voice packet on such adapters. On newer
+    adapters it honours the exchanged MTU, bounded by the LE ACL buffer
+    the controller reported. Without an exchange seen on a newer adapter,
+    the filter started after the remote connected, there is nothing to
+    bound and the packets are left alone.
+
+Arguments:
+
+    Adapter - What we know about the adapter.
+
+    LocalMtu, RemoteMtu - Rx MTUs from the exchange, 0 if not seen.
+
+Return Value:
+
+    ATT length to trim to, or 0 to leave packets alone like before: when
+    nothing is known about the adapter, or a newer one without an MTU
+    exchange seen.
+
+--*/
+{
+    USHORT mtu;
+
+    if (!(Adapter->Flags & (HCI_ADAPTER_VERSION_VALID | HCI_ADAPTER_LE_BUFFER_VALID))) {
+        return 0;
+    }
+
+    if ((Adapter->Flags & HCI_ADAPTER_VERSION_VALID) &&
+        Adapter->LmpVersion <= HCI_LMP_VERSION_4_0) {
+        mtu = ATT_DEFAULT_LE_MTU;
+    } else if (LocalMtu != 0 && RemoteMtu != 0) {
+        mtu = max((USHORT)min(LocalMtu, RemoteMtu), (USHORT)ATT_DEFAULT_LE_MTU);
+    } else {
+        return 0;
+    }
+
+    if ((Adapter->Flags & HCI_ADAPTER_LE_BUFFER_VALID) &&
+        Adapter->LeAclDataPacketLength > L2CAP_HEADER_LENGTH + ATT_DEFAULT_LE_MTU &&
+        Adapter->LeAclDataPacketLength < L2CAP_HEADER_LENGTH + mtu) {
+        mtu = Adapter->LeAclDataPacketLength - L2CAP_HEADER_LENGTH;
+    }
+
+    //
+    // ATT allows a PDU of the whole MTU, but the manual fix was found on
+    // the hardware trimming to 22 for an MTU of 23, and a PDU of exactly
+    // the MTU was never seen to get through the stacks that hang. So the
+    // same one byte margin is kept for every MTU, a full PDU loses its
+    // last value byte rather than hanging the notifications.
+    //
+    return mtu - 1;
+}
+
+static VOID
+HciRecompute(
+    PHCI_LINK_STATE State
+    )
+{
+    ULONG i;
+
+    State->DefaultFixAttLength = HciComputeFixAttLength(&State->Adapter, 0, 0);
+
+    for (i = 0; i < HCI_MAX_CONNECTIONS; i++) {
+        PHCI_CONNECTION conn = &State->Connections[i];
+
+        if (conn->Handle != HCI_INVALID_HANDLE &&
+            !(conn->Flags & HCI_CONNECTION_FIX_FORCED)) {
+            conn->FixAttLength = HciComputeFixAttLength(&State->Adapter,
+                                                        conn->LocalMtu,
+                                                        conn->RemoteMtu);
+        }
+    }
+}
+
+static PHCI_CONNECTION
+HciResetConnection(
+    PHCI_LINK_STATE State,
+    PHCI_CONNECTION Connection,
+    UCHAR           Flags
+    )
+/*++
+
+Routine Description:
+
+    Starts a connection afresh in a slot, whatever was in it before. The
+    caller fills in the details and publishes the handle.
+
+--*/
+{
+    USHORT generation = Connection->Generation;
+
+    Connection->Handle = HCI_INVALID_HANDLE;
+    PORTABLE_MEMORY_BARRIER();
+
+    RtlZeroMemory((PUCHAR)Connection + sizeof(Connection->Handle),
+                  sizeof(HCI_CONNECTION) - sizeof(Connection->Handle));
+
+    Connection->Generation = generation + 1;
+    Connection->Flags = Flags;
+    Connection->FixAttLength = State->DefaultFixAttLength;
+
+    return Connection;
+}
+
+static VOID
+HciPublishConnection(
+    PHCI_CONNECTION Connection,
+    USHORT          Handle
+    )
+{
+    PORTABLE_MEMORY_BARRIER();
+    Connection->Handle = Handle;
+}
+
+static PHCI_CONNECTION
+HciAllocateConnection(
+    PHCI_LINK_STATE State,
+    UCHAR           Flags
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < HCI_MAX_CONNECTIONS; i++) {
+        if (State->Connections[i].Handle == HCI_INVALID_HANDLE) {
+            return HciResetConnection(State, &State->Connections[i], Flags);
+        }
+    }
+
+    //
+    // Only happens if we missed disconnections, give up on the slots
+    // round robin.
+    //
+    i = State->NextEvict;
+    State->NextEvict = (USHORT)((State->NextEvict + 1) % HCI_MAX_CONNECTIONS);
+
+    return HciResetConnection(State, &State->Connections[i], Flags);
+}
+
+PHCI_CONNECTION
+HciLookupConnection(
+    PHCI_LINK_STATE State,
+    USHORT          Handle
+    )
+/*++
+
+Routine Description:
+
+    Finds the connection for an HCI handle. Doesn't take any lock, the
+    slots never go away and a slot's handle is only published once the
+    rest of it is consistent.
+
+Return Value:
+
+    The connection, NULL if the handle isn't connected as far as we know.
+
+--*/
+{
+    ULONG i;
+
+    for (i = 0; i < HCI_MAX_CONNECTIONS; i++) {
+        if (State->Connections[i].Handle == Handle) {
+            return &State->Connections[i];
+        }
+    }
+
+    return NULL;
+}
+
+PHCI_CONNECTION
+HciAdoptConnection(
+    PHCI_LINK_STATE State,
+    USHORT          Handle
+    )
+/*++
+
+Routine Description:
+
+    Finds the connection for an HCI handle, creating it if we never saw it
+    connect. Changes the link state, so the caller serializes it.
+
+--*/
+{
+    PHCI_CONNECTION conn;
+
+    conn = HciLookupConnection(State, Handle & 0x0FFF);
+
+    if (conn == NULL) {
+        conn = HciAllocateConnection(State, HCI_CONNECTION_ADOPTED);
+        HciPublishConnection(conn, Handle & 0x0FFF);
+    }
+
+    return conn;
+}
+
+static PHCI_CONNECTION
+HciConnectionComplete(
+    PHCI_LINK_STATE State,
+    PUCHAR          Params,
+    ULONG           ParamLength
+    )
+/*++
+
+Routine Description:
+
+    Handles LE (Enhanced) Connection Complete. Both start with
+    status handle role peer_address_type peer_address.
+
+--*/
+{
+    PHCI_CONNECTION conn;
+    USHORT          handle;
+
+    if (ParamLength < 11 || Params[0] != 0) {
+        return NULL;
+    }
+
+    handle = READ_USHORT(&Params[1]) & 0x0FFF;
+
+    conn = HciLookupConnection(State, handle);
+
+    if (conn != NULL && (conn->Flags & HCI_CONNECTION_ADOPTED)) {
+        //
+        // ACL data overtook the event on the other pipe, keep what it
+        // taught us.
+        //
+        conn->Flags &= ~HCI_CONNECTION_ADOPTED;
+    } else {
+        //
+        // A handle we still think is connected means we missed its
+        // disconnection, start it over.
+        //
+        if (conn == NULL) {
+            conn = HciAllocateConnection(State, 0);
+        } else {
+            HciResetConnection(State, conn, 0);
+        }
+    }
+
+    conn->Role = Params[3];
+    conn->PeerAddressType = Params[4];
+    RtlCopyMemory(conn->PeerAddress, &Params[5], sizeof(conn->PeerAddress));
+
+    HciPublishConnection(conn, handle);
+
+    return conn;
+}
+
+static PHCI_CONNECTION
+HciEncryptionChange(
+    PHCI_LINK_STATE State,
+    PUCHAR          Params,
+    ULONG           ParamLength
+    )
+/*++
+
+Routine Description:
+
+    Handles Encryption Change, status handle enabled. Only turning
+    encryption on is reported, a link loses it by disconnecting.
+
+--*/
+{
+    PHCI_CONNECTION conn;
+
+    if (ParamLength < 4 || Params[0] != 0 || Params[3] == 0) {
+        return NULL;
+    }
+
+    conn = HciLookupConnection(State, READ_USHORT(&Params[1]) & 0x0FFF);
+
+    if (conn != NULL) {
+        conn->Flags |= HCI_CONNECTION_ENCRYPTED;
+    }
+
+    return conn;
+}
+
+static PHCI_CONNECTION
+HciDisconnectionComplete(
+    PHCI_LINK_STATE State,
+    PUCHAR          Params,
+    ULONG           ParamLength
+    )
+{
+    PHCI_CONNECTION conn;
+
+    if (ParamLength < 4 || Params[0] != 0) {
+        return NULL;
+    }
+
+    conn = HciLookupConnection(State, READ_USHORT(&Params[1]) & 0x0FFF);
+
+    if (conn != NULL) {
+        HciResetConnection(State, conn, 0);
+    }
+
+    return conn;
+}
+
+VOID
+HciInitLinkState(
+    PHCI_LINK_STATE State
+    )
+{
+    ULONG i;
+
+    RtlZeroMemory(State, sizeof(HCI_LINK_STATE));
+
+    for (i = 0; i < HCI_MAX_CONNECTIONS; i++) {
+        State->Connections[i].Handle = HCI_INVALID_HANDLE;
+    }
+}
+
+VOID
+HciPresumeLmpVersion(
+    PHCI_LINK_STATE State,
+    UCHAR           LmpVersion
+    )
+/*++
+
+Routine Description:
+
+    Takes the LMP version from the controller profile until the adapter
+    reports its own in Read Local Version Information.
+
+--*/
+{
+    if (State->Adapter.Flags & HCI_ADAPTER_VERSION_VALID) {
+        return;
+    }
+
+    State->Adapter.LmpVersion = LmpVersion;
+    State->Adapter.Flags |= HCI_ADAPTER_VERSION_VALID | HCI_ADAPTER_VERSION_PRESUMED;
+
+    HciRecompute(State);
+}
+
+HCI_LINK_CHANGE
+HciProcessEvent(
+    PHCI_LINK_STATE State,
+    PUCHAR          Bfr,
+    ULONG           Length,
+    PHCI_CONNECTION *Connection
+    )
+/*++
+
+Routine Description:
+
+    Picks the adapter limits and connection lifecycle out of an HCI event
+    read from the interrupt in pipe.
+
+    --HCI EVENT-- ---------------COMMAND COMPLETE----------------
+    code length  ncmd opcode status hci  rev   lmp manuf subver
+     0e   0c      01  01 10   00    06 00 00 06  0a 00  00 00 (read local version)
+     0e   07      01  02 20   00    1b 00  0f                 (le read buffer size)
+
+    --HCI EVENT-- sub status handle role type -----address-------
+     3e   13      01   00    80 00   00   01  aa bb cc dd ee ff ... (le connection complete)
+     05   04           00    80 00   13                            (disconnection complete)
+     08   04           00    80 00   01                            (encryption change)
+
+Arguments:
+
+    State - Link state to update.
+
+    Bfr, Length - The event.
+
+    Connection - Receives the connection that connected, disconnected or
+        was encrypted.
+
+Return Value:
+
+    What the event changed.
+
+--*/
+{
+    PUCHAR  params;
+    ULONG   paramLength;
+    USHORT  opcode;
+
+    *Connection = NULL;
+
+    if (Length < HCI_EVENT_HEADER_LENGTH ||
+        Length < (ULONG)HCI_EVENT_HEADER_LENGTH + Bfr[1]) {
+        return HciLinkUnchanged;
+    }
+
+    switch (Bfr[0]) {
+    case HCI_EV_DISCONNECTION_COMPLETE:
+        *Connection = HciDisconnectionComplete(State, &Bfr[2], Bfr[1]);
+        return *Connection != NULL ? HciLinkDisconnected : HciLinkUnchanged;
+
+    case HCI_EV_ENCRYPTION_CHANGE:
+        *Connection = HciEncryptionChange(State, &Bfr[2], Bfr[1]);
+        return *Connection != NULL ? HciLinkEncrypted : HciLinkUnchanged;
+
+    case HCI_EV_LE_META:
+        if (Bfr[1] < 1 ||
+            (Bfr[2] != HCI_LE_EV_CONNECTION_COMPLETE &&
+             Bfr[2] != HCI_LE_EV_ENHANCED_CONNECTION_COMPLETE)) {
+            return HciLinkUnchanged;
+        }
+        *Connection = HciConnectionComplete(State, &Bfr[3], Bfr[1] - 1);
+        return *Connection != NULL ? HciLinkConnected : HciLinkUnchanged;
+
+    case HCI_EV_COMMAND_COMPLETE:
+        break;
+
+    default:
+        return HciLinkUnchanged;
+    }
+
+    if (Bfr[1] < 4) {
+        return HciLinkUnchanged;
+    }
+
+    opcode = READ_USHORT(&Bfr[3]);
+
+    //
+    // Return parameters start with the status.
+    //
+    params = &Bfr[6];
+    paramLength = Bfr[1] - 4;
+
+    if (Bfr[5] != 0) {
+        return HciLinkUnchanged;
+    }
+
+    switch (opcode) {
+    case HCI_OP_READ_LOCAL_VERSION:
+        if (paramLength < 8) {
+            return HciLinkUnchanged;
+        }
+        State->Adapter.HciVersion = params[0];
+        State->Adapter.HciRevision = READ_USHORT(&params[1]);
+        State->Adapter.LmpVersion = params[3];
+        State->Adapter.Manufacturer = READ_USHORT(&params[4]);
+        State->Adapter.LmpSubversion = READ_USHORT(&params[6]);
+        State->Adapter.Flags |= HCI_ADAPTER_VERSION_VALID;
+        State->Adapter.Flags &= ~HCI_ADAPTER_VERSION_PRESUMED;
+        break;
+    case HCI_OP_READ_BUFFER_SIZE:
+        if (paramLength < 7) {
+            return HciLinkUnchanged;
+        }
+        State->Adapter.AclDataPacketLength = READ_USHORT(&params[0]);
+        State->Adapter.TotalAclDataPackets = READ_USHORT(&params[3]);
+        State->Adapter.Flags |= HCI_ADAPTER_BUFFER_VALID;
+
+        //
+        // Controllers without dedicated LE buffers report 0 for
+        // LE Read Buffer Size and share the ACL buffers.
+        //
+        if ((State->Adapter.Flags & HCI_ADAPTER_LE_BUFFER_VALID) &&
+            State->Adapter.LeAclDataPacketLength == 0) {
+            State->Adapter.LeAclDataPacketLength = State->Adapter.AclDataPacketLength;
+        }
+        break;
+    case HCI_OP_LE_READ_BUFFER_SIZE:
+        if (paramLength < 3) {
+            return HciLinkUnchanged;
+        }
+        State->Adapter.LeAclDataPacketLength = READ_USHORT(&params[0]);
+        State->Adapter.TotalLeAclDataPackets = params[2];
+        if (State->Adapter.LeAclDataPacketLength == 0) {
+            State->Adapter.LeAclDataPacketLength = State->Adapter.AclDataPacketLength;
+        }
+        State->Adapter.Flags |= HCI_ADAPTER_LE_BUFFER_VALID;
+        break;
+    default:
+        return HciLinkUnchanged;
+    }
+
+    HciRecompute(State);
+
+    return HciLinkAdapterChanged;
+}
+
+BOOLEAN
+HciProcessAclPacket(
+    PHCI_LINK_STATE State,
+    int             Direction,
+    PUCHAR          Bfr,
+    ULONG           Length
+    )
+/*++
+
+Routine Description:
+
+    Records the Rx MTU carried by an ATT Exchange MTU request or response.
+    Either side may start the exchange, so what we send is always our MTU
+    and what we receive is always the remote's.
+
+    ---HCI----- ---L2CAP--- --ATT---
+    80 00 07 00 03 00 04 00 02 0d 02
+
+Arguments:
+
+    State - Link state to update.
+
+    Direction - HCI_DIRECTION_OUT or HCI_DIRECTION_IN.
+
+    Bfr, Length - The ACL packet.
+
+Return Value:
+
+    TRUE if the packet changed the link state.
+
+--*/
+{
+    PHCI_CONNECTION conn;
+    USHORT          mtu;
+
+    if (!HCI_IS_LINK_STATE_PDU(Bfr, Length) ||
+        Length < ATT_PDU_OFFSET + 3) {
+        return FALSE;
+    }
+
+    conn = HciAdoptConnection(State, HCI_ACL_HANDLE(Bfr));
+    mtu = READ_USHORT(&Bfr[ATT_PDU_OFFSET + 1]);
+
+    if (Direction == HCI_DIRECTION_OUT) {
+        conn->LocalMtu = mtu;
+    } else {
+        conn->RemoteMtu = mtu;
+    }
+
+    if (!(conn->Flags & HCI_CONNECTION_FIX_FORCED)) {
+        conn->FixAttLength = HciComputeFixAttLength(&State->Adapter,
+                                                    conn->LocalMtu,
+                                                    conn->RemoteMtu);
+    }
+
+    return TRUE;
+}
+
+USHORT
+HciGetFixAttLength(
+    PHCI_LINK_STATE State,
+    USHORT          Handle
+    )
+/*++
+
+Routine Description:
+
+    Returns the ATT length incoming notifications on a connection are
+    trimmed to, 0 if they are passed up untouched.
+
+--*/
+{
+    PHCI_CONNECTION conn;
+
+    conn = HciLookupConnection(State, Handle);
+
+    if (conn != NULL) {
+        return conn->FixAttLength;
+    }
+
+    return State->DefaultFixAttLength;
+}
+
+BOOLEAN
+HciForceFixAttLength(
+    PHCI_LINK_STATE State,
+    USHORT          Handle
+    )
+/*++
+
+Routine Description:
+
+    Trims the notifications of a connection to the length of the manual
+    fix from now on, for as long as it stays connected.
+
+Return Value:
+
+    FALSE if the connection isn't known or already trimmed that far.
+
+--*/
+{
+    PHCI_CONNECTION conn;
+
+    conn = HciLookupConnection(State, Handle);
+
+    if (conn == NULL ||
+        (conn->FixAttLength != 0 && conn->FixAttLength <= HCI_LEGACY_FIX_ATT_LENGTH)) {
+        return FALSE;
+    }
+
+    conn->Flags |= HCI_CONNECTION_FIX_FORCED;
+    conn->FixAttLength = HCI_LEGACY_FIX_ATT_LENGTH;
+
+    return TRUE;
+}
@@ -0,0 +1,315 @@
+/*++
+
+Module Name:
+
+    hci.h
+
+Abstract:
+
+    HCI, L2CAP and ATT framing as seen on the USB pipes of the bluetooth
+    adapter, and the link state the filter derives from snooping it.
+
+    The adapter reports its limits in the command complete events for
+    Read Local Version Information, Read Buffer Size and LE Read Buffer Size
+    while the host stack initialises it, the buffer sizes with the number
+    of ACL packets the controller takes before it completes one. The ATT MTU of each connection comes
+    from the Exchange MTU request/response pair. From those we work out, per
+    adapter and per connection, whether incoming notifications need the
+    HCI/L2CAP header fix and how long they may be.
+
+    Connections are tracked from the LE Connection Complete and
+    Disconnection Complete events, so per-connection state starts clean
+    when the remote reconnects on a handle that was used before.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "portable.h"
+
+#if !defined(_HCI_H_)
+#define _HCI_H_
+
+//
+// Directions as passed to HciProcessAclPacket. These match
+// USBD_TRANSFER_DIRECTION_OUT/IN.
+//
+#define HCI_DIRECTION_OUT               0
+#define HCI_DIRECTION_IN                1
+
+//
+// HCI ACL data header
+// -------HCI--------
+// handle+flags  length
+//   80 20        09 00
+//
+#define HCI_ACL_HEADER_LENGTH           4
+#define HCI_ACL_HANDLE(Bfr)             ((USHORT)(((Bfr)[0] | ((Bfr)[1] << 8)) & 0x0FFF))
+#define HCI_ACL_PB_FLAG(Bfr)            (((Bfr)[1] >> 4) & 0x03)
+#define HCI_ACL_LENGTH(Bfr)             ((USHORT)((Bfr)[2] | ((Bfr)[3] << 8)))
+
+#define HCI_ACL_PB_FIRST_NON_FLUSHABLE  0x00
+#define HCI_ACL_PB_CONTINUING           0x01
+#define HCI_ACL_PB_FIRST_FLUSHABLE      0x02
+
+#define HCI_ACL_IS_FIRST_FRAGMENT(Bfr)  (HCI_ACL_PB_FLAG(Bfr) != HCI_ACL_PB_CONTINUING)
+
+#define HCI_INVALID_HANDLE              0xFFFF
+
+//
+// L2CAP basic header, follows the HCI ACL header
+//
+#define L2CAP_HEADER_LENGTH             4
+#define L2CAP_LENGTH(Bfr)               ((USHORT)((Bfr)[4] | ((Bfr)[5] << 8)))
+#define L2CAP_CID(Bfr)                  ((USHORT)((Bfr)[6] | ((Bfr)[7] << 8)))
+
+#define L2CAP_CID_ATT                   0x0004
+
+//
+// ATT PDU, follows the L2CAP header
+//
+#define ATT_PDU_OFFSET                  (HCI_ACL_HEADER_LENGTH + L2CAP_HEADER_LENGTH)
+#define ATT_HANDLE(Bfr)                 ((USHORT)((Bfr)[ATT_PDU_OFFSET + 1] | ((Bfr)[ATT_PDU_OFFSET + 2] << 8)))
+
+#define ATT_OP_ERROR_RSP                0x01
+#define ATT_OP_READ_MULTIPLE_VAR_RSP    0x21
+#define ATT_OP_EXCHANGE_MTU_REQ         0x02
+#define ATT_OP_EXCHANGE_MTU_RSP         0x03
+#define ATT_OP_READ_BY_TYPE_REQ         0x08
+#define ATT_OP_READ_BY_TYPE_RSP         0x09
+#define ATT_OP_READ_REQ                 0x0A
+#define ATT_OP_READ_RSP                 0x0B
+#define ATT_OP_READ_BLOB_REQ            0x0C
+#define ATT_OP_READ_BLOB_RSP            0x0D
+#define ATT_OP_WRITE_REQ                0x12
+#define ATT_OP_WRITE_RSP                0x13
+#define ATT_OP_PREPARE_WRITE_REQ        0x16
+#define ATT_OP_HANDLE_VALUE_NTF         0x1B
+#define ATT_OP_HANDLE_VALUE_IND         0x1D
+#define ATT_OP_WRITE_CMD                0x52
+#define ATT_OP_SIGNED_WRITE_CMD         0xD2
+
+#define ATT_DEFAULT_LE_MTU              23
+
+//
+// Error codes of an error response
+// opcode request_opcode handle error
+//   01       12         1d 00   05
+//
+#define ATT_ERROR_RSP_LENGTH            5
+#define ATT_ERR_INSUFFICIENT_AUTHENTICATION 0x05
+#define ATT_ERR_INVALID_OFFSET              0x07
+#define ATT_ERR_ATTRIBUTE_NOT_LONG          0x0B
+#define ATT_ERR_INSUFFICIENT_ENC_KEY_SIZE   0x0C
+#define ATT_ERR_INSUFFICIENT_ENCRYPTION     0x0F
+
+//
+// Requests are even, their responses the next odd opcode. Commands,
+// notifications, indications and confirmations aren't answered.
+//
+#define ATT_IS_REQUEST(Op)                              \
+    (((Op) & 0x01) == 0 &&                              \
+     (Op) >= ATT_OP_EXCHANGE_MTU_REQ &&                 \
+     (Op) < ATT_OP_READ_MULTIPLE_VAR_RSP &&             \
+     (Op) != 0x1E)
+
+#define ATT_IS_RESPONSE(Op)                             \
+    (((Op) & 0x01) != 0 &&                              \
+     (Op) <= ATT_OP_READ_MULTIPLE_VAR_RSP &&            \
+     (Op) != ATT_OP_HANDLE_VALUE_NTF &&                 \
+     (Op) != ATT_OP_HANDLE_VALUE_IND)
+
+//
+// ATT length the manual header fix has always trimmed notifications to,
+// one less than the default LE MTU. TransferBufferLength ends up as 30.
+//
+#define HCI_LEGACY_FIX_ATT_LENGTH       (ATT_DEFAULT_LE_MTU - 1)
+
+//
+// TRUE if Bfr holds the start of an ATT PDU carried on the fixed ATT channel.
+//
+#define HCI_IS_ATT_PDU(Bfr, Length)                     \
+    ((Length) > ATT_PDU_OFFSET &&                       \
+     HCI_ACL_IS_FIRST_FRAGMENT(Bfr) &&                  \
+     L2CAP_CID(Bfr) == L2CAP_CID_ATT)
+
+//
+// TRUE if Bfr is an ATT PDU that changes the link state, i.e. has to be
+// passed to HciProcessAclPacket.
+//
+#define HCI_IS_LINK_STATE_PDU(Bfr, Length)              \
+    (HCI_IS_ATT_PDU(Bfr, Length) &&                     \
+     ((Bfr)[ATT_PDU_OFFSET] == ATT_OP_EXCHANGE_MTU_REQ ||   \
+      (Bfr)[ATT_PDU_OFFSET] == ATT_OP_EXCHANGE_MTU_RSP))
+
+//
+// HCI events, as read from the interrupt in pipe
+// code length parameters...
+//
+#define HCI_EVENT_HEADER_LENGTH         2
+
+#define HCI_EV_DISCONNECTION_COMPLETE   0x05
+#define HCI_EV_ENCRYPTION_CHANGE        0x08
+#define HCI_EV_COMMAND_COMPLETE         0x0E
+#define HCI_EV_NUMBER_OF_COMPLETED_PACKETS  0x13
+#define HCI_EV_LE_META                  0x3E
+
+#define HCI_LE_EV_CONNECTION_COMPLETE           0x01
+#define HCI_LE_EV_ENHANCED_CONNECTION_COMPLETE  0x0A
+
+#define HCI_OP_READ_LOCAL_VERSION       0x1001
+#define HCI_OP_READ_BUFFER_SIZE         0x1005
+#define HCI_OP_LE_READ_BUFFER_SIZE      0x2002
+
+//
+// LMP/HCI version numbers of the core specification
+//
+#define HCI_LMP_VERSION_4_0             6
+#define HCI_LMP_VERSION_4_1             7
+#define HCI_LMP_VERSION_4_2             8
+
+//
+// What we learned about the adapter from its command complete events.
+//
+#define HCI_ADAPTER_VERSION_VALID       0x01
+#define HCI_ADAPTER_BUFFER_VALID        0x02
+#define HCI_ADAPTER_LE_BUFFER_VALID     0x04
+#define HCI_ADAPTER_VERSION_PRESUMED    0x08    // version came from the controller profile
+
+typedef struct _HCI_ADAPTER_INFO {
+
+    UCHAR   Flags;
+    UCHAR   HciVersion;
+    UCHAR   LmpVersion;
+    USHORT  HciRevision;
+    USHORT  Manufacturer;
+    USHORT  LmpSubversion;
+    USHORT  AclDataPacketLength;
+    USHORT  LeAclDataPacketLength;
+    USHORT  TotalAclDataPackets;
+    USHORT  TotalLeAclDataPackets;  // 0 if LE shares the ACL buffers
+
+} HCI_ADAPTER_INFO, *PHCI_ADAPTER_INFO;
+
+#define HCI_MAX_CONNECTIONS             8
+
+//
+// The connection was created by traffic on a handle we had no connection
+// complete event for, e.g. the filter started with the remote connected or
+// ACL data overtook the event on the other pipe.
+//
+#define HCI_CONNECTION_ADOPTED          0x01
+#define HCI_CONNECTION_ENCRYPTED        0x02
+
+//
+// FixAttLength was forced to HCI_LEGACY_FIX_ATT_LENGTH after the upper
+// stack stalled, it no longer follows the MTU and the adapter's limits.
+//
+#define HCI_CONNECTION_FIX_FORCED       0x04
+
+typedef struct _HCI_CONNECTION {
+
+    //
+    // HCI_INVALID_HANDLE while the slot is free. Cleared first when the slot
+    // is reset and set last once it is filled in, so lockless lookups never
+    // see a handle paired with another connection's state.
+    //
+    volatile USHORT Handle;
+
+    USHORT  Generation;     // bumped every time the slot is reset
+    UCHAR   Flags;          // HCI_CONNECTION_*
+    UCHAR   Role;           // 0 central, 1 peripheral
+    UCHAR   PeerAddressType;
+    UCHAR   PeerAddress[6];
+    USHORT  LocalMtu;       // our Rx MTU from the exchange, 0 if not seen
+    USHORT  RemoteMtu;      // the remote's Rx MTU from the exchange, 0 if not seen
+    USHORT  FixAttLength;   // ATT length notifications are trimmed to, 0 for none
+
+} HCI_CONNECTION, *PHCI_CONNECTION;
+
+typedef struct _HCI_LINK_STATE {
+
+    HCI_ADAPTER_INFO    Adapter;
+
+    //
+    // Used for connections we know nothing about.
+    //
+    USHORT              DefaultFixAttLength;
+
+    //
+    // Where to look for a slot to evict when the table is full because
+    // disconnections were missed.
+    //
+    USHORT              NextEvict;
+
+    HCI_CONNECTION      Connections[HCI_MAX_CONNECTIONS];
+
+} HCI_LINK_STATE, *PHCI_LINK_STATE;
+
+//
+// What an HCI event did to the link state.
+//
+typedef enum _HCI_LINK_CHANGE {
+
+    HciLinkUnchanged = 0,
+    HciLinkAdapterChanged,
+    HciLinkConnected,
+    HciLinkDisconnected,
+    HciLinkEncrypted
+
+} HCI_LINK_CHANGE;
+
+VOID
+HciInitLinkState(
+    PHCI_LINK_STATE State
+    );
+
+VOID
+HciPresumeLmpVersion(
+    PHCI_LINK_STATE State,
+    UCHAR           LmpVersion
+    );
+
+HCI_LINK_CHANGE
+HciProcessEvent(
+    PHCI_LINK_STATE State,
+    PUCHAR          Bfr,
+    ULONG           Length,
+    PHCI_CONNECTION *Connection
+    );
+
+PHCI_CONNECTION
+HciLookupConnection(
+    PHCI_LINK_STATE State,
+    USHORT          Handle
+    );
+
+PHCI_CONNECTION
+HciAdoptConnection(
+    PHCI_LINK_STATE State,
+    USHORT          Handle
+    );
+
+BOOLEAN
+HciProcessAclPacket(
+    PHCI_LINK_STATE State,
+    int             Direction,
+    PUCHAR          Bfr,
+    ULONG           Length
+    );
+
+USHORT
+HciGetFixAttLength(
+    PHCI_LINK_STATE State,
+    USHORT          Handle
+    );
+
+BOOLEAN
+HciForceFixAttLength(
+    PHCI_LINK_STATE State,
+    USHORT          Handle
+    );
+
+#endif
@@ -0,0 +1,208 @@
+/*++
+
+Module Name:
+
+    latency.c
+
+Abstract:
+
+    Latency of remote input, see latency.h.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "latency.h"
+
+#define LATENCY_NS_PER_SECOND       1000000000LL
+
+static LONGLONG
+LatencyScale(
+    LONGLONG    Ticks,
+    LONGLONG    To,
+    LONGLONG    From
+    )
+/*++
+
+Routine Description:
+
+    Ticks of a From Hz counter in ticks of a To Hz one. Whole seconds are
+    scaled apart from the rest, so a counter hours from its base doesn't
+    overflow.
+
+--*/
+{
+    if (To == From || From == 0) {
+        return Ticks;
+    }
+
+    return Ticks / From * To + Ticks % From * To / From;
+}
+
+LONGLONG
+LatencyTicksToNs(
+    LONGLONG    Ticks,
+    LONGLONG    Frequency
+    )
+{
+    return LatencyScale(Ticks, LATENCY_NS_PER_SECOND, Frequency);
+}
+
+VOID
+LatencyClockInit(
+    PLATENCY_CLOCK  Clock,
+    LONGLONG        DriverFrequency,
+    LONGLONG        Frequency
+    )
+{
+    RtlZeroMemory(Clock, sizeof(LATENCY_CLOCK));
+
+    Clock->DriverFrequency = DriverFrequency;
+    Clock->Frequency = Frequency;
+}
+
+VOID
+LatencyClockSample(
+    PLATENCY_CLOCK  Clock,
+    LONGLONG        Before,
+    LONGLONG        Driver,
+    LONGLONG        After
+    )
+/*++
+
+Routine Description:
+
+    Takes the driver counter to have been read halfway between Before and
+    After. The mapping is then off by at most half the round trip, so a
+    sample only replaces one that came back faster when the two disagree by
+    more than that allows, the counters drifted apart since.
+
+--*/
+{
+    LONGLONG roundTrip = After - Before;
+    LONGLONG drift;
+
+    if (roundTrip < 0) {
+        return;
+    }
+
+    if (Clock->Sampled && roundTrip > Clock->RoundTrip) {
+
+        drift = LatencyClockToReader(Clock, Driver) - (Before + roundTrip / 2);
+        if (drift < 0) {
+            drift = -drift;
+        }
+
+        if (drift <= (roundTrip + Clock->RoundTrip) / 2) {
+            return;
+        }
+    }
+
+    Clock->DriverBase = Driver;
+    Clock->Base = Before + roundTrip / 2;
+    Clock->RoundTrip = roundTrip;
+    Clock->Sampled = TRUE;
+}
+
+LONGLONG
+LatencyClockToReader(
+    const LATENCY_CLOCK *Clock,
+    LONGLONG            Driver
+    )
+{
+    if (!Clock->Sampled) {
+        return LatencyScale(Driver, Clock->Frequency, Clock->DriverFrequency);
+    }
+
+    return Clock->Base + LatencyScale(Driver - Clock->DriverBase, Clock->Frequency, Clock->DriverFrequency);
+}
+
+VOID
+LatencyHistogramAdd(
+    PLATENCY_HISTOGRAM  Histogram,
+    LONGLONG            Ns
+    )
+{
+    ULONGLONG   ns;
+    ULONG       bucket = 0;
+
+    if (Ns < 0) {
+        Histogram->Negative++;
+        Ns = 0;
+    }
+
+    ns = (ULONGLONG)Ns;
+
+    while (ns > 0 && bucket < LATENCY_BUCKETS - 1) {
+        ns >>= 1;
+        bucket++;
+    }
+
+    Histogram->Buckets[bucket]++;
+    Histogram->Count++;
+    Histogram->Sum += (ULONGLONG)Ns;
+    Histogram->Max = max(Histogram->Max, (ULONGLONG)Ns);
+}
+
+ULONGLONG
+LatencyHistogramPercentile(
+    const LATENCY_HISTOGRAM *Histogram,
+    ULONG                   PerMille
+    )
+{
+    ULONGLONG   rank = (Histogram->Count * PerMille + 999) / 1000;
+    ULONGLONG   seen = 0;
+    ULONG       bucket;
+
+    if (Histogram->Count == 0) {
+        return 0;
+    }
+
+    for (bucket = 0; bucket < LATENCY_BUCKETS - 1; bucket++) {
+        seen += Histogram->Buckets[bucket];
+
+        if (seen >= rank) {
+            return min((ULONGLONG)1 << bucket, Histogram->Max);
+        }
+    }
+
+    return Histogram->Max;
+}
+
+VOID
+LatencyTrackerInit(
+    PLATENCY_TRACKER    Tracker,
+    LONGLONG            DriverFrequency,
+    LONGLONG            Frequency
+    )
+{
+    RtlZeroMemory(Tracker, sizeof(LATENCY_TRACKER));
+
+    LatencyClockInit(&Tracker->Clock, DriverFrequency, Frequency);
+}
+
+VOID
+LatencyTrackerAdd(
+    PLATENCY_TRACKER    Tracker,
+    LONGLONG            Stamp,
+    LONGLONG            Taken,
+    LONGLONG            Received,
+    LONGLONG            Decoded,
+    LONGLONG            Acted
+    )
+{
+    LONGLONG frequency = Tracker->Clock.Frequency;
+
+    LatencyHistogramAdd(&Tracker->Stages[LATENCY_STAGE_DRIVER],
+                        LatencyTicksToNs(Taken - Stamp, Tracker->Clock.DriverFrequency));
+    LatencyHistogramAdd(&Tracker->Stages[LATENCY_STAGE_DELIVERY],
+                        LatencyTicksToNs(Received - LatencyClockToReader(&Tracker->Clock, Taken), frequency));
+    LatencyHistogramAdd(&Tracker->Stages[LATENCY_STAGE_DECODE],
+                        LatencyTicksToNs(Decoded - Received, frequency));
+    LatencyHistogramAdd(&Tracker->Stages[LATENCY_STAGE_ACTION],
+                        LatencyTicksToNs(Acted - Decoded, frequency));
+    LatencyHistogramAdd(&Tracker->Stages[LATENCY_STAGE_TOTAL],
+                        LatencyTicksToNs(Acted - LatencyClockToReader(&Tracker->Clock, Stamp), frequency));
+}
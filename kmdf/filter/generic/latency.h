@@ -0,0 +1,160 @@
+/*++
+
+Module Name:
+
+    latency.h
+
+Abstract:
+
+    Latency of remote input, from the URB that brought a report in to the
+    reader acting on it, for readers of IOCTL_GET_EVENTS.
+
+    An event's time is split into stages:
+
+    DRIVER      the URB completing to the read taking the event, the
+                event's Stamp to the buffer's Taken, both driver counter
+    DELIVERY    the read taking it to the reader getting to it, which
+                includes the events before it in the buffer
+    DECODE      the reader turning the event into its own input
+    ACTION      the reader acting on that input
+    TOTAL       the URB completing to the action
+
+    and each stage has a histogram of log2 nanosecond buckets.
+
+    The driver stamps with its performance counter, the reader times the
+    later stages with a counter of its own. On Windows both are the one
+    QueryPerformanceCounter reads, elsewhere the driver's counter is mapped
+    onto the reader's from samples of IOCTL_GET_CLOCK, keeping the one that
+    came back fastest.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "portable.h"
+#include "public.h"
+
+#if !defined(_LATENCY_H_)
+#define _LATENCY_H_
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define LATENCY_STAGE_DRIVER        0
+#define LATENCY_STAGE_DELIVERY      1
+#define LATENCY_STAGE_DECODE        2
+#define LATENCY_STAGE_ACTION        3
+#define LATENCY_STAGE_TOTAL         4
+#define LATENCY_STAGES              5
+
+//
+// Bucket 0 holds times under 1ns, bucket b times from 2^(b-1)ns up to
+// 2^b ns, the last one everything longer.
+//
+#define LATENCY_BUCKETS             40
+
+typedef struct _LATENCY_CLOCK {
+
+    LONGLONG    DriverFrequency;    // driver counter ticks per second
+    LONGLONG    Frequency;          // reader counter ticks per second
+    LONGLONG    DriverBase;         // the two counters at the same moment
+    LONGLONG    Base;
+    LONGLONG    RoundTrip;          // reader ticks the kept sample took
+    BOOLEAN     Sampled;            // FALSE while the counters are taken to be one
+
+} LATENCY_CLOCK, *PLATENCY_CLOCK;
+
+typedef struct _LATENCY_HISTOGRAM {
+
+    ULONGLONG   Count;
+    ULONGLONG   Negative;           // times below 0 from mapping error, counted as 0
+    ULONGLONG   Sum;                // ns
+    ULONGLONG   Max;
+    ULONGLONG   Buckets[LATENCY_BUCKETS];
+
+} LATENCY_HISTOGRAM, *PLATENCY_HISTOGRAM;
+
+typedef struct _LATENCY_TRACKER {
+
+    LATENCY_CLOCK       Clock;
+    LATENCY_HISTOGRAM   Stages[LATENCY_STAGES];
+
+} LATENCY_TRACKER, *PLATENCY_TRACKER;
+
+VOID
+LatencyClockInit(
+    PLATENCY_CLOCK  Clock,
+    LONGLONG        DriverFrequency,
+    LONGLONG        Frequency
+    );
+
+//
+// Before and After are the reader's counter around IOCTL_GET_CLOCK, Driver
+// the PerformanceCounter it returned.
+//
+VOID
+LatencyClockSample(
+    PLATENCY_CLOCK  Clock,
+    LONGLONG        Before,
+    LONGLONG        Driver,
+    LONGLONG        After
+    );
+
+LONGLONG
+LatencyClockToReader(
+    const LATENCY_CLOCK *Clock,
+    LONGLONG            Driver
+    );
+
+LONGLONG
+LatencyTicksToNs(
+    LONGLONG    Ticks,
+    LONGLONG    Frequency
+    );
+
+VOID
+LatencyHistogramAdd(
+    PLATENCY_HISTOGRAM  Histogram,
+    LONGLONG            Ns
+    );
+
+//
+// Upper bound of the bucket the PerMille'th time falls in, capped at the
+// longest time seen.
+//
+ULONGLONG
+LatencyHistogramPercentile(
+    const LATENCY_HISTOGRAM *Histogram,
+    ULONG                   PerMille
+    );
+
+VOID
+LatencyTrackerInit(
+    PLATENCY_TRACKER    Tracker,
+    LONGLONG            DriverFrequency,
+    LONGLONG            Frequency
+    );
+
+//
+// Adds an event to the histograms. Stamp and Taken are driver counter,
+// Received, Decoded and Acted the reader's counter when it got to the
+// event, had decoded it and had acted on it.
+//
+VOID
+LatencyTrackerAdd(
+    PLATENCY_TRACKER    Tracker,
+    LONGLONG            Stamp,
+    LONGLONG            Taken,
+    LONGLONG            Received,
+    LONGLONG            Decoded,
+    LONGLONG            Acted
+    );
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
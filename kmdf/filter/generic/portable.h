@@ -0,0 +1,93 @@
+/*++
+
+Module Name:
+
+    portable.h
+
+Abstract:
+
+    Base types for the modules of the filter that only parse and track
+    Bluetooth traffic and never touch WDF. Kernel builds get the types from
+    ntddk.h and usermode builds on Windows from windows.h. Anything else gets
+    them from the C runtime so that the same sources can be compiled into
+    usermode tools.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#if !defined(_PORTABLE_H_)
+#define _PORTABLE_H_
+
+#if defined(_KERNEL_MODE)
+
+#include <ntddk.h>
+
+#elif defined(_WIN32)
+
+#include <windows.h>
+
+#else
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define VOID void
+
+typedef void *          PVOID;
+typedef char            CHAR, *PCHAR;
+typedef uint8_t         UCHAR, *PUCHAR;
+typedef uint8_t         BOOLEAN, *PBOOLEAN;
+typedef int16_t         SHORT, *PSHORT;
+typedef uint16_t        USHORT, *PUSHORT;
+typedef int32_t         LONG, *PLONG;
+typedef uint32_t        ULONG, *PULONG;
+typedef int64_t         LONGLONG, *PLONGLONG;
+typedef uint64_t        ULONGLONG, *PULONGLONG;
+typedef uintptr_t       ULONG_PTR;
+
+#define TRUE    1
+#define FALSE   0
+
+#define RtlZeroMemory(Destination, Length)          memset((Destination), 0, (Length))
+#define RtlCopyMemory(Destination, Source, Length)  memcpy((Destination), (Source), (Length))
+#define RtlEqualMemory(Destination, Source, Length) (!memcmp((Destination), (Source), (Length)))
+#define UNREFERENCED_PARAMETER(P)                   ((void)(P))
+#define FIELD_OFFSET(Type, Field)                   offsetof(Type, Field)
+#define C_ASSERT(e)                                 typedef char __C_ASSERT__[(e) ? 1 : -1]
+
+#endif
+
+//
+// Orders the stores that fill in a table entry before the store that
+// publishes it to lockless readers.
+//
+#if defined(_KERNEL_MODE)
+#define PORTABLE_MEMORY_BARRIER()   KeMemoryBarrier()
+#elif defined(_WIN32)
+#define PORTABLE_MEMORY_BARRIER()   MemoryBarrier()
+#else
+#define PORTABLE_MEMORY_BARRIER()   __sync_synchronize()
+#endif
+
+//
+// Returns the incremented value.
+//
+#if defined(_KERNEL_MODE) || defined(_WIN32)
+#define PORTABLE_INTERLOCKED_INCREMENT(Addend)  InterlockedIncrement(Addend)
+#else
+#define PORTABLE_INTERLOCKED_INCREMENT(Addend)  __sync_add_and_fetch((Addend), 1)
+#endif
+
+#if !defined(min)
+#define min(a, b)   (((a) < (b)) ? (a) : (b))
+#endif
+
+#if !defined(max)
+#define max(a, b)   (((a) > (b)) ? (a) : (b))
+#endif
+
+#endif
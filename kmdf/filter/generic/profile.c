@@ -0,0 +1,284 @@
+/*++
+
+Module Name:
+
+    profile.c
+
+Abstract:
+
+    Controller profiles and their packet matchers.
+
+    The Marvell AVASTAR the filter was written against always gives the
+    remote ACL handle 0x080 and marks incoming first fragments flushable,
+    so its matchers compare every byte against constants like the original
+    code did. Other controllers hand out handles their own way, their
+    matchers accept any handle on a first fragment and leave it to the
+    connection table to say which connection it is.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "profile.h"
+
+//
+// Matchers for controllers that put the remote on handle 0x080
+//
+
+static BOOLEAN
+ProfileMatchHidNotification080(
+    PUCHAR  Bfr,
+    ULONG   Length
+    )
+{
+    return Length > ATT_PDU_OFFSET + 2 &&
+           Bfr[0] == 0x80 &&
+           Bfr[1] == 0x20 &&
+           Bfr[3] == 0x00 &&
+           Bfr[5] == 0x00 &&
+           Bfr[6] == 0x04 &&
+           Bfr[7] == 0x00 &&
+           Bfr[8] == ATT_OP_HANDLE_VALUE_NTF &&
+           Bfr[9] == SIRI_ATT_HID_REPORT &&
+           Bfr[10] == 0x00;
+}
+
+static BOOLEAN
+ProfileMatchMagicWrite080(
+    PUCHAR  Bfr,
+    ULONG   Length
+    )
+{
+    return Length == 12 &&
+           Bfr[0] == 0x80 &&
+           Bfr[1] == 0x00 &&
+           Bfr[2] == 0x08 &&
+           Bfr[3] == 0x00 &&
+           Bfr[4] == 0x04 &&
+           Bfr[5] == 0x00 &&
+           Bfr[6] == 0x04 &&
+           Bfr[7] == 0x00 &&
+           Bfr[8] == ATT_OP_WRITE_CMD &&
+           Bfr[9] == SIRI_ATT_BATTERY_LEVEL &&
+           Bfr[10] == 0x00 &&
+           Bfr[11] == SIRI_MAGIC_VALUE;
+}
+
+static BOOLEAN
+ProfileMatchNotifyEnableWrite080(
+    PUCHAR  Bfr,
+    ULONG   Length
+    )
+{
+    return Length == 13 &&
+           Bfr[0] == 0x80 &&
+           Bfr[1] == 0x00 &&
+           Bfr[2] == 0x09 &&
+           Bfr[3] == 0x00 &&
+           Bfr[4] == 0x05 &&
+           Bfr[5] == 0x00 &&
+           Bfr[6] == 0x04 &&
+           Bfr[7] == 0x00 &&
+           Bfr[8] == ATT_OP_WRITE_REQ &&
+           Bfr[9] == SIRI_ATT_BATTERY_LEVEL_CCCD &&
+           Bfr[10] == 0x00 &&
+           Bfr[11] == 0x01 &&
+           Bfr[12] == 0x00;
+}
+
+//
+// Matchers for controllers that use any handle
+//
+
+static BOOLEAN
+ProfileMatchHidNotificationAny(
+    PUCHAR  Bfr,
+    ULONG   Length
+    )
+{
+    return Length > ATT_PDU_OFFSET + 2 &&
+           HCI_ACL_IS_FIRST_FRAGMENT(Bfr) &&
+           Bfr[3] == 0x00 &&
+           Bfr[5] == 0x00 &&
+           Bfr[6] == 0x04 &&
+           Bfr[7] == 0x00 &&
+           Bfr[8] == ATT_OP_HANDLE_VALUE_NTF &&
+           Bfr[9] == SIRI_ATT_HID_REPORT &&
+           Bfr[10] == 0x00;
+}
+
+static BOOLEAN
+ProfileMatchMagicWriteAny(
+    PUCHAR  Bfr,
+    ULONG   Length
+    )
+{
+    return Length == 12 &&
+           HCI_ACL_IS_FIRST_FRAGMENT(Bfr) &&
+           Bfr[2] == 0x08 &&
+           Bfr[3] == 0x00 &&
+           Bfr[4] == 0x04 &&
+           Bfr[5] == 0x00 &&
+           Bfr[6] == 0x04 &&
+           Bfr[7] == 0x00 &&
+           Bfr[8] == ATT_OP_WRITE_CMD &&
+           Bfr[9] == SIRI_ATT_BATTERY_LEVEL &&
+           Bfr[10] == 0x00 &&
+           Bfr[11] == SIRI_MAGIC_VALUE;
+}
+
+static BOOLEAN
+ProfileMatchNotifyEnableWriteAny(
+    PUCHAR  Bfr,
+    ULONG   Length
+    )
+{
+    return Length == 13 &&
+           HCI_ACL_IS_FIRST_FRAGMENT(Bfr) &&
+           Bfr[2] == 0x09 &&
+           Bfr[3] == 0x00 &&
+           Bfr[4] == 0x05 &&
+           Bfr[5] == 0x00 &&
+           Bfr[6] == 0x04 &&
+           Bfr[7] == 0x00 &&
+           Bfr[8] == ATT_OP_WRITE_REQ &&
+           Bfr[9] == SIRI_ATT_BATTERY_LEVEL_CCCD &&
+           Bfr[10] == 0x00 &&
+           Bfr[11] == 0x01 &&
+           Bfr[12] == 0x00;
+}
+
+#define PROFILE_MATCHERS_080    \
+    ProfileMatchHidNotification080, ProfileMatchMagicWrite080, ProfileMatchNotifyEnableWrite080
+
+#define PROFILE_MATCHERS_ANY    \
+    ProfileMatchHidNotificationAny, ProfileMatchMagicWriteAny, ProfileMatchNotifyEnableWriteAny
+
+//
+// Keep in sync with the hardware IDs in filter.inx. The last entry
+// catches everything else.
+//
+static const CONTROLLER_PROFILE ControllerProfiles[] = {
+    { 0x1286, 0x2044, "Marvell AVASTAR",    PROFILE_EP_EVENTS, PROFILE_EP_ACL_IN, PROFILE_EP_ACL_OUT, 0,                   PROFILE_MATCHERS_080 },
+    { 0x0A12, 0x0001, "CSR8510",            PROFILE_EP_EVENTS, PROFILE_EP_ACL_IN, PROFILE_EP_ACL_OUT, HCI_LMP_VERSION_4_0, PROFILE_MATCHERS_ANY },
+    { 0x0A5C, 0x21E8, "Broadcom BCM20702",  PROFILE_EP_EVENTS, PROFILE_EP_ACL_IN, PROFILE_EP_ACL_OUT, HCI_LMP_VERSION_4_0, PROFILE_MATCHERS_ANY },
+    { 0x8087, 0x0A2B, "Intel 8265",         PROFILE_EP_EVENTS, PROFILE_EP_ACL_IN, PROFILE_EP_ACL_OUT, 0,                   PROFILE_MATCHERS_ANY },
+    { 0x8087, 0x0029, "Intel AX200",        PROFILE_EP_EVENTS, PROFILE_EP_ACL_IN, PROFILE_EP_ACL_OUT, 0,                   PROFILE_MATCHERS_ANY },
+    { 0x0BDA, 0x8771, "Realtek RTL8761B",   PROFILE_EP_EVENTS, PROFILE_EP_ACL_IN, PROFILE_EP_ACL_OUT, 0,                   PROFILE_MATCHERS_ANY },
+    { 0x0000, 0x0000, "Generic",            0,                 0,                 0,                  0,                   PROFILE_MATCHERS_ANY },
+};
+
+static BOOLEAN
+ProfileParseHex4(
+    const USHORT   *Chars,
+    PUSHORT         Value
+    )
+{
+    ULONG   i;
+    USHORT  value = 0;
+
+    for (i = 0; i < 4; i++) {
+        USHORT ch = Chars[i];
+
+        value <<= 4;
+
+        if (ch >= '0' && ch <= '9') {
+            value |= ch - '0';
+        } else if (ch >= 'A' && ch <= 'F') {
+            value |= ch - 'A' + 10;
+        } else if (ch >= 'a' && ch <= 'f') {
+            value |= ch - 'a' + 10;
+        } else {
+            return FALSE;
+        }
+    }
+
+    *Value = value;
+
+    return TRUE;
+}
+
+BOOLEAN
+ProfileParseHardwareId(
+    const USHORT   *HardwareId,
+    ULONG           Chars,
+    PUSHORT         VendorId,
+    PUSHORT         ProductId
+    )
+/*++
+
+Routine Description:
+
+    Picks the vendor and product ID out of a USB hardware ID such as
+    USB\VID_1286&PID_2044&REV_3201. Only the first string of a multi-sz
+    is looked at, they all carry the same IDs.
+
+Arguments:
+
+    HardwareId, Chars - The UTF-16 hardware ID.
+
+    VendorId, ProductId - Receive the IDs.
+
+Return Value:
+
+    TRUE if both IDs were found.
+
+--*/
+{
+    static const char vid[] = "VID_";
+    static const char pid[] = "PID_";
+    ULONG   i;
+    ULONG   j;
+    BOOLEAN foundVid = FALSE;
+    BOOLEAN foundPid = FALSE;
+
+    for (i = 0; i + 8 <= Chars && HardwareId[i] != 0; i++) {
+        for (j = 0; j < 4; j++) {
+            if (HardwareId[i + j] != (USHORT)vid[j]) {
+                break;
+            }
+        }
+        if (j == 4 && ProfileParseHex4(&HardwareId[i + 4], VendorId)) {
+            foundVid = TRUE;
+        }
+
+        for (j = 0; j < 4; j++) {
+            if (HardwareId[i + j] != (USHORT)pid[j]) {
+                break;
+            }
+        }
+        if (j == 4 && ProfileParseHex4(&HardwareId[i + 4], ProductId)) {
+            foundPid = TRUE;
+        }
+    }
+
+    return foundVid && foundPid;
+}
+
+PCCONTROLLER_PROFILE
+ProfileSelect(
+    USHORT VendorId,
+    USHORT ProductId
+    )
+/*++
+
+Routine Description:
+
+    Returns the profile for a controller, the generic one if we don't
+    know it.
+
+--*/
+{
+    ULONG i;
+
+    for (i = 0; i < sizeof(ControllerProfiles) / sizeof(ControllerProfiles[0]) - 1; i++) {
+        if (ControllerProfiles[i].VendorId == VendorId &&
+            ControllerProfiles[i].ProductId == ProductId) {
+            break;
+        }
+    }
+
+    return &ControllerProfiles[i];
+}
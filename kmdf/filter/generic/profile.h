@@ -0,0 +1,123 @@
+/*++
+
+Module Name:
+
+    profile.h
+
+Abstract:
+
+    Table of the bluetooth controllers the filter knows how to serve.
+
+    A profile is picked once per adapter in FilterEvtDeviceAdd from its
+    hardware ID. It says which endpoints are worth intercepting, what to assume
+    about the controller until its own events tell us, and carries the
+    matchers for the packets we rewrite, already specialized for the
+    controller's ACL framing. Per-URB code calls the matchers through the
+    profile and never looks at which controller it is running on.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "hci.h"
+
+#if !defined(_PROFILE_H_)
+#define _PROFILE_H_
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+//
+// Siri Remote GATT handles we redirect between
+//
+#define SIRI_ATT_HID_REPORT                 0x0023  // hid report, notify
+#define SIRI_ATT_HID_REPORT_CCCD            0x0024
+#define SIRI_ATT_HID_CONTROL                0x001D  // takes the 0xAF magic value
+#define SIRI_ATT_BATTERY_LEVEL              0x0028
+#define SIRI_ATT_BATTERY_LEVEL_CCCD         0x0029
+#define SIRI_ATT_BATTERY_POWER_STATE        0x002B
+
+#define SIRI_MAGIC_VALUE                    0xAF
+
+//
+// Endpoint addresses the bluetooth USB transport suggests
+//
+#define PROFILE_EP_EVENTS                   0x81
+#define PROFILE_EP_ACL_IN                   0x82
+#define PROFILE_EP_ACL_OUT                  0x02
+
+typedef BOOLEAN PROFILE_MATCH_ROUTINE(
+    PUCHAR  Bfr,
+    ULONG   Length
+    );
+
+typedef PROFILE_MATCH_ROUTINE *PPROFILE_MATCH_ROUTINE;
+
+typedef struct _CONTROLLER_PROFILE {
+
+    USHORT  VendorId;           // 0 matches any controller
+    USHORT  ProductId;
+    const char *Name;
+
+    //
+    // Endpoints carrying HCI events and ACL data. 0 takes the first
+    // interrupt in, bulk in and bulk out pipe of the configuration, for
+    // controllers with extra vendor interfaces the addresses keep us off
+    // pipes that don't carry HCI.
+    //
+    UCHAR   EventEndpoint;
+    UCHAR   AclInEndpoint;
+    UCHAR   AclOutEndpoint;
+
+    //
+    // LMP version to assume until Read Local Version Information is seen,
+    // 0 to assume nothing. Lets AUTO apply the header fix on known BLE 4.0
+    // controllers even when the filter missed the adapter's initialisation.
+    //
+    UCHAR   PresumedLmpVersion;
+
+    //
+    // ---HCI----- ---L2CAP--- -----ATT------
+    // 80 20 09 00 05 00 04 00 1b 23 00 ...
+    // A notification on the hid report handle.
+    //
+    PPROFILE_MATCH_ROUTINE MatchHidNotification;
+
+    //
+    // 80 00 08 00 04 00 04 00 52 28 00 AF
+    // The magic value written without response to battery level.
+    //
+    PPROFILE_MATCH_ROUTINE MatchMagicWrite;
+
+    //
+    // 80 00 09 00 05 00 04 00 12 29 00 01 00
+    // Notifications enabled on battery level.
+    //
+    PPROFILE_MATCH_ROUTINE MatchNotifyEnableWrite;
+
+} CONTROLLER_PROFILE, *PCONTROLLER_PROFILE;
+
+typedef const CONTROLLER_PROFILE *PCCONTROLLER_PROFILE;
+
+BOOLEAN
+ProfileParseHardwareId(
+    const USHORT   *HardwareId,
+    ULONG           Chars,
+    PUSHORT         VendorId,
+    PUSHORT         ProductId
+    );
+
+PCCONTROLLER_PROFILE
+ProfileSelect(
+    USHORT VendorId,
+    USHORT ProductId
+    );
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -0,0 +1,720 @@
+/*++
+
+Module Name:
+
+    reportmap.c
+
+Abstract:
+
+    HID report descriptor compiling and report decoding, see reportmap.h.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "reportmap.h"
+
+//
+// Item prefix, HID 1.11 section 6.2.2.2
+//
+#define HID_ITEM_LONG               0xFE
+#define HID_ITEM_SIZE(b)            ((b) & 0x03)
+#define HID_ITEM_TYPE(b)            (((b) >> 2) & 0x03)
+#define HID_ITEM_TAG(b)             ((b) >> 4)
+
+#define HID_TYPE_MAIN               0
+#define HID_TYPE_GLOBAL             1
+#define HID_TYPE_LOCAL              2
+
+#define HID_MAIN_INPUT              0x8
+#define HID_MAIN_OUTPUT             0x9
+#define HID_MAIN_COLLECTION         0xA
+#define HID_MAIN_FEATURE            0xB
+#define HID_MAIN_END_COLLECTION     0xC
+
+#define HID_GLOBAL_USAGE_PAGE       0x0
+#define HID_GLOBAL_LOGICAL_MIN      0x1
+#define HID_GLOBAL_LOGICAL_MAX      0x2
+#define HID_GLOBAL_REPORT_SIZE      0x7
+#define HID_GLOBAL_REPORT_ID        0x8
+#define HID_GLOBAL_REPORT_COUNT     0x9
+#define HID_GLOBAL_PUSH             0xA
+#define HID_GLOBAL_POP              0xB
+
+#define HID_LOCAL_USAGE             0x0
+#define HID_LOCAL_USAGE_MIN         0x1
+#define HID_LOCAL_USAGE_MAX         0x2
+
+//
+// Data bits of an Input item.
+//
+#define HID_INPUT_CONSTANT          0x01
+#define HID_INPUT_VARIABLE          0x02
+#define HID_INPUT_RELATIVE          0x04
+
+#define REPORT_MAP_MAX_PUSH         4
+#define REPORT_MAP_MAX_USAGES       16
+#define REPORT_MAP_MAX_BITS         0xFFFF
+
+typedef struct _REPORT_MAP_GLOBALS {
+
+    USHORT  UsagePage;
+    UCHAR   ReportId;
+    LONG    LogicalMin;
+    LONG    LogicalMax;
+    ULONG   LogicalMaxUnsigned;     // of the same item, for a LogicalMin that isn't negative
+    ULONG   ReportSize;
+    ULONG   ReportCount;
+
+} REPORT_MAP_GLOBALS, *PREPORT_MAP_GLOBALS;
+
+typedef struct _REPORT_MAP_USAGES {
+
+    USHORT  Page;
+    USHORT  Min;
+    USHORT  Max;
+
+} REPORT_MAP_USAGES, *PREPORT_MAP_USAGES;
+
+typedef struct _REPORT_MAP_PARSER {
+
+    REPORT_MAP_GLOBALS  Globals;
+    REPORT_MAP_GLOBALS  Stack[REPORT_MAP_MAX_PUSH];
+    ULONG               Pushed;
+    ULONG               Depth;      // of collections
+
+    //
+    // Local items, forgotten after each main item. Usage Minimum and
+    // Maximum make a range once both came.
+    //
+    ULONG               UsageCount;
+    REPORT_MAP_USAGES   Usages[REPORT_MAP_MAX_USAGES];
+    BOOLEAN             HaveMin;
+    BOOLEAN             HaveMax;
+    USHORT              MinPage;
+    USHORT              Min;
+    USHORT              MaxPage;
+    USHORT              Max;
+
+} REPORT_MAP_PARSER, *PREPORT_MAP_PARSER;
+
+static VOID
+ReportMapAddUsages(
+    PREPORT_MAP_PARSER  Parser,
+    USHORT              Page,
+    USHORT              Min,
+    USHORT              Max
+    )
+{
+    PREPORT_MAP_USAGES usages;
+
+    if (Parser->UsageCount == REPORT_MAP_MAX_USAGES) {
+        return;
+    }
+
+    usages = &Parser->Usages[Parser->UsageCount++];
+    usages->Page = Page;
+    usages->Min = min(Min, Max);
+    usages->Max = max(Min, Max);
+}
+
+static VOID
+ReportMapUsageOf(
+    const REPORT_MAP_PARSER *Parser,
+    ULONG                   Index,
+    PUSHORT                 Page,
+    PUSHORT                 Usage
+    )
+/*++
+
+Routine Description:
+
+    Usage of element Index of a variable item, the last usage for the
+    elements past the usages there are.
+
+--*/
+{
+    const REPORT_MAP_USAGES *usages;
+    ULONG                   i;
+
+    if (Parser->UsageCount == 0) {
+        *Page = Parser->Globals.UsagePage;
+        *Usage = 0;
+        return;
+    }
+
+    for (i = 0; i < Parser->UsageCount; i++) {
+        usages = &Parser->Usages[i];
+
+        if (Index <= (ULONG)(usages->Max - usages->Min)) {
+            *Page = usages->Page;
+            *Usage = (USHORT)(usages->Min + Index);
+            return;
+        }
+
+        Index -= usages->Max - usages->Min + 1;
+    }
+
+    *Page = Parser->Usages[Parser->UsageCount - 1].Page;
+    *Usage = Parser->Usages[Parser->UsageCount - 1].Max;
+}
+
+static PREPORT_INFO
+ReportMapReportOf(
+    PREPORT_MAP Map,
+    UCHAR       Id
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < Map->ReportCount; i++) {
+        if (Map->Reports[i].Id == Id) {
+            return &Map->Reports[i];
+        }
+    }
+
+    if (Map->ReportCount == REPORT_MAP_MAX_REPORTS) {
+        return NULL;
+    }
+
+    Map->Reports[Map->ReportCount].Id = Id;
+
+    return &Map->Reports[Map->ReportCount++];
+}
+
+static PREPORT_FIELD
+ReportMapNewField(
+    PREPORT_MAP                 Map,
+    const REPORT_MAP_PARSER     *Parser,
+    const REPORT_INFO           *Info,
+    ULONG                       Data
+    )
+{
+    const REPORT_MAP_GLOBALS    *globals = &Parser->Globals;
+    PREPORT_FIELD               field;
+
+    if (Map->FieldCount == REPORT_MAP_MAX_FIELDS) {
+        return NULL;
+    }
+
+    field = &Map->Fields[Map->FieldCount++];
+    RtlZeroMemory(field, sizeof(REPORT_FIELD));
+
+    field->BitOffset = Info->Bits;
+    field->BitSize = (UCHAR)globals->ReportSize;
+    field->Report = (UCHAR)(Info - Map->Reports);
+    field->LogicalMin = globals->LogicalMin;
+    field->LogicalMax = globals->LogicalMax;
+
+    //
+    // A maximum of 0xFF in one byte is -1 read as signed, which no
+    // descriptor with a minimum of 0 means.
+    //
+    if (globals->LogicalMin >= 0 && globals->LogicalMax < 0) {
+        field->LogicalMax = (LONG)min(globals->LogicalMaxUnsigned, 0x7FFFFFFFUL);
+    }
+
+    if (field->LogicalMin < 0) {
+        field->Flags |= REPORT_FIELD_SIGNED;
+    }
+
+    if ((Data & HID_INPUT_VARIABLE) == 0) {
+        field->Flags |= REPORT_FIELD_ARRAY;
+    }
+
+    if (Data & HID_INPUT_RELATIVE) {
+        field->Flags |= REPORT_FIELD_RELATIVE;
+    }
+
+    return field;
+}
+
+static BOOLEAN
+ReportMapInput(
+    PREPORT_MAP         Map,
+    PREPORT_MAP_PARSER  Parser,
+    ULONG               Data
+    )
+/*++
+
+Routine Description:
+
+    Turns an Input item into fields and moves its report on past it.
+
+--*/
+{
+    const REPORT_MAP_GLOBALS    *globals = &Parser->Globals;
+    PREPORT_INFO                info;
+    PREPORT_FIELD               field = NULL;
+    ULONGLONG                   bits = (ULONGLONG)globals->ReportSize * globals->ReportCount;
+    USHORT                      page;
+    USHORT                      usage;
+    ULONG                       i;
+
+    info = ReportMapReportOf(Map, globals->ReportId);
+    if (info == NULL || info->Bits + bits > REPORT_MAP_MAX_BITS) {
+        return FALSE;
+    }
+
+    if (bits == 0 || (Data & HID_INPUT_CONSTANT) || globals->ReportSize > 32) {
+        info->Bits = (USHORT)(info->Bits + bits);
+        return TRUE;
+    }
+
+    if ((Data & HID_INPUT_VARIABLE) == 0) {
+
+        field = ReportMapNewField(Map, Parser, info, Data);
+        if (field == NULL) {
+            return FALSE;
+        }
+
+        field->Count = (USHORT)globals->ReportCount;
+
+        if (Parser->UsageCount != 0) {
+            field->UsagePage = Parser->Usages[0].Page;
+            field->UsageMin = Parser->Usages[0].Min;
+            field->UsageMax = Parser->Usages[0].Max;
+        } else {
+            field->UsagePage = globals->UsagePage;
+        }
+
+        //
+        // Usages listed one by one index on from the first.
+        //
+        for (i = 1; i < Parser->UsageCount; i++) {
+            if (Parser->Usages[i].Page != field->UsagePage ||
+                Parser->Usages[i].Min != field->UsageMax + 1) {
+                break;
+            }
+
+            field->UsageMax = Parser->Usages[i].Max;
+        }
+
+        info->Bits = (USHORT)(info->Bits + bits);
+        return TRUE;
+    }
+
+    for (i = 0; i < globals->ReportCount; i++) {
+
+        ReportMapUsageOf(Parser, i, &page, &usage);
+
+        //
+        // The next usage goes on the run, or repeats the last one past
+        // the usages there are.
+        //
+        if (field != NULL && page == field->UsagePage &&
+            ((usage == field->UsageMax + 1 &&
+              (ULONG)(field->UsageMax - field->UsageMin) + 1 == field->Count) ||
+             usage == field->UsageMax)) {
+
+            if (usage != field->UsageMax) {
+                field->UsageMax = usage;
+            }
+
+            field->Count++;
+
+        } else {
+
+            field = ReportMapNewField(Map, Parser, info, Data);
+            if (field == NULL) {
+                return FALSE;
+            }
+
+            field->BitOffset = (USHORT)(info->Bits + i * globals->ReportSize);
+            field->Count = 1;
+            field->UsagePage = page;
+            field->UsageMin = usage;
+            field->UsageMax = usage;
+        }
+    }
+
+    info->Bits = (USHORT)(info->Bits + bits);
+
+    return TRUE;
+}
+
+static VOID
+ReportMapSort(
+    PREPORT_MAP Map
+    )
+/*++
+
+Routine Description:
+
+    Puts the fields of each report together, keeping their order, and
+    points the reports at them.
+
+--*/
+{
+    REPORT_FIELD    field;
+    ULONG           i;
+    ULONG           j;
+
+    for (i = 1; i < Map->FieldCount; i++) {
+        field = Map->Fields[i];
+
+        for (j = i; j > 0 && Map->Fields[j - 1].Report > field.Report; j--) {
+            Map->Fields[j] = Map->Fields[j - 1];
+        }
+
+        Map->Fields[j] = field;
+    }
+
+    for (i = 0; i < Map->FieldCount; i++) {
+        PREPORT_INFO info = &Map->Reports[Map->Fields[i].Report];
+
+        if (info->FieldCount == 0) {
+            info->FirstField = (USHORT)i;
+        }
+
+        info->FieldCount++;
+    }
+}
+
+BOOLEAN
+ReportMapCompile(
+    PREPORT_MAP     Map,
+    const UCHAR     *Descriptor,
+    ULONG           Length
+    )
+{
+    REPORT_MAP_PARSER           parser;
+    PREPORT_MAP_GLOBALS         globals = &parser.Globals;
+    ULONG                       pos = 0;
+    ULONG                       size;
+    ULONG                       data;
+    LONG                        value;
+    UCHAR                       prefix;
+    ULONG                       i;
+
+    RtlZeroMemory(Map, sizeof(REPORT_MAP));
+    RtlZeroMemory(&parser, sizeof(REPORT_MAP_PARSER));
+
+    while (pos < Length) {
+
+        prefix = Descriptor[pos++];
+
+        if (prefix == HID_ITEM_LONG) {
+            if (pos + 2 > Length || pos + 2 + Descriptor[pos] > Length) {
+                return FALSE;
+            }
+
+            pos += 2 + Descriptor[pos];
+            continue;
+        }
+
+        size = HID_ITEM_SIZE(prefix) == 3 ? 4 : HID_ITEM_SIZE(prefix);
+
+        if (pos + size > Length) {
+            return FALSE;
+        }
+
+        data = 0;
+
+        for (i = 0; i < size; i++) {
+            data |= (ULONG)Descriptor[pos + i] << (i * 8);
+        }
+
+        value = (LONG)data;
+
+        if (size == 1) {
+            value = (LONG)(signed char)data;
+        } else if (size == 2) {
+            value = (LONG)(SHORT)data;
+        }
+
+        pos += size;
+
+        switch (HID_ITEM_TYPE(prefix)) {
+
+        case HID_TYPE_MAIN:
+
+            switch (HID_ITEM_TAG(prefix)) {
+            case HID_MAIN_INPUT:
+                if (!ReportMapInput(Map, &parser, data)) {
+                    return FALSE;
+                }
+                break;
+            case HID_MAIN_OUTPUT:
+            case HID_MAIN_FEATURE:
+                break;
+            case HID_MAIN_COLLECTION:
+                parser.Depth++;
+                break;
+            case HID_MAIN_END_COLLECTION:
+                if (parser.Depth == 0) {
+                    return FALSE;
+                }
+                parser.Depth--;
+                break;
+            default:
+                return FALSE;
+            }
+
+            parser.UsageCount = 0;
+            parser.HaveMin = FALSE;
+            parser.HaveMax = FALSE;
+            break;
+
+        case HID_TYPE_GLOBAL:
+
+            switch (HID_ITEM_TAG(prefix)) {
+            case HID_GLOBAL_USAGE_PAGE:
+                globals->UsagePage = (USHORT)data;
+                break;
+            case HID_GLOBAL_LOGICAL_MIN:
+                globals->LogicalMin = value;
+                break;
+            case HID_GLOBAL_LOGICAL_MAX:
+                globals->LogicalMax = value;
+                globals->LogicalMaxUnsigned = data;
+                break;
+            case HID_GLOBAL_REPORT_SIZE:
+                globals->ReportSize = data;
+                break;
+            case HID_GLOBAL_REPORT_ID:
+                if (data == 0 || data > 0xFF) {
+                    return FALSE;
+                }
+                globals->ReportId = (UCHAR)data;
+                Map->HasIds = TRUE;
+                break;
+            case HID_GLOBAL_REPORT_COUNT:
+                globals->ReportCount = data;
+                break;
+            case HID_GLOBAL_PUSH:
+                if (parser.Pushed == REPORT_MAP_MAX_PUSH) {
+                    return FALSE;
+                }
+                parser.Stack[parser.Pushed++] = *globals;
+                break;
+            case HID_GLOBAL_POP:
+                if (parser.Pushed == 0) {
+                    return FALSE;
+                }
+                *globals = parser.Stack[--parser.Pushed];
+                break;
+            default:
+                //
+                // Physical extents, units and the reserved tags.
+                //
+                if (HID_ITEM_TAG(prefix) > HID_GLOBAL_POP) {
+                    return FALSE;
+                }
+                break;
+            }
+            break;
+
+        case HID_TYPE_LOCAL:
+
+            //
+            // A four byte usage carries its page in the high half.
+            //
+            switch (HID_ITEM_TAG(prefix)) {
+            case HID_LOCAL_USAGE:
+                ReportMapAddUsages(&parser,
+                                   size == 4 ? (USHORT)(data >> 16) : globals->UsagePage,
+                                   (USHORT)data,
+                                   (USHORT)data);
+                break;
+            case HID_LOCAL_USAGE_MIN:
+                parser.HaveMin = TRUE;
+                parser.MinPage = size == 4 ? (USHORT)(data >> 16) : globals->UsagePage;
+                parser.Min = (USHORT)data;
+                break;
+            case HID_LOCAL_USAGE_MAX:
+                parser.HaveMax = TRUE;
+                parser.MaxPage = size == 4 ? (USHORT)(data >> 16) : globals->UsagePage;
+                parser.Max = (USHORT)data;
+                break;
+            default:
+                break;
+            }
+
+            if (parser.HaveMin && parser.HaveMax) {
+                ReportMapAddUsages(&parser, parser.MinPage, parser.Min, parser.Max);
+                parser.HaveMin = FALSE;
+                parser.HaveMax = FALSE;
+            }
+            break;
+
+        default:
+            return FALSE;
+        }
+    }
+
+    if (parser.Depth != 0) {
+        return FALSE;
+    }
+
+    ReportMapSort(Map);
+
+    return TRUE;
+}
+
+ULONG
+ReportMapFindReport(
+    const REPORT_MAP    *Map,
+    UCHAR               Id
+    )
+{
+    ULONG i;
+
+    for (i = 0; i < Map->ReportCount; i++) {
+        if (Map->Reports[i].Id == Id) {
+            return i;
+        }
+    }
+
+    return REPORT_MAP_MAX_REPORTS;
+}
+
+BOOLEAN
+ReportMapFindUsage(
+    const REPORT_MAP    *Map,
+    ULONG               Report,
+    USHORT              UsagePage,
+    USHORT              Usage,
+    PREPORT_FIELD       Field
+    )
+{
+    const REPORT_INFO   *info;
+    const REPORT_FIELD  *field;
+    ULONG               index;
+    ULONG               i;
+
+    if (Report >= Map->ReportCount) {
+        return FALSE;
+    }
+
+    info = &Map->Reports[Report];
+
+    for (i = info->FirstField; i < (ULONG)info->FirstField + info->FieldCount; i++) {
+        field = &Map->Fields[i];
+
+        if ((field->Flags & REPORT_FIELD_ARRAY) || field->UsagePage != UsagePage ||
+            Usage < field->UsageMin || Usage > field->UsageMax) {
+            continue;
+        }
+
+        index = Usage - field->UsageMin;
+
+        *Field = *field;
+        Field->BitOffset = (USHORT)(field->BitOffset + index * field->BitSize);
+        Field->Count = 1;
+        Field->UsageMin = Usage;
+        Field->UsageMax = Usage;
+
+        return TRUE;
+    }
+
+    return FALSE;
+}
+
+ULONG
+ReportMapBits(
+    const UCHAR *Value,
+    ULONG       Length,
+    ULONG       BitOffset,
+    ULONG       BitSize
+    )
+{
+    ULONG       first = BitOffset >> 3;
+    ULONG       last = min((BitOffset + BitSize + 7) >> 3, Length);
+    ULONGLONG   bits = 0;
+    ULONG       i;
+
+    for (i = first; i < last; i++) {
+        bits |= (ULONGLONG)Value[i] << ((i - first) * 8);
+    }
+
+    return (ULONG)(bits >> (BitOffset & 7)) & (0xFFFFFFFFUL >> (32 - BitSize));
+}
+
+LONG
+ReportMapElement(
+    const REPORT_FIELD  *Field,
+    const UCHAR         *Value,
+    ULONG               Length,
+    ULONG               Index
+    )
+{
+    ULONG bits = ReportMapBits(Value, Length, Field->BitOffset + Index * Field->BitSize, Field->BitSize);
+
+    if ((Field->Flags & REPORT_FIELD_SIGNED) && Field->BitSize < 32 &&
+        (bits & (1UL << (Field->BitSize - 1))) != 0) {
+        bits |= 0xFFFFFFFFUL << Field->BitSize;
+    }
+
+    return (LONG)bits;
+}
+
+ULONG
+ReportMapDecode(
+    const REPORT_MAP    *Map,
+    ULONG               Report,
+    const UCHAR         *Value,
+    ULONG               Length,
+    PREPORT_VALUE       Values,
+    ULONG               MaxValues
+    )
+{
+    const REPORT_INFO   *info;
+    const REPORT_FIELD  *field;
+    const REPORT_FIELD  *end;
+    ULONG               bits = Length * 8;
+    ULONG               count = 0;
+    ULONG               index;
+    ULONG               i;
+    LONG                value;
+
+    if (Report >= Map->ReportCount) {
+        return 0;
+    }
+
+    info = &Map->Reports[Report];
+    field = &Map->Fields[info->FirstField];
+    end = field + info->FieldCount;
+
+    for (; field < end; field++) {
+        for (i = 0; i < field->Count; i++) {
+
+            if (field->BitOffset + (i + 1) * field->BitSize > bits || count == MaxValues) {
+                return count;
+            }
+
+            value = ReportMapElement(field, Value, Length, i);
+
+            if (field->Flags & REPORT_FIELD_ARRAY) {
+
+                //
+                // Usage 0 is no usage, what an array reports with nothing
+                // held.
+                //
+                index = (ULONG)value - (ULONG)field->LogicalMin;
+
+                if (value < field->LogicalMin || value > field->LogicalMax ||
+                    index > (ULONG)(field->UsageMax - field->UsageMin) ||
+                    field->UsageMin + index == 0) {
+                    continue;
+                }
+
+                Values[count].UsagePage = field->UsagePage;
+                Values[count].Usage = (USHORT)(field->UsageMin + index);
+                Values[count].Value = 1;
+
+            } else {
+
+                Values[count].UsagePage = field->UsagePage;
+                Values[count].Usage = (USHORT)min((ULONG)field->UsageMin + i, (ULONG)field->UsageMax);
+                Values[count].Value = value;
+            }
+
+            count++;
+        }
+    }
+
+    return count;
+}
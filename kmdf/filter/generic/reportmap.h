@@ -0,0 +1,189 @@
+/*++
+
+Module Name:
+
+    reportmap.h
+
+Abstract:
+
+    Compiles a HID report descriptor, the value of the Report Map
+    characteristic of a HOGP device, into a flat table of the fields of
+    its input reports, and decodes reports with the table.
+
+    Compiling walks the items of the descriptor once, keeping the global
+    items, Push and Pop included, and the usages of the local items, and
+    turns each Input main item into fields. A field is a run of elements
+    of one item with consecutive usages, so a run of button bits is one
+    field and X and Y of one item are one field of two elements. The
+    elements of a variable field have the usages from UsageMin up, the
+    last usage repeating past UsageMax. An array field's elements are
+    indexes of a usage from UsageMin at LogicalMin. Constant elements are
+    padding and make no field, nor do elements longer than 32 bits.
+
+    Bit offsets count from the first byte after the report ID, which
+    HOGP notifications don't carry. The fields of each report are
+    contiguous in the table, in the order of the report's bits.
+
+    Decoding is then a few shifts per element, the descriptor is never
+    looked at again. Nothing is allocated.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "portable.h"
+
+#if !defined(_REPORTMAP_H_)
+#define _REPORTMAP_H_
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define REPORT_MAP_MAX_FIELDS       64
+#define REPORT_MAP_MAX_REPORTS      16
+
+//
+// Usage pages and usages the filter looks for.
+//
+#define HID_PAGE_GENERIC_DESKTOP    0x01
+#define HID_PAGE_BUTTON             0x09
+#define HID_PAGE_DIGITIZER          0x0D
+
+#define HID_USAGE_X                 0x30
+#define HID_USAGE_Y                 0x31
+#define HID_USAGE_TIP_SWITCH        0x42
+#define HID_USAGE_CONTACT_ID        0x51
+
+#define REPORT_FIELD_ARRAY          0x01
+#define REPORT_FIELD_RELATIVE       0x02
+#define REPORT_FIELD_SIGNED         0x04    // LogicalMin is negative
+
+typedef struct _REPORT_FIELD {
+
+    USHORT  BitOffset;      // of element 0, after the report ID
+    USHORT  Count;          // elements
+    UCHAR   BitSize;        // of each element, 1 to 32
+    UCHAR   Flags;          // REPORT_FIELD_*
+    UCHAR   Report;         // index of its report in Reports
+    UCHAR   Reserved;
+    USHORT  UsagePage;
+    USHORT  UsageMin;
+    USHORT  UsageMax;
+    USHORT  Reserved2;
+    LONG    LogicalMin;
+    LONG    LogicalMax;
+
+} REPORT_FIELD, *PREPORT_FIELD;
+
+typedef struct _REPORT_INFO {
+
+    UCHAR   Id;             // 0 in a descriptor without report IDs
+    UCHAR   Reserved;
+    USHORT  Bits;           // of the report, after the report ID
+    USHORT  FirstField;
+    USHORT  FieldCount;
+
+} REPORT_INFO, *PREPORT_INFO;
+
+typedef struct _REPORT_MAP {
+
+    BOOLEAN         HasIds;
+    ULONG           ReportCount;    // input reports, in the order they first appear
+    REPORT_INFO     Reports[REPORT_MAP_MAX_REPORTS];
+    ULONG           FieldCount;
+    REPORT_FIELD    Fields[REPORT_MAP_MAX_FIELDS];
+
+} REPORT_MAP, *PREPORT_MAP;
+
+typedef struct _REPORT_VALUE {
+
+    USHORT  UsagePage;
+    USHORT  Usage;
+    LONG    Value;
+
+} REPORT_VALUE, *PREPORT_VALUE;
+
+//
+// Compiles the descriptor. Returns FALSE for one that is cut short, has
+// an item it shouldn't, closes a collection it didn't open or leaves one
+// open, pops more than it pushed, or has more input reports or fields
+// than the table holds.
+//
+BOOLEAN
+ReportMapCompile(
+    PREPORT_MAP     Map,
+    const UCHAR     *Descriptor,
+    ULONG           Length
+    );
+
+//
+// Index of the report with the ID, or REPORT_MAP_MAX_REPORTS.
+//
+ULONG
+ReportMapFindReport(
+    const REPORT_MAP    *Map,
+    UCHAR               Id
+    );
+
+//
+// The element of a variable field of the report with the usage, as a
+// field of its own of one element. Returns FALSE if there is none.
+//
+BOOLEAN
+ReportMapFindUsage(
+    const REPORT_MAP    *Map,
+    ULONG               Report,
+    USHORT              UsagePage,
+    USHORT              Usage,
+    PREPORT_FIELD       Field
+    );
+
+//
+// BitSize bits of a report of Length bytes, 1 to 32 of them. Bits past
+// Length read as 0.
+//
+ULONG
+ReportMapBits(
+    const UCHAR *Value,
+    ULONG       Length,
+    ULONG       BitOffset,
+    ULONG       BitSize
+    );
+
+//
+// Element Index of the field in a report of Length bytes, sign extended
+// when the field is signed.
+//
+LONG
+ReportMapElement(
+    const REPORT_FIELD  *Field,
+    const UCHAR         *Value,
+    ULONG               Length,
+    ULONG               Index
+    );
+
+//
+// Decodes a report of Length bytes, without its report ID, into the
+// values of its elements: one for each element of a variable field, one
+// for each element of an array field that holds a usage, with Value 1.
+// Fields past Length are left out. Returns the number of values, at most
+// MaxValues.
+//
+ULONG
+ReportMapDecode(
+    const REPORT_MAP    *Map,
+    ULONG               Report,
+    const UCHAR         *Value,
+    ULONG               Length,
+    PREPORT_VALUE       Values,
+    ULONG               MaxValues
+    );
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
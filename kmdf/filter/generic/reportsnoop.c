@@ -0,0 +1,394 @@
+/*++
+
+Module Name:
+
+    reportsnoop.c
+
+Abstract:
+
+    Report Map capture, see reportsnoop.h.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "reportsnoop.h"
+
+#define ATT_LE16(p)     ((USHORT)((p)[0] | ((p)[1] << 8)))
+
+VOID
+ReportSnoopInit(
+    PREPORT_SNOOP_STATE State
+    )
+{
+    ULONG i;
+
+    RtlZeroMemory(State, sizeof(REPORT_SNOOP_STATE));
+
+    for (i = 0; i < HCI_MAX_CONNECTIONS; i++) {
+        State->Connections[i].Map.Handle = HCI_INVALID_HANDLE;
+    }
+}
+
+static PREPORT_SNOOP_CONNECTION
+ReportSnoopLookup(
+    PREPORT_SNOOP_STATE State,
+    ULONG               Stream,
+    USHORT              Handle
+    )
+/*++
+
+Routine Description:
+
+    Returns the slot of a connection, started over if it held another
+    connection before.
+
+--*/
+{
+    PREPORT_SNOOP_CONNECTION conn;
+
+    if (Stream >= HCI_MAX_CONNECTIONS) {
+        return NULL;
+    }
+
+    conn = &State->Connections[Stream];
+
+    if (conn->Map.Handle != Handle) {
+        RtlZeroMemory(conn, sizeof(REPORT_SNOOP_CONNECTION));
+        conn->Map.Handle = Handle;
+    }
+
+    return conn;
+}
+
+VOID
+ReportSnoopDisconnected(
+    PREPORT_SNOOP_STATE State,
+    ULONG               Stream
+    )
+{
+    ReportSnoopLookup(State, Stream, HCI_INVALID_HANDLE);
+}
+
+BOOLEAN
+ReportSnoopRequest(
+    PREPORT_SNOOP_STATE State,
+    ULONG               Stream,
+    const UCHAR         *Bfr,
+    ULONG               Length
+    )
+/*++
+
+Routine Description:
+
+    Notes what the host asks for: characteristic declarations, or a read
+    of some handle from some offset.
+
+Return Value:
+
+    TRUE if the host asked for anything but the rest of the Report Map it
+    was reading, which completes the map. With an ATT_MTU the filter didn't
+    see exchanged, that is how a map read in one response ends.
+
+--*/
+{
+    PREPORT_SNOOP_CONNECTION    conn;
+    const UCHAR                 *pdu = Bfr + ATT_PDU_OFFSET;
+    ULONG                       attLength;
+    BOOLEAN                     completed = FALSE;
+
+    if (!HCI_IS_ATT_PDU(Bfr, Length) || !ATT_IS_REQUEST(pdu[0])) {
+        return FALSE;
+    }
+
+    conn = ReportSnoopLookup(State, Stream, HCI_ACL_HANDLE(Bfr));
+    if (conn == NULL) {
+        return FALSE;
+    }
+
+    attLength = min((ULONG)L2CAP_LENGTH(Bfr), Length - ATT_PDU_OFFSET);
+
+    if (conn->Map.State == FILTER_REPORT_MAP_STATE_READING &&
+        !(pdu[0] == ATT_OP_READ_BLOB_REQ && attLength >= 5 &&
+          ATT_LE16(&pdu[1]) == conn->Map.Attribute &&
+          ATT_LE16(&pdu[3]) == conn->Map.Length)) {
+        conn->Map.State = FILTER_REPORT_MAP_STATE_READ;
+        completed = TRUE;
+    }
+
+    conn->ReadAttribute = 0;
+
+    switch (pdu[0]) {
+
+    //
+    // opcode start end uuid16, a 128 bit type is no declaration
+    //
+    case ATT_OP_READ_BY_TYPE_REQ:
+        conn->Discovering = attLength == 7 && ATT_LE16(&pdu[5]) == GATT_UUID_CHARACTERISTIC;
+        break;
+
+    case ATT_OP_READ_REQ:
+        if (attLength >= 3) {
+            conn->ReadAttribute = ATT_LE16(&pdu[1]);
+            conn->ReadOffset = 0;
+        }
+        break;
+
+    case ATT_OP_READ_BLOB_REQ:
+        if (attLength >= 5) {
+            conn->ReadAttribute = ATT_LE16(&pdu[1]);
+            conn->ReadOffset = ATT_LE16(&pdu[3]);
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    return completed;
+}
+
+static VOID
+ReportSnoopDeclarations(
+    PREPORT_SNOOP_CONNECTION    Conn,
+    const UCHAR                 *Pdu,
+    ULONG                       AttLength
+    )
+/*++
+
+Routine Description:
+
+    Looks for the Report Map among the characteristic declarations of a
+    Read By Type response. Its value handle changing drops the map read
+    so far.
+
+--*/
+{
+    USHORT  attribute;
+    ULONG   i;
+
+    if (AttLength < 2 || Pdu[1] != ATT_READ_BY_TYPE_UUID16_LENGTH) {
+        return;
+    }
+
+    for (i = 2; i + ATT_READ_BY_TYPE_UUID16_LENGTH <= AttLength; i += ATT_READ_BY_TYPE_UUID16_LENGTH) {
+
+        if (ATT_LE16(&Pdu[i + 5]) != GATT_UUID_REPORT_MAP) {
+            continue;
+        }
+
+        attribute = ATT_LE16(&Pdu[i + 3]);
+
+        if (attribute != Conn->Map.Attribute) {
+            Conn->Map.Attribute = attribute;
+            Conn->Map.State = FILTER_REPORT_MAP_STATE_NONE;
+            Conn->Map.Flags = 0;
+            Conn->Map.Length = 0;
+        }
+    }
+}
+
+BOOLEAN
+ReportSnoopResponse(
+    PREPORT_SNOOP_STATE State,
+    ULONG               Stream,
+    const UCHAR         *Bfr,
+    ULONG               Length,
+    ULONG               Mtu
+    )
+/*++
+
+Routine Description:
+
+    Follows the host's discovery and reads of the Report Map with the
+    responses to them.
+
+Return Value:
+
+    TRUE if the response completed the connection's Report Map, it is in
+    the slot's Map with STATE_READ.
+
+--*/
+{
+    PREPORT_SNOOP_CONNECTION    conn;
+    const UCHAR                 *pdu = Bfr + ATT_PDU_OFFSET;
+    ULONG                       attLength;
+    ULONG                       valueLength;
+    ULONG                       copy;
+    UCHAR                       request;
+    BOOLEAN                     reading;
+
+    if (!HCI_IS_ATT_PDU(Bfr, Length)) {
+        return FALSE;
+    }
+
+    switch (pdu[0]) {
+    case ATT_OP_READ_BY_TYPE_RSP:
+    case ATT_OP_READ_RSP:
+    case ATT_OP_READ_BLOB_RSP:
+    case ATT_OP_ERROR_RSP:
+        break;
+    default:
+        return FALSE;
+    }
+
+    conn = ReportSnoopLookup(State, Stream, HCI_ACL_HANDLE(Bfr));
+    if (conn == NULL) {
+        return FALSE;
+    }
+
+    attLength = min((ULONG)L2CAP_LENGTH(Bfr), Length - ATT_PDU_OFFSET);
+
+    if (pdu[0] == ATT_OP_READ_BY_TYPE_RSP) {
+        if (conn->Discovering) {
+            conn->Discovering = FALSE;
+            ReportSnoopDeclarations(conn, pdu, attLength);
+        }
+        return FALSE;
+    }
+
+    reading = conn->Map.Attribute != 0 && conn->ReadAttribute == conn->Map.Attribute;
+
+    if (pdu[0] == ATT_OP_ERROR_RSP) {
+
+        if (attLength < ATT_ERROR_RSP_LENGTH) {
+            return FALSE;
+        }
+
+        request = pdu[1];
+
+        if (request == ATT_OP_READ_BY_TYPE_REQ) {
+            conn->Discovering = FALSE;
+            return FALSE;
+        }
+
+        if (!reading || (request != ATT_OP_READ_REQ && request != ATT_OP_READ_BLOB_REQ)) {
+            return FALSE;
+        }
+
+        conn->ReadAttribute = 0;
+
+        //
+        // A map that is a multiple of ATT_MTU - 1 long ends with a blob read
+        // past it.
+        //
+        if (conn->Map.State == FILTER_REPORT_MAP_STATE_READING &&
+            request == ATT_OP_READ_BLOB_REQ &&
+            conn->ReadOffset == conn->Map.Length &&
+            (pdu[4] == ATT_ERR_ATTRIBUTE_NOT_LONG || pdu[4] == ATT_ERR_INVALID_OFFSET)) {
+            conn->Map.State = FILTER_REPORT_MAP_STATE_READ;
+            return TRUE;
+        }
+
+        if (conn->Map.State == FILTER_REPORT_MAP_STATE_READING) {
+            conn->Map.State = FILTER_REPORT_MAP_STATE_NONE;
+            conn->Map.Length = 0;
+        }
+
+        return FALSE;
+    }
+
+    if (!reading) {
+        return FALSE;
+    }
+
+    conn->ReadAttribute = 0;
+
+    if (pdu[0] == ATT_OP_READ_RSP) {
+        conn->ReadOffset = 0;
+        conn->Longest = 0;
+        conn->Map.State = FILTER_REPORT_MAP_STATE_READING;
+        conn->Map.Flags = 0;
+        conn->Map.Length = 0;
+    }
+
+    //
+    // A blob that isn't the next one, or a response cut into fragments
+    // the filter doesn't put together, loses the map.
+    //
+    if (conn->Map.State != FILTER_REPORT_MAP_STATE_READING ||
+        conn->ReadOffset != conn->Map.Length ||
+        (ULONG)L2CAP_LENGTH(Bfr) > Length - ATT_PDU_OFFSET) {
+
+        if (conn->Map.State == FILTER_REPORT_MAP_STATE_READING) {
+            conn->Map.State = FILTER_REPORT_MAP_STATE_NONE;
+            conn->Map.Length = 0;
+        }
+
+        return FALSE;
+    }
+
+    valueLength = attLength - 1;
+    copy = min(valueLength, (ULONG)(FILTER_REPORT_MAP_MAX - conn->Map.Length));
+
+    RtlCopyMemory(&conn->Map.Map[conn->Map.Length], &pdu[1], copy);
+    conn->Map.Length = (USHORT)(conn->Map.Length + copy);
+
+    //
+    // Responses as long as the ATT_MTU allows come before the last one,
+    // however long that is.
+    //
+    if (valueLength < max(Mtu, ATT_DEFAULT_LE_MTU) - 1 ||
+        valueLength < conn->Longest ||
+        conn->Map.Length == FILTER_REPORT_MAP_MAX) {
+        conn->Map.State = FILTER_REPORT_MAP_STATE_READ;
+        return TRUE;
+    }
+
+    conn->Longest = (USHORT)valueLength;
+
+    return FALSE;
+}
+
+VOID
+ReportSnoopSet(
+    PREPORT_SNOOP_STATE State,
+    ULONG               Stream,
+    USHORT              Handle,
+    const UCHAR         *Map,
+    ULONG               Length
+    )
+{
+    PREPORT_SNOOP_CONNECTION conn;
+
+    conn = ReportSnoopLookup(State, Stream, Handle);
+    if (conn == NULL) {
+        return;
+    }
+
+    Length = min(Length, FILTER_REPORT_MAP_MAX);
+
+    RtlCopyMemory(conn->Map.Map, Map, Length);
+    conn->Map.Length = (USHORT)Length;
+    conn->Map.State = FILTER_REPORT_MAP_STATE_SET;
+    conn->Map.Flags = 0;
+    conn->ReadAttribute = 0;
+}
+
+VOID
+ReportSnoopGet(
+    PREPORT_SNOOP_STATE State,
+    PFILTER_REPORT_MAPS Maps
+    )
+/*++
+
+Routine Description:
+
+    Fills in the maps of the connections for IOCTL_GET_REPORT_MAPS.
+
+--*/
+{
+    ULONG i;
+
+    C_ASSERT(HCI_MAX_CONNECTIONS == FILTER_MAX_CONNECTIONS);
+
+    RtlZeroMemory(Maps, sizeof(FILTER_REPORT_MAPS));
+
+    for (i = 0; i < HCI_MAX_CONNECTIONS; i++) {
+        if (State->Connections[i].Map.Handle != HCI_INVALID_HANDLE) {
+            Maps->Connections[Maps->ConnectionCount++] = State->Connections[i].Map;
+        }
+    }
+}
@@ -0,0 +1,121 @@
+/*++
+
+Module Name:
+
+    reportsnoop.h
+
+Abstract:
+
+    Picks the HID Report Map of each remote out of the host's GATT traffic,
+    per connection.
+
+    The host discovers the characteristics of the HID service with Read By
+    Type requests for characteristic declarations. A declaration of the
+    Report Map characteristic gives the handle of its value. The host then
+    reads the value, a Read Request for the first ATT_MTU - 1 bytes and Read
+    Blob Requests from where that left off, until a response comes back
+    short, the remote answers that there is no more or the host asks for
+    something else. The value is put together from those responses; one
+    missed, or out of order, drops it.
+
+    Only the host's requests count: a client has one outstanding at a time,
+    so the response to a read is the next read response on the connection.
+    A connection that changes handle starts over. The caller serializes all
+    calls for one REPORT_SNOOP_STATE.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "hci.h"
+#include "public.h"
+
+#if !defined(_REPORTSNOOP_H_)
+#define _REPORTSNOOP_H_
+
+#define GATT_UUID_CHARACTERISTIC        0x2803
+#define GATT_UUID_REPORT_MAP            0x2A4B
+
+//
+// Read By Type response
+// opcode length (handle properties value_handle uuid16)...
+//   09     07       20 00  02         21 00       4b 2a
+//
+#define ATT_READ_BY_TYPE_UUID16_LENGTH  7
+
+typedef struct _REPORT_SNOOP_CONNECTION {
+
+    BOOLEAN             Discovering;    // characteristic declarations were asked for
+    USHORT              ReadAttribute;  // of the read outstanding, 0 for none
+    USHORT              ReadOffset;
+    USHORT              Longest;        // response of the map read so far
+    FILTER_REPORT_MAP   Map;            // Handle is the slot's
+
+} REPORT_SNOOP_CONNECTION, *PREPORT_SNOOP_CONNECTION;
+
+typedef struct _REPORT_SNOOP_STATE {
+
+    //
+    // Indexed like the connection slots of the link state.
+    //
+    REPORT_SNOOP_CONNECTION Connections[HCI_MAX_CONNECTIONS];
+
+} REPORT_SNOOP_STATE, *PREPORT_SNOOP_STATE;
+
+VOID
+ReportSnoopInit(
+    PREPORT_SNOOP_STATE State
+    );
+
+VOID
+ReportSnoopDisconnected(
+    PREPORT_SNOOP_STATE State,
+    ULONG               Stream
+    );
+
+//
+// An ATT request of the host going down on the connection. Returns TRUE
+// when it completed the connection's Report Map.
+//
+BOOLEAN
+ReportSnoopRequest(
+    PREPORT_SNOOP_STATE State,
+    ULONG               Stream,
+    const UCHAR         *Bfr,
+    ULONG               Length
+    );
+
+//
+// An ATT response coming up on the connection, whose ATT_MTU is Mtu.
+// Returns TRUE when it completed the connection's Report Map.
+//
+BOOLEAN
+ReportSnoopResponse(
+    PREPORT_SNOOP_STATE State,
+    ULONG               Stream,
+    const UCHAR         *Bfr,
+    ULONG               Length,
+    ULONG               Mtu
+    );
+
+//
+// Gives the connection a Report Map the host didn't read.
+//
+VOID
+ReportSnoopSet(
+    PREPORT_SNOOP_STATE State,
+    ULONG               Stream,
+    USHORT              Handle,
+    const UCHAR         *Map,
+    ULONG               Length
+    );
+
+VOID
+ReportSnoopGet(
+    PREPORT_SNOOP_STATE State,
+    PFILTER_REPORT_MAPS Maps
+    );
+
+#endif
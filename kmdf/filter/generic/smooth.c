@@ -0,0 +1,191 @@
+/*++
+
+Module Name:
+
+    smooth.c
+
+Abstract:
+
+    One-Euro smoothing of trackpad positions, see smooth.h. The caller
+    serializes the calls for one contact.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "smooth.h"
+
+#define SMOOTH_TICKS_PER_SECOND     10000000
+#define SMOOTH_TICKS_PER_MS         10000
+#define SMOOTH_TICKS_PER_US         10
+
+//
+// Alphas are 16 bit fractions.
+//
+#define SMOOTH_ONE                  65536
+
+//
+// The time constant of a low pass is 1 / (2 pi cutoff), this over the
+// cutoff in milliHz gives it in 100ns units.
+//
+#define SMOOTH_TAU_SCALE            1591549431LL
+
+//
+// Bounds that keep the arithmetic in range: a second between reports, a
+// finger a whole pad a millisecond, and a cutoff of a MHz that is no
+// filter at all.
+//
+#define SMOOTH_MAX_INTERVAL         SMOOTH_TICKS_PER_SECOND
+#define SMOOTH_MAX_SPEED            ((LONGLONG)(SMOOTH_POSITION_MAX + 1) * 256 * 1000)
+#define SMOOTH_MAX_CUTOFF           1000000000LL
+
+//
+// How far the reports' clock can run ahead of their arrival, so a
+// ReportUs longer than the remote's period can't drag it away.
+//
+#define SMOOTH_MAX_LEAD_REPORTS     4
+
+static LONGLONG
+SmoothAlpha(
+    LONGLONG    CutoffMilliHz,
+    LONGLONG    Interval
+    )
+{
+    LONGLONG tau = SMOOTH_TAU_SCALE / max(CutoffMilliHz, 1);
+
+    return Interval * SMOOTH_ONE / (Interval + tau);
+}
+
+static LONGLONG
+SmoothClamp(
+    LONGLONG    Value,
+    LONGLONG    Bound
+    )
+{
+    return min(max(Value, -Bound), Bound);
+}
+
+static USHORT
+SmoothPosition(
+    LONGLONG    Position
+    )
+{
+    Position = min(max(Position, 0), (LONGLONG)SMOOTH_POSITION_MAX * 256);
+
+    return (USHORT)((Position + 128) / 256);
+}
+
+VOID
+SmoothConfigure(
+    PSMOOTH_PARAMS              Params,
+    const FILTER_SMOOTH_CONFIG  *Config
+    )
+/*++
+
+Routine Description:
+
+    Sets the filter the contacts go through from their next step.
+
+--*/
+{
+    Params->Enabled = Config->Enable != 0;
+    Params->MinCutoff = Config->MinCutoffMilliHz;
+    Params->Beta = Config->Beta;
+    Params->DerivativeCutoff = Config->DerivativeCutoffMilliHz;
+    Params->Lookahead = min((LONGLONG)Config->LookaheadMs * SMOOTH_TICKS_PER_MS, SMOOTH_MAX_INTERVAL);
+    Params->Report = (LONGLONG)Config->ReportUs * SMOOTH_TICKS_PER_US;
+}
+
+VOID
+SmoothReset(
+    PSMOOTH_CONTACT Contact,
+    USHORT          X,
+    USHORT          Y,
+    LONGLONG        Now
+    )
+{
+    Contact->Primed = TRUE;
+    Contact->X = (LONG)X * 256;
+    Contact->Y = (LONG)Y * 256;
+    Contact->SpeedX = 0;
+    Contact->SpeedY = 0;
+    Contact->Time = Now;
+}
+
+VOID
+SmoothStep(
+    const SMOOTH_PARAMS *Params,
+    PSMOOTH_CONTACT     Contact,
+    USHORT              *X,
+    USHORT              *Y,
+    LONGLONG            Now
+    )
+/*++
+
+Routine Description:
+
+    One step of the One-Euro filter. The speed from the filtered position
+    to the report is low passed, its magnitude sets the cutoff the
+    position is then low passed with.
+
+    The step is timed on the reports' own clock: the arrival, or ReportUs
+    after the previous report if that is later, because reports that
+    arrive together were sent a period apart. A prediction goes
+    LookaheadMs on from there, so the reports of one connection event are
+    predicted as far as each other.
+
+Arguments:
+
+    X, Y - The reported position, replaced with the delivered one.
+
+--*/
+{
+    LONGLONG    x = (LONGLONG)*X * 256;
+    LONGLONG    y = (LONGLONG)*Y * 256;
+    LONGLONG    time = Now;
+    LONGLONG    interval;
+    LONGLONG    speedX;
+    LONGLONG    speedY;
+    LONGLONG    speed;
+    LONGLONG    alpha;
+
+    if (!Contact->Primed) {
+        SmoothReset(Contact, *X, *Y, Now);
+        return;
+    }
+
+    if (Params->Report != 0) {
+        time = max(time, Contact->Time + Params->Report);
+        time = min(time, Now + SMOOTH_MAX_LEAD_REPORTS * Params->Report);
+    }
+
+    interval = min(max(time - Contact->Time, 1), SMOOTH_MAX_INTERVAL);
+
+    //
+    // The speed, low passed at the derivative cutoff.
+    //
+    speedX = SmoothClamp((x - Contact->X) * SMOOTH_TICKS_PER_SECOND / interval, SMOOTH_MAX_SPEED);
+    speedY = SmoothClamp((y - Contact->Y) * SMOOTH_TICKS_PER_SECOND / interval, SMOOTH_MAX_SPEED);
+
+    alpha = SmoothAlpha(Params->DerivativeCutoff, interval);
+    Contact->SpeedX += (LONG)((speedX - Contact->SpeedX) * alpha / SMOOTH_ONE);
+    Contact->SpeedY += (LONG)((speedY - Contact->SpeedY) * alpha / SMOOTH_ONE);
+
+    //
+    // Its magnitude, within 12% of the length of the vector, in units a
+    // second.
+    //
+    speedX = Contact->SpeedX < 0 ? -(LONGLONG)Contact->SpeedX : Contact->SpeedX;
+    speedY = Contact->SpeedY < 0 ? -(LONGLONG)Contact->SpeedY : Contact->SpeedY;
+    speed = (max(speedX, speedY) + min(speedX, speedY) / 2) / 256;
+
+    alpha = SmoothAlpha(min(Params->MinCutoff + Params->Beta * speed, SMOOTH_MAX_CUTOFF), interval);
+    Contact->X += (LONG)((x - Contact->X) * alpha / SMOOTH_ONE);
+    Contact->Y += (LONG)((y - Contact->Y) * alpha / SMOOTH_ONE);
+    Contact->Time = time;
+
+    *X = SmoothPosition(Contact->X + Contact->SpeedX * Params->Lookahead / SMOOTH_TICKS_PER_SECOND);
+    *Y = SmoothPosition(Contact->Y + Contact->SpeedY * Params->Lookahead / SMOOTH_TICKS_PER_SECOND);
+}
@@ -0,0 +1,91 @@
+/*++
+
+Module Name:
+
+    smooth.h
+
+Abstract:
+
+    One-Euro smoothing and prediction of trackpad positions, see
+    FILTER_SMOOTH_CONFIG in public.h.
+
+    Everything is fixed point, positions in 1/256 units and speeds in
+    1/256 units a second, so it runs at any IRQL without saving the
+    floating point state. A step is the same handful of multiplications
+    and divisions whatever the input.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "portable.h"
+#include "public.h"
+
+#if !defined(_SMOOTH_H_)
+#define _SMOOTH_H_
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define SMOOTH_POSITION_MAX     0x0FFF
+
+typedef struct _SMOOTH_PARAMS {
+
+    BOOLEAN     Enabled;
+    ULONG       MinCutoff;          // milliHz
+    ULONG       Beta;               // milliHz per unit/s
+    ULONG       DerivativeCutoff;   // milliHz
+    LONGLONG    Lookahead;          // 100ns units
+    LONGLONG    Report;             // 100ns units, 0 takes the arrival times
+
+} SMOOTH_PARAMS, *PSMOOTH_PARAMS;
+
+typedef struct _SMOOTH_CONTACT {
+
+    BOOLEAN     Primed;
+    LONG        X;                  // filtered position, 1/256 units
+    LONG        Y;
+    LONG        SpeedX;             // filtered speed, 1/256 units a second
+    LONG        SpeedY;
+    LONGLONG    Time;               // the reports' own clock, see SmoothStep
+
+} SMOOTH_CONTACT, *PSMOOTH_CONTACT;
+
+VOID
+SmoothConfigure(
+    PSMOOTH_PARAMS              Params,
+    const FILTER_SMOOTH_CONFIG  *Config
+    );
+
+//
+// Starts a contact over at a position, on touch down.
+//
+VOID
+SmoothReset(
+    PSMOOTH_CONTACT Contact,
+    USHORT          X,
+    USHORT          Y,
+    LONGLONG        Now
+    );
+
+//
+// Runs a reported position through the filter and replaces it with the
+// smoothed, and predicted, one. Now is in 100ns units.
+//
+VOID
+SmoothStep(
+    const SMOOTH_PARAMS *Params,
+    PSMOOTH_CONTACT     Contact,
+    USHORT              *X,
+    USHORT              *Y,
+    LONGLONG            Now
+    );
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -0,0 +1,659 @@
+/*++
+
+Module Name:
+
+    synth.c
+
+Abstract:
+
+    Synthetic traffic of Siri Remotes, see synth.h.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "synth.h"
+#include "profile.h"
+#include "coalesce.h"
+
+#define SYNTH_TICKS_PER_SECOND      10000000LL
+#define SYNTH_TICKS_PER_MS          10000LL
+#define SYNTH_TICKS_PER_US          10LL
+
+//
+// LE Connection Complete, subevent code and the 18 bytes of parameters.
+//
+#define SYNTH_CONNECT_LENGTH        (HCI_EVENT_HEADER_LENGTH + 19)
+
+//
+// Trackpad positions are 12 bits.
+//
+#define SYNTH_POSITION_MAX          0x0FFF
+
+static ULONG
+SynthRandom(
+    PSYNTH_STATE State
+    )
+{
+    ULONG x = State->Random;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    State->Random = x;
+
+    return x;
+}
+
+/*++
+
+Routine Description:
+
+    Returns when the next packet of a stream that comes Hz times a second
+    is due after From, off by up to a tenth of the period either way so
+    remotes at the same rate drift apart.
+
+--*/
+static LONGLONG
+SynthAfter(
+    PSYNTH_STATE    State,
+    LONGLONG        From,
+    ULONG           Hz
+    )
+{
+    LONGLONG period;
+    LONGLONG jitter;
+
+    if (Hz == 0) {
+        return SYNTH_NEVER;
+    }
+
+    period = SYNTH_TICKS_PER_SECOND / Hz;
+    jitter = period / 5;
+
+    if (jitter != 0) {
+        period += (LONGLONG)(SynthRandom(State) % (ULONG)jitter) - jitter / 2;
+    }
+
+    return From + max(period, 1);
+}
+
+/*++
+
+Routine Description:
+
+    When a move sampled at Sample is sent: at once, or at the remote's
+    next connection event.
+
+--*/
+static LONGLONG
+SynthDeliver(
+    PSYNTH_STATE    State,
+    PSYNTH_REMOTE   Remote,
+    LONGLONG        Sample
+    )
+{
+    LONGLONG interval = (LONGLONG)State->Config.IntervalUs * SYNTH_TICKS_PER_US;
+
+    if (interval == 0 || Sample == SYNTH_NEVER) {
+        return Sample;
+    }
+
+    if (Sample <= Remote->Phase) {
+        return Remote->Phase;
+    }
+
+    return Remote->Phase + (Sample - Remote->Phase + interval - 1) / interval * interval;
+}
+
+/*++
+
+Routine Description:
+
+    When the move after one sampled at From is sampled, at a steady rate
+    when they are sent at connection events.
+
+--*/
+static LONGLONG
+SynthSample(
+    PSYNTH_STATE    State,
+    LONGLONG        From
+    )
+{
+    if (State->Config.IntervalUs == 0 || State->Config.MoveHz == 0) {
+        return SynthAfter(State, From, State->Config.MoveHz);
+    }
+
+    return From + SYNTH_TICKS_PER_SECOND / State->Config.MoveHz;
+}
+
+static VOID
+SynthPutConnect(
+    PSYNTH_REMOTE   Remote,
+    PSYNTH_PACKET   Packet
+    )
+{
+    PUCHAR p = Packet->Data;
+
+    RtlZeroMemory(p, SYNTH_CONNECT_LENGTH);
+
+    p[0] = HCI_EV_LE_META;
+    p[1] = SYNTH_CONNECT_LENGTH - HCI_EVENT_HEADER_LENGTH;
+    p[2] = HCI_LE_EV_CONNECTION_COMPLETE;
+    p[3] = 0;                                   // status
+    p[4] = (UCHAR)Remote->Handle;
+    p[5] = (UCHAR)(Remote->Handle >> 8);
+    p[6] = 0;                                   // central
+    p[7] = 0;                                   // public address
+    p[8] = (UCHAR)Remote->Handle;
+    p[9] = 0x5A;
+    p[10] = 0x5A;
+    p[11] = 0xC0;
+    p[12] = 0x7C;
+    p[13] = 0x28;
+    p[14] = 0x09;                               // 11.25ms interval
+    p[16] = 0x04;                               // latency
+    p[18] = 0xC8;                               // 2s supervision timeout
+
+    Packet->Kind = TRACE_KIND_HCI_EVENT;
+    Packet->Length = SYNTH_CONNECT_LENGTH;
+}
+
+/*++
+
+Routine Description:
+
+    Puts the HCI ACL and L2CAP headers of an ATT PDU of AttLength bytes
+    in front of it.
+
+--*/
+static PUCHAR
+SynthPutAtt(
+    PSYNTH_REMOTE   Remote,
+    PSYNTH_PACKET   Packet,
+    ULONG           AttLength
+    )
+{
+    PUCHAR p = Packet->Data;
+
+    p[0] = (UCHAR)Remote->Handle;
+    p[1] = (UCHAR)(((Remote->Handle >> 8) & 0x0F) | (HCI_ACL_PB_FIRST_FLUSHABLE << 4));
+    p[2] = (UCHAR)(L2CAP_HEADER_LENGTH + AttLength);
+    p[3] = (UCHAR)((L2CAP_HEADER_LENGTH + AttLength) >> 8);
+    p[4] = (UCHAR)AttLength;
+    p[5] = (UCHAR)(AttLength >> 8);
+    p[6] = (UCHAR)L2CAP_CID_ATT;
+    p[7] = 0;
+
+    Packet->Kind = TRACE_KIND_ACL;
+    Packet->Length = (USHORT)(ATT_PDU_OFFSET + AttLength);
+
+    return &p[ATT_PDU_OFFSET];
+}
+
+/*++
+
+Routine Description:
+
+    Puts the HCI ACL, L2CAP and ATT headers of a notification of the hid
+    report handle with a value of ValueLength bytes in front of the value.
+
+--*/
+static PUCHAR
+SynthPutNotification(
+    PSYNTH_REMOTE   Remote,
+    PSYNTH_PACKET   Packet,
+    ULONG           ValueLength
+    )
+{
+    PUCHAR pdu = SynthPutAtt(Remote, Packet, 3 + ValueLength);
+
+    pdu[0] = ATT_OP_HANDLE_VALUE_NTF;
+    pdu[1] = (UCHAR)SIRI_ATT_HID_REPORT;
+    pdu[2] = (UCHAR)(SIRI_ATT_HID_REPORT >> 8);
+
+    return &pdu[3];
+}
+
+/*++
+
+Routine Description:
+
+    Puts the next packet of a remote's Report Map read: the host asking
+    for characteristic declarations, the HID Information, Report Map and
+    Report declarations in answer, then a Read of the map and Read Blobs
+    until a response comes back short.
+
+--*/
+static VOID
+SynthPutGatt(
+    PSYNTH_STATE    State,
+    PSYNTH_REMOTE   Remote,
+    PSYNTH_PACKET   Packet
+    )
+{
+    static const UCHAR declarations[] = {
+        ATT_OP_READ_BY_TYPE_RSP, 7,
+        0x18, 0x00, 0x02, 0x19, 0x00, 0x4A, 0x2A,      // hid information
+        (UCHAR)(SYNTH_ATT_REPORT_MAP - 1), 0x00, 0x02,
+        (UCHAR)SYNTH_ATT_REPORT_MAP, 0x00, 0x4B, 0x2A, // report map
+        (UCHAR)(SIRI_ATT_HID_REPORT - 1), 0x00, 0x12,
+        (UCHAR)SIRI_ATT_HID_REPORT, 0x00, 0x4D, 0x2A,  // report
+    };
+    const SYNTH_CONFIG  *config = &State->Config;
+    PUCHAR              pdu;
+    ULONG               length;
+
+    Packet->Type = SYNTH_PACKET_GATT;
+
+    switch (Remote->GattStep) {
+
+    case SYNTH_GATT_DISCOVER:
+        pdu = SynthPutAtt(Remote, Packet, 7);
+        pdu[0] = ATT_OP_READ_BY_TYPE_REQ;
+        pdu[1] = 0x01;
+        pdu[2] = 0x00;
+        pdu[3] = 0xFF;
+        pdu[4] = 0xFF;
+        pdu[5] = 0x03;
+        pdu[6] = 0x28;
+        Packet->Direction = HCI_DIRECTION_OUT;
+        Remote->GattStep = SYNTH_GATT_DECLARATIONS;
+        break;
+
+    case SYNTH_GATT_DECLARATIONS:
+        pdu = SynthPutAtt(Remote, Packet, sizeof(declarations));
+        RtlCopyMemory(pdu, declarations, sizeof(declarations));
+        Remote->GattStep = SYNTH_GATT_READ;
+        break;
+
+    case SYNTH_GATT_READ:
+        if (Remote->GattOffset == 0) {
+            pdu = SynthPutAtt(Remote, Packet, 3);
+            pdu[0] = ATT_OP_READ_REQ;
+        } else {
+            pdu = SynthPutAtt(Remote, Packet, 5);
+            pdu[0] = ATT_OP_READ_BLOB_REQ;
+            pdu[3] = (UCHAR)Remote->GattOffset;
+            pdu[4] = (UCHAR)(Remote->GattOffset >> 8);
+        }
+        pdu[1] = (UCHAR)SYNTH_ATT_REPORT_MAP;
+        pdu[2] = (UCHAR)(SYNTH_ATT_REPORT_MAP >> 8);
+        Packet->Direction = HCI_DIRECTION_OUT;
+        Remote->GattStep = SYNTH_GATT_VALUE;
+        break;
+
+    default:
+        length = min(config->ReportMapLength - Remote->GattOffset, (ULONG)(ATT_DEFAULT_LE_MTU - 1));
+
+        pdu = SynthPutAtt(Remote, Packet, 1 + length);
+        pdu[0] = (UCHAR)(Remote->GattOffset == 0 ? ATT_OP_READ_RSP : ATT_OP_READ_BLOB_RSP);
+        RtlCopyMemory(&pdu[1], &config->ReportMap[Remote->GattOffset], length);
+
+        Remote->GattOffset = (USHORT)(Remote->GattOffset + length);
+        Remote->GattStep = length < ATT_DEFAULT_LE_MTU - 1 ? SYNTH_GATT_DONE : SYNTH_GATT_READ;
+        break;
+    }
+}
+
+/*++
+
+Routine Description:
+
+    Picks the gesture of a touch, where it comes down and how far and how
+    long it goes.
+
+--*/
+static VOID
+SynthStartGesture(
+    PSYNTH_STATE    State,
+    PSYNTH_REMOTE   Remote,
+    LONGLONG        Due
+    )
+{
+    LONG    travel = 0;
+    LONG    drift = 0;
+    ULONG   ms;
+    ULONG   direction;
+
+    Remote->Gesture = (UCHAR)(GESTURE_TAP + SynthRandom(State) % (GESTURE_TYPES - 1));
+
+    switch (Remote->Gesture) {
+    case GESTURE_TAP:
+        ms = 60 + SynthRandom(State) % 100;
+        break;
+    case GESTURE_CLICK:
+        ms = 250 + SynthRandom(State) % 150;
+        break;
+    case GESTURE_SCROLL:
+        ms = 600 + SynthRandom(State) % 400;
+        travel = 200 + SynthRandom(State) % 300;
+        break;
+    default:
+        ms = 120 + SynthRandom(State) % 100;
+        travel = 1000 + SynthRandom(State) % 600;
+        drift = (LONG)(SynthRandom(State) % 201) - 100;
+        break;
+    }
+
+    direction = Remote->Gesture == GESTURE_SCROLL ? GESTURE_SWIPE_LEFT + SynthRandom(State) % 4 : Remote->Gesture;
+
+    switch (direction) {
+    case GESTURE_SWIPE_LEFT:
+        Remote->TravelX = (SHORT)-travel;
+        Remote->TravelY = (SHORT)drift;
+        break;
+    case GESTURE_SWIPE_RIGHT:
+        Remote->TravelX = (SHORT)travel;
+        Remote->TravelY = (SHORT)drift;
+        break;
+    case GESTURE_SWIPE_UP:
+        Remote->TravelX = (SHORT)drift;
+        Remote->TravelY = (SHORT)-travel;
+        break;
+    case GESTURE_SWIPE_DOWN:
+        Remote->TravelX = (SHORT)drift;
+        Remote->TravelY = (SHORT)travel;
+        break;
+    default:
+        Remote->TravelX = 0;
+        Remote->TravelY = 0;
+        break;
+    }
+
+    //
+    // Centered on the pad, off by a few hundred.
+    //
+    Remote->StartX = (USHORT)(SYNTH_POSITION_MAX / 2 - Remote->TravelX / 2 + (LONG)(SynthRandom(State) % 401) - 200);
+    Remote->StartY = (USHORT)(SYNTH_POSITION_MAX / 2 - Remote->TravelY / 2 + (LONG)(SynthRandom(State) % 401) - 200);
+    Remote->X = Remote->StartX;
+    Remote->Y = Remote->StartY;
+    Remote->TouchStart = Due;
+    Remote->TouchEnd = Due + ms * SYNTH_TICKS_PER_MS;
+}
+
+/*++
+
+Routine Description:
+
+    Moves the finger along its gesture, a couple of units off the line,
+    and presses and releases a click.
+
+--*/
+static VOID
+SynthMoveGesture(
+    PSYNTH_STATE    State,
+    PSYNTH_REMOTE   Remote,
+    LONGLONG        Due
+    )
+{
+    LONGLONG    length = Remote->TouchEnd - Remote->TouchStart;
+    LONGLONG    elapsed = min(Due - Remote->TouchStart, length);
+    LONG        x = Remote->StartX + (LONG)(Remote->TravelX * elapsed / length) + (LONG)(SynthRandom(State) % 5) - 2;
+    LONG        y = Remote->StartY + (LONG)(Remote->TravelY * elapsed / length) + (LONG)(SynthRandom(State) % 5) - 2;
+
+    Remote->X = (USHORT)min(max(x, 0), SYNTH_POSITION_MAX);
+    Remote->Y = (USHORT)min(max(y, 0), SYNTH_POSITION_MAX);
+
+    if (Remote->Gesture == GESTURE_CLICK && 3 * elapsed >= length && 3 * elapsed < 2 * length) {
+        Remote->Buttons |= GESTURE_DEFAULT_CLICK_MASK;
+    } else {
+        Remote->Buttons &= ~GESTURE_DEFAULT_CLICK_MASK;
+    }
+}
+
+static VOID
+SynthPutTouch(
+    PSYNTH_REMOTE   Remote,
+    PSYNTH_PACKET   Packet,
+    BOOLEAN         Touching
+    )
+{
+    static const UCHAR tail[] = { 0xca, 0x8a, 0x07, 0x02, 0xa2 };
+    PUCHAR value;
+
+    value = SynthPutNotification(Remote, Packet, SIRI_REPORT_TOUCH_LENGTH + sizeof(tail));
+
+    value[SIRI_REPORT_BUTTONS] = (UCHAR)Remote->Buttons;
+    value[SIRI_REPORT_BUTTONS + 1] = (UCHAR)(Remote->Buttons >> 8);
+    value[SIRI_REPORT_CONTACT] = Touching ? 0x30 : 0x00;
+    value[SIRI_REPORT_POSITION] = (UCHAR)Remote->X;
+    value[SIRI_REPORT_POSITION + 1] = (UCHAR)(((Remote->X >> 8) & 0x0F) | (Remote->Y << 4));
+    value[SIRI_REPORT_POSITION + 2] = (UCHAR)(Remote->Y >> 4);
+    RtlCopyMemory(&value[SIRI_REPORT_TOUCH_LENGTH], tail, sizeof(tail));
+}
+
+static USHORT
+SynthStep(
+    PSYNTH_STATE    State,
+    USHORT          Position
+    )
+{
+    LONG step = (LONG)(SynthRandom(State) % 33) - 16;
+
+    return (USHORT)min(max((LONG)Position + step, 0), SYNTH_POSITION_MAX);
+}
+
+VOID
+SynthInit(
+    PSYNTH_STATE        State,
+    const SYNTH_CONFIG  *Config
+    )
+/*++
+
+Routine Description:
+
+    Starts the traffic. The remotes connect first, at time 0, each stream
+    of a remote then starts at a random point of its first period.
+
+--*/
+{
+    ULONG i;
+
+    RtlZeroMemory(State, sizeof(SYNTH_STATE));
+
+    State->Config = *Config;
+    State->Config.Connections = min(State->Config.Connections, HCI_MAX_CONNECTIONS);
+    State->Config.VoiceLength = min(State->Config.VoiceLength, SYNTH_MAX_VOICE_LENGTH);
+    State->Config.VoiceBurstMs = min(State->Config.VoiceBurstMs, State->Config.VoiceEveryMs);
+    State->Config.ReportMapLength = min(State->Config.ReportMapLength, 0xFFFF);
+    State->Random = Config->Seed != 0 ? Config->Seed : 0x2545F491;
+
+    for (i = 0; i < State->Config.Connections; i++) {
+        PSYNTH_REMOTE remote = &State->Remotes[i];
+        LONGLONG start = SynthRandom(State) % SYNTH_TICKS_PER_SECOND;
+
+        remote->Handle = (USHORT)(SYNTH_FIRST_HANDLE + i);
+        remote->X = SYNTH_POSITION_MAX / 2;
+        remote->Y = SYNTH_POSITION_MAX / 2;
+        remote->TouchEnd = SYNTH_NEVER;
+        remote->GattStep = (UCHAR)(Config->ReportMap != NULL ? SYNTH_GATT_DISCOVER : SYNTH_GATT_DONE);
+        remote->Next[SYNTH_STREAM_BUTTON] = SynthAfter(State, start, State->Config.ButtonHz);
+        remote->Next[SYNTH_STREAM_TOUCH] = SynthAfter(State, start, State->Config.TouchHz);
+        remote->Next[SYNTH_STREAM_MOVE] = SYNTH_NEVER;
+        remote->Next[SYNTH_STREAM_VOICE] = SYNTH_NEVER;
+
+        if (State->Config.IntervalUs != 0) {
+            remote->Phase = SynthRandom(State) % (State->Config.IntervalUs * SYNTH_TICKS_PER_US);
+        }
+
+        if (State->Config.VoiceEveryMs != 0 && State->Config.VoiceHz != 0) {
+            remote->Next[SYNTH_STREAM_VOICE] = start +
+                (SynthRandom(State) % State->Config.VoiceEveryMs) * SYNTH_TICKS_PER_MS;
+            remote->BurstEnd = remote->Next[SYNTH_STREAM_VOICE] +
+                State->Config.VoiceBurstMs * SYNTH_TICKS_PER_MS;
+        }
+    }
+}
+
+VOID
+SynthNext(
+    PSYNTH_STATE    State,
+    PSYNTH_PACKET   Packet
+    )
+/*++
+
+Routine Description:
+
+    Produces the packet of whichever stream of whichever remote is due
+    first and moves that stream on. Connection events come before anything
+    else, then the Report Map reads. With no remotes, or every rate 0, the
+    packet is a connection event at SYNTH_NEVER.
+
+--*/
+{
+    const SYNTH_CONFIG *config = &State->Config;
+    PSYNTH_REMOTE       remote = &State->Remotes[0];
+    ULONG               stream = 0;
+    LONGLONG            due = SYNTH_NEVER;
+    ULONG               i, j;
+
+    Packet->Direction = HCI_DIRECTION_IN;
+    Packet->Gesture = GESTURE_NONE;
+
+    for (i = 0; i < config->Connections; i++) {
+        if (!State->Remotes[i].Connected) {
+            State->Remotes[i].Connected = TRUE;
+            Packet->Time = 0;
+            Packet->Type = SYNTH_PACKET_CONNECT;
+            SynthPutConnect(&State->Remotes[i], Packet);
+            return;
+        }
+    }
+
+    for (i = 0; i < config->Connections; i++) {
+        if (State->Remotes[i].GattStep != SYNTH_GATT_DONE) {
+            Packet->Time = 0;
+            SynthPutGatt(State, &State->Remotes[i], Packet);
+            return;
+        }
+
+        for (j = 0; j < SYNTH_STREAMS; j++) {
+            if (State->Remotes[i].Next[j] < due) {
+                remote = &State->Remotes[i];
+                stream = j;
+                due = remote->Next[j];
+            }
+        }
+    }
+
+    Packet->Time = due;
+
+    if (due == SYNTH_NEVER) {
+        Packet->Type = SYNTH_PACKET_CONNECT;
+        SynthPutConnect(remote, Packet);
+        return;
+    }
+
+    switch (stream) {
+
+    case SYNTH_STREAM_BUTTON:
+    {
+        PUCHAR value;
+
+        //
+        // Presses last half the period, a release follows each.
+        //
+        if (remote->Pressed) {
+            remote->Buttons &= config->Gestures ? GESTURE_DEFAULT_CLICK_MASK : 0;
+            remote->Next[stream] = SynthAfter(State, due, config->ButtonHz * 2);
+        } else if (config->Gestures) {
+            remote->Buttons = (USHORT)((remote->Buttons & GESTURE_DEFAULT_CLICK_MASK) |
+                                       (1 << (1 + SynthRandom(State) % 8)));
+            remote->Next[stream] = due + SYNTH_TICKS_PER_SECOND / (config->ButtonHz * 2);
+        } else {
+            remote->Buttons = (USHORT)(1 << (SynthRandom(State) % 9));
+            remote->Next[stream] = due + SYNTH_TICKS_PER_SECOND / (config->ButtonHz * 2);
+        }
+        remote->Pressed = !remote->Pressed;
+
+        value = SynthPutNotification(remote, Packet, SIRI_REPORT_BUTTONS_LENGTH);
+        value[SIRI_REPORT_BUTTONS] = (UCHAR)remote->Buttons;
+        value[SIRI_REPORT_BUTTONS + 1] = (UCHAR)(remote->Buttons >> 8);
+
+        Packet->Type = SYNTH_PACKET_BUTTON;
+        break;
+    }
+
+    case SYNTH_STREAM_TOUCH:
+        if (remote->TouchEnd == SYNTH_NEVER) {
+            if (config->Gestures) {
+                SynthStartGesture(State, remote, due);
+                Packet->Gesture = remote->Gesture;
+            } else {
+                remote->X = (USHORT)(SynthRandom(State) & SYNTH_POSITION_MAX);
+                remote->Y = (USHORT)(SynthRandom(State) & SYNTH_POSITION_MAX);
+                remote->TouchEnd = due + config->TouchMs * SYNTH_TICKS_PER_MS;
+            }
+            remote->MoveSample = SynthSample(State, due);
+            remote->Next[SYNTH_STREAM_MOVE] = SynthDeliver(State, remote, remote->MoveSample);
+            remote->Next[stream] = SynthDeliver(State, remote, remote->TouchEnd);
+
+            //
+            // The lift goes after the moves of its connection event.
+            //
+            if (config->IntervalUs != 0) {
+                remote->Next[stream]++;
+            }
+
+            SynthPutTouch(remote, Packet, TRUE);
+        } else {
+            remote->TouchEnd = SYNTH_NEVER;
+            remote->Next[stream] = SynthAfter(State, due, config->TouchHz);
+            remote->Next[SYNTH_STREAM_MOVE] = SYNTH_NEVER;
+            remote->Buttons &= config->Gestures ? ~GESTURE_DEFAULT_CLICK_MASK : 0xFFFF;
+            SynthPutTouch(remote, Packet, FALSE);
+        }
+
+        Packet->Type = SYNTH_PACKET_TOUCH;
+        break;
+
+    case SYNTH_STREAM_MOVE:
+        if (config->Gestures) {
+            SynthMoveGesture(State, remote, remote->MoveSample);
+        } else {
+            remote->X = SynthStep(State, remote->X);
+            remote->Y = SynthStep(State, remote->Y);
+        }
+        remote->MoveSample = SynthSample(State, remote->MoveSample);
+
+        //
+        // The lift ends the touch, no moves after it.
+        //
+        if (remote->MoveSample >= remote->TouchEnd) {
+            remote->MoveSample = SYNTH_NEVER;
+        }
+
+        remote->Next[stream] = SynthDeliver(State, remote, remote->MoveSample);
+
+        SynthPutTouch(remote, Packet, TRUE);
+        Packet->Type = SYNTH_PACKET_MOVE;
+        break;
+
+    case SYNTH_STREAM_VOICE:
+    {
+        PUCHAR value = SynthPutNotification(remote, Packet, config->VoiceLength);
+
+        for (i = 0; i < config->VoiceLength; i++) {
+            value[i] = (UCHAR)SynthRandom(State);
+        }
+
+        if (config->VoiceLength != 0) {
+            value[0] = remote->VoiceSequence++;
+        }
+
+        remote->Next[stream] = SynthAfter(State, due, config->VoiceHz);
+
+        if (remote->Next[stream] >= remote->BurstEnd) {
+            remote->Next[stream] = remote->BurstEnd - config->VoiceBurstMs * SYNTH_TICKS_PER_MS +
+                config->VoiceEveryMs * SYNTH_TICKS_PER_MS;
+            remote->BurstEnd = remote->Next[stream] + config->VoiceBurstMs * SYNTH_TICKS_PER_MS;
+        }
+
+        Packet->Type = SYNTH_PACKET_VOICE;
+        break;
+    }
+    }
+}
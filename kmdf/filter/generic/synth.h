@@ -0,0 +1,193 @@
+/*++
+
+Module Name:
+
+    synth.h
+
+Abstract:
+
+    Synthetic traffic of Siri Remotes, for driving the filter harder than
+    one real remote does.
+
+    Every remote gets an LE Connection Complete event, then produces the
+    notifications a remote sends on the hid report handle: button presses
+    and releases, touches with trackpad moves while the finger is down,
+    and bursts of voice frames. Each kind comes at its own configurable
+    rate with some jitter, and the remotes' packets are interleaved by
+    time, so the filter sees the mix several connections produce.
+
+    Packets are complete HCI events and HCI ACL / L2CAP / ATT packets as
+    they come off the adapter, times are in 100ns units from the start.
+    The same seed gives the same traffic. The first byte of a voice frame
+    counts the remote's frames, the rest is noise.
+
+    Touches wander at random, or with Gestures each touch is one of the
+    gestures of gesture.h picked at random and moves like it, a click
+    pressing GESTURE_DEFAULT_CLICK_MASK in its middle third. The touch down
+    packet carries the gesture as its label, the button stream then
+    leaves that button alone.
+
+    With IntervalUs the trackpad is sampled at exactly MoveHz and its
+    moves and lift are sent at the remote's next connection event, so
+    they arrive in lumps like over a real link.
+
+    With a ReportMap every remote, once connected, is asked for its
+    characteristic declarations and its Report Map the way a host does
+    it, at the default ATT_MTU: the host's requests go out, the remote's
+    responses come in, all at time 0 before any notification.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "portable.h"
+#include "public.h"
+#include "hci.h"
+#include "gesture.h"
+
+#if !defined(_SYNTH_H_)
+#define _SYNTH_H_
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define SYNTH_FIRST_HANDLE          0x0040
+
+//
+// What a packet models.
+//
+#define SYNTH_PACKET_CONNECT        0
+#define SYNTH_PACKET_BUTTON         1
+#define SYNTH_PACKET_TOUCH          2   // finger down or lifted
+#define SYNTH_PACKET_MOVE           3
+#define SYNTH_PACKET_VOICE          4
+#define SYNTH_PACKET_GATT           5   // reading the Report Map
+#define SYNTH_PACKET_TYPES          6
+
+//
+// Value handle of the Report Map the remotes answer reads of.
+//
+#define SYNTH_ATT_REPORT_MAP        0x001B
+
+#define SYNTH_MAX_VOICE_LENGTH      240
+#define SYNTH_MAX_PACKET            (ATT_PDU_OFFSET + 3 + SYNTH_MAX_VOICE_LENGTH)
+
+typedef struct _SYNTH_CONFIG {
+
+    ULONG   Connections;    // remotes, at most HCI_MAX_CONNECTIONS
+    ULONG   ButtonHz;       // presses per second, each a press and a release report
+    ULONG   TouchHz;        // touches per second
+    ULONG   TouchMs;        // how long the finger stays down
+    ULONG   MoveHz;         // trackpad reports per second while it is down
+    ULONG   VoiceEveryMs;   // a voice burst starts this often, 0 for none
+    ULONG   VoiceBurstMs;
+    ULONG   VoiceHz;        // frames per second in a burst
+    ULONG   VoiceLength;    // value bytes of a frame
+    ULONG   Seed;
+    ULONG   Gestures;       // nonzero makes every touch a labelled gesture
+    ULONG   IntervalUs;     // connection interval moves are sent at, 0 sends them as sampled
+    const UCHAR *ReportMap; // the host reads after connecting, NULL for no reads
+    ULONG   ReportMapLength;
+
+} SYNTH_CONFIG, *PSYNTH_CONFIG;
+
+//
+// Roughly what one remote in use produces.
+//
+#define SYNTH_DEFAULT_BUTTON_HZ         2
+#define SYNTH_DEFAULT_TOUCH_HZ          1
+#define SYNTH_DEFAULT_TOUCH_MS          600
+#define SYNTH_DEFAULT_MOVE_HZ           90
+#define SYNTH_DEFAULT_VOICE_EVERY_MS    10000
+#define SYNTH_DEFAULT_VOICE_BURST_MS    2000
+#define SYNTH_DEFAULT_VOICE_HZ          50
+#define SYNTH_DEFAULT_VOICE_LENGTH      97
+
+typedef struct _SYNTH_PACKET {
+
+    LONGLONG    Time;
+    UCHAR       Type;           // SYNTH_PACKET_*
+    UCHAR       Kind;           // TRACE_KIND_*
+    UCHAR       Direction;      // HCI_DIRECTION_*
+    USHORT      Length;
+    UCHAR       Gesture;        // GESTURE_* a touch down starts, else GESTURE_NONE
+    UCHAR       Data[SYNTH_MAX_PACKET];
+
+} SYNTH_PACKET, *PSYNTH_PACKET;
+
+//
+// A remote's streams, each at the time of its next packet.
+//
+#define SYNTH_STREAM_BUTTON         0
+#define SYNTH_STREAM_TOUCH          1
+#define SYNTH_STREAM_MOVE           2
+#define SYNTH_STREAM_VOICE          3
+#define SYNTH_STREAMS               4
+
+#define SYNTH_NEVER                 0x7FFFFFFFFFFFFFFFLL
+
+//
+// Where a remote's Report Map read is, the packet each step sends next.
+//
+#define SYNTH_GATT_DISCOVER         0   // Read By Type of characteristic declarations
+#define SYNTH_GATT_DECLARATIONS     1
+#define SYNTH_GATT_READ             2   // Read, then Read Blob
+#define SYNTH_GATT_VALUE            3
+#define SYNTH_GATT_DONE             4
+
+typedef struct _SYNTH_REMOTE {
+
+    USHORT      Handle;
+    BOOLEAN     Connected;
+    BOOLEAN     Pressed;
+    USHORT      Buttons;
+    USHORT      X;
+    USHORT      Y;
+    LONGLONG    TouchEnd;       // SYNTH_NEVER while the finger is up
+    LONGLONG    TouchStart;
+    UCHAR       Gesture;        // of the touch going on
+    USHORT      StartX;
+    USHORT      StartY;
+    SHORT       TravelX;        // where the gesture takes the finger from the start
+    SHORT       TravelY;
+    LONGLONG    MoveSample;     // when the next move is sampled
+    LONGLONG    Phase;          // of its connection events
+    LONGLONG    BurstEnd;
+    UCHAR       VoiceSequence;
+    UCHAR       GattStep;       // SYNTH_GATT_* of the Report Map read
+    USHORT      GattOffset;     // of the map, read so far
+    LONGLONG    Next[SYNTH_STREAMS];
+
+} SYNTH_REMOTE, *PSYNTH_REMOTE;
+
+typedef struct _SYNTH_STATE {
+
+    SYNTH_CONFIG    Config;
+    ULONG           Random;
+    SYNTH_REMOTE    Remotes[HCI_MAX_CONNECTIONS];
+
+} SYNTH_STATE, *PSYNTH_STATE;
+
+VOID
+SynthInit(
+    PSYNTH_STATE        State,
+    const SYNTH_CONFIG  *Config
+    );
+
+//
+// Fills in the next packet of the traffic, in time order.
+//
+VOID
+SynthNext(
+    PSYNTH_STATE    State,
+    PSYNTH_PACKET   Packet
+    );
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -0,0 +1,226 @@
+/*++
+
+Module Name:
+
+    timerwheel.c
+
+Abstract:
+
+    Hierarchical timer wheel, see timerwheel.h.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "timerwheel.h"
+
+#define TIMER_WHEEL_MASK        (TIMER_WHEEL_SLOTS - 1)
+#define TIMER_WHEEL_REACH       (1ULL << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOT_BITS))
+
+static VOID
+TimerWheelInsert(
+    PTIMER_WHEEL_ENTRY  Head,
+    PTIMER_WHEEL_ENTRY  Entry
+    )
+{
+    Entry->Next = Head;
+    Entry->Prev = Head->Prev;
+    Head->Prev->Next = Entry;
+    Head->Prev = Entry;
+}
+
+static VOID
+TimerWheelRemove(
+    PTIMER_WHEEL_ENTRY  Entry
+    )
+{
+    Entry->Prev->Next = Entry->Next;
+    Entry->Next->Prev = Entry->Prev;
+    Entry->Next = NULL;
+    Entry->Prev = NULL;
+}
+
+static VOID
+TimerWheelPlace(
+    PTIMER_WHEEL        Wheel,
+    PTIMER_WHEEL_ENTRY  Entry
+    )
+/*++
+
+Routine Description:
+
+    Puts an entry in the slot of the lowest level that reaches its tick.
+    A level's slots go round ahead of the wheel, so the slot an entry is
+    in comes up again in time to move it down. Ticks further ahead than
+    the last level reaches wait in its furthest slot and are placed again
+    from there.
+
+--*/
+{
+    ULONGLONG   tick = Entry->Expires;
+    ULONGLONG   delta = tick - Wheel->Now;
+    ULONG       level = 0;
+
+    if (delta >= TIMER_WHEEL_REACH) {
+        tick = Wheel->Now + TIMER_WHEEL_REACH - 1;
+        delta = TIMER_WHEEL_REACH - 1;
+    }
+
+    while (level < TIMER_WHEEL_LEVELS - 1 &&
+           delta >= (1ULL << ((level + 1) * TIMER_WHEEL_SLOT_BITS))) {
+        level++;
+    }
+
+    TimerWheelInsert(
+        &Wheel->Slots[level][(tick >> (level * TIMER_WHEEL_SLOT_BITS)) & TIMER_WHEEL_MASK],
+        Entry);
+}
+
+static BOOLEAN
+TimerWheelCascade(
+    PTIMER_WHEEL    Wheel,
+    ULONG           Level
+    )
+/*++
+
+Routine Description:
+
+    Moves the entries of the slot of a level the wheel just turned into
+    down to the levels below. Returns TRUE if the level went round, so
+    the level above turns too.
+
+--*/
+{
+    ULONG               index = (ULONG)(Wheel->Now >> (Level * TIMER_WHEEL_SLOT_BITS)) & TIMER_WHEEL_MASK;
+    PTIMER_WHEEL_ENTRY  head = &Wheel->Slots[Level][index];
+    PTIMER_WHEEL_ENTRY  entry;
+
+    while (head->Next != head) {
+        entry = head->Next;
+        TimerWheelRemove(entry);
+        TimerWheelPlace(Wheel, entry);
+    }
+
+    return index == 0;
+}
+
+VOID
+TimerWheelInit(
+    PTIMER_WHEEL    Wheel,
+    LONGLONG        Tick,
+    LONGLONG        Now
+    )
+{
+    ULONG   level;
+    ULONG   slot;
+
+    Wheel->Tick = max(Tick, 1);
+    Wheel->Now = (ULONGLONG)max(Now, 0) / Wheel->Tick;
+    Wheel->Armed = 0;
+
+    for (level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+        for (slot = 0; slot < TIMER_WHEEL_SLOTS; slot++) {
+            Wheel->Slots[level][slot].Next = &Wheel->Slots[level][slot];
+            Wheel->Slots[level][slot].Prev = &Wheel->Slots[level][slot];
+        }
+    }
+}
+
+VOID
+TimerWheelInitEntry(
+    PTIMER_WHEEL_ENTRY  Entry
+    )
+{
+    Entry->Next = NULL;
+    Entry->Prev = NULL;
+    Entry->Expires = 0;
+}
+
+VOID
+TimerWheelArm(
+    PTIMER_WHEEL        Wheel,
+    PTIMER_WHEEL_ENTRY  Entry,
+    LONGLONG            Expires
+    )
+{
+    ULONGLONG   tick = ((ULONGLONG)max(Expires, 0) + Wheel->Tick - 1) / Wheel->Tick;
+
+    if (TimerWheelArmed(Entry)) {
+        TimerWheelRemove(Entry);
+    } else {
+        Wheel->Armed++;
+    }
+
+    Entry->Expires = max(tick, Wheel->Now + 1);
+    TimerWheelPlace(Wheel, Entry);
+}
+
+VOID
+TimerWheelCancel(
+    PTIMER_WHEEL        Wheel,
+    PTIMER_WHEEL_ENTRY  Entry
+    )
+{
+    if (TimerWheelArmed(Entry)) {
+        TimerWheelRemove(Entry);
+        Wheel->Armed--;
+    }
+}
+
+ULONG
+TimerWheelRun(
+    PTIMER_WHEEL            Wheel,
+    LONGLONG                Now,
+    PTIMER_WHEEL_ROUTINE    Routine,
+    PVOID                   Context
+    )
+/*++
+
+Routine Description:
+
+    Turns the wheel a tick at a time, moving the entries of the higher
+    levels down as it turns into their slots, and fires what is in the
+    first level's slot of the tick. Everything in that slot is due in it.
+    With nothing armed the wheel moves straight to Now.
+
+--*/
+{
+    ULONGLONG           target = (ULONGLONG)max(Now, 0) / Wheel->Tick;
+    PTIMER_WHEEL_ENTRY  head;
+    PTIMER_WHEEL_ENTRY  entry;
+    ULONG               level;
+    ULONG               fired = 0;
+
+    while (Wheel->Now < target) {
+
+        if (Wheel->Armed == 0) {
+            Wheel->Now = target;
+            break;
+        }
+
+        Wheel->Now++;
+
+        if ((Wheel->Now & TIMER_WHEEL_MASK) == 0) {
+            for (level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+                if (!TimerWheelCascade(Wheel, level)) {
+                    break;
+                }
+            }
+        }
+
+        head = &Wheel->Slots[0][Wheel->Now & TIMER_WHEEL_MASK];
+
+        while (head->Next != head) {
+            entry = head->Next;
+            TimerWheelRemove(entry);
+            Wheel->Armed--;
+            fired++;
+
+            Routine(Context, entry);
+        }
+    }
+
+    return fired;
+}
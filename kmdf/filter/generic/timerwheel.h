@@ -0,0 +1,124 @@
+/*++
+
+Module Name:
+
+    timerwheel.h
+
+Abstract:
+
+    Hierarchical timer wheel, for keeping many short timeouts without a
+    sorted structure.
+
+    Time is cut into ticks. The first level has a slot for each of the
+    next 64 ticks, each further level a slot for 64 of the slots of the
+    level below, so four levels reach 2^24 ticks ahead. Arming or
+    cancelling a timer is a list insert or removal. A timer on a higher
+    level moves down a level when the wheel turns into its slot, so it is
+    moved at most once per level before it fires.
+
+    Timers never fire before their time and at most a tick after it. The
+    entries are the caller's, embedded in whatever the timer is for;
+    nothing is allocated. The caller serializes all calls for one wheel.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "portable.h"
+
+#if !defined(_TIMERWHEEL_H_)
+#define _TIMERWHEEL_H_
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define TIMER_WHEEL_LEVELS      4
+#define TIMER_WHEEL_SLOT_BITS   6
+#define TIMER_WHEEL_SLOTS       (1 << TIMER_WHEEL_SLOT_BITS)
+
+typedef struct _TIMER_WHEEL_ENTRY {
+
+    struct _TIMER_WHEEL_ENTRY   *Next;      // NULL while not armed
+    struct _TIMER_WHEEL_ENTRY   *Prev;
+    ULONGLONG                   Expires;    // tick it fires in
+
+} TIMER_WHEEL_ENTRY, *PTIMER_WHEEL_ENTRY;
+
+typedef struct _TIMER_WHEEL {
+
+    LONGLONG            Tick;       // 100ns units
+    ULONGLONG           Now;        // the last tick run
+    ULONG               Armed;
+
+    //
+    // Sentinels of the circular lists of each slot.
+    //
+    TIMER_WHEEL_ENTRY   Slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+
+} TIMER_WHEEL, *PTIMER_WHEEL;
+
+//
+// Called for each timer as it fires, after it is disarmed. It can arm the
+// timer again, or arm and cancel others.
+//
+typedef VOID TIMER_WHEEL_ROUTINE(
+    PVOID               Context,
+    PTIMER_WHEEL_ENTRY  Entry
+    );
+
+typedef TIMER_WHEEL_ROUTINE *PTIMER_WHEEL_ROUTINE;
+
+//
+// Tick and Now in 100ns units.
+//
+VOID
+TimerWheelInit(
+    PTIMER_WHEEL    Wheel,
+    LONGLONG        Tick,
+    LONGLONG        Now
+    );
+
+VOID
+TimerWheelInitEntry(
+    PTIMER_WHEEL_ENTRY  Entry
+    );
+
+//
+// Arms the timer for Expires, in 100ns units, moving it if it is armed.
+// A time already past fires with the next tick.
+//
+VOID
+TimerWheelArm(
+    PTIMER_WHEEL        Wheel,
+    PTIMER_WHEEL_ENTRY  Entry,
+    LONGLONG            Expires
+    );
+
+VOID
+TimerWheelCancel(
+    PTIMER_WHEEL        Wheel,
+    PTIMER_WHEEL_ENTRY  Entry
+    );
+
+#define TimerWheelArmed(Entry)  ((Entry)->Next != NULL)
+
+//
+// Turns the wheel to Now, in 100ns units, firing the timers due by then
+// in the order of their ticks. Returns the number fired.
+//
+ULONG
+TimerWheelRun(
+    PTIMER_WHEEL            Wheel,
+    LONGLONG                Now,
+    PTIMER_WHEEL_ROUTINE    Routine,
+    PVOID                   Context
+    );
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -0,0 +1,293 @@
+/*++
+
+Module Name:
+
+    tracefilter.c
+
+Abstract:
+
+    Verifier and interpreter for trace predicates.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "tracefilter.h"
+
+BOOLEAN
+TraceFilterVerify(
+    const TRACE_FILTER_INSN *Insns,
+    ULONG                   InsnCount
+    )
+/*++
+
+Routine Description:
+
+    Checks a program before it is run. Every jump must land on an
+    instruction of the program or just past its end, which rejects.
+
+Return Value:
+
+    TRUE if the program is safe to run.
+
+--*/
+{
+    ULONG i;
+
+    if (InsnCount > TRACE_FILTER_MAX_INSNS) {
+        return FALSE;
+    }
+
+    for (i = 0; i < InsnCount; i++) {
+        const TRACE_FILTER_INSN *insn = &Insns[i];
+
+        switch (insn->Op) {
+        case TRACE_OP_ACCEPT:
+        case TRACE_OP_REJECT:
+            continue;
+        case TRACE_OP_KIND:
+        case TRACE_OP_DIRECTION:
+        case TRACE_OP_LENGTH:
+        case TRACE_OP_ACL_HANDLE:
+        case TRACE_OP_CID:
+        case TRACE_OP_ATT_OPCODE:
+        case TRACE_OP_ATT_HANDLE:
+            if (insn->Low > insn->High) {
+                return FALSE;
+            }
+            break;
+        case TRACE_OP_SAMPLE:
+            if (insn->Low == 0) {
+                return FALSE;
+            }
+            break;
+        case TRACE_OP_RATE_LIMIT:
+            if (insn->Low == 0 || insn->High == 0) {
+                return FALSE;
+            }
+            break;
+        default:
+            return FALSE;
+        }
+
+        if (i + 1 + insn->JumpTrue > InsnCount ||
+            i + 1 + insn->JumpFalse > InsnCount) {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+BOOLEAN
+TraceFilterLoad(
+    PTRACE_FILTER               Filter,
+    const TRACE_FILTER_PROGRAM  *Program,
+    ULONG                       Length
+    )
+/*++
+
+Routine Description:
+
+    Verifies a program as received from usermode and copies it into
+    Filter with fresh run time state.
+
+Arguments:
+
+    Program, Length - The program and the size of the buffer holding it.
+
+Return Value:
+
+    FALSE if the buffer is short or the program doesn't verify, Filter is
+    left untouched then.
+
+--*/
+{
+    if (Length < FIELD_OFFSET(TRACE_FILTER_PROGRAM, Insns) ||
+        Program->InsnCount > TRACE_FILTER_MAX_INSNS ||
+        Length < TRACE_FILTER_PROGRAM_SIZE(Program->InsnCount) ||
+        !TraceFilterVerify(Program->Insns, Program->InsnCount)) {
+        return FALSE;
+    }
+
+    RtlZeroMemory(Filter, sizeof(TRACE_FILTER));
+    RtlCopyMemory(Filter->Insns, Program->Insns, Program->InsnCount * sizeof(TRACE_FILTER_INSN));
+    Filter->InsnCount = Program->InsnCount;
+
+    return TRUE;
+}
+
+//
+// TRUE if the ATT PDU starts with a handle.
+//
+static BOOLEAN
+TraceFilterAttHasHandle(
+    UCHAR Opcode
+    )
+{
+    switch (Opcode) {
+    case ATT_OP_READ_REQ:
+    case ATT_OP_READ_BLOB_REQ:
+    case ATT_OP_WRITE_REQ:
+    case ATT_OP_PREPARE_WRITE_REQ:
+    case ATT_OP_HANDLE_VALUE_NTF:
+    case ATT_OP_HANDLE_VALUE_IND:
+    case ATT_OP_WRITE_CMD:
+    case ATT_OP_SIGNED_WRITE_CMD:
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+static BOOLEAN
+TraceFilterRateLimit(
+    const TRACE_FILTER_INSN     *Insn,
+    PTRACE_FILTER_INSN_STATE    State,
+    LONGLONG                    Now
+    )
+/*++
+
+Routine Description:
+
+    Token bucket holding up to High packets, refilled at Low per second.
+    Credit is kept in ticks times packets per second so no division is
+    needed per packet.
+
+--*/
+{
+    LONGLONG capacity = (LONGLONG)Insn->High * TRACE_FILTER_TICKS_PER_SECOND;
+    LONGLONG elapsed = Now - State->LastTime;
+
+    if (State->LastTime == 0 || elapsed < 0) {
+        State->Tokens = capacity;
+    } else if (elapsed > 0) {
+        State->Tokens += min(elapsed, TRACE_FILTER_TICKS_PER_SECOND * 3600) * Insn->Low;
+        if (State->Tokens > capacity) {
+            State->Tokens = capacity;
+        }
+    }
+    State->LastTime = Now;
+
+    if (State->Tokens < TRACE_FILTER_TICKS_PER_SECOND) {
+        return FALSE;
+    }
+
+    State->Tokens -= TRACE_FILTER_TICKS_PER_SECOND;
+
+    return TRUE;
+}
+
+BOOLEAN
+TraceFilterRun(
+    PTRACE_FILTER   Filter,
+    UCHAR           Kind,
+    UCHAR           Direction,
+    PUCHAR          Bfr,
+    ULONG           Length,
+    LONGLONG        Now
+    )
+/*++
+
+Routine Description:
+
+    Runs a verified program over a packet. Nothing is formatted or copied,
+    the tests read at most the first eleven bytes.
+
+Arguments:
+
+    Kind - TRACE_KIND_* of the packet.
+
+    Direction - HCI_DIRECTION_*.
+
+    Bfr, Length - The packet as on the pipe.
+
+    Now - Current time in 100ns units.
+
+Return Value:
+
+    TRUE if the packet should be dumped.
+
+--*/
+{
+    BOOLEAN isAcl = Kind == TRACE_KIND_ACL &&
+                    Length >= HCI_ACL_HEADER_LENGTH &&
+                    HCI_ACL_IS_FIRST_FRAGMENT(Bfr);
+    BOOLEAN isL2cap = isAcl && Length >= ATT_PDU_OFFSET;
+    BOOLEAN isAtt = isL2cap && Length > ATT_PDU_OFFSET && L2CAP_CID(Bfr) == L2CAP_CID_ATT;
+    ULONG   pc = 0;
+
+    while (pc < Filter->InsnCount) {
+        const TRACE_FILTER_INSN *insn = &Filter->Insns[pc];
+        BOOLEAN                 result;
+        ULONG                   value;
+
+        switch (insn->Op) {
+        case TRACE_OP_ACCEPT:
+            return TRUE;
+        case TRACE_OP_REJECT:
+            return FALSE;
+        case TRACE_OP_SAMPLE:
+            if (++Filter->State[pc].Count >= insn->Low) {
+                Filter->State[pc].Count = 0;
+                result = TRUE;
+            } else {
+                result = FALSE;
+            }
+            goto Jump;
+        case TRACE_OP_RATE_LIMIT:
+            result = TraceFilterRateLimit(insn, &Filter->State[pc], Now);
+            goto Jump;
+        case TRACE_OP_KIND:
+            value = Kind;
+            break;
+        case TRACE_OP_DIRECTION:
+            value = Direction;
+            break;
+        case TRACE_OP_LENGTH:
+            value = Length;
+            break;
+        case TRACE_OP_ACL_HANDLE:
+            if (!isAcl) {
+                result = FALSE;
+                goto Jump;
+            }
+            value = HCI_ACL_HANDLE(Bfr);
+            break;
+        case TRACE_OP_CID:
+            if (!isL2cap) {
+                result = FALSE;
+                goto Jump;
+            }
+            value = L2CAP_CID(Bfr);
+            break;
+        case TRACE_OP_ATT_OPCODE:
+            if (!isAtt) {
+                result = FALSE;
+                goto Jump;
+            }
+            value = Bfr[ATT_PDU_OFFSET];
+            break;
+        case TRACE_OP_ATT_HANDLE:
+            if (!isAtt ||
+                Length < ATT_PDU_OFFSET + 3 ||
+                !TraceFilterAttHasHandle(Bfr[ATT_PDU_OFFSET])) {
+                result = FALSE;
+                goto Jump;
+            }
+            value = (ULONG)Bfr[ATT_PDU_OFFSET + 1] | ((ULONG)Bfr[ATT_PDU_OFFSET + 2] << 8);
+            break;
+        default:
+            return FALSE;
+        }
+
+        result = value >= insn->Low && value <= insn->High;
+
+Jump:
+        pc += 1 + (result ? insn->JumpTrue : insn->JumpFalse);
+    }
+
+    return FALSE;
+}
@@ -0,0 +1,87 @@
+/*++
+
+Module Name:
+
+    tracefilter.h
+
+Abstract:
+
+    Trace predicates deciding which packets get dumped to the debugger.
+
+    Programs come from usermode over the control device, so they are
+    verified once when loaded: known opcodes, sane ranges and forward jumps
+    that stay inside the program. A verified program runs in at most one
+    step per instruction, whatever the packet.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "hci.h"
+#include "public.h"
+
+#if !defined(_TRACEFILTER_H_)
+#define _TRACEFILTER_H_
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+//
+// Time passed to TraceFilterRun is in 100ns units, as from
+// KeQueryInterruptTime.
+//
+#define TRACE_FILTER_TICKS_PER_SECOND   10000000LL
+
+//
+// Run time state of an instruction, for the sampling and rate limiting
+// ones. Packets complete on several processors at once and these are
+// updated without a lock, so both are approximate under load. Good enough
+// for deciding what to print.
+//
+typedef struct _TRACE_FILTER_INSN_STATE {
+
+    ULONG       Count;
+    LONGLONG    Tokens;     // rate limit credit in ticks
+    LONGLONG    LastTime;
+
+} TRACE_FILTER_INSN_STATE, *PTRACE_FILTER_INSN_STATE;
+
+typedef struct _TRACE_FILTER {
+
+    ULONG                   InsnCount;
+    TRACE_FILTER_INSN       Insns[TRACE_FILTER_MAX_INSNS];
+    TRACE_FILTER_INSN_STATE State[TRACE_FILTER_MAX_INSNS];
+
+} TRACE_FILTER, *PTRACE_FILTER;
+
+BOOLEAN
+TraceFilterVerify(
+    const TRACE_FILTER_INSN *Insns,
+    ULONG                   InsnCount
+    );
+
+BOOLEAN
+TraceFilterLoad(
+    PTRACE_FILTER               Filter,
+    const TRACE_FILTER_PROGRAM  *Program,
+    ULONG                       Length
+    );
+
+BOOLEAN
+TraceFilterRun(
+    PTRACE_FILTER   Filter,
+    UCHAR           Kind,
+    UCHAR           Direction,
+    PUCHAR          Bfr,
+    ULONG           Length,
+    LONGLONG        Now
+    );
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
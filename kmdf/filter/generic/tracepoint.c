@@ -0,0 +1,163 @@
+/*++
+
+Module Name:
+
+    tracepoint.c
+
+Abstract:
+
+    Lockless ring the tracepoints write to. Writers on any processor take
+    a sequence number with one interlocked increment and own that slot
+    until they publish the sequence in it. Readers copy a slot and keep
+    the copy only if its sequence was published before and after.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#if !defined(_KERNEL_MODE) && !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 199309L     // clock_gettime
+#endif
+
+#include "tracepoint.h"
+
+#if !defined(_KERNEL_MODE) && !defined(_WIN32)
+#include <time.h>
+#endif
+
+volatile ULONG TracepointKeywords = TRACEPOINT_KEYWORDS_DEFAULT;
+
+//
+// Records ever written, record n goes to slot (n - 1) % TRACEPOINT_RING_RECORDS.
+//
+static volatile LONG TracepointHead;
+static TRACEPOINT_RECORD TracepointRing[TRACEPOINT_RING_RECORDS];
+
+static LONGLONG
+TracepointTime(
+    VOID
+    )
+{
+#if defined(_KERNEL_MODE)
+    return (LONGLONG)KeQueryInterruptTime();
+#elif defined(_WIN32)
+    return (LONGLONG)GetTickCount64() * 10000;
+#else
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (LONGLONG)now.tv_sec * 10000000 + now.tv_nsec / 100;
+#endif
+}
+
+VOID
+TracepointWrite(
+    USHORT      Id,
+    UCHAR       Level,
+    ULONGLONG   Field0,
+    ULONGLONG   Field1,
+    ULONGLONG   Field2,
+    ULONGLONG   Field3
+    )
+/*++
+
+Routine Description:
+
+    Writes a record, called through TRACEPOINT once the keyword check
+    passed. Can be called at any IRQL up to DISPATCH_LEVEL.
+
+--*/
+{
+    ULONG               sequence = (ULONG)PORTABLE_INTERLOCKED_INCREMENT(&TracepointHead);
+    PTRACEPOINT_RECORD  record = &TracepointRing[(sequence - 1) % TRACEPOINT_RING_RECORDS];
+
+    record->Sequence = 0;
+    PORTABLE_MEMORY_BARRIER();
+
+    record->Id = Id;
+    record->Level = Level;
+    record->Reserved = 0;
+    record->Time = TracepointTime();
+    record->Fields[0] = Field0;
+    record->Fields[1] = Field1;
+    record->Fields[2] = Field2;
+    record->Fields[3] = Field3;
+
+    PORTABLE_MEMORY_BARRIER();
+    record->Sequence = sequence;
+}
+
+ULONG
+TracepointRead(
+    ULONG               FirstSequence,
+    PTRACEPOINT_RECORD  Records,
+    ULONG               MaxRecords,
+    PULONG              NextSequence,
+    PULONG              Lost
+    )
+/*++
+
+Routine Description:
+
+    Copies out records in the order they were written.
+
+Arguments:
+
+    FirstSequence - Sequence of the first record wanted, 0 for the oldest
+        one still in the ring.
+
+    Records, MaxRecords - Where to copy them.
+
+    NextSequence - Receives the sequence to pass in the next call.
+
+    Lost - Receives how many of the records wanted were overwritten before
+        they could be copied.
+
+Return Value:
+
+    Number of records copied. Stops early at a record that is still being
+    written, it is returned by the next call.
+
+--*/
+{
+    ULONG head = (ULONG)TracepointHead;
+    ULONG oldest = head >= TRACEPOINT_RING_RECORDS ? head - TRACEPOINT_RING_RECORDS + 1 : 1;
+    ULONG sequence = FirstSequence;
+    ULONG count = 0;
+
+    *Lost = 0;
+
+    if (sequence == 0) {
+        sequence = oldest;
+    } else if ((LONG)(sequence - oldest) < 0) {
+        *Lost = oldest - sequence;
+        sequence = oldest;
+    } else if ((LONG)(sequence - head) > 1) {
+        sequence = head + 1;
+    }
+
+    for (; sequence != head + 1 && count < MaxRecords; sequence++) {
+        PTRACEPOINT_RECORD  record = &TracepointRing[(sequence - 1) % TRACEPOINT_RING_RECORDS];
+        ULONG               before;
+
+        before = record->Sequence;
+        PORTABLE_MEMORY_BARRIER();
+        Records[count] = *record;
+        PORTABLE_MEMORY_BARRIER();
+
+        if (before == sequence && record->Sequence == sequence) {
+            count++;
+        } else if (before == 0 || (LONG)(before - sequence) < 0) {
+            break;
+        } else {
+            (*Lost)++;
+        }
+    }
+
+    *NextSequence = sequence;
+
+    return count;
+}
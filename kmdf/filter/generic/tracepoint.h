@@ -0,0 +1,87 @@
+/*++
+
+Module Name:
+
+    tracepoint.h
+
+Abstract:
+
+    Tracepoints on the URB path.
+
+    A tracepoint writes a binary TRACEPOINT_RECORD (see tracepoints.h) into
+    a lockless ring that usermode reads with IOCTL_GET_TRACEPOINTS. Nothing
+    is formatted in the driver.
+
+    Tracepoints above TRACEPOINT_COMPILED_LEVEL compile to nothing, build
+    with /DTRACEPOINT_COMPILED_LEVEL=1 to keep only the errors. The others
+    cost one load of TracepointKeywords and one branch while their keyword
+    is disabled, the fields aren't evaluated then.
+
+    The same sources build in usermode, so the cost of a record can be
+    measured outside the driver.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "portable.h"
+#include "tracepoints.h"
+
+#if !defined(_TRACEPOINT_H_)
+#define _TRACEPOINT_H_
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#if !defined(TRACEPOINT_COMPILED_LEVEL)
+#define TRACEPOINT_COMPILED_LEVEL   TRACEPOINT_LEVEL_VERBOSE
+#endif
+
+#define TRACEPOINT_RING_RECORDS     1024
+
+C_ASSERT((TRACEPOINT_RING_RECORDS & (TRACEPOINT_RING_RECORDS - 1)) == 0);
+
+extern volatile ULONG TracepointKeywords;
+
+#define TRACEPOINT_ENABLED(Level, Keyword) \
+    ((Level) <= TRACEPOINT_COMPILED_LEVEL && (TracepointKeywords & (Keyword)) != 0)
+
+#define TRACEPOINT(Level, Keyword, Id, F0, F1, F2, F3)                          \
+    do {                                                                        \
+        if (TRACEPOINT_ENABLED(Level, Keyword)) {                               \
+            TracepointWrite((Id), (Level),                                      \
+                            (ULONGLONG)(F0), (ULONGLONG)(F1),                   \
+                            (ULONGLONG)(F2), (ULONGLONG)(F3));                  \
+        }                                                                       \
+    } while (0)
+
+#define TRACEPOINT_PTR(P)           ((ULONGLONG)(ULONG_PTR)(P))
+#define TRACEPOINT_STATUS(S)        ((ULONGLONG)(ULONG)(S))
+
+VOID
+TracepointWrite(
+    USHORT      Id,
+    UCHAR       Level,
+    ULONGLONG   Field0,
+    ULONGLONG   Field1,
+    ULONGLONG   Field2,
+    ULONGLONG   Field3
+    );
+
+ULONG
+TracepointRead(
+    ULONG               FirstSequence,
+    PTRACEPOINT_RECORD  Records,
+    ULONG               MaxRecords,
+    PULONG              NextSequence,
+    PULONG              Lost
+    );
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
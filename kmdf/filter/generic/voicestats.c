@@ -0,0 +1,316 @@
+/*++
+
+Module Name:
+
+    voicestats.c
+
+Abstract:
+
+    Voice session accounting, see voicestats.h.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "voicestats.h"
+
+#define VOICE_STATS_TICKS_PER_MS        10000
+#define VOICE_STATS_TICKS_PER_SECOND    10000000
+
+static ULONG
+VoiceStatsHash(
+    const UCHAR *Value,
+    ULONG       Captured,
+    ULONG       Length
+    )
+{
+    ULONG hash = 2166136261u ^ Length;
+    ULONG i;
+
+    for (i = 0; i < Captured; i++) {
+        hash = (hash ^ Value[i]) * 16777619u;
+    }
+
+    return hash;
+}
+
+static VOID
+VoiceStatsSummarize(
+    const VOICE_STATS_STATE     *State,
+    const VOICE_STATS_STREAM    *Stream,
+    PFILTER_VOICE_SESSION       Session
+    )
+/*++
+
+Routine Description:
+
+    Fills in a session from the stream's counts, with the missing frames
+    counted from the rate when the frames have no counter.
+
+--*/
+{
+    const FILTER_VOICE_SESSION *session = &Stream->Session;
+    LONGLONG                    expected;
+
+    *Session = *session;
+
+    if (State->Config.SequenceOffset == FILTER_VOICE_NO_SEQUENCE) {
+        Session->Missing = 0;
+
+        if (State->Config.FrameHz != 0) {
+            expected = ((session->End - session->Start) * State->Config.FrameHz +
+                        VOICE_STATS_TICKS_PER_SECOND / 2) / VOICE_STATS_TICKS_PER_SECOND + 1;
+
+            if (expected > (LONGLONG)Stream->Distinct) {
+                Session->Missing = (ULONG)(expected - Stream->Distinct);
+            }
+        }
+    }
+
+    Session->ExpectedBytes = Stream->MaxLength * (Stream->Distinct + Session->Missing);
+    Session->JitterUs = (ULONG)(Stream->Jitter / 16 / 10);
+}
+
+static VOID
+VoiceStatsFinish(
+    PVOICE_STATS_STATE  State,
+    PVOICE_STATS_STREAM Stream
+    )
+{
+    PFILTER_VOICE_SESSION session = &State->Sessions[State->TotalSessions % FILTER_VOICE_SESSIONS];
+    PFILTER_VOICE_SESSION totals = &State->Totals;
+
+    VoiceStatsSummarize(State, Stream, session);
+
+    if (State->TotalSessions == 0) {
+        totals->Start = session->Start;
+    }
+
+    totals->End = session->End;
+    totals->Frames += session->Frames;
+    totals->Missing += session->Missing;
+    totals->Duplicates += session->Duplicates;
+    totals->Reordered += session->Reordered;
+    totals->Late += session->Late;
+    totals->Short += session->Short;
+    totals->Trimmed += session->Trimmed;
+    totals->Bytes += session->Bytes;
+    totals->ExpectedBytes += session->ExpectedBytes;
+    totals->DeliveredBytes += session->DeliveredBytes;
+    totals->JitterUs = max(totals->JitterUs, session->JitterUs);
+    totals->MaxGapUs = max(totals->MaxGapUs, session->MaxGapUs);
+
+    State->TotalSessions++;
+    Stream->Active = FALSE;
+}
+
+VOID
+VoiceStatsInit(
+    PVOICE_STATS_STATE State
+    )
+{
+    FILTER_VOICE_CONFIG config;
+
+    RtlZeroMemory(State, sizeof(VOICE_STATS_STATE));
+
+    config.SequenceOffset = FILTER_VOICE_NO_SEQUENCE;
+    config.FrameHz = 0;
+    config.GapMs = FILTER_VOICE_DEFAULT_GAP_MS;
+
+    VoiceStatsConfigure(State, &config);
+}
+
+VOID
+VoiceStatsConfigure(
+    PVOICE_STATS_STATE          State,
+    const FILTER_VOICE_CONFIG   *Config
+    )
+/*++
+
+Routine Description:
+
+    Applies a new configuration. The sessions going on are finished, they
+    were counted the old way.
+
+--*/
+{
+    ULONG i;
+
+    for (i = 0; i < HCI_MAX_CONNECTIONS; i++) {
+        if (State->Streams[i].Active) {
+            VoiceStatsFinish(State, &State->Streams[i]);
+        }
+    }
+
+    State->Config = *Config;
+    State->GapTicks = (LONGLONG)max(Config->GapMs, 1) * VOICE_STATS_TICKS_PER_MS;
+}
+
+VOID
+VoiceStatsFrame(
+    PVOICE_STATS_STATE  State,
+    ULONG               Stream,
+    USHORT              Handle,
+    USHORT              Attribute,
+    const UCHAR         *Value,
+    ULONG               Captured,
+    ULONG               Length,
+    ULONG               Delivered,
+    LONGLONG            Now
+    )
+{
+    PVOICE_STATS_STREAM     stream;
+    PFILTER_VOICE_SESSION   session;
+    ULONG                   offset = State->Config.SequenceOffset;
+    BOOLEAN                 counted = offset < Captured;
+    ULONG                   hash = VoiceStatsHash(Value, Captured, Length);
+    LONGLONG                gap;
+    LONGLONG                period;
+    LONGLONG                deviation;
+    UCHAR                   delta;
+
+    if (Stream >= HCI_MAX_CONNECTIONS) {
+        return;
+    }
+
+    stream = &State->Streams[Stream];
+    session = &stream->Session;
+
+    if (stream->Active &&
+        (session->Handle != Handle || Now - session->End > State->GapTicks)) {
+        VoiceStatsFinish(State, stream);
+    }
+
+    if (!stream->Active) {
+        RtlZeroMemory(stream, sizeof(VOICE_STATS_STREAM));
+
+        stream->Active = TRUE;
+        stream->Distinct = 1;
+        stream->Sequence = counted ? Value[offset] : 0;
+        session->Start = Now;
+        session->End = Now;
+        session->Handle = Handle;
+    } else {
+        if (counted) {
+            delta = (UCHAR)(Value[offset] - stream->Sequence);
+
+            if (delta == 0) {
+                session->Duplicates++;
+            } else if (delta < 0x80) {
+                session->Missing += delta - 1;
+                stream->Sequence = Value[offset];
+                stream->Distinct++;
+            } else {
+                //
+                // Counted missing when the frames after it came.
+                //
+                session->Reordered++;
+                if (session->Missing > 0) {
+                    session->Missing--;
+                }
+                stream->Distinct++;
+            }
+        } else if (hash == stream->Hash) {
+            session->Duplicates++;
+        } else {
+            stream->Distinct++;
+        }
+
+        gap = Now - session->End;
+
+        if (State->Config.FrameHz != 0) {
+            period = VOICE_STATS_TICKS_PER_SECOND / State->Config.FrameHz;
+        } else if (session->Frames > 1) {
+            period = (session->End - session->Start) / (session->Frames - 1);
+        } else {
+            period = gap;
+        }
+
+        deviation = gap - period;
+        if (deviation < 0) {
+            deviation = -deviation;
+        }
+
+        stream->Jitter += deviation - stream->Jitter / 16;
+
+        if (gap > 2 * period) {
+            session->Late++;
+        }
+
+        session->MaxGapUs = max(session->MaxGapUs, (ULONG)(gap / 10));
+        session->End = Now;
+    }
+
+    stream->Hash = hash;
+
+    if (Length < stream->MaxLength) {
+        session->Short++;
+    }
+    stream->MaxLength = (USHORT)max(stream->MaxLength, Length);
+
+    if (Delivered < Length) {
+        session->Trimmed++;
+    }
+
+    session->Attribute = Attribute;
+    session->Frames++;
+    session->Bytes += Length;
+    session->DeliveredBytes += Delivered;
+}
+
+VOID
+VoiceStatsResetStream(
+    PVOICE_STATS_STATE  State,
+    ULONG               Stream
+    )
+{
+    if (Stream < HCI_MAX_CONNECTIONS && State->Streams[Stream].Active) {
+        VoiceStatsFinish(State, &State->Streams[Stream]);
+    }
+}
+
+VOID
+VoiceStatsGet(
+    PVOICE_STATS_STATE  State,
+    LONGLONG            Now,
+    PFILTER_VOICE_STATS Stats
+    )
+/*++
+
+Routine Description:
+
+    Finishes the sessions that went quiet and fills in the finished ones
+    kept and the ones going on.
+
+--*/
+{
+    ULONG i;
+    ULONG first;
+
+    RtlZeroMemory(Stats, sizeof(FILTER_VOICE_STATS));
+
+    for (i = 0; i < HCI_MAX_CONNECTIONS; i++) {
+        PVOICE_STATS_STREAM stream = &State->Streams[i];
+
+        if (stream->Active && Now - stream->Session.End > State->GapTicks) {
+            VoiceStatsFinish(State, stream);
+        }
+    }
+
+    Stats->TotalSessions = State->TotalSessions;
+    Stats->Totals = State->Totals;
+    Stats->SessionCount = min(State->TotalSessions, FILTER_VOICE_SESSIONS);
+    first = State->TotalSessions - Stats->SessionCount;
+
+    for (i = 0; i < Stats->SessionCount; i++) {
+        Stats->Sessions[i] = State->Sessions[(first + i) % FILTER_VOICE_SESSIONS];
+    }
+
+    for (i = 0; i < HCI_MAX_CONNECTIONS && i < FILTER_MAX_CONNECTIONS; i++) {
+        if (State->Streams[i].Active) {
+            VoiceStatsSummarize(State, &State->Streams[i], &Stats->Active[Stats->ActiveCount++]);
+        }
+    }
+}
@@ -0,0 +1,111 @@
+/*++
+
+Module Name:
+
+    voicestats.h
+
+Abstract:
+
+    Accounting of the voice sessions of each connection, see
+    FILTER_VOICE_CONFIG.
+
+    The completion path reports every voice notification with the length
+    the header fix left it, and the disconnections. Sessions that went
+    quiet are only finished when the next frame comes in or the stats are
+    read, so nothing runs between frames. A stream keeps a few counters
+    and the previous frame's counter and hash, so a session of any length
+    takes the same memory.
+
+    The caller serializes all calls for one VOICE_STATS_STATE.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "hci.h"
+#include "public.h"
+
+#if !defined(_VOICESTATS_H_)
+#define _VOICESTATS_H_
+
+typedef struct _VOICE_STATS_STREAM {
+
+    FILTER_VOICE_SESSION    Session;
+    BOOLEAN                 Active;
+    UCHAR                   Sequence;       // counter of the latest frame
+    USHORT                  MaxLength;
+    ULONG                   Hash;           // of the previous frame
+    ULONG                   Distinct;       // frames that weren't duplicates
+    LONGLONG                Jitter;         // 100ns units, times 16
+
+} VOICE_STATS_STREAM, *PVOICE_STATS_STREAM;
+
+typedef struct _VOICE_STATS_STATE {
+
+    FILTER_VOICE_CONFIG     Config;
+    LONGLONG                GapTicks;
+    ULONG                   TotalSessions;
+    FILTER_VOICE_SESSION    Totals;
+
+    //
+    // Finished sessions, the oldest at TotalSessions modulo their count.
+    //
+    FILTER_VOICE_SESSION    Sessions[FILTER_VOICE_SESSIONS];
+
+    //
+    // Indexed like the connection slots of the link state.
+    //
+    VOICE_STATS_STREAM      Streams[HCI_MAX_CONNECTIONS];
+
+} VOICE_STATS_STATE, *PVOICE_STATS_STATE;
+
+VOID
+VoiceStatsInit(
+    PVOICE_STATS_STATE State
+    );
+
+VOID
+VoiceStatsConfigure(
+    PVOICE_STATS_STATE          State,
+    const FILTER_VOICE_CONFIG   *Config
+    );
+
+//
+// Value, Length - The value of the notification as it came in, Length
+//     bytes of which Captured are at Value.
+//
+// Delivered - Bytes of the value passed up, less than Length when the
+//     header fix trimmed it.
+//
+VOID
+VoiceStatsFrame(
+    PVOICE_STATS_STATE  State,
+    ULONG               Stream,
+    USHORT              Handle,
+    USHORT              Attribute,
+    const UCHAR         *Value,
+    ULONG               Captured,
+    ULONG               Length,
+    ULONG               Delivered,
+    LONGLONG            Now
+    );
+
+//
+// Finishes the session of a connection that went away.
+//
+VOID
+VoiceStatsResetStream(
+    PVOICE_STATS_STATE  State,
+    ULONG               Stream
+    );
+
+VOID
+VoiceStatsGet(
+    PVOICE_STATS_STATE  State,
+    LONGLONG            Now,
+    PFILTER_VOICE_STATS Stats
+    );
+
+#endif
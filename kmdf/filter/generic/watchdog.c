@@ -0,0 +1,225 @@
+/*++
+
+Module Name:
+
+    watchdog.c
+
+Abstract:
+
+    Notification stall detection, see watchdog.h.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "watchdog.h"
+
+#define WATCHDOG_TICKS_PER_MS   10000
+
+VOID
+WatchdogInit(
+    PWATCHDOG_STATE State
+    )
+{
+    FILTER_WATCHDOG_CONFIG config;
+
+    RtlZeroMemory(State, sizeof(WATCHDOG_STATE));
+
+    config.GapMs = FILTER_WATCHDOG_DEFAULT_GAP_MS;
+    config.Actions = FILTER_WATCHDOG_ACTION_DEFAULT;
+    config.Flags = 0;
+
+    WatchdogConfigure(State, &config);
+}
+
+VOID
+WatchdogConfigure(
+    PWATCHDOG_STATE                 State,
+    const FILTER_WATCHDOG_CONFIG    *Config
+    )
+/*++
+
+Routine Description:
+
+    Applies a new configuration. The connections start streaming afresh,
+    the counts are kept.
+
+--*/
+{
+    ULONG i;
+
+    State->Config = *Config;
+    State->GapTicks = (LONGLONG)Config->GapMs * WATCHDOG_TICKS_PER_MS;
+
+    for (i = 0; i < HCI_MAX_CONNECTIONS; i++) {
+        State->Streams[i].Notifications = 0;
+    }
+}
+
+VOID
+WatchdogResetStream(
+    PWATCHDOG_STATE State,
+    ULONG           Stream
+    )
+/*++
+
+Routine Description:
+
+    Forgets a connection slot when it connects or disconnects, a remote
+    that disconnects is quiet, not stalled.
+
+--*/
+{
+    if (Stream < HCI_MAX_CONNECTIONS) {
+        RtlZeroMemory(&State->Streams[Stream], sizeof(WATCHDOG_STREAM));
+    }
+}
+
+BOOLEAN
+WatchdogNotification(
+    PWATCHDOG_STATE State,
+    ULONG           Stream,
+    USHORT          Handle,
+    ULONG           AttLength,
+    LONGLONG        Now
+    )
+/*++
+
+Routine Description:
+
+    Counts a notification passed up to the upper stack.
+
+Arguments:
+
+    AttLength - ATT length of the notification as passed up, after the
+        header fix trimmed it.
+
+Return Value:
+
+    TRUE if the caller has to schedule a check in WatchdogPeriod.
+
+--*/
+{
+    PWATCHDOG_STREAM stream;
+
+    if (State->GapTicks == 0 || Stream >= HCI_MAX_CONNECTIONS) {
+        return FALSE;
+    }
+
+    stream = &State->Streams[Stream];
+
+    if (stream->Handle != Handle) {
+        RtlZeroMemory(stream, sizeof(WATCHDOG_STREAM));
+        stream->Handle = Handle;
+    }
+
+    if (stream->Notifications != 0 &&
+        Now - stream->LastNotification <= State->GapTicks) {
+        stream->Notifications++;
+    } else {
+        stream->Notifications = 1;
+    }
+
+    stream->LastNotification = Now;
+    stream->LastLong = AttLength > HCI_LEGACY_FIX_ATT_LENGTH;
+
+    if (stream->Notifications < FILTER_WATCHDOG_STREAMING) {
+        return FALSE;
+    }
+
+    if (stream->Stalled) {
+        stream->Stalled = FALSE;
+        State->Recoveries++;
+    }
+
+    if (State->Scheduled) {
+        return FALSE;
+    }
+
+    State->Scheduled = TRUE;
+    return TRUE;
+}
+
+ULONG
+WatchdogCheck(
+    PWATCHDOG_STATE State,
+    LONGLONG        Now,
+    PWATCHDOG_STALL Stalls,
+    PBOOLEAN        Reschedule
+    )
+/*++
+
+Routine Description:
+
+    Looks for streaming connections that went quiet. A quiet connection
+    stops streaming, so one stall is returned once.
+
+Arguments:
+
+    Stalls - Receives up to HCI_MAX_CONNECTIONS stalls.
+
+    Reschedule - Receives TRUE if a connection still streams and the caller
+        has to schedule the next check.
+
+Return Value:
+
+    Number of stalls found.
+
+--*/
+{
+    PWATCHDOG_STREAM    stream;
+    ULONG               count = 0;
+    ULONG               i;
+
+    *Reschedule = FALSE;
+
+    for (i = 0; i < HCI_MAX_CONNECTIONS; i++) {
+        stream = &State->Streams[i];
+
+        if (stream->Notifications < FILTER_WATCHDOG_STREAMING) {
+            continue;
+        }
+
+        if (State->GapTicks != 0 && Now - stream->LastNotification <= State->GapTicks) {
+            *Reschedule = TRUE;
+            continue;
+        }
+
+        stream->Notifications = 0;
+
+        if (State->GapTicks == 0 ||
+            (!stream->LastLong && !(State->Config.Flags & FILTER_WATCHDOG_ANY_GAP))) {
+            continue;
+        }
+
+        stream->Stalled = TRUE;
+        stream->Stalls++;
+        State->Stalls++;
+
+        Stalls[count].Stream = i;
+        Stalls[count].Handle = stream->Handle;
+        Stalls[count].GapMs = (USHORT)min((Now - stream->LastNotification) / WATCHDOG_TICKS_PER_MS, 0xFFFF);
+        count++;
+    }
+
+    State->Scheduled = *Reschedule;
+
+    return count;
+}
+
+ULONG
+WatchdogPeriod(
+    PWATCHDOG_STATE State
+    )
+/*++
+
+Routine Description:
+
+    Milliseconds from one check to the next.
+
+--*/
+{
+    return max(State->Config.GapMs / 2, WATCHDOG_MIN_PERIOD_MS);
+}
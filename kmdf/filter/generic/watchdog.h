@@ -0,0 +1,108 @@
+/*++
+
+Module Name:
+
+    watchdog.h
+
+Abstract:
+
+    Notices connections whose notifications stopped reaching the upper
+    stack, see FILTER_WATCHDOG_CONFIG.
+
+    The completion path reports every notification it passes up. Nothing
+    runs while no connection streams; the first connection to start
+    streaming asks the caller to schedule a check, and each check asks for
+    the next one while a connection still streams. Checking WatchdogPeriod
+    after each other catches a stall at most half a gap late.
+
+    The caller serializes all calls for one WATCHDOG_STATE and carries out
+    the actions of the stalls a check returns.
+
+Environment:
+
+    Kernel mode or usermode
+
+--*/
+
+#include "hci.h"
+#include "public.h"
+
+#if !defined(_WATCHDOG_H_)
+#define _WATCHDOG_H_
+
+#define WATCHDOG_MIN_PERIOD_MS          20
+
+typedef struct _WATCHDOG_STREAM {
+
+    LONGLONG    LastNotification;
+    ULONG       Notifications;  // in a row, each within the gap of the previous
+    USHORT      Handle;
+    BOOLEAN     LastLong;       // the last notification was too long for the header fix
+    BOOLEAN     Stalled;        // until the connection streams again
+    USHORT      Stalls;
+
+} WATCHDOG_STREAM, *PWATCHDOG_STREAM;
+
+typedef struct _WATCHDOG_STALL {
+
+    ULONG       Stream;
+    USHORT      Handle;
+    USHORT      GapMs;          // since the last notification
+
+} WATCHDOG_STALL, *PWATCHDOG_STALL;
+
+typedef struct _WATCHDOG_STATE {
+
+    FILTER_WATCHDOG_CONFIG  Config;
+    LONGLONG                GapTicks;   // 0 while stopped
+    BOOLEAN                 Scheduled;  // a check is due
+    ULONG                   Stalls;
+    ULONG                   Recoveries;
+
+    //
+    // Indexed like the connection slots of the link state.
+    //
+    WATCHDOG_STREAM         Streams[HCI_MAX_CONNECTIONS];
+
+} WATCHDOG_STATE, *PWATCHDOG_STATE;
+
+VOID
+WatchdogInit(
+    PWATCHDOG_STATE State
+    );
+
+VOID
+WatchdogConfigure(
+    PWATCHDOG_STATE                 State,
+    const FILTER_WATCHDOG_CONFIG    *Config
+    );
+
+VOID
+WatchdogResetStream(
+    PWATCHDOG_STATE State,
+    ULONG           Stream
+    );
+
+BOOLEAN
+WatchdogNotification(
+    PWATCHDOG_STATE State,
+    ULONG           Stream,
+    USHORT          Handle,
+    ULONG           AttLength,
+    LONGLONG        Now
+    );
+
+ULONG
+WatchdogCheck(
+    PWATCHDOG_STATE State,
+    LONGLONG        Now,
+    PWATCHDOG_STALL Stalls,
+    PBOOLEAN        Reschedule
+    );
+
+ULONG
+WatchdogPeriod(
+    PWATCHDOG_STATE State
+    );
+
+#endif
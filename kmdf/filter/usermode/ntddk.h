@@ -0,0 +1,351 @@
+/*++
+
+Module Name:
+
+    ntddk.h
+
+Abstract:
+
+    Usermode stand-in for the part of the WDK's ntddk.h the filter uses,
+    so filter.c and its modules build unmodified into a usermode program,
+    see shim.h. Types keep their Windows sizes, ULONG is 32 bits as on
+    LLP64.
+
+    Spin locks really spin and interlocked operations are atomic, so
+    several threads can drive the filter at once. IRQL is only tracked
+    per thread.
+
+Environment:
+
+    usermode, gcc or clang
+
+--*/
+
+#if !defined(_SHIM_NTDDK_H_)
+#define _SHIM_NTDDK_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define IN
+#define OUT
+#define OPTIONAL
+#define _In_
+#define _Out_
+#define _Inout_
+#define _In_opt_
+
+#define VOID                void
+#define FORCEINLINE         static inline __attribute__((always_inline))
+#define POINTER_ALIGNMENT   __attribute__((aligned(sizeof(void *))))
+#define DECLSPEC_ALIGN(x)   __attribute__((aligned(x)))
+
+typedef void *              PVOID;
+typedef char                CHAR, *PCHAR;
+typedef const char *        PCSTR;
+typedef uint8_t             UCHAR, *PUCHAR;
+typedef uint8_t             BOOLEAN, *PBOOLEAN;
+typedef int16_t             SHORT, *PSHORT;
+typedef uint16_t            USHORT, *PUSHORT;
+typedef uint16_t            WCHAR, *PWCHAR, *PWCH, *PWSTR;
+typedef const WCHAR *       PCWSTR;
+typedef int32_t             LONG, *PLONG;
+typedef uint32_t            ULONG, *PULONG;
+typedef int64_t             LONGLONG, *PLONGLONG;
+typedef uint64_t            ULONGLONG, *PULONGLONG;
+typedef uintptr_t           ULONG_PTR, *PULONG_PTR;
+typedef size_t              SIZE_T;
+typedef LONG                NTSTATUS;
+
+typedef union _LARGE_INTEGER {
+    struct {
+        ULONG   LowPart;
+        LONG    HighPart;
+    };
+    LONGLONG    QuadPart;
+} LARGE_INTEGER, *PLARGE_INTEGER;
+
+#define TRUE    1
+#define FALSE   0
+
+#define STATUS_SUCCESS                  ((NTSTATUS)0x00000000L)
+#define STATUS_TIMEOUT                  ((NTSTATUS)0x00000102L)
+#define STATUS_PENDING                  ((NTSTATUS)0x00000103L)
+#define STATUS_NO_MORE_ENTRIES          ((NTSTATUS)0x8000001AL)
+#define STATUS_UNSUCCESSFUL             ((NTSTATUS)0xC0000001L)
+#define STATUS_NOT_IMPLEMENTED          ((NTSTATUS)0xC0000002L)
+#define STATUS_INVALID_PARAMETER        ((NTSTATUS)0xC000000DL)
+#define STATUS_NO_SUCH_DEVICE           ((NTSTATUS)0xC000000EL)
+#define STATUS_INVALID_DEVICE_REQUEST   ((NTSTATUS)0xC0000010L)
+#define STATUS_BUFFER_TOO_SMALL         ((NTSTATUS)0xC0000023L)
+#define STATUS_INSUFFICIENT_RESOURCES   ((NTSTATUS)0xC000009AL)
+#define STATUS_CANCELLED                ((NTSTATUS)0xC0000120L)
+#define STATUS_INVALID_DEVICE_STATE     ((NTSTATUS)0xC0000184L)
+#define STATUS_NOT_FOUND                ((NTSTATUS)0xC0000225L)
+
+#define NT_SUCCESS(Status)              (((NTSTATUS)(Status)) >= 0)
+
+#define UNREFERENCED_PARAMETER(P)       ((void)(P))
+#define PAGED_CODE()
+#define FIELD_OFFSET(Type, Field)       offsetof(Type, Field)
+#define RTL_NUMBER_OF(A)                (sizeof(A) / sizeof((A)[0]))
+#define ARRAYSIZE(A)                    RTL_NUMBER_OF(A)
+#if defined(__cplusplus)
+#define C_ASSERT(e)                     static_assert(e, #e)
+#else
+#define C_ASSERT(e)                     _Static_assert(e, #e)
+#endif
+
+#if !defined(__cplusplus)
+#if !defined(min)
+#define min(a, b)   (((a) < (b)) ? (a) : (b))
+#endif
+#if !defined(max)
+#define max(a, b)   (((a) > (b)) ? (a) : (b))
+#endif
+#endif
+
+#define RtlZeroMemory(Destination, Length)          memset((Destination), 0, (Length))
+#define RtlFillMemory(Destination, Length, Fill)    memset((Destination), (Fill), (Length))
+#define RtlCopyMemory(Destination, Source, Length)  memcpy((Destination), (Source), (Length))
+#define RtlMoveMemory(Destination, Source, Length)  memmove((Destination), (Source), (Length))
+#define RtlEqualMemory(Destination, Source, Length) (!memcmp((Destination), (Source), (Length)))
+
+//
+// Formats like the kernel's, %lu is 32 bits and %ws a WCHAR string. Goes
+// nowhere unless ShimDebugOutput is set, see shim.h. KdPrint only prints
+// in checked builds, built with DBG=1.
+//
+ULONG
+DbgPrint(
+    PCSTR Format,
+    ...
+    );
+
+#if DBG
+#define KdPrint(_x_)    DbgPrint _x_
+#else
+#define KdPrint(_x_)
+#endif
+
+#define FILE_DEVICE_UNKNOWN     0x00000022
+#define METHOD_BUFFERED         0
+#define METHOD_IN_DIRECT        1
+#define METHOD_OUT_DIRECT       2
+#define METHOD_NEITHER          3
+#define FILE_ANY_ACCESS         0
+#define FILE_READ_DATA          0x0001
+#define FILE_WRITE_DATA         0x0002
+
+#define CTL_CODE(DeviceType, Function, Method, Access) \
+    (((DeviceType) << 16) | ((Access) << 14) | ((Function) << 2) | (Method))
+
+typedef struct _UNICODE_STRING {
+    USHORT  Length;
+    USHORT  MaximumLength;
+    PWCH    Buffer;
+} UNICODE_STRING, *PUNICODE_STRING;
+
+typedef const UNICODE_STRING *PCUNICODE_STRING;
+
+//
+// Nothing reads the device names back, so the wchar_t literals are
+// stored as they are.
+//
+#define DECLARE_CONST_UNICODE_STRING(_var, _string) \
+    const UNICODE_STRING _var = { 0, 0, (PWCH)(_string) }
+
+//
+// IRQL
+//
+typedef UCHAR KIRQL, *PKIRQL;
+
+#define PASSIVE_LEVEL   0
+#define APC_LEVEL       1
+#define DISPATCH_LEVEL  2
+
+KIRQL
+KeGetCurrentIrql(
+    VOID
+    );
+
+//
+// Spin locks
+//
+typedef volatile LONG KSPIN_LOCK, *PKSPIN_LOCK;
+
+VOID
+KeInitializeSpinLock(
+    PKSPIN_LOCK SpinLock
+    );
+
+VOID
+KeAcquireSpinLock(
+    PKSPIN_LOCK SpinLock,
+    PKIRQL      OldIrql
+    );
+
+VOID
+KeReleaseSpinLock(
+    PKSPIN_LOCK SpinLock,
+    KIRQL       NewIrql
+    );
+
+//
+// Interlocked operations, full barriers like on Windows.
+//
+FORCEINLINE LONG
+InterlockedIncrement(volatile LONG *Addend)
+{
+    return __atomic_add_fetch(Addend, 1, __ATOMIC_SEQ_CST);
+}
+
+FORCEINLINE LONG
+InterlockedDecrement(volatile LONG *Addend)
+{
+    return __atomic_sub_fetch(Addend, 1, __ATOMIC_SEQ_CST);
+}
+
+FORCEINLINE LONG
+InterlockedExchange(volatile LONG *Target, LONG Value)
+{
+    return __atomic_exchange_n(Target, Value, __ATOMIC_SEQ_CST);
+}
+
+FORCEINLINE LONG
+InterlockedExchangeAdd(volatile LONG *Addend, LONG Value)
+{
+    return __atomic_fetch_add(Addend, Value, __ATOMIC_SEQ_CST);
+}
+
+FORCEINLINE VOID
+KeMemoryBarrier(VOID)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+//
+// Time, in 100ns units. Interrupt time follows the monotonic clock unless
+// the program pinned it, see ShimSetInterruptTime.
+//
+ULONGLONG
+KeQueryInterruptTime(
+    VOID
+    );
+
+//
+// The performance counter is the monotonic clock in nanoseconds, it is
+// never pinned.
+//
+LARGE_INTEGER
+KeQueryPerformanceCounter(
+    PLARGE_INTEGER  PerformanceFrequency
+    );
+
+typedef CHAR KPROCESSOR_MODE;
+
+#define KernelMode  0
+#define UserMode    1
+
+NTSTATUS
+KeDelayExecutionThread(
+    KPROCESSOR_MODE WaitMode,
+    BOOLEAN         Alertable,
+    PLARGE_INTEGER  Interval
+    );
+
+typedef enum _POOL_TYPE {
+    NonPagedPool = 0,
+    NonPagedPoolNx = 512
+} POOL_TYPE;
+
+//
+// MDLs describe a buffer that is already mapped.
+//
+typedef struct _MDL {
+    struct _MDL *   Next;
+    PVOID           MappedSystemVa;
+    ULONG           ByteCount;
+} MDL, *PMDL;
+
+#define NormalPagePriority      16
+#define MdlMappingNoExecute     0x40000000
+
+FORCEINLINE PVOID
+MmGetSystemAddressForMdlSafe(PMDL Mdl, ULONG Priority)
+{
+    UNREFERENCED_PARAMETER(Priority);
+    return Mdl->MappedSystemVa;
+}
+
+#define MmGetSystemAddressForMdl(Mdl)   ((Mdl)->MappedSystemVa)
+
+//
+// IRPs only carry the stack location the filter reads, laid out like the
+// kernel's so Others.Argument1 and DeviceIoControl overlap the same way.
+//
+typedef struct _IO_STATUS_BLOCK {
+    NTSTATUS    Status;
+    ULONG_PTR   Information;
+} IO_STATUS_BLOCK, *PIO_STATUS_BLOCK;
+
+typedef struct _IO_STACK_LOCATION {
+    UCHAR   MajorFunction;
+    UCHAR   MinorFunction;
+    UCHAR   Flags;
+    UCHAR   Control;
+    union {
+        struct {
+            ULONG                   OutputBufferLength;
+            ULONG POINTER_ALIGNMENT InputBufferLength;
+            ULONG POINTER_ALIGNMENT IoControlCode;
+            PVOID                   Type3InputBuffer;
+        } DeviceIoControl;
+        struct {
+            PVOID   Argument1;
+            PVOID   Argument2;
+            PVOID   Argument3;
+            PVOID   Argument4;
+        } Others;
+    } Parameters;
+} IO_STACK_LOCATION, *PIO_STACK_LOCATION;
+
+typedef struct _IRP {
+    IO_STATUS_BLOCK     IoStatus;
+    IO_STACK_LOCATION   Stack;
+} IRP, *PIRP;
+
+#define IRP_MJ_DEVICE_CONTROL           0x0e
+#define IRP_MJ_INTERNAL_DEVICE_CONTROL  0x0f
+
+FORCEINLINE PIO_STACK_LOCATION
+IoGetCurrentIrpStackLocation(PIRP Irp)
+{
+    return &Irp->Stack;
+}
+
+typedef struct _DRIVER_OBJECT {
+    PVOID   DriverExtension;
+} DRIVER_OBJECT, *PDRIVER_OBJECT;
+
+typedef struct _DEVICE_OBJECT {
+    PVOID   DeviceExtension;
+} DEVICE_OBJECT, *PDEVICE_OBJECT;
+
+typedef enum _DEVICE_REGISTRY_PROPERTY {
+    DevicePropertyDeviceDescription = 0,
+    DevicePropertyHardwareID = 1
+} DEVICE_REGISTRY_PROPERTY;
+
+typedef NTSTATUS DRIVER_INITIALIZE(PDRIVER_OBJECT DriverObject, PUNICODE_STRING RegistryPath);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
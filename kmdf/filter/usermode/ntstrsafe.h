@@ -0,0 +1,25 @@
+/*++
+
+Module Name:
+
+    ntstrsafe.h
+
+Abstract:
+
+    Usermode stand-in for the WDK's ntstrsafe.h, see shim.h. The filter
+    only needs the C runtime headers it pulls in.
+
+Environment:
+
+    usermode, gcc or clang
+
+--*/
+
+#if !defined(_SHIM_NTSTRSAFE_H_)
+#define _SHIM_NTSTRSAFE_H_
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#endif
@@ -0,0 +1,2185 @@
+/*++
+
+Module Name:
+
+    shim.c
+
+Abstract:
+
+    The framework, kernel and USB stack the filter sees when it runs in a
+    usermode program, see shim.h.
+
+    Every handle is a SHIM_OBJECT. Objects hang off their parent and are
+    deleted with it, children after the parent's cleanup callback like in
+    KMDF. Requests that come from above have no parent, completing them
+    frees them.
+
+Environment:
+
+    usermode, POSIX
+
+--*/
+
+#if !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 200809L     // clock_gettime, nanosleep
+#endif
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "shim.h"
+#include <wdmsec.h>
+
+typedef enum _SHIM_OBJECT_TYPE {
+    ShimObjectDriver,
+    ShimObjectDevice,
+    ShimObjectQueue,
+    ShimObjectRequest,
+    ShimObjectIoTarget,
+    ShimObjectCollection,
+    ShimObjectWaitLock,
+    ShimObjectMemory,
+    ShimObjectTimer,
+    ShimObjectFileObject
+} SHIM_OBJECT_TYPE;
+
+//
+// Where a request came from, and so what completing it does.
+//
+typedef enum _SHIM_REQUEST_ORIGIN {
+    ShimRequestCreated,     // WdfRequestCreate, the driver deletes it
+    ShimRequestUrb,         // ShimSubmitUrb, completes to SHIM_UPPER_COMPLETE
+    ShimRequestControl      // ShimOpenControl and ShimDeviceIoControl, which wait for it
+} SHIM_REQUEST_ORIGIN;
+
+struct _WDFDEVICE_INIT {
+    WDFDRIVER               Driver;
+    BOOLEAN                 Control;
+    SHIM_DEVICE_CONFIG      Config;
+    BOOLEAN                 HasRequestAttributes;
+    WDF_OBJECT_ATTRIBUTES   RequestAttributes;
+    BOOLEAN                 HasFileObjectConfig;
+    WDF_FILEOBJECT_CONFIG   FileObjectConfig;
+    WDF_OBJECT_ATTRIBUTES   FileObjectAttributes;
+    WDFDEVICE               Device;     // created from it
+};
+
+typedef struct _SHIM_OBJECT {
+
+    SHIM_OBJECT_TYPE                Type;
+    struct _SHIM_OBJECT *           Parent;
+    struct _SHIM_OBJECT *           FirstChild;
+    struct _SHIM_OBJECT *           Next;
+    struct _SHIM_OBJECT *           Prev;
+    volatile LONG                   Deleting;
+
+    PFN_WDF_OBJECT_CONTEXT_CLEANUP  EvtCleanupCallback;
+    PFN_WDF_OBJECT_CONTEXT_DESTROY  EvtDestroyCallback;
+    PCWDF_OBJECT_CONTEXT_TYPE_INFO  ContextTypeInfo;
+    PVOID                           Context;
+
+    union {
+        struct {
+            WDF_DRIVER_CONFIG   Config;
+        } Driver;
+
+        struct {
+            BOOLEAN                 Control;
+            BOOLEAN                 Ready;
+            SHIM_DEVICE_CONFIG      Config;
+            BOOLEAN                 HasRequestAttributes;
+            WDF_OBJECT_ATTRIBUTES   RequestAttributes;
+            BOOLEAN                 HasFileObjectConfig;
+            WDF_FILEOBJECT_CONFIG   FileObjectConfig;
+            WDF_OBJECT_ATTRIBUTES   FileObjectAttributes;
+            struct _SHIM_OBJECT *   IoTarget;
+            struct _SHIM_OBJECT *   DefaultQueue;
+        } Device;
+
+        struct {
+            WDF_IO_QUEUE_CONFIG     Config;
+            pthread_mutex_t         Lock;   // held while a sequential queue dispatches, guards a manual one's list
+            struct _SHIM_OBJECT *   Head;   // requests a manual queue holds, oldest first
+            struct _SHIM_OBJECT *   Tail;
+        } Queue;
+
+        struct {
+            SHIM_REQUEST_ORIGIN                 Origin;
+            IRP                                 Irp;
+            volatile NTSTATUS                   Status;
+            PFN_WDF_REQUEST_COMPLETION_ROUTINE  CompletionRoutine;
+            WDFCONTEXT                          CompletionContext;
+            BOOLEAN                             SendAndForget;
+            struct _SHIM_OBJECT *               Target;
+            struct _SHIM_OBJECT *               Device;         // it was submitted to
+            struct _SHIM_OBJECT *               FileObject;
+            PVOID                               SystemBuffer;
+            volatile LONG                       Completed;
+            struct _SHIM_OBJECT *               Queue;          // manual queue holding it
+            struct _SHIM_OBJECT *               NextQueued;
+        } Request;
+
+        struct {
+            ULONG                   Count;
+            ULONG                   Allocated;
+            struct _SHIM_OBJECT **  Items;
+        } Collection;
+
+        struct {
+            pthread_mutex_t Mutex;
+        } WaitLock;
+
+        struct {
+            PVOID   Buffer;
+            size_t  Size;
+        } Memory;
+
+        struct {
+            WDF_TIMER_CONFIG        Config;
+            struct _SHIM_OBJECT *   NextTimer;
+            BOOLEAN                 Started;
+            ULONGLONG               Due;
+            ULONG                   Pass;       // of ShimRunTimers it last ran in
+            volatile LONG           Running;
+        } Timer;
+    };
+
+} SHIM_OBJECT, *PSHIM_OBJECT;
+
+BOOLEAN ShimDebugOutput = FALSE;
+
+const UNICODE_STRING SDDL_DEVOBJ_SYS_ALL_ADM_RWX_WORLD_RW_RES_R =
+    { 0, 0, (PWCH)u"D:P(A;;GA;;;SY)(A;;GRGWGX;;;BA)(A;;GRGW;;;WD)(A;;GR;;;RC)" };
+
+//
+// Guards the object tree and collections, never held across a callback.
+//
+static pthread_mutex_t ShimObjectLock = PTHREAD_MUTEX_INITIALIZER;
+
+//
+// Signalled when a request the program waits for completes.
+//
+static pthread_mutex_t ShimCompletionLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ShimCompletionEvent = PTHREAD_COND_INITIALIZER;
+
+static pthread_mutex_t ShimTimerLock = PTHREAD_MUTEX_INITIALIZER;
+static PSHIM_OBJECT ShimTimers;
+static ULONG ShimTimerPass;
+
+static PSHIM_OBJECT ShimDriver;
+static PSHIM_OBJECT ShimControlDevice;
+
+static volatile ULONGLONG ShimPinnedTime;
+
+static __thread KIRQL ShimIrql = PASSIVE_LEVEL;
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ShimCpuRelax()  __builtin_ia32_pause()
+#elif defined(__aarch64__)
+#define ShimCpuRelax()  __asm__ __volatile__("yield")
+#else
+#define ShimCpuRelax()
+#endif
+
+//
+// Objects
+//
+
+static PSHIM_OBJECT
+ShimObjectCreate(
+    SHIM_OBJECT_TYPE        Type,
+    PWDF_OBJECT_ATTRIBUTES  Attributes,
+    PSHIM_OBJECT            DefaultParent
+    )
+/*++
+Routine Description:
+
+    Allocates an object with the context and callbacks of Attributes and
+    links it under its parent, the attributes' or DefaultParent.
+
+--*/
+{
+    PSHIM_OBJECT    object;
+    PSHIM_OBJECT    parent = DefaultParent;
+
+    object = (PSHIM_OBJECT)calloc(1, sizeof(SHIM_OBJECT));
+    if (object == NULL) {
+        return NULL;
+    }
+
+    object->Type = Type;
+
+    if (Attributes != NULL) {
+        object->EvtCleanupCallback = Attributes->EvtCleanupCallback;
+        object->EvtDestroyCallback = Attributes->EvtDestroyCallback;
+
+        if (Attributes->ParentObject != NULL) {
+            parent = Attributes->ParentObject;
+        }
+
+        if (Attributes->ContextTypeInfo != NULL) {
+            size_t size = max(Attributes->ContextTypeInfo->ContextSize, Attributes->ContextSizeOverride);
+
+            object->ContextTypeInfo = Attributes->ContextTypeInfo;
+            object->Context = calloc(1, max(size, (size_t)1));
+            if (object->Context == NULL) {
+                free(object);
+                return NULL;
+            }
+        }
+    }
+
+    if (parent != NULL) {
+        pthread_mutex_lock(&ShimObjectLock);
+        object->Parent = parent;
+        object->Next = parent->FirstChild;
+        if (parent->FirstChild != NULL) {
+            parent->FirstChild->Prev = object;
+        }
+        parent->FirstChild = object;
+        pthread_mutex_unlock(&ShimObjectLock);
+    }
+
+    return object;
+}
+
+static VOID
+ShimTimerUnlink(
+    PSHIM_OBJECT Timer
+    )
+{
+    PSHIM_OBJECT *link;
+
+    pthread_mutex_lock(&ShimTimerLock);
+
+    for (link = &ShimTimers; *link != NULL; link = &(*link)->Timer.NextTimer) {
+        if (*link == Timer) {
+            *link = Timer->Timer.NextTimer;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&ShimTimerLock);
+
+    while (Timer->Timer.Running != 0) {
+        sched_yield();
+    }
+}
+
+static VOID
+ShimObjectFree(
+    PSHIM_OBJECT Object
+    )
+{
+    PSHIM_OBJECT request;
+
+    switch (Object->Type) {
+    case ShimObjectQueue:
+        //
+        // Requests still held are cancelled, like a purge of the queue.
+        //
+        while ((request = Object->Queue.Head) != NULL) {
+            Object->Queue.Head = request->Request.NextQueued;
+            request->Request.Queue = NULL;
+            request->Request.NextQueued = NULL;
+            WdfRequestComplete(request, STATUS_CANCELLED);
+        }
+        pthread_mutex_destroy(&Object->Queue.Lock);
+        break;
+    case ShimObjectRequest:
+        free(Object->Request.SystemBuffer);
+        break;
+    case ShimObjectCollection:
+        free(Object->Collection.Items);
+        break;
+    case ShimObjectWaitLock:
+        pthread_mutex_destroy(&Object->WaitLock.Mutex);
+        break;
+    case ShimObjectMemory:
+        free(Object->Memory.Buffer);
+        break;
+    default:
+        break;
+    }
+
+    free(Object->Context);
+    free(Object);
+}
+
+VOID
+WdfObjectDelete(
+    WDFOBJECT Object
+    )
+/*++
+Routine Description:
+
+    Runs the object's cleanup callback, deletes its children and frees it.
+
+--*/
+{
+    PSHIM_OBJECT    object = Object;
+    PSHIM_OBJECT    child;
+
+    if (InterlockedExchange(&object->Deleting, 1) != 0) {
+        return;
+    }
+
+    if (object->Type == ShimObjectTimer) {
+        ShimTimerUnlink(object);
+    }
+
+    if (object->EvtCleanupCallback != NULL) {
+        object->EvtCleanupCallback(object);
+    }
+
+    for (;;) {
+        pthread_mutex_lock(&ShimObjectLock);
+        child = object->FirstChild;
+        if (child != NULL) {
+            object->FirstChild = child->Next;
+            if (child->Next != NULL) {
+                child->Next->Prev = NULL;
+            }
+            child->Parent = NULL;
+        }
+        pthread_mutex_unlock(&ShimObjectLock);
+
+        if (child == NULL) {
+            break;
+        }
+
+        WdfObjectDelete(child);
+    }
+
+    pthread_mutex_lock(&ShimObjectLock);
+    if (object->Parent != NULL) {
+        if (object->Prev != NULL) {
+            object->Prev->Next = object->Next;
+        } else {
+            object->Parent->FirstChild = object->Next;
+        }
+        if (object->Next != NULL) {
+            object->Next->Prev = object->Prev;
+        }
+    }
+    if (object == ShimControlDevice) {
+        ShimControlDevice = NULL;
+    }
+    if (object == ShimDriver) {
+        ShimDriver = NULL;
+    }
+    pthread_mutex_unlock(&ShimObjectLock);
+
+    if (object->EvtDestroyCallback != NULL) {
+        object->EvtDestroyCallback(object);
+    }
+
+    ShimObjectFree(object);
+}
+
+PVOID
+WdfObjectGetTypedContextWorker(
+    WDFOBJECT                       Handle,
+    PCWDF_OBJECT_CONTEXT_TYPE_INFO  TypeInfo
+    )
+/*++
+Routine Description:
+
+    Every file has its own type info for a context type, so they are told
+    apart by name.
+
+--*/
+{
+    PSHIM_OBJECT object = Handle;
+
+    if (object->ContextTypeInfo == NULL) {
+        return NULL;
+    }
+
+    if (object->ContextTypeInfo != TypeInfo &&
+        strcmp(object->ContextTypeInfo->ContextName, TypeInfo->ContextName) != 0) {
+        return NULL;
+    }
+
+    return object->Context;
+}
+
+//
+// Driver
+//
+
+NTSTATUS
+WdfDriverCreate(
+    PDRIVER_OBJECT          DriverObject,
+    PCUNICODE_STRING        RegistryPath,
+    PWDF_OBJECT_ATTRIBUTES  DriverAttributes,
+    PWDF_DRIVER_CONFIG      DriverConfig,
+    WDFDRIVER *             Driver
+    )
+{
+    PSHIM_OBJECT driver;
+
+    UNREFERENCED_PARAMETER(DriverObject);
+    UNREFERENCED_PARAMETER(RegistryPath);
+
+    if (ShimDriver != NULL) {
+        return STATUS_INVALID_DEVICE_STATE;
+    }
+
+    driver = ShimObjectCreate(ShimObjectDriver, DriverAttributes, NULL);
+    if (driver == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    driver->Driver.Config = *DriverConfig;
+
+    ShimDriver = driver;
+
+    if (Driver != NULL) {
+        *Driver = driver;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+ShimLoadDriver(
+    DRIVER_INITIALIZE * DriverEntry
+    )
+{
+    static DRIVER_OBJECT    driverObject;
+    static WCHAR            registryPath[] = u"\\Registry\\Machine\\System\\CurrentControlSet\\Services\\SiriRemoteFilter";
+    static UNICODE_STRING   registryPathString = { sizeof(registryPath) - sizeof(WCHAR), sizeof(registryPath), registryPath };
+    NTSTATUS                status;
+
+    status = DriverEntry(&driverObject, &registryPathString);
+
+    if (!NT_SUCCESS(status) && ShimDriver != NULL) {
+        WdfObjectDelete(ShimDriver);
+    }
+
+    return status;
+}
+
+VOID
+ShimUnloadDriver(
+    VOID
+    )
+{
+    PSHIM_OBJECT driver = ShimDriver;
+
+    if (driver == NULL) {
+        return;
+    }
+
+    if (driver->Driver.Config.EvtDriverUnload != NULL) {
+        driver->Driver.Config.EvtDriverUnload(driver);
+    }
+
+    WdfObjectDelete(driver);
+}
+
+//
+// Devices
+//
+
+VOID
+WdfFdoInitSetFilter(
+    PWDFDEVICE_INIT DeviceInit
+    )
+{
+    UNREFERENCED_PARAMETER(DeviceInit);
+}
+
+NTSTATUS
+WdfFdoInitQueryProperty(
+    PWDFDEVICE_INIT             DeviceInit,
+    DEVICE_REGISTRY_PROPERTY    DeviceProperty,
+    ULONG                       BufferLength,
+    PVOID                       PropertyBuffer,
+    PULONG                      ResultLength
+    )
+/*++
+Routine Description:
+
+    Only knows the hardware IDs, a REG_MULTI_SZ of the one the program
+    gave.
+
+--*/
+{
+    PCSTR   hardwareId = DeviceInit->Config.HardwareId;
+    ULONG   length;
+    ULONG   i;
+
+    if (DeviceProperty != DevicePropertyHardwareID || hardwareId == NULL) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    length = (ULONG)(strlen(hardwareId) + 2) * sizeof(WCHAR);
+    *ResultLength = length;
+
+    if (BufferLength < length) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    for (i = 0; hardwareId[i] != '\0'; i++) {
+        ((PWCHAR)PropertyBuffer)[i] = (UCHAR)hardwareId[i];
+    }
+
+    ((PWCHAR)PropertyBuffer)[i] = 0;
+    ((PWCHAR)PropertyBuffer)[i + 1] = 0;
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+WdfDeviceInitSetRequestAttributes(
+    PWDFDEVICE_INIT         DeviceInit,
+    PWDF_OBJECT_ATTRIBUTES  RequestAttributes
+    )
+{
+    DeviceInit->HasRequestAttributes = TRUE;
+    DeviceInit->RequestAttributes = *RequestAttributes;
+}
+
+VOID
+WdfDeviceInitSetFileObjectConfig(
+    PWDFDEVICE_INIT         DeviceInit,
+    PWDF_FILEOBJECT_CONFIG  FileObjectConfig,
+    PWDF_OBJECT_ATTRIBUTES  FileObjectAttributes
+    )
+{
+    DeviceInit->HasFileObjectConfig = TRUE;
+    DeviceInit->FileObjectConfig = *FileObjectConfig;
+
+    if (FileObjectAttributes != NULL) {
+        DeviceInit->FileObjectAttributes = *FileObjectAttributes;
+    } else {
+        WDF_OBJECT_ATTRIBUTES_INIT(&DeviceInit->FileObjectAttributes);
+    }
+}
+
+VOID
+WdfDeviceInitSetExclusive(
+    PWDFDEVICE_INIT DeviceInit,
+    BOOLEAN         IsExclusive
+    )
+{
+    UNREFERENCED_PARAMETER(DeviceInit);
+    UNREFERENCED_PARAMETER(IsExclusive);
+}
+
+NTSTATUS
+WdfDeviceInitAssignName(
+    PWDFDEVICE_INIT     DeviceInit,
+    PCUNICODE_STRING    DeviceName
+    )
+{
+    UNREFERENCED_PARAMETER(DeviceInit);
+    UNREFERENCED_PARAMETER(DeviceName);
+
+    return STATUS_SUCCESS;
+}
+
+PWDFDEVICE_INIT
+WdfControlDeviceInitAllocate(
+    WDFDRIVER           Driver,
+    PCUNICODE_STRING    SDDLString
+    )
+{
+    PWDFDEVICE_INIT init;
+
+    UNREFERENCED_PARAMETER(SDDLString);
+
+    init = (PWDFDEVICE_INIT)calloc(1, sizeof(struct _WDFDEVICE_INIT));
+    if (init == NULL) {
+        return NULL;
+    }
+
+    init->Driver = Driver;
+    init->Control = TRUE;
+
+    return init;
+}
+
+VOID
+WdfDeviceInitFree(
+    PWDFDEVICE_INIT DeviceInit
+    )
+{
+    free(DeviceInit);
+}
+
+NTSTATUS
+WdfDeviceCreate(
+    PWDFDEVICE_INIT *       DeviceInit,
+    PWDF_OBJECT_ATTRIBUTES  DeviceAttributes,
+    WDFDEVICE *             Device
+    )
+/*++
+Routine Description:
+
+    Creates a filter device with its I/O target, or a control device. The
+    framework owns the init of a control device from here on, the one of
+    a filter device stays ShimAddDevice's.
+
+--*/
+{
+    PWDFDEVICE_INIT init = *DeviceInit;
+    PSHIM_OBJECT    device;
+    PSHIM_OBJECT    target;
+
+    device = ShimObjectCreate(ShimObjectDevice, DeviceAttributes, init->Driver);
+    if (device == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    device->Device.Control = init->Control;
+    device->Device.Ready = !init->Control;
+    device->Device.Config = init->Config;
+    device->Device.HasRequestAttributes = init->HasRequestAttributes;
+    device->Device.RequestAttributes = init->RequestAttributes;
+    device->Device.HasFileObjectConfig = init->HasFileObjectConfig;
+    device->Device.FileObjectConfig = init->FileObjectConfig;
+    device->Device.FileObjectAttributes = init->FileObjectAttributes;
+
+    if (!init->Control) {
+        target = ShimObjectCreate(ShimObjectIoTarget, WDF_NO_OBJECT_ATTRIBUTES, device);
+        if (target == NULL) {
+            WdfObjectDelete(device);
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        device->Device.IoTarget = target;
+        init->Device = device;
+    } else {
+        free(init);
+    }
+
+    *DeviceInit = NULL;
+    *Device = device;
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+WdfDeviceCreateSymbolicLink(
+    WDFDEVICE           Device,
+    PCUNICODE_STRING    SymbolicLinkName
+    )
+{
+    UNREFERENCED_PARAMETER(Device);
+    UNREFERENCED_PARAMETER(SymbolicLinkName);
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+WdfControlFinishInitializing(
+    WDFDEVICE Device
+    )
+{
+    pthread_mutex_lock(&ShimObjectLock);
+    Device->Device.Ready = TRUE;
+    if (ShimControlDevice == NULL) {
+        ShimControlDevice = Device;
+    }
+    pthread_mutex_unlock(&ShimObjectLock);
+}
+
+WDFDRIVER
+WdfDeviceGetDriver(
+    WDFDEVICE Device
+    )
+{
+    UNREFERENCED_PARAMETER(Device);
+
+    return ShimDriver;
+}
+
+WDFIOTARGET
+WdfDeviceGetIoTarget(
+    WDFDEVICE Device
+    )
+{
+    return Device->Device.IoTarget;
+}
+
+WDFDEVICE
+WdfFileObjectGetDevice(
+    WDFFILEOBJECT FileObject
+    )
+{
+    return FileObject->Parent;
+}
+
+NTSTATUS
+ShimAddDevice(
+    PSHIM_DEVICE_CONFIG Config,
+    WDFDEVICE *         Device
+    )
+/*++
+Routine Description:
+
+    Plays PnP adding the filter above an adapter. A device the driver
+    created before failing is deleted again.
+
+--*/
+{
+    struct _WDFDEVICE_INIT  init;
+    NTSTATUS                status;
+
+    if (ShimDriver == NULL || ShimDriver->Driver.Config.EvtDriverDeviceAdd == NULL) {
+        return STATUS_INVALID_DEVICE_STATE;
+    }
+
+    RtlZeroMemory(&init, sizeof(init));
+    init.Driver = ShimDriver;
+    init.Config = *Config;
+
+    status = ShimDriver->Driver.Config.EvtDriverDeviceAdd(ShimDriver, &init);
+
+    if (!NT_SUCCESS(status)) {
+        if (init.Device != NULL) {
+            WdfObjectDelete(init.Device);
+        }
+        return status;
+    }
+
+    if (init.Device == NULL) {
+        return STATUS_UNSUCCESSFUL;
+    }
+
+    *Device = init.Device;
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+ShimRemoveDevice(
+    WDFDEVICE Device
+    )
+{
+    WdfObjectDelete(Device);
+}
+
+//
+// Queues
+//
+
+NTSTATUS
+WdfIoQueueCreate(
+    WDFDEVICE               Device,
+    PWDF_IO_QUEUE_CONFIG    Config,
+    PWDF_OBJECT_ATTRIBUTES  QueueAttributes,
+    WDFQUEUE *              Queue
+    )
+{
+    PSHIM_OBJECT queue;
+
+    queue = ShimObjectCreate(ShimObjectQueue, QueueAttributes, Device);
+    if (queue == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    queue->Queue.Config = *Config;
+    pthread_mutex_init(&queue->Queue.Lock, NULL);
+
+    if (Config->DefaultQueue) {
+        Device->Device.DefaultQueue = queue;
+    }
+
+    if (Queue != NULL) {
+        *Queue = queue;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+WDFDEVICE
+WdfIoQueueGetDevice(
+    WDFQUEUE Queue
+    )
+{
+    return Queue->Parent;
+}
+
+NTSTATUS
+WdfRequestForwardToIoQueue(
+    WDFREQUEST  Request,
+    WDFQUEUE    DestinationQueue
+    )
+{
+    if (DestinationQueue->Queue.Config.DispatchType != WdfIoQueueDispatchManual ||
+        Request->Request.Origin == ShimRequestCreated ||
+        Request->Request.Queue != NULL) {
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+
+    pthread_mutex_lock(&DestinationQueue->Queue.Lock);
+
+    Request->Request.Queue = DestinationQueue;
+    Request->Request.NextQueued = NULL;
+
+    if (DestinationQueue->Queue.Tail != NULL) {
+        DestinationQueue->Queue.Tail->Request.NextQueued = Request;
+    } else {
+        DestinationQueue->Queue.Head = Request;
+    }
+    DestinationQueue->Queue.Tail = Request;
+
+    pthread_mutex_unlock(&DestinationQueue->Queue.Lock);
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+WdfIoQueueFindRequest(
+    WDFQUEUE        Queue,
+    WDFREQUEST      FoundRequest,
+    WDFFILEOBJECT   FileObject,
+    PVOID           Parameters,
+    WDFREQUEST *    OutRequest
+    )
+/*++
+Routine Description:
+
+    Returns the request after FoundRequest, the oldest one for NULL, that
+    came from FileObject unless that is NULL.
+
+--*/
+{
+    PSHIM_OBJECT    request;
+    NTSTATUS        status = STATUS_NO_MORE_ENTRIES;
+
+    if (Parameters != NULL) {
+        return STATUS_NOT_IMPLEMENTED;
+    }
+
+    *OutRequest = NULL;
+
+    pthread_mutex_lock(&Queue->Queue.Lock);
+
+    if (FoundRequest == NULL) {
+        request = Queue->Queue.Head;
+    } else if (FoundRequest->Request.Queue == Queue) {
+        request = FoundRequest->Request.NextQueued;
+    } else {
+        request = NULL;
+        status = STATUS_NOT_FOUND;
+    }
+
+    for (; request != NULL; request = request->Request.NextQueued) {
+        if (FileObject == NULL || request->Request.FileObject == FileObject) {
+            *OutRequest = request;
+            status = STATUS_SUCCESS;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&Queue->Queue.Lock);
+
+    return status;
+}
+
+NTSTATUS
+WdfIoQueueRetrieveFoundRequest(
+    WDFQUEUE        Queue,
+    WDFREQUEST      FoundRequest,
+    WDFREQUEST *    OutRequest
+    )
+{
+    PSHIM_OBJECT *  link;
+    PSHIM_OBJECT    previous = NULL;
+    NTSTATUS        status = STATUS_NOT_FOUND;
+
+    *OutRequest = NULL;
+
+    pthread_mutex_lock(&Queue->Queue.Lock);
+
+    for (link = &Queue->Queue.Head; *link != NULL; link = &(*link)->Request.NextQueued) {
+        if (*link == FoundRequest) {
+            *link = FoundRequest->Request.NextQueued;
+            if (Queue->Queue.Tail == FoundRequest) {
+                Queue->Queue.Tail = previous;
+            }
+            FoundRequest->Request.Queue = NULL;
+            FoundRequest->Request.NextQueued = NULL;
+            *OutRequest = FoundRequest;
+            status = STATUS_SUCCESS;
+            break;
+        }
+        previous = *link;
+    }
+
+    pthread_mutex_unlock(&Queue->Queue.Lock);
+
+    return status;
+}
+
+//
+// Requests
+//
+
+static PSHIM_OBJECT
+ShimRequestAllocate(
+    PSHIM_OBJECT            Device,
+    SHIM_REQUEST_ORIGIN     Origin
+    )
+{
+    PSHIM_OBJECT request;
+
+    request = ShimObjectCreate(ShimObjectRequest,
+                               Device->Device.HasRequestAttributes ? &Device->Device.RequestAttributes : NULL,
+                               NULL);
+    if (request == NULL) {
+        return NULL;
+    }
+
+    //
+    // Requests coming from above are nobody's children.
+    //
+    request->EvtCleanupCallback = NULL;
+    request->EvtDestroyCallback = NULL;
+
+    request->Request.Origin = Origin;
+    request->Request.Device = Device;
+    request->Request.Status = STATUS_PENDING;
+
+    return request;
+}
+
+static VOID
+ShimDispatch(
+    PSHIM_OBJECT Request
+    )
+/*++
+Routine Description:
+
+    Presents a request to the default queue of its device.
+
+--*/
+{
+    PSHIM_OBJECT        queue = Request->Request.Device->Device.DefaultQueue;
+    PIO_STACK_LOCATION  stack = &Request->Request.Irp.Stack;
+    BOOLEAN             sequential;
+
+    if (queue == NULL) {
+        WdfRequestComplete(Request, STATUS_INVALID_DEVICE_REQUEST);
+        return;
+    }
+
+    sequential = queue->Queue.Config.DispatchType == WdfIoQueueDispatchSequential;
+
+    if (sequential) {
+        pthread_mutex_lock(&queue->Queue.Lock);
+    }
+
+    if (stack->MajorFunction == IRP_MJ_INTERNAL_DEVICE_CONTROL &&
+        queue->Queue.Config.EvtIoInternalDeviceControl != NULL) {
+        queue->Queue.Config.EvtIoInternalDeviceControl(queue,
+                                                       Request,
+                                                       stack->Parameters.DeviceIoControl.OutputBufferLength,
+                                                       stack->Parameters.DeviceIoControl.InputBufferLength,
+                                                       stack->Parameters.DeviceIoControl.IoControlCode);
+    } else if (stack->MajorFunction == IRP_MJ_DEVICE_CONTROL &&
+               queue->Queue.Config.EvtIoDeviceControl != NULL) {
+        queue->Queue.Config.EvtIoDeviceControl(queue,
+                                               Request,
+                                               stack->Parameters.DeviceIoControl.OutputBufferLength,
+                                               stack->Parameters.DeviceIoControl.InputBufferLength,
+                                               stack->Parameters.DeviceIoControl.IoControlCode);
+    } else {
+        WdfRequestComplete(Request, STATUS_INVALID_DEVICE_REQUEST);
+    }
+
+    if (sequential) {
+        pthread_mutex_unlock(&queue->Queue.Lock);
+    }
+}
+
+static NTSTATUS
+ShimWaitForCompletion(
+    PSHIM_OBJECT Request
+    )
+{
+    pthread_mutex_lock(&ShimCompletionLock);
+    while (!Request->Request.Completed) {
+        pthread_cond_wait(&ShimCompletionEvent, &ShimCompletionLock);
+    }
+    pthread_mutex_unlock(&ShimCompletionLock);
+
+    return Request->Request.Status;
+}
+
+NTSTATUS
+ShimSubmitUrb(
+    WDFDEVICE   Device,
+    PURB        Urb
+    )
+{
+    PSHIM_OBJECT        request;
+    PIO_STACK_LOCATION  stack;
+
+    request = ShimRequestAllocate(Device, ShimRequestUrb);
+    if (request == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    stack = &request->Request.Irp.Stack;
+    stack->MajorFunction = IRP_MJ_INTERNAL_DEVICE_CONTROL;
+    stack->Parameters.Others.Argument1 = Urb;
+    stack->Parameters.DeviceIoControl.IoControlCode = IOCTL_INTERNAL_USB_SUBMIT_URB;
+
+    ShimDispatch(request);
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+WdfRequestCreate(
+    PWDF_OBJECT_ATTRIBUTES  RequestAttributes,
+    WDFIOTARGET             IoTarget,
+    WDFREQUEST *            Request
+    )
+{
+    PSHIM_OBJECT request;
+
+    UNREFERENCED_PARAMETER(IoTarget);
+
+    request = ShimObjectCreate(ShimObjectRequest, RequestAttributes, ShimDriver);
+    if (request == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    request->Request.Origin = ShimRequestCreated;
+    request->Request.Status = STATUS_SUCCESS;
+
+    *Request = request;
+
+    return STATUS_SUCCESS;
+}
+
+PIRP
+WdfRequestWdmGetIrp(
+    WDFREQUEST Request
+    )
+{
+    return &Request->Request.Irp;
+}
+
+WDFFILEOBJECT
+WdfRequestGetFileObject(
+    WDFREQUEST Request
+    )
+{
+    return Request->Request.FileObject;
+}
+
+static NTSTATUS
+ShimRequestRetrieveBuffer(
+    WDFREQUEST  Request,
+    size_t      BufferLength,
+    size_t      MinimumRequiredSize,
+    PVOID *     Buffer,
+    size_t *    Length
+    )
+{
+    if (Request->Request.Irp.Stack.MajorFunction != IRP_MJ_DEVICE_CONTROL) {
+        return STATUS_INVALID_DEVICE_REQUEST;
+    }
+
+    if (BufferLength == 0 || BufferLength < MinimumRequiredSize) {
+        return STATUS_BUFFER_TOO_SMALL;
+    }
+
+    *Buffer = Request->Request.SystemBuffer;
+
+    if (Length != NULL) {
+        *Length = BufferLength;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+WdfRequestRetrieveInputBuffer(
+    WDFREQUEST  Request,
+    size_t      MinimumRequiredSize,
+    PVOID *     Buffer,
+    size_t *    Length
+    )
+{
+    return ShimRequestRetrieveBuffer(Request,
+                                     Request->Request.Irp.Stack.Parameters.DeviceIoControl.InputBufferLength,
+                                     MinimumRequiredSize,
+                                     Buffer,
+                                     Length);
+}
+
+NTSTATUS
+WdfRequestRetrieveOutputBuffer(
+    WDFREQUEST  Request,
+    size_t      MinimumRequiredSize,
+    PVOID *     Buffer,
+    size_t *    Length
+    )
+{
+    return ShimRequestRetrieveBuffer(Request,
+                                     Request->Request.Irp.Stack.Parameters.DeviceIoControl.OutputBufferLength,
+                                     MinimumRequiredSize,
+                                     Buffer,
+                                     Length);
+}
+
+VOID
+WdfRequestFormatRequestUsingCurrentType(
+    WDFREQUEST Request
+    )
+{
+    //
+    // The filter and the lower share the one stack location.
+    //
+    UNREFERENCED_PARAMETER(Request);
+}
+
+VOID
+WdfRequestSetCompletionRoutine(
+    WDFREQUEST                          Request,
+    PFN_WDF_REQUEST_COMPLETION_ROUTINE  CompletionRoutine,
+    WDFCONTEXT                          CompletionContext
+    )
+{
+    Request->Request.CompletionRoutine = CompletionRoutine;
+    Request->Request.CompletionContext = CompletionContext;
+}
+
+BOOLEAN
+WdfRequestSend(
+    WDFREQUEST                  Request,
+    WDFIOTARGET                 Target,
+    PWDF_REQUEST_SEND_OPTIONS   Options
+    )
+/*++
+Routine Description:
+
+    Hands the request to the lower of the target's device. Once the lower
+    took it, the request may already be completed and freed.
+
+--*/
+{
+    PSHIM_OBJECT        device = Target->Parent;
+    PIO_STACK_LOCATION  stack = &Request->Request.Irp.Stack;
+    PURB                urb = NULL;
+
+    Request->Request.Target = Target;
+    Request->Request.SendAndForget =
+        Options != NULL && (Options->Flags & WDF_REQUEST_SEND_OPTION_SEND_AND_FORGET) != 0;
+    Request->Request.Status = STATUS_PENDING;
+
+    if (stack->MajorFunction == IRP_MJ_INTERNAL_DEVICE_CONTROL &&
+        stack->Parameters.DeviceIoControl.IoControlCode == IOCTL_INTERNAL_USB_SUBMIT_URB) {
+        urb = (PURB)stack->Parameters.Others.Argument1;
+    }
+
+    if (device->Device.Config.LowerSend == NULL ||
+        !device->Device.Config.LowerSend(device->Device.Config.Context, Request, urb)) {
+        Request->Request.Status = STATUS_NO_SUCH_DEVICE;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+VOID
+ShimCompleteLowerRequest(
+    WDFREQUEST  Request,
+    NTSTATUS    Status
+    )
+/*++
+Routine Description:
+
+    The lower is done with a request. It goes to the completion routine
+    the filter set, or straight back up when the filter forgot about it.
+
+--*/
+{
+    WDF_REQUEST_COMPLETION_PARAMS   params;
+    PIRP                            irp = &Request->Request.Irp;
+
+    irp->IoStatus.Status = Status;
+    Request->Request.Status = Status;
+
+    if (Request->Request.SendAndForget || Request->Request.CompletionRoutine == NULL) {
+        WdfRequestComplete(Request, Status);
+        return;
+    }
+
+    RtlZeroMemory(&params, sizeof(params));
+    params.Size = sizeof(params);
+    params.Type = (WDF_REQUEST_TYPE)irp->Stack.MajorFunction;
+    params.IoStatus = irp->IoStatus;
+
+    Request->Request.CompletionRoutine(Request,
+                                       Request->Request.Target,
+                                       &params,
+                                       Request->Request.CompletionContext);
+}
+
+NTSTATUS
+WdfRequestGetStatus(
+    WDFREQUEST Request
+    )
+{
+    return Request->Request.Status;
+}
+
+VOID
+WdfRequestCompleteWithInformation(
+    WDFREQUEST  Request,
+    NTSTATUS    Status,
+    ULONG_PTR   Information
+    )
+/*++
+Routine Description:
+
+    Completes a request that came from above. A URB goes back to the
+    device's SHIM_UPPER_COMPLETE and its request is freed, the program
+    frees the requests it waits for.
+
+--*/
+{
+    SHIM_DEVICE_CONFIG  config;
+    PURB                urb;
+
+    Request->Request.Irp.IoStatus.Status = Status;
+    Request->Request.Irp.IoStatus.Information = Information;
+    Request->Request.Status = Status;
+
+    switch (Request->Request.Origin) {
+    case ShimRequestUrb:
+        config = Request->Request.Device->Device.Config;
+        urb = (PURB)Request->Request.Irp.Stack.Parameters.Others.Argument1;
+
+        ShimObjectFree(Request);
+
+        if (config.UpperComplete != NULL) {
+            config.UpperComplete(config.Context, urb, Status);
+        }
+        break;
+
+    case ShimRequestControl:
+        pthread_mutex_lock(&ShimCompletionLock);
+        Request->Request.Completed = TRUE;
+        pthread_cond_broadcast(&ShimCompletionEvent);
+        pthread_mutex_unlock(&ShimCompletionLock);
+        break;
+
+    default:
+        break;
+    }
+}
+
+VOID
+WdfRequestComplete(
+    WDFREQUEST  Request,
+    NTSTATUS    Status
+    )
+{
+    WdfRequestCompleteWithInformation(Request, Status, 0);
+}
+
+//
+// I/O targets and memory
+//
+
+NTSTATUS
+WdfMemoryCreate(
+    PWDF_OBJECT_ATTRIBUTES  Attributes,
+    POOL_TYPE               PoolType,
+    ULONG                   PoolTag,
+    size_t                  BufferSize,
+    WDFMEMORY *             Memory,
+    PVOID *                 Buffer
+    )
+{
+    PSHIM_OBJECT memory;
+
+    UNREFERENCED_PARAMETER(PoolType);
+    UNREFERENCED_PARAMETER(PoolTag);
+
+    memory = ShimObjectCreate(ShimObjectMemory, Attributes, ShimDriver);
+    if (memory == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    memory->Memory.Buffer = malloc(max(BufferSize, (size_t)1));
+    if (memory->Memory.Buffer == NULL) {
+        WdfObjectDelete(memory);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    memory->Memory.Size = BufferSize;
+
+    *Memory = memory;
+
+    if (Buffer != NULL) {
+        *Buffer = memory->Memory.Buffer;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+static PVOID
+ShimMemoryArgument(
+    WDFMEMORY           Memory,
+    PWDFMEMORY_OFFSET   Offset
+    )
+{
+    if (Memory == NULL) {
+        return NULL;
+    }
+
+    return (PUCHAR)Memory->Memory.Buffer + (Offset != NULL ? Offset->BufferOffset : 0);
+}
+
+NTSTATUS
+WdfIoTargetFormatRequestForInternalIoctlOthers(
+    WDFIOTARGET         IoTarget,
+    WDFREQUEST          Request,
+    ULONG               IoctlCode,
+    WDFMEMORY           OtherArg1,
+    PWDFMEMORY_OFFSET   OtherArg1Offset,
+    WDFMEMORY           OtherArg2,
+    PWDFMEMORY_OFFSET   OtherArg2Offset,
+    WDFMEMORY           OtherArg4,
+    PWDFMEMORY_OFFSET   OtherArg4Offset
+    )
+{
+    PIO_STACK_LOCATION stack = &Request->Request.Irp.Stack;
+
+    UNREFERENCED_PARAMETER(IoTarget);
+
+    RtlZeroMemory(stack, sizeof(IO_STACK_LOCATION));
+    stack->MajorFunction = IRP_MJ_INTERNAL_DEVICE_CONTROL;
+    stack->Parameters.Others.Argument1 = ShimMemoryArgument(OtherArg1, OtherArg1Offset);
+    stack->Parameters.Others.Argument2 = ShimMemoryArgument(OtherArg2, OtherArg2Offset);
+    stack->Parameters.Others.Argument4 = ShimMemoryArgument(OtherArg4, OtherArg4Offset);
+
+    //
+    // Argument3 is where the control code goes, like in the kernel.
+    //
+    stack->Parameters.DeviceIoControl.IoControlCode = IoctlCode;
+
+    return STATUS_SUCCESS;
+}
+
+WDFDEVICE
+WdfIoTargetGetDevice(
+    WDFIOTARGET IoTarget
+    )
+{
+    return IoTarget->Parent;
+}
+
+//
+// Control device handles
+//
+
+NTSTATUS
+ShimOpenControl(
+    SHIM_HANDLE * Handle
+    )
+/*++
+Routine Description:
+
+    Opens a handle on the control device, through the filter's file
+    create callback.
+
+--*/
+{
+    PSHIM_OBJECT    device;
+    PSHIM_OBJECT    fileObject;
+    PSHIM_OBJECT    request;
+    NTSTATUS        status;
+
+    pthread_mutex_lock(&ShimObjectLock);
+    device = ShimControlDevice;
+    pthread_mutex_unlock(&ShimObjectLock);
+
+    if (device == NULL || !device->Device.Ready) {
+        return STATUS_NO_SUCH_DEVICE;
+    }
+
+    fileObject = ShimObjectCreate(ShimObjectFileObject,
+                                  device->Device.HasFileObjectConfig ? &device->Device.FileObjectAttributes : NULL,
+                                  device);
+    if (fileObject == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    if (!device->Device.HasFileObjectConfig ||
+        device->Device.FileObjectConfig.EvtDeviceFileCreate == NULL) {
+        *Handle = fileObject;
+        return STATUS_SUCCESS;
+    }
+
+    request = ShimRequestAllocate(device, ShimRequestControl);
+    if (request == NULL) {
+        WdfObjectDelete(fileObject);
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    request->Request.FileObject = fileObject;
+
+    device->Device.FileObjectConfig.EvtDeviceFileCreate(device, request, fileObject);
+
+    status = ShimWaitForCompletion(request);
+    ShimObjectFree(request);
+
+    if (!NT_SUCCESS(status)) {
+        WdfObjectDelete(fileObject);
+        return status;
+    }
+
+    *Handle = fileObject;
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+ShimCloseControl(
+    SHIM_HANDLE Handle
+    )
+{
+    PSHIM_OBJECT device = Handle->Parent;
+
+    if (device != NULL && device->Device.HasFileObjectConfig) {
+        if (device->Device.FileObjectConfig.EvtFileCleanup != NULL) {
+            device->Device.FileObjectConfig.EvtFileCleanup(Handle);
+        }
+        if (device->Device.FileObjectConfig.EvtFileClose != NULL) {
+            device->Device.FileObjectConfig.EvtFileClose(Handle);
+        }
+    }
+
+    WdfObjectDelete(Handle);
+}
+
+NTSTATUS
+ShimDeviceIoControl(
+    SHIM_HANDLE Handle,
+    ULONG       IoControlCode,
+    PVOID       Input,
+    ULONG       InputLength,
+    PVOID       Output,
+    ULONG       OutputLength,
+    PULONG      BytesReturned
+    )
+/*++
+Routine Description:
+
+    Sends a buffered I/O control to the control device and waits for it.
+    Input and output share the system buffer like in the kernel.
+
+--*/
+{
+    PSHIM_OBJECT        device = Handle->Parent;
+    PSHIM_OBJECT        request;
+    PIO_STACK_LOCATION  stack;
+    ULONG               length = max(InputLength, OutputLength);
+    ULONG               returned = 0;
+    NTSTATUS            status;
+
+    if (device == NULL || !device->Device.Ready) {
+        return STATUS_INVALID_DEVICE_STATE;
+    }
+
+    request = ShimRequestAllocate(device, ShimRequestControl);
+    if (request == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    if (length != 0) {
+        request->Request.SystemBuffer = calloc(1, length);
+        if (request->Request.SystemBuffer == NULL) {
+            ShimObjectFree(request);
+            return STATUS_INSUFFICIENT_RESOURCES;
+        }
+
+        if (InputLength != 0) {
+            RtlCopyMemory(request->Request.SystemBuffer, Input, InputLength);
+        }
+    }
+
+    request->Request.FileObject = Handle;
+
+    stack = &request->Request.Irp.Stack;
+    stack->MajorFunction = IRP_MJ_DEVICE_CONTROL;
+    stack->Parameters.DeviceIoControl.OutputBufferLength = OutputLength;
+    stack->Parameters.DeviceIoControl.InputBufferLength = InputLength;
+    stack->Parameters.DeviceIoControl.IoControlCode = IoControlCode;
+
+    ShimDispatch(request);
+
+    status = ShimWaitForCompletion(request);
+
+    if (NT_SUCCESS(status)) {
+        returned = (ULONG)min(request->Request.Irp.IoStatus.Information, (ULONG_PTR)OutputLength);
+        if (returned != 0) {
+            RtlCopyMemory(Output, request->Request.SystemBuffer, returned);
+        }
+    }
+
+    if (BytesReturned != NULL) {
+        *BytesReturned = returned;
+    }
+
+    ShimObjectFree(request);
+
+    return status;
+}
+
+//
+// Collections and wait locks
+//
+
+NTSTATUS
+WdfCollectionCreate(
+    PWDF_OBJECT_ATTRIBUTES  CollectionAttributes,
+    WDFCOLLECTION *         Collection
+    )
+{
+    PSHIM_OBJECT collection;
+
+    collection = ShimObjectCreate(ShimObjectCollection, CollectionAttributes, ShimDriver);
+    if (collection == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    *Collection = collection;
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+WdfCollectionAdd(
+    WDFCOLLECTION   Collection,
+    WDFOBJECT       Object
+    )
+{
+    NTSTATUS status = STATUS_SUCCESS;
+
+    pthread_mutex_lock(&ShimObjectLock);
+
+    if (Collection->Collection.Count == Collection->Collection.Allocated) {
+        ULONG           allocated = max(Collection->Collection.Allocated * 2, (ULONG)8);
+        PSHIM_OBJECT *  items;
+
+        items = (PSHIM_OBJECT *)realloc(Collection->Collection.Items, allocated * sizeof(PSHIM_OBJECT));
+        if (items == NULL) {
+            status = STATUS_INSUFFICIENT_RESOURCES;
+        } else {
+            Collection->Collection.Items = items;
+            Collection->Collection.Allocated = allocated;
+        }
+    }
+
+    if (NT_SUCCESS(status)) {
+        Collection->Collection.Items[Collection->Collection.Count++] = Object;
+    }
+
+    pthread_mutex_unlock(&ShimObjectLock);
+
+    return status;
+}
+
+VOID
+WdfCollectionRemove(
+    WDFCOLLECTION   Collection,
+    WDFOBJECT       Item
+    )
+{
+    ULONG i;
+
+    pthread_mutex_lock(&ShimObjectLock);
+
+    for (i = 0; i < Collection->Collection.Count; i++) {
+        if (Collection->Collection.Items[i] == Item) {
+            memmove(&Collection->Collection.Items[i],
+                    &Collection->Collection.Items[i + 1],
+                    (Collection->Collection.Count - i - 1) * sizeof(PSHIM_OBJECT));
+            Collection->Collection.Count--;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&ShimObjectLock);
+}
+
+ULONG
+WdfCollectionGetCount(
+    WDFCOLLECTION Collection
+    )
+{
+    ULONG count;
+
+    pthread_mutex_lock(&ShimObjectLock);
+    count = Collection->Collection.Count;
+    pthread_mutex_unlock(&ShimObjectLock);
+
+    return count;
+}
+
+WDFOBJECT
+WdfCollectionGetItem(
+    WDFCOLLECTION   Collection,
+    ULONG           Index
+    )
+{
+    WDFOBJECT item = NULL;
+
+    pthread_mutex_lock(&ShimObjectLock);
+    if (Index < Collection->Collection.Count) {
+        item = Collection->Collection.Items[Index];
+    }
+    pthread_mutex_unlock(&ShimObjectLock);
+
+    return item;
+}
+
+NTSTATUS
+WdfWaitLockCreate(
+    PWDF_OBJECT_ATTRIBUTES  LockAttributes,
+    WDFWAITLOCK *           Lock
+    )
+{
+    PSHIM_OBJECT lock;
+
+    lock = ShimObjectCreate(ShimObjectWaitLock, LockAttributes, ShimDriver);
+    if (lock == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    pthread_mutex_init(&lock->WaitLock.Mutex, NULL);
+
+    *Lock = lock;
+
+    return STATUS_SUCCESS;
+}
+
+NTSTATUS
+WdfWaitLockAcquire(
+    WDFWAITLOCK Lock,
+    PLONGLONG   Timeout
+    )
+{
+    //
+    // Only no timeout and a zero one, a try, are told apart.
+    //
+    if (Timeout != NULL && *Timeout == 0) {
+        return pthread_mutex_trylock(&Lock->WaitLock.Mutex) == 0 ? STATUS_SUCCESS : STATUS_TIMEOUT;
+    }
+
+    pthread_mutex_lock(&Lock->WaitLock.Mutex);
+
+    return STATUS_SUCCESS;
+}
+
+VOID
+WdfWaitLockRelease(
+    WDFWAITLOCK Lock
+    )
+{
+    pthread_mutex_unlock(&Lock->WaitLock.Mutex);
+}
+
+//
+// Timers
+//
+
+NTSTATUS
+WdfTimerCreate(
+    PWDF_TIMER_CONFIG       Config,
+    PWDF_OBJECT_ATTRIBUTES  Attributes,
+    WDFTIMER *              Timer
+    )
+{
+    PSHIM_OBJECT timer;
+
+    if (Attributes == NULL || Attributes->ParentObject == NULL) {
+        return STATUS_INVALID_PARAMETER;
+    }
+
+    timer = ShimObjectCreate(ShimObjectTimer, Attributes, NULL);
+    if (timer == NULL) {
+        return STATUS_INSUFFICIENT_RESOURCES;
+    }
+
+    timer->Timer.Config = *Config;
+
+    pthread_mutex_lock(&ShimTimerLock);
+    timer->Timer.NextTimer = ShimTimers;
+    ShimTimers = timer;
+    pthread_mutex_unlock(&ShimTimerLock);
+
+    *Timer = timer;
+
+    return STATUS_SUCCESS;
+}
+
+BOOLEAN
+WdfTimerStart(
+    WDFTIMER    Timer,
+    LONGLONG    DueTime
+    )
+/*++
+Routine Description:
+
+    A negative due time is relative, in 100ns units, a positive one an
+    interrupt time.
+
+--*/
+{
+    ULONGLONG   now = KeQueryInterruptTime();
+    BOOLEAN     started;
+
+    pthread_mutex_lock(&ShimTimerLock);
+    started = Timer->Timer.Started;
+    Timer->Timer.Started = TRUE;
+    Timer->Timer.Due = DueTime < 0 ? now + (ULONGLONG)-DueTime : (ULONGLONG)DueTime;
+    pthread_mutex_unlock(&ShimTimerLock);
+
+    return started;
+}
+
+BOOLEAN
+WdfTimerStop(
+    WDFTIMER    Timer,
+    BOOLEAN     Wait
+    )
+{
+    BOOLEAN started;
+
+    pthread_mutex_lock(&ShimTimerLock);
+    started = Timer->Timer.Started;
+    Timer->Timer.Started = FALSE;
+    pthread_mutex_unlock(&ShimTimerLock);
+
+    //
+    // A callback stopping its own timer mustn't wait for itself.
+    //
+    if (Wait && KeGetCurrentIrql() == PASSIVE_LEVEL) {
+        while (Timer->Timer.Running != 0) {
+            sched_yield();
+        }
+    }
+
+    return started;
+}
+
+WDFOBJECT
+WdfTimerGetParentObject(
+    WDFTIMER Timer
+    )
+{
+    return Timer->Parent;
+}
+
+ULONG
+ShimRunTimers(
+    VOID
+    )
+/*++
+Routine Description:
+
+    Runs every timer that is due, at dispatch level like a DPC. A timer
+    the callback starts again only runs in the next call.
+
+--*/
+{
+    ULONGLONG       now = KeQueryInterruptTime();
+    PSHIM_OBJECT    timer;
+    ULONG           pass;
+    ULONG           ran = 0;
+    KIRQL           irql;
+
+    pthread_mutex_lock(&ShimTimerLock);
+    pass = ++ShimTimerPass;
+    pthread_mutex_unlock(&ShimTimerLock);
+
+    for (;;) {
+        pthread_mutex_lock(&ShimTimerLock);
+
+        for (timer = ShimTimers; timer != NULL; timer = timer->Timer.NextTimer) {
+            if (timer->Timer.Started && timer->Timer.Due <= now && timer->Timer.Pass != pass) {
+                break;
+            }
+        }
+
+        if (timer != NULL) {
+            timer->Timer.Pass = pass;
+
+            if (timer->Timer.Config.Period != 0) {
+                timer->Timer.Due = now + (ULONGLONG)timer->Timer.Config.Period * 10000;
+            } else {
+                timer->Timer.Started = FALSE;
+            }
+
+            InterlockedIncrement(&timer->Timer.Running);
+        }
+
+        pthread_mutex_unlock(&ShimTimerLock);
+
+        if (timer == NULL) {
+            break;
+        }
+
+        irql = ShimIrql;
+        ShimIrql = DISPATCH_LEVEL;
+        timer->Timer.Config.EvtTimerFunc(timer);
+        ShimIrql = irql;
+
+        InterlockedDecrement(&timer->Timer.Running);
+        ran++;
+    }
+
+    return ran;
+}
+
+ULONGLONG
+ShimNextTimerDue(
+    VOID
+    )
+{
+    PSHIM_OBJECT    timer;
+    ULONGLONG       due = 0;
+
+    pthread_mutex_lock(&ShimTimerLock);
+
+    for (timer = ShimTimers; timer != NULL; timer = timer->Timer.NextTimer) {
+        if (timer->Timer.Started && (due == 0 || timer->Timer.Due < due)) {
+            due = timer->Timer.Due;
+        }
+    }
+
+    pthread_mutex_unlock(&ShimTimerLock);
+
+    return due;
+}
+
+//
+// Kernel
+//
+
+KIRQL
+KeGetCurrentIrql(
+    VOID
+    )
+{
+    return ShimIrql;
+}
+
+VOID
+KeInitializeSpinLock(
+    PKSPIN_LOCK SpinLock
+    )
+{
+    __atomic_store_n(SpinLock, 0, __ATOMIC_RELEASE);
+}
+
+VOID
+KeAcquireSpinLock(
+    PKSPIN_LOCK SpinLock,
+    PKIRQL      OldIrql
+    )
+{
+    *OldIrql = ShimIrql;
+    ShimIrql = DISPATCH_LEVEL;
+
+    while (__atomic_exchange_n(SpinLock, 1, __ATOMIC_ACQUIRE) != 0) {
+        while (__atomic_load_n(SpinLock, __ATOMIC_RELAXED) != 0) {
+            ShimCpuRelax();
+        }
+    }
+}
+
+VOID
+KeReleaseSpinLock(
+    PKSPIN_LOCK SpinLock,
+    KIRQL       NewIrql
+    )
+{
+    __atomic_store_n(SpinLock, 0, __ATOMIC_RELEASE);
+
+    ShimIrql = NewIrql;
+}
+
+ULONGLONG
+KeQueryInterruptTime(
+    VOID
+    )
+{
+    ULONGLONG       pinned = ShimPinnedTime;
+    struct timespec now;
+
+    if (pinned != 0) {
+        return pinned;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (ULONGLONG)now.tv_sec * 10000000 + (ULONGLONG)now.tv_nsec / 100;
+}
+
+LARGE_INTEGER
+KeQueryPerformanceCounter(
+    PLARGE_INTEGER  PerformanceFrequency
+    )
+{
+    LARGE_INTEGER   counter;
+    struct timespec now;
+
+    if (PerformanceFrequency != NULL) {
+        PerformanceFrequency->QuadPart = 1000000000;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    counter.QuadPart = (LONGLONG)now.tv_sec * 1000000000 + now.tv_nsec;
+
+    return counter;
+}
+
+VOID
+ShimSetInterruptTime(
+    ULONGLONG Time
+    )
+{
+    ShimPinnedTime = Time;
+}
+
+NTSTATUS
+KeDelayExecutionThread(
+    KPROCESSOR_MODE WaitMode,
+    BOOLEAN         Alertable,
+    PLARGE_INTEGER  Interval
+    )
+{
+    LONGLONG        ticks = Interval->QuadPart;
+    struct timespec delay;
+
+    UNREFERENCED_PARAMETER(WaitMode);
+    UNREFERENCED_PARAMETER(Alertable);
+
+    if (ticks > 0) {
+        ticks -= (LONGLONG)KeQueryInterruptTime();
+    } else {
+        ticks = -ticks;
+    }
+
+    if (ticks > 0) {
+        delay.tv_sec = ticks / 10000000;
+        delay.tv_nsec = (long)(ticks % 10000000) * 100;
+        nanosleep(&delay, NULL);
+    }
+
+    return STATUS_SUCCESS;
+}
+
+//
+// DbgPrint
+//
+
+static VOID
+ShimAppend(
+    PCHAR       Out,
+    size_t      OutLength,
+    size_t *    Used,
+    PCSTR       Format,
+    ...
+    )
+{
+    va_list args;
+    int     n;
+
+    if (*Used >= OutLength - 1) {
+        return;
+    }
+
+    va_start(args, Format);
+    n = vsnprintf(Out + *Used, OutLength - *Used, Format, args);
+    va_end(args);
+
+    if (n > 0) {
+        *Used = min(*Used + (size_t)n, OutLength - 1);
+    }
+}
+
+ULONG
+DbgPrint(
+    PCSTR Format,
+    ...
+    )
+/*++
+Routine Description:
+
+    Formats like the kernel does, one conversion at a time so the sizes
+    are Windows': l is 32 bits, ll and I64 are 64 bits, w or S are wide
+    strings and %p has no 0x.
+
+--*/
+{
+    CHAR        out[1024];
+    CHAR        spec[32];
+    CHAR        narrow[256];
+    size_t      used = 0;
+    size_t      specLength;
+    PCSTR       p;
+    va_list     args;
+
+    if (!ShimDebugOutput) {
+        return STATUS_SUCCESS;
+    }
+
+    va_start(args, Format);
+
+    for (p = Format; *p != '\0'; p++) {
+        BOOLEAN wide = FALSE;
+        BOOLEAN wide64 = FALSE;
+
+        if (*p != '%') {
+            if (used < sizeof(out) - 1) {
+                out[used++] = *p;
+            }
+            continue;
+        }
+
+        if (p[1] == '%') {
+            if (used < sizeof(out) - 1) {
+                out[used++] = '%';
+            }
+            p++;
+            continue;
+        }
+
+        //
+        // Flags, width and precision carry over as they are, with * read
+        // from the arguments.
+        //
+        specLength = 0;
+        spec[specLength++] = *p++;
+
+        while (*p != '\0' && strchr("-+ #0", *p) != NULL && specLength < 8) {
+            spec[specLength++] = *p++;
+        }
+
+        for (; (*p >= '0' && *p <= '9') || *p == '.' || *p == '*'; p++) {
+            if (*p == '*') {
+                specLength += snprintf(spec + specLength, sizeof(spec) - specLength, "%d", va_arg(args, int));
+            } else if (specLength < sizeof(spec) - 8) {
+                spec[specLength++] = *p;
+            }
+        }
+
+        for (;; p++) {
+            if (*p == 'l' && p[1] == 'l') {
+                wide64 = TRUE;
+                p++;
+            } else if (*p == 'I' && p[1] == '6' && p[2] == '4') {
+                wide64 = TRUE;
+                p += 2;
+            } else if (*p == 'I' && p[1] == '3' && p[2] == '2') {
+                p += 2;
+            } else if (*p == 'I') {
+                wide64 = sizeof(PVOID) == 8;
+            } else if (*p == 'w') {
+                wide = TRUE;
+            } else if (*p != 'l' && *p != 'h') {
+                break;
+            }
+        }
+
+        if (*p == '\0') {
+            break;
+        }
+
+        switch (*p) {
+        case 'd':
+        case 'i':
+            spec[specLength++] = 'l';
+            spec[specLength++] = 'l';
+            spec[specLength++] = *p;
+            spec[specLength] = '\0';
+            ShimAppend(out, sizeof(out), &used, spec,
+                       wide64 ? va_arg(args, long long) : (long long)va_arg(args, int));
+            break;
+
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+            spec[specLength++] = 'l';
+            spec[specLength++] = 'l';
+            spec[specLength++] = *p;
+            spec[specLength] = '\0';
+            ShimAppend(out, sizeof(out), &used, spec,
+                       wide64 ? va_arg(args, unsigned long long) : (unsigned long long)va_arg(args, unsigned int));
+            break;
+
+        case 'c':
+        case 'C':
+            spec[specLength++] = 'c';
+            spec[specLength] = '\0';
+            ShimAppend(out, sizeof(out), &used, spec, va_arg(args, int));
+            break;
+
+        case 'p':
+            //
+            // Zero padded hex without 0x, like the kernel prints them.
+            //
+            ShimAppend(out, sizeof(out), &used, "%0*llX",
+                       (int)(sizeof(PVOID) * 2), (unsigned long long)(ULONG_PTR)va_arg(args, PVOID));
+            break;
+
+        case 's':
+        case 'S':
+            spec[specLength++] = 's';
+            spec[specLength] = '\0';
+            if (wide || *p == 'S') {
+                PCWSTR  string = va_arg(args, PCWSTR);
+                size_t  i = 0;
+
+                if (string == NULL) {
+                    strcpy(narrow, "(null)");
+                } else {
+                    for (; string[i] != 0 && i < sizeof(narrow) - 1; i++) {
+                        narrow[i] = string[i] < 0x80 ? (CHAR)string[i] : '?';
+                    }
+                    narrow[i] = '\0';
+                }
+                ShimAppend(out, sizeof(out), &used, spec, narrow);
+            } else {
+                PCSTR string = va_arg(args, PCSTR);
+
+                ShimAppend(out, sizeof(out), &used, spec, string != NULL ? string : "(null)");
+            }
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    va_end(args);
+
+    out[used] = '\0';
+    fputs(out, stderr);
+
+    return STATUS_SUCCESS;
+}
@@ -0,0 +1,174 @@
+/*++
+
+Module Name:
+
+    shim.h
+
+Abstract:
+
+    Runs the filter in a usermode program, for profiling its dispatch and
+    completion routines on Linux. The headers in this directory stand in
+    for the WDK's, so filter.c and its modules build unmodified with
+
+        cc -D_KERNEL_MODE -Ikmdf/filter/usermode -Ikmdf/filter/generic -Iinc
+
+    and link against shim.c instead of the framework.
+
+    The program plays the PnP manager, the driver above and the driver
+    below. It loads the driver through DriverEntry and adds a filter device
+    per adapter with ShimAddDevice. URBs it submits with ShimSubmitUrb go
+    to the filter's internal device control callback like they would from
+    the bluetooth stack, and whatever the filter sends down ends up in the
+    device's SHIM_LOWER_SEND. The lower either completes the request right
+    away or holds on to it, in both cases through ShimCompleteLowerRequest,
+    which runs the filter's completion routine. When the filter completes
+    a submitted URB, the device's SHIM_UPPER_COMPLETE gets it.
+
+    Timers don't fire on their own, the program runs the due ones with
+    ShimRunTimers, and can pin the interrupt time to replay captures.
+
+    URBs the filter parks in a manual queue stay there until it retrieves
+    them, deleting the queue cancels the ones left.
+
+    The shim is as thread safe as the framework for what the filter does,
+    so several threads can submit URBs to a device at once.
+
+Environment:
+
+    usermode, POSIX
+
+--*/
+
+#if !defined(_SHIM_H_)
+#define _SHIM_H_
+
+#include <ntddk.h>
+#include <wdf.h>
+#include "usbdrivr.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+//
+// DbgPrint and KdPrint write to stderr once this is set.
+//
+extern BOOLEAN ShimDebugOutput;
+
+//
+// Called when the filter sends Request down to the adapter, Urb is the URB
+// on its stack location. Returns FALSE to fail the send, the request is
+// then still the filter's. Otherwise the request belongs to the lower
+// until it is passed to ShimCompleteLowerRequest, which may be done from
+// here.
+//
+typedef BOOLEAN SHIM_LOWER_SEND(PVOID Context, WDFREQUEST Request, PURB Urb);
+
+//
+// Called when the filter completes a URB submitted with ShimSubmitUrb.
+//
+typedef VOID SHIM_UPPER_COMPLETE(PVOID Context, PURB Urb, NTSTATUS Status);
+
+typedef struct _SHIM_DEVICE_CONFIG {
+
+    PCSTR                   HardwareId;     // first string of the hardware IDs, NULL for none
+    SHIM_LOWER_SEND *       LowerSend;
+    SHIM_UPPER_COMPLETE *   UpperComplete;
+    PVOID                   Context;        // passed to both callbacks
+
+} SHIM_DEVICE_CONFIG, *PSHIM_DEVICE_CONFIG;
+
+NTSTATUS
+ShimLoadDriver(
+    DRIVER_INITIALIZE * DriverEntry
+    );
+
+VOID
+ShimUnloadDriver(
+    VOID
+    );
+
+NTSTATUS
+ShimAddDevice(
+    PSHIM_DEVICE_CONFIG Config,
+    WDFDEVICE *         Device
+    );
+
+VOID
+ShimRemoveDevice(
+    WDFDEVICE Device
+    );
+
+//
+// Sends Urb down the device stack. Its completion is reported to the
+// device's SHIM_UPPER_COMPLETE, which may run before this returns.
+//
+NTSTATUS
+ShimSubmitUrb(
+    WDFDEVICE   Device,
+    PURB        Urb
+    );
+
+VOID
+ShimCompleteLowerRequest(
+    WDFREQUEST  Request,
+    NTSTATUS    Status
+    );
+
+//
+// A handle on the control device. Device I/O control is buffered, Output
+// gets the bytes the filter returned.
+//
+typedef struct _SHIM_OBJECT *SHIM_HANDLE;
+
+NTSTATUS
+ShimOpenControl(
+    SHIM_HANDLE * Handle
+    );
+
+VOID
+ShimCloseControl(
+    SHIM_HANDLE Handle
+    );
+
+NTSTATUS
+ShimDeviceIoControl(
+    SHIM_HANDLE Handle,
+    ULONG       IoControlCode,
+    PVOID       Input,
+    ULONG       InputLength,
+    PVOID       Output,
+    ULONG       OutputLength,
+    PULONG      BytesReturned
+    );
+
+//
+// Pins KeQueryInterruptTime at Time, 100ns units, 0 lets it follow the
+// monotonic clock again.
+//
+VOID
+ShimSetInterruptTime(
+    ULONGLONG Time
+    );
+
+//
+// Runs the timers due by now, returns how many ran.
+//
+ULONG
+ShimRunTimers(
+    VOID
+    );
+
+//
+// Interrupt time the next timer is due at, 0 when none is started.
+//
+ULONGLONG
+ShimNextTimerDue(
+    VOID
+    );
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -0,0 +1,168 @@
+/*++
+
+Module Name:
+
+    usbdrivr.h
+
+Abstract:
+
+    Usermode stand-in for the URBs of the WDK's usbdrivr.h the filter
+    handles, laid out like the real ones, see shim.h.
+
+Environment:
+
+    usermode, gcc or clang
+
+--*/
+
+#if !defined(_SHIM_USBDRIVR_H_)
+#define _SHIM_USBDRIVR_H_
+
+#include <ntddk.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+#define FILE_DEVICE_USB                 FILE_DEVICE_UNKNOWN
+#define USB_SUBMIT_URB                  0
+
+#define IOCTL_INTERNAL_USB_SUBMIT_URB   CTL_CODE(FILE_DEVICE_USB, USB_SUBMIT_URB, METHOD_NEITHER, FILE_ANY_ACCESS)
+
+#define URB_FUNCTION_SELECT_CONFIGURATION           0x0000
+#define URB_FUNCTION_BULK_OR_INTERRUPT_TRANSFER     0x0009
+#define URB_FUNCTION_CLASS_DEVICE                   0x001A
+
+#define USBD_TRANSFER_DIRECTION_OUT     0
+#define USBD_TRANSFER_DIRECTION_IN      1
+#define USBD_SHORT_TRANSFER_OK          2
+
+typedef LONG USBD_STATUS;
+
+#define USBD_STATUS_SUCCESS             ((USBD_STATUS)0x00000000L)
+#define USBD_STATUS_CANCELED            ((USBD_STATUS)0xC0010000L)
+
+#define USB_ENDPOINT_DIRECTION_MASK     0x80
+#define USB_ENDPOINT_DIRECTION_OUT(x)   (!((x) & USB_ENDPOINT_DIRECTION_MASK))
+#define USB_ENDPOINT_DIRECTION_IN(x)    ((x) & USB_ENDPOINT_DIRECTION_MASK)
+
+typedef PVOID USBD_PIPE_HANDLE;
+typedef PVOID USBD_CONFIGURATION_HANDLE;
+typedef PVOID USBD_INTERFACE_HANDLE;
+
+typedef enum _USBD_PIPE_TYPE {
+    UsbdPipeTypeControl,
+    UsbdPipeTypeIsochronous,
+    UsbdPipeTypeBulk,
+    UsbdPipeTypeInterrupt
+} USBD_PIPE_TYPE;
+
+#pragma pack(push, 1)
+typedef struct _USB_CONFIGURATION_DESCRIPTOR {
+    UCHAR   bLength;
+    UCHAR   bDescriptorType;
+    USHORT  wTotalLength;
+    UCHAR   bNumInterfaces;
+    UCHAR   bConfigurationValue;
+    UCHAR   iConfiguration;
+    UCHAR   bmAttributes;
+    UCHAR   MaxPower;
+} USB_CONFIGURATION_DESCRIPTOR, *PUSB_CONFIGURATION_DESCRIPTOR;
+#pragma pack(pop)
+
+typedef struct _USBD_PIPE_INFORMATION {
+    USHORT              MaximumPacketSize;
+    UCHAR               EndpointAddress;
+    UCHAR               Interval;
+    USBD_PIPE_TYPE      PipeType;
+    USBD_PIPE_HANDLE    PipeHandle;
+    ULONG               MaximumTransferSize;
+    ULONG               PipeFlags;
+} USBD_PIPE_INFORMATION, *PUSBD_PIPE_INFORMATION;
+
+typedef struct _USBD_INTERFACE_INFORMATION {
+    USHORT                  Length;     // of this structure and its pipes
+    UCHAR                   InterfaceNumber;
+    UCHAR                   AlternateSetting;
+    UCHAR                   Class;
+    UCHAR                   SubClass;
+    UCHAR                   Protocol;
+    UCHAR                   Reserved;
+    USBD_INTERFACE_HANDLE   InterfaceHandle;
+    ULONG                   NumberOfPipes;
+    USBD_PIPE_INFORMATION   Pipes[1];
+} USBD_INTERFACE_INFORMATION, *PUSBD_INTERFACE_INFORMATION;
+
+#define GET_USBD_INTERFACE_SIZE(numEndpoints) \
+    (sizeof(USBD_INTERFACE_INFORMATION) + sizeof(USBD_PIPE_INFORMATION) * (numEndpoints) - sizeof(USBD_PIPE_INFORMATION))
+
+struct _URB_HEADER {
+    USHORT      Length;
+    USHORT      Function;
+    USBD_STATUS Status;
+    PVOID       UsbdDeviceHandle;
+    ULONG       UsbdFlags;
+};
+
+struct _URB_HCD_AREA {
+    PVOID   Reserved8[8];
+};
+
+struct _URB_SELECT_CONFIGURATION {
+    struct _URB_HEADER              Hdr;
+    PUSB_CONFIGURATION_DESCRIPTOR   ConfigurationDescriptor;
+    USBD_CONFIGURATION_HANDLE       ConfigurationHandle;
+    USBD_INTERFACE_INFORMATION      Interface;
+};
+
+struct _URB_BULK_OR_INTERRUPT_TRANSFER {
+    struct _URB_HEADER      Hdr;
+    USBD_PIPE_HANDLE        PipeHandle;
+    ULONG                   TransferFlags;
+    ULONG                   TransferBufferLength;
+    PVOID                   TransferBuffer;
+    PMDL                    TransferBufferMDL;
+    struct _URB *           UrbLink;
+    struct _URB_HCD_AREA    hca;
+};
+
+struct _URB_CONTROL_VENDOR_OR_CLASS_REQUEST {
+    struct _URB_HEADER      Hdr;
+    PVOID                   Reserved;
+    ULONG                   TransferFlags;
+    ULONG                   TransferBufferLength;
+    PVOID                   TransferBuffer;
+    PMDL                    TransferBufferMDL;
+    struct _URB *           UrbLink;
+    struct _URB_HCD_AREA    hca;
+    UCHAR                   RequestTypeReservedBits;
+    UCHAR                   Request;
+    USHORT                  Value;
+    USHORT                  Index;
+    USHORT                  Reserved1;
+};
+
+typedef struct _URB {
+    union {
+        struct _URB_HEADER                          UrbHeader;
+        struct _URB_SELECT_CONFIGURATION            UrbSelectConfiguration;
+        struct _URB_BULK_OR_INTERRUPT_TRANSFER      UrbBulkOrInterruptTransfer;
+        struct _URB_CONTROL_VENDOR_OR_CLASS_REQUEST UrbControlVendorClassRequest;
+    };
+} URB, *PURB;
+
+#define UsbBuildInterruptOrBulkTransferRequest(urb, length, pipeHandle, transferBuffer, transferBufferMDL, transferBufferLength, transferFlags, link) { \
+    (urb)->UrbHeader.Function = URB_FUNCTION_BULK_OR_INTERRUPT_TRANSFER;   \
+    (urb)->UrbHeader.Length = (length);                                     \
+    (urb)->UrbBulkOrInterruptTransfer.PipeHandle = (pipeHandle);            \
+    (urb)->UrbBulkOrInterruptTransfer.TransferBufferLength = (transferBufferLength); \
+    (urb)->UrbBulkOrInterruptTransfer.TransferBufferMDL = (transferBufferMDL); \
+    (urb)->UrbBulkOrInterruptTransfer.TransferBuffer = (transferBuffer);    \
+    (urb)->UrbBulkOrInterruptTransfer.TransferFlags = (transferFlags);      \
+    (urb)->UrbBulkOrInterruptTransfer.UrbLink = (link); }
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -0,0 +1,586 @@
+/*++
+
+Module Name:
+
+    wdf.h
+
+Abstract:
+
+    Usermode stand-in for the part of KMDF the filter uses, see shim.h for
+    how a program drives it. Objects have a parent, an optional context and
+    cleanup callback, and are deleted with their children. Requests carry
+    one stack location, the filter's and the lower device's are the same.
+
+Environment:
+
+    usermode, gcc or clang
+
+--*/
+
+#if !defined(_SHIM_WDF_H_)
+#define _SHIM_WDF_H_
+
+#include <ntddk.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+typedef struct _SHIM_OBJECT *WDFOBJECT, *WDFDRIVER, *WDFDEVICE, *WDFQUEUE,
+                            *WDFREQUEST, *WDFIOTARGET, *WDFCOLLECTION,
+                            *WDFWAITLOCK, *WDFMEMORY, *WDFTIMER, *WDFFILEOBJECT;
+
+typedef PVOID WDFCONTEXT;
+
+typedef struct _WDFDEVICE_INIT *PWDFDEVICE_INIT;
+
+#define WDF_NO_OBJECT_ATTRIBUTES    NULL
+#define WDF_NO_HANDLE               NULL
+#define WDF_NO_CONTEXT              NULL
+#define WDF_NO_SEND_OPTIONS         NULL
+#define WDF_NO_EVENT_CALLBACK       NULL
+
+//
+// Object attributes and contexts
+//
+typedef struct _WDF_OBJECT_CONTEXT_TYPE_INFO {
+    ULONG   Size;
+    PCSTR   ContextName;
+    size_t  ContextSize;
+} WDF_OBJECT_CONTEXT_TYPE_INFO, *PWDF_OBJECT_CONTEXT_TYPE_INFO;
+
+typedef const WDF_OBJECT_CONTEXT_TYPE_INFO *PCWDF_OBJECT_CONTEXT_TYPE_INFO;
+
+typedef VOID EVT_WDF_OBJECT_CONTEXT_CLEANUP(WDFOBJECT Object);
+typedef VOID EVT_WDF_OBJECT_CONTEXT_DESTROY(WDFOBJECT Object);
+
+typedef EVT_WDF_OBJECT_CONTEXT_CLEANUP *PFN_WDF_OBJECT_CONTEXT_CLEANUP;
+typedef EVT_WDF_OBJECT_CONTEXT_DESTROY *PFN_WDF_OBJECT_CONTEXT_DESTROY;
+
+typedef struct _WDF_OBJECT_ATTRIBUTES {
+    ULONG                           Size;
+    PFN_WDF_OBJECT_CONTEXT_CLEANUP  EvtCleanupCallback;
+    PFN_WDF_OBJECT_CONTEXT_DESTROY  EvtDestroyCallback;
+    WDFOBJECT                       ParentObject;
+    size_t                          ContextSizeOverride;
+    PCWDF_OBJECT_CONTEXT_TYPE_INFO  ContextTypeInfo;
+} WDF_OBJECT_ATTRIBUTES, *PWDF_OBJECT_ATTRIBUTES;
+
+FORCEINLINE VOID
+WDF_OBJECT_ATTRIBUTES_INIT(PWDF_OBJECT_ATTRIBUTES Attributes)
+{
+    RtlZeroMemory(Attributes, sizeof(WDF_OBJECT_ATTRIBUTES));
+    Attributes->Size = sizeof(WDF_OBJECT_ATTRIBUTES);
+}
+
+#define WDF_GET_CONTEXT_TYPE_INFO(_contexttype) (&_WDF_##_contexttype##_TYPE_INFO)
+
+#define WDF_OBJECT_ATTRIBUTES_INIT_CONTEXT_TYPE(_attributes, _contexttype) \
+    (WDF_OBJECT_ATTRIBUTES_INIT(_attributes), \
+     (_attributes)->ContextTypeInfo = WDF_GET_CONTEXT_TYPE_INFO(_contexttype))
+
+PVOID
+WdfObjectGetTypedContextWorker(
+    WDFOBJECT                       Handle,
+    PCWDF_OBJECT_CONTEXT_TYPE_INFO  TypeInfo
+    );
+
+//
+// Every file gets its own type info, contexts are matched by name.
+//
+#define WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(_contexttype, _castingfunction) \
+    static const WDF_OBJECT_CONTEXT_TYPE_INFO _WDF_##_contexttype##_TYPE_INFO = \
+        { sizeof(WDF_OBJECT_CONTEXT_TYPE_INFO), #_contexttype, sizeof(_contexttype) }; \
+    static inline _contexttype * \
+    _castingfunction(WDFOBJECT Handle) \
+    { \
+        return (_contexttype *)WdfObjectGetTypedContextWorker(Handle, WDF_GET_CONTEXT_TYPE_INFO(_contexttype)); \
+    }
+
+#define WDF_DECLARE_CONTEXT_TYPE(_contexttype) \
+    WDF_DECLARE_CONTEXT_TYPE_WITH_NAME(_contexttype, WdfObjectGet_##_contexttype)
+
+VOID
+WdfObjectDelete(
+    WDFOBJECT Object
+    );
+
+//
+// Nothing is freed behind the driver's back, so references only have to
+// pair up.
+//
+#define WdfObjectReference(Handle)      UNREFERENCED_PARAMETER(Handle)
+#define WdfObjectDereference(Handle)    UNREFERENCED_PARAMETER(Handle)
+
+//
+// Driver
+//
+typedef NTSTATUS EVT_WDF_DRIVER_DEVICE_ADD(WDFDRIVER Driver, PWDFDEVICE_INIT DeviceInit);
+typedef VOID EVT_WDF_DRIVER_UNLOAD(WDFDRIVER Driver);
+
+typedef struct _WDF_DRIVER_CONFIG {
+    ULONG                       Size;
+    EVT_WDF_DRIVER_DEVICE_ADD * EvtDriverDeviceAdd;
+    EVT_WDF_DRIVER_UNLOAD *     EvtDriverUnload;
+    ULONG                       DriverInitFlags;
+    ULONG                       DriverPoolTag;
+} WDF_DRIVER_CONFIG, *PWDF_DRIVER_CONFIG;
+
+FORCEINLINE VOID
+WDF_DRIVER_CONFIG_INIT(PWDF_DRIVER_CONFIG Config, EVT_WDF_DRIVER_DEVICE_ADD *EvtDriverDeviceAdd)
+{
+    RtlZeroMemory(Config, sizeof(WDF_DRIVER_CONFIG));
+    Config->Size = sizeof(WDF_DRIVER_CONFIG);
+    Config->EvtDriverDeviceAdd = EvtDriverDeviceAdd;
+}
+
+NTSTATUS
+WdfDriverCreate(
+    PDRIVER_OBJECT          DriverObject,
+    PCUNICODE_STRING        RegistryPath,
+    PWDF_OBJECT_ATTRIBUTES  DriverAttributes,
+    PWDF_DRIVER_CONFIG      DriverConfig,
+    WDFDRIVER *             Driver
+    );
+
+//
+// Devices
+//
+typedef VOID EVT_WDF_DEVICE_CONTEXT_CLEANUP(WDFOBJECT Device);
+
+typedef VOID EVT_WDF_DEVICE_FILE_CREATE(WDFDEVICE Device, WDFREQUEST Request, WDFFILEOBJECT FileObject);
+typedef VOID EVT_WDF_FILE_CLOSE(WDFFILEOBJECT FileObject);
+typedef VOID EVT_WDF_FILE_CLEANUP(WDFFILEOBJECT FileObject);
+
+typedef struct _WDF_FILEOBJECT_CONFIG {
+    ULONG                           Size;
+    EVT_WDF_DEVICE_FILE_CREATE *    EvtDeviceFileCreate;
+    EVT_WDF_FILE_CLOSE *            EvtFileClose;
+    EVT_WDF_FILE_CLEANUP *          EvtFileCleanup;
+} WDF_FILEOBJECT_CONFIG, *PWDF_FILEOBJECT_CONFIG;
+
+FORCEINLINE VOID
+WDF_FILEOBJECT_CONFIG_INIT(
+    PWDF_FILEOBJECT_CONFIG          FileEventCallbacks,
+    EVT_WDF_DEVICE_FILE_CREATE *    EvtDeviceFileCreate,
+    EVT_WDF_FILE_CLOSE *            EvtFileClose,
+    EVT_WDF_FILE_CLEANUP *          EvtFileCleanup
+    )
+{
+    RtlZeroMemory(FileEventCallbacks, sizeof(WDF_FILEOBJECT_CONFIG));
+    FileEventCallbacks->Size = sizeof(WDF_FILEOBJECT_CONFIG);
+    FileEventCallbacks->EvtDeviceFileCreate = EvtDeviceFileCreate;
+    FileEventCallbacks->EvtFileClose = EvtFileClose;
+    FileEventCallbacks->EvtFileCleanup = EvtFileCleanup;
+}
+
+VOID
+WdfFdoInitSetFilter(
+    PWDFDEVICE_INIT DeviceInit
+    );
+
+NTSTATUS
+WdfFdoInitQueryProperty(
+    PWDFDEVICE_INIT             DeviceInit,
+    DEVICE_REGISTRY_PROPERTY    DeviceProperty,
+    ULONG                       BufferLength,
+    PVOID                       PropertyBuffer,
+    PULONG                      ResultLength
+    );
+
+VOID
+WdfDeviceInitSetRequestAttributes(
+    PWDFDEVICE_INIT         DeviceInit,
+    PWDF_OBJECT_ATTRIBUTES  RequestAttributes
+    );
+
+VOID
+WdfDeviceInitSetFileObjectConfig(
+    PWDFDEVICE_INIT         DeviceInit,
+    PWDF_FILEOBJECT_CONFIG  FileObjectConfig,
+    PWDF_OBJECT_ATTRIBUTES  FileObjectAttributes
+    );
+
+VOID
+WdfDeviceInitSetExclusive(
+    PWDFDEVICE_INIT DeviceInit,
+    BOOLEAN         IsExclusive
+    );
+
+NTSTATUS
+WdfDeviceInitAssignName(
+    PWDFDEVICE_INIT     DeviceInit,
+    PCUNICODE_STRING    DeviceName
+    );
+
+PWDFDEVICE_INIT
+WdfControlDeviceInitAllocate(
+    WDFDRIVER           Driver,
+    PCUNICODE_STRING    SDDLString
+    );
+
+VOID
+WdfDeviceInitFree(
+    PWDFDEVICE_INIT DeviceInit
+    );
+
+NTSTATUS
+WdfDeviceCreate(
+    PWDFDEVICE_INIT *       DeviceInit,
+    PWDF_OBJECT_ATTRIBUTES  DeviceAttributes,
+    WDFDEVICE *             Device
+    );
+
+NTSTATUS
+WdfDeviceCreateSymbolicLink(
+    WDFDEVICE           Device,
+    PCUNICODE_STRING    SymbolicLinkName
+    );
+
+VOID
+WdfControlFinishInitializing(
+    WDFDEVICE Device
+    );
+
+WDFDRIVER
+WdfDeviceGetDriver(
+    WDFDEVICE Device
+    );
+
+WDFIOTARGET
+WdfDeviceGetIoTarget(
+    WDFDEVICE Device
+    );
+
+WDFDEVICE
+WdfFileObjectGetDevice(
+    WDFFILEOBJECT FileObject
+    );
+
+//
+// Queues
+//
+typedef VOID EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL(WDFQUEUE Queue, WDFREQUEST Request, size_t OutputBufferLength, size_t InputBufferLength, ULONG IoControlCode);
+typedef VOID EVT_WDF_IO_QUEUE_IO_INTERNAL_DEVICE_CONTROL(WDFQUEUE Queue, WDFREQUEST Request, size_t OutputBufferLength, size_t InputBufferLength, ULONG IoControlCode);
+
+typedef enum _WDF_IO_QUEUE_DISPATCH_TYPE {
+    WdfIoQueueDispatchInvalid = 0,
+    WdfIoQueueDispatchSequential,
+    WdfIoQueueDispatchParallel,
+    WdfIoQueueDispatchManual
+} WDF_IO_QUEUE_DISPATCH_TYPE;
+
+typedef struct _WDF_IO_QUEUE_CONFIG {
+    ULONG                                           Size;
+    WDF_IO_QUEUE_DISPATCH_TYPE                      DispatchType;
+    BOOLEAN                                         PowerManaged;
+    BOOLEAN                                         DefaultQueue;
+    EVT_WDF_IO_QUEUE_IO_DEVICE_CONTROL *            EvtIoDeviceControl;
+    EVT_WDF_IO_QUEUE_IO_INTERNAL_DEVICE_CONTROL *   EvtIoInternalDeviceControl;
+} WDF_IO_QUEUE_CONFIG, *PWDF_IO_QUEUE_CONFIG;
+
+FORCEINLINE VOID
+WDF_IO_QUEUE_CONFIG_INIT_DEFAULT_QUEUE(PWDF_IO_QUEUE_CONFIG Config, WDF_IO_QUEUE_DISPATCH_TYPE DispatchType)
+{
+    RtlZeroMemory(Config, sizeof(WDF_IO_QUEUE_CONFIG));
+    Config->Size = sizeof(WDF_IO_QUEUE_CONFIG);
+    Config->DispatchType = DispatchType;
+    Config->PowerManaged = TRUE;
+    Config->DefaultQueue = TRUE;
+}
+
+FORCEINLINE VOID
+WDF_IO_QUEUE_CONFIG_INIT(PWDF_IO_QUEUE_CONFIG Config, WDF_IO_QUEUE_DISPATCH_TYPE DispatchType)
+{
+    RtlZeroMemory(Config, sizeof(WDF_IO_QUEUE_CONFIG));
+    Config->Size = sizeof(WDF_IO_QUEUE_CONFIG);
+    Config->DispatchType = DispatchType;
+    Config->PowerManaged = TRUE;
+}
+
+NTSTATUS
+WdfIoQueueCreate(
+    WDFDEVICE               Device,
+    PWDF_IO_QUEUE_CONFIG    Config,
+    PWDF_OBJECT_ATTRIBUTES  QueueAttributes,
+    WDFQUEUE *              Queue
+    );
+
+WDFDEVICE
+WdfIoQueueGetDevice(
+    WDFQUEUE Queue
+    );
+
+//
+// Only manual queues hold requests, and only a request from above can be
+// forwarded to one. The parameters filter of WdfIoQueueFindRequest isn't
+// supported and must be NULL.
+//
+NTSTATUS
+WdfRequestForwardToIoQueue(
+    WDFREQUEST  Request,
+    WDFQUEUE    DestinationQueue
+    );
+
+NTSTATUS
+WdfIoQueueFindRequest(
+    WDFQUEUE        Queue,
+    WDFREQUEST      FoundRequest,
+    WDFFILEOBJECT   FileObject,
+    PVOID           Parameters,
+    WDFREQUEST *    OutRequest
+    );
+
+NTSTATUS
+WdfIoQueueRetrieveFoundRequest(
+    WDFQUEUE        Queue,
+    WDFREQUEST      FoundRequest,
+    WDFREQUEST *    OutRequest
+    );
+
+//
+// Requests
+//
+typedef enum _WDF_REQUEST_TYPE {
+    WdfRequestTypeCreate = 0x0,
+    WdfRequestTypeDeviceControl = 0xE,
+    WdfRequestTypeDeviceControlInternal = 0xF
+} WDF_REQUEST_TYPE;
+
+typedef struct _WDF_REQUEST_COMPLETION_PARAMS {
+    ULONG               Size;
+    WDF_REQUEST_TYPE    Type;
+    IO_STATUS_BLOCK     IoStatus;
+} WDF_REQUEST_COMPLETION_PARAMS, *PWDF_REQUEST_COMPLETION_PARAMS;
+
+typedef VOID EVT_WDF_REQUEST_COMPLETION_ROUTINE(WDFREQUEST Request, WDFIOTARGET Target, PWDF_REQUEST_COMPLETION_PARAMS Params, WDFCONTEXT Context);
+
+typedef EVT_WDF_REQUEST_COMPLETION_ROUTINE *PFN_WDF_REQUEST_COMPLETION_ROUTINE;
+
+#define WDF_REQUEST_SEND_OPTION_TIMEOUT             0x00000001
+#define WDF_REQUEST_SEND_OPTION_SYNCHRONOUS         0x00000002
+#define WDF_REQUEST_SEND_OPTION_IGNORE_TARGET_STATE 0x00000004
+#define WDF_REQUEST_SEND_OPTION_SEND_AND_FORGET     0x00000008
+
+typedef struct _WDF_REQUEST_SEND_OPTIONS {
+    ULONG       Size;
+    ULONG       Flags;
+    LONGLONG    Timeout;
+} WDF_REQUEST_SEND_OPTIONS, *PWDF_REQUEST_SEND_OPTIONS;
+
+FORCEINLINE VOID
+WDF_REQUEST_SEND_OPTIONS_INIT(PWDF_REQUEST_SEND_OPTIONS Options, ULONG Flags)
+{
+    RtlZeroMemory(Options, sizeof(WDF_REQUEST_SEND_OPTIONS));
+    Options->Size = sizeof(WDF_REQUEST_SEND_OPTIONS);
+    Options->Flags = Flags;
+}
+
+NTSTATUS
+WdfRequestCreate(
+    PWDF_OBJECT_ATTRIBUTES  RequestAttributes,
+    WDFIOTARGET             IoTarget,
+    WDFREQUEST *            Request
+    );
+
+PIRP
+WdfRequestWdmGetIrp(
+    WDFREQUEST Request
+    );
+
+WDFFILEOBJECT
+WdfRequestGetFileObject(
+    WDFREQUEST Request
+    );
+
+NTSTATUS
+WdfRequestRetrieveInputBuffer(
+    WDFREQUEST  Request,
+    size_t      MinimumRequiredSize,
+    PVOID *     Buffer,
+    size_t *    Length
+    );
+
+NTSTATUS
+WdfRequestRetrieveOutputBuffer(
+    WDFREQUEST  Request,
+    size_t      MinimumRequiredSize,
+    PVOID *     Buffer,
+    size_t *    Length
+    );
+
+VOID
+WdfRequestFormatRequestUsingCurrentType(
+    WDFREQUEST Request
+    );
+
+VOID
+WdfRequestSetCompletionRoutine(
+    WDFREQUEST                          Request,
+    PFN_WDF_REQUEST_COMPLETION_ROUTINE  CompletionRoutine,
+    WDFCONTEXT                          CompletionContext
+    );
+
+BOOLEAN
+WdfRequestSend(
+    WDFREQUEST                  Request,
+    WDFIOTARGET                 Target,
+    PWDF_REQUEST_SEND_OPTIONS   Options
+    );
+
+NTSTATUS
+WdfRequestGetStatus(
+    WDFREQUEST Request
+    );
+
+VOID
+WdfRequestComplete(
+    WDFREQUEST  Request,
+    NTSTATUS    Status
+    );
+
+VOID
+WdfRequestCompleteWithInformation(
+    WDFREQUEST  Request,
+    NTSTATUS    Status,
+    ULONG_PTR   Information
+    );
+
+//
+// I/O targets and memory
+//
+typedef struct _WDFMEMORY_OFFSET {
+    size_t  BufferOffset;
+    size_t  BufferLength;
+} WDFMEMORY_OFFSET, *PWDFMEMORY_OFFSET;
+
+NTSTATUS
+WdfMemoryCreate(
+    PWDF_OBJECT_ATTRIBUTES  Attributes,
+    POOL_TYPE               PoolType,
+    ULONG                   PoolTag,
+    size_t                  BufferSize,
+    WDFMEMORY *             Memory,
+    PVOID *                 Buffer
+    );
+
+NTSTATUS
+WdfIoTargetFormatRequestForInternalIoctlOthers(
+    WDFIOTARGET         IoTarget,
+    WDFREQUEST          Request,
+    ULONG               IoctlCode,
+    WDFMEMORY           OtherArg1,
+    PWDFMEMORY_OFFSET   OtherArg1Offset,
+    WDFMEMORY           OtherArg2,
+    PWDFMEMORY_OFFSET   OtherArg2Offset,
+    WDFMEMORY           OtherArg4,
+    PWDFMEMORY_OFFSET   OtherArg4Offset
+    );
+
+WDFDEVICE
+WdfIoTargetGetDevice(
+    WDFIOTARGET IoTarget
+    );
+
+//
+// Collections and wait locks
+//
+NTSTATUS
+WdfCollectionCreate(
+    PWDF_OBJECT_ATTRIBUTES  CollectionAttributes,
+    WDFCOLLECTION *         Collection
+    );
+
+NTSTATUS
+WdfCollectionAdd(
+    WDFCOLLECTION   Collection,
+    WDFOBJECT       Object
+    );
+
+VOID
+WdfCollectionRemove(
+    WDFCOLLECTION   Collection,
+    WDFOBJECT       Item
+    );
+
+ULONG
+WdfCollectionGetCount(
+    WDFCOLLECTION Collection
+    );
+
+WDFOBJECT
+WdfCollectionGetItem(
+    WDFCOLLECTION   Collection,
+    ULONG           Index
+    );
+
+NTSTATUS
+WdfWaitLockCreate(
+    PWDF_OBJECT_ATTRIBUTES  LockAttributes,
+    WDFWAITLOCK *           Lock
+    );
+
+NTSTATUS
+WdfWaitLockAcquire(
+    WDFWAITLOCK Lock,
+    PLONGLONG   Timeout
+    );
+
+VOID
+WdfWaitLockRelease(
+    WDFWAITLOCK Lock
+    );
+
+//
+// Timers only fire from ShimRunTimers.
+//
+typedef VOID EVT_WDF_TIMER(WDFTIMER Timer);
+
+typedef struct _WDF_TIMER_CONFIG {
+    ULONG           Size;
+    EVT_WDF_TIMER * EvtTimerFunc;
+    ULONG           Period;
+    BOOLEAN         AutomaticSerialization;
+    ULONG           TolerableDelay;
+} WDF_TIMER_CONFIG, *PWDF_TIMER_CONFIG;
+
+FORCEINLINE VOID
+WDF_TIMER_CONFIG_INIT(PWDF_TIMER_CONFIG Config, EVT_WDF_TIMER *EvtTimerFunc)
+{
+    RtlZeroMemory(Config, sizeof(WDF_TIMER_CONFIG));
+    Config->Size = sizeof(WDF_TIMER_CONFIG);
+    Config->EvtTimerFunc = EvtTimerFunc;
+    Config->AutomaticSerialization = TRUE;
+}
+
+#define WDF_REL_TIMEOUT_IN_MS(Time) (-((LONGLONG)(Time) * 10000))
+
+NTSTATUS
+WdfTimerCreate(
+    PWDF_TIMER_CONFIG       Config,
+    PWDF_OBJECT_ATTRIBUTES  Attributes,
+    WDFTIMER *              Timer
+    );
+
+BOOLEAN
+WdfTimerStart(
+    WDFTIMER    Timer,
+    LONGLONG    DueTime
+    );
+
+BOOLEAN
+WdfTimerStop(
+    WDFTIMER    Timer,
+    BOOLEAN     Wait
+    );
+
+WDFOBJECT
+WdfTimerGetParentObject(
+    WDFTIMER Timer
+    );
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif
@@ -0,0 +1,33 @@
+/*++
+
+Module Name:
+
+    wdmsec.h
+
+Abstract:
+
+    Usermode stand-in for the WDK's wdmsec.h, see shim.h. The control
+    device isn't secured, the SDDL strings are only names.
+
+Environment:
+
+    usermode, gcc or clang
+
+--*/
+
+#if !defined(_SHIM_WDMSEC_H_)
+#define _SHIM_WDMSEC_H_
+
+#include <ntddk.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+extern const UNICODE_STRING SDDL_DEVOBJ_SYS_ALL_ADM_RWX_WORLD_RW_RES_R;
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif